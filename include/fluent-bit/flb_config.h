@@ -100,10 +100,15 @@ struct flb_config {
 
     /* Outputs instances */
     struct mk_list outputs;             /* list of output plugins   */
+    int routes_mask_size;               /* routes mask elements     */
 
     /* Filter instances */
     struct mk_list filters;
 
+    /* Compiled routing rules and cache of routes by Tag */
+    struct flb_router *router;
+    int router_cache_size;
+
     struct mk_event_loop *evl;          /* the event loop (mk_core) */
 
     /* Proxies */
@@ -153,6 +158,11 @@ struct flb_config {
     int   storage_checksum;         /* checksum enabled */
     int   storage_max_chunks_up;    /* max number of chunks 'up' in memory */
     char *storage_bl_mem_limit;     /* storage backlog memory limit */
+    char *storage_backend;          /* filesystem layout: file, segment */
+    char *storage_segment_size;     /* preallocated segment file size */
+    int   storage_commit_interval;  /* group commit window (milliseconds) */
+    char *storage_commit_bytes;     /* group commit early size limit */
+    char *storage_compression;      /* compression of locked chunks */
     struct flb_storage_metrics *storage_metrics_ctx; /* storage metrics context */
 
     /* Embedded SQL Database support (SQLite3) */
@@ -190,7 +200,11 @@ struct flb_config {
 
     void *sched;
 
-    struct flb_task_map tasks_map[2048];
+    /* Tasks map, indexed by task id */
+    struct flb_task_map *tasks_map;
+    int tasks_map_size;                 /* number of slots              */
+    int tasks_map_free;                 /* first free slot or -1        */
+    int tasks_max;                      /* concurrent tasks, 0: no limit */
 };
 
 #define FLB_CONFIG_LOG_LEVEL(c) (c->log->level)
@@ -244,8 +258,19 @@ enum conf_type {
 #define FLB_CONF_STORAGE_CHECKSUM      "storage.checksum"
 #define FLB_CONF_STORAGE_BL_MEM_LIMIT  "storage.backlog.mem_limit"
 #define FLB_CONF_STORAGE_MAX_CHUNKS_UP "storage.max_chunks_up"
+#define FLB_CONF_STORAGE_BACKEND       "storage.backend"
+#define FLB_CONF_STORAGE_SEGMENT_SIZE  "storage.segment_size"
+#define FLB_CONF_STORAGE_COMMIT_INTERVAL "storage.commit_interval"
+#define FLB_CONF_STORAGE_COMMIT_BYTES  "storage.commit_bytes"
+#define FLB_CONF_STORAGE_COMPRESSION   "storage.compression"
 
 /* Coroutines */
 #define FLB_CONF_STR_CORO_STACK_SIZE "Coro_Stack_Size"
 
+/* Router */
+#define FLB_CONF_ROUTER_CACHE_SIZE   "router.cache_size"
+
+/* Tasks */
+#define FLB_CONF_TASKS_MAX           "tasks.max"
+
 #endif
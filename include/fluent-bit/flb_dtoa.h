@@ -0,0 +1,48 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_DTOA_H
+#define FLB_DTOA_H
+
+#include <fluent-bit/flb_info.h>
+#include <stdint.h>
+
+/* Enough room for any number written by flb_u64toa() or flb_dtoa() */
+#define FLB_DTOA_SIZE    32
+
+/*
+ * Shortest decimal representation of a finite double that reads back to the
+ * same value, so |d| = mantissa * 10^exponent. The sign is ignored and zero
+ * gives a zero mantissa.
+ */
+void flb_dtoa_shortest(double d, uint64_t *mantissa, int *exponent);
+
+/* Write the decimal digits of 'v' to 'buf' (not NULL terminated) */
+int flb_u64toa(uint64_t v, char *buf);
+
+/*
+ * Write 'd' the way printf("%.17g") does, using the shortest digits that
+ * round trip: exponent notation when the exponent is lower than -4 or
+ * higher than 'max_exp', nan and inf for special values. Returns the
+ * number of bytes written to 'buf', it's not NULL terminated.
+ */
+int flb_dtoa(double d, int max_exp, char *buf);
+
+#endif
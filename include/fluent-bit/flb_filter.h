@@ -34,6 +34,7 @@
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_config_map.h>
 #include <fluent-bit/flb_input_chunk.h>
+#include <fluent-bit/flb_filter_batch.h>
 #include <msgpack.h>
 
 #define FLB_FILTER_MODIFIED 1
@@ -57,6 +58,16 @@ struct flb_filter_plugin {
                       void **, size_t *,
                       struct flb_filter_instance *,
                       void *, struct flb_config *);
+
+    /*
+     * Optional: filter a decoded batch in place. When set it's used instead
+     * of cb_filter, the batch is shared by the consecutive filters of the
+     * chain that implement it and it's serialized only once.
+     */
+    int (*cb_filter_batch) (struct flb_filter_batch *,
+                            const char *, int,
+                            struct flb_filter_instance *,
+                            void *, struct flb_config *);
     int (*cb_exit) (void *, struct flb_config *);
 
     struct mk_list _head;  /* Link to parent list (config->filters) */
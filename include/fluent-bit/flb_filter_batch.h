@@ -0,0 +1,148 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_FILTER_BATCH_H
+#define FLB_FILTER_BATCH_H
+
+#include <fluent-bit/flb_info.h>
+#include <msgpack.h>
+#include <stdint.h>
+
+struct flb_time;
+
+/*
+ * A filter batch is the decoded form of a msgpack buffer of records that is
+ * shared by all the filters of a chain. Every object lives in an arena (a
+ * msgpack zone) owned by the batch and strings reference the original
+ * buffer, so decoding does not copy the payload.
+ *
+ * Record maps are copy-on-write: the first edit of a record clones its
+ * key/value array into the arena, the decoded map is never touched. When the
+ * chain finishes the batch is serialized once; records that were not edited
+ * are copied as raw bytes from the original buffer.
+ *
+ * On request the batch also provides a columnar view of the records: the
+ * timestamps in one array and, for every top level key interned in a
+ * dictionary, a vector with the value of that key in each record. Filters
+ * evaluate a predicate over a whole column instead of looking up the key in
+ * every map. The view is built once per batch, it's shared by the filters of
+ * the chain and edits done through this API keep it up to date.
+ */
+
+/* Record flags */
+#define FLB_BATCH_RECORD_DROPPED    1   /* record removed from the batch   */
+#define FLB_BATCH_RECORD_MODIFIED   2   /* map edited, must be re-packed   */
+
+/* Initial capacity of a copy-on-write map on top of its original size */
+#define FLB_BATCH_MAP_EXTRA         8
+
+/*
+ * Keys interned when building the columnar view. Records with more distinct
+ * keys leave the view incomplete, the remaining columns are built when they
+ * are requested.
+ */
+#define FLB_BATCH_COLUMNS_MAX_KEYS  64
+
+struct flb_batch_record {
+    int flags;
+    msgpack_object *ts;           /* original timestamp object             */
+    msgpack_object *map;          /* record body, NULL if not [ts, body]   */
+    int map_cap;                  /* kv slots of a copy-on-write map       */
+    size_t raw_off;               /* offset of the record in the buffer    */
+    size_t raw_size;              /* packed size of the record             */
+};
+
+/* Values of one key, the first occurrence in each record map */
+struct flb_batch_column {
+    const char *key;
+    int key_len;
+    uint32_t hash;
+    msgpack_object **values;      /* one entry per record, NULL if missing */
+};
+
+struct flb_batch_columns {
+    int complete;                 /* every key of the batch is interned ?  */
+    int keys;                     /* number of columns                     */
+    int keys_size;                /* allocated entries in 'columns'        */
+    int table_size;               /* slots in the key hash table           */
+    int *table;                   /* column index + 1, zero if empty       */
+    struct flb_time *ts;          /* timestamp of each record              */
+    struct flb_batch_column **columns;
+};
+
+struct flb_filter_batch {
+    int count;                    /* number of decoded records             */
+    int alive;                    /* records not dropped                   */
+    int modified;                 /* any record edited or dropped ?        */
+    int size;                     /* allocated entries in 'records'        */
+    struct flb_batch_record *records;
+    const char *data;             /* original msgpack buffer               */
+    size_t bytes;                 /* original msgpack buffer size          */
+    msgpack_zone zone;            /* arena for objects and edits           */
+    struct flb_batch_columns *columns; /* columnar view, NULL until used   */
+};
+
+int flb_filter_batch_init(struct flb_filter_batch *batch,
+                          const void *data, size_t bytes);
+void flb_filter_batch_destroy(struct flb_filter_batch *batch);
+int flb_filter_batch_pack(struct flb_filter_batch *batch,
+                          char **out_buf, size_t *out_size);
+
+/* Record edits */
+void flb_filter_batch_drop(struct flb_filter_batch *batch, int i);
+int flb_filter_batch_map_lookup(struct flb_filter_batch *batch, int i,
+                                const char *key, int key_len);
+int flb_filter_batch_map_append(struct flb_filter_batch *batch, int i,
+                                msgpack_object *key, msgpack_object *val);
+int flb_filter_batch_map_remove(struct flb_filter_batch *batch, int i,
+                                int kv_index);
+int flb_filter_batch_str(struct flb_filter_batch *batch,
+                         const char *str, size_t len, msgpack_object *obj);
+
+/* Columnar view */
+struct flb_batch_columns *flb_filter_batch_columns(struct flb_filter_batch *batch);
+int flb_filter_batch_column(struct flb_filter_batch *batch,
+                            const char *key, int key_len,
+                            struct flb_batch_column **column);
+
+/* Returns the record body if it's a map, otherwise NULL */
+static inline msgpack_object *flb_filter_batch_map(struct flb_filter_batch *batch,
+                                                   int i)
+{
+    struct flb_batch_record *rec = &batch->records[i];
+
+    if (rec->flags & FLB_BATCH_RECORD_DROPPED || !rec->map ||
+        rec->map->type != MSGPACK_OBJECT_MAP) {
+        return NULL;
+    }
+    return rec->map;
+}
+
+/* Value of the column in record 'i', NULL if the record doesn't have it */
+static inline msgpack_object *flb_batch_column_value(struct flb_batch_column *col,
+                                                     int i)
+{
+    if (!col) {
+        return NULL;
+    }
+    return col->values[i];
+}
+
+#endif
@@ -29,4 +29,23 @@ int flb_gzip_compress(void *in_data, size_t in_len,
 int flb_gzip_uncompress(void *in_data, size_t in_len,
                         void **out_data, size_t *out_size);
 
+/*
+ * Streaming compression: data is compressed as it's written and the GZip
+ * output is handed to 'cb_out' in blocks of up to FLB_GZIP_STREAM_BUF
+ * bytes, so the whole uncompressed or compressed payload is never held
+ * in memory.
+ */
+#define FLB_GZIP_STREAM_BUF  32768
+
+struct flb_gzip_stream;
+
+struct flb_gzip_stream *flb_gzip_stream_create(int (*cb_out)(void *,
+                                                             const void *,
+                                                             size_t),
+                                               void *cb_data);
+int flb_gzip_stream_write(struct flb_gzip_stream *gz,
+                          const void *data, size_t len);
+int flb_gzip_stream_finish(struct flb_gzip_stream *gz);
+void flb_gzip_stream_destroy(struct flb_gzip_stream *gz);
+
 #endif
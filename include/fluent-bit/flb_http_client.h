@@ -122,6 +122,20 @@ struct flb_http_client {
     int body_len;
     const char *body_buf;
 
+    /* payload fragments sent after 'body_buf', see flb_http_add_body() */
+    int body_iov_count;
+    int body_iov_size;
+    size_t body_iov_len;
+    struct iovec *body_iov;
+
+    /* payload written by a callback, see flb_http_set_body_cb() */
+    int (*body_cb)(struct flb_http_client *, void *);
+    void *body_cb_data;
+    size_t body_sent;
+
+    /* request in flight on a pipelined connection */
+    struct flb_upstream_pipeline_req *pl_req;
+
     struct mk_list headers;
 
     /* Proxy */
@@ -143,6 +157,13 @@ struct flb_http_client *flb_http_client(struct flb_upstream_conn *u_conn,
 int flb_http_add_header(struct flb_http_client *c,
                         const char *key, size_t key_len,
                         const char *val, size_t val_len);
+int flb_http_add_body(struct flb_http_client *c,
+                      const char *buf, size_t len);
+int flb_http_set_body_cb(struct flb_http_client *c,
+                         int (*cb)(struct flb_http_client *, void *),
+                         void *data);
+int flb_http_write_body(struct flb_http_client *c,
+                        const void *buf, size_t len);
 int flb_http_basic_auth(struct flb_http_client *c,
                         const char *user, const char *passwd);
 int flb_http_set_keepalive(struct flb_http_client *c);
@@ -33,6 +33,7 @@
 #include <fluent-bit/flb_filter.h>
 #include <fluent-bit/flb_thread.h>
 #include <fluent-bit/flb_mp.h>
+#include <fluent-bit/flb_hash.h>
 
 #ifdef FLB_HAVE_METRICS
 #include <fluent-bit/flb_metrics.h>
@@ -47,11 +48,14 @@
 #define FLB_COLLECT_FD_EVENT    2
 #define FLB_COLLECT_FD_SERVER   4
 
+struct flb_in_worker;
+
 /* Input plugin masks */
 #define FLB_INPUT_NET          4  /* input address may set host and port   */
 #define FLB_INPUT_THREAD     128  /* plugin requires a thread on callbacks */
 #define FLB_INPUT_PRIVATE    256  /* plugin is not published/exposed       */
 #define FLB_INPUT_NOTAG      512  /* plugin might don't have tags          */
+#define FLB_INPUT_THREAD_SAFE 1024 /* collectors can run on a worker       */
 
 /* Input status */
 #define FLB_INPUT_RUNNING     1
@@ -137,6 +141,8 @@ struct flb_input_instance {
     int log_level;                       /* log level for this plugin    */
     flb_pipefd_t channel[2];             /* pipe(2) channel              */
     int threaded;                        /* bool / Threaded instance ?   */
+    int use_worker;                      /* bool / 'worker' property     */
+    struct flb_in_worker *worker;        /* collectors worker thread     */
     char name[32];                       /* numbered name (cpu -> cpu.0) */
     char *alias;                         /* alias name for the instance  */
     void *context;                       /* plugin configuration context */
@@ -213,6 +219,7 @@ struct flb_input_instance {
     struct mk_list _head;                /* link to config->inputs     */
     struct mk_list routes;               /* flb_router_path's list     */
     struct mk_list chunks;               /* storage chunks             */
+    struct flb_hash *ht_chunks;          /* Tag => chunk open for data */
     struct mk_list properties;           /* properties / configuration */
     struct mk_list collectors;           /* collectors                 */
 
@@ -479,6 +486,7 @@ int flb_input_set_property(struct flb_input_instance *ins,
 const char *flb_input_get_property(const char *key,
                                    struct flb_input_instance *ins);
 
+void flb_input_prepare();
 int flb_input_check(struct flb_config *config);
 void flb_input_set_context(struct flb_input_instance *ins, void *context);
 int flb_input_channel_init(struct flb_input_instance *ins);
@@ -518,6 +526,9 @@ void flb_input_exit_all(struct flb_config *config);
 
 void *flb_input_flush(struct flb_input_instance *ins, size_t *size);
 int flb_input_pause_all(struct flb_config *config);
+void flb_input_pause(struct flb_input_instance *ins);
+void flb_input_resume(struct flb_input_instance *ins);
+struct mk_event_loop *flb_input_event_loop(struct flb_input_instance *ins);
 const char *flb_input_name(struct flb_input_instance *ins);
 int flb_input_name_exists(const char *name, struct flb_config *config);
 
@@ -23,6 +23,7 @@
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_sds.h>
+#include <fluent-bit/flb_routes_mask.h>
 #include <monkey/mk_core.h>
 #include <msgpack.h>
 
@@ -38,6 +39,9 @@
  */
 #define FLB_INPUT_CHUNK_FS_MAX_SIZE   2048000  /* 2MB */
 
+/* Size of the per input instance table of chunks open by Tag */
+#define FLB_INPUT_CHUNK_INDEX_SIZE       1024
+
 struct flb_input_chunk {
     int busy;                       /* buffer is being flushed  */
     int fs_backlog;                 /* chunk originated from fs backlog */
@@ -47,11 +51,12 @@ struct flb_input_chunk {
     int added_records;              /* recently added records */
 #endif
     void *chunk;                    /* context of struct cio_chunk */
+    flb_sds_t tag;                  /* tag, if created by the input */
     off_t stream_off;               /* stream offset */
     msgpack_packer mp_pck;          /* msgpack packer */
     struct flb_input_instance *in;  /* reference to parent input instance */
     struct flb_task *task;          /* reference to the outgoing task */
-    uint64_t routes_mask;           /* track the output plugin the chunk routes to */
+    flb_route_mask_element *routes_mask; /* output plugins the chunk routes to */
     struct mk_list _head;
 };
 
@@ -0,0 +1,93 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef FLB_INPUT_WORKER_H
+#define FLB_INPUT_WORKER_H
+
+#include <monkey/mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_thread_storage.h>
+
+/* Number of records the ring buffer can hold before the worker waits */
+#define FLB_INPUT_WORKER_RING_SIZE  1024
+
+/* Commands sent by the engine to the worker */
+#define FLB_INPUT_WORKER_PAUSE      1
+#define FLB_INPUT_WORKER_RESUME     2
+#define FLB_INPUT_WORKER_STOP       3
+
+/*
+ * Input workers
+ * =============
+ * When an input instance sets 'worker on', its collectors run on a dedicated
+ * thread with a private event loop instead of the engine event loop. Records
+ * appended by the plugin are not written to a chunk by the worker: they are
+ * copied into a ring buffer and the engine is notified, then the engine
+ * appends them to the chunks from its own thread. Storage, routing and
+ * metrics stay owned by the engine.
+ *
+ * Pause and resume requests (mem_buf_limit, shutdown) are forwarded to the
+ * worker, so the plugin callbacks always run on the worker thread.
+ */
+struct flb_in_worker_record {
+    char *tag;                          /* record tag or NULL       */
+    size_t tag_len;
+    char *buf;                          /* msgpack records          */
+    size_t size;
+};
+
+struct flb_in_worker {
+    struct mk_event event;              /* engine: records ready    */
+    struct mk_event event_cmd;          /* worker: engine commands  */
+    pthread_t tid;                      /* worker thread            */
+    flb_pipefd_t ch_ring[2];            /* worker -> engine channel */
+    flb_pipefd_t ch_events[2];          /* engine -> worker channel */
+    struct mk_event_loop *evl;          /* worker event loop        */
+
+    /* Ring buffer of records pending to be appended by the engine */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct flb_in_worker_record **ring;
+    size_t ring_size;
+    size_t ring_head;                   /* next record to append    */
+    size_t ring_count;                  /* records in the ring      */
+    int notified;                       /* engine already notified? */
+    int stopping;
+
+    struct flb_input_instance *ins;     /* parent input instance    */
+    struct flb_config *config;
+};
+
+struct flb_input_instance;
+
+void flb_input_worker_prepare();
+struct flb_in_worker *flb_input_worker_get();
+struct flb_in_worker *flb_input_worker_create(struct flb_input_instance *ins,
+                                              struct flb_config *config);
+int flb_input_worker_start(struct flb_in_worker *worker);
+void flb_input_worker_destroy(struct flb_in_worker *worker);
+int flb_input_worker_command(struct flb_in_worker *worker, uint64_t cmd);
+int flb_input_worker_append(struct flb_in_worker *worker,
+                            const char *tag, size_t tag_len,
+                            const void *buf, size_t buf_size);
+
+#endif
@@ -24,6 +24,7 @@
 #include <monkey/mk_core.h>
 
 #include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_compat.h>
 #include <fluent-bit/flb_thread.h>
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_upstream.h>
@@ -42,11 +43,28 @@
 /* Other features */
 #define FLB_IO_IPV6       32  /* network I/O uses IPv6                  */
 
+/* Maximum number of buffers passed to a single sendmsg(2) call */
+#define FLB_IO_IOV_MAX          64
+
+/*
+ * TLS can't write a vector: buffers up to this size are coalesced so they
+ * go out in a single record (the maximum TLS record payload).
+ */
+#define FLB_IO_TLS_COALESCE_MAX  16384
+
 int flb_io_net_connect(struct flb_upstream_conn *u_conn,
                        struct flb_thread *th);
+int flb_io_net_connect_start(struct flb_upstream_conn *u_conn);
 
 int flb_io_net_write(struct flb_upstream_conn *u, const void *data,
                      size_t len, size_t *out_len);
+int flb_io_net_writev(struct flb_upstream_conn *u_conn,
+                      const struct iovec *iov, int iovcnt, size_t *out_len);
 ssize_t flb_io_net_read(struct flb_upstream_conn *u, void *buf, size_t len);
+ssize_t flb_io_net_try_writev(struct flb_upstream_conn *u_conn,
+                              const struct iovec *iov, int iovcnt, int *mask);
+ssize_t flb_io_net_try_read(struct flb_upstream_conn *u_conn,
+                            void *buf, size_t len, int *mask);
+int flb_io_iov_advance(struct iovec **iov, int iovcnt, size_t bytes);
 
 #endif
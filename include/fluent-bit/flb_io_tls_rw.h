@@ -29,6 +29,9 @@
 #include <fluent-bit/flb_thread.h>
 #include <fluent-bit/flb_upstream.h>
 
+int flb_io_tls_handshake_start(struct flb_upstream_conn *u_conn);
+int flb_io_tls_handshake_step(struct flb_upstream_conn *u_conn);
+
 int flb_io_tls_net_read_async(struct flb_thread *th, struct flb_upstream_conn *u_conn,
                               void *buf, size_t len);
 int flb_io_tls_net_read(struct flb_upstream_conn *u_conn,
@@ -37,6 +40,10 @@ int flb_io_tls_net_write_async(struct flb_thread *th, struct flb_upstream_conn *
                                const void *data, size_t len, size_t *out_len);
 int flb_io_tls_net_write(struct flb_upstream_conn *u_conn,
                          const void *data, size_t len, size_t *out_len);
+ssize_t flb_io_tls_net_try_read(struct flb_upstream_conn *u_conn,
+                                void *buf, size_t len, int *mask);
+ssize_t flb_io_tls_net_try_write(struct flb_upstream_conn *u_conn,
+                                 const void *data, size_t len, int *mask);
 
 #endif
 
@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#ifndef FLB_LINES_H
+#define FLB_LINES_H
+
+#include <fluent-bit/flb_info.h>
+#include <stddef.h>
+
+/*
+ * Find the offsets of the line breaks ('\n') in a buffer. Up to 'max'
+ * offsets are stored in 'lines', the return value is the number of offsets
+ * found. If it's equal to 'max' the caller must scan again starting after
+ * the last offset.
+ *
+ * When the compiler targets AVX2 or SSE2 the buffer is classified in
+ * 64-byte blocks (two AVX2 or four SSE2 compares per block) and gaps without
+ * line breaks are skipped with memchr(); otherwise memchr() is used alone.
+ */
+int flb_lines_scan(const char *buf, size_t len, size_t *lines, int max);
+
+#endif
@@ -38,6 +38,13 @@
 #define FLB_METRIC_OUT_RETRY          13
 #define FLB_METRIC_OUT_RETRY_FAILED   14
 
+/* Upstream connections pool of an output (flb_upstream_stats) */
+#define FLB_METRIC_OUT_UPSTREAM_IDLE         15
+#define FLB_METRIC_OUT_UPSTREAM_BUSY         16
+#define FLB_METRIC_OUT_UPSTREAM_CONNECTS     17
+#define FLB_METRIC_OUT_UPSTREAM_TLS_RESUMED  18
+#define FLB_METRIC_OUT_UPSTREAM_WAITS        19
+
 struct flb_metric {
     int id;
     int title_len;
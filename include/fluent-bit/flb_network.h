@@ -39,6 +39,18 @@ struct flb_net_setup {
 
     /* network interface to bind and use to send data */
     flb_sds_t source_address;
+
+    /* max number of pipelined requests sharing a connection */
+    int pipeline_depth;
+
+    /* keepalive connections kept open in the background */
+    int min_idle_connections;
+
+    /* max number of connections, zero means no limit */
+    int max_connections;
+
+    /* resume the last TLS session on new connections */
+    int tls_session_resumption;
 };
 
 /* Defines a host service and it properties */
@@ -50,9 +50,12 @@
 
 /* Output plugin masks */
 #define FLB_OUTPUT_NET          32  /* output address may set host and port */
+#define FLB_OUTPUT_THREAD_SAFE  64  /* flush callback can run on workers    */
 #define FLB_OUTPUT_PLUGIN_CORE   0
 #define FLB_OUTPUT_PLUGIN_PROXY  1
 
+struct flb_out_worker;
+
 /*
  * Tests callbacks
  * ===============
@@ -187,7 +190,7 @@ struct flb_output_plugin {
  * and the variable one that is generated when the plugin is invoked.
  */
 struct flb_output_instance {
-    uint64_t mask_id;                    /* internal bitmask for routing */
+    int mask_id;                         /* bit in the routes mask       */
     int id;                              /* instance id                  */
     int log_level;                       /* instance log level           */
     char name[32];                       /* numbered name (cpu -> cpu.0) */
@@ -246,6 +249,15 @@ struct flb_output_instance {
     /* IO upstream context, if flags & (FLB_OUTPUT_TCP | FLB_OUTPUT TLS)) */
     struct flb_upstream *upstream;
 
+    /*
+     * Output workers: if 'workers' is greater than zero, flushes run on
+     * dedicated threads (see flb_output_worker.h). 'worker_next' is the
+     * round-robin cursor used to pick the worker for the next flush.
+     */
+    int workers;
+    struct mk_list worker_list;
+    struct mk_list *worker_next;
+
     /*
      * The threads_queue is the head for the linked list that holds co-routines
      * nodes information that needs to be processed.
@@ -319,6 +331,9 @@ struct flb_output_thread {
     struct flb_config *config;         /* FLB context        */
     struct flb_output_instance *o_ins; /* output instance    */
     struct flb_thread *parent;         /* parent thread addr */
+    struct flb_out_worker *worker;     /* output worker, if any */
+    int finished;                      /* flush returned ?   */
+    int ret;                           /* flush return value */
     struct mk_list _head;              /* Link to struct flb_task->threads */
 };
 
@@ -501,6 +516,9 @@ struct flb_thread *flb_output_thread(struct flb_task *task,
     out_th->buffer  = buf;
     out_th->config  = config;
     out_th->parent  = th;
+    out_th->worker  = NULL;
+    out_th->finished = FLB_FALSE;
+    out_th->ret     = 0;
 
     th->caller = co_active();
     th->callee = co_create(config->coro_stack_size,
@@ -524,6 +542,35 @@ struct flb_thread *flb_output_thread(struct flb_task *task,
     return th;
 }
 
+/* Account the result of a flush in the output instance metrics */
+static inline void flb_output_thread_metrics(int ret,
+                                             struct flb_output_thread *out_th)
+{
+#ifdef FLB_HAVE_METRICS
+    int records;
+    struct flb_task *task = out_th->task;
+
+    if (out_th->o_ins->metrics) {
+        if (ret == FLB_OK) {
+            records = task->records;
+            flb_metrics_sum(FLB_METRIC_OUT_OK_RECORDS, records,
+                            out_th->o_ins->metrics);
+            flb_metrics_sum(FLB_METRIC_OUT_OK_BYTES, task->size,
+                            out_th->o_ins->metrics);
+        }
+        else if (ret == FLB_ERROR) {
+            flb_metrics_sum(FLB_METRIC_OUT_ERROR, 1, out_th->o_ins->metrics);
+        }
+        else if (ret == FLB_RETRY) {
+            /*
+             * Counting retries is happening in the event loop/scheduler side
+             * since it also needs to count if some retry fails to re-schedule.
+             */
+        }
+    }
+#endif
+}
+
 /*
  * This function is used by the output plugins to return. It's mandatory
  * as it will take care to signal the event loop letting know the flush
@@ -534,54 +581,42 @@ struct flb_thread *flb_output_thread(struct flb_task *task,
  */
 static inline void flb_output_return(int ret, struct flb_thread *th) {
     int n;
-    uint32_t set;
     uint64_t val;
     struct flb_task *task;
     struct flb_output_thread *out_th;
-#ifdef FLB_HAVE_METRICS
-    int records;
-#endif
 
     out_th = (struct flb_output_thread *) FLB_THREAD_DATA(th);
     task = out_th->task;
 
+    /*
+     * A flush running on an output worker is reported by the worker once
+     * the co-routine yields, otherwise the engine could release it while
+     * it's still running. Metrics are accounted by the engine.
+     */
+    if (out_th->worker) {
+        out_th->ret = ret;
+        out_th->finished = FLB_TRUE;
+        return;
+    }
+
     /*
      * To compose the signal event the relevant info is:
      *
      * - Unique Task events id: 2 in this case
      * - Return value: FLB_OK (0) or FLB_ERROR (1)
-     * - Task ID
+     * - Task ID and its generation
+     * - Output thread ID
      *
-     * We put together the return value with the task_id on the 32 bits at right
+     * All of them are packed on the 64 bits message (see flb_task.h).
      */
-    set = FLB_TASK_SET(ret, task->id, out_th->id);
-    val = FLB_BITS_U64_SET(2 /* FLB_ENGINE_TASK */, set);
+    val = FLB_TASK_SET(ret, task->id, task->gen, out_th->id);
 
     n = flb_pipe_w(task->config->ch_manager[1], (void *) &val, sizeof(val));
     if (n == -1) {
         flb_errno();
     }
 
-#ifdef FLB_HAVE_METRICS
-    if (out_th->o_ins->metrics) {
-        if (ret == FLB_OK) {
-            records = task->records;
-            flb_metrics_sum(FLB_METRIC_OUT_OK_RECORDS, records,
-                            out_th->o_ins->metrics);
-            flb_metrics_sum(FLB_METRIC_OUT_OK_BYTES, task->size,
-                            out_th->o_ins->metrics);
-        }
-        else if (ret == FLB_ERROR) {
-            flb_metrics_sum(FLB_METRIC_OUT_ERROR, 1, out_th->o_ins->metrics);
-        }
-        else if (ret == FLB_RETRY) {
-            /*
-             * Counting retries is happening in the event loop/scheduler side
-             * since it also needs to count if some retry fails to re-schedule.
-             */
-        }
-    }
-#endif
+    flb_output_thread_metrics(ret, out_th);
 }
 
 static inline void flb_output_return_do(int x)
@@ -635,6 +670,7 @@ int flb_output_instance_destroy(struct flb_output_instance *ins);
 int flb_output_init_all(struct flb_config *config);
 int flb_output_check(struct flb_config *config);
 int flb_output_upstream_set(struct flb_upstream *u, struct flb_output_instance *ins);
+int flb_output_upstream_ha_set(void *ha, struct flb_output_instance *ins);
 void flb_output_prepare();
 int flb_output_set_http_debug_callbacks(struct flb_output_instance *ins);
 
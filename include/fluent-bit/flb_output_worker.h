@@ -0,0 +1,79 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_OUTPUT_WORKER_H
+#define FLB_OUTPUT_WORKER_H
+
+#include <monkey/mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_thread_storage.h>
+
+#ifdef FLB_HAVE_TLS
+#include <fluent-bit/flb_io_tls.h>
+#endif
+
+/*
+ * Output workers
+ * ==============
+ * When an output instance sets 'workers N', its flushes run on N dedicated
+ * threads instead of the engine event loop. The engine still creates the
+ * flush co-routine and owns the task, then it hands the co-routine to a
+ * worker through the worker channel. The worker resumes it on its own event
+ * loop, where every network operation is registered, and once the flush
+ * returns it reports the result to the engine through the manager channel.
+ *
+ * Upstream contexts created by the plugin are cloned per worker on first
+ * use, so every worker has its own connections pool.
+ */
+struct flb_out_worker {
+    struct mk_event event;              /* channel event            */
+    struct mk_event event_timer;        /* connections timeouts     */
+    int id;                             /* worker number            */
+    pthread_t tid;                      /* worker thread            */
+    flb_pipefd_t ch_events[2];          /* engine -> worker channel */
+    flb_pipefd_t timer_fd;              /* timer file descriptor    */
+    struct mk_event_loop *evl;          /* worker event loop        */
+    struct mk_list upstreams;           /* private upstream copies  */
+
+#ifdef FLB_HAVE_TLS
+    struct flb_tls tls;                 /* private TLS context      */
+#endif
+
+    struct flb_output_instance *ins;    /* parent output instance   */
+    struct flb_config *config;
+    struct mk_list _head;               /* link to ins->worker_list */
+};
+
+struct flb_upstream;
+struct flb_thread;
+struct flb_output_instance;
+
+void flb_output_worker_prepare();
+int flb_output_worker_start(struct flb_output_instance *ins,
+                            struct flb_config *config);
+void flb_output_worker_stop(struct flb_output_instance *ins);
+int flb_output_worker_flush(struct flb_output_instance *ins,
+                            struct flb_thread *th);
+struct flb_out_worker *flb_output_worker_get();
+struct flb_upstream *flb_output_worker_upstream(struct flb_upstream *u);
+void flb_output_worker_resume(struct flb_thread *th);
+
+#endif
@@ -0,0 +1,67 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_PACK_FAST_H
+#define FLB_PACK_FAST_H
+
+#include <fluent-bit/flb_info.h>
+#include <stddef.h>
+
+/*
+ * Maximum nesting handled, deeper messages are left to jsmn. It keeps the
+ * decoder stack usage low enough to run inside a co-routine.
+ */
+#define FLB_PACK_FAST_DEPTH    32
+
+/*
+ * Lookup of a key of the root map while the JSON message is packed. The
+ * first pair using that key is reported with its offsets in the msgpack
+ * buffer, only if its value is a string.
+ */
+struct flb_pack_json_key {
+    const char *name;
+    int name_len;
+
+    int found;
+    size_t kv_off;        /* start of the key                 */
+    size_t kv_end;        /* end of the value                 */
+    size_t val_off;       /* start of the string value bytes  */
+    size_t val_len;       /* length of the string value       */
+};
+
+/*
+ * Convert a JSON message to msgpack in a single pass over an index of its
+ * structural characters. The output is the same than the jsmn based
+ * flb_pack_json(), when the message is invalid, incomplete or uses a corner
+ * case this decoder doesn't handle it returns -1 and the caller is expected
+ * to use jsmn instead.
+ *
+ * If 'key' is set, the message must be a single value and the key is looked
+ * up on the root map.
+ */
+int flb_pack_json_fast(const char *js, size_t len,
+                       char **buffer, size_t *size, int *root_type,
+                       struct flb_pack_json_key *key);
+
+/* Remove the pair found by a key lookup from the root map */
+void flb_pack_json_key_remove(char *buf, size_t *size,
+                              struct flb_pack_json_key *key);
+
+#endif
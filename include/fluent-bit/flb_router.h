@@ -23,16 +23,83 @@
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_filter.h>
+#include <fluent-bit/flb_hash.h>
+#include <fluent-bit/flb_routes_mask.h>
+
+/* Default number of Tags with resolved routes kept in the cache */
+#define FLB_ROUTER_CACHE_SIZE  8192
+
+/* Rule types */
+#define FLB_ROUTER_OUTPUT      0
+#define FLB_ROUTER_FILTER      1
 
 struct flb_router_path {
     struct flb_output_instance *ins;
     struct mk_list _head;
 };
 
+/* A compiled 'Match' or 'Match_Regex' rule of an output or filter instance */
+struct flb_router_rule {
+    int type;                     /* FLB_ROUTER_OUTPUT or FLB_ROUTER_FILTER */
+    int index;                    /* filter position in config->filters     */
+    int literal;                  /* pattern has no wildcards ?             */
+    int prefix_len;               /* length of the literal prefix           */
+    char *match;                  /* wildcard pattern                       */
+    void *match_regex;            /* regex pattern (struct flb_regex)       */
+    void *ins;                    /* output or filter instance              */
+    struct mk_list _head;         /* link to trie node or regex list        */
+};
+
+/*
+ * Trie node: every wildcard pattern is stored under the node that
+ * represents its literal prefix (the characters before the first '*').
+ */
+struct flb_router_node {
+    unsigned char c;
+    struct mk_list rules;             /* rules whose prefix ends here */
+    struct flb_router_node *child;    /* first child                  */
+    struct flb_router_node *next;     /* next sibling                 */
+};
+
+/*
+ * Routes resolved for a Tag, this is the value stored in the cache. The
+ * routes mask is followed by the list of matching filters in config order,
+ * use flb_router_route_filters() to access them.
+ */
+struct flb_router_route {
+    int filters_count;                     /* number of filters         */
+    int routes_mask_size;                  /* routes mask elements      */
+    flb_route_mask_element routes_mask[];  /* output instances          */
+};
+
+struct flb_router {
+    int filters_count;
+    struct flb_filter_instance **filters; /* all filters, config order */
+    char *matched;                        /* scratch: matched filters  */
+    struct flb_router_node *root;         /* literal prefixes trie     */
+    struct mk_list regex_rules;           /* Match_Regex rules         */
+    struct flb_hash *cache;               /* Tag => flb_router_route   */
+    struct flb_router_route *route;       /* scratch: cache misses     */
+};
+
+static inline struct flb_filter_instance **flb_router_route_filters(
+                                            struct flb_router_route *route)
+{
+    return (struct flb_filter_instance **) (route->routes_mask +
+                                            route->routes_mask_size);
+}
+
 int flb_router_match(const char *tag, int tag_len,
                      const char *match, void *match_regex);
 int flb_router_io_set(struct flb_config *config);
 void flb_router_exit(struct flb_config *config);
-uint64_t flb_router_get_routes_mask_by_tag(const char *tag, int tag_len,
-                                           struct flb_input_instance *in);
+
+struct flb_router *flb_router_create(struct flb_config *config);
+void flb_router_destroy(struct flb_router *router);
+struct flb_router_route *flb_router_route_get(const char *tag, int tag_len,
+                                              struct flb_config *config);
+int flb_router_get_routes_mask_by_tag(const char *tag, int tag_len,
+                                      struct flb_input_instance *in,
+                                      flb_route_mask_element *routes_mask);
 #endif
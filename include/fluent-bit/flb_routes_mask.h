@@ -0,0 +1,140 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_ROUTES_MASK_H
+#define FLB_ROUTES_MASK_H
+
+#include <fluent-bit/flb_info.h>
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * A routes mask is a bitmap where every output instance owns one bit, the
+ * position is the output 'mask_id'. A chunk routes to an output instance if
+ * the bit of the instance is set.
+ *
+ * The number of elements of a mask depends on the number of configured
+ * output instances (config->routes_mask_size), there is no fixed limit.
+ * Operations run over contiguous 64-bit words so the compiler can vectorize
+ * the loops.
+ */
+typedef uint64_t flb_route_mask_element;
+
+#define FLB_ROUTES_MASK_ELEMENT_BITS  (sizeof(flb_route_mask_element) * 8)
+
+/* Number of elements required to store a mask of 'bits' routes */
+#define FLB_ROUTES_MASK_ELEMENTS(bits)                                  \
+    (((bits) + FLB_ROUTES_MASK_ELEMENT_BITS - 1) / FLB_ROUTES_MASK_ELEMENT_BITS)
+
+static inline void flb_routes_mask_clear(flb_route_mask_element *mask,
+                                         int size)
+{
+    memset(mask, '\0', sizeof(flb_route_mask_element) * size);
+}
+
+static inline void flb_routes_mask_copy(flb_route_mask_element *dst,
+                                        const flb_route_mask_element *src,
+                                        int size)
+{
+    memcpy(dst, src, sizeof(flb_route_mask_element) * size);
+}
+
+static inline void flb_routes_mask_set_bit(flb_route_mask_element *mask,
+                                           int bit)
+{
+    mask[bit / FLB_ROUTES_MASK_ELEMENT_BITS] |=
+        ((flb_route_mask_element) 1 << (bit % FLB_ROUTES_MASK_ELEMENT_BITS));
+}
+
+static inline void flb_routes_mask_clear_bit(flb_route_mask_element *mask,
+                                             int bit)
+{
+    mask[bit / FLB_ROUTES_MASK_ELEMENT_BITS] &=
+        ~((flb_route_mask_element) 1 << (bit % FLB_ROUTES_MASK_ELEMENT_BITS));
+}
+
+static inline int flb_routes_mask_get_bit(const flb_route_mask_element *mask,
+                                          int bit)
+{
+    return (mask[bit / FLB_ROUTES_MASK_ELEMENT_BITS] >>
+            (bit % FLB_ROUTES_MASK_ELEMENT_BITS)) & 1;
+}
+
+static inline int flb_routes_mask_is_empty(const flb_route_mask_element *mask,
+                                           int size)
+{
+    int i;
+    flb_route_mask_element acc = 0;
+
+    for (i = 0; i < size; i++) {
+        acc |= mask[i];
+    }
+
+    return (acc == 0);
+}
+
+/* dst = dst | src */
+static inline void flb_routes_mask_or(flb_route_mask_element *dst,
+                                      const flb_route_mask_element *src,
+                                      int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++) {
+        dst[i] |= src[i];
+    }
+}
+
+/* dst = dst & src */
+static inline void flb_routes_mask_and(flb_route_mask_element *dst,
+                                       const flb_route_mask_element *src,
+                                       int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++) {
+        dst[i] &= src[i];
+    }
+}
+
+/* Number of routes (bits set) in the mask */
+static inline int flb_routes_mask_popcount(const flb_route_mask_element *mask,
+                                           int size)
+{
+    int i;
+    int count = 0;
+
+    for (i = 0; i < size; i++) {
+#if defined(__GNUC__) || defined(__clang__)
+        count += __builtin_popcountll(mask[i]);
+#else
+        flb_route_mask_element v = mask[i];
+        while (v) {
+            v &= (v - 1);
+            count++;
+        }
+#endif
+    }
+
+    return count;
+}
+
+#endif
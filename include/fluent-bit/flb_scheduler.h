@@ -29,11 +29,25 @@
 /* Sched contstants */
 #define FLB_SCHED_CAP            2000
 #define FLB_SCHED_BASE           5
-#define FLB_SCHED_REQUEST_FRAME  10
+
+/*
+ * Timing wheel: FLB_SCHED_WHEEL_LEVELS levels of FLB_SCHED_WHEEL_SLOTS slots
+ * with a resolution of one millisecond, the last level covers ~12 days.
+ * Timers expiring later are re-queued when they reach the last level.
+ */
+#define FLB_SCHED_WHEEL_BITS     6
+#define FLB_SCHED_WHEEL_SLOTS    (1 << FLB_SCHED_WHEEL_BITS)
+#define FLB_SCHED_WHEEL_MASK     (FLB_SCHED_WHEEL_SLOTS - 1)
+#define FLB_SCHED_WHEEL_LEVELS   5
+
+/*
+ * Without timerfd(2) the wheel cannot be armed for the next expiration, it's
+ * driven by a periodic timer of FLB_SCHED_WHEEL_TICK milliseconds instead.
+ */
+#define FLB_SCHED_WHEEL_TICK     5
 
 /* Timer types */
-#define FLB_SCHED_TIMER_REQUEST     1  /* timerfd             */
-#define FLB_SCHED_TIMER_FRAME       2  /* timer frame checker */
+#define FLB_SCHED_TIMER_REQUEST     1  /* retry request            */
 #define FLB_SCHED_TIMER_CB_ONESHOT  3  /* one-shot callback timer  */
 #define FLB_SCHED_TIMER_CB_PERM     4  /* permanent callback timer */
 
@@ -46,7 +60,6 @@
  * - data: opaque data type used by the target handler
  */
 struct flb_sched_timer {
-    struct mk_event event;
     int active;
     int type;
     void *data;
@@ -54,52 +67,49 @@ struct flb_sched_timer {
     /*
      * Custom timer specific data:
      *
-     * - timer_fd = timer file descriptor
-     * - cb       = callback to be triggerd upon expiration
+     * - expire = monotonic time (milliseconds) of the next expiration
+     * - ms     = interval of permanent callback timers
+     * - cb     = callback to be triggerd upon expiration
      */
-    int timer_fd;
+    uint64_t expire;
+    int ms;
     void (*cb)(struct flb_config *, void *);
 
+    /* Wheel position, level is -1 if the timer is not linked to a slot */
+    int level;
+    int slot;
+
     /* Parent context */
     struct flb_config *config;
 
-    /* link to flb_sched->timers */
-    struct mk_list _head;
+    struct mk_list _head;          /* link to flb_sched->timers */
+    struct mk_list _wheel;         /* link to a wheel slot      */
 };
 
 /* Struct representing a FLB_SCHED_TIMER_REQUEST */
 struct flb_sched_request {
-    flb_pipefd_t fd;
     time_t created;
     time_t timeout;
-    void *data;
-    struct flb_sched_timer *timer; /* parent timer linked from */
-    struct mk_list _head;          /* link to flb_sched->[requests|wait] */
+    void *data;                    /* task retry                */
+    struct flb_sched_timer *timer; /* parent timer linked from  */
+    struct mk_list _head;          /* link to flb_sched->requests */
 };
 
 /* Scheduler context */
 struct flb_sched {
 
     /*
-     * Scheduler lists:
-     *
      * The scheduler is used to issue 'retries' of flush requests when these
-     * cannot be processed and the output plugins ask for a retry.
-     *
-     * If a retry have not reached a limit and is allowed, it needs to be
-     * queued:
-     *
-     *  - For retries that will happen within the next 60 seconds, they are
-     *    placed in the 'requests' list and a timeout is registered with
-     *    the operating system (timerfd).
+     * cannot be processed and the output plugins ask for a retry, and to
+     * trigger callbacks at a given interval.
      *
-     *  - For retries that will happen 'after' 60 seconds, they are queued
-     *    into the requests_wait' list. They stay there until their
-     *    flush time happens within the next 60 seconds, so they are moved
-     *    to the sched_requests list and a further timeout is created.
+     * Retries and callbacks are timers held by a hierarchical timing wheel,
+     * inserting and cancelling a timer does not depend on the number of
+     * timers pending. A single timer file descriptor registered in the
+     * event loop is armed for the next expiration, all the timers expired
+     * by then are processed in a batch.
      */
     struct mk_list requests;
-    struct mk_list requests_wait;
 
     /* Timers: list of timers for different purposes */
     struct mk_list timers;
@@ -110,8 +120,13 @@ struct flb_sched {
      */
     struct mk_list timers_drop;
 
-    /* Frame timer context */
-    flb_pipefd_t frame_fd;
+    /* Timing wheel */
+    struct mk_event event;         /* wheel timer event                */
+    flb_pipefd_t timer_fd;         /* wheel timer                      */
+    uint64_t now;                  /* next tick to process             */
+    uint64_t armed;                /* tick the timer is armed for      */
+    uint64_t bitmap[FLB_SCHED_WHEEL_LEVELS];  /* non empty slots       */
+    struct mk_list wheel[FLB_SCHED_WHEEL_LEVELS][FLB_SCHED_WHEEL_SLOTS];
 
     struct flb_config *config;
 };
@@ -28,8 +28,26 @@
 #define FLB_STORAGE_BL_MEM_LIMIT   "5M"
 #define FLB_STORAGE_MAX_CHUNKS_UP  128
 
+/* group commit: default commit window in milliseconds */
+#define FLB_STORAGE_COMMIT_INTERVAL  5
+
+/*
+ * Histogram buckets for durable syncs: number of chunk syncs covered by
+ * a single sync (batch size) and sync latency in microseconds. The last
+ * bucket of each histogram counts everything above the previous bound.
+ */
+#define FLB_STORAGE_SYNC_BATCH_BUCKETS    10
+#define FLB_STORAGE_SYNC_LATENCY_BUCKETS  10
+
 struct flb_storage_metrics {
     int fd;
+
+    /* durable syncs */
+    uint64_t sync_total;
+    uint64_t sync_chunks;
+    uint64_t sync_bytes;
+    uint64_t sync_batch[FLB_STORAGE_SYNC_BATCH_BUCKETS];
+    uint64_t sync_latency[FLB_STORAGE_SYNC_LATENCY_BUCKETS];
 };
 
 /*
@@ -50,6 +68,7 @@ int flb_storage_input_create(struct cio_ctx *cio,
 void flb_storage_destroy(struct flb_config *ctx);
 void flb_storage_input_destroy(struct flb_input_instance *in);
 
+int flb_storage_commit_create(struct flb_config *ctx);
 struct flb_storage_metrics *flb_storage_metrics_create(struct flb_config *ctx);
 
 #endif
@@ -37,19 +37,24 @@
  * The FLB_OUTPUT_RETURN macro lookup the current active 'engine thread' and
  * it 'engine task' associated, so it emits an event to the main event loop
  * indicating an output thread has done. In order to specify return values
- * and the proper IDs an unsigned 32 bits number is used:
+ * and the proper IDs an unsigned 64 bits number is used, the event type
+ * (FLB_ENGINE_TASK) takes the most significant byte:
  *
- *     AAAA     BBBBBBBBBBBBBB CCCCCCCCCCCCCC   > 32 bit number
- *       ^            ^              ^
- *    4 bits       14 bits        14 bits
- *  return val     task_id       thread_id
+ *   TTTTTTTT AAAA GGGGGGGGGGGGGGGG BBBBBBBBBBBBBBBBBBBBBB CCCCCCCCCCCCCC
+ *       ^     ^          ^                   ^                  ^
+ *    8 bits 4 bits    16 bits             22 bits            14 bits
+ *     type  return   generation           task_id           thread_id
  */
 
-#define FLB_TASK_RET(val)  (val >> 28)
-#define FLB_TASK_ID(val)   (uint32_t) (val & 0xfffc000) >> 14
-#define FLB_TASK_TH(val)   (val & 0x3fff)
-#define FLB_TASK_SET(ret, task_id, th_id)               \
-    (uint32_t) ((ret << 28) | (task_id << 14) | th_id)
+#define FLB_TASK_TYPE(val) ((uint64_t) (val) >> 56)
+#define FLB_TASK_RET(val)  (int) (((uint64_t) (val) >> 52) & 0xf)
+#define FLB_TASK_GEN(val)  (int) (((uint64_t) (val) >> 36) & 0xffff)
+#define FLB_TASK_ID(val)   (int) (((uint64_t) (val) >> 14) & 0x3fffff)
+#define FLB_TASK_TH(val)   (int) ((uint64_t) (val) & 0x3fff)
+#define FLB_TASK_SET(ret, task_id, gen, th_id)                          \
+    (((uint64_t) 2 /* FLB_ENGINE_TASK */ << 56) |                       \
+     ((uint64_t) (ret) << 52) | ((uint64_t) (gen) << 36) |              \
+     ((uint64_t) (task_id) << 14) | (uint64_t) (th_id))
 
 struct flb_task_route {
     struct flb_output_instance *out;
@@ -68,12 +73,14 @@ struct flb_task_retry {
     int attemps;                        /* number of attemps, default 1 */
     struct flb_output_instance *o_ins;  /* route that we are retrying   */
     struct flb_task *parent;            /* parent task reference        */
+    struct flb_sched_request *request;  /* pending scheduler request    */
     struct mk_list _head;               /* link to parent task list     */
 };
 
 /* A task takes a buffer and sync input and output instances to handle it */
 struct flb_task {
     int id;                             /* task id                   */
+    uint16_t gen;                       /* task id generation        */
     uint64_t ref_id;                    /* external reference id     */
     uint8_t status;                     /* new task or running ?     */
     int n_threads;                      /* number number of threads  */
@@ -94,6 +101,8 @@ struct flb_task {
     struct flb_config *config;          /* parent flb config             */
 };
 
+struct flb_task *flb_task_get(struct flb_config *config, int id, int gen);
+void flb_task_map_destroy(struct flb_config *config);
 int flb_task_running_count(struct flb_config *config);
 int flb_task_running_print(struct flb_config *config);
 
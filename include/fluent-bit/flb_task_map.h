@@ -23,8 +23,22 @@
 
 #include <inttypes.h>
 
+/* Initial number of slots, the map doubles its size when full */
+#define FLB_TASK_MAP_SIZE   256
+
+/* Highest number of tasks, the task_id of the engine events is 22 bits */
+#define FLB_TASK_MAP_MAX    (1 << 22)
+
+/*
+ * A slot of the tasks map, the task id is the slot index. Free slots are
+ * linked by index and 'gen' is incremented each time a slot is released, so
+ * an event for a task already destroyed is not taken for the task using the
+ * same id later.
+ */
 struct flb_task_map {
-    void    *task;
+    void     *task;
+    uint16_t gen;                /* slot generation         */
+    int      next_free;          /* next free slot or -1    */
 };
 
 #endif
@@ -28,9 +28,15 @@
 #include <fluent-bit/flb_network.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_pipe.h>
 
 #ifdef FLB_HAVE_TLS
 #include <mbedtls/net.h>
+#include <mbedtls/ssl.h>
+#endif
+
+#ifdef FLB_HAVE_METRICS
+#include <fluent-bit/flb_metrics.h>
 #endif
 
 /*
@@ -46,6 +52,15 @@
  * ---
  */
 
+/* Connections pool statistics */
+struct flb_upstream_stats {
+    size_t idle;                   /* keepalive connections available */
+    size_t busy;                   /* connections in use              */
+    size_t connects;               /* connections established         */
+    size_t tls_resumed;            /* TLS sessions resumed            */
+    size_t waits;                  /* flushes queued for a connection */
+};
+
 /* Upstream handler */
 struct flb_upstream {
     struct mk_event_loop *evl;
@@ -67,6 +82,12 @@ struct flb_upstream {
     int ha_mode;
     void *ha_ctx;
 
+    /*
+     * Output workers use a private copy of the upstream context bound to
+     * their own event loop, 'parent' references the original one.
+     */
+    struct flb_upstream *parent;
+
     /*
      * This field is a linked-list-head for upstream connections that
      * are available for usage. When a connection is taken, it's moved to the
@@ -82,14 +103,56 @@ struct flb_upstream {
 
     struct mk_list destroy_queue;
 
+    /*
+     * Connections opened in the background to keep 'net.min_idle_connections'
+     * available, they are moved to 'av_queue' once connected. The pool is
+     * filled once a connection has been requested ('active').
+     */
+    int active;
+    struct mk_list prewarm_queue;
+
+    /*
+     * Flushes waiting for a connection once 'net.max_connections' has been
+     * reached. They are resumed from the wake channel when a connection is
+     * released, the channel is created on first use.
+     */
+    struct mk_list conn_waiters;
+    struct mk_event wake_event;
+    flb_pipefd_t wake_ch[2];
+    int wake_signaled;
+
+    /*
+     * Pool statistics: 'stats' counts the activity of this context and it's
+     * reported periodically to the upstream of the engine, 'stats_total'
+     * sums it for the context and its worker copies (flb_upstream_stats_get).
+     */
+    struct flb_upstream_stats stats;
+    struct flb_upstream_stats stats_sent;
+    struct flb_upstream_stats stats_total;
+    pthread_mutex_t stats_lock;
+
+#ifdef FLB_HAVE_METRICS
+    /* output instance metrics where the pool statistics are exported */
+    struct flb_metrics *metrics;
+#endif
+
 #ifdef FLB_HAVE_TLS
     /* context with mbedTLS data to handle certificates and keys */
     struct flb_tls *tls;
+
+    /* last TLS session, resumed by the next connection */
+    int tls_resume_set;
+    mbedtls_ssl_session tls_resume;
 #endif
 
     struct mk_list _head;
 };
 
+/* Background connection states */
+#define FLB_UPSTREAM_PREWARM_NONE       0
+#define FLB_UPSTREAM_PREWARM_CONNECT    1
+#define FLB_UPSTREAM_PREWARM_HANDSHAKE  2
+
 /* Upstream TCP connection */
 struct flb_upstream_conn {
     struct mk_event event;
@@ -125,6 +188,9 @@ struct flb_upstream_conn {
     time_t ts_connect_start;
     time_t ts_connect_timeout;
 
+    /* Background connect state, FLB_UPSTREAM_PREWARM_* */
+    int prewarm;
+
     /* Upstream parent */
     struct flb_upstream *u;
 
@@ -135,6 +201,12 @@ struct flb_upstream_conn {
      */
     struct mk_list _head;
 
+    /*
+     * Requests pipelining state, set once the connection has been shared
+     * through flb_upstream_conn_get_shared() (flb_upstream_pipeline.h).
+     */
+    void *pipeline;
+
 #ifdef FLB_HAVE_TLS
     /* Each TCP connections using TLS needs a session */
     struct flb_tls_session *tls_session;
@@ -148,17 +220,23 @@ struct flb_upstream *flb_upstream_create(struct flb_config *config,
 struct flb_upstream *flb_upstream_create_url(struct flb_config *config,
                                              const char *url, int flags,
                                              void *tls);
+struct flb_upstream *flb_upstream_clone(struct flb_upstream *u,
+                                        struct mk_event_loop *evl,
+                                        void *tls);
 
 int flb_upstream_destroy(struct flb_upstream *u);
 
 int flb_upstream_conn_recycle(struct flb_upstream_conn *conn, int val);
 struct flb_upstream_conn *flb_upstream_conn_get(struct flb_upstream *u);
+struct flb_upstream_conn *flb_upstream_conn_get_shared(struct flb_upstream *u);
 int flb_upstream_conn_release(struct flb_upstream_conn *u_conn);
-int flb_upstream_conn_timeouts(struct flb_config *ctx);
-int flb_upstream_conn_pending_destroy(struct flb_config *ctx);
+int flb_upstream_conn_timeouts(struct mk_list *list);
+int flb_upstream_conn_pending_destroy(struct mk_list *list);
 int flb_upstream_set_property(struct flb_config *config,
                               struct flb_net_setup *net, char *k, char *v);
 int flb_upstream_is_async(struct flb_upstream *u);
+void flb_upstream_stats_get(struct flb_upstream *u,
+                            struct flb_upstream_stats *stats);
 struct mk_list *flb_upstream_get_config_map(struct flb_config *config);
 
 #endif
@@ -23,13 +23,51 @@
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_sds.h>
+#include <fluent-bit/flb_time.h>
 #include <fluent-bit/flb_upstream_node.h>
 #include <monkey/mk_core.h>
 
+#include <pthread.h>
+
+/* Balancing strategies, set with 'balance' in the [UPSTREAM] section */
+#define FLB_UPSTREAM_HA_ROUND_ROBIN        0
+#define FLB_UPSTREAM_HA_LEAST_OUTSTANDING  1   /* fewest requests in flight */
+#define FLB_UPSTREAM_HA_EWMA               2   /* best of two random nodes  */
+#define FLB_UPSTREAM_HA_TAG_HASH           3   /* consistent hashing by tag */
+
+/* Points of each node on the consistent hashing ring */
+#define FLB_UPSTREAM_HA_RING_POINTS      160
+
+/* Weight of the last request in the latency moving average */
+#define FLB_UPSTREAM_HA_EWMA_ALPHA       0.3
+
+/* Latency (ms) of a failed request when the node has no connect timeout */
+#define FLB_UPSTREAM_HA_FAIL_PENALTY     10000
+
+struct flb_upstream_ha_point {
+    uint32_t hash;
+    struct flb_upstream_node *node;
+};
+
 struct flb_upstream_ha {
     flb_sds_t name;            /* Upstream HA name        */
+    int balance;               /* Balancing strategy      */
     void *last_used_node;      /* Last used node          */
     struct mk_list nodes;      /* List of available nodes */
+
+    /*
+     * Passive health checks: after 'max_fails' consecutive failed requests
+     * a node is ejected for 'fail_timeout' seconds (0: disabled).
+     */
+    int max_fails;
+    int fail_timeout;
+
+    /* consistent hashing ring, built on first use */
+    int ring_size;
+    struct flb_upstream_ha_point *ring;
+
+    uint64_t rand_state;       /* random node picks       */
+    pthread_mutex_t lock;
 };
 
 struct flb_upstream_ha *flb_upstream_ha_create(const char *name);
@@ -37,6 +75,16 @@ void flb_upstream_ha_destroy(struct flb_upstream_ha *ctx);
 void flb_upstream_ha_node_add(struct flb_upstream_ha *ctx,
                               struct flb_upstream_node *node);
 struct flb_upstream_node *flb_upstream_ha_node_get(struct flb_upstream_ha *ctx);
+struct flb_upstream_node *flb_upstream_ha_node_get_key(struct flb_upstream_ha *ctx,
+                                                       const char *key,
+                                                       int key_len);
+void flb_upstream_ha_node_begin(struct flb_upstream_ha *ctx,
+                                struct flb_upstream_node *node,
+                                struct flb_time *start);
+void flb_upstream_ha_node_end(struct flb_upstream_ha *ctx,
+                              struct flb_upstream_node *node,
+                              struct flb_time *start, int success);
+int flb_upstream_ha_balance_type(const char *str);
 struct flb_upstream_ha *flb_upstream_ha_from_file(const char *file,
                                                   struct flb_config *config);
 
@@ -58,6 +58,13 @@ struct flb_upstream_node {
 
     void *data;
 
+    /* Balancing and passive health checks, see flb_upstream_ha.c */
+    int outstanding;          /* requests in flight           */
+    int fails;                /* consecutive failed requests  */
+    int ejected;              /* out of the rotation ?        */
+    time_t ejected_until;
+    double ewma_latency;      /* request latency average (ms) */
+
     /* Link to upstream_ha or upstream */
     struct mk_list _head;
 };
@@ -0,0 +1,105 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_UPSTREAM_PIPELINE_H
+#define FLB_UPSTREAM_PIPELINE_H
+
+#include <monkey/mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_compat.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_thread.h>
+#include <fluent-bit/flb_upstream.h>
+
+/*
+ * Pipelined connections
+ * =====================
+ * With 'net.pipeline_depth' greater than one, up to that number of flush
+ * co-routines share a keepalive connection: each one writes its request as
+ * soon as the previous writer is done and responses are read back in the
+ * same order (HTTP/1.1 pipelining).
+ *
+ * Only one co-routine writes at a time and only the one owning the oldest
+ * request reads. Bytes read past the end of a response belong to the next
+ * one and are kept in 'carry'. Co-routines waiting for their turn or for
+ * the socket are parked in 'waiters' and all resumed on any change, either
+ * by the socket event or through the wake channel. Any error breaks the
+ * connection: every pending request fails and its flush is retried.
+ */
+struct flb_upstream_pipeline {
+    struct mk_event event;         /* wake channel event          */
+    flb_pipefd_t ch[2];            /* wake channel                */
+    int signaled;                  /* wake up pending ?           */
+    int users;                     /* co-routines sharing it      */
+    int broken;                    /* no more requests allowed    */
+    int want;                      /* socket events to wait for   */
+    struct mk_list sent;           /* requests waiting a response */
+    struct mk_list waiters;        /* parked co-routines          */
+
+    /* request being written */
+    struct flb_upstream_pipeline_req *writer;
+
+    /* bytes of the following responses */
+    char *carry;
+    size_t carry_len;
+    size_t carry_size;
+
+    struct flb_upstream_conn *u_conn;
+};
+
+/* A request in flight, owned by the co-routine sending it */
+struct flb_upstream_pipeline_req {
+    struct flb_thread *th;
+    int queued;                    /* linked to 'sent' ?          */
+    struct mk_list _head;          /* link to 'sent'              */
+    struct mk_list _head_wait;     /* link to 'waiters'           */
+};
+
+/* Returns the pipeline of a connection taken in shared mode, or NULL */
+static inline struct flb_upstream_pipeline *flb_upstream_pipeline_get(
+                                             struct flb_upstream_conn *u_conn)
+{
+    struct flb_upstream_pipeline *pl = u_conn->pipeline;
+
+    if (pl && pl->users > 0) {
+        return pl;
+    }
+    return NULL;
+}
+
+int flb_upstream_pipeline_attach(struct flb_upstream_conn *u_conn);
+int flb_upstream_pipeline_join(struct flb_upstream_conn *u_conn);
+int flb_upstream_pipeline_release(struct flb_upstream_conn *u_conn);
+void flb_upstream_pipeline_destroy(struct flb_upstream_pipeline *pl);
+
+int flb_upstream_pipeline_writev(struct flb_upstream_conn *u_conn,
+                                 struct flb_upstream_pipeline_req *req,
+                                 const struct iovec *iov, int iovcnt,
+                                 int more, size_t *out_len);
+ssize_t flb_upstream_pipeline_read(struct flb_upstream_conn *u_conn,
+                                   struct flb_upstream_pipeline_req *req,
+                                   void *buf, size_t len);
+void flb_upstream_pipeline_done(struct flb_upstream_conn *u_conn,
+                                struct flb_upstream_pipeline_req *req,
+                                const char *next, size_t len);
+void flb_upstream_pipeline_abort(struct flb_upstream_conn *u_conn,
+                                 struct flb_upstream_pipeline_req *req);
+
+#endif
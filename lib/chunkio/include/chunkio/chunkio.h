@@ -35,12 +35,26 @@
 /* Storage backend */
 #define CIO_STORE_FS        0
 #define CIO_STORE_MEM       1
+#define CIO_STORE_SEG       2   /* log-structured segment files */
 
 /* flags */
 #define CIO_OPEN            1   /* open/create file reference */
 #define CIO_OPEN_RD         2   /* open and read/mmap content if exists */
 #define CIO_CHECKSUM        4   /* enable checksum verification (crc32) */
 #define CIO_FULL_SYNC       8   /* force sync to fs through MAP_SYNC */
+#define CIO_SEGMENTS       16   /* file streams use the segment backend */
+#define CIO_OPEN_DOWN      32   /* register a chunk without loading it */
+
+/*
+ * Checksum algorithms: crc32c is the default when the CPU provides the
+ * crc32 instruction, every chunk records the algorithm it was written with.
+ */
+#define CIO_CRC32           0
+#define CIO_CRC32C          1
+
+/* Compression of locked file chunks, see cio_compress.h */
+#define CIO_COMPRESS_NONE   0
+#define CIO_COMPRESS_LZ4    1
 
 /* Return status */
 #define CIO_CORRUPTED      -3  /* Indicate that a chunk is corrupted */
@@ -50,6 +64,9 @@
 
 /* defaults */
 #define CIO_MAX_CHUNKS_UP  64   /* default limit for cio_ctx->max_chunks_up */
+#define CIO_SCAN_WORKERS    4   /* default threads listing stream dirs */
+
+struct cio_commit_info;
 
 struct cio_ctx {
     int flags;
@@ -74,6 +91,28 @@ struct cio_ctx {
      */
     size_t max_chunks_up;
 
+    /* checksum algorithm for new chunks: CIO_CRC32 or CIO_CRC32C */
+    int checksum_type;
+
+    /* compression for locked file chunks: CIO_COMPRESS_NONE or LZ4 */
+    int compression;
+
+    /* startup scan: listing threads and manifest (see cio_manifest.h) */
+    int scan_workers;
+    int manifest;
+
+    /* preallocated size of segment files (CIO_STORE_SEG) */
+    size_t segment_size;
+
+    /* group commit, see cio_commit.h */
+    int commit_interval;      /* commit window in milliseconds, 0 = off */
+    size_t commit_bytes;      /* commit once pending bytes reach this   */
+    int commit_fd;            /* root path descriptor used to sync      */
+    int commit_chunks;        /* pending chunk syncs                    */
+    size_t commit_pending;    /* pending bytes                          */
+    void (*commit_cb)(struct cio_ctx *, struct cio_commit_info *, void *);
+    void *commit_data;
+
     /* streams */
     struct mk_list streams;
 };
@@ -90,6 +129,11 @@ int cio_qsort(struct cio_ctx *ctx, int (*compar)(const void *, const void *));
 void cio_set_log_callback(struct cio_ctx *ctx, void (*log_cb));
 int cio_set_log_level(struct cio_ctx *ctx, int level);
 int cio_set_max_chunks_up(struct cio_ctx *ctx, int n);
+int cio_set_segment_size(struct cio_ctx *ctx, size_t size);
+int cio_set_checksum_type(struct cio_ctx *ctx, int type);
+int cio_set_compression(struct cio_ctx *ctx, int type);
+int cio_set_scan_workers(struct cio_ctx *ctx, int n);
+int cio_set_manifest(struct cio_ctx *ctx, int enabled);
 
 int cio_meta_write(struct cio_chunk *ch, char *buf, size_t size);
 int cio_meta_cmp(struct cio_chunk *ch, char *meta_buf, int meta_len);
@@ -0,0 +1,63 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef CIO_COMMIT_H
+#define CIO_COMMIT_H
+
+#include <stdint.h>
+#include <chunkio/chunkio.h>
+
+/*
+ * Group commit
+ * ============
+ *
+ * With CIO_FULL_SYNC every chunk sync waits for its own msync(MS_SYNC) or
+ * fdatasync(2) call. When group commit is enabled, syncs only schedule the
+ * write-back and register the chunk as pending; the pending writes of all
+ * streams are made durable together by a single file system sync issued by
+ * cio_commit(), either when the caller's commit window expires or as soon
+ * as the pending bytes reach the configured limit. Group commit is only
+ * available on systems providing syncfs(2).
+ *
+ * The commit callback is invoked after every durable sync (grouped or not)
+ * with the number of chunks and bytes covered and the time it took.
+ */
+
+struct cio_commit_info {
+    int chunks;               /* number of chunk syncs covered       */
+    size_t bytes;             /* bytes written by those syncs        */
+    uint64_t latency;         /* sync time in microseconds           */
+};
+
+int cio_set_group_commit(struct cio_ctx *ctx, int interval, size_t bytes);
+void cio_set_commit_callback(struct cio_ctx *ctx,
+                             void (*cb)(struct cio_ctx *,
+                                        struct cio_commit_info *, void *),
+                             void *data);
+int cio_commit(struct cio_ctx *ctx);
+int cio_commit_enabled(struct cio_ctx *ctx);
+
+/* internal: used by the backends */
+int cio_commit_add(struct cio_ctx *ctx, size_t bytes);
+uint64_t cio_commit_time(void);
+void cio_commit_report(struct cio_ctx *ctx, int chunks, size_t bytes,
+                       uint64_t start);
+void cio_commit_destroy(struct cio_ctx *ctx);
+
+#endif
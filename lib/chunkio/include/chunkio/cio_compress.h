@@ -0,0 +1,59 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef CIO_COMPRESS_H
+#define CIO_COMPRESS_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Chunk compression
+ * =================
+ *
+ * When compression is enabled on the context, file chunks that are locked
+ * (no more data will be appended) get compressed when they are put down.
+ * The compressed file keeps the chunk header, with CIO_FILE_FLAG_LZ4 set
+ * and the length of the uncompressed content section stored in the header
+ * padding, followed by the content section (metadata length, metadata and
+ * data) compressed as a single LZ4 block:
+ *
+ *   +--------+-------+-------+---------+---------+---------------------+
+ *   | id     | crc32 | flags | pad     | raw_len | pad     | LZ4 block |
+ *   | 2      | 4     | 1     | 1       | 8       | 6       | ...       |
+ *   +--------+-------+-------+---------+---------+---------------------+
+ *
+ * The checksum covers the uncompressed content, so it is verified after
+ * the chunk is brought up and decompressed in memory. Writing to a
+ * compressed chunk restores the uncompressed file first.
+ */
+
+/* chunks with less content than this are not worth compressing */
+#define CIO_COMPRESS_MIN_SIZE   4096
+
+size_t cio_lz4_bound(size_t size);
+ssize_t cio_lz4_compress(const char *src, size_t src_size,
+                         char *dst, size_t dst_size);
+ssize_t cio_lz4_decompress(const char *src, size_t src_size,
+                           char *dst, size_t dst_size);
+
+/* CPU time consumed by the calling thread, in microseconds */
+uint64_t cio_compress_cpu_time(void);
+
+#endif
@@ -20,10 +20,28 @@
 #ifndef CIO_CRC32_H
 #define CIO_CRC32_H
 
+#include <chunkio/chunkio.h>
 #include <crc32/crc32.h>
 
 #define cio_crc32_init()            crc_init()
 #define cio_crc32_update(a, b, c)   crc_update(a, b, c)
 #define cio_crc32_finalize(a)       crc_finalize(a)
 
+/*
+ * CRC32C (Castagnoli polynomial) shares the init and finalize steps with
+ * CRC32, see CIO_CRC32C in chunkio.h.
+ */
+void cio_crc32c_init();
+int cio_crc32c_hw();
+crc_t cio_crc32c_update(crc_t crc, const void *data, size_t len);
+
+static inline crc_t cio_crc_update(int type, crc_t crc,
+                                   const void *data, size_t len)
+{
+    if (type == CIO_CRC32C) {
+        return cio_crc32c_update(crc, data, len);
+    }
+    return cio_crc32_update(crc, data, len);
+}
+
 #endif
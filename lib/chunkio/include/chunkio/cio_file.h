@@ -38,6 +38,8 @@ struct cio_file {
     /* cached addr */
     char *st_content;
     crc_t crc_cur;
+    int crc_type;             /* CIO_CRC32 or CIO_CRC32C */
+    int compressed;           /* map holds a decompressed copy */
 };
 
 struct cio_file *cio_file_open(struct cio_ctx *ctx,
@@ -38,6 +38,9 @@
  *    +--------------+----------------+
  *    |   4 BYTES CRC32 + 16 BYTES    +--> CRC32(Content) + Padding
  *    +-------------------------------+
+ *    (the first padding byte holds flags, CIO_FILE_FLAG_CRC32C means the
+ *     checksum is CRC32C instead of CRC32, files without flags are CRC32.
+ *     CIO_FILE_FLAG_LZ4 marks a compressed file, see cio_compress.h)
  *    |            Content            |
  *    |  +-------------------------+  |
  *    |  |         2 BYTES         +-----> Metadata Length
@@ -59,6 +62,13 @@
 #define CIO_FILE_ID_01          0x00    /* header: second byte */
 #define CIO_FILE_HEADER_MIN       24    /* 24 bytes for the header */
 #define CIO_FILE_CONTENT_OFFSET   22
+#define CIO_FILE_FLAGS_OFFSET      6
+
+/* header flags */
+#define CIO_FILE_RAW_LEN_OFFSET    8
+
+#define CIO_FILE_FLAG_CRC32C    0x01    /* content checksum is crc32c */
+#define CIO_FILE_FLAG_LZ4       0x02    /* content is compressed (LZ4) */
 
 /* Return pointer to hash position */
 static inline char *cio_file_st_get_hash(char *map)
@@ -66,7 +76,41 @@ static inline char *cio_file_st_get_hash(char *map)
     return map + 2;
 }
 
+/* Return header flags */
+static inline uint8_t cio_file_st_get_flags(char *map)
+{
+    return (uint8_t) map[CIO_FILE_FLAGS_OFFSET];
+}
+
+/* Set header flags */
+static inline void cio_file_st_set_flags(char *map, uint8_t flags)
+{
+    map[CIO_FILE_FLAGS_OFFSET] = flags;
+}
+
 /* Return metadata length */
+/* Uncompressed content section length of a compressed file */
+static inline uint64_t cio_file_st_get_raw_len(char *map)
+{
+    int i;
+    uint64_t len = 0;
+
+    for (i = 0; i < 8; i++) {
+        len = (len << 8) | (uint8_t) map[CIO_FILE_RAW_LEN_OFFSET + i];
+    }
+    return len;
+}
+
+static inline void cio_file_st_set_raw_len(char *map, uint64_t len)
+{
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        map[CIO_FILE_RAW_LEN_OFFSET + i] = (uint8_t) len;
+        len >>= 8;
+    }
+}
+
 static inline uint16_t cio_file_st_get_meta_len(char *map)
 {
     return (uint16_t) ((uint8_t) map[22] << 8) | (uint8_t) map[23];
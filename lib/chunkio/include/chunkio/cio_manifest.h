@@ -0,0 +1,69 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef CIO_MANIFEST_H
+#define CIO_MANIFEST_H
+
+#include <stdint.h>
+#include <chunkio/chunkio.h>
+#include <chunkio/cio_scan.h>
+
+/*
+ * Chunk manifest
+ * ==============
+ *
+ * On cio_destroy() the chunk files of every file stream are listed and
+ * saved in '<root_path>/.manifest' together with the modification time of
+ * the stream directory:
+ *
+ *   header:  | CIOMAN01 (8) | crc32 (4) | n_streams (4) |
+ *   stream:  | mtime_sec (8) | mtime_nsec (4) | n_chunks (4) | name\0 |
+ *            | chunk name\0 | chunk name\0 | ...                     |
+ *
+ * Integers are in network byte order and the checksum covers everything
+ * after it. cio_load() reads the manifest once and removes it; the
+ * listing of a stream is used only if its directory was not modified
+ * since (any chunk created, deleted or renamed changes the directory
+ * mtime), otherwise the directory is listed again.
+ */
+
+#define CIO_MANIFEST_FILE      ".manifest"
+#define CIO_MANIFEST_MAGIC     "CIOMAN01"
+
+struct cio_manifest_stream {
+    char *name;
+    int64_t mtime_sec;
+    long mtime_nsec;
+    int count;
+    char **names;             /* point into the manifest buffer */
+};
+
+struct cio_manifest {
+    char *buf;
+    size_t size;
+    int count;
+    struct cio_manifest_stream *streams;
+};
+
+int cio_manifest_write(struct cio_ctx *ctx);
+struct cio_manifest *cio_manifest_load(struct cio_ctx *ctx);
+int cio_manifest_lookup(struct cio_manifest *mf, struct cio_scan_dir *sd);
+void cio_manifest_destroy(struct cio_manifest *mf);
+
+#endif
@@ -20,8 +20,30 @@
 #ifndef CIO_SCAN_H
 #define CIO_SCAN_H
 
+#include <time.h>
 #include <chunkio/chunkio.h>
 
+/*
+ * Listing of a stream directory. Listings of different streams are
+ * independent and run in parallel on up to ctx->scan_workers threads, the
+ * chunks are registered afterwards from the caller thread.
+ */
+struct cio_scan_dir {
+    struct cio_stream *st;
+    char *path;               /* stream directory                    */
+    struct timespec mtime;    /* directory mtime before listing it   */
+    char **names;             /* regular files, dotfiles are skipped */
+    int count;
+    int size;
+    int borrowed;             /* names are owned by the manifest     */
+    int ret;                  /* listing status                      */
+};
+
+struct cio_scan_dir *cio_scan_dir_create(struct cio_ctx *ctx,
+                                         struct cio_stream *st);
+void cio_scan_dir_destroy(struct cio_scan_dir *sd);
+int cio_scan_dirs(struct cio_ctx *ctx, struct cio_scan_dir **dirs, int n);
+
 int cio_scan_streams(struct cio_ctx *ctx, char *chunk_extension);
 void cio_scan_dump(struct cio_ctx *ctx);
 
@@ -0,0 +1,153 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef CIO_SEGMENT_H
+#define CIO_SEGMENT_H
+
+#include <chunkio/chunkio.h>
+#include <chunkio/cio_stream.h>
+#include <chunkio/cio_chunk.h>
+#include <chunkio/cio_crc32.h>
+
+/*
+ * Segment storage layout
+ * ======================
+ *
+ * A stream using the segment backend owns a set of preallocated files
+ * named '<root_path>/<stream>/<id>.seg'. Chunks are kept in memory while
+ * they are being written and every sync appends a full copy of the chunk
+ * (a record) to the active segment:
+ *
+ *   +--------+-----+----------+----------+----------+------+------+------+
+ *   | state  | crc | name_len | meta_len | flags    | data | name | meta |
+ *   | 4      | 4   | 2        | 2        | 4        | 8    | ...  | ...  |
+ *   +--------+-----+----------+----------+----------+------+------+------+
+ *   | content data ...                                     | padding     |
+ *   +------------------------------------------------------+-------------+
+ *
+ * Integers are stored in network byte order and records are aligned to
+ * 8 bytes. The 'state' field is rewritten in place when a record becomes
+ * obsolete (the chunk was deleted or synced again), so the record headers
+ * act as the index of the segment: restoring a stream only needs to read
+ * headers, not the content. A zeroed 'state' marks the end of the log.
+ * The 'flags' field tells the checksum algorithm of the record: crc32c
+ * when CIO_SEG_REC_CRC32C is set, crc32 otherwise.
+ *
+ * Every segment keeps a counter of live records, once it drops to zero
+ * and the segment is not the one receiving appends, the file is removed.
+ *
+ * With group commit a new record is not durable until the next
+ * cio_commit(), so the record it replaces stays live until then: it's
+ * queued in the stream index and killed by cio_segment_commit() once the
+ * file system sync succeeded. If the process stops before that, the scan
+ * finds both copies and keeps the newest.
+ */
+
+#define CIO_SEG_MAGIC          "CIOSEG01"
+#define CIO_SEG_HEADER_SIZE    16
+#define CIO_SEG_REC_HEADER     24
+#define CIO_SEG_REC_ALIGN      8
+#define CIO_SEG_EXTENSION      ".seg"
+
+/* record states */
+#define CIO_SEG_REC_END        0x00000000
+#define CIO_SEG_REC_LIVE       0x4c495645      /* 'LIVE' */
+#define CIO_SEG_REC_DEAD       0x44454144      /* 'DEAD' */
+
+/* record flags */
+#define CIO_SEG_REC_CRC32C     0x00000001
+
+/* default size of a preallocated segment file */
+#define CIO_SEG_DEFAULT_SIZE   (16 * 1024 * 1024)
+
+/* A segment file */
+struct cio_segment {
+    uint32_t id;              /* segment id (file name)              */
+    int fd;                   /* file descriptor                     */
+    int live;                 /* number of live records              */
+    size_t size;              /* preallocated size                   */
+    size_t offset;            /* next append position                */
+    char *path;               /* absolute path                       */
+    struct mk_list _head;     /* link to cio_segment_index->segments */
+};
+
+/* A replaced record waiting for the next group commit to be killed */
+struct cio_segment_kill {
+    struct cio_segment *seg;  /* segment holding the record          */
+    off_t rec_offset;         /* record position                     */
+    struct mk_list _head;     /* link to cio_segment_index->kills    */
+};
+
+/* Per stream index of segments */
+struct cio_segment_index {
+    uint32_t next_id;         /* id for the next segment created     */
+    struct cio_segment *active;
+    struct mk_list segments;
+    struct mk_list kills;     /* records to kill after the commit    */
+};
+
+/* Chunk context */
+struct cio_segment_chunk {
+    int up;                   /* content loaded in memory ?          */
+    int synced;               /* sync after latest write ?           */
+
+    /* metadata: always in memory */
+    char *meta_data;
+    int  meta_len;
+
+    /* content-data, only set when the chunk is 'up' */
+    char *buf_data;
+    size_t buf_size;
+    size_t realloc_size;
+    size_t data_size;         /* content length (up or down)         */
+
+    /* latest persisted record, if any */
+    struct cio_segment *seg;
+    off_t rec_offset;
+    uint32_t rec_crc;
+    int rec_crc_type;
+};
+
+/* stream index */
+int cio_segment_index_create(struct cio_ctx *ctx, struct cio_stream *st);
+void cio_segment_index_destroy(struct cio_stream *st);
+int cio_segment_scan(struct cio_ctx *ctx, struct cio_stream *st);
+void cio_segment_scan_dump(struct cio_ctx *ctx, struct cio_stream *st);
+void cio_segment_commit(struct cio_ctx *ctx);
+
+/* chunks */
+struct cio_segment_chunk *cio_segment_open(struct cio_ctx *ctx,
+                                           struct cio_stream *st,
+                                           struct cio_chunk *ch,
+                                           int flags, size_t size,
+                                           int *err);
+void cio_segment_close(struct cio_chunk *ch, int delete);
+int cio_segment_write(struct cio_chunk *ch, const void *buf, size_t count);
+int cio_segment_write_metadata(struct cio_chunk *ch, char *buf, size_t size);
+int cio_segment_sync(struct cio_chunk *ch);
+int cio_segment_content_copy(struct cio_chunk *ch,
+                             void **out_buf, size_t *out_size);
+size_t cio_segment_real_size(struct cio_chunk *ch);
+
+int cio_segment_is_up(struct cio_chunk *ch);
+int cio_segment_up(struct cio_chunk *ch);
+int cio_segment_up_force(struct cio_chunk *ch);
+int cio_segment_down(struct cio_chunk *ch);
+
+#endif
@@ -20,13 +20,26 @@
 #ifndef CIO_STREAM_H
 #define CIO_STREAM_H
 
+#include <stdint.h>
 #include <monkey/mk_core/mk_list.h>
 
+/* Compression counters of the chunks of a stream, CPU times in usec */
+struct cio_stream_compress {
+    uint64_t chunks;          /* chunks compressed                   */
+    uint64_t raw_bytes;       /* content size before compression     */
+    uint64_t bytes;           /* content size after compression      */
+    uint64_t cpu_time;        /* time spent compressing              */
+    uint64_t decompressed;    /* chunks decompressed                 */
+    uint64_t decompress_time; /* time spent decompressing            */
+};
+
 struct cio_stream {
-    int type;                 /* type: CIO_STORE_FS or CIO_STORE_MEM */
+    int type;                 /* type: CIO_STORE_FS, MEM or SEG */
     char *name;               /* stream name */
     struct mk_list _head;     /* head link to ctx->streams list */
     struct mk_list chunks;
+    void *backend;            /* stream context (segment index) */
+    struct cio_stream_compress compress;
     void *parent;             /* ref to parent ctx */
 };
 
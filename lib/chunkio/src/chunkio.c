@@ -27,6 +27,10 @@
 #include <chunkio/cio_log.h>
 #include <chunkio/cio_stream.h>
 #include <chunkio/cio_scan.h>
+#include <chunkio/cio_segment.h>
+#include <chunkio/cio_commit.h>
+#include <chunkio/cio_crc32.h>
+#include <chunkio/cio_manifest.h>
 
 #include <monkey/mk_core/mk_list.h>
 
@@ -79,6 +83,19 @@ struct cio_ctx *cio_create(const char *root_path,
     mk_list_init(&ctx->streams);
     ctx->page_size = getpagesize();
     ctx->max_chunks_up = CIO_MAX_CHUNKS_UP;
+    ctx->segment_size = CIO_SEG_DEFAULT_SIZE;
+    ctx->commit_fd = -1;
+    ctx->compression = CIO_COMPRESS_NONE;
+    ctx->scan_workers = CIO_SCAN_WORKERS;
+    ctx->manifest = CIO_FALSE;
+
+    /* prefer crc32c when the CPU can compute it */
+    if (cio_crc32c_hw()) {
+        ctx->checksum_type = CIO_CRC32C;
+    }
+    else {
+        ctx->checksum_type = CIO_CRC32;
+    }
     ctx->flags = flags;
 
     /* Counters */
@@ -187,7 +204,12 @@ void cio_destroy(struct cio_ctx *ctx)
         return;
     }
 
+    if (ctx->manifest == CIO_TRUE) {
+        cio_manifest_write(ctx);
+    }
+
     cio_stream_destroy_all(ctx);
+    cio_commit_destroy(ctx);
     free(ctx->root_path);
     free(ctx);
 }
@@ -216,3 +238,56 @@ int cio_set_max_chunks_up(struct cio_ctx *ctx, int n)
     ctx->max_chunks_up = n;
     return 0;
 }
+
+int cio_set_segment_size(struct cio_ctx *ctx, size_t size)
+{
+    if (size < (size_t) ctx->page_size) {
+        return -1;
+    }
+
+    ctx->segment_size = size;
+    return 0;
+}
+
+/* Checksum algorithm used for chunks created from now on */
+int cio_set_checksum_type(struct cio_ctx *ctx, int type)
+{
+    if (type != CIO_CRC32 && type != CIO_CRC32C) {
+        return -1;
+    }
+
+    ctx->checksum_type = type;
+    return 0;
+}
+
+/* Compression applied to file chunks once they are locked and put down */
+int cio_set_compression(struct cio_ctx *ctx, int type)
+{
+    if (type != CIO_COMPRESS_NONE && type != CIO_COMPRESS_LZ4) {
+        return -1;
+    }
+
+    ctx->compression = type;
+    return 0;
+}
+
+/* Number of threads used to list stream directories on cio_load() */
+int cio_set_scan_workers(struct cio_ctx *ctx, int n)
+{
+    if (n < 1) {
+        return -1;
+    }
+
+    ctx->scan_workers = n;
+    return 0;
+}
+
+/*
+ * Keep a manifest of the chunk files on cio_destroy() so the next
+ * cio_load() can skip listing the stream directories that did not change.
+ */
+int cio_set_manifest(struct cio_ctx *ctx, int enabled)
+{
+    ctx->manifest = enabled ? CIO_TRUE : CIO_FALSE;
+    return 0;
+}
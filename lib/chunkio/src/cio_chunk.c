@@ -22,6 +22,7 @@
 #include <chunkio/cio_version.h>
 #include <chunkio/cio_file.h>
 #include <chunkio/cio_memfs.h>
+#include <chunkio/cio_segment.h>
 #include <chunkio/cio_log.h>
 
 #include <string.h>
@@ -50,7 +51,7 @@ struct cio_chunk *cio_chunk_open(struct cio_ctx *ctx, struct cio_stream *st,
         return NULL;
     }
 #ifndef CIO_HAVE_BACKEND_FILESYSTEM
-    if (st->type == CIO_STORE_FS) {
+    if (st->type == CIO_STORE_FS || st->type == CIO_STORE_SEG) {
         cio_log_error(ctx, "[cio chunk] file system backend not supported");
         return NULL;
     }
@@ -81,6 +82,9 @@ struct cio_chunk *cio_chunk_open(struct cio_ctx *ctx, struct cio_stream *st,
         *err = CIO_OK;
         backend = cio_memfs_open(ctx, st, ch, flags, size);
     }
+    else if (st->type == CIO_STORE_SEG) {
+        backend = cio_segment_open(ctx, st, ch, flags, size, err);
+    }
 
     if (!backend) {
         mk_list_del(&ch->_head);
@@ -114,6 +118,9 @@ void cio_chunk_close(struct cio_chunk *ch, int delete)
     else if (type == CIO_STORE_FS) {
         cio_file_close(ch, delete);
     }
+    else if (type == CIO_STORE_SEG) {
+        cio_segment_close(ch, delete);
+    }
 
     mk_list_del(&ch->_head);
     free(ch->name);
@@ -133,6 +140,7 @@ int cio_chunk_write_at(struct cio_chunk *ch, off_t offset,
     int type;
     struct cio_memfs *mf;
     struct cio_file *cf;
+    struct cio_segment_chunk *sc;
 
     type = ch->st->type;
     if (type == CIO_STORE_MEM) {
@@ -143,6 +151,11 @@ int cio_chunk_write_at(struct cio_chunk *ch, off_t offset,
         cf = ch->backend;
         cf->data_size = offset;
     }
+    else if (type == CIO_STORE_SEG) {
+        sc = ch->backend;
+        sc->data_size = offset;
+        sc->synced = CIO_FALSE;
+    }
 
     /*
      * By default backends (fs, mem) appends data after the it last position,
@@ -163,6 +176,9 @@ int cio_chunk_write(struct cio_chunk *ch, const void *buf, size_t count)
     else if (type == CIO_STORE_FS) {
         ret = cio_file_write(ch, buf, count);
     }
+    else if (type == CIO_STORE_SEG) {
+        ret = cio_segment_write(ch, buf, count);
+    }
 
     return ret;
 }
@@ -176,6 +192,9 @@ int cio_chunk_sync(struct cio_chunk *ch)
     if (type == CIO_STORE_FS) {
         ret = cio_file_sync(ch);
     }
+    else if (type == CIO_STORE_SEG) {
+        ret = cio_segment_sync(ch);
+    }
 
     return ret;
 }
@@ -186,6 +205,7 @@ int cio_chunk_get_content(struct cio_chunk *ch, char **buf, size_t *size)
     int type;
     struct cio_memfs *mf;
     struct cio_file *cf;
+    struct cio_segment_chunk *sc;
 
     type = ch->st->type;
     if (type == CIO_STORE_MEM) {
@@ -204,6 +224,18 @@ int cio_chunk_get_content(struct cio_chunk *ch, char **buf, size_t *size)
         *buf = cio_file_st_get_content(cf->map);
         return ret;
     }
+    else if (type == CIO_STORE_SEG) {
+        sc = ch->backend;
+        if (cio_segment_is_up(ch) == CIO_FALSE) {
+            ret = cio_segment_up_force(ch);
+            if (ret != CIO_OK) {
+                return ret;
+            }
+        }
+        *size = sc->data_size;
+        *buf = sc->buf_data;
+        return ret;
+    }
 
     return CIO_ERROR;
 }
@@ -221,6 +253,9 @@ int cio_chunk_get_content_copy(struct cio_chunk *ch,
     else if (type == CIO_STORE_FS) {
         return cio_file_content_copy(ch, out_buf, out_size);
     }
+    else if (type == CIO_STORE_SEG) {
+        return cio_segment_content_copy(ch, out_buf, out_size);
+    }
 
     return CIO_ERROR;
 }
@@ -231,6 +266,7 @@ size_t cio_chunk_get_content_end_pos(struct cio_chunk *ch)
     off_t pos = 0;
     struct cio_memfs *mf;
     struct cio_file *cf;
+    struct cio_segment_chunk *sc;
 
     type = ch->st->type;
     if (type == CIO_STORE_MEM) {
@@ -241,6 +277,10 @@ size_t cio_chunk_get_content_end_pos(struct cio_chunk *ch)
         cf = ch->backend;
         pos = (off_t) (cio_file_st_get_content(cf->map) + cf->data_size);
     }
+    else if (type == CIO_STORE_SEG) {
+        sc = ch->backend;
+        pos = (off_t) (sc->buf_data + sc->data_size);
+    }
 
     return pos;
 }
@@ -250,6 +290,7 @@ ssize_t cio_chunk_get_content_size(struct cio_chunk *ch)
     int type;
     struct cio_memfs *mf;
     struct cio_file *cf;
+    struct cio_segment_chunk *sc;
 
     type = ch->st->type;
     if (type == CIO_STORE_MEM) {
@@ -260,6 +301,10 @@ ssize_t cio_chunk_get_content_size(struct cio_chunk *ch)
         cf = ch->backend;
         return cf->data_size;
     }
+    else if (type == CIO_STORE_SEG) {
+        sc = ch->backend;
+        return sc->data_size;
+    }
 
     return -1;
 }
@@ -279,6 +324,9 @@ ssize_t cio_chunk_get_real_size(struct cio_chunk *ch)
         cf = ch->backend;
         return cf->fs_size;
     }
+    else if (type == CIO_STORE_SEG) {
+        return cio_segment_real_size(ch);
+    }
 
     return -1;
 }
@@ -339,6 +387,7 @@ int cio_chunk_tx_begin(struct cio_chunk *ch)
     int type;
     struct cio_memfs *mf;
     struct cio_file *cf;
+    struct cio_segment_chunk *sc;
 
     if (cio_chunk_is_locked(ch)) {
         return CIO_RETRY;
@@ -360,6 +409,10 @@ int cio_chunk_tx_begin(struct cio_chunk *ch)
         ch->tx_crc = cf->crc_cur;
         ch->tx_content_length = cf->data_size;
     }
+    else if (type == CIO_STORE_SEG) {
+        sc = ch->backend;
+        ch->tx_content_length = sc->data_size;
+    }
 
     return CIO_OK;
 }
@@ -388,6 +441,7 @@ int cio_chunk_tx_rollback(struct cio_chunk *ch)
     int type;
     struct cio_memfs *mf;
     struct cio_file *cf;
+    struct cio_segment_chunk *sc;
 
     if (ch->tx_active == CIO_FALSE) {
         return -1;
@@ -404,6 +458,10 @@ int cio_chunk_tx_rollback(struct cio_chunk *ch)
         cf->crc_cur = ch->tx_crc;
         cf->data_size = ch->tx_content_length;
     }
+    else if (type == CIO_STORE_SEG) {
+        sc = ch->backend;
+        sc->data_size = ch->tx_content_length;
+    }
 
     ch->tx_active = CIO_FALSE;
     return CIO_OK;
@@ -427,6 +485,9 @@ int cio_chunk_is_up(struct cio_chunk *ch)
         cf = ch->backend;
         return cio_file_is_up(ch, cf);
     }
+    else if (type == CIO_STORE_SEG) {
+        return cio_segment_is_up(ch);
+    }
 
     return CIO_FALSE;
 }
@@ -436,7 +497,7 @@ int cio_chunk_is_file(struct cio_chunk *ch)
     int type;
 
     type = ch->st->type;
-    if (type == CIO_STORE_FS) {
+    if (type == CIO_STORE_FS || type == CIO_STORE_SEG) {
         return CIO_TRUE;
     }
 
@@ -451,6 +512,9 @@ int cio_chunk_down(struct cio_chunk *ch)
     if (type == CIO_STORE_FS) {
         return cio_file_down(ch);
     }
+    else if (type == CIO_STORE_SEG) {
+        return cio_segment_down(ch);
+    }
 
     return CIO_OK;
 }
@@ -463,6 +527,9 @@ int cio_chunk_up(struct cio_chunk *ch)
     if (type == CIO_STORE_FS) {
         return cio_file_up(ch);
     }
+    else if (type == CIO_STORE_SEG) {
+        return cio_segment_up(ch);
+    }
 
     return CIO_OK;
 }
@@ -475,6 +542,9 @@ int cio_chunk_up_force(struct cio_chunk *ch)
     if (type == CIO_STORE_FS) {
         return cio_file_up_force(ch);
     }
+    else if (type == CIO_STORE_SEG) {
+        return cio_segment_up_force(ch);
+    }
 
     return CIO_OK;
 }
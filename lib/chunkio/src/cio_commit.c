@@ -0,0 +1,194 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <chunkio/chunkio_compat.h>
+#include <chunkio/chunkio.h>
+#include <chunkio/cio_log.h>
+#include <chunkio/cio_commit.h>
+#include <chunkio/cio_segment.h>
+
+/*
+ * Enable group commit: 'interval' is the commit window in milliseconds that
+ * the caller honors by invoking cio_commit() periodically, 'bytes' (optional)
+ * forces an early commit once that much data is pending.
+ *
+ * It requires syncfs(2): sync(2) may return before the data is written back
+ * (it does on macOS and the BSDs) so it cannot make the pending writes
+ * durable.
+ */
+int cio_set_group_commit(struct cio_ctx *ctx, int interval, size_t bytes)
+{
+    int fd;
+
+#ifndef CIO_HAVE_SYNCFS
+    cio_log_error(ctx, "[cio commit] group commit requires syncfs(2), "
+                  "not available on this system");
+    return -1;
+#endif
+
+    if (interval <= 0) {
+        cio_log_error(ctx, "[cio commit] invalid commit interval %i",
+                      interval);
+        return -1;
+    }
+
+    if (!ctx->root_path) {
+        cio_log_error(ctx, "[cio commit] group commit requires a root path");
+        return -1;
+    }
+
+    if (ctx->commit_fd == -1) {
+        fd = open(ctx->root_path, O_RDONLY);
+        if (fd == -1) {
+            cio_errno();
+            cio_log_error(ctx, "[cio commit] cannot open %s", ctx->root_path);
+            return -1;
+        }
+        ctx->commit_fd = fd;
+    }
+
+    ctx->commit_interval = interval;
+    ctx->commit_bytes = bytes;
+
+    return 0;
+}
+
+void cio_set_commit_callback(struct cio_ctx *ctx,
+                             void (*cb)(struct cio_ctx *,
+                                        struct cio_commit_info *, void *),
+                             void *data)
+{
+    ctx->commit_cb = cb;
+    ctx->commit_data = data;
+}
+
+int cio_commit_enabled(struct cio_ctx *ctx)
+{
+    if (ctx->commit_interval > 0 && (ctx->flags & CIO_FULL_SYNC)) {
+        return CIO_TRUE;
+    }
+    return CIO_FALSE;
+}
+
+/* Monotonic time in microseconds */
+uint64_t cio_commit_time()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Notify the caller about a durable sync started at 'start' */
+void cio_commit_report(struct cio_ctx *ctx, int chunks, size_t bytes,
+                       uint64_t start)
+{
+    struct cio_commit_info info;
+
+    if (!ctx->commit_cb) {
+        return;
+    }
+
+    info.chunks = chunks;
+    info.bytes = bytes;
+    info.latency = cio_commit_time() - start;
+    ctx->commit_cb(ctx, &info, ctx->commit_data);
+}
+
+/*
+ * Make all pending writes durable with a single sync of the file system
+ * holding the root path.
+ */
+int cio_commit(struct cio_ctx *ctx)
+{
+    int ret;
+    int chunks;
+    size_t bytes;
+    uint64_t start;
+
+    if (ctx->commit_chunks == 0) {
+        return 0;
+    }
+
+    chunks = ctx->commit_chunks;
+    bytes = ctx->commit_pending;
+    ctx->commit_chunks = 0;
+    ctx->commit_pending = 0;
+
+    start = cio_commit_time();
+#ifdef CIO_HAVE_SYNCFS
+    ret = syncfs(ctx->commit_fd);
+#else
+    /* not reached: group commit cannot be enabled */
+    errno = ENOSYS;
+    ret = -1;
+#endif
+    if (ret == -1) {
+        cio_errno();
+        cio_log_error(ctx, "[cio commit] sync failed, %i chunks pending",
+                      chunks);
+        ctx->commit_chunks += chunks;
+        ctx->commit_pending += bytes;
+        return -1;
+    }
+
+    cio_log_debug(ctx, "[cio commit] %i chunks, %lu bytes",
+                  chunks, bytes);
+    cio_commit_report(ctx, chunks, bytes, start);
+
+    /* the new segment records are durable, kill the ones they replaced */
+    cio_segment_commit(ctx);
+
+    return 0;
+}
+
+/* Register a chunk sync waiting for the next group commit */
+int cio_commit_add(struct cio_ctx *ctx, size_t bytes)
+{
+    ctx->commit_chunks++;
+    ctx->commit_pending += bytes;
+
+    if (ctx->commit_bytes > 0 && ctx->commit_pending >= ctx->commit_bytes) {
+        return cio_commit(ctx);
+    }
+
+    return 0;
+}
+
+/* Flush what is pending and release the commit resources */
+void cio_commit_destroy(struct cio_ctx *ctx)
+{
+    if (ctx->commit_fd == -1) {
+        return;
+    }
+
+    cio_commit(ctx);
+    close(ctx->commit_fd);
+    ctx->commit_fd = -1;
+}
@@ -0,0 +1,281 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * LZ4 block format encoder and decoder.
+ *
+ * A block is a list of sequences: a token (literal length in the high
+ * nibble, match length minus 4 in the low nibble), optional literal length
+ * bytes, the literals, a little endian 16 bit match offset and optional
+ * match length bytes. The last sequence only carries literals. Blocks
+ * produced here can be read by any LZ4 implementation and the other way
+ * around.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <chunkio/cio_compress.h>
+
+#define LZ4_MINMATCH       4
+#define LZ4_LASTLITERALS   5     /* the last 5 bytes are always literals */
+#define LZ4_MFLIMIT       12     /* no match can start in the last 12 bytes */
+#define LZ4_MAX_DISTANCE  65535
+#define LZ4_HASH_LOG      14
+#define LZ4_SKIP_TRIGGER   6     /* speed up on incompressible data */
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t val;
+
+    memcpy(&val, p, sizeof(val));
+    return val;
+}
+
+static inline uint32_t lz4_hash(uint32_t val)
+{
+    return (val * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline uint8_t *write_length(uint8_t *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t) len;
+
+    return op;
+}
+
+static inline uint8_t *write_literals(uint8_t *op, uint8_t *token,
+                                      const uint8_t *lit, size_t len)
+{
+    if (len >= 15) {
+        *token = 15 << 4;
+        op = write_length(op, len - 15);
+    }
+    else {
+        *token = (uint8_t) (len << 4);
+    }
+
+    memcpy(op, lit, len);
+    return op + len;
+}
+
+/* Worst case size of a compressed block */
+size_t cio_lz4_bound(size_t size)
+{
+    return size + (size / 255) + 16;
+}
+
+/*
+ * Compress 'src' as a single block, 'dst' must hold at least
+ * cio_lz4_bound(src_size) bytes. Returns the compressed size or -1.
+ */
+ssize_t cio_lz4_compress(const char *src, size_t src_size,
+                         char *dst, size_t dst_size)
+{
+    size_t lit;
+    size_t mlen;
+    size_t off;
+    uint32_t h;
+    uint32_t miss;
+    uint32_t *table;
+    uint8_t *op = (uint8_t *) dst;
+    uint8_t *token;
+    const uint8_t *base = (const uint8_t *) src;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    const uint8_t *end = base + src_size;
+    const uint8_t *ref;
+    const uint8_t *mp;
+    const uint8_t *rp;
+    const uint8_t *mflimit;
+    const uint8_t *match_limit;
+
+    if (dst_size < cio_lz4_bound(src_size)) {
+        return -1;
+    }
+
+    if (src_size > LZ4_MFLIMIT) {
+        table = calloc(1 << LZ4_HASH_LOG, sizeof(uint32_t));
+        if (!table) {
+            return -1;
+        }
+
+        mflimit = end - LZ4_MFLIMIT;
+        match_limit = end - LZ4_LASTLITERALS;
+        miss = 1 << LZ4_SKIP_TRIGGER;
+
+        while (ip < mflimit) {
+            h = lz4_hash(read32(ip));
+            ref = base + table[h];
+            table[h] = (uint32_t) (ip - base);
+
+            if (ref >= ip || ip - ref > LZ4_MAX_DISTANCE ||
+                read32(ref) != read32(ip)) {
+                /* the longer we miss, the bigger the step */
+                ip += miss++ >> LZ4_SKIP_TRIGGER;
+                continue;
+            }
+            miss = 1 << LZ4_SKIP_TRIGGER;
+
+            /* extend the match backwards into the pending literals */
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            /* and forward */
+            mp = ip + LZ4_MINMATCH;
+            rp = ref + LZ4_MINMATCH;
+            while (mp < match_limit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+
+            lit = ip - anchor;
+            token = op++;
+            op = write_literals(op, token, anchor, lit);
+
+            off = ip - ref;
+            *op++ = (uint8_t) off;
+            *op++ = (uint8_t) (off >> 8);
+
+            mlen = mp - ip - LZ4_MINMATCH;
+            if (mlen >= 15) {
+                *token |= 15;
+                op = write_length(op, mlen - 15);
+            }
+            else {
+                *token |= (uint8_t) mlen;
+            }
+
+            ip = mp;
+            anchor = ip;
+
+            /* index a position inside the match to catch repetitions */
+            table[lz4_hash(read32(ip - 2))] = (uint32_t) (ip - 2 - base);
+        }
+        free(table);
+    }
+
+    /* last literals */
+    token = op++;
+    op = write_literals(op, token, anchor, end - anchor);
+
+    return (ssize_t) (op - (uint8_t *) dst);
+}
+
+/*
+ * Decompress a block into 'dst'. Every length and offset is validated
+ * against both buffers, a malformed block returns -1.
+ */
+ssize_t cio_lz4_decompress(const char *src, size_t src_size,
+                           char *dst, size_t dst_size)
+{
+    uint8_t b;
+    uint8_t token;
+    size_t i;
+    size_t lit;
+    size_t mlen;
+    size_t off;
+    const uint8_t *ip = (const uint8_t *) src;
+    const uint8_t *iend = ip + src_size;
+    const uint8_t *ref;
+    uint8_t *op = (uint8_t *) dst;
+    uint8_t *oend = op + dst_size;
+
+    while (ip < iend) {
+        token = *ip++;
+
+        /* literals */
+        lit = token >> 4;
+        if (lit == 15) {
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+
+        if (lit > (size_t) (iend - ip) || lit > (size_t) (oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+
+        /* the last sequence has no match */
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (off == 0 || off > (size_t) (op - (uint8_t *) dst)) {
+            return -1;
+        }
+
+        mlen = token & 15;
+        if (mlen == 15) {
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ4_MINMATCH;
+
+        if (mlen > (size_t) (oend - op)) {
+            return -1;
+        }
+
+        ref = op - off;
+        if (off >= mlen) {
+            memcpy(op, ref, mlen);
+        }
+        else {
+            /* overlapping copy repeats the pattern */
+            for (i = 0; i < mlen; i++) {
+                op[i] = ref[i];
+            }
+        }
+        op += mlen;
+    }
+
+    return (ssize_t) (op - (uint8_t *) dst);
+}
+
+uint64_t cio_compress_cpu_time()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
@@ -0,0 +1,256 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <chunkio/chunkio_compat.h>
+#include <chunkio/cio_crc32.h>
+
+#ifdef CIO_HAVE_CRC32C_X86
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+/* reflected Castagnoli polynomial */
+#define CRC32C_POLY         0x82f63b78
+
+/*
+ * The hardware path splits large buffers in three lanes that are hashed
+ * in parallel and merged by a carry-less multiplication.
+ */
+#define CRC32C_LONG         8192
+#define CRC32C_SHORT        256
+
+static int crc32c_ready = 0;
+static uint32_t crc32c_table[8][256];
+static crc_t (*crc32c_update)(crc_t, const unsigned char *, size_t);
+
+/* Software, slicing-by-8 */
+static crc_t crc32c_sw(crc_t crc, const unsigned char *p, size_t len)
+{
+    uint32_t c = crc;
+    uint32_t d1;
+    uint32_t d2;
+
+    while (len > 0 && ((uintptr_t) p & 7)) {
+        c = crc32c_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+        len--;
+    }
+
+    while (len >= 8) {
+        memcpy(&d1, p, 4);
+        memcpy(&d2, p + 4, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        d1 = __builtin_bswap32(d1);
+        d2 = __builtin_bswap32(d2);
+#endif
+        d1 ^= c;
+        c = crc32c_table[7][d1 & 0xff] ^
+            crc32c_table[6][(d1 >> 8) & 0xff] ^
+            crc32c_table[5][(d1 >> 16) & 0xff] ^
+            crc32c_table[4][d1 >> 24] ^
+            crc32c_table[3][d2 & 0xff] ^
+            crc32c_table[2][(d2 >> 8) & 0xff] ^
+            crc32c_table[1][(d2 >> 16) & 0xff] ^
+            crc32c_table[0][d2 >> 24];
+        p += 8;
+        len -= 8;
+    }
+
+    while (len > 0) {
+        c = crc32c_table[0][(c ^ *p++) & 0xff] ^ (c >> 8);
+        len--;
+    }
+
+    return c;
+}
+
+#ifdef CIO_HAVE_CRC32C_X86
+
+/* x^(8 * n) mod P for the lane sizes */
+static uint32_t shift_long1;
+static uint32_t shift_long2;
+static uint32_t shift_short1;
+static uint32_t shift_short2;
+
+/* a * b mod P, both polynomials in reflected form */
+static uint32_t multmodp(uint32_t a, uint32_t b)
+{
+    uint32_t m = (uint32_t) 1 << 31;
+    uint32_t p = 0;
+
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if ((a & (m - 1)) == 0) {
+                break;
+            }
+        }
+        m >>= 1;
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+
+    return p;
+}
+
+/* x^(8 * n) mod P: the operator that appends 'n' zero bytes */
+static uint32_t zeros_operator(size_t n)
+{
+    uint32_t p = (uint32_t) 1 << 31;          /* x^0 */
+    uint32_t sq = (uint32_t) 1 << 23;         /* x^8 */
+
+    while (n > 0) {
+        if (n & 1) {
+            p = multmodp(sq, p);
+        }
+        sq = multmodp(sq, sq);
+        n >>= 1;
+    }
+
+    return p;
+}
+
+/* crc * x^(8 * n) mod P, 'k' being the operator for 'n' bytes */
+__attribute__((target("sse4.2,pclmul")))
+static inline uint32_t crc32c_shift(uint32_t crc, uint32_t k)
+{
+    __m128i p;
+    uint64_t v;
+
+    p = _mm_clmulepi64_si128(_mm_cvtsi32_si128(crc),
+                             _mm_cvtsi32_si128(k), 0x00);
+    v = (uint64_t) _mm_cvtsi128_si64(p) << 1;
+    return _mm_crc32_u32(0, (uint32_t) v) ^ (uint32_t) (v >> 32);
+}
+
+#define CRC32C_LANES(size, k1, k2)                                  \
+    while (len >= 3 * (size)) {                                     \
+        c1 = 0;                                                     \
+        c2 = 0;                                                     \
+        end = p + (size);                                           \
+        do {                                                        \
+            memcpy(&w0, p, 8);                                      \
+            memcpy(&w1, p + (size), 8);                             \
+            memcpy(&w2, p + 2 * (size), 8);                         \
+            c0 = _mm_crc32_u64(c0, w0);                             \
+            c1 = _mm_crc32_u64(c1, w1);                             \
+            c2 = _mm_crc32_u64(c2, w2);                             \
+            p += 8;                                                 \
+        } while (p < end);                                          \
+        c0 = crc32c_shift(c0, k2) ^ crc32c_shift(c1, k1) ^ c2;      \
+        p += 2 * (size);                                            \
+        len -= 3 * (size);                                          \
+    }
+
+/* SSE4.2 crc32 instruction, three lanes folded with PCLMULQDQ */
+__attribute__((target("sse4.2,pclmul")))
+static crc_t crc32c_hw(crc_t crc, const unsigned char *p, size_t len)
+{
+    uint64_t c0 = (uint32_t) crc;
+    uint64_t c1;
+    uint64_t c2;
+    uint64_t w0;
+    uint64_t w1;
+    uint64_t w2;
+    const unsigned char *end;
+
+    while (len > 0 && ((uintptr_t) p & 7)) {
+        c0 = _mm_crc32_u8(c0, *p++);
+        len--;
+    }
+
+    CRC32C_LANES(CRC32C_LONG, shift_long1, shift_long2);
+    CRC32C_LANES(CRC32C_SHORT, shift_short1, shift_short2);
+
+    while (len >= 8) {
+        memcpy(&w0, p, 8);
+        c0 = _mm_crc32_u64(c0, w0);
+        p += 8;
+        len -= 8;
+    }
+
+    while (len > 0) {
+        c0 = _mm_crc32_u8(c0, *p++);
+        len--;
+    }
+
+    return (uint32_t) c0;
+}
+#endif
+
+/* Build the tables and pick the fastest implementation for this CPU */
+void cio_crc32c_init()
+{
+    int i;
+    int k;
+    uint32_t c;
+
+    if (crc32c_ready) {
+        return;
+    }
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+        for (k = 0; k < 8; k++) {
+            c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc32c_table[0][i] = c;
+    }
+    for (i = 0; i < 256; i++) {
+        c = crc32c_table[0][i];
+        for (k = 1; k < 8; k++) {
+            c = crc32c_table[0][c & 0xff] ^ (c >> 8);
+            crc32c_table[k][i] = c;
+        }
+    }
+    crc32c_update = crc32c_sw;
+
+#ifdef CIO_HAVE_CRC32C_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+        shift_long1 = zeros_operator(CRC32C_LONG);
+        shift_long2 = zeros_operator(2 * CRC32C_LONG);
+        shift_short1 = zeros_operator(CRC32C_SHORT);
+        shift_short2 = zeros_operator(2 * CRC32C_SHORT);
+        crc32c_update = crc32c_hw;
+    }
+#endif
+
+    crc32c_ready = 1;
+}
+
+/* Hardware accelerated CRC32C available ? */
+int cio_crc32c_hw()
+{
+    cio_crc32c_init();
+#ifdef CIO_HAVE_CRC32C_X86
+    return crc32c_update == crc32c_hw;
+#else
+    return 0;
+#endif
+}
+
+crc_t cio_crc32c_update(crc_t crc, const void *data, size_t len)
+{
+    if (!crc32c_ready) {
+        cio_crc32c_init();
+    }
+    return crc32c_update(crc, (const unsigned char *) data, len);
+}
@@ -33,6 +33,8 @@
 #include <chunkio/chunkio.h>
 #include <chunkio/cio_crc32.h>
 #include <chunkio/cio_chunk.h>
+#include <chunkio/cio_commit.h>
+#include <chunkio/cio_compress.h>
 #include <chunkio/cio_file.h>
 #include <chunkio/cio_file_st.h>
 #include <chunkio/cio_log.h>
@@ -77,7 +79,7 @@ void cio_file_calculate_checksum(struct cio_file *cf, crc_t *out)
 
     len = content_len(cf);
     in_data = (unsigned char *) cf->map + CIO_FILE_CONTENT_OFFSET;
-    val = cio_crc32_update(cf->crc_cur, in_data, len);
+    val = cio_crc_update(cf->crc_type, cf->crc_cur, in_data, len);
     *out = val;
 }
 
@@ -86,17 +88,20 @@ static void update_checksum(struct cio_file *cf,
                             unsigned char *data, size_t len)
 {
     crc_t crc;
+    uint32_t val;
 
-    crc = cio_crc32_update(cf->crc_cur, data, len);
-    memcpy(cf->map + 2, &crc, sizeof(crc));
+    crc = cio_crc_update(cf->crc_type, cf->crc_cur, data, len);
+    val = (uint32_t) crc;
+    memcpy(cf->map + 2, &val, sizeof(val));
     cf->crc_cur = crc;
 }
 
 /* Finalize CRC32 context and update the memory map */
 static void finalize_checksum(struct cio_file *cf)
 {
-    crc_t crc;
+    uint32_t crc;
 
+    /* only the 4 bytes of the checksum, the header flags follow it */
     crc = cio_crc32_finalize(cf->crc_cur);
     crc = htonl(crc);
     memcpy(cf->map + 2, &crc, sizeof(crc));
@@ -127,6 +132,8 @@ static int adjust_layout(struct cio_chunk *ch,
 /* Initialize Chunk header & structure */
 static void write_init_header(struct cio_chunk *ch, struct cio_file *cf)
 {
+    uint32_t crc;
+
     memcpy(cf->map, cio_file_init_bytes, sizeof(cio_file_init_bytes));
 
     /* If no checksum is enabled, reset the initial crc32 bytes */
@@ -136,6 +143,14 @@ static void write_init_header(struct cio_chunk *ch, struct cio_file *cf)
         cf->map[4] = 0;
         cf->map[5] = 0;
     }
+    else if (cf->crc_type == CIO_CRC32C) {
+        /* checksum of the empty content (metadata length) */
+        crc = cio_crc32_finalize(cio_crc32c_update(cio_crc32_init(),
+                                     cf->map + CIO_FILE_CONTENT_OFFSET, 2));
+        crc = htonl(crc);
+        memcpy(cf->map + 2, &crc, 4);
+        cio_file_st_set_flags(cf->map, CIO_FILE_FLAG_CRC32C);
+    }
 }
 
 /* Return the available size in the file map to write data */
@@ -162,7 +177,7 @@ static int cio_file_format_check(struct cio_chunk *ch,
                                  struct cio_file *cf, int flags)
 {
     unsigned char *p;
-    crc_t crc_check;
+    uint32_t crc_check;
     crc_t crc;
 
     p = (unsigned char *) cf->map;
@@ -183,6 +198,7 @@ static int cio_file_format_check(struct cio_chunk *ch,
         }
 
         /* Initialize init bytes */
+        cf->crc_type = ch->ctx->checksum_type;
         write_init_header(ch, cf);
 
         /* Write checksum in context (note: crc32 not finalized) */
@@ -198,6 +214,14 @@ static int cio_file_format_check(struct cio_chunk *ch,
             return -1;
         }
 
+        /* Checksum algorithm, files without flags use crc32 */
+        if (cio_file_st_get_flags(cf->map) & CIO_FILE_FLAG_CRC32C) {
+            cf->crc_type = CIO_CRC32C;
+        }
+        else {
+            cf->crc_type = CIO_CRC32;
+        }
+
         /* Checksum */
         if (ch->ctx->flags & CIO_CHECKSUM) {
             /* Initialize CRC variable */
@@ -209,9 +233,8 @@ static int cio_file_format_check(struct cio_chunk *ch,
             /* Calculate content checksum */
             cio_file_calculate_checksum(cf, &crc);
 
-            /* Compare */
-            crc_check = cio_crc32_finalize(crc);
-            crc_check = htonl(crc_check);
+            /* Compare the 4 bytes of the checksum */
+            crc_check = htonl((uint32_t) cio_crc32_finalize(crc));
             if (memcmp(p, &crc_check, sizeof(crc_check)) != 0) {
                 cio_log_debug(ch->ctx, "[cio file] invalid crc32 at %s/%s",
                               ch->name, cf->path);
@@ -224,6 +247,286 @@ static int cio_file_format_check(struct cio_chunk *ch,
     return 0;
 }
 
+/* Write the whole buffer at the current position of 'fd' */
+static int write_all(int fd, char *buf, size_t size)
+{
+    ssize_t bytes;
+
+    while (size > 0) {
+        bytes = write(fd, buf, size);
+        if (bytes == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += bytes;
+        size -= bytes;
+    }
+
+    return 0;
+}
+
+/* Make the entries of the stream directory durable */
+static int stream_dir_sync(struct cio_chunk *ch)
+{
+    int fd;
+    int ret;
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s/%s", ch->ctx->root_path, ch->st->name);
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    ret = fsync(fd);
+    close(fd);
+
+    return ret;
+}
+
+/*
+ * Atomically replace the chunk file with the content of 'hdr' and 'data':
+ * the new version is written to a hidden temporary file and renamed over
+ * the chunk. The scanner skips such files and removes the ones left by a
+ * crash before the rename. Returns a read/write file descriptor of the new
+ * file.
+ *
+ * With CIO_FULL_SYNC (also set by group commit) the chunk was durable, so
+ * is the replacement before returning: the new file is synced before the
+ * rename and the directory after it, a crash cannot leave a partial file
+ * in place of the chunk.
+ */
+static int file_rewrite(struct cio_chunk *ch, struct cio_file *cf,
+                        char *hdr, size_t hdr_len,
+                        char *data, size_t data_len)
+{
+    int fd;
+    int ret;
+    size_t size;
+    char *tmp;
+
+    size = strlen(cf->path) + 8;
+    tmp = malloc(size);
+    if (!tmp) {
+        cio_errno();
+        return -1;
+    }
+    snprintf(tmp, size, "%s/%s/.%s.tmp",
+             ch->ctx->root_path, ch->st->name, ch->name);
+
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, (mode_t) 0600);
+    if (fd == -1) {
+        cio_errno();
+        cio_log_error(ch->ctx, "[cio file] cannot create %s", tmp);
+        free(tmp);
+        return -1;
+    }
+
+    ret = write_all(fd, hdr, hdr_len);
+    if (ret == 0 && data_len > 0) {
+        ret = write_all(fd, data, data_len);
+    }
+    if (ret == 0 && (ch->ctx->flags & CIO_FULL_SYNC)) {
+        ret = fsync(fd);
+    }
+    if (ret == 0) {
+        ret = rename(tmp, cf->path);
+    }
+
+    if (ret == -1) {
+        cio_errno();
+        cio_log_error(ch->ctx, "[cio file] cannot rewrite chunk %s:%s",
+                      ch->st->name, ch->name);
+        close(fd);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+
+    /* the new content is in place already, only the rename may be lost */
+    if ((ch->ctx->flags & CIO_FULL_SYNC) && stream_dir_sync(ch) == -1) {
+        cio_errno();
+        cio_log_error(ch->ctx, "[cio file] cannot sync stream directory of "
+                      "rewritten chunk %s:%s", ch->st->name, ch->name);
+    }
+
+    return fd;
+}
+
+/*
+ * Compress the content section of a synced chunk into a new version of
+ * the file. Returns 1 if the file was replaced, 0 if compression does not
+ * pay off or -1 on error (the original file is left untouched).
+ */
+static int file_compress(struct cio_chunk *ch, struct cio_file *cf)
+{
+    int fd;
+    char hdr[CIO_FILE_CONTENT_OFFSET];
+    char *buf;
+    size_t raw_len;
+    size_t bound;
+    ssize_t len;
+    uint64_t start;
+    struct cio_stream *st = ch->st;
+
+    if (cf->data_size < CIO_COMPRESS_MIN_SIZE) {
+        return 0;
+    }
+
+    start = cio_compress_cpu_time();
+
+    raw_len = content_len(cf);
+    bound = cio_lz4_bound(raw_len);
+    buf = malloc(bound);
+    if (!buf) {
+        cio_errno();
+        return -1;
+    }
+
+    len = cio_lz4_compress(cf->map + CIO_FILE_CONTENT_OFFSET, raw_len,
+                           buf, bound);
+    if (len == -1 || (size_t) len >= raw_len) {
+        free(buf);
+        return len == -1 ? -1 : 0;
+    }
+
+    /* same header, flagged and with the uncompressed length */
+    memcpy(hdr, cf->map, sizeof(hdr));
+    cio_file_st_set_flags(hdr, cio_file_st_get_flags(hdr) | CIO_FILE_FLAG_LZ4);
+    cio_file_st_set_raw_len(hdr, raw_len);
+
+    fd = file_rewrite(ch, cf, hdr, sizeof(hdr), buf, len);
+    free(buf);
+    if (fd == -1) {
+        return -1;
+    }
+    close(fd);
+
+    cf->fs_size = sizeof(hdr) + len;
+
+    st->compress.chunks++;
+    st->compress.raw_bytes += raw_len;
+    st->compress.bytes += len;
+    st->compress.cpu_time += cio_compress_cpu_time() - start;
+
+    cio_log_debug(ch->ctx, "[cio file] %s:%s compressed %lu -> %lu bytes",
+                  st->name, ch->name, raw_len, len);
+    return 1;
+}
+
+/*
+ * Replace the map of a compressed file with an anonymous map holding the
+ * uncompressed chunk. On success 'size' is set to the uncompressed file
+ * size.
+ */
+static int file_decompress(struct cio_chunk *ch, struct cio_file *cf,
+                           size_t *size)
+{
+    char *map;
+    size_t alloc;
+    ssize_t len;
+    uint64_t raw_len;
+    uint64_t start;
+    struct cio_ctx *ctx = ch->ctx;
+
+    start = cio_compress_cpu_time();
+
+    raw_len = cio_file_st_get_raw_len(cf->map);
+    if (*size < CIO_FILE_CONTENT_OFFSET || raw_len < 2 ||
+        raw_len > SIZE_MAX / 2) {
+        cio_log_error(ctx, "[cio file] invalid compressed chunk %s",
+                      cf->path);
+        return CIO_CORRUPTED;
+    }
+
+    alloc = ROUND_UP(CIO_FILE_CONTENT_OFFSET + raw_len, ctx->page_size);
+    map = mmap(0, alloc, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        cio_errno();
+        return CIO_ERROR;
+    }
+
+    memcpy(map, cf->map, CIO_FILE_CONTENT_OFFSET);
+    len = cio_lz4_decompress(cf->map + CIO_FILE_CONTENT_OFFSET,
+                             *size - CIO_FILE_CONTENT_OFFSET,
+                             map + CIO_FILE_CONTENT_OFFSET, raw_len);
+
+    munmap(cf->map, cf->alloc_size);
+    cf->map = NULL;
+    cf->alloc_size = 0;
+
+    if (len != (ssize_t) raw_len) {
+        cio_log_error(ctx, "[cio file] cannot decompress chunk %s", cf->path);
+        munmap(map, alloc);
+        return CIO_CORRUPTED;
+    }
+
+    /* the copy in memory looks like a regular chunk */
+    cio_file_st_set_flags(map, cio_file_st_get_flags(map) & ~CIO_FILE_FLAG_LZ4);
+    cio_file_st_set_raw_len(map, 0);
+
+    cf->map = map;
+    cf->alloc_size = alloc;
+    cf->compressed = CIO_TRUE;
+    *size = CIO_FILE_CONTENT_OFFSET + raw_len;
+
+    ch->st->compress.decompressed++;
+    ch->st->compress.decompress_time += cio_compress_cpu_time() - start;
+
+    return CIO_OK;
+}
+
+/*
+ * A compressed chunk is about to be modified: write it back uncompressed
+ * and map the new file.
+ */
+static int file_expand(struct cio_chunk *ch, struct cio_file *cf)
+{
+    int fd;
+    int ret;
+    char *map;
+    size_t size;
+
+    if ((cf->flags & CIO_OPEN) == 0) {
+        cio_log_error(ch->ctx, "[cio file] cannot modify read-only chunk %s:%s",
+                      ch->st->name, ch->name);
+        return -1;
+    }
+
+    size = CIO_FILE_CONTENT_OFFSET + content_len(cf);
+    fd = file_rewrite(ch, cf, cf->map, size, NULL, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    close(cf->fd);
+    cf->fd = fd;
+
+    ret = cio_file_fs_size_change(cf, cf->alloc_size);
+    if (ret == -1) {
+        cio_errno();
+        return -1;
+    }
+
+    map = mmap(0, cf->alloc_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        cio_errno();
+        return -1;
+    }
+    munmap(cf->map, cf->alloc_size);
+
+    cf->map = map;
+    cf->st_content = cio_file_st_get_content(cf->map);
+    cf->fs_size = size;
+    cf->compressed = CIO_FALSE;
+    cf->synced = CIO_FALSE;
+
+    return 0;
+}
+
 /*
  * Unmap the memory for the opened file in question. It make sure
  * to sync changes to disk first.
@@ -275,6 +578,7 @@ static int mmap_file(struct cio_ctx *ctx, struct cio_chunk *ch, size_t size)
     int ret;
     int oflags = 0;
     size_t fs_size = 0;
+    size_t map_size;
     ssize_t content_size;
     struct stat fst;
     struct cio_file *cf;
@@ -346,10 +650,27 @@ static int mmap_file(struct cio_ctx *ctx, struct cio_chunk *ch, size_t size)
         return CIO_ERROR;
     }
     cf->alloc_size = size;
+    cf->compressed = CIO_FALSE;
+
+    /* compressed chunks are used from an uncompressed copy in memory */
+    map_size = fs_size;
+    if (fs_size >= CIO_FILE_HEADER_MIN &&
+        (cio_file_st_get_flags(cf->map) & CIO_FILE_FLAG_LZ4)) {
+        ret = file_decompress(ch, cf, &map_size);
+        if (ret != CIO_OK) {
+            if (cf->map) {
+                munmap(cf->map, cf->alloc_size);
+                cf->map = NULL;
+            }
+            cf->data_size = 0;
+            cf->alloc_size = 0;
+            return ret;
+        }
+    }
 
     /* check content data size */
     if (fs_size > 0) {
-        content_size = cio_file_st_get_content_size(cf->map, fs_size);
+        content_size = cio_file_st_get_content_size(cf->map, map_size);
         if (content_size == -1) {
             cio_log_error(ctx, "invalid content size %s", cf->path);
             munmap(cf->map, cf->alloc_size);
@@ -510,6 +831,9 @@ static inline int open_and_up(struct cio_ctx *ctx)
  *
  * CIO_OPEN_RD:
  *    - If file exists, open it in read-only mode.
+ *
+ * CIO_OPEN_DOWN:
+ *    - Only register the file, it's opened and validated when put up.
  */
 struct cio_file *cio_file_open(struct cio_ctx *ctx,
                                struct cio_stream *st,
@@ -556,7 +880,7 @@ struct cio_file *cio_file_open(struct cio_ctx *ctx,
     }
 
     cf->fd = -1;
-    cf->flags = flags;
+    cf->flags = flags & ~CIO_OPEN_DOWN;
     cf->realloc_size = getpagesize() * 8;
     cf->st_content = NULL;
     cf->crc_cur = cio_crc32_init();
@@ -566,7 +890,7 @@ struct cio_file *cio_file_open(struct cio_ctx *ctx,
 
     /* Should we open and put this file up ? */
     ret = open_and_up(ctx);
-    if (ret == CIO_FALSE) {
+    if (ret == CIO_FALSE || (flags & CIO_OPEN_DOWN)) {
         /* we reached our limit, let the file 'down' */
         return cf;
     }
@@ -670,6 +994,7 @@ int cio_file_up_force(struct cio_chunk *ch)
 int cio_file_down(struct cio_chunk *ch)
 {
     int ret;
+    int compressed = 0;
     struct stat st;
     struct cio_file *cf = (struct cio_file *) ch->backend;
 
@@ -679,21 +1004,34 @@ int cio_file_down(struct cio_chunk *ch)
         return -1;
     }
 
+    /*
+     * A locked chunk will not receive more data, store it compressed
+     * if enabled. On failure the chunk is kept as it is.
+     */
+    if (ch->ctx->compression == CIO_COMPRESS_LZ4 && ch->lock == CIO_TRUE &&
+        cf->compressed == CIO_FALSE && (cf->flags & CIO_OPEN) &&
+        cio_file_sync(ch) == 0) {
+        compressed = file_compress(ch, cf);
+    }
+
     /* unmap memory */
     munmap_file(ch->ctx, ch);
 
     /* Allocated map size is zero */
     cf->alloc_size = 0;
 
-    /* Get file size */
-    ret = fstat(cf->fd, &st);
-    if (ret == -1) {
-        cio_errno();
-        cf->fs_size = 0;
-    }
-    else {
-        cf->fs_size = st.st_size;
+    /* Get file size, the descriptor of a compressed chunk is stale */
+    if (compressed <= 0 && !cf->compressed) {
+        ret = fstat(cf->fd, &st);
+        if (ret == -1) {
+            cio_errno();
+            cf->fs_size = 0;
+        }
+        else {
+            cf->fs_size = st.st_size;
+        }
     }
+    cf->compressed = CIO_FALSE;
 
     /* Close file descriptor */
     close(cf->fd);
@@ -755,11 +1093,15 @@ int cio_file_write(struct cio_chunk *ch, const void *buf, size_t count)
     }
 
     if (cio_chunk_is_up(ch) == CIO_FALSE) {
-        cio_log_error("[cio file] file is not mmap()ed: %s:%s",
+        cio_log_error(ch->ctx, "[cio file] file is not mmap()ed: %s:%s",
                       ch->st->name, ch->name);
         return -1;
     }
 
+    if (cf->compressed == CIO_TRUE && file_expand(ch, cf) == -1) {
+        return -1;
+    }
+
     /* get available size */
     av_size = get_available_size(cf, &meta_len);
 
@@ -838,6 +1180,10 @@ int cio_file_write_metadata(struct cio_chunk *ch, char *buf, size_t size)
         return -1;
     }
 
+    if (cf->compressed == CIO_TRUE && file_expand(ch, cf) == -1) {
+        return -1;
+    }
+
     /* Get metadata pointer */
     meta = cio_file_st_get_meta(cf->map);
 
@@ -921,6 +1267,7 @@ int cio_file_sync(struct cio_chunk *ch)
     int ret;
     int meta_len;
     int sync_mode;
+    uint64_t start = 0;
     void *tmp;
     size_t old_size;
     size_t av_size;
@@ -997,9 +1344,13 @@ int cio_file_sync(struct cio_chunk *ch)
         finalize_checksum(cf);
     }
 
-    /* Sync mode */
-    if (ch->ctx->flags & CIO_FULL_SYNC) {
+    /*
+     * Sync mode: with group commit the write-back is only scheduled here,
+     * the data becomes durable on the next cio_commit().
+     */
+    if ((ch->ctx->flags & CIO_FULL_SYNC) && !cio_commit_enabled(ch->ctx)) {
         sync_mode = MS_SYNC;
+        start = cio_commit_time();
     }
     else {
         sync_mode = MS_ASYNC;
@@ -1012,6 +1363,16 @@ int cio_file_sync(struct cio_chunk *ch)
         return -1;
     }
 
+    if (sync_mode == MS_SYNC) {
+        cio_commit_report(ch->ctx, 1, cf->alloc_size, start);
+    }
+    else if (ch->ctx->flags & CIO_FULL_SYNC) {
+        ret = cio_commit_add(ch->ctx, cf->alloc_size);
+        if (ret == -1) {
+            return -1;
+        }
+    }
+
     cf->synced = CIO_TRUE;
     cio_log_debug(ch->ctx, "[cio file] synced at: %s/%s",
                   ch->st->name, ch->name);
@@ -1070,7 +1431,7 @@ void cio_file_scan_dump(struct cio_ctx *ctx, struct cio_stream *st)
     int set_down = CIO_FALSE;
     char *p;
     crc_t crc;
-    crc_t crc_fs;
+    uint32_t crc_fs;
     char tmp[PATH_MAX];
     struct mk_list *head;
     struct cio_chunk *ch;
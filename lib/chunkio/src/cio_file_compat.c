@@ -18,11 +18,12 @@
  */
 
 /*
- * Trivial stub implementation of cio_file.h.
+ * Trivial stub implementation of cio_file.h, cio_segment.h and
+ * cio_commit.h.
  *
  * If your C runtime doesn't offer enough functionality to compile
- * cio_file.c, you can compile and link this file instead. See
- * CIO_BACKEND_FILESYSTEM in chunkio/CMakeList.txt for details.
+ * cio_file.c, cio_segment.c and cio_commit.c, you can compile and link this file
+ * instead. See CIO_BACKEND_FILESYSTEM in chunkio/CMakeList.txt for details.
  */
 
 #include <chunkio/chunkio_compat.h>
@@ -30,6 +31,9 @@
 #include <chunkio/cio_chunk.h>
 #include <chunkio/cio_file_st.h>
 #include <chunkio/cio_crc32.h>
+#include <chunkio/cio_segment.h>
+#include <chunkio/cio_commit.h>
+#include <chunkio/cio_manifest.h>
 
 struct cio_file *cio_file_open(struct cio_ctx *ctx,
                                struct cio_stream *st,
@@ -114,3 +118,137 @@ int cio_file_up_force(struct cio_chunk *ch)
 {
     return -1;
 }
+
+int cio_segment_index_create(struct cio_ctx *ctx, struct cio_stream *st)
+{
+    return -1;
+}
+
+void cio_segment_index_destroy(struct cio_stream *st)
+{
+    return;
+}
+
+int cio_segment_scan(struct cio_ctx *ctx, struct cio_stream *st)
+{
+    return -1;
+}
+
+void cio_segment_scan_dump(struct cio_ctx *ctx, struct cio_stream *st)
+{
+    return;
+}
+
+void cio_segment_commit(struct cio_ctx *ctx)
+{
+    return;
+}
+
+struct cio_segment_chunk *cio_segment_open(struct cio_ctx *ctx,
+                                           struct cio_stream *st,
+                                           struct cio_chunk *ch,
+                                           int flags, size_t size,
+                                           int *err)
+{
+    return NULL;
+}
+
+void cio_segment_close(struct cio_chunk *ch, int delete)
+{
+    return;
+}
+
+int cio_segment_write(struct cio_chunk *ch, const void *buf, size_t count)
+{
+    return -1;
+}
+
+int cio_segment_write_metadata(struct cio_chunk *ch, char *buf, size_t size)
+{
+    return -1;
+}
+
+int cio_segment_sync(struct cio_chunk *ch)
+{
+    return -1;
+}
+
+int cio_segment_content_copy(struct cio_chunk *ch,
+                             void **out_buf, size_t *out_size)
+{
+    return -1;
+}
+
+size_t cio_segment_real_size(struct cio_chunk *ch)
+{
+    return 0;
+}
+
+int cio_segment_is_up(struct cio_chunk *ch)
+{
+    return CIO_FALSE;
+}
+
+int cio_segment_up(struct cio_chunk *ch)
+{
+    return -1;
+}
+
+int cio_segment_up_force(struct cio_chunk *ch)
+{
+    return -1;
+}
+
+int cio_segment_down(struct cio_chunk *ch)
+{
+    return -1;
+}
+
+int cio_set_group_commit(struct cio_ctx *ctx, int interval, size_t bytes)
+{
+    return -1;
+}
+
+void cio_set_commit_callback(struct cio_ctx *ctx,
+                             void (*cb)(struct cio_ctx *,
+                                        struct cio_commit_info *, void *),
+                             void *data)
+{
+    return;
+}
+
+int cio_commit(struct cio_ctx *ctx)
+{
+    return 0;
+}
+
+int cio_commit_enabled(struct cio_ctx *ctx)
+{
+    return CIO_FALSE;
+}
+
+int cio_commit_add(struct cio_ctx *ctx, size_t bytes)
+{
+    return -1;
+}
+
+uint64_t cio_commit_time()
+{
+    return 0;
+}
+
+void cio_commit_report(struct cio_ctx *ctx, int chunks, size_t bytes,
+                       uint64_t start)
+{
+    return;
+}
+
+void cio_commit_destroy(struct cio_ctx *ctx)
+{
+    return;
+}
+
+int cio_manifest_write(struct cio_ctx *ctx)
+{
+    return 0;
+}
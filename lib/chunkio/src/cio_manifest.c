@@ -0,0 +1,429 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <chunkio/chunkio_compat.h>
+#include <chunkio/chunkio.h>
+#include <chunkio/cio_crc32.h>
+#include <chunkio/cio_log.h>
+#include <chunkio/cio_scan.h>
+#include <chunkio/cio_stream.h>
+#include <chunkio/cio_manifest.h>
+
+#define MANIFEST_HEADER   16     /* magic + crc32 + number of streams */
+
+/* Growing output buffer */
+struct mbuf {
+    char *data;
+    size_t len;
+    size_t size;
+};
+
+static int mbuf_put(struct mbuf *b, const void *data, size_t len)
+{
+    size_t size;
+    char *tmp;
+
+    if (b->len + len > b->size) {
+        size = b->size ? b->size : 4096;
+        while (size < b->len + len) {
+            size *= 2;
+        }
+        tmp = realloc(b->data, size);
+        if (!tmp) {
+            return -1;
+        }
+        b->data = tmp;
+        b->size = size;
+    }
+
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return 0;
+}
+
+static int mbuf_put_u32(struct mbuf *b, uint32_t val)
+{
+    val = htonl(val);
+    return mbuf_put(b, &val, 4);
+}
+
+static int mbuf_put_u64(struct mbuf *b, uint64_t val)
+{
+    int ret;
+
+    ret = mbuf_put_u32(b, (uint32_t) (val >> 32));
+    if (ret == 0) {
+        ret = mbuf_put_u32(b, (uint32_t) val);
+    }
+    return ret;
+}
+
+static uint32_t get_u32(const char *p)
+{
+    uint32_t val;
+
+    memcpy(&val, p, 4);
+    return ntohl(val);
+}
+
+static uint64_t get_u64(const char *p)
+{
+    return ((uint64_t) get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static char *manifest_path(struct cio_ctx *ctx, const char *suffix)
+{
+    int len;
+    char *path;
+
+    len = strlen(ctx->root_path) + strlen(CIO_MANIFEST_FILE) +
+          strlen(suffix) + 2;
+    path = malloc(len);
+    if (!path) {
+        cio_errno();
+        return NULL;
+    }
+    snprintf(path, len, "%s/%s%s", ctx->root_path, CIO_MANIFEST_FILE, suffix);
+
+    return path;
+}
+
+static int write_file(const char *path, char *buf, size_t size)
+{
+    int fd;
+    ssize_t bytes;
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, (mode_t) 0600);
+    if (fd == -1) {
+        return -1;
+    }
+
+    while (size > 0) {
+        bytes = write(fd, buf, size);
+        if (bytes == -1) {
+            close(fd);
+            return -1;
+        }
+        buf += bytes;
+        size -= bytes;
+    }
+
+    return close(fd);
+}
+
+/* List the file streams and save them as the manifest */
+int cio_manifest_write(struct cio_ctx *ctx)
+{
+    int i;
+    int j;
+    int n = 0;
+    int ret = -1;
+    uint32_t crc;
+    char *path = NULL;
+    char *tmp = NULL;
+    struct mbuf b = {0};
+    struct mk_list *head;
+    struct cio_stream *st;
+    struct cio_scan_dir *sd;
+    struct cio_scan_dir **dirs;
+
+    if (!ctx->root_path) {
+        return 0;
+    }
+
+    dirs = malloc(sizeof(struct cio_scan_dir *) *
+                  (mk_list_size(&ctx->streams) + 1));
+    if (!dirs) {
+        cio_errno();
+        return -1;
+    }
+
+    mk_list_foreach(head, &ctx->streams) {
+        st = mk_list_entry(head, struct cio_stream, _head);
+        if (st->type != CIO_STORE_FS) {
+            continue;
+        }
+
+        sd = cio_scan_dir_create(ctx, st);
+        if (!sd) {
+            goto out;
+        }
+        dirs[n++] = sd;
+    }
+
+    cio_scan_dirs(ctx, dirs, n);
+
+    /* header, the checksum is set once the content is complete */
+    ret = mbuf_put(&b, CIO_MANIFEST_MAGIC, 8);
+    ret |= mbuf_put_u32(&b, 0);
+    ret |= mbuf_put_u32(&b, n);
+
+    for (i = 0; i < n && ret == 0; i++) {
+        sd = dirs[i];
+        if (sd->ret == -1) {
+            ret = -1;
+            break;
+        }
+
+        ret |= mbuf_put_u64(&b, sd->mtime.tv_sec);
+        ret |= mbuf_put_u32(&b, sd->mtime.tv_nsec);
+        ret |= mbuf_put_u32(&b, sd->count);
+        ret |= mbuf_put(&b, sd->st->name, strlen(sd->st->name) + 1);
+
+        for (j = 0; j < sd->count && ret == 0; j++) {
+            ret = mbuf_put(&b, sd->names[j], strlen(sd->names[j]) + 1);
+        }
+    }
+
+    if (ret != 0) {
+        cio_log_warn(ctx, "[cio manifest] cannot build manifest");
+        ret = -1;
+        goto out;
+    }
+
+    crc = cio_crc32_init();
+    crc = cio_crc32_update(crc, b.data + 12, b.len - 12);
+    crc = htonl((uint32_t) cio_crc32_finalize(crc));
+    memcpy(b.data + 8, &crc, 4);
+
+    /* write and rename, a reader never sees a partial manifest */
+    path = manifest_path(ctx, "");
+    tmp = manifest_path(ctx, ".tmp");
+    if (!path || !tmp) {
+        ret = -1;
+        goto out;
+    }
+
+    ret = write_file(tmp, b.data, b.len);
+    if (ret == 0) {
+        ret = rename(tmp, path);
+    }
+    if (ret == -1) {
+        cio_errno();
+        cio_log_warn(ctx, "[cio manifest] cannot write %s", path);
+        unlink(tmp);
+    }
+    else {
+        cio_log_debug(ctx, "[cio manifest] %i streams saved", n);
+    }
+
+ out:
+    for (i = 0; i < n; i++) {
+        cio_scan_dir_destroy(dirs[i]);
+    }
+    free(dirs);
+    free(b.data);
+    free(path);
+    free(tmp);
+
+    return ret;
+}
+
+/* Parse the streams of a manifest, every name must be NUL terminated */
+static int manifest_parse(struct cio_manifest *mf)
+{
+    int i;
+    int j;
+    char *p;
+    char *end;
+    char *nul;
+    struct cio_manifest_stream *ms;
+
+    p = mf->buf + MANIFEST_HEADER;
+    end = mf->buf + mf->size;
+
+    mf->count = get_u32(mf->buf + 12);
+    if (mf->count > (end - p) / 17) {
+        return -1;
+    }
+
+    mf->streams = calloc(mf->count, sizeof(struct cio_manifest_stream));
+    if (!mf->streams) {
+        return -1;
+    }
+
+    for (i = 0; i < mf->count; i++) {
+        ms = &mf->streams[i];
+        if (end - p < 17) {
+            return -1;
+        }
+
+        ms->mtime_sec = (int64_t) get_u64(p);
+        ms->mtime_nsec = get_u32(p + 8);
+        ms->count = get_u32(p + 12);
+        p += 16;
+
+        nul = memchr(p, '\0', end - p);
+        if (!nul) {
+            return -1;
+        }
+        ms->name = p;
+        p = nul + 1;
+
+        if (ms->count > end - p) {
+            return -1;
+        }
+        ms->names = malloc(sizeof(char *) * (ms->count + 1));
+        if (!ms->names) {
+            return -1;
+        }
+
+        for (j = 0; j < ms->count; j++) {
+            nul = memchr(p, '\0', end - p);
+            if (!nul) {
+                return -1;
+            }
+            ms->names[j] = p;
+            p = nul + 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Read and remove the manifest, NULL if missing or invalid */
+struct cio_manifest *cio_manifest_load(struct cio_ctx *ctx)
+{
+    int fd;
+    int ret;
+    char *path;
+    ssize_t bytes;
+    size_t off = 0;
+    uint32_t crc;
+    struct stat st;
+    struct cio_manifest *mf;
+
+    path = manifest_path(ctx, "");
+    if (!path) {
+        return NULL;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        free(path);
+        return NULL;
+    }
+
+    /* used once: a stale manifest is never picked up again */
+    unlink(path);
+    free(path);
+
+    mf = calloc(1, sizeof(struct cio_manifest));
+    if (!mf) {
+        cio_errno();
+        close(fd);
+        return NULL;
+    }
+
+    ret = fstat(fd, &st);
+    if (ret == -1 || st.st_size < MANIFEST_HEADER) {
+        goto error;
+    }
+
+    mf->size = st.st_size;
+    mf->buf = malloc(mf->size);
+    if (!mf->buf) {
+        cio_errno();
+        goto error;
+    }
+
+    while (off < mf->size) {
+        bytes = read(fd, mf->buf + off, mf->size - off);
+        if (bytes <= 0) {
+            goto error;
+        }
+        off += bytes;
+    }
+    close(fd);
+    fd = -1;
+
+    if (memcmp(mf->buf, CIO_MANIFEST_MAGIC, 8) != 0) {
+        goto error;
+    }
+
+    crc = cio_crc32_init();
+    crc = cio_crc32_update(crc, mf->buf + 12, mf->size - 12);
+    if ((uint32_t) cio_crc32_finalize(crc) != get_u32(mf->buf + 8)) {
+        goto error;
+    }
+
+    if (manifest_parse(mf) == -1) {
+        goto error;
+    }
+
+    return mf;
+
+ error:
+    cio_log_warn(ctx, "[cio manifest] invalid manifest, ignoring it");
+    if (fd != -1) {
+        close(fd);
+    }
+    cio_manifest_destroy(mf);
+    return NULL;
+}
+
+/*
+ * Fill the listing of a stream from the manifest if its directory did not
+ * change since the manifest was written. Returns 0 on success.
+ */
+int cio_manifest_lookup(struct cio_manifest *mf, struct cio_scan_dir *sd)
+{
+    int i;
+    struct cio_manifest_stream *ms;
+
+    for (i = 0; i < mf->count; i++) {
+        ms = &mf->streams[i];
+        if (strcmp(ms->name, sd->st->name) != 0) {
+            continue;
+        }
+
+        if (ms->mtime_sec != sd->mtime.tv_sec ||
+            ms->mtime_nsec != sd->mtime.tv_nsec) {
+            return -1;
+        }
+
+        sd->names = ms->names;
+        sd->count = ms->count;
+        sd->borrowed = CIO_TRUE;
+        return 0;
+    }
+
+    return -1;
+}
+
+void cio_manifest_destroy(struct cio_manifest *mf)
+{
+    int i;
+
+    if (mf->streams) {
+        for (i = 0; i < mf->count; i++) {
+            free(mf->streams[i].names);
+        }
+        free(mf->streams);
+    }
+    free(mf->buf);
+    free(mf);
+}
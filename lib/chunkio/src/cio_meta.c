@@ -25,6 +25,7 @@
 #include <chunkio/cio_file.h>
 #include <chunkio/cio_file_st.h>
 #include <chunkio/cio_memfs.h>
+#include <chunkio/cio_segment.h>
 #include <chunkio/cio_stream.h>
 #include <chunkio/cio_log.h>
 
@@ -69,6 +70,9 @@ int cio_meta_write(struct cio_chunk *ch, char *buf, size_t size)
     else if (ch->st->type == CIO_STORE_FS) {
         return cio_file_write_metadata(ch, buf, size);
     }
+    else if (ch->st->type == CIO_STORE_SEG) {
+        return cio_segment_write_metadata(ch, buf, size);
+    }
     return -1;
 }
 
@@ -81,6 +85,10 @@ int cio_meta_size(struct cio_chunk *ch) {
         struct cio_file *cf = ch->backend;
         return cio_file_st_get_meta_len(cf->map);
     }
+    else if (ch->st->type == CIO_STORE_SEG) {
+        struct cio_segment_chunk *sc = ch->backend;
+        return sc->meta_len;
+    }
 
     return -1;
 }
@@ -91,6 +99,7 @@ int cio_meta_read(struct cio_chunk *ch, char **meta_buf, int *meta_len)
     char *meta;
     struct cio_file *cf;
     struct cio_memfs *mf;
+    struct cio_segment_chunk *sc;
 
     /* In-memory type */
     if (ch->st->type == CIO_STORE_MEM) {
@@ -120,6 +129,18 @@ int cio_meta_read(struct cio_chunk *ch, char **meta_buf, int *meta_len)
 
         return 0;
     }
+    else if (ch->st->type == CIO_STORE_SEG) {
+        sc = ch->backend;
+
+        if (!sc->meta_data) {
+            return -1;
+        }
+
+        *meta_buf = sc->meta_data;
+        *meta_len = sc->meta_len;
+
+        return 0;
+    }
 
     return -1;
 
@@ -131,6 +152,7 @@ int cio_meta_cmp(struct cio_chunk *ch, char *meta_buf, int meta_len)
     char *meta;
     struct cio_file *cf = ch->backend;
     struct cio_memfs *mf;
+    struct cio_segment_chunk *sc;
 
     /* In-memory type */
     if (ch->st->type == CIO_STORE_MEM) {
@@ -154,6 +176,21 @@ int cio_meta_cmp(struct cio_chunk *ch, char *meta_buf, int meta_len)
         return -1;
     }
 
+    /* Segment type: metadata is always in memory */
+    if (ch->st->type == CIO_STORE_SEG) {
+        sc = (struct cio_segment_chunk *) ch->backend;
+
+        if (!sc->meta_data || sc->meta_len != meta_len) {
+            return -1;
+        }
+
+        if (memcmp(sc->meta_data, meta_buf, meta_len) == 0) {
+            return 0;
+        }
+
+        return -1;
+    }
+
     /* File system type */
     len = cio_file_st_get_meta_len(cf->map);
     if (len != meta_len) {
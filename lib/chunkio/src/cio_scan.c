@@ -27,89 +27,279 @@
 #include <chunkio/cio_stream.h>
 #include <chunkio/cio_file.h>
 #include <chunkio/cio_memfs.h>
+#include <chunkio/cio_segment.h>
 #include <chunkio/cio_chunk.h>
 #include <chunkio/cio_log.h>
+#include <chunkio/cio_scan.h>
+#include <chunkio/cio_manifest.h>
 
 #ifdef CIO_HAVE_BACKEND_FILESYSTEM
-static int cio_scan_stream_files(struct cio_ctx *ctx, struct cio_stream *st,
-                                 char *chunk_extension)
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+struct scan_queue {
+    int next;
+    int n;
+    struct cio_scan_dir **dirs;
+    pthread_mutex_t lock;
+};
+
+static int dir_mtime(const char *path, struct timespec *ts)
 {
-    int len;
     int ret;
-    int err;
-    int ext_off;
-    int ext_len = 0;
-    char *path;
-    DIR *dir;
-    struct dirent *ent;
+    struct stat st;
 
-    len = strlen(ctx->root_path) + strlen(st->name) + 2;
-    path = malloc(len);
-    if (!path) {
-        cio_errno();
+    ret = stat(path, &st);
+    if (ret == -1) {
         return -1;
     }
 
-    ret = snprintf(path, len, "%s/%s", ctx->root_path, st->name);
-    if (ret == -1) {
+#ifdef __APPLE__
+    *ts = st.st_mtimespec;
+#else
+    *ts = st.st_mtim;
+#endif
+    return 0;
+}
+
+struct cio_scan_dir *cio_scan_dir_create(struct cio_ctx *ctx,
+                                         struct cio_stream *st)
+{
+    int len;
+    struct cio_scan_dir *sd;
+
+    sd = calloc(1, sizeof(struct cio_scan_dir));
+    if (!sd) {
         cio_errno();
-        free(path);
-        return -1;
+        return NULL;
     }
+    sd->st = st;
 
-    dir = opendir(path);
-    if (!dir) {
+    len = strlen(ctx->root_path) + strlen(st->name) + 2;
+    sd->path = malloc(len);
+    if (!sd->path) {
         cio_errno();
-        free(path);
-        return -1;
+        free(sd);
+        return NULL;
     }
+    snprintf(sd->path, len, "%s/%s", ctx->root_path, st->name);
 
-    if (chunk_extension) {
-        ext_len = strlen(chunk_extension);
+    /* taken before the listing: later changes invalidate it */
+    if (dir_mtime(sd->path, &sd->mtime) == -1) {
+        memset(&sd->mtime, 0, sizeof(sd->mtime));
     }
 
-    cio_log_debug(ctx, "[cio scan] opening stream %s", st->name);
+    return sd;
+}
+
+void cio_scan_dir_destroy(struct cio_scan_dir *sd)
+{
+    int i;
+
+    if (sd->borrowed == CIO_FALSE) {
+        for (i = 0; i < sd->count; i++) {
+            free(sd->names[i]);
+        }
+        free(sd->names);
+    }
+    free(sd->path);
+    free(sd);
+}
+
+static int scan_dir_add(struct cio_scan_dir *sd, const char *name)
+{
+    int size;
+    char **tmp;
+
+    if (sd->count == sd->size) {
+        size = sd->size ? sd->size * 2 : 64;
+        tmp = realloc(sd->names, sizeof(char *) * size);
+        if (!tmp) {
+            return -1;
+        }
+        sd->names = tmp;
+        sd->size = size;
+    }
+
+    sd->names[sd->count] = strdup(name);
+    if (!sd->names[sd->count]) {
+        return -1;
+    }
+    sd->count++;
+
+    return 0;
+}
+
+/* Hidden '.<chunk>.tmp' file written by a chunk rewrite (see cio_file.c) */
+static int is_rewrite_tmp(const char *name)
+{
+    size_t len = strlen(name);
+
+    return name[0] == '.' && len > 5 && strcmp(name + len - 4, ".tmp") == 0;
+}
+
+/* List the regular files of a stream directory, no context is touched */
+static void scan_dir_list(struct cio_scan_dir *sd)
+{
+    DIR *dir;
+    struct dirent *ent;
+
+    dir = opendir(sd->path);
+    if (!dir) {
+        sd->ret = -1;
+        return;
+    }
 
-    /* Iterate the root_path */
     while ((ent = readdir(dir)) != NULL) {
-        if ((ent->d_name[0] == '.') || (strcmp(ent->d_name, "..") == 0)) {
+        if (ent->d_name[0] == '.') {
+            /* left behind by a rewrite interrupted before its rename */
+            if (ent->d_type == DT_REG && is_rewrite_tmp(ent->d_name)) {
+                unlinkat(dirfd(dir), ent->d_name, 0);
+            }
             continue;
         }
 
-        /* Look just for directories */
         if (ent->d_type != DT_REG) {
             continue;
         }
 
-        /* Check the file matches the desired extension (if set) */
-        if (chunk_extension) {
-            len = strlen(ent->d_name);
-            if (len <= ext_len) {
-                continue;
-            }
+        if (scan_dir_add(sd, ent->d_name) == -1) {
+            sd->ret = -1;
+            break;
+        }
+    }
 
-            ext_off = len - ext_len;
-            if (strncmp(ent->d_name + ext_off, chunk_extension, ext_len) != 0) {
-                continue;
-            }
+    closedir(dir);
+}
+
+static void *scan_worker(void *data)
+{
+    int i;
+    struct scan_queue *q = data;
+
+    while (1) {
+        pthread_mutex_lock(&q->lock);
+        i = q->next++;
+        pthread_mutex_unlock(&q->lock);
+
+        if (i >= q->n) {
+            break;
         }
+        scan_dir_list(q->dirs[i]);
+    }
 
-        /* register every directory as a stream */
-        cio_chunk_open(ctx, st, ent->d_name, CIO_OPEN_RD, 0, &err);
+    return NULL;
+}
+
+/* List the given directories using up to ctx->scan_workers threads */
+int cio_scan_dirs(struct cio_ctx *ctx, struct cio_scan_dir **dirs, int n)
+{
+    int i;
+    int ret;
+    int workers;
+    int started = 0;
+    pthread_t *tids;
+    struct scan_queue q;
+
+    workers = ctx->scan_workers;
+    if (workers > n) {
+        workers = n;
     }
 
-    closedir(dir);
-    free(path);
+    q.next = 0;
+    q.n = n;
+    q.dirs = dirs;
+    pthread_mutex_init(&q.lock, NULL);
+
+    tids = NULL;
+    if (workers > 1) {
+        tids = malloc(sizeof(pthread_t) * (workers - 1));
+        if (!tids) {
+            cio_errno();
+        }
+    }
+
+    /* the caller thread is one of the workers */
+    for (i = 0; tids && i < workers - 1; i++) {
+        ret = pthread_create(&tids[i], NULL, scan_worker, &q);
+        if (ret != 0) {
+            cio_log_warn(ctx, "[cio scan] cannot create scan worker");
+            break;
+        }
+        started++;
+    }
+
+    /* also covers thread creation failures */
+    scan_worker(&q);
+
+    for (i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    pthread_mutex_destroy(&q.lock);
+    free(tids);
 
+    if (started > 0) {
+        cio_log_debug(ctx, "[cio scan] %i directories listed by %i workers",
+                      n, started + 1);
+    }
     return 0;
 }
 
+/*
+ * Register the listed chunks. They are left down: opening, mapping and
+ * validating the content is deferred until each chunk is brought up.
+ */
+static void scan_dir_register(struct cio_ctx *ctx, struct cio_scan_dir *sd,
+                              char *chunk_extension)
+{
+    int i;
+    int len;
+    int err;
+    int ext_len = 0;
+    char *name;
+
+    if (sd->ret == -1) {
+        cio_log_error(ctx, "[cio scan] cannot list stream %s", sd->path);
+    }
+
+    if (chunk_extension) {
+        ext_len = strlen(chunk_extension);
+    }
+
+    for (i = 0; i < sd->count; i++) {
+        name = sd->names[i];
+
+        /* Check the file matches the desired extension (if set) */
+        if (chunk_extension) {
+            len = strlen(name);
+            if (len <= ext_len ||
+                strcmp(name + len - ext_len, chunk_extension) != 0) {
+                continue;
+            }
+        }
+
+        cio_chunk_open(ctx, sd->st, name, CIO_OPEN_RD | CIO_OPEN_DOWN, 0,
+                       &err);
+    }
+}
+
 /* Given a cio context, scan it root_path and populate stream/files */
 int cio_scan_streams(struct cio_ctx *ctx, char *chunk_extension)
 {
+    int i;
+    int n = 0;
+    int n_list = 0;
+    int size = 0;
     DIR *dir;
     struct dirent *ent;
     struct cio_stream *st;
+    struct cio_scan_dir *sd;
+    struct cio_scan_dir **tmp;
+    struct cio_scan_dir **dirs = NULL;
+    struct cio_scan_dir **list = NULL;
+    struct cio_manifest *mf = NULL;
 
     dir = opendir(ctx->root_path);
     if (!dir) {
@@ -119,6 +309,10 @@ int cio_scan_streams(struct cio_ctx *ctx, char *chunk_extension)
 
     cio_log_debug(ctx, "[cio scan] opening path %s", ctx->root_path);
 
+    if (ctx->manifest == CIO_TRUE) {
+        mf = cio_manifest_load(ctx);
+    }
+
     /* Iterate the root_path */
     while ((ent = readdir(dir)) != NULL) {
         if ((ent->d_name[0] == '.') || (strcmp(ent->d_name, "..") == 0)) {
@@ -132,12 +326,69 @@ int cio_scan_streams(struct cio_ctx *ctx, char *chunk_extension)
 
         /* register every directory as a stream */
         st = cio_stream_create(ctx, ent->d_name, CIO_STORE_FS);
-        if (st) {
-            cio_scan_stream_files(ctx, st, chunk_extension);
+        if (!st) {
+            continue;
         }
-    }
 
+        if (st->type == CIO_STORE_SEG) {
+            cio_segment_scan(ctx, st);
+            continue;
+        }
+
+        sd = cio_scan_dir_create(ctx, st);
+        if (!sd) {
+            continue;
+        }
+
+        if (n == size) {
+            size = size ? size * 2 : 16;
+            tmp = realloc(dirs, sizeof(struct cio_scan_dir *) * size);
+            if (!tmp) {
+                cio_errno();
+                cio_scan_dir_destroy(sd);
+                break;
+            }
+            dirs = tmp;
+        }
+        dirs[n++] = sd;
+    }
     closedir(dir);
+
+    /* streams not covered by the manifest are listed in parallel */
+    if (n > 0) {
+        list = malloc(sizeof(struct cio_scan_dir *) * n);
+    }
+    for (i = 0; i < n; i++) {
+        if (mf && cio_manifest_lookup(mf, dirs[i]) == 0) {
+            continue;
+        }
+
+        if (list) {
+            list[n_list++] = dirs[i];
+        }
+        else {
+            cio_scan_dirs(ctx, &dirs[i], 1);
+        }
+    }
+    if (n_list > 0) {
+        cio_scan_dirs(ctx, list, n_list);
+    }
+    if (mf) {
+        cio_log_debug(ctx, "[cio scan] manifest used for %i of %i streams",
+                      n - n_list, n);
+    }
+
+    for (i = 0; i < n; i++) {
+        scan_dir_register(ctx, dirs[i], chunk_extension);
+        cio_scan_dir_destroy(dirs[i]);
+    }
+
+    free(list);
+    free(dirs);
+    if (mf) {
+        cio_manifest_destroy(mf);
+    }
+
     return 0;
 }
 #else
@@ -167,5 +418,8 @@ void cio_scan_dump(struct cio_ctx *ctx)
         else if (st->type == CIO_STORE_FS) {
             cio_file_scan_dump(ctx, st);
         }
+        else if (st->type == CIO_STORE_SEG) {
+            cio_segment_scan_dump(ctx, st);
+        }
     }
 }
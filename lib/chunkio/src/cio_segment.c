@@ -0,0 +1,1261 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <arpa/inet.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <chunkio/chunkio_compat.h>
+#include <chunkio/chunkio.h>
+#include <chunkio/cio_crc32.h>
+#include <chunkio/cio_chunk.h>
+#include <chunkio/cio_commit.h>
+#include <chunkio/cio_segment.h>
+#include <chunkio/cio_log.h>
+#include <chunkio/cio_stream.h>
+
+#define ROUND_UP(N, S) ((((N) + (S) - 1) / (S)) * (S))
+
+/* A live record found while scanning the segments of a stream */
+struct seg_entry {
+    char *name;
+    char *meta;
+    int meta_len;
+    size_t data_size;
+    uint32_t crc;
+    int crc_type;
+    off_t offset;
+    struct cio_segment *seg;
+};
+
+static inline size_t record_size(size_t name_len, size_t meta_len,
+                                 size_t data_size)
+{
+    return ROUND_UP(CIO_SEG_REC_HEADER + name_len + meta_len + data_size,
+                    CIO_SEG_REC_ALIGN);
+}
+
+static inline void put_u16(unsigned char *p, uint16_t val)
+{
+    val = htons(val);
+    memcpy(p, &val, 2);
+}
+
+static inline void put_u32(unsigned char *p, uint32_t val)
+{
+    val = htonl(val);
+    memcpy(p, &val, 4);
+}
+
+static inline void put_u64(unsigned char *p, uint64_t val)
+{
+    put_u32(p, (uint32_t) (val >> 32));
+    put_u32(p + 4, (uint32_t) (val & 0xffffffff));
+}
+
+static inline uint16_t get_u16(unsigned char *p)
+{
+    uint16_t val;
+
+    memcpy(&val, p, 2);
+    return ntohs(val);
+}
+
+static inline uint32_t get_u32(unsigned char *p)
+{
+    uint32_t val;
+
+    memcpy(&val, p, 4);
+    return ntohl(val);
+}
+
+static inline uint64_t get_u64(unsigned char *p)
+{
+    return ((uint64_t) get_u32(p) << 32) | get_u32(p + 4);
+}
+
+static uint32_t data_checksum(int type, const char *buf, size_t size)
+{
+    crc_t crc;
+
+    crc = cio_crc32_init();
+    crc = cio_crc_update(type, crc, (const unsigned char *) buf, size);
+    return (uint32_t) cio_crc32_finalize(crc);
+}
+
+static char *segment_path(struct cio_ctx *ctx, struct cio_stream *st,
+                          uint32_t id)
+{
+    int len;
+    int ret;
+    char *path;
+
+    len = strlen(ctx->root_path) + strlen(st->name) + 32;
+    path = malloc(len);
+    if (!path) {
+        cio_errno();
+        return NULL;
+    }
+
+    ret = snprintf(path, len, "%s/%s/%08x%s",
+                   ctx->root_path, st->name, id, CIO_SEG_EXTENSION);
+    if (ret < 0 || ret >= len) {
+        free(path);
+        return NULL;
+    }
+
+    return path;
+}
+
+/* Return the segment id of a file name, or -1 if it's not a segment */
+static int64_t segment_id(const char *name)
+{
+    char *end;
+    unsigned long id;
+
+    if (strlen(name) != 8 + sizeof(CIO_SEG_EXTENSION) - 1) {
+        return -1;
+    }
+
+    errno = 0;
+    id = strtoul(name, &end, 16);
+    if (errno != 0 || end != name + 8 ||
+        strcmp(end, CIO_SEG_EXTENSION) != 0) {
+        return -1;
+    }
+
+    return (int64_t) id;
+}
+
+static struct cio_segment *segment_new(uint32_t id, int fd, char *path)
+{
+    struct cio_segment *seg;
+
+    seg = calloc(1, sizeof(struct cio_segment));
+    if (!seg) {
+        cio_errno();
+        return NULL;
+    }
+    seg->id = id;
+    seg->fd = fd;
+    seg->path = path;
+    seg->offset = CIO_SEG_HEADER_SIZE;
+
+    return seg;
+}
+
+static void segment_destroy(struct cio_segment *seg)
+{
+    if (seg->fd >= 0) {
+        close(seg->fd);
+    }
+    mk_list_del(&seg->_head);
+    free(seg->path);
+    free(seg);
+}
+
+/* Remove a segment without live records from the file system */
+static void segment_release(struct cio_ctx *ctx, struct cio_segment *seg)
+{
+    int ret;
+
+    ret = unlink(seg->path);
+    if (ret == -1) {
+        cio_errno();
+        cio_log_error(ctx, "[cio segment] cannot remove %s", seg->path);
+    }
+    else {
+        cio_log_debug(ctx, "[cio segment] reclaimed %s", seg->path);
+    }
+
+    segment_destroy(seg);
+}
+
+/* Create and preallocate a new segment able to store 'min_size' bytes */
+static struct cio_segment *segment_create(struct cio_ctx *ctx,
+                                          struct cio_stream *st,
+                                          size_t min_size)
+{
+    int fd;
+    int ret;
+    size_t size;
+    char *path;
+    char header[CIO_SEG_HEADER_SIZE] = {0};
+    struct cio_segment *seg;
+    struct cio_segment_index *idx = st->backend;
+
+    size = ctx->segment_size;
+    if (size < CIO_SEG_HEADER_SIZE + min_size) {
+        size = ROUND_UP(CIO_SEG_HEADER_SIZE + min_size, ctx->page_size);
+    }
+
+    /* never reuse an existing file: another stream may own it */
+    while (1) {
+        path = segment_path(ctx, st, idx->next_id);
+        if (!path) {
+            return NULL;
+        }
+
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL, (mode_t) 0600);
+        if (fd >= 0) {
+            break;
+        }
+
+        free(path);
+        if (errno != EEXIST) {
+            cio_errno();
+            return NULL;
+        }
+        idx->next_id++;
+    }
+
+#if defined(CIO_HAVE_FALLOCATE)
+    ret = fallocate(fd, 0, 0, size);
+#else
+    ret = ftruncate(fd, size);
+#endif
+    if (ret == -1) {
+        cio_errno();
+        cio_log_error(ctx, "[cio segment] cannot allocate %lu bytes for %s",
+                      size, path);
+        close(fd);
+        unlink(path);
+        free(path);
+        return NULL;
+    }
+
+    memcpy(header, CIO_SEG_MAGIC, sizeof(CIO_SEG_MAGIC) - 1);
+    ret = pwrite(fd, header, sizeof(header), 0);
+    if (ret != sizeof(header)) {
+        cio_errno();
+        close(fd);
+        unlink(path);
+        free(path);
+        return NULL;
+    }
+
+    seg = segment_new(idx->next_id, fd, path);
+    if (!seg) {
+        close(fd);
+        unlink(path);
+        free(path);
+        return NULL;
+    }
+    seg->size = size;
+    idx->next_id++;
+    mk_list_add(&seg->_head, &idx->segments);
+
+    cio_log_debug(ctx, "[cio segment] created %s (%lu bytes)", path, size);
+    return seg;
+}
+
+/* Drop a reference to a segment, remove it if nothing lives there */
+static void segment_unref(struct cio_ctx *ctx, struct cio_stream *st,
+                          struct cio_segment *seg)
+{
+    struct cio_segment_index *idx = st->backend;
+
+    seg->live--;
+    if (seg->live <= 0 && seg != idx->active) {
+        segment_release(ctx, seg);
+    }
+}
+
+/* Rewrite the state of a record as obsolete */
+static int record_state_dead(struct cio_segment *seg, off_t rec_offset)
+{
+    int ret;
+    unsigned char state[4];
+
+    put_u32(state, CIO_SEG_REC_DEAD);
+    ret = pwrite(seg->fd, state, sizeof(state), rec_offset);
+    if (ret != sizeof(state)) {
+        cio_errno();
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Mark the latest record of a chunk as obsolete */
+static void record_kill(struct cio_chunk *ch, struct cio_segment_chunk *sc)
+{
+    if (!sc->seg) {
+        return;
+    }
+
+    if (record_state_dead(sc->seg, sc->rec_offset) == -1) {
+        cio_log_error(ch->ctx, "[cio segment] cannot invalidate record of "
+                      "%s:%s", ch->st->name, ch->name);
+    }
+
+    segment_unref(ch->ctx, ch->st, sc->seg);
+    sc->seg = NULL;
+    sc->rec_offset = 0;
+}
+
+/*
+ * Queue the latest record of a chunk to be killed after the next group
+ * commit, the record keeps its reference on the segment until then. If the
+ * entry cannot be allocated the record is left live (and its segment kept)
+ * for the next scan to resolve.
+ */
+static void record_kill_deferred(struct cio_chunk *ch,
+                                 struct cio_segment_chunk *sc)
+{
+    struct cio_segment_kill *kill;
+    struct cio_segment_index *idx = ch->st->backend;
+
+    if (!sc->seg) {
+        return;
+    }
+
+    kill = malloc(sizeof(struct cio_segment_kill));
+    if (!kill) {
+        cio_errno();
+        cio_log_error(ch->ctx, "[cio segment] cannot queue the previous "
+                      "record of %s:%s", ch->st->name, ch->name);
+    }
+    else {
+        kill->seg = sc->seg;
+        kill->rec_offset = sc->rec_offset;
+        mk_list_add(&kill->_head, &idx->kills);
+    }
+
+    sc->seg = NULL;
+    sc->rec_offset = 0;
+}
+
+/* Kill the queued records of a stream, their replacements are durable */
+static void stream_kills_apply(struct cio_ctx *ctx, struct cio_stream *st)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct cio_segment_kill *kill;
+    struct cio_segment_index *idx = st->backend;
+
+    mk_list_foreach_safe(head, tmp, &idx->kills) {
+        kill = mk_list_entry(head, struct cio_segment_kill, _head);
+        if (record_state_dead(kill->seg, kill->rec_offset) == -1) {
+            cio_log_error(ctx, "[cio segment] cannot invalidate record at "
+                          "%s:%lu", kill->seg->path,
+                          (unsigned long) kill->rec_offset);
+        }
+        segment_unref(ctx, st, kill->seg);
+        mk_list_del(&kill->_head);
+        free(kill);
+    }
+}
+
+/* Called by cio_commit() after a successful file system sync */
+void cio_segment_commit(struct cio_ctx *ctx)
+{
+    struct mk_list *head;
+    struct cio_stream *st;
+
+    mk_list_foreach(head, &ctx->streams) {
+        st = mk_list_entry(head, struct cio_stream, _head);
+        if (st->type == CIO_STORE_SEG && st->backend) {
+            stream_kills_apply(ctx, st);
+        }
+    }
+}
+
+/* Append the current content of a chunk to the active segment */
+static int record_append(struct cio_chunk *ch, struct cio_segment_chunk *sc)
+{
+    int iov_n = 0;
+    size_t name_len;
+    size_t size;
+    size_t body;
+    ssize_t ret;
+    uint32_t crc = 0;
+    uint32_t flags = 0;
+    uint64_t start;
+    unsigned char header[CIO_SEG_REC_HEADER] = {0};
+    char padding[CIO_SEG_REC_ALIGN] = {0};
+    struct iovec iov[5];
+    struct cio_segment *prev;
+    struct cio_segment *seg;
+    struct cio_segment_index *idx = ch->st->backend;
+    struct cio_ctx *ctx = ch->ctx;
+
+    name_len = strlen(ch->name);
+    body = CIO_SEG_REC_HEADER + name_len + sc->meta_len + sc->data_size;
+    size = record_size(name_len, sc->meta_len, sc->data_size);
+
+    /* roll over to a new segment if the record does not fit */
+    seg = idx->active;
+    if (!seg || seg->offset + size > seg->size) {
+        prev = seg;
+        seg = segment_create(ctx, ch->st, size);
+        if (!seg) {
+            return -1;
+        }
+        idx->active = seg;
+
+        if (prev && prev->live <= 0) {
+            segment_release(ctx, prev);
+        }
+    }
+
+    if (ctx->flags & CIO_CHECKSUM) {
+        crc = data_checksum(ctx->checksum_type, sc->buf_data, sc->data_size);
+        if (ctx->checksum_type == CIO_CRC32C) {
+            flags |= CIO_SEG_REC_CRC32C;
+        }
+    }
+
+    put_u32(header, CIO_SEG_REC_LIVE);
+    put_u32(header + 4, crc);
+    put_u16(header + 8, name_len);
+    put_u16(header + 10, sc->meta_len);
+    put_u32(header + 12, flags);
+    put_u64(header + 16, sc->data_size);
+
+    iov[iov_n].iov_base = header;
+    iov[iov_n++].iov_len = sizeof(header);
+    iov[iov_n].iov_base = ch->name;
+    iov[iov_n++].iov_len = name_len;
+    if (sc->meta_len > 0) {
+        iov[iov_n].iov_base = sc->meta_data;
+        iov[iov_n++].iov_len = sc->meta_len;
+    }
+    if (sc->data_size > 0) {
+        iov[iov_n].iov_base = sc->buf_data;
+        iov[iov_n++].iov_len = sc->data_size;
+    }
+    if (size > body) {
+        iov[iov_n].iov_base = padding;
+        iov[iov_n++].iov_len = size - body;
+    }
+
+    ret = pwritev(seg->fd, iov, iov_n, seg->offset);
+    if (ret != (ssize_t) size) {
+        if (ret == -1) {
+            cio_errno();
+        }
+        cio_log_error(ctx, "[cio segment] cannot append %s:%s to %s",
+                      ch->st->name, ch->name, seg->path);
+        return -1;
+    }
+
+    if (!cio_commit_enabled(ctx) && ctx->flags & CIO_FULL_SYNC) {
+        start = cio_commit_time();
+        ret = fdatasync(seg->fd);
+        if (ret == -1) {
+            cio_errno();
+            return -1;
+        }
+        cio_commit_report(ctx, 1, size, start);
+    }
+
+    seg->live++;
+    if (cio_commit_enabled(ctx)) {
+        /* the new copy is durable after the next commit, keep the old one */
+        record_kill_deferred(ch, sc);
+    }
+    else {
+        /* the new copy is stored, now the previous one can go away */
+        record_kill(ch, sc);
+    }
+
+    sc->seg = seg;
+    sc->rec_offset = seg->offset;
+    sc->rec_crc = crc;
+    sc->rec_crc_type = ctx->checksum_type;
+    seg->offset += size;
+
+    if (cio_commit_enabled(ctx)) {
+        return cio_commit_add(ctx, size);
+    }
+
+    return 0;
+}
+
+/* Read the content of the latest record into 'buf' */
+static int record_read(struct cio_chunk *ch, struct cio_segment_chunk *sc,
+                       char *buf)
+{
+    ssize_t ret;
+    off_t offset;
+
+    offset = sc->rec_offset + CIO_SEG_REC_HEADER +
+             strlen(ch->name) + sc->meta_len;
+
+    ret = pread(sc->seg->fd, buf, sc->data_size, offset);
+    if (ret != (ssize_t) sc->data_size) {
+        if (ret == -1) {
+            cio_errno();
+        }
+        cio_log_error(ch->ctx, "[cio segment] cannot read %s:%s from %s",
+                      ch->st->name, ch->name, sc->seg->path);
+        return CIO_ERROR;
+    }
+
+    if (ch->ctx->flags & CIO_CHECKSUM &&
+        data_checksum(sc->rec_crc_type, buf, sc->data_size) != sc->rec_crc) {
+        cio_log_error(ch->ctx, "[cio segment] checksum failed for %s:%s",
+                      ch->st->name, ch->name);
+        return CIO_CORRUPTED;
+    }
+
+    return CIO_OK;
+}
+
+/* Allocate the in-memory buffer for a chunk and load it content if any */
+static int chunk_load(struct cio_chunk *ch, struct cio_segment_chunk *sc)
+{
+    int ret;
+    size_t size;
+
+    size = sc->realloc_size;
+    if (sc->data_size > size) {
+        size = ROUND_UP(sc->data_size, sc->realloc_size);
+    }
+
+    sc->buf_data = malloc(size);
+    if (!sc->buf_data) {
+        cio_errno();
+        return CIO_ERROR;
+    }
+    sc->buf_size = size;
+
+    if (sc->seg) {
+        ret = record_read(ch, sc, sc->buf_data);
+        if (ret != CIO_OK) {
+            free(sc->buf_data);
+            sc->buf_data = NULL;
+            sc->buf_size = 0;
+            return ret;
+        }
+    }
+
+    sc->up = CIO_TRUE;
+    sc->synced = CIO_TRUE;
+    cio_chunk_counter_total_up_add(ch->ctx);
+
+    return CIO_OK;
+}
+
+static void chunk_unload(struct cio_chunk *ch, struct cio_segment_chunk *sc)
+{
+    free(sc->buf_data);
+    sc->buf_data = NULL;
+    sc->buf_size = 0;
+    sc->up = CIO_FALSE;
+    cio_chunk_counter_total_up_sub(ch->ctx);
+}
+
+int cio_segment_index_create(struct cio_ctx *ctx, struct cio_stream *st)
+{
+    int64_t id;
+    char *path;
+    DIR *dir;
+    struct dirent *ent;
+    struct cio_segment_index *idx;
+
+    idx = calloc(1, sizeof(struct cio_segment_index));
+    if (!idx) {
+        cio_errno();
+        return -1;
+    }
+    mk_list_init(&idx->segments);
+    mk_list_init(&idx->kills);
+
+    /* new segments are always numbered after the existing ones */
+    path = segment_path(ctx, st, 0);
+    if (!path) {
+        free(idx);
+        return -1;
+    }
+    *strrchr(path, '/') = '\0';
+
+    dir = opendir(path);
+    if (!dir) {
+        cio_errno();
+        free(path);
+        free(idx);
+        return -1;
+    }
+
+    while ((ent = readdir(dir)) != NULL) {
+        id = segment_id(ent->d_name);
+        if (id >= 0 && id >= idx->next_id) {
+            idx->next_id = id + 1;
+        }
+    }
+    closedir(dir);
+    free(path);
+
+    st->backend = idx;
+    return 0;
+}
+
+void cio_segment_index_destroy(struct cio_stream *st)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct cio_segment *seg;
+    struct cio_segment_kill *kill;
+    struct cio_segment_index *idx = st->backend;
+
+    if (!idx) {
+        return;
+    }
+
+    /* the records still queued stay live, the next scan keeps the newest */
+    if (mk_list_is_empty(&idx->kills) != 0) {
+        cio_commit(st->parent);
+    }
+    mk_list_foreach_safe(head, tmp, &idx->kills) {
+        kill = mk_list_entry(head, struct cio_segment_kill, _head);
+        mk_list_del(&kill->_head);
+        free(kill);
+    }
+
+    mk_list_foreach_safe(head, tmp, &idx->segments) {
+        seg = mk_list_entry(head, struct cio_segment, _head);
+        if (seg->live <= 0) {
+            segment_release(st->parent, seg);
+        }
+        else {
+            segment_destroy(seg);
+        }
+    }
+
+    free(idx);
+    st->backend = NULL;
+}
+
+struct cio_segment_chunk *cio_segment_open(struct cio_ctx *ctx,
+                                           struct cio_stream *st,
+                                           struct cio_chunk *ch,
+                                           int flags, size_t size,
+                                           int *err)
+{
+    int ret;
+    struct cio_segment_chunk *sc;
+
+    (void) st;
+
+    if (strlen(ch->name) > 65535) {
+        cio_log_error(ctx, "[cio segment] invalid chunk name");
+        *err = CIO_ERROR;
+        return NULL;
+    }
+
+    sc = calloc(1, sizeof(struct cio_segment_chunk));
+    if (!sc) {
+        cio_errno();
+        *err = CIO_ERROR;
+        return NULL;
+    }
+    sc->realloc_size = getpagesize() * 8;
+    if (size > sc->realloc_size) {
+        sc->realloc_size = size;
+    }
+    ch->backend = sc;
+    *err = CIO_OK;
+
+    /* chunks restored from a segment are registered 'down' */
+    if (flags & CIO_OPEN_RD) {
+        sc->synced = CIO_TRUE;
+        return sc;
+    }
+
+    /* Should we put this chunk up ? */
+    if (ctx->total_chunks_up >= ctx->max_chunks_up) {
+        return sc;
+    }
+
+    ret = chunk_load(ch, sc);
+    if (ret != CIO_OK) {
+        free(sc);
+        ch->backend = NULL;
+        *err = ret;
+        return NULL;
+    }
+
+    return sc;
+}
+
+void cio_segment_close(struct cio_chunk *ch, int delete)
+{
+    int ret;
+    struct cio_segment_chunk *sc = ch->backend;
+
+    if (!sc) {
+        return;
+    }
+
+    if (delete == CIO_TRUE) {
+        record_kill(ch, sc);
+    }
+    else if (sc->up == CIO_TRUE && sc->synced == CIO_FALSE) {
+        /* keep the latest content for the next start */
+        ret = record_append(ch, sc);
+        if (ret == -1) {
+            cio_log_error(ch->ctx, "[cio segment] data lost at close %s:%s",
+                          ch->st->name, ch->name);
+        }
+    }
+
+    if (sc->up == CIO_TRUE) {
+        chunk_unload(ch, sc);
+    }
+
+    free(sc->meta_data);
+    free(sc);
+    ch->backend = NULL;
+}
+
+int cio_segment_write(struct cio_chunk *ch, const void *buf, size_t count)
+{
+    char *tmp;
+    size_t new_size;
+    struct cio_segment_chunk *sc = ch->backend;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    if (sc->up == CIO_FALSE) {
+        cio_log_error(ch->ctx, "[cio segment] chunk is not up: %s:%s",
+                      ch->st->name, ch->name);
+        return -1;
+    }
+
+    if (sc->buf_size - sc->data_size < count) {
+        new_size = sc->buf_size + sc->realloc_size;
+        while (new_size < sc->data_size + count) {
+            new_size += sc->realloc_size;
+        }
+
+        tmp = realloc(sc->buf_data, new_size);
+        if (!tmp) {
+            cio_errno();
+            return -1;
+        }
+        sc->buf_data = tmp;
+        sc->buf_size = new_size;
+    }
+
+    memcpy(sc->buf_data + sc->data_size, buf, count);
+    sc->data_size += count;
+    sc->synced = CIO_FALSE;
+
+    return 0;
+}
+
+int cio_segment_write_metadata(struct cio_chunk *ch, char *buf, size_t size)
+{
+    char *meta;
+    struct cio_segment_chunk *sc = ch->backend;
+
+    meta = malloc(size);
+    if (!meta) {
+        cio_errno();
+        return -1;
+    }
+    memcpy(meta, buf, size);
+
+    free(sc->meta_data);
+    sc->meta_data = meta;
+    sc->meta_len = size;
+    sc->synced = CIO_FALSE;
+
+    return 0;
+}
+
+int cio_segment_sync(struct cio_chunk *ch)
+{
+    int ret;
+    struct cio_segment_chunk *sc = ch->backend;
+
+    if (sc->up == CIO_FALSE || sc->synced == CIO_TRUE) {
+        return 0;
+    }
+
+    ret = record_append(ch, sc);
+    if (ret == -1) {
+        return -1;
+    }
+
+    sc->synced = CIO_TRUE;
+    cio_log_debug(ch->ctx, "[cio segment] synced at: %s/%s (segment %08x)",
+                  ch->st->name, ch->name, sc->seg->id);
+    return 0;
+}
+
+int cio_segment_content_copy(struct cio_chunk *ch,
+                             void **out_buf, size_t *out_size)
+{
+    int ret;
+    char *buf;
+    struct cio_segment_chunk *sc = ch->backend;
+
+    buf = malloc(sc->data_size + 1);
+    if (!buf) {
+        cio_errno();
+        return CIO_ERROR;
+    }
+
+    if (sc->up == CIO_TRUE) {
+        memcpy(buf, sc->buf_data, sc->data_size);
+    }
+    else if (sc->seg) {
+        ret = record_read(ch, sc, buf);
+        if (ret != CIO_OK) {
+            free(buf);
+            return CIO_ERROR;
+        }
+    }
+    buf[sc->data_size] = '\0';
+
+    *out_buf = buf;
+    *out_size = sc->data_size;
+
+    return CIO_OK;
+}
+
+size_t cio_segment_real_size(struct cio_chunk *ch)
+{
+    struct cio_segment_chunk *sc = ch->backend;
+
+    if (!sc->seg) {
+        return sc->data_size;
+    }
+
+    return record_size(strlen(ch->name), sc->meta_len, sc->data_size);
+}
+
+int cio_segment_is_up(struct cio_chunk *ch)
+{
+    struct cio_segment_chunk *sc = ch->backend;
+
+    return sc->up;
+}
+
+static int _cio_segment_up(struct cio_chunk *ch, int enforced)
+{
+    struct cio_segment_chunk *sc = ch->backend;
+
+    if (sc->up == CIO_TRUE) {
+        cio_log_error(ch->ctx, "[cio segment] chunk is already up: %s/%s",
+                      ch->st->name, ch->name);
+        return CIO_ERROR;
+    }
+
+    if (enforced == CIO_TRUE &&
+        ch->ctx->total_chunks_up >= ch->ctx->max_chunks_up) {
+        return CIO_ERROR;
+    }
+
+    return chunk_load(ch, sc);
+}
+
+int cio_segment_up(struct cio_chunk *ch)
+{
+    return _cio_segment_up(ch, CIO_TRUE);
+}
+
+int cio_segment_up_force(struct cio_chunk *ch)
+{
+    return _cio_segment_up(ch, CIO_FALSE);
+}
+
+/* Store the chunk content (if changed) and release its memory */
+int cio_segment_down(struct cio_chunk *ch)
+{
+    int ret;
+    struct cio_segment_chunk *sc = ch->backend;
+
+    if (sc->up == CIO_FALSE) {
+        cio_log_error(ch->ctx, "[cio segment] chunk is not up: %s/%s",
+                      ch->st->name, ch->name);
+        return -1;
+    }
+
+    ret = cio_segment_sync(ch);
+    if (ret == -1) {
+        return -1;
+    }
+
+    chunk_unload(ch, sc);
+    return 0;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+    int ret;
+    const struct seg_entry *ea = a;
+    const struct seg_entry *eb = b;
+
+    ret = strcmp(ea->name, eb->name);
+    if (ret != 0) {
+        return ret;
+    }
+
+    /* newer copies are always appended after the old ones */
+    if (ea->seg->id != eb->seg->id) {
+        return ea->seg->id < eb->seg->id ? -1 : 1;
+    }
+    if (ea->offset != eb->offset) {
+        return ea->offset < eb->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+static int id_cmp(const void *a, const void *b)
+{
+    uint32_t ia = *(const uint32_t *) a;
+    uint32_t ib = *(const uint32_t *) b;
+
+    if (ia == ib) {
+        return 0;
+    }
+    return ia < ib ? -1 : 1;
+}
+
+/* Append an entry to the scan array, growing it as needed */
+static int entries_add(struct seg_entry **entries, size_t *n, size_t *size,
+                       struct seg_entry *e)
+{
+    size_t new_size;
+    struct seg_entry *tmp;
+
+    if (*n == *size) {
+        new_size = *size ? *size * 2 : 256;
+        tmp = realloc(*entries, new_size * sizeof(struct seg_entry));
+        if (!tmp) {
+            cio_errno();
+            return -1;
+        }
+        *entries = tmp;
+        *size = new_size;
+    }
+
+    (*entries)[(*n)++] = *e;
+    return 0;
+}
+
+/* Read the record headers of a segment and collect the live ones */
+static int segment_load(struct cio_ctx *ctx, struct cio_stream *st,
+                        uint32_t id, struct seg_entry **entries,
+                        size_t *n_entries, size_t *entries_size)
+{
+    int fd;
+    int ret;
+    char *path;
+    off_t off;
+    size_t rsize;
+    uint32_t state;
+    uint16_t name_len;
+    struct stat fst;
+    unsigned char header[CIO_SEG_REC_HEADER];
+    struct seg_entry e;
+    struct cio_segment *seg;
+    struct cio_segment_index *idx = st->backend;
+
+    path = segment_path(ctx, st, id);
+    if (!path) {
+        return -1;
+    }
+
+    fd = open(path, O_RDWR);
+    if (fd == -1) {
+        cio_errno();
+        free(path);
+        return -1;
+    }
+
+    ret = fstat(fd, &fst);
+    if (ret == -1 ||
+        pread(fd, header, CIO_SEG_HEADER_SIZE, 0) != CIO_SEG_HEADER_SIZE ||
+        memcmp(header, CIO_SEG_MAGIC, sizeof(CIO_SEG_MAGIC) - 1) != 0) {
+        cio_log_warn(ctx, "[cio segment] invalid segment file %s", path);
+        close(fd);
+        free(path);
+        return -1;
+    }
+
+    seg = segment_new(id, fd, path);
+    if (!seg) {
+        close(fd);
+        free(path);
+        return -1;
+    }
+    seg->size = fst.st_size;
+    mk_list_add(&seg->_head, &idx->segments);
+
+    off = CIO_SEG_HEADER_SIZE;
+    while (off + CIO_SEG_REC_HEADER <= seg->size) {
+        ret = pread(fd, header, sizeof(header), off);
+        if (ret != sizeof(header)) {
+            cio_errno();
+            break;
+        }
+
+        state = get_u32(header);
+        if (state == CIO_SEG_REC_END) {
+            break;
+        }
+        else if (state != CIO_SEG_REC_LIVE && state != CIO_SEG_REC_DEAD) {
+            cio_log_warn(ctx, "[cio segment] invalid record at %s:%lu, "
+                         "skipping the rest of the segment",
+                         path, (unsigned long) off);
+            break;
+        }
+
+        memset(&e, '\0', sizeof(e));
+        name_len = get_u16(header + 8);
+        e.meta_len = get_u16(header + 10);
+        e.data_size = get_u64(header + 16);
+
+        rsize = record_size(name_len, e.meta_len, e.data_size);
+        if (name_len == 0 || off + rsize > seg->size) {
+            cio_log_warn(ctx, "[cio segment] truncated record at %s:%lu",
+                         path, (unsigned long) off);
+            break;
+        }
+
+        if (state == CIO_SEG_REC_DEAD) {
+            off += rsize;
+            continue;
+        }
+
+        /* read name and metadata, content is loaded when the chunk is up */
+        e.name = malloc(name_len + 1);
+        e.meta = malloc(e.meta_len + 1);
+        if (!e.name || !e.meta) {
+            cio_errno();
+            free(e.name);
+            free(e.meta);
+            return -1;
+        }
+
+        ret = pread(fd, e.name, name_len, off + CIO_SEG_REC_HEADER);
+        if (ret != name_len) {
+            free(e.name);
+            free(e.meta);
+            break;
+        }
+        e.name[name_len] = '\0';
+
+        ret = pread(fd, e.meta, e.meta_len,
+                    off + CIO_SEG_REC_HEADER + name_len);
+        if (ret != e.meta_len) {
+            free(e.name);
+            free(e.meta);
+            break;
+        }
+
+        e.crc = get_u32(header + 4);
+        if (get_u32(header + 12) & CIO_SEG_REC_CRC32C) {
+            e.crc_type = CIO_CRC32C;
+        }
+        else {
+            e.crc_type = CIO_CRC32;
+        }
+        e.offset = off;
+        e.seg = seg;
+
+        ret = entries_add(entries, n_entries, entries_size, &e);
+        if (ret == -1) {
+            free(e.name);
+            free(e.meta);
+            return -1;
+        }
+        off += rsize;
+    }
+    seg->offset = off;
+
+    return 0;
+}
+
+/*
+ * Restore the chunks of a stream: load every segment found in the stream
+ * directory, register the latest copy of each chunk and drop the segments
+ * that have nothing alive.
+ */
+int cio_segment_scan(struct cio_ctx *ctx, struct cio_stream *st)
+{
+    int err;
+    int ret;
+    int64_t id;
+    char *path;
+    size_t i;
+    size_t n_ids = 0;
+    size_t n_entries = 0;
+    size_t entries_size = 0;
+    uint32_t *ids = NULL;
+    uint32_t *tmp;
+    DIR *dir;
+    unsigned char state[4];
+    struct dirent *ent;
+    struct mk_list *head;
+    struct mk_list *tmp_head;
+    struct seg_entry *e;
+    struct seg_entry *entries = NULL;
+    struct cio_chunk *ch;
+    struct cio_segment *seg;
+    struct cio_segment_chunk *sc;
+    struct cio_segment_index *idx = st->backend;
+
+    path = segment_path(ctx, st, 0);
+    if (!path) {
+        return -1;
+    }
+    *strrchr(path, '/') = '\0';
+
+    dir = opendir(path);
+    if (!dir) {
+        cio_errno();
+        free(path);
+        return -1;
+    }
+
+    cio_log_debug(ctx, "[cio segment] scanning stream %s", st->name);
+
+    while ((ent = readdir(dir)) != NULL) {
+        id = segment_id(ent->d_name);
+        if (id < 0) {
+            continue;
+        }
+
+        tmp = realloc(ids, sizeof(uint32_t) * (n_ids + 1));
+        if (!tmp) {
+            cio_errno();
+            closedir(dir);
+            free(ids);
+            free(path);
+            return -1;
+        }
+        ids = tmp;
+        ids[n_ids++] = id;
+    }
+    closedir(dir);
+    free(path);
+
+    /* segments are loaded in creation order */
+    if (n_ids > 0) {
+        qsort(ids, n_ids, sizeof(uint32_t), id_cmp);
+    }
+    for (i = 0; i < n_ids; i++) {
+        segment_load(ctx, st, ids[i], &entries, &n_entries, &entries_size);
+        if (ids[i] >= idx->next_id) {
+            idx->next_id = ids[i] + 1;
+        }
+    }
+    free(ids);
+
+    /*
+     * A chunk might have two live copies if the process stopped right
+     * after appending a new one, keep the most recent.
+     */
+    if (n_entries > 0) {
+        qsort(entries, n_entries, sizeof(struct seg_entry), entry_cmp);
+    }
+
+    put_u32(state, CIO_SEG_REC_DEAD);
+    for (i = 0; i < n_entries; i++) {
+        e = &entries[i];
+
+        if (i + 1 < n_entries && strcmp(e->name, entries[i + 1].name) == 0) {
+            ret = pwrite(e->seg->fd, state, sizeof(state), e->offset);
+            if (ret != sizeof(state)) {
+                cio_errno();
+            }
+            free(e->name);
+            free(e->meta);
+            continue;
+        }
+
+        ch = cio_chunk_open(ctx, st, e->name, CIO_OPEN_RD, 0, &err);
+        if (!ch) {
+            free(e->name);
+            free(e->meta);
+            continue;
+        }
+
+        sc = ch->backend;
+        sc->seg = e->seg;
+        sc->rec_offset = e->offset;
+        sc->rec_crc = e->crc;
+        sc->rec_crc_type = e->crc_type;
+        sc->data_size = e->data_size;
+        if (e->meta_len > 0) {
+            sc->meta_data = e->meta;
+            sc->meta_len = e->meta_len;
+        }
+        else {
+            free(e->meta);
+        }
+        e->seg->live++;
+        free(e->name);
+    }
+    free(entries);
+
+    mk_list_foreach_safe(head, tmp_head, &idx->segments) {
+        seg = mk_list_entry(head, struct cio_segment, _head);
+        if (seg->live <= 0) {
+            segment_release(ctx, seg);
+        }
+    }
+
+    return 0;
+}
+
+void cio_segment_scan_dump(struct cio_ctx *ctx, struct cio_stream *st)
+{
+    char tmp[PATH_MAX];
+    struct mk_list *head;
+    struct cio_chunk *ch;
+    struct cio_segment_chunk *sc;
+
+    (void) ctx;
+
+    mk_list_foreach(head, &st->chunks) {
+        ch = mk_list_entry(head, struct cio_chunk, _head);
+        sc = ch->backend;
+
+        snprintf(tmp, sizeof(tmp) - 1, "%s/%s", st->name, ch->name);
+        printf("        %-60s", tmp);
+        if (sc->seg) {
+            printf("meta_len=%d, data_size=%lu, segment=%08x, offset=%lu\n",
+                   sc->meta_len, sc->data_size, sc->seg->id,
+                   (unsigned long) sc->rec_offset);
+        }
+        else {
+            printf("meta_len=%d, data_size=%lu, not synced\n",
+                   sc->meta_len, sc->data_size);
+        }
+    }
+}
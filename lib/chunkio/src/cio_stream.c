@@ -27,6 +27,7 @@
 #include <chunkio/cio_log.h>
 #include <chunkio/cio_chunk.h>
 #include <chunkio/cio_stream.h>
+#include <chunkio/cio_segment.h>
 
 #include <monkey/mk_core/mk_list.h>
 
@@ -92,15 +93,21 @@ struct cio_stream *cio_stream_create(struct cio_ctx *ctx, const char *name,
         cio_log_error(ctx, "[stream create] invalid stream name");
         return NULL;
     }
+
+    /* file system streams can be stored in segments */
+    if (type == CIO_STORE_FS && (ctx->flags & CIO_SEGMENTS)) {
+        type = CIO_STORE_SEG;
+    }
+
 #ifndef CIO_HAVE_BACKEND_FILESYSTEM
-    if (type == CIO_STORE_FS) {
+    if (type == CIO_STORE_FS || type == CIO_STORE_SEG) {
         cio_log_error(ctx, "[stream create] file system backend not supported");
         return NULL;
     }
 #endif
 
     /* If backend is the file system, validate the stream path */
-    if (type == CIO_STORE_FS) {
+    if (type == CIO_STORE_FS || type == CIO_STORE_SEG) {
         ret = check_stream_path(ctx, name);
         if (ret == -1) {
             return NULL;
@@ -121,7 +128,19 @@ struct cio_stream *cio_stream_create(struct cio_ctx *ctx, const char *name,
     }
 
     st->parent = ctx;
+    st->backend = NULL;
+    memset(&st->compress, 0, sizeof(st->compress));
     mk_list_init(&st->chunks);
+
+    if (type == CIO_STORE_SEG) {
+        ret = cio_segment_index_create(ctx, st);
+        if (ret == -1) {
+            free(st->name);
+            free(st);
+            return NULL;
+        }
+    }
+
     mk_list_add(&st->_head, &ctx->streams);
 
     cio_log_debug(ctx, "[cio stream] new stream registered: %s", name);
@@ -136,6 +155,10 @@ void cio_stream_destroy(struct cio_stream *st)
     /* close all files */
     cio_chunk_close_stream(st);
 
+    if (st->type == CIO_STORE_SEG) {
+        cio_segment_index_destroy(st);
+    }
+
     /* destroy stream */
     mk_list_del(&st->_head);
     free(st->name);
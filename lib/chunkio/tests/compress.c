@@ -0,0 +1,138 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chunkio/chunkio.h>
+#include <chunkio/cio_compress.h>
+
+#include "cio_tests_internal.h"
+
+/* Compress, decompress and compare; returns the compressed size */
+static ssize_t round_trip(const char *in, size_t size)
+{
+    char *out;
+    char *dec;
+    size_t bound;
+    ssize_t len;
+    ssize_t ret;
+
+    bound = cio_lz4_bound(size);
+    out = malloc(bound);
+    dec = malloc(size + 1);
+    TEST_CHECK(out != NULL && dec != NULL);
+
+    len = cio_lz4_compress(in, size, out, bound);
+    TEST_CHECK(len > 0 && (size_t) len <= bound);
+
+    ret = cio_lz4_decompress(out, len, dec, size);
+    TEST_CHECK(ret == (ssize_t) size);
+    TEST_CHECK(memcmp(in, dec, size) == 0);
+
+    free(out);
+    free(dec);
+    return len;
+}
+
+static void test_lz4_round_trip()
+{
+    int i;
+    size_t size;
+    ssize_t len;
+    char buf[70000];
+    uint32_t seed = 1;
+
+    /* tiny inputs: only literals */
+    round_trip("", 0);
+    round_trip("a", 1);
+    round_trip("hello, world", 12);
+
+    /* long runs use overlapping matches */
+    memset(buf, 'x', sizeof(buf));
+    len = round_trip(buf, sizeof(buf));
+    TEST_CHECK(len < 512);
+
+    /* random data does not compress but must survive */
+    for (i = 0; i < sizeof(buf); i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+    len = round_trip(buf, sizeof(buf));
+    TEST_CHECK(len <= (ssize_t) cio_lz4_bound(sizeof(buf)));
+
+    /* log records */
+    size = 0;
+    for (i = 0; size + 128 < sizeof(buf); i++) {
+        size += snprintf(buf + size, sizeof(buf) - size,
+                         "{\"time\":%i,\"level\":\"info\",\"status\":%i}\n",
+                         1600000000 + i, 200 + (i % 5));
+    }
+    len = round_trip(buf, size);
+    TEST_CHECK(len < size / 2);
+}
+
+/* Malformed blocks must be rejected without overflowing the output */
+static void test_lz4_malformed()
+{
+    int i;
+    char in[4096];
+    char out[8192];
+    char dec[4096];
+    ssize_t len;
+    ssize_t ret;
+
+    for (i = 0; i < sizeof(in); i++) {
+        in[i] = "abcabcabd"[i % 9];
+    }
+    len = cio_lz4_compress(in, sizeof(in), out, sizeof(out));
+    TEST_CHECK(len > 0);
+
+    /* output buffer too small */
+    ret = cio_lz4_decompress(out, len, dec, sizeof(dec) - 1);
+    TEST_CHECK(ret == -1);
+
+    /* truncated input */
+    ret = cio_lz4_decompress(out, len - 3, dec, sizeof(dec));
+    TEST_CHECK(ret != sizeof(dec));
+
+    /* offset pointing before the start of the output */
+    out[0] = 0x10;           /* 1 literal, match of 4 */
+    out[1] = 'a';
+    out[2] = 0x05;
+    out[3] = 0x00;
+    ret = cio_lz4_decompress(out, 4, dec, sizeof(dec));
+    TEST_CHECK(ret == -1);
+
+    /* zero offset */
+    out[2] = 0x00;
+    ret = cio_lz4_decompress(out, 4, dec, sizeof(dec));
+    TEST_CHECK(ret == -1);
+
+    /* destination smaller than the bound */
+    ret = cio_lz4_compress(in, sizeof(in), out, 16);
+    TEST_CHECK(ret == -1);
+}
+
+TEST_LIST = {
+    {"lz4_round_trip", test_lz4_round_trip},
+    {"lz4_malformed",  test_lz4_malformed},
+    { 0 }
+};
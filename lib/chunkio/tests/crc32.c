@@ -0,0 +1,151 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <chunkio/chunkio.h>
+#include <chunkio/cio_crc32.h>
+
+#include "cio_tests_internal.h"
+
+/* Bitwise reference implementation */
+static uint32_t crc32c_ref(uint32_t crc, const unsigned char *p, size_t len)
+{
+    int k;
+
+    while (len--) {
+        crc ^= *p++;
+        for (k = 0; k < 8; k++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+        }
+    }
+    return crc;
+}
+
+static uint32_t crc32c(const void *buf, size_t len)
+{
+    crc_t crc;
+
+    crc = cio_crc32_init();
+    crc = cio_crc32c_update(crc, buf, len);
+    return (uint32_t) cio_crc32_finalize(crc);
+}
+
+/* Check values of both algorithms */
+static void test_crc32_check_values()
+{
+    crc_t crc;
+    const char *in = "123456789";
+
+    crc = cio_crc32_init();
+    crc = cio_crc32_update(crc, in, 9);
+    TEST_CHECK((uint32_t) cio_crc32_finalize(crc) == 0xcbf43926);
+
+    TEST_CHECK(crc32c(in, 9) == 0xe3069283);
+    TEST_CHECK(crc32c(in, 0) == 0);
+
+    printf("\ncrc32c hardware acceleration: %s\n",
+           cio_crc32c_hw() ? "yes" : "no");
+}
+
+/*
+ * Compare against the reference for every length and alignment up to a few
+ * lanes, plus sizes that go through the long lanes.
+ */
+static void test_crc32c_sizes()
+{
+    int i;
+    int off;
+    int fail = 0;
+    size_t len;
+    size_t big = 3 * 8192 * 3 + 3 * 256 + 13;
+    unsigned char *buf;
+    uint32_t a;
+    uint32_t b;
+
+    buf = malloc(big + 8);
+    TEST_CHECK(buf != NULL);
+    if (!buf) {
+        exit(EXIT_FAILURE);
+    }
+
+    srand(1234);
+    for (i = 0; i < big + 8; i++) {
+        buf[i] = rand() & 0xff;
+    }
+
+    for (off = 0; off < 8; off++) {
+        for (len = 0; len < 3 * 256 * 2 + 17; len++) {
+            a = crc32c_ref(0xffffffff, buf + off, len) ^ 0xffffffff;
+            b = crc32c(buf + off, len);
+            if (a != b) {
+                fail++;
+            }
+        }
+    }
+    TEST_CHECK(fail == 0);
+
+    for (off = 0; off < 8; off++) {
+        a = crc32c_ref(0xffffffff, buf + off, big) ^ 0xffffffff;
+        b = crc32c(buf + off, big);
+        TEST_CHECK(a == b);
+    }
+
+    free(buf);
+}
+
+/* The checksum can be computed in pieces, as chunk writes do */
+static void test_crc32c_incremental()
+{
+    int i;
+    size_t size = 100000;
+    size_t pos;
+    size_t step;
+    unsigned char *buf;
+    crc_t crc;
+
+    buf = malloc(size);
+    TEST_CHECK(buf != NULL);
+    if (!buf) {
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < size; i++) {
+        buf[i] = i * 31;
+    }
+
+    crc = cio_crc32_init();
+    pos = 0;
+    step = 1;
+    while (pos < size) {
+        if (pos + step > size) {
+            step = size - pos;
+        }
+        crc = cio_crc32c_update(crc, buf + pos, step);
+        pos += step;
+        step = step * 3 + 1;
+    }
+
+    TEST_CHECK((uint32_t) cio_crc32_finalize(crc) == crc32c(buf, size));
+    free(buf);
+}
+
+TEST_LIST = {
+    {"crc32_check_values", test_crc32_check_values},
+    {"crc32c_sizes",       test_crc32c_sizes},
+    {"crc32c_incremental", test_crc32c_incremental},
+    { 0 }
+};
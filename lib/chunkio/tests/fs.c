@@ -19,11 +19,17 @@
 
 #include <sys/mman.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <chunkio/chunkio.h>
 #include <chunkio/cio_log.h>
 #include <chunkio/cio_scan.h>
+#include <chunkio/cio_commit.h>
+#include <chunkio/cio_compress.h>
+#include <chunkio/cio_crc32.h>
 #include <chunkio/cio_file.h>
+#include <chunkio/cio_manifest.h>
 #include <chunkio/cio_meta.h>
 #include <chunkio/cio_stream.h>
 #include <chunkio/cio_utils.h>
@@ -200,6 +206,7 @@ static void test_fs_checksum()
 
     ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, flags);
     TEST_CHECK(ctx != NULL);
+    cio_set_checksum_type(ctx, CIO_CRC32);
 
     stream = cio_stream_create(ctx, "test-crc32", CIO_STORE_FS);
     TEST_CHECK(stream != NULL);
@@ -257,6 +264,102 @@ static void test_fs_checksum()
     free(in_data);
 }
 
+/* Value of the checksum stored in the chunk header */
+static uint32_t chunk_crc(struct cio_chunk *chunk)
+{
+    uint32_t val;
+
+    memcpy(&val, cio_chunk_hash(chunk), sizeof(val));
+    return ntohl(val);
+}
+
+/*
+ * crc32c chunks are flagged in their header, chunks written with crc32
+ * keep validating and keep their algorithm after they are loaded again.
+ */
+static void test_fs_checksum_crc32c()
+{
+    int ret;
+    int err;
+    char *in_data;
+    char *buf;
+    size_t in_size;
+    size_t size;
+    crc_t crc;
+    struct cio_ctx *ctx;
+    struct cio_stream *stream;
+    struct cio_chunk *chunk;
+    struct cio_file *cf;
+
+    cio_utils_recursive_delete(CIO_ENV);
+
+    ret = cio_utils_read_file(CIO_FILE_400KB, &in_data, &in_size);
+    TEST_CHECK(ret == 0);
+    if (ret == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_CHECKSUM);
+    TEST_CHECK(ctx != NULL);
+    stream = cio_stream_create(ctx, "test-crc32c", CIO_STORE_FS);
+
+    /* crc32c chunk */
+    cio_set_checksum_type(ctx, CIO_CRC32C);
+    chunk = cio_chunk_open(ctx, stream, "new", CIO_OPEN, 10, &err);
+    TEST_CHECK(chunk != NULL);
+    cf = chunk->backend;
+    TEST_CHECK(cio_file_st_get_flags(cf->map) & CIO_FILE_FLAG_CRC32C);
+
+    crc = cio_crc32_init();
+    crc = cio_crc32c_update(crc, "\0\0", 2);
+    TEST_CHECK(chunk_crc(chunk) == (uint32_t) cio_crc32_finalize(crc));
+
+    cio_chunk_write(chunk, in_data, in_size);
+    cio_chunk_sync(chunk);
+    crc = cio_crc32c_update(crc, in_data, in_size);
+    TEST_CHECK(chunk_crc(chunk) == (uint32_t) cio_crc32_finalize(crc));
+
+    /* crc32 (legacy) chunk */
+    cio_set_checksum_type(ctx, CIO_CRC32);
+    chunk = cio_chunk_open(ctx, stream, "old", CIO_OPEN, 10, &err);
+    TEST_CHECK(chunk != NULL);
+    cf = chunk->backend;
+    TEST_CHECK(cio_file_st_get_flags(cf->map) == 0);
+    cio_chunk_write(chunk, in_data, in_size);
+    cio_chunk_sync(chunk);
+    cio_destroy(ctx);
+
+    /* restore both, append to the legacy one and restore again */
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_CHECKSUM);
+    cio_set_checksum_type(ctx, CIO_CRC32C);
+    stream = cio_stream_create(ctx, "test-crc32c", CIO_STORE_FS);
+
+    chunk = cio_chunk_open(ctx, stream, "new", CIO_OPEN, 10, &err);
+    TEST_CHECK(chunk != NULL);
+
+    chunk = cio_chunk_open(ctx, stream, "old", CIO_OPEN, 10, &err);
+    TEST_CHECK(chunk != NULL);
+    cf = chunk->backend;
+    TEST_CHECK(cf->crc_type == CIO_CRC32);
+    cio_chunk_write(chunk, in_data, in_size);
+    cio_chunk_sync(chunk);
+    cio_destroy(ctx);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_CHECKSUM);
+    stream = cio_stream_create(ctx, "test-crc32c", CIO_STORE_FS);
+    chunk = cio_chunk_open(ctx, stream, "old", CIO_OPEN, 10, &err);
+    TEST_CHECK(chunk != NULL);
+    if (chunk) {
+        ret = cio_chunk_get_content(chunk, &buf, &size);
+        TEST_CHECK(ret == CIO_OK);
+        TEST_CHECK(size == in_size * 2);
+    }
+    cio_destroy(ctx);
+
+    free(in_data);
+    cio_utils_recursive_delete(CIO_ENV);
+}
+
 /*
  * Create one file chunk, do writes and invoke up()/down() calls, then validate
  * it checksum.
@@ -305,6 +408,7 @@ static void test_fs_up_down()
 
     ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, flags);
     TEST_CHECK(ctx != NULL);
+    cio_set_checksum_type(ctx, CIO_CRC32);
 
     stream = cio_stream_create(ctx, "test-crc32", CIO_STORE_FS);
     TEST_CHECK(stream != NULL);
@@ -452,11 +556,441 @@ static void test_issue_flb_2025()
     cio_destroy(ctx);
 }
 
+struct commit_counter {
+    int commits;
+    int chunks;
+    size_t bytes;
+};
+
+static void commit_cb(struct cio_ctx *ctx, struct cio_commit_info *info,
+                      void *data)
+{
+    struct commit_counter *c = data;
+
+    (void) ctx;
+
+    c->commits++;
+    c->chunks += info->chunks;
+    c->bytes += info->bytes;
+}
+
+/* Chunk syncs are made durable in groups, for files and segments */
+static void group_commit(int flags)
+{
+    int i;
+    int ret;
+    int err;
+    int n_chunks = 16;
+    char name[32];
+    char data[10 * 1024];
+    struct cio_ctx *ctx;
+    struct cio_chunk *chunk;
+    struct cio_stream *stream;
+    struct commit_counter counter = {0};
+
+    cio_utils_recursive_delete(CIO_ENV);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, flags | CIO_FULL_SYNC);
+    TEST_CHECK(ctx != NULL);
+    if (!ctx) {
+        exit(1);
+    }
+
+    /* commit every 64KB, the window is driven by explicit commits */
+    ret = cio_set_group_commit(ctx, 1000, 64 * 1024);
+#ifndef CIO_HAVE_SYNCFS
+    /* no syncfs(2): group commit is refused */
+    TEST_CHECK(ret == -1);
+    TEST_CHECK(cio_commit_enabled(ctx) == CIO_FALSE);
+    cio_destroy(ctx);
+    cio_utils_recursive_delete(CIO_ENV);
+    return;
+#endif
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(cio_commit_enabled(ctx) == CIO_TRUE);
+    cio_set_commit_callback(ctx, commit_cb, &counter);
+
+    stream = cio_stream_create(ctx, "test-commit", CIO_STORE_FS);
+    memset(data, 'x', sizeof(data));
+
+    for (i = 0; i < n_chunks; i++) {
+        snprintf(name, sizeof(name), "chunk-%i", i);
+        chunk = cio_chunk_open(ctx, stream, name, CIO_OPEN, 1000, &err);
+        TEST_CHECK(chunk != NULL);
+        if (!chunk) {
+            exit(1);
+        }
+        ret = cio_chunk_write(chunk, data, sizeof(data));
+        TEST_CHECK(ret == 0);
+        ret = cio_chunk_sync(chunk);
+        TEST_CHECK(ret == 0);
+    }
+
+    /* the byte limit triggered commits covering several chunks */
+    TEST_CHECK(counter.commits > 0);
+    TEST_CHECK(counter.commits < n_chunks);
+    TEST_CHECK(counter.chunks > counter.commits);
+
+    /* the window expiration commits the rest */
+    ret = cio_commit(ctx);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(counter.chunks == n_chunks);
+    TEST_CHECK(ctx->commit_chunks == 0);
+    TEST_CHECK(ctx->commit_pending == 0);
+    TEST_CHECK(counter.bytes >= n_chunks * sizeof(data));
+
+    /* nothing pending: no-op */
+    i = counter.commits;
+    cio_commit(ctx);
+    TEST_CHECK(counter.commits == i);
+
+    cio_destroy(ctx);
+    cio_utils_recursive_delete(CIO_ENV);
+}
+
+static void test_fs_group_commit()
+{
+    group_commit(0);
+    group_commit(CIO_SEGMENTS);
+}
+
+/* Buffer of log like records, compressible as real chunks are */
+static char *log_records(size_t *size)
+{
+    int i;
+    size_t len = 0;
+    size_t alloc = 512 * 1024;
+    char *buf;
+
+    buf = malloc(alloc);
+    if (!buf) {
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; len + 128 < alloc; i++) {
+        len += snprintf(buf + len, alloc - len,
+                        "{\"time\":%i,\"level\":\"info\",\"path\":\"/api/%i\","
+                        "\"status\":%i,\"bytes\":%i}\n",
+                        1600000000 + i, i % 97, 200 + (i % 5), i * 7);
+    }
+
+    *size = len;
+    return buf;
+}
+
+/* Locked chunks are compressed when put down and restored transparently */
+static void test_fs_compress()
+{
+    int fd;
+    int ret;
+    int err;
+    int meta_len;
+    char *meta;
+    char *in_data;
+    char *buf;
+    char path[1024];
+    size_t in_size;
+    size_t size;
+    ssize_t real_size;
+    struct mk_list *head;
+    struct cio_ctx *ctx;
+    struct cio_stream *stream;
+    struct cio_chunk *chunk;
+    struct cio_chunk *active;
+    struct cio_file *cf;
+
+    cio_utils_recursive_delete(CIO_ENV);
+
+    in_data = log_records(&in_size);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_CHECKSUM);
+    TEST_CHECK(ctx != NULL);
+    ret = cio_set_compression(ctx, CIO_COMPRESS_LZ4);
+    TEST_CHECK(ret == 0);
+    stream = cio_stream_create(ctx, "test-compress", CIO_STORE_FS);
+
+    chunk = cio_chunk_open(ctx, stream, "locked", CIO_OPEN, 10, &err);
+    TEST_CHECK(chunk != NULL);
+    cio_meta_write(chunk, "tag", 3);
+    cio_chunk_write(chunk, in_data, in_size);
+    cio_chunk_write(chunk, in_data, in_size);
+
+    active = cio_chunk_open(ctx, stream, "active", CIO_OPEN, 10, &err);
+    TEST_CHECK(active != NULL);
+    cio_chunk_write(active, in_data, in_size);
+
+    /* only the locked chunk gets compressed */
+    cio_chunk_lock(chunk);
+    ret = cio_chunk_down(chunk);
+    TEST_CHECK(ret == 0);
+    ret = cio_chunk_down(active);
+    TEST_CHECK(ret == 0);
+
+    real_size = cio_chunk_get_real_size(chunk);
+    TEST_CHECK(real_size > 0 && real_size < in_size);
+    TEST_CHECK(cio_chunk_get_real_size(active) >= in_size);
+    TEST_CHECK(stream->compress.chunks == 1);
+    TEST_CHECK(stream->compress.raw_bytes == 2 + 3 + in_size * 2);
+    TEST_CHECK(stream->compress.bytes < stream->compress.raw_bytes);
+
+    /* up: content and checksum are verified */
+    ret = cio_chunk_up(chunk);
+    TEST_CHECK(ret == CIO_OK);
+    ret = cio_chunk_get_content(chunk, &buf, &size);
+    TEST_CHECK(ret == CIO_OK);
+    TEST_CHECK(size == in_size * 2);
+    TEST_CHECK(memcmp(buf, in_data, in_size) == 0);
+    TEST_CHECK(memcmp(buf + in_size, in_data, in_size) == 0);
+    TEST_CHECK(stream->compress.decompressed == 1);
+
+    /* a compressed chunk goes down without being written again */
+    ret = cio_chunk_down(chunk);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(cio_chunk_get_real_size(chunk) == real_size);
+    TEST_CHECK(stream->compress.chunks == 1);
+    cio_destroy(ctx);
+
+    /* restore */
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_CHECKSUM);
+    ret = cio_load(ctx, NULL);
+    TEST_CHECK(ret == 0);
+    stream = mk_list_entry_first(&ctx->streams, struct cio_stream, _head);
+    TEST_CHECK(mk_list_size(&stream->chunks) == 2);
+
+    chunk = NULL;
+    mk_list_foreach(head, &stream->chunks) {
+        chunk = mk_list_entry(head, struct cio_chunk, _head);
+        if (strcmp(chunk->name, "locked") == 0) {
+            break;
+        }
+    }
+    TEST_CHECK(chunk != NULL && strcmp(chunk->name, "locked") == 0);
+    if (cio_chunk_is_up(chunk) == CIO_FALSE) {
+        ret = cio_chunk_up(chunk);
+        TEST_CHECK(ret == CIO_OK);
+    }
+    ret = cio_chunk_get_content(chunk, &buf, &size);
+    TEST_CHECK(size == in_size * 2);
+    TEST_CHECK(memcmp(buf, in_data, in_size) == 0);
+    ret = cio_meta_read(chunk, &meta, &meta_len);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(meta_len == 3 && memcmp(meta, "tag", 3) == 0);
+    cio_destroy(ctx);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_CHECKSUM);
+    stream = cio_stream_create(ctx, "test-compress", CIO_STORE_FS);
+    chunk = cio_chunk_open(ctx, stream, "locked", CIO_OPEN, 10, &err);
+    TEST_CHECK(chunk != NULL);
+    if (!chunk) {
+        exit(EXIT_FAILURE);
+    }
+
+    /* writing to the chunk stores it uncompressed again */
+    ret = cio_chunk_write(chunk, in_data, in_size);
+    TEST_CHECK(ret == 0);
+    cf = chunk->backend;
+    TEST_CHECK(cf->compressed == CIO_FALSE);
+    ret = cio_chunk_down(chunk);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(cio_chunk_get_real_size(chunk) >= in_size * 3);
+
+    ret = cio_chunk_up(chunk);
+    TEST_CHECK(ret == CIO_OK);
+    ret = cio_chunk_get_content(chunk, &buf, &size);
+    TEST_CHECK(size == in_size * 3);
+    TEST_CHECK(memcmp(buf + in_size * 2, in_data, in_size) == 0);
+    ret = cio_meta_read(chunk, &meta, &meta_len);
+    TEST_CHECK(meta_len == 3 && memcmp(meta, "tag", 3) == 0);
+
+    /* compress it again and corrupt the compressed content */
+    cio_set_compression(ctx, CIO_COMPRESS_LZ4);
+    cio_chunk_lock(chunk);
+    cio_chunk_down(chunk);
+    TEST_CHECK(cio_chunk_get_real_size(chunk) < in_size);
+    cio_destroy(ctx);
+
+    snprintf(path, sizeof(path), "%s/test-compress/locked", CIO_ENV);
+    fd = open(path, O_RDWR);
+    TEST_CHECK(fd != -1);
+    if (fd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    ret = pwrite(fd, "\xff\xff\xff\xff", 4, CIO_FILE_CONTENT_OFFSET + 1);
+    TEST_CHECK(ret == 4);
+    close(fd);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_CHECKSUM);
+    stream = cio_stream_create(ctx, "test-compress", CIO_STORE_FS);
+    chunk = cio_chunk_open(ctx, stream, "locked", CIO_OPEN, 10, &err);
+    TEST_CHECK(chunk == NULL);
+    TEST_CHECK(err == CIO_CORRUPTED);
+    cio_destroy(ctx);
+
+    free(in_data);
+    cio_utils_recursive_delete(CIO_ENV);
+}
+
+static int count_chunks(struct cio_ctx *ctx, int *up)
+{
+    int total = 0;
+    struct mk_list *head;
+    struct mk_list *c_head;
+    struct cio_stream *stream;
+    struct cio_chunk *chunk;
+
+    *up = 0;
+    mk_list_foreach(head, &ctx->streams) {
+        stream = mk_list_entry(head, struct cio_stream, _head);
+        mk_list_foreach(c_head, &stream->chunks) {
+            chunk = mk_list_entry(c_head, struct cio_chunk, _head);
+            if (cio_chunk_is_up(chunk) == CIO_TRUE) {
+                (*up)++;
+            }
+            total++;
+        }
+    }
+
+    return total;
+}
+
+/* Parallel scan, deferred validation and the startup manifest */
+static void test_fs_scan()
+{
+    int i;
+    int j;
+    int up;
+    int err;
+    int ret;
+    int used;
+    int fd;
+    char name[64];
+    char path[1024];
+    struct mk_list *head;
+    struct cio_ctx *ctx;
+    struct cio_stream *stream;
+    struct cio_chunk *chunk;
+    struct cio_scan_dir *sd;
+    struct cio_manifest *mf;
+
+    cio_utils_recursive_delete(CIO_ENV);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_CHECKSUM);
+    TEST_CHECK(ctx != NULL);
+    TEST_CHECK(cio_set_scan_workers(ctx, 0) == -1);
+    cio_set_manifest(ctx, CIO_TRUE);
+
+    for (i = 0; i < 6; i++) {
+        snprintf(name, sizeof(name), "stream-%i", i);
+        stream = cio_stream_create(ctx, name, CIO_STORE_FS);
+        for (j = 0; j < 20; j++) {
+            snprintf(name, sizeof(name), "chunk-%i.flb", j);
+            chunk = cio_chunk_open(ctx, stream, name, CIO_OPEN, 100, &err);
+            TEST_CHECK(chunk != NULL);
+            cio_chunk_write(chunk, "data", 4);
+            cio_chunk_down(chunk);
+        }
+    }
+    cio_destroy(ctx);
+
+    snprintf(path, sizeof(path), "%s/%s", CIO_ENV, CIO_MANIFEST_FILE);
+    TEST_CHECK(access(path, F_OK) == 0);
+
+    /* every stream listed in the manifest is still valid */
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_CHECKSUM);
+    mf = cio_manifest_load(ctx);
+    TEST_CHECK(mf != NULL);
+    if (!mf) {
+        exit(EXIT_FAILURE);
+    }
+    TEST_CHECK(mf->count == 6);
+    TEST_CHECK(access(path, F_OK) == -1);
+
+    used = 0;
+    for (i = 0; i < 6; i++) {
+        snprintf(name, sizeof(name), "stream-%i", i);
+        stream = cio_stream_create(ctx, name, CIO_STORE_FS);
+        sd = cio_scan_dir_create(ctx, stream);
+        if (cio_manifest_lookup(mf, sd) == 0) {
+            TEST_CHECK(sd->count == 20);
+            used++;
+        }
+        cio_scan_dir_destroy(sd);
+    }
+    TEST_CHECK(used == 6);
+    cio_manifest_destroy(mf);
+    cio_destroy(ctx);
+
+    /* a changed stream is listed again, chunks are registered down */
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_CHECKSUM);
+    cio_set_manifest(ctx, CIO_TRUE);
+    ret = cio_load(ctx, NULL);
+    TEST_CHECK(ret == 0);
+    cio_destroy(ctx);
+
+    snprintf(path, sizeof(path), "%s/stream-3/extra.flb", CIO_ENV);
+    fd = open(path, O_CREAT | O_WRONLY, 0600);
+    TEST_CHECK(fd != -1);
+    close(fd);
+
+    /* temporary file of an interrupted rewrite */
+    snprintf(path, sizeof(path), "%s/stream-3/.chunk-0.flb.tmp", CIO_ENV);
+    fd = open(path, O_CREAT | O_WRONLY, 0600);
+    TEST_CHECK(fd != -1);
+    close(fd);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_CHECKSUM);
+    cio_set_manifest(ctx, CIO_TRUE);
+    cio_set_scan_workers(ctx, 4);
+    ret = cio_load(ctx, ".flb");
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(mk_list_size(&ctx->streams) == 6);
+    TEST_CHECK(count_chunks(ctx, &up) == 121);
+    TEST_CHECK(up == 0);
+    TEST_CHECK(access(path, F_OK) == -1);
+
+    /* validation happens when the chunk is brought up */
+    mk_list_foreach(head, &ctx->streams) {
+        stream = mk_list_entry(head, struct cio_stream, _head);
+        chunk = mk_list_entry_first(&stream->chunks, struct cio_chunk, _head);
+        if (strcmp(chunk->name, "extra.flb") == 0) {
+            chunk = mk_list_entry_last(&stream->chunks, struct cio_chunk,
+                                       _head);
+        }
+        ret = cio_chunk_up(chunk);
+        TEST_CHECK(ret == CIO_OK);
+    }
+    count_chunks(ctx, &up);
+    TEST_CHECK(up == 6);
+    cio_destroy(ctx);
+
+    /* a damaged manifest is ignored */
+    snprintf(path, sizeof(path), "%s/%s", CIO_ENV, CIO_MANIFEST_FILE);
+    fd = open(path, O_WRONLY);
+    TEST_CHECK(fd != -1);
+    ret = pwrite(fd, "\xff", 1, 20);
+    TEST_CHECK(ret == 1);
+    close(fd);
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, CIO_CHECKSUM);
+    mf = cio_manifest_load(ctx);
+    TEST_CHECK(mf == NULL);
+    ret = cio_load(ctx, ".flb");
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(count_chunks(ctx, &up) == 121);
+    cio_destroy(ctx);
+
+    cio_utils_recursive_delete(CIO_ENV);
+}
+
 TEST_LIST = {
     {"fs_write",   test_fs_write},
     {"fs_checksum",  test_fs_checksum},
+    {"fs_checksum_crc32c", test_fs_checksum_crc32c},
     {"fs_up_down", test_fs_up_down},
     {"issue_51",   test_issue_51},
     {"issue_flb_2025", test_issue_flb_2025},
+    {"fs_group_commit", test_fs_group_commit},
+    {"fs_compress", test_fs_compress},
+    {"fs_scan", test_fs_scan},
     { 0 }
 };
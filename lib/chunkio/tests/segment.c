@@ -0,0 +1,415 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Chunk I/O
+ *  =========
+ *  Copyright 2018 Eduardo Silva <eduardo@monkey.io>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include <chunkio/chunkio.h>
+#include <chunkio/cio_log.h>
+#include <chunkio/cio_scan.h>
+#include <chunkio/cio_meta.h>
+#include <chunkio/cio_commit.h>
+#include <chunkio/cio_segment.h>
+#include <chunkio/cio_stream.h>
+#include <chunkio/cio_utils.h>
+
+#include "cio_tests_internal.h"
+
+#define CIO_ENV           "/tmp/cio-segment-test"
+#define CIO_SEG_SIZE      (64 * 1024)
+
+static int log_cb(struct cio_ctx *ctx, int level, const char *file, int line,
+                  char *str)
+{
+    (void) ctx;
+
+    printf("[cio-test-segment] %-60s => %s:%i\n",  str, file, line);
+    return 0;
+}
+
+/* Count the segment files of a stream */
+static int count_segments(const char *stream)
+{
+    int n = 0;
+    char path[1024];
+    DIR *dir;
+    struct dirent *ent;
+
+    snprintf(path, sizeof(path), "%s/%s", CIO_ENV, stream);
+    dir = opendir(path);
+    if (!dir) {
+        return -1;
+    }
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (strstr(ent->d_name, CIO_SEG_EXTENSION)) {
+            n++;
+        }
+    }
+    closedir(dir);
+
+    return n;
+}
+
+static struct cio_ctx *segment_ctx(int flags)
+{
+    struct cio_ctx *ctx;
+
+    ctx = cio_create(CIO_ENV, log_cb, CIO_LOG_INFO, flags | CIO_SEGMENTS);
+    TEST_CHECK(ctx != NULL);
+    if (!ctx) {
+        exit(EXIT_FAILURE);
+    }
+    cio_set_segment_size(ctx, CIO_SEG_SIZE);
+
+    return ctx;
+}
+
+/* Fill a buffer with a pattern that depends on the chunk number */
+static void fill(char *buf, size_t size, int n)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        buf[i] = 'a' + ((n + i) % 26);
+    }
+}
+
+/*
+ * Write many chunks spread across several segments, delete some of them
+ * and restore the rest from a new context.
+ */
+static void test_segment_write_restore()
+{
+    int i;
+    int ret;
+    int err;
+    int len;
+    int meta_len;
+    int n_chunks = 64;
+    char *meta;
+    char *buf;
+    size_t size;
+    char name[64];
+    char data[4096];
+    struct mk_list *head;
+    struct cio_ctx *ctx;
+    struct cio_stream *stream;
+    struct cio_chunk *chunk;
+    struct cio_chunk *carr[64];
+
+    cio_utils_recursive_delete(CIO_ENV);
+
+    ctx = segment_ctx(CIO_CHECKSUM);
+    stream = cio_stream_create(ctx, "test-segment", CIO_STORE_FS);
+    TEST_CHECK(stream != NULL);
+    TEST_CHECK(stream->type == CIO_STORE_SEG);
+
+    for (i = 0; i < n_chunks; i++) {
+        len = snprintf(name, sizeof(name), "chunk-%04i.flb", i);
+        carr[i] = cio_chunk_open(ctx, stream, name, CIO_OPEN, 1000, &err);
+        TEST_CHECK(carr[i] != NULL);
+        if (!carr[i]) {
+            exit(EXIT_FAILURE);
+        }
+
+        if (cio_chunk_is_up(carr[i]) == CIO_FALSE) {
+            cio_chunk_up_force(carr[i]);
+        }
+
+        ret = cio_meta_write(carr[i], name, len);
+        TEST_CHECK(ret == 0);
+
+        /* first version */
+        fill(data, sizeof(data), i);
+        ret = cio_chunk_write(carr[i], data, 1000);
+        TEST_CHECK(ret == 0);
+        ret = cio_chunk_sync(carr[i]);
+        TEST_CHECK(ret == 0);
+
+        /* second version supersedes the first one */
+        ret = cio_chunk_write(carr[i], data + 1000, sizeof(data) - 1000);
+        TEST_CHECK(ret == 0);
+        ret = cio_chunk_down(carr[i]);
+        TEST_CHECK(ret == 0);
+        TEST_CHECK(cio_chunk_is_up(carr[i]) == CIO_FALSE);
+        TEST_CHECK(cio_chunk_get_content_size(carr[i]) == sizeof(data));
+    }
+
+    /* content spans several segment files */
+    TEST_CHECK(count_segments("test-segment") > 1);
+
+    /* acknowledge even chunks */
+    for (i = 0; i < n_chunks; i += 2) {
+        cio_chunk_close(carr[i], CIO_TRUE);
+    }
+    cio_destroy(ctx);
+
+    /* restore */
+    ctx = segment_ctx(CIO_CHECKSUM);
+    ret = cio_load(ctx, NULL);
+    TEST_CHECK(ret == 0);
+
+    stream = mk_list_entry_first(&ctx->streams, struct cio_stream, _head);
+    TEST_CHECK(stream->type == CIO_STORE_SEG);
+    TEST_CHECK(mk_list_size(&stream->chunks) == n_chunks / 2);
+
+    mk_list_foreach(head, &stream->chunks) {
+        chunk = mk_list_entry(head, struct cio_chunk, _head);
+        TEST_CHECK(cio_chunk_is_up(chunk) == CIO_FALSE);
+
+        ret = sscanf(chunk->name, "chunk-%d.flb", &i);
+        TEST_CHECK(ret == 1);
+        TEST_CHECK(i % 2 == 1);
+
+        ret = cio_meta_read(chunk, &meta, &meta_len);
+        TEST_CHECK(ret == 0);
+        TEST_CHECK(meta_len == strlen(chunk->name));
+        TEST_CHECK(memcmp(meta, chunk->name, meta_len) == 0);
+
+        ret = cio_chunk_up(chunk);
+        TEST_CHECK(ret == CIO_OK);
+
+        ret = cio_chunk_get_content(chunk, &buf, &size);
+        TEST_CHECK(ret == CIO_OK);
+        TEST_CHECK(size == sizeof(data));
+        fill(data, sizeof(data), i);
+        TEST_CHECK(memcmp(buf, data, sizeof(data)) == 0);
+    }
+
+    /* acknowledge everything: all segments are reclaimed */
+    while (mk_list_size(&stream->chunks) > 0) {
+        chunk = mk_list_entry_first(&stream->chunks, struct cio_chunk, _head);
+        cio_chunk_close(chunk, CIO_TRUE);
+    }
+    TEST_CHECK(count_segments("test-segment") == 0);
+    cio_destroy(ctx);
+
+    cio_utils_recursive_delete(CIO_ENV);
+}
+
+/* A corrupted record must be reported when the chunk is brought up */
+static void test_segment_checksum()
+{
+    int fd;
+    int ret;
+    int err;
+    char path[1024];
+    char data[512];
+    struct cio_ctx *ctx;
+    struct cio_stream *stream;
+    struct cio_chunk *chunk;
+
+    cio_utils_recursive_delete(CIO_ENV);
+
+    ctx = segment_ctx(CIO_CHECKSUM);
+    stream = cio_stream_create(ctx, "test-crc32", CIO_STORE_FS);
+    chunk = cio_chunk_open(ctx, stream, "c", CIO_OPEN, 1000, &err);
+    TEST_CHECK(chunk != NULL);
+
+    fill(data, sizeof(data), 0);
+    cio_chunk_write(chunk, data, sizeof(data));
+    ret = cio_chunk_down(chunk);
+    TEST_CHECK(ret == 0);
+    cio_destroy(ctx);
+
+    /* flip one byte of the content */
+    snprintf(path, sizeof(path), "%s/test-crc32/00000000%s",
+             CIO_ENV, CIO_SEG_EXTENSION);
+    fd = open(path, O_RDWR);
+    TEST_CHECK(fd != -1);
+    if (fd == -1) {
+        exit(EXIT_FAILURE);
+    }
+    ret = pwrite(fd, "X", 1, CIO_SEG_HEADER_SIZE + CIO_SEG_REC_HEADER + 1);
+    TEST_CHECK(ret == 1);
+    close(fd);
+
+    ctx = segment_ctx(CIO_CHECKSUM);
+    cio_load(ctx, NULL);
+    stream = mk_list_entry_first(&ctx->streams, struct cio_stream, _head);
+    TEST_CHECK(mk_list_size(&stream->chunks) == 1);
+
+    chunk = mk_list_entry_first(&stream->chunks, struct cio_chunk, _head);
+    ret = cio_chunk_up(chunk);
+    TEST_CHECK(ret == CIO_CORRUPTED);
+    cio_destroy(ctx);
+
+    cio_utils_recursive_delete(CIO_ENV);
+}
+
+/* Chunks bigger than a segment get their own segment */
+static void test_segment_large_chunk()
+{
+    int ret;
+    int err;
+    char *buf;
+    size_t size;
+    size_t len = CIO_SEG_SIZE * 3;
+    char *data;
+    struct cio_ctx *ctx;
+    struct cio_stream *stream;
+    struct cio_chunk *chunk;
+
+    cio_utils_recursive_delete(CIO_ENV);
+
+    data = malloc(len);
+    TEST_CHECK(data != NULL);
+    fill(data, len, 7);
+
+    ctx = segment_ctx(0);
+    stream = cio_stream_create(ctx, "test-large", CIO_STORE_FS);
+    chunk = cio_chunk_open(ctx, stream, "big", CIO_OPEN, 1000, &err);
+    TEST_CHECK(chunk != NULL);
+
+    ret = cio_chunk_write(chunk, data, len);
+    TEST_CHECK(ret == 0);
+    ret = cio_chunk_down(chunk);
+    TEST_CHECK(ret == 0);
+    ret = cio_chunk_up(chunk);
+    TEST_CHECK(ret == 0);
+
+    ret = cio_chunk_get_content(chunk, &buf, &size);
+    TEST_CHECK(ret == CIO_OK);
+    TEST_CHECK(size == len);
+    TEST_CHECK(memcmp(buf, data, len) == 0);
+
+    cio_chunk_close(chunk, CIO_TRUE);
+    TEST_CHECK(count_segments("test-large") == 1);
+    cio_destroy(ctx);
+
+    /* the active segment is removed when empty */
+    TEST_CHECK(count_segments("test-large") == 0);
+
+    free(data);
+    cio_utils_recursive_delete(CIO_ENV);
+}
+
+/* State field of the record stored at 'offset' of a segment */
+static uint32_t record_state(const char *path, off_t offset)
+{
+    int fd;
+    uint32_t state = 0;
+
+    fd = open(path, O_RDONLY);
+    TEST_CHECK(fd != -1);
+    TEST_CHECK(pread(fd, &state, sizeof(state), offset) == sizeof(state));
+    close(fd);
+
+    return ntohl(state);
+}
+
+/*
+ * With group commit the record replaced by a new sync stays live until
+ * the commit makes the new one durable.
+ */
+static void test_segment_group_commit()
+{
+    int ret;
+    int err;
+    char *buf;
+    size_t size;
+    off_t offset;
+    char path[1024];
+    char data[1024];
+    struct cio_ctx *ctx;
+    struct cio_stream *stream;
+    struct cio_chunk *chunk;
+    struct cio_segment_chunk *sc;
+
+    cio_utils_recursive_delete(CIO_ENV);
+
+    ctx = segment_ctx(CIO_FULL_SYNC);
+    ret = cio_set_group_commit(ctx, 1000, 0);
+#ifndef CIO_HAVE_SYNCFS
+    TEST_CHECK(ret == -1);
+    cio_destroy(ctx);
+    cio_utils_recursive_delete(CIO_ENV);
+    return;
+#endif
+    TEST_CHECK(ret == 0);
+
+    stream = cio_stream_create(ctx, "test-commit", CIO_STORE_FS);
+    chunk = cio_chunk_open(ctx, stream, "c", CIO_OPEN, 1000, &err);
+    TEST_CHECK(chunk != NULL);
+    if (!chunk) {
+        exit(EXIT_FAILURE);
+    }
+
+    fill(data, sizeof(data), 1);
+    ret = cio_chunk_write(chunk, data, sizeof(data));
+    TEST_CHECK(ret == 0);
+    ret = cio_chunk_sync(chunk);
+    TEST_CHECK(ret == 0);
+
+    sc = chunk->backend;
+    snprintf(path, sizeof(path), "%s", sc->seg->path);
+    offset = sc->rec_offset;
+
+    ret = cio_chunk_write(chunk, data, sizeof(data));
+    TEST_CHECK(ret == 0);
+    ret = cio_chunk_sync(chunk);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(sc->rec_offset != offset);
+
+    /* not committed yet: both copies are live */
+    TEST_CHECK(record_state(path, offset) == CIO_SEG_REC_LIVE);
+    TEST_CHECK(record_state(path, sc->rec_offset) == CIO_SEG_REC_LIVE);
+
+    ret = cio_commit(ctx);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(record_state(path, offset) == CIO_SEG_REC_DEAD);
+    TEST_CHECK(record_state(path, sc->rec_offset) == CIO_SEG_REC_LIVE);
+
+    /* a pending replacement is committed when the stream goes away */
+    offset = sc->rec_offset;
+    ret = cio_chunk_write(chunk, data, sizeof(data));
+    TEST_CHECK(ret == 0);
+    ret = cio_chunk_sync(chunk);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(record_state(path, offset) == CIO_SEG_REC_LIVE);
+    cio_destroy(ctx);
+    TEST_CHECK(record_state(path, offset) == CIO_SEG_REC_DEAD);
+
+    ctx = segment_ctx(0);
+    ret = cio_load(ctx, NULL);
+    TEST_CHECK(ret == 0);
+
+    stream = mk_list_entry_first(&ctx->streams, struct cio_stream, _head);
+    TEST_CHECK(mk_list_size(&stream->chunks) == 1);
+    chunk = mk_list_entry_first(&stream->chunks, struct cio_chunk, _head);
+    ret = cio_chunk_up(chunk);
+    TEST_CHECK(ret == CIO_OK);
+    ret = cio_chunk_get_content(chunk, &buf, &size);
+    TEST_CHECK(ret == CIO_OK);
+    TEST_CHECK(size == sizeof(data) * 3);
+    cio_destroy(ctx);
+
+    cio_utils_recursive_delete(CIO_ENV);
+}
+
+TEST_LIST = {
+    {"segment_write_restore", test_segment_write_restore},
+    {"segment_checksum",      test_segment_checksum},
+    {"segment_large_chunk",   test_segment_large_chunk},
+    {"segment_group_commit",  test_segment_group_commit},
+    { 0 }
+};
@@ -31,6 +31,7 @@
 #include <fluent-bit/flb_pack.h>
 #include <fluent-bit/flb_regex.h>
 #include <fluent-bit/flb_record_accessor.h>
+#include <fluent-bit/record_accessor/flb_ra_parser.h>
 #include <msgpack.h>
 
 #include "grep.h"
@@ -60,6 +61,7 @@ static int set_rules(struct grep_ctx *ctx, struct flb_filter_instance *f_ins)
     struct flb_split_entry *sentry;
     struct flb_kv *kv;
     struct grep_rule *rule;
+    struct flb_ra_parser *rp;
 
     /* Iterate all filter properties */
     mk_list_foreach(head, &f_ins->properties) {
@@ -127,6 +129,13 @@ static int set_rules(struct grep_ctx *ctx, struct flb_filter_instance *f_ins)
             return -1;
         }
 
+        /* Map keys are matched over the batch columns */
+        rp = mk_list_entry_first(&rule->ra->list, struct flb_ra_parser, _head);
+        rule->key = NULL;
+        if (rp->type == FLB_RA_PARSER_KEYMAP) {
+            rule->key = rp->key;
+        }
+
         /* Convert string to regex pattern */
         rule->regex = flb_regex_create(rule->regex_pattern);
         if (!rule->regex) {
@@ -144,34 +153,83 @@ static int set_rules(struct grep_ctx *ctx, struct flb_filter_instance *f_ins)
     return 0;
 }
 
-/* Given a msgpack record, do some filter action based on the defined rules */
-static inline int grep_filter_data(msgpack_object map, struct grep_ctx *ctx)
+/*
+ * Match a rule against the value of its key in a record, rules that don't
+ * reference a map key never match.
+ */
+static inline int grep_rule_match(struct grep_rule *rule, msgpack_object *map,
+                                  msgpack_object *val)
+{
+    if (!val) {
+        return -1;
+    }
+
+    /* nested keys are resolved by the record accessor */
+    if (rule->key->subkeys &&
+        (val->type == MSGPACK_OBJECT_MAP || val->type == MSGPACK_OBJECT_ARRAY)) {
+        return flb_ra_regex_match(rule->ra, *map, rule->regex, NULL);
+    }
+
+    if (val->type != MSGPACK_OBJECT_STR) {
+        return -1;
+    }
+
+    return flb_regex_match(rule->regex, (unsigned char *) val->via.str.ptr,
+                           val->via.str.size);
+}
+
+/*
+ * Apply the rules one at a time over the whole batch. For every record the
+ * rules are evaluated in order until one of them decides: a Regex that does
+ * not match or an Exclude that matches drops the record, a matching Regex
+ * keeps it.
+ */
+static int grep_filter_batch(struct flb_filter_batch *batch,
+                             struct grep_ctx *ctx, char *kept)
 {
-    ssize_t ret;
+    int i;
+    int ret;
+    msgpack_object *map;
+    msgpack_object *val;
     struct mk_list *head;
     struct grep_rule *rule;
+    struct flb_batch_column *col;
 
-    /* For each rule, validate against map fields */
     mk_list_foreach(head, &ctx->rules) {
         rule = mk_list_entry(head, struct grep_rule, _head);
 
-        ret = flb_ra_regex_match(rule->ra, map, rule->regex, NULL);
-        if (ret <= 0) { /* no match */
-            if (rule->type == GREP_REGEX) {
-                return GREP_RET_EXCLUDE;
-            }
+        col = NULL;
+        if (rule->key &&
+            flb_filter_batch_column(batch, rule->key->name,
+                                    flb_sds_len(rule->key->name), &col) == -1) {
+            return -1;
         }
-        else {
-            if (rule->type == GREP_EXCLUDE) {
-                return GREP_RET_EXCLUDE;
+
+        for (i = 0; i < batch->count; i++) {
+            if (kept[i] ||
+                batch->records[i].flags & FLB_BATCH_RECORD_DROPPED) {
+                continue;
+            }
+
+            map = flb_filter_batch_map(batch, i);
+            val = flb_batch_column_value(col, i);
+            ret = grep_rule_match(rule, map, val);
+
+            if (ret <= 0) { /* no match */
+                if (rule->type == GREP_REGEX) {
+                    flb_filter_batch_drop(batch, i);
+                }
+            }
+            else if (rule->type == GREP_EXCLUDE) {
+                flb_filter_batch_drop(batch, i);
             }
             else {
-                return GREP_RET_KEEP;
+                kept[i] = FLB_TRUE;
             }
         }
     }
 
-    return GREP_RET_KEEP;
+    return 0;
 }
 
 static int cb_grep_init(struct flb_filter_instance *f_ins,
@@ -202,64 +260,39 @@ static int cb_grep_init(struct flb_filter_instance *f_ins,
     return 0;
 }
 
-static int cb_grep_filter(const void *data, size_t bytes,
+static int cb_grep_filter(struct flb_filter_batch *batch,
                           const char *tag, int tag_len,
-                          void **out_buf, size_t *out_size,
                           struct flb_filter_instance *f_ins,
                           void *context,
                           struct flb_config *config)
 {
     int ret;
-    int old_size = 0;
-    int new_size = 0;
-    msgpack_unpacked result;
-    msgpack_object map;
-    msgpack_object root;
-    size_t off = 0;
-    (void) f_ins;
+    int alive = batch->alive;
+    char *kept;
+    struct grep_ctx *ctx = context;
     (void) config;
-    msgpack_sbuffer tmp_sbuf;
-    msgpack_packer tmp_pck;
-
-    /* Create temporary msgpack buffer */
-    msgpack_sbuffer_init(&tmp_sbuf);
-    msgpack_packer_init(&tmp_pck, &tmp_sbuf, msgpack_sbuffer_write);
-
-    /* Iterate each item array and apply rules */
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off) == MSGPACK_UNPACK_SUCCESS) {
-        root = result.data;
-        if (root.type != MSGPACK_OBJECT_ARRAY) {
-            continue;
-        }
 
-        old_size++;
+    if (batch->count == 0) {
+        return FLB_FILTER_NOTOUCH;
+    }
 
-        /* get time and map */
-        map  = root.via.array.ptr[1];
+    kept = flb_calloc(batch->count, sizeof(char));
+    if (!kept) {
+        flb_errno();
+        return FLB_FILTER_NOTOUCH;
+    }
 
-        ret = grep_filter_data(map, context);
-        if (ret == GREP_RET_KEEP) {
-            msgpack_pack_object(&tmp_pck, root);
-            new_size++;
-        }
-        else if (ret == GREP_RET_EXCLUDE) {
-            /* Do nothing */
-        }
+    ret = grep_filter_batch(batch, ctx, kept);
+    flb_free(kept);
+    if (ret == -1) {
+        flb_plg_error(f_ins, "could not evaluate rules");
     }
-    msgpack_unpacked_destroy(&result);
 
     /* we keep everything ? */
-    if (old_size == new_size) {
-        /* Destroy the buffer to avoid more overhead */
-        msgpack_sbuffer_destroy(&tmp_sbuf);
+    if (batch->alive == alive) {
         return FLB_FILTER_NOTOUCH;
     }
 
-    /* link new buffers */
-    *out_buf   = tmp_sbuf.data;
-    *out_size = tmp_sbuf.size;
-
     return FLB_FILTER_MODIFIED;
 }
 
@@ -280,7 +313,7 @@ struct flb_filter_plugin filter_grep_plugin = {
     .name         = "grep",
     .description  = "grep events by specified field values",
     .cb_init      = cb_grep_init,
-    .cb_filter    = cb_grep_filter,
+    .cb_filter_batch = cb_grep_filter,
     .cb_exit      = cb_grep_exit,
     .flags        = 0
 };
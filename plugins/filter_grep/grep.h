@@ -45,6 +45,7 @@ struct grep_rule {
     char *regex_pattern;
     struct flb_regex *regex;
     struct flb_record_accessor *ra;
+    struct flb_ra_key *key;      /* top level key of the accessor */
     struct mk_list _head;
 };
 
@@ -110,6 +110,14 @@ static int configure(struct record_modifier_ctx *ctx,
             mod_record->val = flb_strndup(sentry->value, sentry->len);
             mod_record->val_len = sentry->len;
 
+            /* objects appended to every record, they reference the strings */
+            mod_record->key_obj.type = MSGPACK_OBJECT_STR;
+            mod_record->key_obj.via.str.ptr = mod_record->key;
+            mod_record->key_obj.via.str.size = mod_record->key_len;
+            mod_record->val_obj.type = MSGPACK_OBJECT_STR;
+            mod_record->val_obj.via.str.ptr = mod_record->val;
+            mod_record->val_obj.via.str.size = mod_record->val_len;
+
             flb_utils_split_free(split);
             mk_list_add(&mod_record->_head, &ctx->records);
             ctx->records_num++;
@@ -180,171 +188,108 @@ static int cb_modifier_init(struct flb_filter_instance *f_ins,
     return 0;
 }
 
-static int make_bool_map(struct record_modifier_ctx *ctx, msgpack_object *map,
-                             bool_map_t *bool_map, int map_num)
+/* Returns FLB_TRUE if the key matches any entry of the list */
+static int key_match(struct mk_list *list, msgpack_object *key)
 {
-    struct mk_list *tmp;
     struct mk_list *head;
-    struct mk_list *check = NULL;
-    msgpack_object_kv *kv;
     struct modifier_key *mod_key;
 
-    char result;
-    char is_to_delete;
-    msgpack_object *key;
-    int ret = map_num;
-    int i;
-
-    for (i=0; i<map_num; i++) {
-        bool_map[i] = TO_BE_REMAINED;
-    }
-    bool_map[map_num] = TAIL_OF_ARRAY;/* tail of map */
-
-    if (ctx->remove_keys_num > 0) {
-        check = &(ctx->remove_keys);
-        is_to_delete = FLB_TRUE;
-    }
-    else if(ctx->whitelist_keys_num > 0) {
-        check = &(ctx->whitelist_keys);
-        is_to_delete = FLB_FALSE;
-    }
-
-    if (check != NULL){
-        kv = map->via.map.ptr;
-        for(i=0; i<map_num; i++){
-            key = &(kv+i)->key;
-            result = FLB_FALSE;
-
-            mk_list_foreach_safe(head, tmp, check) {
-                mod_key = mk_list_entry(head, struct modifier_key,  _head);
-                if (key->via.bin.size != mod_key->key_len &&
-                    key->via.str.size != mod_key->key_len &&
-                    mod_key->dynamic_key == FLB_FALSE) {
-                    continue;
-                }
-                if (key->via.bin.size < mod_key->key_len &&
-                    key->via.str.size < mod_key->key_len &&
-                    mod_key->dynamic_key == FLB_TRUE) {
-                    continue;
-                }
-                if ((key->type == MSGPACK_OBJECT_BIN &&
-                     !strncasecmp(key->via.bin.ptr, mod_key->key,
-                                  mod_key->key_len)) ||
-                    (key->type == MSGPACK_OBJECT_STR &&
-                     !strncasecmp(key->via.str.ptr, mod_key->key,
-                                  mod_key->key_len))
-                    ) {
-                    result = FLB_TRUE;
-                    break;
-                }
-            }
-            if (result == is_to_delete) {
-                bool_map[i] = TO_BE_REMOVED;
-                ret--;
-            }
+    mk_list_foreach(head, list) {
+        mod_key = mk_list_entry(head, struct modifier_key,  _head);
+        if (key->via.bin.size != mod_key->key_len &&
+            key->via.str.size != mod_key->key_len &&
+            mod_key->dynamic_key == FLB_FALSE) {
+            continue;
+        }
+        if (key->via.bin.size < mod_key->key_len &&
+            key->via.str.size < mod_key->key_len &&
+            mod_key->dynamic_key == FLB_TRUE) {
+            continue;
+        }
+        if ((key->type == MSGPACK_OBJECT_BIN &&
+             !strncasecmp(key->via.bin.ptr, mod_key->key,
+                          mod_key->key_len)) ||
+            (key->type == MSGPACK_OBJECT_STR &&
+             !strncasecmp(key->via.str.ptr, mod_key->key,
+                          mod_key->key_len))
+            ) {
+            return FLB_TRUE;
         }
     }
 
-    return ret;
+    return FLB_FALSE;
 }
 
-static int cb_modifier_filter(const void *data, size_t bytes,
+static int cb_modifier_filter(struct flb_filter_batch *batch,
                               const char *tag, int tag_len,
-                              void **out_buf, size_t *out_size,
                               struct flb_filter_instance *f_ins,
                               void *context,
                               struct flb_config *config)
 {
     struct record_modifier_ctx *ctx = context;
-    char is_modified = FLB_FALSE;
-    size_t off = 0;
     int i;
-    int removed_map_num  = 0;
-    int map_num          = 0;
-    bool_map_t bool_map[128];
+    int j;
+    int size;
+    char is_to_delete = FLB_FALSE;
+    char is_modified = FLB_FALSE;
     (void) f_ins;
     (void) config;
-    struct flb_time tm;
     struct modifier_record *mod_rec;
-    msgpack_sbuffer tmp_sbuf;
-    msgpack_packer tmp_pck;
-    msgpack_unpacked result;
-    msgpack_object  *obj;
-    msgpack_object_kv *kv;
-    struct mk_list *tmp;
+    msgpack_object *map;
     struct mk_list *head;
+    struct mk_list *check = NULL;
 
-    /* Create temporary msgpack buffer */
-    msgpack_sbuffer_init(&tmp_sbuf);
-    msgpack_packer_init(&tmp_pck, &tmp_sbuf, msgpack_sbuffer_write);
-
-    /* Iterate each item to know map number */
-    msgpack_unpacked_init(&result);
-    while (msgpack_unpack_next(&result, data, bytes, &off) == MSGPACK_UNPACK_SUCCESS) {
-        map_num = 0;
-        removed_map_num = 0;
-        if (result.data.type != MSGPACK_OBJECT_ARRAY) {
-            continue;
-        }
-
-        flb_time_pop_from_msgpack(&tm, &result, &obj);
+    if (ctx->remove_keys_num > 0) {
+        check = &ctx->remove_keys;
+        is_to_delete = FLB_TRUE;
+    }
+    else if (ctx->whitelist_keys_num > 0) {
+        check = &ctx->whitelist_keys;
+        is_to_delete = FLB_FALSE;
+    }
 
-        /* grep keys */
-        if (obj->type == MSGPACK_OBJECT_MAP) {
-            map_num = obj->via.map.size;
-            removed_map_num = make_bool_map(ctx, obj,
-                                            bool_map, obj->via.map.size);
-        }
-        else {
+    for (i = 0; i < batch->count; i++) {
+        map = flb_filter_batch_map(batch, i);
+        if (!map) {
             continue;
         }
-
-        if (removed_map_num != map_num) {
-            is_modified = FLB_TRUE;
-        }
-
-        removed_map_num += ctx->records_num;
-        if (removed_map_num <= 0) {
-            continue;
+        size = map->via.map.size;
+
+        /* grep keys, backwards so removals don't shift pending entries */
+        if (check != NULL) {
+            for (j = map->via.map.size - 1; j >= 0; j--) {
+                map = flb_filter_batch_map(batch, i);
+                if (key_match(check, &map->via.map.ptr[j].key) !=
+                    is_to_delete) {
+                    continue;
+                }
+                if (flb_filter_batch_map_remove(batch, i, j) == 0) {
+                    is_modified = FLB_TRUE;
+                }
+            }
         }
 
-        msgpack_pack_array(&tmp_pck, 2);
-        flb_time_append_to_msgpack(&tm, &tmp_pck, 0);
-
-        msgpack_pack_map(&tmp_pck, removed_map_num);
-        kv = obj->via.map.ptr;
-        for(i=0; bool_map[i] != TAIL_OF_ARRAY; i++) {
-            if (bool_map[i] == TO_BE_REMAINED) {
-                msgpack_pack_object(&tmp_pck, (kv+i)->key);
-                msgpack_pack_object(&tmp_pck, (kv+i)->val);
+        /* append record */
+        mk_list_foreach(head, &ctx->records) {
+            mod_rec = mk_list_entry(head, struct modifier_record,  _head);
+            if (flb_filter_batch_map_append(batch, i, &mod_rec->key_obj,
+                                            &mod_rec->val_obj) == 0) {
+                is_modified = FLB_TRUE;
             }
         }
 
-        /* append record */
-        if (ctx->records_num > 0) {
+        /* records left without keys are not kept */
+        map = flb_filter_batch_map(batch, i);
+        if (size > 0 && map->via.map.size == 0) {
+            flb_filter_batch_drop(batch, i);
             is_modified = FLB_TRUE;
-            mk_list_foreach_safe(head, tmp, &ctx->records) {
-                mod_rec = mk_list_entry(head, struct modifier_record,  _head);
-                msgpack_pack_str(&tmp_pck, mod_rec->key_len);
-                msgpack_pack_str_body(&tmp_pck,
-                                      mod_rec->key, mod_rec->key_len);
-                msgpack_pack_str(&tmp_pck, mod_rec->val_len);
-                msgpack_pack_str_body(&tmp_pck,
-                                      mod_rec->val, mod_rec->val_len);
-            }
         }
     }
-    msgpack_unpacked_destroy(&result);
 
     if (is_modified != FLB_TRUE) {
-        /* Destroy the buffer to avoid more overhead */
-        msgpack_sbuffer_destroy(&tmp_sbuf);
         return FLB_FILTER_NOTOUCH;
     }
 
-    /* link new buffers */
-    *out_buf  = tmp_sbuf.data;
-    *out_size = tmp_sbuf.size;
     return FLB_FILTER_MODIFIED;
 }
 
@@ -360,10 +305,10 @@ static int cb_modifier_exit(void *data, struct flb_config *config)
 }
 
 struct flb_filter_plugin filter_record_modifier_plugin = {
-    .name         = "record_modifier",
-    .description  = "modify record",
-    .cb_init      = cb_modifier_init,
-    .cb_filter    = cb_modifier_filter,
-    .cb_exit      = cb_modifier_exit,
-    .flags        = 0
+    .name            = "record_modifier",
+    .description     = "modify record",
+    .cb_init         = cb_modifier_init,
+    .cb_filter_batch = cb_modifier_filter,
+    .cb_exit         = cb_modifier_exit,
+    .flags           = 0
 };
@@ -23,12 +23,15 @@
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_filter.h>
+#include <msgpack.h>
 
 struct modifier_record {
     char *key;
     char *val;
     int  key_len;
     int  val_len;
+    msgpack_object key_obj;
+    msgpack_object val_obj;
     struct mk_list _head;
 };
 
@@ -49,11 +52,5 @@ struct record_modifier_ctx {
     struct flb_filter_instance *ins;
 };
 
-typedef enum {
-    TO_BE_REMOVED = 0,
-    TO_BE_REMAINED = 1,
-    TAIL_OF_ARRAY = 2
-} bool_map_t;
-
 
 #endif /* FLB_FILTER_RECORD_MODIFIER_H */
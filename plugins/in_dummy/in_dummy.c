@@ -253,5 +253,6 @@ struct flb_input_plugin in_dummy_plugin = {
     .cb_pre_run   = NULL,
     .cb_collect   = in_dummy_collect,
     .cb_flush_buf = NULL,
-    .cb_exit      = in_dummy_exit
+    .cb_exit      = in_dummy_exit,
+    .flags        = FLB_INPUT_THREAD_SAFE
 };
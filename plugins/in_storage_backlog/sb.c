@@ -138,7 +138,7 @@ static int sb_append_chunk(struct cio_chunk *chunk, struct cio_stream *stream,
 
     /* lock the chunk */
     cio_chunk_lock(chunk);
-    flb_plg_info(ctx->ins, "register %s/%s", stream->name, chunk->name);
+    flb_plg_debug(ctx->ins, "register %s/%s", stream->name, chunk->name);
 
     return 0;
 }
@@ -146,6 +146,7 @@ static int sb_append_chunk(struct cio_chunk *chunk, struct cio_stream *stream,
 static int sb_prepare_environment(struct flb_sb *ctx)
 {
     int ret;
+    int count = 0;
     struct mk_list *head;
     struct mk_list *c_head;
     struct cio_stream *stream;
@@ -163,6 +164,7 @@ static int sb_prepare_environment(struct flb_sb *ctx)
                           stream->name, chunk->name);
                 continue;
             }
+            count++;
 
             if (cio_chunk_is_up(chunk) == CIO_TRUE) {
                 cio_chunk_down(chunk);
@@ -170,6 +172,10 @@ static int sb_prepare_environment(struct flb_sb *ctx)
         }
     }
 
+    if (count > 0) {
+        flb_plg_info(ctx->ins, "%i chunks registered", count);
+    }
+
     return 0;
 }
 
@@ -70,6 +70,13 @@ static int in_tail_collect_pending(struct flb_input_instance *ins,
     struct flb_tail_file *file;
     struct stat st;
 
+#ifdef FLB_HAVE_IO_URING
+    /* Read the next chunk of every file with pending bytes at once */
+    if (ctx->read_backend == FLB_TAIL_READ_URING) {
+        flb_tail_file_prefetch(ctx, &ctx->files_event);
+    }
+#endif
+
     /* Iterate promoted event files with pending bytes */
     mk_list_foreach_safe(head, tmp, &ctx->files_event) {
         file = mk_list_entry(head, struct flb_tail_file, _head);
@@ -133,6 +140,13 @@ static int in_tail_collect_static(struct flb_input_instance *ins,
     struct flb_tail_config *ctx = in_context;
     struct flb_tail_file *file;
 
+#ifdef FLB_HAVE_IO_URING
+    /* Read the next chunk of every static file at once */
+    if (ctx->read_backend == FLB_TAIL_READ_URING) {
+        flb_tail_file_prefetch(ctx, &ctx->files_static);
+    }
+#endif
+
     /* Do a data chunk collection for each file */
     mk_list_foreach_safe(head, tmp, &ctx->files_static) {
         file = mk_list_entry(head, struct flb_tail_file, _head);
@@ -356,6 +370,19 @@ static int in_tail_init(struct flb_input_instance *in,
     }
     ctx->coll_fd_pending = ret;
 
+#ifdef FLB_HAVE_SQLDB
+    /* Register callback to commit file offsets in batches */
+    if (ctx->db && ctx->db_checkpoint_interval > 0) {
+        ret = flb_input_set_collector_time(in, flb_tail_db_checkpoint_callback,
+                                           ctx->db_checkpoint_interval, 0,
+                                           config);
+        if (ret == -1) {
+            flb_tail_config_destroy(ctx);
+            return -1;
+        }
+        ctx->coll_fd_db_checkpoint = ret;
+    }
+#endif
 
     if (ctx->multiline == FLB_TRUE && ctx->parser) {
         ctx->parser = NULL;
@@ -409,6 +436,11 @@ static int in_tail_exit(void *data, struct flb_config *config)
     (void) *config;
     struct flb_tail_config *ctx = data;
 
+#ifdef FLB_HAVE_SQLDB
+    /* Commit pending offsets before the files are released */
+    flb_tail_db_checkpoint(ctx);
+#endif
+
     flb_tail_file_remove_all(ctx);
     flb_tail_config_destroy(ctx);
 
@@ -547,6 +579,14 @@ static struct flb_config_map config_map[] = {
      "restrict how much the memory buffer can grow. If reading a file exceed "
      "this limit, the file is removed from the monitored file list."
     },
+    {
+     FLB_CONFIG_MAP_STR, "read_backend", "read",
+     0, FLB_TRUE, offsetof(struct flb_tail_config, read_backend_str),
+     "set how file content is read. 'read' uses read(2), 'mmap' maps static "
+     "files (catch-up) in windows instead of copying them, and 'io_uring' "
+     "batches the reads of all active files in a single syscall. Note that "
+     "'mmap' is not safe with copytruncate rotation."
+    },
     {
      FLB_CONFIG_MAP_BOOL, "skip_long_lines", "false",
      0, FLB_TRUE, offsetof(struct flb_tail_config, skip_long_lines),
@@ -585,6 +625,19 @@ static struct flb_config_map config_map[] = {
      0, FLB_FALSE, 0,
      "set a database sync method. values: extra, full, normal and off."
     },
+    {
+     FLB_CONFIG_MAP_STR, "db.journal_mode", "off",
+     0, FLB_TRUE, offsetof(struct flb_tail_config, db_journal_mode),
+     "set the database journal mode. values: off, delete, truncate, persist, "
+     "memory and wal."
+    },
+    {
+     FLB_CONFIG_MAP_TIME, "db.checkpoint_interval", "0",
+     0, FLB_TRUE, offsetof(struct flb_tail_config, db_checkpoint_interval),
+     "if set, file offsets are kept in memory and committed to the database "
+     "in a single transaction on this interval and on shutdown, instead of "
+     "being written on every read."
+    },
 #endif
 
     /* Multiline Options */
@@ -633,5 +686,5 @@ struct flb_input_plugin in_tail_plugin = {
     .cb_resume    = in_tail_resume,
     .cb_exit      = in_tail_exit,
     .config_map   = config_map,
-    .flags        = 0
+    .flags        = FLB_INPUT_THREAD_SAFE
 };
@@ -34,10 +34,17 @@
 #define FLB_TAIL_STATIC  0  /* Data is being consumed through read(2) */
 #define FLB_TAIL_EVENT   1  /* Data is being consumed through inotify */
 
+/* Read backends */
+#define FLB_TAIL_READ_DEFAULT  0  /* read(2) into the file buffer          */
+#define FLB_TAIL_READ_MMAP     1  /* mmap(2) windows for static files      */
+#define FLB_TAIL_READ_URING    2  /* io_uring batched reads across files   */
+
 /* Config */
 #define FLB_TAIL_CHUNK        "32768"    /* buffer chunk = 32KB            */
 #define FLB_TAIL_REFRESH      60         /* refresh every 60 seconds       */
 #define FLB_TAIL_ROTATE_WAIT  "5"        /* time to monitor after rotation */
+#define FLB_TAIL_MMAP_WINDOW  (1 << 20)  /* mmap backend window = 1MB      */
+#define FLB_TAIL_URING_SIZE   256        /* io_uring queue entries         */
 
 int in_tail_collect_event(void *file, struct flb_config *config);
 
@@ -26,6 +26,7 @@
 
 #include "tail_fs.h"
 #include "tail_db.h"
+#include "tail_uring.h"
 #include "tail_config.h"
 #include "tail_scan.h"
 #include "tail_sql.h"
@@ -160,6 +161,35 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *ins,
         }
     }
 
+    /* Read backend */
+    if (strcasecmp(ctx->read_backend_str, "read") == 0) {
+        ctx->read_backend = FLB_TAIL_READ_DEFAULT;
+    }
+#ifndef FLB_SYSTEM_WINDOWS
+    else if (strcasecmp(ctx->read_backend_str, "mmap") == 0) {
+        ctx->read_backend = FLB_TAIL_READ_MMAP;
+        ctx->page_size = sysconf(_SC_PAGESIZE);
+    }
+#endif
+#ifdef FLB_HAVE_IO_URING
+    else if (strcasecmp(ctx->read_backend_str, "io_uring") == 0) {
+        ctx->uring = flb_tail_uring_create(FLB_TAIL_URING_SIZE);
+        if (ctx->uring) {
+            ctx->read_backend = FLB_TAIL_READ_URING;
+        }
+        else {
+            flb_plg_warn(ctx->ins, "io_uring is not available, using read(2)");
+            ctx->read_backend = FLB_TAIL_READ_DEFAULT;
+        }
+    }
+#endif
+    else {
+        flb_plg_error(ctx->ins, "read_backend '%s' is not supported",
+                      ctx->read_backend_str);
+        flb_tail_config_destroy(ctx);
+        return NULL;
+    }
+
     /* Validate buffer limit */
     if (ctx->buf_chunk_size > ctx->buf_max_size) {
         flb_plg_error(ctx->ins, "buffer_max_size must be >= buffer_chunk");
@@ -181,8 +211,17 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *ins,
     mk_list_init(&ctx->files_static);
     mk_list_init(&ctx->files_event);
     mk_list_init(&ctx->files_rotated);
+
+    ctx->files_hash = flb_hash_create(FLB_HASH_EVICT_NONE,
+                                      FLB_TAIL_FILES_HASH_SIZE, 0);
+    if (!ctx->files_hash) {
+        flb_plg_error(ctx->ins, "could not create files hash table");
+        flb_tail_config_destroy(ctx);
+        return NULL;
+    }
 #ifdef FLB_HAVE_SQLDB
     ctx->db = NULL;
+    mk_list_init(&ctx->files_db_dirty);
 #endif
 
 #ifdef FLB_HAVE_REGEX
@@ -228,6 +267,18 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *ins,
         }
     }
 
+    if (strcasecmp(ctx->db_journal_mode, "off") != 0 &&
+        strcasecmp(ctx->db_journal_mode, "delete") != 0 &&
+        strcasecmp(ctx->db_journal_mode, "truncate") != 0 &&
+        strcasecmp(ctx->db_journal_mode, "persist") != 0 &&
+        strcasecmp(ctx->db_journal_mode, "memory") != 0 &&
+        strcasecmp(ctx->db_journal_mode, "wal") != 0) {
+        flb_plg_error(ctx->ins, "invalid database 'db.journal_mode' value: %s",
+                      ctx->db_journal_mode);
+        flb_tail_config_destroy(ctx);
+        return NULL;
+    }
+
     /* Initialize database */
     tmp = flb_input_get_property("db", ins);
     if (tmp) {
@@ -309,6 +360,20 @@ struct flb_tail_config *flb_tail_config_create(struct flb_input_instance *ins,
                     "files_closed", ctx->ins->metrics);
     flb_metrics_add(FLB_TAIL_METRIC_F_ROTATED,
                     "files_rotated", ctx->ins->metrics);
+    flb_metrics_add(FLB_TAIL_METRIC_SCANS,
+                    "scans", ctx->ins->metrics);
+    flb_metrics_add(FLB_TAIL_METRIC_SCAN_TIME,
+                    "scan_time_us", ctx->ins->metrics);
+#ifdef FLB_HAVE_SQLDB
+    if (ctx->db && ctx->db_checkpoint_interval > 0) {
+        flb_metrics_add(FLB_TAIL_METRIC_DB_CKPT,
+                        "db_checkpoints", ctx->ins->metrics);
+        flb_metrics_add(FLB_TAIL_METRIC_DB_FILES,
+                        "db_checkpoint_files", ctx->ins->metrics);
+        flb_metrics_add(FLB_TAIL_METRIC_DB_TIME,
+                        "db_checkpoint_time_us", ctx->ins->metrics);
+    }
+#endif
 #endif
 
     return ctx;
@@ -344,6 +409,16 @@ int flb_tail_config_destroy(struct flb_tail_config *config)
     }
 #endif
 
+    if (config->files_hash) {
+        flb_hash_destroy(config->files_hash);
+    }
+
+#ifdef FLB_HAVE_IO_URING
+    if (config->uring) {
+        flb_tail_uring_destroy(config->uring);
+    }
+#endif
+
     flb_free(config);
     return 0;
 }
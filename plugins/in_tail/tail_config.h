@@ -26,6 +26,8 @@
 #include <fluent-bit/flb_parser.h>
 #include <fluent-bit/flb_macros.h>
 #include <fluent-bit/flb_sqldb.h>
+#include <fluent-bit/flb_hash.h>
+#include <fluent-bit/flb_sds.h>
 #ifdef FLB_HAVE_REGEX
 #include <fluent-bit/flb_regex.h>
 #endif
@@ -35,8 +37,16 @@
 #define FLB_TAIL_METRIC_F_OPENED  100  /* number of opened files  */
 #define FLB_TAIL_METRIC_F_CLOSED  101  /* number of closed files  */
 #define FLB_TAIL_METRIC_F_ROTATED 102  /* number of rotated files */
+#define FLB_TAIL_METRIC_SCANS     103  /* number of path scans    */
+#define FLB_TAIL_METRIC_SCAN_TIME 104  /* total scan time (us)    */
+#define FLB_TAIL_METRIC_DB_CKPT   105  /* db checkpoint commits   */
+#define FLB_TAIL_METRIC_DB_FILES  106  /* offsets committed       */
+#define FLB_TAIL_METRIC_DB_TIME   107  /* checkpoint time (us)    */
 #endif
 
+/* Buckets of the tracked files index (dev:inode) */
+#define FLB_TAIL_FILES_HASH_SIZE  1024
+
 struct flb_tail_config {
     int fd_notify;             /* inotify fd               */
     flb_pipefd_t ch_manager[2];    /* pipe: channel manager    */
@@ -47,6 +57,12 @@ struct flb_tail_config {
     /* Buffer Config */
     size_t buf_chunk_size;     /* allocation chunks        */
     size_t buf_max_size;       /* max size of a buffer     */
+    int read_backend;          /* FLB_TAIL_READ_*          */
+    flb_sds_t read_backend_str;
+    long page_size;
+#ifdef FLB_HAVE_IO_URING
+    struct flb_tail_uring *uring;
+#endif
 
     /* Collectors */
     int coll_fd_static;
@@ -56,6 +72,7 @@ struct flb_tail_config {
     int coll_fd_pending;
     int coll_fd_dmode_flush;
     int coll_fd_mult_flush;
+    int coll_fd_db_checkpoint;
 
     /* Backend collectors */
     int coll_fd_fs1;           /* used by fs_inotify & fs_stat */
@@ -83,6 +100,9 @@ struct flb_tail_config {
 #ifdef FLB_HAVE_SQLDB
     struct flb_sqldb *db;
     int db_sync;
+    int db_checkpoint_interval;     /* 0: write every offset update   */
+    flb_sds_t db_journal_mode;
+    struct mk_list files_db_dirty;  /* files with uncommitted offsets */
     sqlite3_stmt *stmt_get_file;
     sqlite3_stmt *stmt_insert_file;
     sqlite3_stmt *stmt_delete_file;
@@ -111,6 +131,9 @@ struct flb_tail_config {
     /* List of rotated files that needs to be removed after 'rotate_wait' */
     struct mk_list files_rotated;
 
+    /* Index of every tracked file (static and event) by dev:inode */
+    struct flb_hash *files_hash;
+
     /* List of shell patterns used to exclude certain file names */
     struct mk_list *exclude_list;
 
@@ -21,6 +21,7 @@
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_input_plugin.h>
 #include <fluent-bit/flb_sqldb.h>
+#include <fluent-bit/flb_time.h>
 
 #include "tail_db.h"
 #include "tail_sql.h"
@@ -67,7 +68,9 @@ struct flb_sqldb *flb_tail_db_open(const char *path,
         }
     }
 
-    ret = flb_sqldb_query(db, SQL_PRAGMA_JOURNAL_MODE, NULL, NULL);
+    snprintf(tmp, sizeof(tmp) - 1, SQL_PRAGMA_JOURNAL_MODE,
+             ctx->db_journal_mode);
+    ret = flb_sqldb_query(db, tmp, NULL, NULL);
     if (ret != FLB_OK) {
         flb_plg_error(ctx->ins, "db: could not set pragma 'journal_mode'");
         flb_sqldb_close(db);
@@ -184,9 +187,9 @@ int flb_tail_db_file_set(struct flb_tail_file *file,
     return 0;
 }
 
-/* Update Offset v2 */
-int flb_tail_db_file_offset(struct flb_tail_file *file,
-                            struct flb_tail_config *ctx)
+/* Write the current file offset to the database */
+static int db_file_offset_write(struct flb_tail_file *file,
+                                struct flb_tail_config *ctx)
 {
     int ret;
 
@@ -218,6 +221,136 @@ int flb_tail_db_file_offset(struct flb_tail_file *file,
     return 0;
 }
 
+/*
+ * Update Offset v2: without a checkpoint interval the offset is written
+ * right away, otherwise the file is queued and its latest offset will be
+ * committed by the next flb_tail_db_checkpoint().
+ */
+int flb_tail_db_file_offset(struct flb_tail_file *file,
+                            struct flb_tail_config *ctx)
+{
+    if (ctx->db_checkpoint_interval <= 0) {
+        return db_file_offset_write(file, ctx);
+    }
+
+    if (file->db_dirty == FLB_FALSE) {
+        file->db_dirty = FLB_TRUE;
+        mk_list_add(&file->_db_head, &ctx->files_db_dirty);
+    }
+
+    return 0;
+}
+
+static inline void db_file_dequeue(struct flb_tail_file *file)
+{
+    if (file->db_dirty == FLB_TRUE) {
+        mk_list_del(&file->_db_head);
+        file->db_dirty = FLB_FALSE;
+    }
+}
+
+/* Write a queued offset right away, used before a file stops being tracked */
+int flb_tail_db_file_sync(struct flb_tail_file *file,
+                          struct flb_tail_config *ctx)
+{
+    if (file->db_dirty == FLB_FALSE) {
+        return 0;
+    }
+
+    db_file_dequeue(file);
+    return db_file_offset_write(file, ctx);
+}
+
+/*
+ * Commit the offsets of every queued file in a single transaction, so the
+ * database pays one journal sync per interval instead of one per read.
+ */
+int flb_tail_db_checkpoint(struct flb_tail_config *ctx)
+{
+    int ret;
+    int count = 0;
+    int errors = 0;
+    double elapsed;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_tail_file *file;
+    struct flb_time t_start;
+    struct flb_time t_end;
+    struct flb_time t_diff;
+
+    if (!ctx->db || mk_list_is_empty(&ctx->files_db_dirty) == 0) {
+        return 0;
+    }
+
+    flb_time_get(&t_start);
+
+    ret = flb_sqldb_query(ctx->db, SQL_BEGIN_TRANSACTION, NULL, NULL);
+    if (ret != FLB_OK) {
+        flb_plg_error(ctx->ins, "db: could not begin checkpoint transaction");
+        return -1;
+    }
+
+    mk_list_foreach(head, &ctx->files_db_dirty) {
+        file = mk_list_entry(head, struct flb_tail_file, _db_head);
+
+        ret = db_file_offset_write(file, ctx);
+        if (ret == -1) {
+            errors++;
+        }
+        count++;
+    }
+
+    /*
+     * If the commit fails the transaction is rolled back so the next
+     * checkpoint can begin a new one, files stay queued until then.
+     */
+    ret = flb_sqldb_query(ctx->db, SQL_COMMIT_TRANSACTION, NULL, NULL);
+    if (ret != FLB_OK) {
+        flb_plg_error(ctx->ins, "db: could not commit checkpoint of %i files",
+                      count);
+        flb_sqldb_query(ctx->db, SQL_ROLLBACK_TRANSACTION, NULL, NULL);
+        return -1;
+    }
+
+    mk_list_foreach_safe(head, tmp, &ctx->files_db_dirty) {
+        file = mk_list_entry(head, struct flb_tail_file, _db_head);
+        db_file_dequeue(file);
+    }
+
+    flb_time_get(&t_end);
+    flb_time_diff(&t_end, &t_start, &t_diff);
+    elapsed = flb_time_to_double(&t_diff) * 1000.0;
+
+    if (errors > 0) {
+        flb_plg_warn(ctx->ins, "db: checkpoint could not update %i offsets",
+                     errors);
+    }
+    flb_plg_debug(ctx->ins, "db: checkpoint of %i files took %.3f ms",
+                  count, elapsed);
+
+#ifdef FLB_HAVE_METRICS
+    flb_metrics_sum(FLB_TAIL_METRIC_DB_CKPT, 1, ctx->ins->metrics);
+    flb_metrics_sum(FLB_TAIL_METRIC_DB_FILES, count, ctx->ins->metrics);
+    flb_metrics_sum(FLB_TAIL_METRIC_DB_TIME,
+                    t_diff.tm.tv_sec * 1000000 + t_diff.tm.tv_nsec / 1000,
+                    ctx->ins->metrics);
+#endif
+
+    return count;
+}
+
+/* Collector callback registered when 'db.checkpoint_interval' is set */
+int flb_tail_db_checkpoint_callback(struct flb_input_instance *ins,
+                                    struct flb_config *config, void *context)
+{
+    struct flb_tail_config *ctx = context;
+    (void) ins;
+    (void) config;
+
+    flb_tail_db_checkpoint(ctx);
+    return 0;
+}
+
 /* Mark a file as rotated v2 */
 int flb_tail_db_file_rotate(const char *new_name,
                             struct flb_tail_file *file,
@@ -247,6 +380,9 @@ int flb_tail_db_file_delete(struct flb_tail_file *file,
 {
     int ret;
 
+    /* A deleted entry must not be restored by a pending checkpoint */
+    db_file_dequeue(file);
+
     /* Bind parameters */
     sqlite3_bind_int64(ctx->stmt_delete_file, 1, file->db_id);
     ret = sqlite3_step(ctx->stmt_delete_file);
@@ -41,4 +41,9 @@ int flb_tail_db_file_rotate(const char *new_name,
                             struct flb_tail_config *ctx);
 int flb_tail_db_file_delete(struct flb_tail_file *file,
                             struct flb_tail_config *ctx);
+int flb_tail_db_file_sync(struct flb_tail_file *file,
+                          struct flb_tail_config *ctx);
+int flb_tail_db_checkpoint(struct flb_tail_config *ctx);
+int flb_tail_db_checkpoint_callback(struct flb_input_instance *ins,
+                                    struct flb_config *config, void *context);
 #endif
@@ -20,6 +20,9 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifndef FLB_SYSTEM_WINDOWS
+#include <sys/mman.h>
+#endif
 #include <fcntl.h>
 #include <time.h>
 
@@ -27,6 +30,7 @@
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_input_plugin.h>
 #include <fluent-bit/flb_parser.h>
+#include <fluent-bit/flb_lines.h>
 #ifdef FLB_HAVE_REGEX
 #include <fluent-bit/flb_regex.h>
 #include <fluent-bit/flb_hash.h>
@@ -40,15 +44,14 @@
 #include "tail_dockermode.h"
 #include "tail_multiline.h"
 #include "tail_scan.h"
+#include "tail_uring.h"
 
 #ifdef FLB_SYSTEM_WINDOWS
 #include "win32.h"
 #endif
 
-static inline void consume_bytes(char *buf, int bytes, int length)
-{
-    memmove(buf, buf + bytes, length - bytes);
-}
+/* Number of line offsets obtained on each buffer scan */
+#define TAIL_LINES_BATCH  256
 
 static int unpack_and_pack(msgpack_packer *pck, msgpack_object *root,
                            const char *key, size_t key_len,
@@ -142,38 +145,65 @@ int flb_tail_pack_line_map(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
     return 0;
 }
 
-int flb_tail_file_pack_line(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
-                            struct flb_time *time, char *data, size_t data_size,
-                            struct flb_tail_file *file)
+/*
+ * Pack the map header and the keys that are the same for every record of
+ * the file: optional path_key and its value, plus the key name of the line.
+ */
+static int pack_prefix_create(struct flb_tail_file *file)
 {
     int map_num = 1;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
     struct flb_tail_config *ctx = file->config;
 
-    if (file->config->path_key != NULL) {
+    if (ctx->path_key != NULL) {
         map_num++; /* to append path_key */
     }
-    msgpack_pack_array(mp_pck, 2);
-    flb_time_append_to_msgpack(time, mp_pck, 0);
-    msgpack_pack_map(mp_pck, map_num);
 
-    if (file->config->path_key != NULL) {
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_map(&mp_pck, map_num);
+
+    if (ctx->path_key != NULL) {
         /* append path_key */
-        msgpack_pack_str(mp_pck, flb_sds_len(file->config->path_key));
-        msgpack_pack_str_body(mp_pck, file->config->path_key,
-                              flb_sds_len(file->config->path_key));
-        msgpack_pack_str(mp_pck, file->name_len);
-        msgpack_pack_str_body(mp_pck, file->name, file->name_len);
+        msgpack_pack_str(&mp_pck, flb_sds_len(ctx->path_key));
+        msgpack_pack_str_body(&mp_pck, ctx->path_key,
+                              flb_sds_len(ctx->path_key));
+        msgpack_pack_str(&mp_pck, file->name_len);
+        msgpack_pack_str_body(&mp_pck, file->name, file->name_len);
+    }
+
+    msgpack_pack_str(&mp_pck, flb_sds_len(ctx->key));
+    msgpack_pack_str_body(&mp_pck, ctx->key, flb_sds_len(ctx->key));
+
+    if (file->pack_prefix) {
+        flb_sds_destroy(file->pack_prefix);
+    }
+    file->pack_prefix = flb_sds_create_len(mp_sbuf.data, mp_sbuf.size);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    if (!file->pack_prefix) {
+        return -1;
     }
+    return 0;
+}
 
-    msgpack_pack_str(mp_pck, flb_sds_len(ctx->key));
-    msgpack_pack_str_body(mp_pck, ctx->key, flb_sds_len(ctx->key));
+int flb_tail_file_pack_line(msgpack_sbuffer *mp_sbuf, msgpack_packer *mp_pck,
+                            struct flb_time *time, char *data, size_t data_size,
+                            struct flb_tail_file *file)
+{
+    msgpack_pack_array(mp_pck, 2);
+    flb_time_append_to_msgpack(time, mp_pck, 0);
+    msgpack_sbuffer_write(mp_sbuf, file->pack_prefix,
+                          flb_sds_len(file->pack_prefix));
     msgpack_pack_str(mp_pck, data_size);
     msgpack_pack_str_body(mp_pck, data, data_size);
 
     return 0;
 }
 
-static int process_content(struct flb_tail_file *file, size_t *bytes)
+static int process_content(struct flb_tail_file *file, char *buf, size_t size,
+                           size_t *bytes)
 {
     size_t len;
     int lines = 0;
@@ -185,6 +215,10 @@ static int process_content(struct flb_tail_file *file, size_t *bytes)
     void *out_buf;
     size_t out_size;
     int crlf;
+    int n_lines = 0;
+    int i_line = 0;
+    size_t nl[TAIL_LINES_BATCH];
+    char *scan = NULL;
     char *line;
     size_t line_len;
     char *repl_line;
@@ -204,9 +238,20 @@ static int process_content(struct flb_tail_file *file, size_t *bytes)
     out_pck  = &mp_pck;
 
     /* Parse the data content */
-    data = file->buf_data;
-    end = data + file->buf_len;
-    while ((p = memchr(data, '\n', end - data))) {
+    data = buf;
+    end = buf + size;
+    while (1) {
+        /* Get the next batch of line breaks */
+        if (i_line == n_lines) {
+            n_lines = flb_lines_scan(data, end - data, nl, TAIL_LINES_BATCH);
+            if (n_lines == 0) {
+                break;
+            }
+            scan = data;
+            i_line = 0;
+        }
+
+        p = scan + nl[i_line++];
         len = (p - data);
 
         if (file->skip_next == FLB_TRUE) {
@@ -332,7 +377,7 @@ static int process_content(struct flb_tail_file *file, size_t *bytes)
         file->parsed = 0;
         lines++;
     }
-    file->parsed = file->buf_len;
+    file->parsed = size;
     *bytes = processed_bytes;
 
     /* Append buffer content to a chunk */
@@ -514,29 +559,64 @@ static int tag_compose(char *tag, char *fname, char *out_buf, size_t *out_size,
     return 0;
 }
 
-static inline int flb_tail_file_exists(struct stat *st,
-                                       struct flb_tail_config *ctx)
+/* Compose the key used by the tracked files index: 'dev:inode' */
+static inline int file_hash_key(char *buf, size_t size,
+                                uint64_t dev, uint64_t inode)
 {
-    struct mk_list *head;
-    struct flb_tail_file *file;
+    return snprintf(buf, size, "%"PRIu64":%"PRIu64, dev, inode);
+}
 
-    /* Iterate static list */
-    mk_list_foreach(head, &ctx->files_static) {
-        file = mk_list_entry(head, struct flb_tail_file, _head);
-        if (file->inode == st->st_ino) {
-            return FLB_TRUE;
-        }
+static int file_hash_add(struct flb_tail_file *file)
+{
+    int len;
+    int ret;
+    char key[64];
+
+    len = file_hash_key(key, sizeof(key), file->dev, file->inode);
+    ret = flb_hash_add(file->config->files_hash, key, len,
+                       (char *) &file, sizeof(file));
+    if (ret == -1) {
+        return -1;
     }
 
-    /* Iterate dynamic list */
-    mk_list_foreach(head, &ctx->files_event) {
-        file = mk_list_entry(head, struct flb_tail_file, _head);
-        if (file->inode == st->st_ino) {
-            return FLB_TRUE;
-        }
+    return 0;
+}
+
+static void file_hash_del(struct flb_tail_file *file)
+{
+    int len;
+    int ret;
+    size_t size;
+    char key[64];
+    const char *val;
+
+    len = file_hash_key(key, sizeof(key), file->dev, file->inode);
+
+    /* Only drop the key if it still references this file */
+    ret = flb_hash_get(file->config->files_hash, key, len, &val, &size);
+    if (ret == -1 || *(struct flb_tail_file **) val != file) {
+        return;
     }
+    flb_hash_del(file->config->files_hash, key);
+}
 
-    return FLB_FALSE;
+/* Check if the file behind 'st' is already tracked, static or event */
+static inline int flb_tail_file_exists(struct stat *st,
+                                       struct flb_tail_config *ctx)
+{
+    int len;
+    int ret;
+    size_t size;
+    char key[64];
+    const char *val;
+
+    len = file_hash_key(key, sizeof(key), st->st_dev, st->st_ino);
+    ret = flb_hash_get(ctx->files_hash, key, len, &val, &size);
+    if (ret == -1) {
+        return FLB_FALSE;
+    }
+
+    return FLB_TRUE;
 }
 
 /*
@@ -628,6 +708,7 @@ int flb_tail_file_append(char *path, struct stat *st, int mode,
     /* Initialize */
     file->watch_fd  = -1;
     file->fd        = fd;
+    file->config    = ctx;
 
     /* On non-windows environments check if the original path is a link */
     ret = lstat(path, &lst);
@@ -650,17 +731,18 @@ int flb_tail_file_append(char *path, struct stat *st, int mode,
      * with some extra calls.
      */
     ret = flb_tail_file_name_dup(path, file);
-    if (!file->name) {
+    if (ret == -1 || !file->name) {
         flb_errno();
         goto error;
     }
 
+    file->dev       = st->st_dev;
     file->inode     = st->st_ino;
     file->offset    = 0;
     file->size      = st->st_size;
+    file->buf_start = 0;
     file->buf_len   = 0;
     file->parsed    = 0;
-    file->config    = ctx;
     file->tail_mode = mode;
     file->tag_len   = 0;
     file->tag_buf   = NULL;
@@ -739,6 +821,17 @@ int flb_tail_file_append(char *path, struct stat *st, int mode,
         }
     }
 
+    /* Index the file so scans can tell it is already tracked */
+    ret = file_hash_add(file);
+    if (ret == -1) {
+        flb_plg_error(ctx->ins, "could not index file %s", path);
+        mk_list_del(&file->_head);
+        if (mode == FLB_TAIL_EVENT) {
+            flb_tail_fs_remove(file);
+        }
+        goto error;
+    }
+
     /* Set the file position (database offset, head or tail) */
     ret = set_file_position(ctx, file);
     if (ret == -1) {
@@ -766,6 +859,7 @@ error:
         if (file->name) {
             flb_free(file->name);
         }
+        flb_sds_destroy(file->pack_prefix);
         flb_free(file);
     }
     close(fd);
@@ -795,9 +889,17 @@ void flb_tail_file_remove(struct flb_tail_file *file)
         mk_list_del(&file->_rotate_head);
     }
 
+#ifdef FLB_HAVE_SQLDB
+    /* Persist an offset still waiting for the next checkpoint */
+    if (ctx->db) {
+        flb_tail_db_file_sync(file, ctx);
+    }
+#endif
+
     flb_sds_destroy(file->dmode_buf);
     flb_sds_destroy(file->dmode_lastline);
     mk_list_del(&file->_head);
+    file_hash_del(file);
     flb_tail_fs_remove(file);
     /* avoid deleting file with -1 fd */
     if (file->fd != -1) {
@@ -810,6 +912,7 @@ void flb_tail_file_remove(struct flb_tail_file *file)
     flb_free(file->buf_data);
     flb_free(file->name);
     flb_free(file->real_name);
+    flb_sds_destroy(file->pack_prefix);
 
 #ifdef FLB_HAVE_METRICS
     flb_metrics_sum(FLB_TAIL_METRIC_F_CLOSED, 1, ctx->ins->metrics);
@@ -880,25 +983,31 @@ static int adjust_counters(struct flb_tail_config *ctx, struct flb_tail_file *fi
     return FLB_TAIL_OK;
 }
 
-int flb_tail_file_chunk(struct flb_tail_file *file)
+/*
+ * Make room in the file buffer for the next read. Consumed bytes are
+ * dropped lazily: pending ones are moved only if there is no room left,
+ * and the buffer grows up to 'buffer_max_size'. On success 'capacity' is
+ * the number of bytes that can be read at buf_start + buf_len.
+ */
+static int file_buffer_prepare(struct flb_tail_file *file, size_t *capacity)
 {
-    int ret;
     char *tmp;
     size_t size;
-    size_t capacity;
-    size_t processed_bytes;
-    ssize_t bytes;
-    struct stat st;
-    struct flb_tail_config *ctx;
+    size_t avail;
+    struct flb_tail_config *ctx = file->config;
 
-    /* Check if we the engine issued a pause */
-    ctx = file->config;
-    if (flb_input_buf_paused(ctx->ins) == FLB_TRUE) {
-        return FLB_TAIL_BUSY;
+    if (file->buf_len == 0) {
+        file->buf_start = 0;
+    }
+    avail = (file->buf_size - file->buf_start - file->buf_len) - 1;
+    if (avail < 1 && file->buf_start > 0) {
+        memmove(file->buf_data, file->buf_data + file->buf_start,
+                file->buf_len);
+        file->buf_start = 0;
+        avail = (file->buf_size - file->buf_len) - 1;
     }
 
-    capacity = (file->buf_size - file->buf_len) - 1;
-    if (capacity < 1) {
+    if (avail < 1) {
         /*
          * If there is no more room for more data, try to increase the
          * buffer under the limit of buffer_max_size.
@@ -907,7 +1016,7 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
             if (ctx->skip_long_lines == FLB_FALSE) {
                 flb_plg_error(ctx->ins, "file=%s requires a larger buffer size, "
                           "lines are too long. Skipping file.", file->name);
-                return FLB_TAIL_ERROR;
+                return -1;
             }
 
             /* Warn the user */
@@ -940,17 +1049,242 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
                 flb_errno();
                 flb_plg_error(ctx->ins, "cannot increase buffer size for %s, "
                           "skipping file.", file->name);
-                return FLB_TAIL_ERROR;
+                return -1;
             }
         }
-        capacity = (file->buf_size - file->buf_len) - 1;
+        avail = (file->buf_size - file->buf_len) - 1;
+    }
+
+    *capacity = avail;
+    return 0;
+}
+
+#ifndef FLB_SYSTEM_WINDOWS
+/*
+ * 'mmap' read backend for static files: map the next window of the file
+ * and cut lines straight from the mapping, skipping the copy into the file
+ * buffer and one read(2) per buffer_chunk_size bytes. Returns
+ * TAIL_MMAP_FALLBACK when the regular read path must handle the file, e.g:
+ * a line does not fit in the window.
+ */
+#define TAIL_MMAP_FALLBACK  -2
+
+static int file_chunk_mmap(struct flb_tail_file *file)
+{
+    int ret;
+    char *map;
+    size_t map_len;
+    size_t window;
+    size_t processed_bytes;
+    off_t map_offset;
+    off_t delta;
+    off_t pos;
+    struct stat st;
+    struct flb_tail_config *ctx = file->config;
+
+    ret = fstat(file->fd, &st);
+    if (ret == -1) {
+        flb_errno();
+        return FLB_TAIL_ERROR;
+    }
+
+    if (file->offset >= st.st_size) {
+        return TAIL_MMAP_FALLBACK;
+    }
+
+    window = st.st_size - file->offset;
+    if (window > FLB_TAIL_MMAP_WINDOW) {
+        window = FLB_TAIL_MMAP_WINDOW;
+    }
+
+    /* mmap(2) offsets must be page aligned */
+    map_offset = file->offset & ~((off_t) ctx->page_size - 1);
+    delta = file->offset - map_offset;
+    map_len = window + delta;
+
+    map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, file->fd, map_offset);
+    if (map == MAP_FAILED) {
+        flb_errno();
+        return TAIL_MMAP_FALLBACK;
+    }
+    madvise(map, map_len, MADV_SEQUENTIAL);
+
+    ret = process_content(file, map + delta, window, &processed_bytes);
+    munmap(map, map_len);
+    if (ret < 0) {
+        flb_plg_debug(ctx->ins, "inode=%"PRIu64" file=%s process content ERROR",
+                      file->inode, file->name);
+        return FLB_TAIL_ERROR;
+    }
+
+    /* A line longer than the window: let the read path deal with it */
+    if (processed_bytes == 0 && file->offset + window < st.st_size) {
+        return TAIL_MMAP_FALLBACK;
+    }
+
+    file->offset += processed_bytes;
+
+    /* Keep the descriptor position in sync for the read(2) path */
+    pos = lseek(file->fd, file->offset, SEEK_SET);
+    if (pos == -1) {
+        flb_errno();
+        return FLB_TAIL_ERROR;
+    }
+
+#ifdef FLB_HAVE_SQLDB
+    if (ctx->db) {
+        flb_tail_db_file_offset(file, ctx);
+    }
+#endif
+
+    /* Only a partial line remains: wait for more data */
+    if (processed_bytes == 0) {
+        ret = adjust_counters(ctx, file);
+        if (ret == FLB_TAIL_OK) {
+            return FLB_TAIL_WAIT;
+        }
+        return FLB_TAIL_ERROR;
+    }
+
+    return adjust_counters(ctx, file);
+}
+#endif
+
+#ifdef FLB_HAVE_IO_URING
+static void file_prefetch_done(void *data, int res)
+{
+    struct flb_tail_file *file = data;
+
+    file->io_bytes = res;
+    file->io_ready = FLB_TRUE;
+}
+
+/*
+ * The ring failed: the reads already completed are still consumed by
+ * flb_tail_file_chunk(), the following ones use read(2).
+ */
+static int prefetch_disable(struct flb_tail_config *ctx)
+{
+    flb_plg_error(ctx->ins, "io_uring read failed, using read(2)");
+    flb_tail_uring_destroy(ctx->uring);
+    ctx->uring = NULL;
+    ctx->read_backend = FLB_TAIL_READ_DEFAULT;
+
+    return -1;
+}
+
+/*
+ * 'io_uring' read backend: queue the next read of every file in 'list'
+ * and wait for all of them with one syscall per ring of requests. The
+ * results are consumed by the following flb_tail_file_chunk() call of
+ * each file instead of issuing its own read(2).
+ */
+int flb_tail_file_prefetch(struct flb_tail_config *ctx, struct mk_list *list)
+{
+    int ret;
+    int count = 0;
+    size_t capacity;
+    struct mk_list *head;
+    struct flb_tail_file *file;
+
+    if (!ctx->uring || flb_input_buf_paused(ctx->ins) == FLB_TRUE) {
+        return 0;
+    }
+
+    mk_list_foreach(head, list) {
+        file = mk_list_entry(head, struct flb_tail_file, _head);
+        if (file->io_ready == FLB_TRUE) {
+            continue;
+        }
+        if (file->tail_mode == FLB_TAIL_EVENT && file->pending_bytes <= 0) {
+            continue;
+        }
+
+        ret = file_buffer_prepare(file, &capacity);
+        if (ret == -1) {
+            /* flb_tail_file_chunk() will report it */
+            continue;
+        }
+
+        ret = flb_tail_uring_read(ctx->uring, file->fd,
+                                  file->buf_data + file->buf_start +
+                                  file->buf_len, capacity, file);
+        if (ret == -1) {
+            /* Ring is full, reap this batch and queue again */
+            if (flb_tail_uring_wait(ctx->uring, file_prefetch_done) == -1) {
+                return prefetch_disable(ctx);
+            }
+            ret = flb_tail_uring_read(ctx->uring, file->fd,
+                                      file->buf_data + file->buf_start +
+                                      file->buf_len, capacity, file);
+            if (ret == -1) {
+                continue;
+            }
+        }
+        count++;
+    }
+
+    if (flb_tail_uring_wait(ctx->uring, file_prefetch_done) == -1) {
+        return prefetch_disable(ctx);
+    }
+
+    return count;
+}
+#endif
+
+int flb_tail_file_chunk(struct flb_tail_file *file)
+{
+    int ret;
+    size_t capacity;
+    size_t processed_bytes;
+    ssize_t bytes;
+    struct stat st;
+    struct flb_tail_config *ctx;
+
+    ctx = file->config;
+
+    if (file->io_ready == FLB_TRUE) {
+        /*
+         * Data was already read by flb_tail_file_prefetch(), it must be
+         * consumed even if the engine issued a pause in the meantime.
+         */
+        file->io_ready = FLB_FALSE;
+        bytes = file->io_bytes;
+        if (bytes < 0) {
+            errno = -bytes;
+            bytes = -1;
+        }
+    }
+    else {
+        /* Check if we the engine issued a pause */
+        if (flb_input_buf_paused(ctx->ins) == FLB_TRUE) {
+            return FLB_TAIL_BUSY;
+        }
+
+#ifndef FLB_SYSTEM_WINDOWS
+        if (ctx->read_backend == FLB_TAIL_READ_MMAP &&
+            file->tail_mode == FLB_TAIL_STATIC && file->buf_len == 0) {
+            ret = file_chunk_mmap(file);
+            if (ret != TAIL_MMAP_FALLBACK) {
+                return ret;
+            }
+        }
+#endif
+
+        ret = file_buffer_prepare(file, &capacity);
+        if (ret == -1) {
+            return FLB_TAIL_ERROR;
+        }
+
+        bytes = read(file->fd,
+                     file->buf_data + file->buf_start + file->buf_len,
+                     capacity);
     }
 
-    bytes = read(file->fd, file->buf_data + file->buf_len, capacity);
     if (bytes > 0) {
         /* we read some data, let the content processor take care of it */
         file->buf_len += bytes;
-        file->buf_data[file->buf_len] = '\0';
+        file->buf_data[file->buf_start + file->buf_len] = '\0';
 
         /* Now that we have some data in the buffer, call the data processor
          * which aims to cut lines and register the entries into the engine.
@@ -959,7 +1293,8 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
          * now. It may need to get back a few bytes at the beginning of a new
          * line.
          */
-        ret = process_content(file, &processed_bytes);
+        ret = process_content(file, file->buf_data + file->buf_start,
+                              file->buf_len, &processed_bytes);
         if (ret < 0) {
             flb_plg_debug(ctx->ins, "inode=%"PRIu64" file=%s process content ERROR",
                           file->inode, file->name);
@@ -969,9 +1304,8 @@ int flb_tail_file_chunk(struct flb_tail_file *file)
 
         /* Adjust the file offset and buffer */
         file->offset += processed_bytes;
-        consume_bytes(file->buf_data, processed_bytes, file->buf_len);
+        file->buf_start += processed_bytes;
         file->buf_len -= processed_bytes;
-        file->buf_data[file->buf_len] = '\0';
 
 #ifdef FLB_HAVE_SQLDB
         if (file->config->db) {
@@ -1226,7 +1560,8 @@ int flb_tail_file_name_dup(char *path, struct flb_tail_file *file)
         return -1;
     }
 
-    return 0;
+    /* The record prefix contains the file name (path_key) */
+    return pack_prefix_create(file);
 }
 
 /* Invoked every time a file was rotated */
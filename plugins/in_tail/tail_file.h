@@ -97,6 +97,9 @@ static inline int flb_tail_target_file_name_cmp(char *name,
 int flb_tail_file_name_dup(char *path, struct flb_tail_file *file);
 int flb_tail_file_to_event(struct flb_tail_file *file);
 int flb_tail_file_chunk(struct flb_tail_file *file);
+#ifdef FLB_HAVE_IO_URING
+int flb_tail_file_prefetch(struct flb_tail_config *ctx, struct mk_list *list);
+#endif
 int flb_tail_file_append(char *path, struct stat *st, int mode,
                          struct flb_tail_config *ctx);
 void flb_tail_file_remove(struct flb_tail_file *file);
@@ -37,6 +37,7 @@ struct flb_tail_file {
     int64_t size;
     int64_t offset;
     int64_t last_line;
+    uint64_t  dev;
     uint64_t  inode;
     uint64_t  link_inode;
     int   is_link;
@@ -46,6 +47,10 @@ struct flb_tail_file {
     time_t rotated;
     int64_t pending_bytes;
 
+    /* read already completed by the io_uring backend */
+    int io_ready;
+    ssize_t io_bytes;
+
     /* dynamic tag for this file */
     int tag_len;
     char *tag_buf;
@@ -67,12 +72,19 @@ struct flb_tail_file {
     bool dmode_complete;        /* buffer contains completed log         */
     bool dmode_firstline;       /* dmode mult firstline found ?          */
 
-    /* buffering */
+    /*
+     * buffering: pending data starts at 'buf_start', consumed bytes are
+     * only moved to the beginning when the buffer needs room for a read.
+     */
     size_t parsed;
+    size_t buf_start;
     size_t buf_len;
     size_t buf_size;
     char *buf_data;
 
+    /* packed map header and keys shared by every record of the file */
+    flb_sds_t pack_prefix;
+
     /*
      * Long-lines handling: this flag is enabled when a previous line was
      * too long and the buffer did not contain a \n, so when reaching the
@@ -90,6 +102,8 @@ struct flb_tail_file {
 
     /* database reference */
     uint64_t db_id;
+    int db_dirty;               /* offset pending for next checkpoint */
+    struct mk_list _db_head;    /* link to config->files_db_dirty     */
 
     /* reference */
     int tail_mode;
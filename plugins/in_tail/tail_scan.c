@@ -19,6 +19,7 @@
  */
 
 #include <fluent-bit/flb_input_plugin.h>
+#include <fluent-bit/flb_time.h>
 #include "tail.h"
 #include "tail_config.h"
 
@@ -34,9 +35,15 @@
 int flb_tail_scan(struct mk_list *path_list, struct flb_tail_config *ctx)
 {
     int ret;
+    double elapsed;
+    struct flb_time t_start;
+    struct flb_time t_end;
+    struct flb_time t_diff;
     struct mk_list *head;
     struct flb_slist_entry *pattern;
 
+    flb_time_get(&t_start);
+
     mk_list_foreach(head, path_list) {
         pattern = mk_list_entry(head, struct flb_slist_entry, _head);
         ret = tail_scan_path(pattern->str, ctx);
@@ -49,6 +56,20 @@ int flb_tail_scan(struct mk_list *path_list, struct flb_tail_config *ctx)
         }
     }
 
+    flb_time_get(&t_end);
+    flb_time_diff(&t_end, &t_start, &t_diff);
+    elapsed = flb_time_to_double(&t_diff) * 1000.0;
+
+    flb_plg_debug(ctx->ins, "scan of %i files took %.3f ms",
+                  ctx->files_hash->total_count, elapsed);
+
+#ifdef FLB_HAVE_METRICS
+    flb_metrics_sum(FLB_TAIL_METRIC_SCANS, 1, ctx->ins->metrics);
+    flb_metrics_sum(FLB_TAIL_METRIC_SCAN_TIME,
+                    t_diff.tm.tv_sec * 1000000 + t_diff.tm.tv_nsec / 1000,
+                    ctx->ins->metrics);
+#endif
+
     return 0;
 }
 
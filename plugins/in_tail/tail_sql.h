@@ -57,6 +57,10 @@
     "PRAGMA synchronous=%i;"
 
 #define SQL_PRAGMA_JOURNAL_MODE                 \
-    "PRAGMA journal_mode=OFF;"
+    "PRAGMA journal_mode=%s;"
+
+#define SQL_BEGIN_TRANSACTION     "BEGIN TRANSACTION;"
+#define SQL_COMMIT_TRANSACTION    "COMMIT;"
+#define SQL_ROLLBACK_TRANSACTION  "ROLLBACK;"
 
 #endif
@@ -0,0 +1,319 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+/*
+ * Minimal io_uring(7) interface used by the 'io_uring' read backend: it
+ * only queues read requests on the current file position of each
+ * descriptor and waits for all of them, so the plugin pays a single
+ * syscall to read from many files at once.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+
+#ifdef FLB_HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "tail_uring.h"
+
+/* io_uring_enter(2) attempts on EAGAIN or EBUSY before giving up */
+#define FLB_TAIL_URING_RETRIES  16
+
+struct flb_tail_uring {
+    int fd;
+    unsigned int queued;        /* requests not submitted yet  */
+    unsigned int inflight;      /* submitted, not reaped yet   */
+
+    /* submission queue */
+    void *sq_ptr;
+    size_t sq_len;
+    unsigned int sq_entries;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+
+    /* completion queue */
+    void *cq_ptr;
+    size_t cq_len;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static inline int uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int uring_enter(int fd, unsigned int submit,
+                              unsigned int complete, unsigned int flags)
+{
+    return syscall(__NR_io_uring_enter, fd, submit, complete, flags,
+                   NULL, 0);
+}
+
+struct flb_tail_uring *flb_tail_uring_create(unsigned int entries)
+{
+    char *sq;
+    char *cq;
+    struct io_uring_params p;
+    struct flb_tail_uring *ring;
+
+    ring = flb_calloc(1, sizeof(struct flb_tail_uring));
+    if (!ring) {
+        flb_errno();
+        return NULL;
+    }
+    ring->sq_ptr = MAP_FAILED;
+    ring->cq_ptr = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+
+    memset(&p, 0, sizeof(p));
+    ring->fd = uring_setup(entries, &p);
+    if (ring->fd == -1) {
+        flb_errno();
+        flb_free(ring);
+        return NULL;
+    }
+
+    /* Reads must be able to use (and move) the current file position */
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+        flb_error("[io_uring] kernel does not support reads on the current "
+                  "file position");
+        flb_tail_uring_destroy(ring);
+        return NULL;
+    }
+
+    ring->sq_entries = p.sq_entries;
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len) {
+            ring->sq_len = ring->cq_len;
+        }
+        ring->cq_len = ring->sq_len;
+    }
+
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        flb_errno();
+        flb_tail_uring_destroy(ring);
+        return NULL;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ptr = ring->sq_ptr;
+    }
+    else {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            flb_errno();
+            flb_tail_uring_destroy(ring);
+            return NULL;
+        }
+    }
+
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        flb_errno();
+        flb_tail_uring_destroy(ring);
+        return NULL;
+    }
+
+    sq = ring->sq_ptr;
+    ring->sq_head = (unsigned int *) (sq + p.sq_off.head);
+    ring->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *) (sq + p.sq_off.array);
+
+    cq = ring->cq_ptr;
+    ring->cq_head = (unsigned int *) (cq + p.cq_off.head);
+    ring->cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    return ring;
+}
+
+void flb_tail_uring_destroy(struct flb_tail_uring *ring)
+{
+    if (ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqes_len);
+    }
+    if (ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    if (ring->sq_ptr != MAP_FAILED) {
+        munmap(ring->sq_ptr, ring->sq_len);
+    }
+    close(ring->fd);
+    flb_free(ring);
+}
+
+/*
+ * Queue a read(2) of 'len' bytes on the current position of 'fd'. Returns
+ * -1 if the submission queue is full: the caller must wait for the queued
+ * requests first.
+ */
+int flb_tail_uring_read(struct flb_tail_uring *ring, int fd,
+                        char *buf, size_t len, void *data)
+{
+    unsigned int head;
+    unsigned int tail;
+    unsigned int index;
+    struct io_uring_sqe *sqe;
+
+    head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    tail = *ring->sq_tail;
+    if (tail - head >= ring->sq_entries ||
+        ring->queued + ring->inflight >= ring->sq_entries) {
+        return -1;
+    }
+
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = len;
+    sqe->off = (__u64) -1;
+    sqe->user_data = (unsigned long) data;
+
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->queued++;
+
+    return 0;
+}
+
+/* Invoke 'cb' for every completed request, returns how many were reaped */
+static int uring_reap(struct flb_tail_uring *ring,
+                      void (*cb) (void *data, int res))
+{
+    int count = 0;
+    unsigned int head;
+    unsigned int tail;
+    struct io_uring_cqe *cqe;
+
+    head = *ring->cq_head;
+    tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        cqe = &ring->cqes[head & *ring->cq_mask];
+        cb((void *) (unsigned long) cqe->user_data, cqe->res);
+        ring->inflight--;
+        count++;
+        head++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+/*
+ * Wait for the submitted requests without submitting new ones: they read
+ * into the callers buffers, which cannot be reused or freed before. The
+ * queued requests are dropped, the ring must be destroyed afterwards.
+ */
+static int uring_drain(struct flb_tail_uring *ring,
+                       void (*cb) (void *data, int res))
+{
+    int ret;
+    int retries = 0;
+
+    ring->queued = 0;
+    while (ring->inflight > 0) {
+        ret = uring_enter(ring->fd, 0, ring->inflight,
+                          IORING_ENTER_GETEVENTS);
+        if (ret == -1 && errno != EINTR) {
+            if ((errno != EAGAIN && errno != EBUSY) ||
+                retries++ >= FLB_TAIL_URING_RETRIES) {
+                flb_errno();
+                return -1;
+            }
+        }
+        uring_reap(ring, cb);
+    }
+
+    return 0;
+}
+
+/*
+ * Submit every queued request, wait until all of them complete and invoke
+ * 'cb' with the read(2)-like result of each one (bytes or -errno).
+ *
+ * On error the submitted requests are still waited for, so no read is left
+ * in flight; if even that fails the kernel may still write into the
+ * buffers until the ring is destroyed.
+ */
+int flb_tail_uring_wait(struct flb_tail_uring *ring,
+                        void (*cb) (void *data, int res))
+{
+    int ret;
+    int count = 0;
+    int retries = 0;
+
+    while (ring->queued > 0 || ring->inflight > 0) {
+        ret = uring_enter(ring->fd, ring->queued, ring->inflight + ring->queued,
+                          IORING_ENTER_GETEVENTS);
+        if (ret == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            /* out of resources or completions to reap first: try again */
+            if ((errno == EAGAIN || errno == EBUSY) &&
+                retries++ < FLB_TAIL_URING_RETRIES) {
+                count += uring_reap(ring, cb);
+                continue;
+            }
+
+            flb_errno();
+            uring_drain(ring, cb);
+            return -1;
+        }
+        retries = 0;
+        ring->inflight += ret;
+        ring->queued -= ret;
+
+        count += uring_reap(ring, cb);
+    }
+
+    return count;
+}
+
+#endif
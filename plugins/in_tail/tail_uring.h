@@ -0,0 +1,41 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#ifndef FLB_TAIL_URING_H
+#define FLB_TAIL_URING_H
+
+#include <fluent-bit/flb_info.h>
+
+#ifdef FLB_HAVE_IO_URING
+
+#include <stddef.h>
+
+struct flb_tail_uring;
+
+struct flb_tail_uring *flb_tail_uring_create(unsigned int entries);
+void flb_tail_uring_destroy(struct flb_tail_uring *ring);
+
+int flb_tail_uring_read(struct flb_tail_uring *ring, int fd,
+                        char *buf, size_t len, void *data);
+int flb_tail_uring_wait(struct flb_tail_uring *ring,
+                        void (*cb) (void *data, int res));
+
+#endif
+#endif
@@ -85,7 +85,7 @@ static int in_tcp_init(struct flb_input_instance *in,
     }
     flb_net_socket_nonblocking(ctx->server_fd);
 
-    ctx->evl = config->evl;
+    ctx->evl = flb_input_event_loop(in);
 
     /* Collect upon data available on the standard input */
     ret = flb_input_set_collector_socket(in,
@@ -127,5 +127,5 @@ struct flb_input_plugin in_tcp_plugin = {
     .cb_collect   = in_tcp_collect,
     .cb_flush_buf = NULL,
     .cb_exit      = in_tcp_exit,
-    .flags        = FLB_INPUT_NET,
+    .flags        = FLB_INPUT_NET | FLB_INPUT_THREAD_SAFE,
 };
@@ -311,7 +311,7 @@ static void cb_datadog_flush(const void *data, size_t bytes,
     int compressed = FLB_FALSE;
 
     /* Get upstream connection */
-    upstream_conn = flb_upstream_conn_get(ctx->upstream);
+    upstream_conn = flb_upstream_conn_get_shared(ctx->upstream);
     if (!upstream_conn) {
         FLB_OUTPUT_RETURN(FLB_RETRY);
     }
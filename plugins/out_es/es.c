@@ -641,7 +641,7 @@ static void cb_es_flush(const void *data, size_t bytes,
     flb_sds_t signature = NULL;
 
     /* Get upstream connection */
-    u_conn = flb_upstream_conn_get(ctx->u);
+    u_conn = flb_upstream_conn_get_shared(ctx->u);
     if (!u_conn) {
         FLB_OUTPUT_RETURN(FLB_RETRY);
     }
@@ -931,5 +931,5 @@ struct flb_output_plugin out_es_plugin = {
     .test_formatter.callback = elasticsearch_format,
 
     /* Plugin flags */
-    .flags          = FLB_OUTPUT_NET | FLB_IO_OPT_TLS,
+    .flags          = FLB_OUTPUT_NET | FLB_IO_OPT_TLS | FLB_OUTPUT_THREAD_SAFE,
 };
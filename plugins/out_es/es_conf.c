@@ -139,6 +139,12 @@ struct flb_elasticsearch *flb_es_conf_create(struct flb_output_instance *ins,
             ctx->has_aws_auth = FLB_TRUE;
             flb_debug("[out_es] Enabled AWS Auth");
 
+            /* The credentials provider cannot be shared by workers */
+            if (ins->workers > 0) {
+                flb_plg_warn(ins, "workers are not supported with AWS Auth");
+                ins->workers = 0;
+            }
+
             /* AWS provider needs a separate TLS instance */
             ctx->aws_tls.context = flb_tls_context_new(FLB_TRUE,
                                                        ins->tls_debug,
@@ -678,6 +678,12 @@ static int forward_config_ha(const char *upstream_file,
         return -1;
     }
 
+    ret = flb_output_upstream_ha_set(ctx->ha, ctx->ins);
+    if (ret == -1) {
+        flb_plg_error(ctx->ins, "cannot set Upstream network options");
+        return -1;
+    }
+
     /* Iterate nodes and create a forward_config context */
     mk_list_foreach(head, &ctx->ha->nodes) {
         node = mk_list_entry(head, struct flb_upstream_node, _head);
@@ -817,13 +823,14 @@ static int cb_forward_init(struct flb_output_instance *ins,
 }
 
 struct flb_forward_config *flb_forward_target(struct flb_forward *ctx,
+                                              const char *tag, int tag_len,
                                               struct flb_upstream_node **node)
 {
     struct flb_forward_config *fc = NULL;
     struct flb_upstream_node *f_node;
 
     if (ctx->ha_mode == FLB_TRUE) {
-        f_node = flb_upstream_ha_node_get(ctx->ha);
+        f_node = flb_upstream_ha_node_get_key(ctx->ha, tag, tag_len);
         if (!f_node) {
             return NULL;
         }
@@ -1078,10 +1085,11 @@ static void cb_forward_flush(const void *data, size_t bytes,
     struct flb_upstream_conn *u_conn;
     struct flb_upstream_node *node = NULL;
     struct flb_forward_flush *flush_ctx;
+    struct flb_time start;
     (void) i_ins;
     (void) config;
 
-    fc = flb_forward_target(ctx, &node);
+    fc = flb_forward_target(ctx, tag, tag_len, &node);
     if (!fc) {
         FLB_OUTPUT_RETURN(FLB_RETRY);
     }
@@ -1104,6 +1112,11 @@ static void cb_forward_flush(const void *data, size_t bytes,
     }
     flush_ctx->fc = fc;
 
+    /* Track the request for the balancing and health of the HA node */
+    if (node) {
+        flb_upstream_ha_node_begin(ctx->ha, node, &start);
+    }
+
     /* Format the right payload and retrieve the 'forward mode' used */
     mode = flb_forward_format(config, i_ins, ctx, flush_ctx,
                               tag, tag_len,
@@ -1124,6 +1137,9 @@ static void cb_forward_flush(const void *data, size_t bytes,
             flb_free(tmp_buf);
         }
         flb_free(flush_ctx);
+        if (node) {
+            flb_upstream_ha_node_end(ctx->ha, node, &start, FLB_FALSE);
+        }
         FLB_OUTPUT_RETURN(FLB_RETRY);
     }
 
@@ -1140,6 +1156,9 @@ static void cb_forward_flush(const void *data, size_t bytes,
                 flb_free(tmp_buf);
             }
             flb_free(flush_ctx);
+            if (node) {
+                flb_upstream_ha_node_end(ctx->ha, node, &start, FLB_FALSE);
+            }
             FLB_OUTPUT_RETURN(FLB_RETRY);
         }
     }
@@ -1162,6 +1181,9 @@ static void cb_forward_flush(const void *data, size_t bytes,
 
     flb_upstream_conn_release(u_conn);
     flb_free(flush_ctx);
+    if (node) {
+        flb_upstream_ha_node_end(ctx->ha, node, &start, ret == FLB_OK);
+    }
     FLB_OUTPUT_RETURN(ret);
 }
 
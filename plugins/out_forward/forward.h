@@ -105,6 +105,7 @@ struct flb_forward_flush {
 };
 
 struct flb_forward_config *flb_forward_target(struct flb_forward *ctx,
+                                              const char *tag, int tag_len,
                                               struct flb_upstream_node **node);
 
 #endif
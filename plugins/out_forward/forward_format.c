@@ -373,7 +373,7 @@ int flb_forward_format(struct flb_config *config,
     struct flb_forward *ctx = ins_ctx;
 
     if (!flush_ctx) {
-        fc = flb_forward_target(ctx, &node);
+        fc = flb_forward_target(ctx, tag, tag_len, &node);
     }
     else {
         fc = ff->fc;
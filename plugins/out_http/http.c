@@ -63,9 +63,63 @@ static int cb_http_init(struct flb_output_instance *ins,
     return 0;
 }
 
+/* Records being formatted and compressed while the request is sent */
+struct http_stream {
+    struct flb_out_http *ctx;
+    const void *data;
+    size_t bytes;
+};
+
+static int cb_stream_gzip_out(void *data, const void *buf, size_t len)
+{
+    struct flb_http_client *c = data;
+
+    return flb_http_write_body(c, buf, len);
+}
+
+static int cb_stream_json_out(void *data, const char *buf, size_t len)
+{
+    struct flb_gzip_stream *gz = data;
+
+    return flb_gzip_stream_write(gz, buf, len);
+}
+
+static int cb_stream_body(struct flb_http_client *c, void *data)
+{
+    int ret;
+    struct http_stream *st = data;
+    struct flb_out_http *ctx = st->ctx;
+    struct flb_gzip_stream *gz;
+
+    gz = flb_gzip_stream_create(cb_stream_gzip_out, c);
+    if (!gz) {
+        return -1;
+    }
+
+    ret = flb_pack_msgpack_to_json_format_cb(st->data, st->bytes,
+                                             ctx->out_format,
+                                             ctx->json_date_format,
+                                             ctx->date_key,
+                                             cb_stream_json_out, gz);
+    if (ret != -1) {
+        ret = flb_gzip_stream_finish(gz);
+    }
+    flb_gzip_stream_destroy(gz);
+
+    if (ret == -1) {
+        flb_plg_error(ctx->ins, "could not stream compressed payload");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Send 'body', or when 'stream' is set the records in it, which are then
+ * formatted and compressed while they are sent.
+ */
 static int http_post(struct flb_out_http *ctx,
                      const void *body, size_t body_len,
-                     const char *tag, int tag_len)
+                     const char *tag, int tag_len, int stream)
 {
     int ret;
     int out_ret = FLB_OK;
@@ -80,10 +134,11 @@ static int http_post(struct flb_out_http *ctx,
     struct flb_config_map_val *mv;
     struct flb_slist_entry *key = NULL;
     struct flb_slist_entry *val = NULL;
+    struct http_stream st;
 
     /* Get upstream context and connection */
     u = ctx->u;
-    u_conn = flb_upstream_conn_get(u);
+    u_conn = flb_upstream_conn_get_shared(u);
     if (!u_conn) {
         flb_plg_error(ctx->ins, "no upstream connections available to %s:%i",
                       u->tcp_host, u->tcp_port);
@@ -95,7 +150,12 @@ static int http_post(struct flb_out_http *ctx,
     payload_size = body_len;
 
     /* Should we compress the payload ? */
-    if (ctx->compress_gzip == FLB_TRUE) {
+    if (stream == FLB_TRUE) {
+        payload_buf = NULL;
+        payload_size = 0;
+        compressed = FLB_TRUE;
+    }
+    else if (ctx->compress_gzip == FLB_TRUE) {
         ret = flb_gzip_compress((void *) body, body_len,
                                 &payload_buf, &payload_size);
         if (ret == -1) {
@@ -113,6 +173,20 @@ static int http_post(struct flb_out_http *ctx,
                         ctx->host, ctx->port,
                         ctx->proxy, 0);
 
+    if (stream == FLB_TRUE) {
+        st.ctx = ctx;
+        st.data = body;
+        st.bytes = body_len;
+        ret = flb_http_set_body_cb(c, cb_stream_body, &st);
+        if (ret == -1) {
+            flb_plg_error(ctx->ins, "cannot stream the payload to %s:%i",
+                          ctx->host, ctx->port);
+            flb_http_client_destroy(c);
+            flb_upstream_conn_release(u_conn);
+            return FLB_RETRY;
+        }
+    }
+
     /* Allow duplicated headers ? */
     flb_http_allow_duplicated_headers(c, ctx->allow_dup_headers);
 
@@ -288,7 +362,7 @@ static int http_gelf(struct flb_out_http *ctx,
         s = tmp;
     }
 
-    ret = http_post(ctx, s, flb_sds_len(s), tag, tag_len);
+    ret = http_post(ctx, s, flb_sds_len(s), tag, tag_len, FLB_FALSE);
     flb_sds_destroy(s);
     msgpack_unpacked_destroy(&result);
 
@@ -310,12 +384,19 @@ static void cb_http_flush(const void *data, size_t bytes,
         (ctx->out_format == FLB_PACK_JSON_FORMAT_STREAM) ||
         (ctx->out_format == FLB_PACK_JSON_FORMAT_LINES)) {
 
+        if (ctx->compress_gzip == FLB_TRUE &&
+            ctx->stream_compression == FLB_TRUE) {
+            ret = http_post(ctx, data, bytes, tag, tag_len, FLB_TRUE);
+            FLB_OUTPUT_RETURN(ret);
+        }
+
         json = flb_pack_msgpack_to_json_format(data, bytes,
                                                ctx->out_format,
                                                ctx->json_date_format,
                                                ctx->date_key);
         if (json != NULL) {
-            ret = http_post(ctx, json, flb_sds_len(json), tag, tag_len);
+            ret = http_post(ctx, json, flb_sds_len(json), tag, tag_len,
+                            FLB_FALSE);
             flb_sds_destroy(json);
         }
     }
@@ -323,7 +404,7 @@ static void cb_http_flush(const void *data, size_t bytes,
         ret = http_gelf(ctx, data, bytes, tag, tag_len);
     }
     else {
-        ret = http_post(ctx, data, bytes, tag, tag_len);
+        ret = http_post(ctx, data, bytes, tag, tag_len, FLB_FALSE);
     }
 
     FLB_OUTPUT_RETURN(ret);
@@ -384,6 +465,12 @@ static struct flb_config_map config_map[] = {
      0, FLB_FALSE, 0,
      "Set payload compression mechanism. Option available is 'gzip'"
     },
+    {
+     FLB_CONFIG_MAP_BOOL, "stream_compression", "false",
+     0, FLB_TRUE, offsetof(struct flb_out_http, stream_compression),
+     "Format and compress JSON records while they are sent, using chunked "
+     "transfer encoding, instead of building the whole payload first"
+    },
     {
      FLB_CONFIG_MAP_SLIST_1, "header", NULL,
      FLB_CONFIG_MAP_MULT, FLB_TRUE, offsetof(struct flb_out_http, headers),
@@ -435,5 +522,5 @@ struct flb_output_plugin out_http_plugin = {
     .cb_flush    = cb_http_flush,
     .cb_exit     = cb_http_exit,
     .config_map  = config_map,
-    .flags       = FLB_OUTPUT_NET | FLB_IO_OPT_TLS,
+    .flags       = FLB_OUTPUT_NET | FLB_IO_OPT_TLS | FLB_OUTPUT_THREAD_SAFE,
 };
@@ -58,6 +58,7 @@ struct flb_out_http {
 
     /* Compression mode (gzip) */
     int compress_gzip;
+    int stream_compression;    /* compress while sending (chunked) */
 
     /* Allow duplicated headers */
     int allow_dup_headers;
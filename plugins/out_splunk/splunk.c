@@ -173,7 +173,7 @@ static void cb_splunk_flush(const void *data, size_t bytes,
     (void) config;
 
     /* Get upstream connection */
-    u_conn = flb_upstream_conn_get(ctx->u);
+    u_conn = flb_upstream_conn_get_shared(ctx->u);
     if (!u_conn) {
         FLB_OUTPUT_RETURN(FLB_RETRY);
     }
@@ -193,6 +193,6 @@ struct flb_output_plugin out_stdout_plugin = {
     .cb_init      = cb_stdout_init,
     .cb_flush     = cb_stdout_flush,
     .cb_exit      = cb_stdout_exit,
-    .flags        = 0,
+    .flags        = FLB_OUTPUT_THREAD_SAFE,
     .config_map   = config_map
 };
@@ -39,9 +39,11 @@
 #include <fluent-bit/flb_kernel.h>
 #include <fluent-bit/flb_worker.h>
 #include <fluent-bit/flb_scheduler.h>
+#include <fluent-bit/flb_task.h>
 #include <fluent-bit/flb_http_server.h>
 #include <fluent-bit/flb_plugin.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_router.h>
 
 const char *FLB_CONF_ENV_LOGLEVEL = "FLB_LOG_LEVEL";
 
@@ -108,12 +110,37 @@ struct flb_service_config service_configs[] = {
     {FLB_CONF_STORAGE_MAX_CHUNKS_UP,
      FLB_CONF_TYPE_INT,
      offsetof(struct flb_config, storage_max_chunks_up)},
+    {FLB_CONF_STORAGE_BACKEND,
+     FLB_CONF_TYPE_STR,
+     offsetof(struct flb_config, storage_backend)},
+    {FLB_CONF_STORAGE_SEGMENT_SIZE,
+     FLB_CONF_TYPE_STR,
+     offsetof(struct flb_config, storage_segment_size)},
+    {FLB_CONF_STORAGE_COMMIT_INTERVAL,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, storage_commit_interval)},
+    {FLB_CONF_STORAGE_COMMIT_BYTES,
+     FLB_CONF_TYPE_STR,
+     offsetof(struct flb_config, storage_commit_bytes)},
+    {FLB_CONF_STORAGE_COMPRESSION,
+     FLB_CONF_TYPE_STR,
+     offsetof(struct flb_config, storage_compression)},
 
     /* Coroutines */
     {FLB_CONF_STR_CORO_STACK_SIZE,
      FLB_CONF_TYPE_INT,
      offsetof(struct flb_config, coro_stack_size)},
 
+    /* Router */
+    {FLB_CONF_ROUTER_CACHE_SIZE,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, router_cache_size)},
+
+    /* Tasks */
+    {FLB_CONF_TASKS_MAX,
+     FLB_CONF_TYPE_INT,
+     offsetof(struct flb_config, tasks_max)},
+
 #ifdef FLB_HAVE_STREAM_PROCESSOR
     {FLB_CONF_STR_STREAMS_FILE,
      FLB_CONF_TYPE_STR,
@@ -180,6 +207,10 @@ struct flb_config *flb_config_init()
     /* Set default coroutines stack size */
     config->coro_stack_size = FLB_THREAD_STACK_SIZE;
 
+    /* Router */
+    config->router = NULL;
+    config->router_cache_size = FLB_ROUTER_CACHE_SIZE;
+
     /* Initialize linked lists */
     mk_list_init(&config->collectors);
     mk_list_init(&config->in_plugins);
@@ -194,7 +225,11 @@ struct flb_config *flb_config_init()
     mk_list_init(&config->workers);
     mk_list_init(&config->upstreams);
 
-    memset(&config->tasks_map, '\0', sizeof(config->tasks_map));
+    /* Tasks map, allocated with the first task */
+    config->tasks_map = NULL;
+    config->tasks_map_size = 0;
+    config->tasks_map_free = -1;
+    config->tasks_max = 0;
 
     /* Environment */
     config->env = flb_env_create();
@@ -325,6 +360,14 @@ void flb_config_exit(struct flb_config *config)
     /* Release scheduler */
     flb_sched_exit(config);
 
+    /* Tasks map */
+    flb_task_map_destroy(config);
+
+    /* Compiled routes (if the engine did not release them) */
+    if (config->router) {
+        flb_router_destroy(config->router);
+    }
+
 #ifdef FLB_HAVE_HTTP_SERVER
     if (config->http_listen) {
         flb_free(config->http_listen);
@@ -344,6 +387,18 @@ void flb_config_exit(struct flb_config *config)
     if (config->storage_bl_mem_limit) {
         flb_free(config->storage_bl_mem_limit);
     }
+    if (config->storage_backend) {
+        flb_free(config->storage_backend);
+    }
+    if (config->storage_segment_size) {
+        flb_free(config->storage_segment_size);
+    }
+    if (config->storage_commit_bytes) {
+        flb_free(config->storage_commit_bytes);
+    }
+    if (config->storage_compression) {
+        flb_free(config->storage_compression);
+    }
 
 #ifdef FLB_HAVE_STREAM_PROCESSOR
     if (config->stream_processor_file) {
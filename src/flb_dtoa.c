@@ -0,0 +1,537 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_macros.h>
+#include <fluent-bit/flb_dtoa.h>
+
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * Shortest round trip formatting of doubles, an implementation of the Ryu
+ * algorithm by Ulf Adams ("Ryu: fast float-to-string conversion", PLDI
+ * 2018). The interval of decimal numbers rounding to the double is computed
+ * with 64 bit multiplications by a 125 bit approximation of a power of 5,
+ * then digits are removed while both ends of the interval still differ.
+ *
+ * The powers of 5 are not stored for every exponent: only one out of 26 is
+ * kept and the others are computed from it and 5^0..5^25. The small error
+ * of that multiplication is corrected by 2 bit offsets. These tables are
+ * generated by computing the exact values with big integers.
+ */
+
+#define DOUBLE_MANTISSA_BITS    52
+#define DOUBLE_EXPONENT_BITS    11
+#define DOUBLE_BIAS             1023
+#define POW5_BITCOUNT           125
+#define POW5_INV_BITCOUNT       125
+#define POW5_STEP               26
+
+static const uint64_t pow5_table[26] = {
+    0x0000000000000001, 0x0000000000000005,
+    0x0000000000000019, 0x000000000000007d,
+    0x0000000000000271, 0x0000000000000c35,
+    0x0000000000003d09, 0x000000000001312d,
+    0x000000000005f5e1, 0x00000000001dcd65,
+    0x00000000009502f9, 0x0000000002e90edd,
+    0x000000000e8d4a51, 0x0000000048c27395,
+    0x000000016bcc41e9, 0x000000071afd498d,
+    0x0000002386f26fc1, 0x000000b1a2bc2ec5,
+    0x000003782dace9d9, 0x00001158e460913d,
+    0x000056bc75e2d631, 0x0001b1ae4d6e2ef5,
+    0x000878678326eac9, 0x002a5a058fc295ed,
+    0x00d3c21bcecceda1, 0x0422ca8b0a00a425,
+};
+
+static const uint64_t pow5_split[13][2] = {
+    { 0x0000000000000000, 0x1000000000000000 },
+    { 0x0000000000000000, 0x14adf4b7320334b9 },
+    { 0x0e549208b31adb10, 0x1aba4714957d300d },
+    { 0x6dc6ad264d8f0866, 0x1145b7e285bf98f5 },
+    { 0xeb1dbd923d8596ca, 0x1652efdc6018a1fc },
+    { 0xb4c1b80b22ae923c, 0x1cda62055b2d9d83 },
+    { 0x5bb28b4e8f7e4c30, 0x12a5568b9f52f416 },
+    { 0xf08aed437682d4fb, 0x1819651531f9e78f },
+    { 0xb4ee134ad99bf150, 0x1f25c186a6f04c28 },
+    { 0x16499ecb70c25f03, 0x1420eb449c8842e6 },
+    { 0x85a56ead360865b0, 0x1a03fde214caf085 },
+    { 0x093db1d57999890b, 0x10cfeb353a97dad8 },
+    { 0xcf38bb735e3f36ac, 0x15baaf44fa52673e },
+};
+
+static const uint32_t pow5_offsets[21] = {
+    0x00000000, 0x00000000, 0x00000000, 0x00000000,
+    0x40000000, 0x59695995, 0x55545555, 0x56555515,
+    0x41150504, 0x40555410, 0x44555145, 0x44504540,
+    0x45555550, 0x40004000, 0x96440440, 0x55565565,
+    0x54454045, 0x40154151, 0x55559155, 0x51405555,
+    0x00000105,
+};
+
+static const uint64_t pow5_inv_split[13][2] = {
+    { 0x0000000000000000, 0x2000000000000000 },
+    { 0x52a6c95fc0655033, 0x18c240c4aecb13bb },
+    { 0x7ca8d50071dfc805, 0x1327fc58da0f6ff5 },
+    { 0x6520247d3556476d, 0x1da48ce468e7c702 },
+    { 0x6139cdd76802e6e8, 0x16ef5b40c2fc7779 },
+    { 0xf951a7ff43de8c78, 0x11bebdf578b2f391 },
+    { 0x7be8bee8d6e957e7, 0x1b758d848fac54b0 },
+    { 0x8bd3f9e999a423e9, 0x153eda614071a3b7 },
+    { 0x0848f973cb3ee3cd, 0x10701bd527b4978c },
+    { 0x153285ebb9efbfa1, 0x196fbb9bb44db44d },
+    { 0xadeee7f86c07b695, 0x13ae3591f5b4d936 },
+    { 0x4d686a4eaf182221, 0x1e74404f3daada91 },
+    { 0x98c0a106e09ebd9e, 0x17900ea4fda7c257 },
+};
+
+static const uint32_t pow5_inv_offsets[19] = {
+    0x54544554, 0x04055545, 0x10041000, 0x00400414,
+    0x40010000, 0x41155555, 0x00000454, 0x00010044,
+    0x40000000, 0x44000041, 0x50454450, 0x55550054,
+    0x51655554, 0x40004000, 0x01000001, 0x00010500,
+    0x51515411, 0x05555554, 0x00000000,
+};
+
+static const char digits_lut[200] = {
+    '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8',
+    '0','9','1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7',
+    '1','8','1','9','2','0','2','1','2','2','2','3','2','4','2','5','2','6',
+    '2','7','2','8','2','9','3','0','3','1','3','2','3','3','3','4','3','5',
+    '3','6','3','7','3','8','3','9','4','0','4','1','4','2','4','3','4','4',
+    '4','5','4','6','4','7','4','8','4','9','5','0','5','1','5','2','5','3',
+    '5','4','5','5','5','6','5','7','5','8','5','9','6','0','6','1','6','2',
+    '6','3','6','4','6','5','6','6','6','7','6','8','6','9','7','0','7','1',
+    '7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9','8','0',
+    '8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+    '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8',
+    '9','9'
+};
+
+#if defined(__SIZEOF_INT128__)
+static inline uint64_t umul128(uint64_t a, uint64_t b, uint64_t *hi)
+{
+    unsigned __int128 r = (unsigned __int128) a * b;
+
+    *hi = (uint64_t) (r >> 64);
+    return (uint64_t) r;
+}
+#else
+static inline uint64_t umul128(uint64_t a, uint64_t b, uint64_t *hi)
+{
+    uint64_t a_lo = (uint32_t) a;
+    uint64_t a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t) b;
+    uint64_t b_hi = b >> 32;
+    uint64_t b00 = a_lo * b_lo;
+    uint64_t b01 = a_lo * b_hi;
+    uint64_t b10 = a_hi * b_lo;
+    uint64_t b11 = a_hi * b_hi;
+    uint64_t mid1 = b10 + (b00 >> 32);
+    uint64_t mid2 = b01 + (uint32_t) mid1;
+
+    *hi = b11 + (mid1 >> 32) + (mid2 >> 32);
+    return (mid2 << 32) | (uint32_t) b00;
+}
+#endif
+
+/* 0 < dist < 64 */
+static inline uint64_t shiftright128(uint64_t lo, uint64_t hi,
+                                     unsigned int dist)
+{
+    return (hi << (64 - dist)) | (lo >> dist);
+}
+
+/* ceil(log2(5^e)), 0 <= e <= 3528 */
+static inline int pow5bits(int e)
+{
+    return (int) (((uint32_t) e * 1217359) >> 19) + 1;
+}
+
+/* floor(log10(2^e)), 0 <= e <= 1650 */
+static inline int log10_pow2(int e)
+{
+    return (int) (((uint32_t) e * 78913) >> 18);
+}
+
+/* floor(log10(5^e)), 0 <= e <= 2620 */
+static inline int log10_pow5(int e)
+{
+    return (int) (((uint32_t) e * 732923) >> 20);
+}
+
+static inline int pow5_factor(uint64_t v)
+{
+    int count = 0;
+
+    while (v % 5 == 0) {
+        v /= 5;
+        count++;
+    }
+    return count;
+}
+
+static inline int multiple_of_pow5(uint64_t v, int p)
+{
+    return pow5_factor(v) >= p;
+}
+
+static inline int multiple_of_pow2(uint64_t v, int p)
+{
+    return (v & ((1ULL << p) - 1)) == 0;
+}
+
+/* 5^i with POW5_BITCOUNT bits */
+static void pow5_compute(int i, uint64_t *res)
+{
+    int base = i / POW5_STEP;
+    int offset = i - base * POW5_STEP;
+    int delta;
+    uint64_t m;
+    uint64_t lo0;
+    uint64_t hi0;
+    uint64_t lo1;
+    uint64_t hi1;
+    uint64_t sum;
+    const uint64_t *mul = pow5_split[base];
+
+    if (offset == 0) {
+        res[0] = mul[0];
+        res[1] = mul[1];
+        return;
+    }
+
+    m = pow5_table[offset];
+    lo1 = umul128(m, mul[1], &hi1);
+    lo0 = umul128(m, mul[0], &hi0);
+    sum = hi0 + lo1;
+    if (sum < hi0) {
+        hi1++;
+    }
+
+    delta = pow5bits(i) - pow5bits(base * POW5_STEP);
+    res[0] = shiftright128(lo0, sum, delta) +
+             ((pow5_offsets[i / 16] >> ((i % 16) << 1)) & 3);
+    res[1] = shiftright128(sum, hi1, delta);
+}
+
+/* 2^k / 5^i, rounded up, with POW5_INV_BITCOUNT bits */
+static void pow5_inv_compute(int i, uint64_t *res)
+{
+    int base = (i + POW5_STEP - 1) / POW5_STEP;
+    int offset = base * POW5_STEP - i;
+    int delta;
+    uint64_t m;
+    uint64_t lo0;
+    uint64_t hi0;
+    uint64_t lo1;
+    uint64_t hi1;
+    uint64_t sum;
+    const uint64_t *mul = pow5_inv_split[base];
+
+    if (offset == 0) {
+        res[0] = mul[0] + 1;
+        res[1] = mul[1];
+        return;
+    }
+
+    m = pow5_table[offset];
+    lo1 = umul128(m, mul[1], &hi1);
+    lo0 = umul128(m, mul[0], &hi0);
+    sum = hi0 + lo1;
+    if (sum < hi0) {
+        hi1++;
+    }
+
+    delta = pow5bits(base * POW5_STEP) - pow5bits(i);
+    res[0] = shiftright128(lo0, sum, delta) + 1 +
+             ((pow5_inv_offsets[i / 16] >> ((i % 16) << 1)) & 3);
+    res[1] = shiftright128(sum, hi1, delta);
+}
+
+/* (m * mul) >> j, 64 < j < 128 */
+static inline uint64_t mul_shift(uint64_t m, const uint64_t *mul, int j)
+{
+    uint64_t hi0;
+    uint64_t lo1;
+    uint64_t hi1;
+    uint64_t sum;
+
+    umul128(m, mul[0], &hi0);
+    lo1 = umul128(m, mul[1], &hi1);
+    sum = hi0 + lo1;
+    if (sum < hi0) {
+        hi1++;
+    }
+    return shiftright128(sum, hi1, j - 64);
+}
+
+void flb_dtoa_shortest(double d, uint64_t *mantissa, int *exponent)
+{
+    int e2;
+    int e10;
+    int q;
+    int i;
+    int k;
+    int removed = 0;
+    int accept_bounds;
+    int vm_trailing_zeros = FLB_FALSE;
+    int vr_trailing_zeros = FLB_FALSE;
+    int round_up = FLB_FALSE;
+    uint32_t mm_shift;
+    uint32_t ieee_exponent;
+    uint64_t bits;
+    uint64_t ieee_mantissa;
+    uint64_t m2;
+    uint64_t mv;
+    uint64_t vr;
+    uint64_t vp;
+    uint64_t vm;
+    uint64_t mul[2];
+    uint8_t last_removed = 0;
+
+    memcpy(&bits, &d, sizeof(bits));
+    ieee_mantissa = bits & ((1ULL << DOUBLE_MANTISSA_BITS) - 1);
+    ieee_exponent = (uint32_t) ((bits >> DOUBLE_MANTISSA_BITS) &
+                                ((1u << DOUBLE_EXPONENT_BITS) - 1));
+
+    if (ieee_exponent == 0 && ieee_mantissa == 0) {
+        *mantissa = 0;
+        *exponent = 0;
+        return;
+    }
+
+    if (ieee_exponent == 0) {
+        e2 = 1 - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = ieee_mantissa;
+    }
+    else {
+        e2 = (int) ieee_exponent - DOUBLE_BIAS - DOUBLE_MANTISSA_BITS - 2;
+        m2 = (1ULL << DOUBLE_MANTISSA_BITS) | ieee_mantissa;
+    }
+    accept_bounds = (m2 & 1) == 0;
+
+    /* the interval is [mv - 1 - mm_shift, mv + 2] in units of 2^e2 */
+    mv = 4 * m2;
+    mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+
+    if (e2 >= 0) {
+        q = log10_pow2(e2) - (e2 > 3);
+        e10 = q;
+        k = POW5_INV_BITCOUNT + pow5bits(q) - 1;
+        i = -e2 + q + k;
+        pow5_inv_compute(q, mul);
+        vr = mul_shift(4 * m2, mul, i);
+        vp = mul_shift(4 * m2 + 2, mul, i);
+        vm = mul_shift(4 * m2 - 1 - mm_shift, mul, i);
+        if (q <= 21) {
+            /* only one of mp, mv and mm can be a multiple of 5 */
+            if (mv % 5 == 0) {
+                vr_trailing_zeros = multiple_of_pow5(mv, q);
+            }
+            else if (accept_bounds) {
+                vm_trailing_zeros = multiple_of_pow5(mv - 1 - mm_shift, q);
+            }
+            else {
+                vp -= multiple_of_pow5(mv + 2, q);
+            }
+        }
+    }
+    else {
+        q = log10_pow5(-e2) - (-e2 > 1);
+        e10 = q + e2;
+        i = -e2 - q;
+        k = pow5bits(i) - POW5_BITCOUNT;
+        pow5_compute(i, mul);
+        vr = mul_shift(4 * m2, mul, q - k);
+        vp = mul_shift(4 * m2 + 2, mul, q - k);
+        vm = mul_shift(4 * m2 - 1 - mm_shift, mul, q - k);
+        if (q <= 1) {
+            /* mv has at least q trailing 0 bits */
+            vr_trailing_zeros = FLB_TRUE;
+            if (accept_bounds) {
+                vm_trailing_zeros = mm_shift == 1;
+            }
+            else {
+                vp--;
+            }
+        }
+        else if (q < 63) {
+            vr_trailing_zeros = multiple_of_pow2(mv, q);
+        }
+    }
+
+    if (vm_trailing_zeros || vr_trailing_zeros) {
+        /* rare case, the lower bound may be exact or the result a tie */
+        while (vp / 10 > vm / 10) {
+            vm_trailing_zeros &= vm % 10 == 0;
+            vr_trailing_zeros &= last_removed == 0;
+            last_removed = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_trailing_zeros) {
+            while (vm % 10 == 0) {
+                vr_trailing_zeros &= last_removed == 0;
+                last_removed = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        if (vr_trailing_zeros && last_removed == 5 && vr % 2 == 0) {
+            /* round half to even */
+            last_removed = 4;
+        }
+        *mantissa = vr + ((vr == vm && (!accept_bounds ||
+                                        !vm_trailing_zeros)) ||
+                          last_removed >= 5);
+    }
+    else {
+        if (vp / 100 > vm / 100) {
+            round_up = vr % 100 >= 50;
+            vr /= 100;
+            vp /= 100;
+            vm /= 100;
+            removed += 2;
+        }
+        while (vp / 10 > vm / 10) {
+            round_up = vr % 10 >= 5;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        *mantissa = vr + (vr == vm || round_up);
+    }
+
+    *exponent = e10 + removed;
+}
+
+int flb_u64toa(uint64_t v, char *buf)
+{
+    int len;
+    int pos;
+    uint64_t t;
+
+    len = 1;
+    for (t = v; t >= 10; t /= 10) {
+        len++;
+    }
+
+    pos = len;
+    while (v >= 100) {
+        t = (v % 100) * 2;
+        v /= 100;
+        buf[--pos] = digits_lut[t + 1];
+        buf[--pos] = digits_lut[t];
+    }
+    if (v >= 10) {
+        buf[--pos] = digits_lut[v * 2 + 1];
+        buf[--pos] = digits_lut[v * 2];
+    }
+    else {
+        buf[--pos] = '0' + v;
+    }
+
+    return len;
+}
+
+int flb_dtoa(double d, int max_exp, char *buf)
+{
+    int i;
+    int len;
+    int exp;
+    int point;
+    char *p = buf;
+    char digits[FLB_DTOA_SIZE];
+    uint64_t bits;
+    uint64_t mantissa;
+
+    memcpy(&bits, &d, sizeof(bits));
+    if (bits >> 63) {
+        *p++ = '-';
+    }
+
+    if (((bits >> DOUBLE_MANTISSA_BITS) & 0x7ff) == 0x7ff) {
+        if (bits & ((1ULL << DOUBLE_MANTISSA_BITS) - 1)) {
+            memcpy(p, "nan", 3);
+        }
+        else {
+            memcpy(p, "inf", 3);
+        }
+        return (p - buf) + 3;
+    }
+
+    flb_dtoa_shortest(d, &mantissa, &exp);
+    len = flb_u64toa(mantissa, digits);
+
+    /* decimal exponent of the first digit */
+    point = len - 1 + exp;
+
+    if (point < -4 || point > max_exp) {
+        *p++ = digits[0];
+        if (len > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, len - 1);
+            p += len - 1;
+        }
+        *p++ = 'e';
+        if (point < 0) {
+            *p++ = '-';
+            point = -point;
+        }
+        else {
+            *p++ = '+';
+        }
+        if (point < 10) {
+            *p++ = '0';
+        }
+        p += flb_u64toa(point, p);
+    }
+    else if (point < 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (i = point + 1; i < 0; i++) {
+            *p++ = '0';
+        }
+        memcpy(p, digits, len);
+        p += len;
+    }
+    else if (point + 1 >= len) {
+        memcpy(p, digits, len);
+        p += len;
+        for (i = len; i <= point; i++) {
+            *p++ = '0';
+        }
+    }
+    else {
+        memcpy(p, digits, point + 1);
+        p += point + 1;
+        *p++ = '.';
+        memcpy(p, digits + point + 1, len - point - 1);
+        p += len - point - 1;
+    }
+
+    return p - buf;
+}
@@ -94,7 +94,7 @@ static void cb_engine_sched_timer(struct flb_config *ctx, void *data)
     (void) data;
 
     /* Upstream connections timeouts handling */
-    flb_upstream_conn_timeouts(ctx);
+    flb_upstream_conn_timeouts(&ctx->upstreams);
 }
 
 
@@ -102,6 +102,7 @@ static inline int flb_engine_manager(flb_pipefd_t fd, struct flb_config *config)
 {
     int ret;
     int bytes;
+    int gen;
     int task_id;
     int thread_id;
     int retries;
@@ -120,9 +121,18 @@ static inline int flb_engine_manager(flb_pipefd_t fd, struct flb_config *config)
         return -1;
     }
 
-    /* Get type and key */
-    type = FLB_BITS_U64_HIGH(val);
-    key  = FLB_BITS_U64_LOW(val);
+    /*
+     * Get type and key: task events use the whole 64 bits and carry their
+     * type on the highest byte, the others on the 32 bits at left.
+     */
+    if (FLB_TASK_TYPE(val) == FLB_ENGINE_TASK) {
+        type = FLB_ENGINE_TASK;
+        key  = 0;
+    }
+    else {
+        type = FLB_BITS_U64_HIGH(val);
+        key  = FLB_BITS_U64_LOW(val);
+    }
 
     /* Flush all remaining data */
     if (type == 1) {                  /* Engine type */
@@ -141,9 +151,10 @@ static inline int flb_engine_manager(flb_pipefd_t fd, struct flb_config *config)
          * The notion of ENGINE_TASK is associated to outputs. All thread
          * references below belongs to flb_output_thread's.
          */
-        ret       = FLB_TASK_RET(key);
-        task_id   = FLB_TASK_ID(key);
-        thread_id = FLB_TASK_TH(key);
+        ret       = FLB_TASK_RET(val);
+        gen       = FLB_TASK_GEN(val);
+        task_id   = FLB_TASK_ID(val);
+        thread_id = FLB_TASK_TH(val);
 
 #ifdef FLB_HAVE_TRACE
         char *trace_st = NULL;
@@ -163,10 +174,21 @@ static inline int flb_engine_manager(flb_pipefd_t fd, struct flb_config *config)
                   task_id, thread_id, trace_st);
 #endif
 
-        task   = config->tasks_map[task_id].task;
+        /* the task might be gone and its id already reused */
+        task = flb_task_get(config, task_id, gen);
+        if (!task) {
+            flb_error("[engine] invalid task event task_id=%i gen=%i",
+                      task_id, gen);
+            return 0;
+        }
         out_th = flb_output_thread_get(thread_id, task);
         ins    = out_th->o_ins;
 
+        /* Flushes that ran on an output worker are accounted here */
+        if (out_th->worker) {
+            flb_output_thread_metrics(ret, out_th);
+        }
+
         /* A thread has finished, delete it */
         if (ret == FLB_OK) {
             /* Inform the user if a 'retry' succedeed */
@@ -493,6 +515,12 @@ int flb_engine_start(struct flb_config *config)
         return -1;
     }
 
+    /* Storage group commit */
+    ret = flb_storage_commit_create(config);
+    if (ret == -1) {
+        return -1;
+    }
+
 #ifdef FLB_HAVE_METRICS
     if (config->storage_metrics == FLB_TRUE) {
         config->storage_metrics_ctx = flb_storage_metrics_create(config);
@@ -627,7 +655,7 @@ int flb_engine_start(struct flb_config *config)
         /* Cleanup functions associated to events and timers */
         if (config->is_running == FLB_TRUE) {
             flb_sched_timer_cleanup(config->sched);
-            flb_upstream_conn_pending_destroy(config);
+            flb_upstream_conn_pending_destroy(&config->upstreams);
         }
     }
 }
@@ -24,12 +24,29 @@
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_input_chunk.h>
 #include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_output_worker.h>
 #include <fluent-bit/flb_router.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_thread.h>
 #include <fluent-bit/flb_engine.h>
 #include <fluent-bit/flb_task.h>
 
+/* Run a flush co-routine, on an output worker if the instance has them */
+static void output_thread_run(struct flb_output_instance *o_ins,
+                              struct flb_thread *th)
+{
+    int ret;
+
+    if (o_ins->workers > 0) {
+        ret = flb_output_worker_flush(o_ins, th);
+        if (ret == 0) {
+            return;
+        }
+    }
+
+    flb_thread_resume(th);
+}
+
 /* It creates a new output thread using a 'Retry' context */
 int flb_engine_dispatch_retry(struct flb_task_retry *retry,
                               struct flb_config *config)
@@ -85,7 +102,7 @@ int flb_engine_dispatch_retry(struct flb_task_retry *retry,
     }
 
     flb_task_add_thread(th, task);
-    flb_thread_resume(th);
+    output_thread_run(retry->o_ins, th);
 
     return 0;
 }
@@ -182,7 +199,7 @@ static int tasks_start(struct flb_input_instance *in,
                                    task->tag,
                                    task->tag_len);
             flb_task_add_thread(th, task);
-            flb_thread_resume(th);
+            output_thread_run(route->out, th);
         }
     }
 
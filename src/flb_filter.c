@@ -53,6 +53,34 @@ static inline int prop_key_check(const char *key, const char *kv, int k_len)
     return -1;
 }
 
+/*
+ * Serialize a filter batch if it was edited and make the result the working
+ * buffer of the chain. The batch references the previous working buffer, so
+ * that one is released after packing.
+ */
+static void filter_batch_release(struct flb_filter_batch *batch,
+                                 char **buf,
+                                 const char **work_data, size_t *work_size,
+                                 int *modified)
+{
+    char *out_buf;
+    size_t out_size;
+
+    if (batch->modified == FLB_FALSE) {
+        flb_filter_batch_destroy(batch);
+        return;
+    }
+
+    flb_filter_batch_pack(batch, &out_buf, &out_size);
+    flb_filter_batch_destroy(batch);
+
+    flb_free(*buf);
+    *buf = out_buf;
+    *work_data = out_buf;
+    *work_size = out_size;
+    *modified = FLB_TRUE;
+}
+
 void flb_filter_do(struct flb_input_chunk *ic,
                    const void *data, size_t bytes,
                    const char *tag, int tag_len,
@@ -65,127 +93,187 @@ void flb_filter_do(struct flb_input_chunk *ic,
     int diff = 0;
     int pre_records = 0;
 #endif
+    int i;
+    int filters_count;
+    int in_batch = FLB_FALSE;
+    int modified = FLB_FALSE;
     char *ntag;
+    char *buf = NULL;
     const char *work_data;
     size_t work_size;
+    size_t size;
     void *out_buf;
-    size_t cur_size;
     size_t out_size;
     ssize_t content_size;
     ssize_t write_at;
-    struct mk_list *head;
+    struct flb_router_route *route;
+    struct flb_filter_batch batch;
     struct flb_filter_instance *f_ins;
+    struct flb_filter_instance **filters;
 
-    /* For the incoming Tag make sure to create a NULL terminated reference */
-    ntag = flb_malloc(tag_len + 1);
-    if (!ntag) {
+    /* Lookup the filters that matches the Tag */
+    route = flb_router_route_get(tag, tag_len, config);
+    if (!route || route->filters_count == 0) {
+        return;
+    }
+
+    /*
+     * The route is owned by the router and might be invalidated if a filter
+     * ingest records (e.g: rewrite_tag), keep a local copy of the filters
+     * list together with a NULL terminated reference of the incoming Tag.
+     */
+    filters_count = route->filters_count;
+    size = sizeof(struct flb_filter_instance *) * filters_count;
+    filters = flb_malloc(size + tag_len + 1);
+    if (!filters) {
         flb_errno();
         flb_error("[filter] could not filter record due to memory problems");
         return;
     }
+    memcpy(filters, flb_router_route_filters(route), size);
+
+    ntag = ((char *) filters) + size;
     memcpy(ntag, tag, tag_len);
     ntag[tag_len] = '\0';
 
+    /*
+     * The chain works over a private buffer and the chunk is written only
+     * once at the end, 'buf' is the working buffer owned by this function.
+     */
     work_data = (const char *) data;
     work_size = bytes;
 
+    /* where to position the new content if modified ? */
+    content_size = cio_chunk_get_content_size(ic->chunk);
+    write_at = (content_size - bytes);
+
 #ifdef FLB_HAVE_METRICS
     /* Count number of incoming records */
     in_records = ic->added_records;
     pre_records = ic->total_records - in_records;
 #endif
 
-    /* Iterate filters */
-    mk_list_foreach(head, &config->filters) {
-        f_ins = mk_list_entry(head, struct flb_filter_instance, _head);
-        if (flb_router_match(ntag, tag_len, f_ins->match
-#ifdef FLB_HAVE_REGEX
-        , f_ins->match_regex
-#else
-        , NULL
-#endif
-           )) {
-            /* Reset filtered buffer */
-            out_buf = NULL;
-            out_size = 0;
-
-            content_size = cio_chunk_get_content_size(ic->chunk);
-
-            /* where to position the new content if modified ? */
-            write_at = (content_size - work_size);
-
-            /* Invoke the filter callback */
-            ret = f_ins->p->cb_filter(work_data,      /* msgpack buffer   */
-                                      work_size,      /* msgpack size     */
-                                      ntag, tag_len,  /* input tag        */
-                                      &out_buf,       /* new data         */
-                                      &out_size,      /* new data size    */
-                                      f_ins,          /* filter instance  */
-                                      f_ins->context, /* filter priv data */
-                                      config);
+    /* Iterate matched filters */
+    for (i = 0; i < filters_count; i++) {
+        f_ins = filters[i];
+
+        if (f_ins->p->cb_filter_batch) {
+            /* Decode once, the batch is shared by consecutive filters */
+            if (in_batch == FLB_FALSE) {
+                ret = flb_filter_batch_init(&batch, work_data, work_size);
+                if (ret == -1) {
+                    flb_error("[filter] could not decode records, skipping "
+                              "filter %s", flb_filter_name(f_ins));
+                    continue;
+                }
+                in_batch = FLB_TRUE;
+            }
 
-            /* Override buffer just if it was modified */
-            if (ret == FLB_FILTER_MODIFIED) {
-                /* all records removed, no data to continue processing */
-                if (out_size == 0) {
-                    /* reset data content length */
-                    flb_input_chunk_write_at(ic, write_at, "", 0);
+            f_ins->p->cb_filter_batch(&batch,          /* records batch    */
+                                      ntag, tag_len,   /* input tag        */
+                                      f_ins,           /* filter instance  */
+                                      f_ins->context,  /* filter priv data */
+                                      config);
 
 #ifdef FLB_HAVE_METRICS
-                    ic->total_records = pre_records;
+            if (batch.alive < in_records) {
+                diff = (in_records - batch.alive);
+                flb_metrics_sum(FLB_METRIC_N_DROPPED, diff, f_ins->metrics);
+                in_records = batch.alive;
+            }
+#endif
+            /* all records removed, no data to continue processing */
+            if (batch.alive == 0) {
+                break;
+            }
+            continue;
+        }
+
+        /* Plugins using the msgpack interface need the batch serialized */
+        if (in_batch == FLB_TRUE) {
+            filter_batch_release(&batch, &buf, &work_data, &work_size,
+                                 &modified);
+            in_batch = FLB_FALSE;
+        }
+
+        /* Reset filtered buffer */
+        out_buf = NULL;
+        out_size = 0;
+
+        /* Invoke the filter callback */
+        ret = f_ins->p->cb_filter(work_data,      /* msgpack buffer   */
+                                  work_size,      /* msgpack size     */
+                                  ntag, tag_len,  /* input tag        */
+                                  &out_buf,       /* new data         */
+                                  &out_size,      /* new data size    */
+                                  f_ins,          /* filter instance  */
+                                  f_ins->context, /* filter priv data */
+                                  config);
+
+        /* Override buffer just if it was modified */
+        if (ret != FLB_FILTER_MODIFIED) {
+            continue;
+        }
 
-                    /* Summarize all records removed */
-                    flb_metrics_sum(FLB_METRIC_N_DROPPED,
-                                    in_records, f_ins->metrics);
+        flb_free(buf);
+        buf = out_buf;
+        work_data = out_buf;
+        work_size = out_size;
+        modified = FLB_TRUE;
+
+        /* all records removed, no data to continue processing */
+        if (out_size == 0) {
+#ifdef FLB_HAVE_METRICS
+            /* Summarize all records removed */
+            flb_metrics_sum(FLB_METRIC_N_DROPPED,
+                            in_records, f_ins->metrics);
+            in_records = 0;
 #endif
-                    break;
-                }
-                else {
+            break;
+        }
+
 #ifdef FLB_HAVE_METRICS
-                    out_records = flb_mp_count(out_buf, out_size);
-                    if (out_records > in_records) {
-                        diff = (out_records - in_records);
-                        /* Summarize new records */
-                        flb_metrics_sum(FLB_METRIC_N_ADDED,
-                                        diff, f_ins->metrics);
-                    }
-                    else if (out_records < in_records) {
-                        diff = (in_records - out_records);
-                        /* Summarize dropped records */
-                        flb_metrics_sum(FLB_METRIC_N_DROPPED,
-                                        diff, f_ins->metrics);
-                    }
-
-                    /* set number of records in new chunk */
-                    in_records = out_records;
-                    ic->total_records = pre_records + in_records;
+        out_records = flb_mp_count(out_buf, out_size);
+        if (out_records > in_records) {
+            diff = (out_records - in_records);
+            /* Summarize new records */
+            flb_metrics_sum(FLB_METRIC_N_ADDED,
+                            diff, f_ins->metrics);
+        }
+        else if (out_records < in_records) {
+            diff = (in_records - out_records);
+            /* Summarize dropped records */
+            flb_metrics_sum(FLB_METRIC_N_DROPPED,
+                            diff, f_ins->metrics);
+        }
+        in_records = out_records;
 #endif
-                }
-                ret = flb_input_chunk_write_at(ic, write_at,
-                                               out_buf, out_size);
-                if (ret == -1) {
-                    flb_error("[filter] could not write data to storage. "
-                              "Skipping filtering.");
-                    flb_free(out_buf);
-                    continue;
-                }
+    }
 
-                /* Point back the 'data' pointer to the new address */
-                ret = cio_chunk_get_content(ic->chunk,
-                                            (char **) &work_data, &cur_size);
-                if (ret != CIO_OK) {
-                    flb_error("[filter] error retrieving data chunk");
-                }
-                else {
-                    work_data += (cur_size - out_size);
-                    work_size = out_size;
-                }
-                flb_free(out_buf);
-            }
+    if (in_batch == FLB_TRUE) {
+        filter_batch_release(&batch, &buf, &work_data, &work_size, &modified);
+    }
+
+    /* Replace the ingested data with the filtered content */
+    if (modified == FLB_TRUE) {
+        if (work_size == 0) {
+            work_data = "";
+        }
+        ret = flb_input_chunk_write_at(ic, write_at, work_data, work_size);
+        if (ret == -1) {
+            flb_error("[filter] could not write data to storage. "
+                      "Skipping filtering.");
         }
+#ifdef FLB_HAVE_METRICS
+        else {
+            /* set number of records in the chunk */
+            ic->total_records = pre_records + in_records;
+        }
+#endif
     }
 
-    flb_free(ntag);
+    flb_free(buf);
+    flb_free(filters);
 }
 
 int flb_filter_set_property(struct flb_filter_instance *ins,
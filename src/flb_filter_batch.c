@@ -0,0 +1,649 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_filter_batch.h>
+
+#include <msgpack.h>
+#include <string.h>
+
+#define BATCH_ZONE_CHUNK_SIZE   8192
+#define BATCH_RECORDS_INIT      64
+#define BATCH_COLUMNS_TABLE     16
+
+static int batch_grow(struct flb_filter_batch *batch)
+{
+    int size;
+    struct flb_batch_record *tmp;
+
+    if (batch->size == 0) {
+        size = BATCH_RECORDS_INIT;
+    }
+    else {
+        size = batch->size * 2;
+    }
+
+    tmp = flb_realloc(batch->records, sizeof(struct flb_batch_record) * size);
+    if (!tmp) {
+        flb_errno();
+        return -1;
+    }
+    batch->records = tmp;
+    batch->size = size;
+
+    return 0;
+}
+
+/* Decode all the records of a msgpack buffer into the batch arena */
+int flb_filter_batch_init(struct flb_filter_batch *batch,
+                          const void *data, size_t bytes)
+{
+    int ret;
+    size_t off = 0;
+    size_t prev = 0;
+    msgpack_object *obj;
+    struct flb_batch_record *rec;
+
+    batch->count = 0;
+    batch->alive = 0;
+    batch->modified = FLB_FALSE;
+    batch->size = 0;
+    batch->records = NULL;
+    batch->data = data;
+    batch->bytes = bytes;
+    batch->columns = NULL;
+
+    if (!msgpack_zone_init(&batch->zone, BATCH_ZONE_CHUNK_SIZE)) {
+        flb_errno();
+        return -1;
+    }
+
+    while (off < bytes) {
+        obj = msgpack_zone_malloc(&batch->zone, sizeof(msgpack_object));
+        if (!obj) {
+            flb_errno();
+            flb_filter_batch_destroy(batch);
+            return -1;
+        }
+
+        ret = msgpack_unpack(data, bytes, &off, &batch->zone, obj);
+        if (ret != MSGPACK_UNPACK_SUCCESS &&
+            ret != MSGPACK_UNPACK_EXTRA_BYTES) {
+            flb_error("[filter batch] invalid msgpack data at offset %zu",
+                      prev);
+            flb_filter_batch_destroy(batch);
+            return -1;
+        }
+
+        if (batch->count == batch->size && batch_grow(batch) == -1) {
+            flb_filter_batch_destroy(batch);
+            return -1;
+        }
+
+        rec = &batch->records[batch->count];
+        rec->flags = 0;
+        rec->ts = NULL;
+        rec->map = NULL;
+        rec->map_cap = 0;
+        rec->raw_off = prev;
+        rec->raw_size = off - prev;
+
+        /* Records are [timestamp, body], others are kept as opaque data */
+        if (obj->type == MSGPACK_OBJECT_ARRAY && obj->via.array.size == 2) {
+            rec->ts = &obj->via.array.ptr[0];
+            rec->map = &obj->via.array.ptr[1];
+        }
+
+        batch->count++;
+        prev = off;
+    }
+    batch->alive = batch->count;
+
+    return 0;
+}
+
+static void columns_destroy(struct flb_batch_columns *cols)
+{
+    int i;
+
+    for (i = 0; i < cols->keys; i++) {
+        flb_free(cols->columns[i]->values);
+        flb_free(cols->columns[i]);
+    }
+    flb_free(cols->columns);
+    flb_free(cols->table);
+    flb_free(cols->ts);
+    flb_free(cols);
+}
+
+void flb_filter_batch_destroy(struct flb_filter_batch *batch)
+{
+    if (batch->columns) {
+        columns_destroy(batch->columns);
+        batch->columns = NULL;
+    }
+    msgpack_zone_destroy(&batch->zone);
+    flb_free(batch->records);
+    batch->records = NULL;
+    batch->count = 0;
+    batch->alive = 0;
+    batch->size = 0;
+}
+
+/*
+ * Serialize the batch. Untouched records are copied as raw bytes from the
+ * original buffer, edited ones are packed from the arena. On success the
+ * caller owns 'out_buf'; if every record was dropped 'out_size' is zero and
+ * 'out_buf' is NULL.
+ */
+int flb_filter_batch_pack(struct flb_filter_batch *batch,
+                          char **out_buf, size_t *out_size)
+{
+    int i;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+    struct flb_batch_record *rec;
+
+    *out_buf = NULL;
+    *out_size = 0;
+
+    if (batch->alive == 0) {
+        return 0;
+    }
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+
+    for (i = 0; i < batch->count; i++) {
+        rec = &batch->records[i];
+
+        if (rec->flags & FLB_BATCH_RECORD_DROPPED) {
+            continue;
+        }
+
+        if (rec->flags & FLB_BATCH_RECORD_MODIFIED) {
+            msgpack_pack_array(&mp_pck, 2);
+            msgpack_pack_object(&mp_pck, *rec->ts);
+            msgpack_pack_object(&mp_pck, *rec->map);
+        }
+        else {
+            msgpack_sbuffer_write(&mp_sbuf, batch->data + rec->raw_off,
+                                  rec->raw_size);
+        }
+    }
+
+    *out_buf = mp_sbuf.data;
+    *out_size = mp_sbuf.size;
+
+    return 0;
+}
+
+/* FNV-1a of a column key */
+static inline uint32_t key_hash(const char *key, int len)
+{
+    int i;
+    uint32_t h = 2166136261u;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static struct flb_batch_column *columns_find(struct flb_batch_columns *cols,
+                                             const char *key, int key_len,
+                                             uint32_t hash)
+{
+    int slot;
+    int mask = cols->table_size - 1;
+    struct flb_batch_column *col;
+
+    for (slot = hash & mask; cols->table[slot] != 0; slot = (slot + 1) & mask) {
+        col = cols->columns[cols->table[slot] - 1];
+        if (col->hash == hash && col->key_len == key_len &&
+            memcmp(col->key, key, key_len) == 0) {
+            return col;
+        }
+    }
+    return NULL;
+}
+
+static int columns_table_grow(struct flb_batch_columns *cols)
+{
+    int i;
+    int slot;
+    int size = cols->table_size * 2;
+    int *table;
+
+    table = flb_calloc(size, sizeof(int));
+    if (!table) {
+        flb_errno();
+        return -1;
+    }
+
+    for (i = 0; i < cols->keys; i++) {
+        slot = cols->columns[i]->hash & (size - 1);
+        while (table[slot] != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        table[slot] = i + 1;
+    }
+
+    flb_free(cols->table);
+    cols->table = table;
+    cols->table_size = size;
+
+    return 0;
+}
+
+/* Intern a key, 'key' must live as long as the batch */
+static struct flb_batch_column *columns_add(struct flb_filter_batch *batch,
+                                            struct flb_batch_columns *cols,
+                                            const char *key, int key_len,
+                                            uint32_t hash)
+{
+    int slot;
+    int size;
+    struct flb_batch_column *col;
+    struct flb_batch_column **tmp;
+
+    if ((cols->keys + 1) * 2 > cols->table_size &&
+        columns_table_grow(cols) == -1) {
+        return NULL;
+    }
+
+    if (cols->keys == cols->keys_size) {
+        size = cols->keys_size > 0 ? cols->keys_size * 2 : 8;
+        tmp = flb_realloc(cols->columns,
+                          sizeof(struct flb_batch_column *) * size);
+        if (!tmp) {
+            flb_errno();
+            return NULL;
+        }
+        cols->columns = tmp;
+        cols->keys_size = size;
+    }
+
+    col = flb_malloc(sizeof(struct flb_batch_column));
+    if (!col) {
+        flb_errno();
+        return NULL;
+    }
+    col->values = flb_calloc(batch->count > 0 ? batch->count : 1,
+                             sizeof(msgpack_object *));
+    if (!col->values) {
+        flb_errno();
+        flb_free(col);
+        return NULL;
+    }
+    col->key = key;
+    col->key_len = key_len;
+    col->hash = hash;
+
+    cols->columns[cols->keys++] = col;
+    slot = hash & (cols->table_size - 1);
+    while (cols->table[slot] != 0) {
+        slot = (slot + 1) & (cols->table_size - 1);
+    }
+    cols->table[slot] = cols->keys;
+
+    return col;
+}
+
+/*
+ * Register the values of record 'i' in the columns, its entries must be
+ * clear. Keys not interned yet get a new column while the view is complete;
+ * if that's not possible the view turns incomplete and the key is left for
+ * flb_filter_batch_column() to resolve.
+ */
+static void columns_index(struct flb_filter_batch *batch,
+                          struct flb_batch_columns *cols, int i)
+{
+    int j;
+    uint32_t hash;
+    msgpack_object *map;
+    msgpack_object_kv *kv;
+    struct flb_batch_column *col;
+
+    map = flb_filter_batch_map(batch, i);
+    if (!map) {
+        return;
+    }
+
+    for (j = 0; j < map->via.map.size; j++) {
+        kv = &map->via.map.ptr[j];
+        if (kv->key.type != MSGPACK_OBJECT_STR) {
+            continue;
+        }
+
+        hash = key_hash(kv->key.via.str.ptr, kv->key.via.str.size);
+        col = columns_find(cols, kv->key.via.str.ptr, kv->key.via.str.size,
+                           hash);
+        if (!col) {
+            if (cols->complete == FLB_FALSE) {
+                continue;
+            }
+            if (cols->keys < FLB_BATCH_COLUMNS_MAX_KEYS) {
+                col = columns_add(batch, cols, kv->key.via.str.ptr,
+                                  kv->key.via.str.size, hash);
+            }
+            if (!col) {
+                cols->complete = FLB_FALSE;
+                continue;
+            }
+        }
+
+        /* duplicated keys resolve to the first one, like lookups do */
+        if (!col->values[i]) {
+            col->values[i] = &kv->val;
+        }
+    }
+}
+
+/* Refresh the column entries of a record after an edit */
+static void columns_update(struct flb_filter_batch *batch, int i)
+{
+    int k;
+    struct flb_batch_columns *cols = batch->columns;
+
+    if (!cols) {
+        return;
+    }
+
+    for (k = 0; k < cols->keys; k++) {
+        cols->columns[k]->values[i] = NULL;
+    }
+    columns_index(batch, cols, i);
+}
+
+/*
+ * Build the columnar view of the batch, or return the existing one. The
+ * view is owned by the batch and released with it.
+ */
+struct flb_batch_columns *flb_filter_batch_columns(struct flb_filter_batch *batch)
+{
+    int i;
+    struct flb_batch_columns *cols;
+    struct flb_batch_record *rec;
+
+    if (batch->columns) {
+        return batch->columns;
+    }
+
+    cols = flb_calloc(1, sizeof(struct flb_batch_columns));
+    if (!cols) {
+        flb_errno();
+        return NULL;
+    }
+    cols->complete = FLB_TRUE;
+    cols->table_size = BATCH_COLUMNS_TABLE;
+
+    cols->table = flb_calloc(cols->table_size, sizeof(int));
+    cols->ts = flb_calloc(batch->count > 0 ? batch->count : 1,
+                          sizeof(struct flb_time));
+    if (!cols->table || !cols->ts) {
+        flb_errno();
+        columns_destroy(cols);
+        return NULL;
+    }
+
+    for (i = 0; i < batch->count; i++) {
+        rec = &batch->records[i];
+        if (rec->ts && flb_time_msgpack_to_time(&cols->ts[i], rec->ts) == -1) {
+            flb_time_zero(&cols->ts[i]);
+        }
+        columns_index(batch, cols, i);
+    }
+
+    batch->columns = cols;
+    return cols;
+}
+
+/*
+ * Get the column of a top level key. On success 'column' is NULL when no
+ * record of the batch has the key.
+ */
+int flb_filter_batch_column(struct flb_filter_batch *batch,
+                            const char *key, int key_len,
+                            struct flb_batch_column **column)
+{
+    int i;
+    int idx;
+    uint32_t hash;
+    char *name;
+    msgpack_object *map;
+    struct flb_batch_column *col;
+    struct flb_batch_columns *cols;
+
+    *column = NULL;
+
+    cols = flb_filter_batch_columns(batch);
+    if (!cols) {
+        return -1;
+    }
+
+    hash = key_hash(key, key_len);
+    col = columns_find(cols, key, key_len, hash);
+    if (col || cols->complete == FLB_TRUE) {
+        *column = col;
+        return 0;
+    }
+
+    /* The key was not interned, collect its values now */
+    name = msgpack_zone_malloc_no_align(&batch->zone, key_len > 0 ? key_len : 1);
+    if (!name) {
+        flb_errno();
+        return -1;
+    }
+    memcpy(name, key, key_len);
+
+    col = columns_add(batch, cols, name, key_len, hash);
+    if (!col) {
+        return -1;
+    }
+
+    for (i = 0; i < batch->count; i++) {
+        idx = flb_filter_batch_map_lookup(batch, i, key, key_len);
+        if (idx >= 0) {
+            map = flb_filter_batch_map(batch, i);
+            col->values[i] = &map->via.map.ptr[idx].val;
+        }
+    }
+
+    *column = col;
+    return 0;
+}
+
+void flb_filter_batch_drop(struct flb_filter_batch *batch, int i)
+{
+    struct flb_batch_record *rec = &batch->records[i];
+
+    if (rec->flags & FLB_BATCH_RECORD_DROPPED) {
+        return;
+    }
+
+    rec->flags |= FLB_BATCH_RECORD_DROPPED;
+    batch->alive--;
+    batch->modified = FLB_TRUE;
+    columns_update(batch, i);
+}
+
+/* Find a string key in a record map, returns the kv index or -1 */
+int flb_filter_batch_map_lookup(struct flb_filter_batch *batch, int i,
+                                const char *key, int key_len)
+{
+    int j;
+    msgpack_object *map;
+    msgpack_object *k;
+
+    map = flb_filter_batch_map(batch, i);
+    if (!map) {
+        return -1;
+    }
+
+    for (j = 0; j < map->via.map.size; j++) {
+        k = &map->via.map.ptr[j].key;
+        if (k->type != MSGPACK_OBJECT_STR || k->via.str.size != key_len) {
+            continue;
+        }
+        if (strncmp(k->via.str.ptr, key, key_len) == 0) {
+            return j;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * Make sure the map of the record is a private copy in the arena with room
+ * for at least 'entries' key/value pairs.
+ */
+static int map_reserve(struct flb_filter_batch *batch,
+                       struct flb_batch_record *rec, int entries)
+{
+    int cap;
+    size_t size;
+    msgpack_object *map;
+    msgpack_object_kv *kv;
+
+    if (rec->map_cap >= entries) {
+        return 0;
+    }
+
+    cap = entries + FLB_BATCH_MAP_EXTRA;
+    if (rec->map_cap > 0 && cap < rec->map_cap * 2) {
+        cap = rec->map_cap * 2;
+    }
+
+    kv = msgpack_zone_malloc(&batch->zone, sizeof(msgpack_object_kv) * cap);
+    if (!kv) {
+        flb_errno();
+        return -1;
+    }
+
+    /* The first copy also detaches the map object from the decoded data */
+    if (rec->map_cap == 0) {
+        map = msgpack_zone_malloc(&batch->zone, sizeof(msgpack_object));
+        if (!map) {
+            flb_errno();
+            return -1;
+        }
+        *map = *rec->map;
+        rec->map = map;
+    }
+
+    size = sizeof(msgpack_object_kv) * rec->map->via.map.size;
+    if (size > 0) {
+        memcpy(kv, rec->map->via.map.ptr, size);
+    }
+    rec->map->via.map.ptr = kv;
+    rec->map_cap = cap;
+
+    return 0;
+}
+
+static inline void record_modified(struct flb_filter_batch *batch, int i)
+{
+    batch->records[i].flags |= FLB_BATCH_RECORD_MODIFIED;
+    batch->modified = FLB_TRUE;
+    columns_update(batch, i);
+}
+
+/* Append a key/value pair to the record map, objects are not copied */
+int flb_filter_batch_map_append(struct flb_filter_batch *batch, int i,
+                                msgpack_object *key, msgpack_object *val)
+{
+    msgpack_object *map;
+    msgpack_object_kv *kv;
+    struct flb_batch_record *rec;
+
+    map = flb_filter_batch_map(batch, i);
+    if (!map) {
+        return -1;
+    }
+
+    rec = &batch->records[i];
+    if (map_reserve(batch, rec, map->via.map.size + 1) == -1) {
+        return -1;
+    }
+
+    kv = &rec->map->via.map.ptr[rec->map->via.map.size];
+    kv->key = *key;
+    kv->val = *val;
+    rec->map->via.map.size++;
+    record_modified(batch, i);
+
+    return 0;
+}
+
+/* Remove the key/value pair at 'kv_index' keeping the order of the map */
+int flb_filter_batch_map_remove(struct flb_filter_batch *batch, int i,
+                                int kv_index)
+{
+    int n;
+    msgpack_object *map;
+    msgpack_object_kv *kv;
+    struct flb_batch_record *rec;
+
+    map = flb_filter_batch_map(batch, i);
+    if (!map || kv_index < 0 || kv_index >= map->via.map.size) {
+        return -1;
+    }
+
+    rec = &batch->records[i];
+    if (map_reserve(batch, rec, map->via.map.size) == -1) {
+        return -1;
+    }
+
+    kv = rec->map->via.map.ptr;
+    n = rec->map->via.map.size - kv_index - 1;
+    if (n > 0) {
+        memmove(&kv[kv_index], &kv[kv_index + 1],
+                sizeof(msgpack_object_kv) * n);
+    }
+    rec->map->via.map.size--;
+    record_modified(batch, i);
+
+    return 0;
+}
+
+/* Create a string object, the content is copied into the batch arena */
+int flb_filter_batch_str(struct flb_filter_batch *batch,
+                         const char *str, size_t len, msgpack_object *obj)
+{
+    char *buf;
+
+    buf = msgpack_zone_malloc_no_align(&batch->zone, len > 0 ? len : 1);
+    if (!buf) {
+        flb_errno();
+        return -1;
+    }
+    memcpy(buf, str, len);
+
+    obj->type = MSGPACK_OBJECT_STR;
+    obj->via.str.ptr = buf;
+    obj->via.str.size = len;
+
+    return 0;
+}
@@ -34,6 +34,25 @@ typedef enum {
     FCOMMENT = 16
 } flb_tinf_gzip_flag;
 
+struct flb_gzip_stream {
+    mz_stream strm;
+    mz_ulong crc;
+    size_t total_in;
+    int finished;
+
+    /* output callback */
+    int (*cb_out)(void *, const void *, size_t);
+    void *cb_data;
+
+    /* small writes are gathered before being compressed */
+    size_t in_len;
+    uint8_t in[FLB_GZIP_STREAM_BUF];
+
+    /* compressed data not handed to the callback yet */
+    size_t out_len;
+    uint8_t out[FLB_GZIP_STREAM_BUF];
+};
+
 static unsigned int read_le16(const unsigned char *p)
 {
     return ((unsigned int) p[0]) | ((unsigned int) p[1] << 8);
@@ -156,6 +175,182 @@ int flb_gzip_compress(void *in_data, size_t in_len,
     return 0;
 }
 
+static int gzip_stream_flush(struct flb_gzip_stream *gz)
+{
+    int ret;
+
+    if (gz->out_len == 0) {
+        return 0;
+    }
+
+    ret = gz->cb_out(gz->cb_data, gz->out, gz->out_len);
+    gz->out_len = 0;
+    return ret;
+}
+
+struct flb_gzip_stream *flb_gzip_stream_create(int (*cb_out)(void *,
+                                                             const void *,
+                                                             size_t),
+                                               void *cb_data)
+{
+    int ret;
+    struct flb_gzip_stream *gz;
+
+    gz = flb_malloc(sizeof(struct flb_gzip_stream));
+    if (!gz) {
+        flb_errno();
+        return NULL;
+    }
+    memset(&gz->strm, '\0', sizeof(gz->strm));
+    gz->crc = MZ_CRC32_INIT;
+    gz->total_in = 0;
+    gz->finished = FLB_FALSE;
+    gz->in_len = 0;
+    gz->cb_out = cb_out;
+    gz->cb_data = cb_data;
+
+    /* same settings than flb_gzip_compress() */
+    ret = deflateInit2(&gz->strm, Z_DEFAULT_COMPRESSION,
+                       Z_DEFLATED, -Z_DEFAULT_WINDOW_BITS, 9,
+                       Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        flb_error("[gzip] could not initialize stream");
+        flb_free(gz);
+        return NULL;
+    }
+
+    gzip_header(gz->out);
+    gz->out_len = FLB_GZIP_HEADER_OFFSET;
+
+    return gz;
+}
+
+/* Run deflate() over the pending input, handing out every full block */
+static int gzip_stream_deflate(struct flb_gzip_stream *gz, int flush)
+{
+    int status;
+
+    while (1) {
+        gz->strm.next_out = gz->out + gz->out_len;
+        gz->strm.avail_out = sizeof(gz->out) - gz->out_len;
+
+        status = deflate(&gz->strm, flush);
+        gz->out_len = sizeof(gz->out) - gz->strm.avail_out;
+
+        if (status != Z_OK && status != Z_STREAM_END &&
+            status != Z_BUF_ERROR) {
+            return -1;
+        }
+
+        if (gz->out_len == sizeof(gz->out)) {
+            if (gzip_stream_flush(gz) == -1) {
+                return -1;
+            }
+            continue;
+        }
+
+        if (status == Z_STREAM_END ||
+            (flush == Z_NO_FLUSH && gz->strm.avail_in == 0)) {
+            break;
+        }
+
+        /* no progress with room left in the output */
+        if (status == Z_BUF_ERROR) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int gzip_stream_input(struct flb_gzip_stream *gz,
+                             const void *data, size_t len)
+{
+    if (len == 0) {
+        return 0;
+    }
+
+    gz->crc = mz_crc32(gz->crc, data, len);
+    gz->strm.next_in = data;
+    gz->strm.avail_in = len;
+
+    return gzip_stream_deflate(gz, Z_NO_FLUSH);
+}
+
+int flb_gzip_stream_write(struct flb_gzip_stream *gz,
+                          const void *data, size_t len)
+{
+    int ret;
+
+    if (gz->finished == FLB_TRUE) {
+        return -1;
+    }
+    gz->total_in += len;
+
+    if (gz->in_len + len <= sizeof(gz->in)) {
+        memcpy(gz->in + gz->in_len, data, len);
+        gz->in_len += len;
+        return 0;
+    }
+
+    ret = gzip_stream_input(gz, gz->in, gz->in_len);
+    gz->in_len = 0;
+    if (ret == -1) {
+        return -1;
+    }
+
+    if (len >= sizeof(gz->in)) {
+        return gzip_stream_input(gz, data, len);
+    }
+
+    memcpy(gz->in, data, len);
+    gz->in_len = len;
+    return 0;
+}
+
+/* Compress the remaining data and append the GZip footer */
+int flb_gzip_stream_finish(struct flb_gzip_stream *gz)
+{
+    int i;
+    uint8_t footer[8];
+
+    if (gz->finished == FLB_TRUE) {
+        return -1;
+    }
+    gz->finished = FLB_TRUE;
+
+    if (gzip_stream_input(gz, gz->in, gz->in_len) == -1) {
+        return -1;
+    }
+    gz->in_len = 0;
+
+    if (gzip_stream_deflate(gz, Z_FINISH) == -1) {
+        return -1;
+    }
+
+    /* CRC32 and size of the uncompressed data */
+    for (i = 0; i < 4; i++) {
+        footer[i] = (gz->crc >> (i * 8)) & 0xFF;
+        footer[i + 4] = (gz->total_in >> (i * 8)) & 0xFF;
+    }
+
+    if (gz->out_len + sizeof(footer) > sizeof(gz->out)) {
+        if (gzip_stream_flush(gz) == -1) {
+            return -1;
+        }
+    }
+    memcpy(gz->out + gz->out_len, footer, sizeof(footer));
+    gz->out_len += sizeof(footer);
+
+    return gzip_stream_flush(gz);
+}
+
+void flb_gzip_stream_destroy(struct flb_gzip_stream *gz)
+{
+    deflateEnd(&gz->strm);
+    flb_free(gz);
+}
+
 /* Uncompress (inflate) GZip data */
 int flb_gzip_uncompress(void *in_data, size_t in_len,
                         void **out_data, size_t *out_len)
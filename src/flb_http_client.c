@@ -39,6 +39,7 @@
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_http_client.h>
 #include <fluent-bit/flb_http_client_debug.h>
+#include <fluent-bit/flb_upstream_pipeline.h>
 #include <fluent-bit/flb_utils.h>
 
 #include <mbedtls/base64.h>
@@ -843,6 +844,133 @@ int flb_http_add_header(struct flb_http_client *c,
     return 0;
 }
 
+/*
+ * Append a payload fragment. Fragments are sent after the body given to
+ * flb_http_client(), in order and without being copied: the caller keeps
+ * them valid until flb_http_do() returns. Content-Length is updated.
+ */
+int flb_http_add_body(struct flb_http_client *c,
+                      const char *buf, size_t len)
+{
+    int size;
+    int val_len;
+    char val[32];
+    flb_sds_t sds;
+    struct iovec *tmp;
+    struct flb_kv *kv;
+    struct mk_list *head;
+
+    if (len == 0) {
+        return 0;
+    }
+
+    if (c->body_iov_count == c->body_iov_size) {
+        size = c->body_iov_size ? c->body_iov_size * 2 : 8;
+        tmp = flb_realloc(c->body_iov, sizeof(struct iovec) * size);
+        if (!tmp) {
+            flb_errno();
+            return -1;
+        }
+        c->body_iov = tmp;
+        c->body_iov_size = size;
+    }
+
+    c->body_iov[c->body_iov_count].iov_base = (void *) buf;
+    c->body_iov[c->body_iov_count].iov_len = len;
+    c->body_iov_count++;
+    c->body_iov_len += len;
+
+    /* replace the Content-Length value */
+    val_len = snprintf(val, sizeof(val), "%zu",
+                       (size_t) c->body_len + c->body_iov_len);
+    mk_list_foreach(head, &c->headers) {
+        kv = mk_list_entry(head, struct flb_kv, _head);
+        if (flb_sds_casecmp(kv->key, "Content-Length", 14) == 0) {
+            flb_sds_len_set(kv->val, 0);
+            sds = flb_sds_cat(kv->val, val, val_len);
+            if (!sds) {
+                return -1;
+            }
+            kv->val = sds;
+            return 0;
+        }
+    }
+
+    return flb_http_add_header(c, "Content-Length", 14, val, val_len);
+}
+
+/*
+ * Let 'cb' write the payload from flb_http_do() through flb_http_write_body(),
+ * so it can be produced while it's sent instead of being built beforehand.
+ * The request uses chunked transfer encoding: the size is not known in
+ * advance. If the callback fails, the request is aborted.
+ */
+int flb_http_set_body_cb(struct flb_http_client *c,
+                         int (*cb)(struct flb_http_client *, void *),
+                         void *data)
+{
+    struct flb_kv *kv;
+    struct mk_list *tmp;
+    struct mk_list *head;
+
+    if (c->flags & FLB_HTTP_10 || c->body_len > 0 || c->body_iov_count > 0) {
+        flb_error("[http_client] chunked payload requires HTTP/1.1 and "
+                  "no body set");
+        return -1;
+    }
+
+    mk_list_foreach_safe(head, tmp, &c->headers) {
+        kv = mk_list_entry(head, struct flb_kv, _head);
+        if (flb_sds_casecmp(kv->key, "Content-Length", 14) == 0) {
+            flb_kv_item_destroy(kv);
+        }
+    }
+
+    c->body_cb = cb;
+    c->body_cb_data = data;
+
+    return flb_http_add_header(c, "Transfer-Encoding", 17, "chunked", 7);
+}
+
+static int http_writev(struct flb_http_client *c, struct iovec *iov,
+                       int iovcnt, int more, size_t *bytes)
+{
+    if (c->pl_req) {
+        return flb_upstream_pipeline_writev(c->u_conn, c->pl_req, iov, iovcnt,
+                                            more, bytes);
+    }
+    return flb_io_net_writev(c->u_conn, iov, iovcnt, bytes);
+}
+
+/* Send a payload chunk, only valid from the callback of flb_http_set_body_cb() */
+int flb_http_write_body(struct flb_http_client *c,
+                        const void *buf, size_t len)
+{
+    int ret;
+    int size_len;
+    char size[32];
+    size_t bytes;
+    struct iovec iov[3];
+
+    /* an empty chunk would end the payload */
+    if (len == 0) {
+        return 0;
+    }
+
+    size_len = snprintf(size, sizeof(size), "%zx\r\n", len);
+    iov[0].iov_base = size;
+    iov[0].iov_len = size_len;
+    iov[1].iov_base = (void *) buf;
+    iov[1].iov_len = len;
+    iov[2].iov_base = "\r\n";
+    iov[2].iov_len = 2;
+
+    ret = http_writev(c, iov, 3, FLB_TRUE, &bytes);
+    c->body_sent += bytes;
+
+    return ret;
+}
+
 static int http_header_push(struct flb_http_client *c, struct flb_kv *header)
 {
     char *tmp;
@@ -1025,6 +1153,48 @@ int flb_http_basic_auth(struct flb_http_client *c,
     return ret;
 }
 
+/*
+ * On a pipelined connection the bytes read past the end of the response
+ * belong to the next one, give them back to the connection.
+ */
+static void pipeline_response_done(struct flb_http_client *c,
+                                   struct flb_upstream_pipeline_req *req)
+{
+    size_t len = 0;
+    char *end;
+    struct flb_http_response *r = &c->resp;
+
+    if (!r->headers_end) {
+        flb_upstream_pipeline_abort(c->u_conn, req);
+        return;
+    }
+
+    if (r->content_length >= 0) {
+        end = r->headers_end + r->content_length;
+    }
+    else if (r->chunked_encoding == FLB_TRUE) {
+        end = r->chunk_processed_end;
+    }
+    else {
+        end = r->headers_end;
+
+        /* the body ends when the server closes the connection */
+        if (r->status != 204 && r->status != 304) {
+            flb_upstream_pipeline_abort(c->u_conn, req);
+            return;
+        }
+    }
+
+    if (end < r->data + r->data_len) {
+        len = (r->data + r->data_len) - end;
+    }
+    flb_upstream_pipeline_done(c->u_conn, req, end, len);
+
+    r->data_len -= len;
+    r->data[r->data_len] = '\0';
+    r->payload_size = r->data_len - (r->headers_end - r->data);
+}
+
 int flb_http_do(struct flb_http_client *c, size_t *bytes)
 {
     int ret;
@@ -1033,9 +1203,11 @@ int flb_http_do(struct flb_http_client *c, size_t *bytes)
     int new_size;
     ssize_t available;
     size_t out_size;
-    size_t bytes_header = 0;
-    size_t bytes_body = 0;
     char *tmp;
+    struct iovec iov_stack[2];
+    struct iovec *iov = iov_stack;
+    struct flb_upstream_pipeline *pl;
+    struct flb_upstream_pipeline_req req;
 
     /* Append pending headers */
     ret = http_headers_compose(c);
@@ -1068,28 +1240,55 @@ int flb_http_do(struct flb_http_client *c, size_t *bytes)
     }
 #endif
 
-    /* Write the header */
-    ret = flb_io_net_write(c->u_conn,
-                           c->header_buf, c->header_len,
-                           &bytes_header);
+    /* Header, body and body fragments go out in a single write */
+    if (c->body_iov_count > 0) {
+        iov = flb_malloc(sizeof(struct iovec) * (c->body_iov_count + 2));
+        if (!iov) {
+            flb_errno();
+            return -1;
+        }
+        memcpy(iov + 2, c->body_iov, sizeof(struct iovec) * c->body_iov_count);
+    }
+    iov[0].iov_base = c->header_buf;
+    iov[0].iov_len = c->header_len;
+    iov[1].iov_base = (void *) c->body_buf;
+    iov[1].iov_len = c->body_len > 0 ? c->body_len : 0;
+
+    /* Connections shared with other flushes send pipelined requests */
+    pl = flb_upstream_pipeline_get(c->u_conn);
+    c->pl_req = pl ? &req : NULL;
+
+    ret = http_writev(c, iov, c->body_iov_count + 2,
+                      c->body_cb ? FLB_TRUE : FLB_FALSE, bytes);
+    if (iov != iov_stack) {
+        flb_free(iov);
+    }
     if (ret == -1) {
         flb_errno();
         return -1;
     }
 
-    if (c->body_len > 0) {
-        ret = flb_io_net_write(c->u_conn,
-                               c->body_buf, c->body_len,
-                               &bytes_body);
-        if (ret == -1) {
-            flb_errno();
+    /* Payload written by the caller, then the last (empty) chunk */
+    if (c->body_cb) {
+        c->body_sent = 0;
+        ret = c->body_cb(c, c->body_cb_data);
+        *bytes += c->body_sent;
+        if (ret == 0) {
+            iov_stack[0].iov_base = "0\r\n\r\n";
+            iov_stack[0].iov_len = 5;
+            ret = http_writev(c, iov_stack, 1, FLB_FALSE, &out_size);
+            *bytes += out_size;
+        }
+        if (ret != 0) {
+            /* the server got an incomplete request */
+            flb_upstream_conn_recycle(c->u_conn, FLB_FALSE);
+            if (pl) {
+                flb_upstream_pipeline_abort(c->u_conn, &req);
+            }
             return -1;
         }
     }
 
-    /* number of sent bytes */
-    *bytes = (bytes_header + bytes_body);
-
     /* Read the server response, we need at least 19 bytes */
     c->resp.data_len = 0;
     while (1) {
@@ -1107,14 +1306,24 @@ int flb_http_do(struct flb_http_client *c, size_t *bytes)
                  * this.
                  */
                 flb_upstream_conn_recycle(c->u_conn, FLB_FALSE);
+                if (pl) {
+                    flb_upstream_pipeline_abort(c->u_conn, &req);
+                }
                 return 0;
             }
             available = flb_http_buffer_available(c) - 1;
         }
 
-        r_bytes = flb_io_net_read(c->u_conn,
-                                  c->resp.data + c->resp.data_len,
-                                  available);
+        if (pl) {
+            r_bytes = flb_upstream_pipeline_read(c->u_conn, &req,
+                                                 c->resp.data + c->resp.data_len,
+                                                 available);
+        }
+        else {
+            r_bytes = flb_io_net_read(c->u_conn,
+                                      c->resp.data + c->resp.data_len,
+                                      available);
+        }
         if (r_bytes <= 0) {
             if (c->flags & FLB_HTTP_10) {
                 break;
@@ -1128,6 +1337,9 @@ int flb_http_do(struct flb_http_client *c, size_t *bytes)
 
             ret = process_data(c);
             if (ret == FLB_HTTP_ERROR) {
+                if (pl) {
+                    flb_upstream_pipeline_abort(c->u_conn, &req);
+                }
                 return -1;
             }
             else if (ret == FLB_HTTP_OK) {
@@ -1140,10 +1352,17 @@ int flb_http_do(struct flb_http_client *c, size_t *bytes)
         else {
             flb_error("[http_client] broken connection to %s:%i ?",
                       c->u_conn->u->tcp_host, c->u_conn->u->tcp_port);
+            if (pl) {
+                flb_upstream_pipeline_abort(c->u_conn, &req);
+            }
             return -1;
         }
     }
 
+    if (pl) {
+        pipeline_response_done(c, &req);
+    }
+
     /* Check 'Connection' response header */
     ret = check_connection(c);
     if (ret == FLB_HTTP_OK) {
@@ -1174,6 +1393,7 @@ int flb_http_do(struct flb_http_client *c, size_t *bytes)
 void flb_http_client_destroy(struct flb_http_client *c)
 {
     http_headers_destroy(c);
+    flb_free(c->body_iov);
     flb_free(c->resp.data);
     flb_free(c->header_buf);
     flb_free((void *)c->proxy.host);
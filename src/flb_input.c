@@ -34,9 +34,15 @@
 #include <fluent-bit/flb_metrics.h>
 #include <fluent-bit/flb_storage.h>
 #include <fluent-bit/flb_kv.h>
+#include <fluent-bit/flb_input_worker.h>
 
 struct flb_libco_in_params libco_in_param;
 
+void flb_input_prepare()
+{
+    flb_input_worker_prepare();
+}
+
 #define protcmp(a, b)  strncasecmp(a, b, strlen(a))
 
 static int check_protocol(const char *prot, const char *output)
@@ -155,6 +161,8 @@ struct flb_input_instance *flb_input_new(struct flb_config *config,
         instance->context  = NULL;
         instance->data     = data;
         instance->threaded = FLB_FALSE;
+        instance->use_worker = FLB_FALSE;
+        instance->worker   = NULL;
         instance->storage  = NULL;
         instance->storage_type = -1;
         instance->log_level = -1;
@@ -176,10 +184,19 @@ struct flb_input_instance *flb_input_new(struct flb_config *config,
         /* Initialize properties list */
         flb_kv_init(&instance->properties);
 
+        /* Index of chunks available to append data by Tag */
+        instance->ht_chunks = flb_hash_create(FLB_HASH_EVICT_NONE,
+                                              FLB_INPUT_CHUNK_INDEX_SIZE, 0);
+        if (!instance->ht_chunks) {
+            flb_free(instance);
+            return NULL;
+        }
+
         /* Plugin use networking */
         if (plugin->flags & FLB_INPUT_NET) {
             ret = flb_net_host_set(plugin->name, &instance->host, input);
             if (ret != 0) {
+                flb_hash_destroy(instance->ht_chunks);
                 flb_free(instance);
                 return NULL;
             }
@@ -298,6 +315,10 @@ int flb_input_set_property(struct flb_input_instance *ins,
         ins->host.ipv6 = flb_utils_bool(tmp);
         flb_sds_destroy(tmp);
     }
+    else if (prop_key_check("worker", k, len) == 0 && tmp) {
+        ins->use_worker = flb_utils_bool(tmp);
+        flb_sds_destroy(tmp);
+    }
     else if (prop_key_check("storage.type", k, len) == 0 && tmp) {
         /* Set the storage type */
         if (strcasecmp(tmp, "filesystem") == 0) {
@@ -348,6 +369,11 @@ const char *flb_input_name(struct flb_input_instance *ins)
 
 void flb_input_instance_destroy(struct flb_input_instance *ins)
 {
+    if (ins->worker) {
+        flb_input_worker_destroy(ins->worker);
+        ins->worker = NULL;
+    }
+
     if (ins->alias) {
         flb_sds_destroy(ins->alias);
     }
@@ -370,6 +396,11 @@ void flb_input_instance_destroy(struct flb_input_instance *ins)
     /* release the tag if any */
     flb_sds_destroy(ins->tag);
 
+    /* chunks index by tag */
+    if (ins->ht_chunks) {
+        flb_hash_destroy(ins->ht_chunks);
+    }
+
     /* Let the engine remove any pending task */
     flb_engine_destroy_tasks(&ins->tasks);
 
@@ -459,6 +490,28 @@ int flb_input_instance_init(struct flb_input_instance *ins,
         }
     }
 
+    /*
+     * The worker context must exist before the plugin initialization, so
+     * the collectors and events registered by the plugin go to the worker
+     * event loop.
+     */
+    if (ins->use_worker == FLB_TRUE) {
+        if (!(p->flags & FLB_INPUT_THREAD_SAFE) || ins->threaded == FLB_TRUE) {
+            flb_warn("[input] %s does not support a worker thread, "
+                     "collectors run on the engine", flb_input_name(ins));
+            ins->use_worker = FLB_FALSE;
+        }
+        else {
+            ins->worker = flb_input_worker_create(ins, config);
+            if (!ins->worker) {
+                flb_error("[input] could not create worker for %s",
+                          flb_input_name(ins));
+                flb_input_instance_destroy(ins);
+                return -1;
+            }
+        }
+    }
+
     /* Initialize the input */
     if (p->cb_init) {
         /* Sanity check: all non-dynamic tag input plugins must have a tag */
@@ -537,6 +590,12 @@ void flb_input_instance_exit(struct flb_input_instance *ins,
 {
     struct flb_input_plugin *p;
 
+    /* The plugin cannot be running when its exit callback is invoked */
+    if (ins->worker) {
+        flb_input_worker_destroy(ins->worker);
+        ins->worker = NULL;
+    }
+
     p = ins->p;
     if (p->cb_exit && ins->context) {
         p->cb_exit(ins->context, config);
@@ -696,7 +755,7 @@ static int collector_start(struct flb_input_collector *coll,
     }
 
     event = &coll->event;
-    evl = config->evl;
+    evl = flb_input_event_loop(coll->instance);
 
     if (coll->type == FLB_COLLECT_TIME) {
         event->mask = MK_EVENT_EMPTY;
@@ -758,13 +817,22 @@ int flb_input_collectors_start(struct flb_config *config)
 {
     struct mk_list *head;
     struct flb_input_collector *collector;
+    struct flb_input_instance *ins;
 
-    /* For each Collector, register the event into the main loop */
+    /* For each Collector, register the event into its event loop */
     mk_list_foreach(head, &config->collectors) {
         collector = mk_list_entry(head, struct flb_input_collector, _head);
         collector_start(collector, config);
     }
 
+    /* Collectors are in place, start the workers */
+    mk_list_foreach(head, &config->inputs) {
+        ins = mk_list_entry(head, struct flb_input_instance, _head);
+        if (ins->worker) {
+            flb_input_worker_start(ins->worker);
+        }
+    }
+
     return 0;
 }
 
@@ -808,7 +876,7 @@ int flb_input_pause_all(struct flb_config *config)
         if (flb_input_buf_paused(in) == FLB_FALSE) {
             if (in->p->cb_pause && in->context) {
                 flb_info("[input] pausing %s", flb_input_name(in));
-                in->p->cb_pause(in->context, in->config);
+                flb_input_pause(in);
             }
             paused++;
         }
@@ -818,10 +886,49 @@ int flb_input_pause_all(struct flb_config *config)
     return paused;
 }
 
+/*
+ * Invoke the pause callback of the instance. If the collectors run on a
+ * worker, the request is forwarded so the callback runs in that thread.
+ */
+void flb_input_pause(struct flb_input_instance *ins)
+{
+    if (ins->worker) {
+        flb_input_worker_command(ins->worker, FLB_INPUT_WORKER_PAUSE);
+        return;
+    }
+
+    if (ins->p->cb_pause && ins->context) {
+        ins->p->cb_pause(ins->context, ins->config);
+    }
+}
+
+/* Invoke the resume callback of the instance, see flb_input_pause() */
+void flb_input_resume(struct flb_input_instance *ins)
+{
+    if (ins->worker) {
+        flb_input_worker_command(ins->worker, FLB_INPUT_WORKER_RESUME);
+        return;
+    }
+
+    if (ins->p->cb_resume && ins->context) {
+        ins->p->cb_resume(ins->context, ins->config);
+    }
+}
+
+/* Event loop where the instance collectors and events are registered */
+struct mk_event_loop *flb_input_event_loop(struct flb_input_instance *ins)
+{
+    if (ins->worker) {
+        return ins->worker->evl;
+    }
+
+    return ins->config->evl;
+}
+
 int flb_input_collector_pause(int coll_id, struct flb_input_instance *in)
 {
     int ret;
-    struct flb_config *config;
+    struct mk_event_loop *evl;
     struct flb_input_collector *coll;
 
     coll = get_collector(coll_id, in);
@@ -833,19 +940,19 @@ int flb_input_collector_pause(int coll_id, struct flb_input_instance *in)
         return 0;
     }
 
-    config = in->config;
+    evl = flb_input_event_loop(in);
     if (coll->type == FLB_COLLECT_TIME) {
         /*
          * For a collector time, it's better to just remove the file
          * descriptor associated to the time out, when resumed a new
          * one can be created.
          */
-        mk_event_timeout_destroy(config->evl, &coll->event);
+        mk_event_timeout_destroy(evl, &coll->event);
         mk_event_closesocket(coll->fd_timer);
         coll->fd_timer = -1;
     }
     else if (coll->type & (FLB_COLLECT_FD_SERVER | FLB_COLLECT_FD_EVENT)) {
-        ret = mk_event_del(config->evl, &coll->event);
+        ret = mk_event_del(evl, &coll->event);
         if (ret != 0) {
             flb_warn("[input] cannot disable event for %s", in->name);
             return -1;
@@ -864,6 +971,7 @@ int flb_input_collector_resume(int coll_id, struct flb_input_instance *in)
     struct flb_input_collector *coll;
     struct flb_config *config;
     struct mk_event *event;
+    struct mk_event_loop *evl;
 
     coll = get_collector(coll_id, in);
     if (!coll) {
@@ -878,6 +986,7 @@ int flb_input_collector_resume(int coll_id, struct flb_input_instance *in)
 
     config = in->config;
     event = &coll->event;
+    evl = flb_input_event_loop(in);
 
     /* If data ingestion has been paused, the collector cannot resume */
     if (config->is_ingestion_active == FLB_FALSE) {
@@ -887,7 +996,7 @@ int flb_input_collector_resume(int coll_id, struct flb_input_instance *in)
     if (coll->type == FLB_COLLECT_TIME) {
         event->mask = MK_EVENT_EMPTY;
         event->status = MK_EVENT_NONE;
-        fd = mk_event_timeout_create(config->evl, coll->seconds,
+        fd = mk_event_timeout_create(evl, coll->seconds,
                                      coll->nanoseconds, event);
         if (fd == -1) {
             flb_error("[input collector] resume COLLECT_TIME failed");
@@ -900,7 +1009,7 @@ int flb_input_collector_resume(int coll_id, struct flb_input_instance *in)
         event->mask   = MK_EVENT_EMPTY;
         event->status = MK_EVENT_NONE;
 
-        ret = mk_event_add(config->evl,
+        ret = mk_event_add(evl,
                            coll->fd_event,
                            FLB_ENGINE_EV_CORE,
                            MK_EVENT_READ, event);
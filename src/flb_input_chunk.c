@@ -21,6 +21,7 @@
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_input_chunk.h>
+#include <fluent-bit/flb_input_worker.h>
 #include <fluent-bit/flb_storage.h>
 #include <fluent-bit/flb_time.h>
 #include <fluent-bit/flb_router.h>
@@ -94,7 +95,7 @@ static int flb_input_chunk_is_task_safe_delete(struct flb_task *task)
 
 int flb_input_chunk_safe_delete(struct flb_input_chunk *ic,
                                 struct flb_input_chunk *old_ic,
-                                uint64_t o_mask_id)
+                                int o_mask_id)
 {
     /* The chunk we want to drop should not be the incoming chunk */
     if (ic == old_ic) {
@@ -106,7 +107,7 @@ int flb_input_chunk_safe_delete(struct flb_input_chunk *ic,
      * the routes_mask could be modified when new chunks is ingested. Therefore,
      * we still need to do the validation on the routes_mask with mask_id.
      */
-    if ((old_ic->routes_mask & o_mask_id) == 0) {
+    if (flb_routes_mask_get_bit(old_ic->routes_mask, o_mask_id) == 0) {
         return FLB_FALSE;
     }
 
@@ -167,10 +168,11 @@ int flb_intput_chunk_count_dropped_chunks(struct flb_input_chunk *ic,
  * reach the limit when buffering the new data
  */
 int flb_input_chunk_find_space_new_data(struct flb_input_chunk *ic,
-                                        uint64_t overlimit_routes_mask,
+                                        flb_route_mask_element *overlimit_routes_mask,
                                         size_t chunk_size)
 {
     int count;
+    int mask_size;
     ssize_t old_ic_bytes;
     struct mk_list *tmp;
     struct mk_list *head;
@@ -183,12 +185,13 @@ int flb_input_chunk_find_space_new_data(struct flb_input_chunk *ic,
      * removed. We will adjust the routes_mask to only route to the output plugin
      * that have enough space after deleting some chunks fome the queue.
      */
+    mask_size = ic->in->config->routes_mask_size;
     mk_list_foreach(head, &ic->in->config->outputs) {
         count = 0;
         o_ins = mk_list_entry(head, struct flb_output_instance, _head);
 
-        if ((o_ins->total_limit_size == -1) ||
-            (ic->routes_mask & o_ins->mask_id) == 0) {
+        if (flb_routes_mask_get_bit(overlimit_routes_mask,
+                                    o_ins->mask_id) == 0) {
             continue;
         }
 
@@ -202,7 +205,7 @@ int flb_input_chunk_find_space_new_data(struct flb_input_chunk *ic,
              */
             flb_error("[input chunk] no enough space in filesystem to buffer "
                       "chunk %s in plugin %s", flb_input_chunk_get_name(ic), o_ins->name);
-            ic->routes_mask ^= o_ins->mask_id;
+            flb_routes_mask_clear_bit(ic->routes_mask, o_ins->mask_id);
             continue;
         }
 
@@ -222,14 +225,14 @@ int flb_input_chunk_find_space_new_data(struct flb_input_chunk *ic,
 
             old_ic_bytes = flb_input_chunk_get_size(old_ic);
             /* drop chunk by adjusting the routes_mask */
-            old_ic->routes_mask ^= o_ins->mask_id;
+            flb_routes_mask_clear_bit(old_ic->routes_mask, o_ins->mask_id);
             o_ins->fs_chunks_size -= old_ic_bytes;
 
             flb_debug("[input chunk] remove route of chunk %s with size %ld bytes to output plugin %s "
                       "to place the incoming data with size %ld bytes", flb_input_chunk_get_name(old_ic),
                       old_ic_bytes, o_ins->name, chunk_size);
 
-            if (old_ic->routes_mask == 0) {
+            if (flb_routes_mask_is_empty(old_ic->routes_mask, mask_size)) {
                 if (old_ic->task != NULL) {
                     /*
                      * If the chunk is referenced by a task and task has no active route,
@@ -260,21 +263,24 @@ int flb_input_chunk_find_space_new_data(struct flb_input_chunk *ic,
 }
 
 /*
- * Returns routes_mask of output instances that will reach the limit
- * after buffering the new data
+ * Set in routes_mask the output instances that will reach the limit after
+ * buffering the new data, returns the number of output instances set.
  */
-uint64_t flb_input_chunk_get_overlimit_routes_mask(struct flb_input_chunk *ic,
-                                                   size_t chunk_size)
+int flb_input_chunk_get_overlimit_routes_mask(struct flb_input_chunk *ic,
+                                              size_t chunk_size,
+                                              flb_route_mask_element *routes_mask)
 {
-    uint64_t routes_mask = 0;
+    int mask_size;
     struct mk_list *head;
     struct flb_output_instance *o_ins;
 
+    mask_size = ic->in->config->routes_mask_size;
+    flb_routes_mask_clear(routes_mask, mask_size);
+
     mk_list_foreach(head, &ic->in->config->outputs) {
         o_ins = mk_list_entry(head, struct flb_output_instance, _head);
 
-        if ((o_ins->total_limit_size == -1) ||
-            (ic->routes_mask & o_ins->mask_id) == 0) {
+        if (o_ins->total_limit_size == -1) {
             continue;
         }
 
@@ -284,30 +290,149 @@ uint64_t flb_input_chunk_get_overlimit_routes_mask(struct flb_input_chunk *ic,
                   o_ins->name);
 
         if (o_ins->fs_chunks_size + chunk_size > o_ins->total_limit_size) {
-            routes_mask |= o_ins->mask_id;
+            flb_routes_mask_set_bit(routes_mask, o_ins->mask_id);
+        }
+    }
+
+    /* only the output instances the chunk routes to are relevant */
+    flb_routes_mask_and(routes_mask, ic->routes_mask, mask_size);
+
+    return flb_routes_mask_popcount(routes_mask, mask_size);
+}
+
+/*
+ * Find a slot for the incoming data to buffer it in local file system,
+ * returns the number of output instances the chunk still routes to.
+ */
+int flb_input_chunk_place_new_chunk(struct flb_input_chunk *ic, size_t chunk_size)
+{
+    int ret;
+    int mask_size;
+    flb_route_mask_element buf[16];
+    flb_route_mask_element *overlimit_routes_mask = buf;
+
+    /* use the stack unless there are more than 1024 output instances */
+    mask_size = ic->in->config->routes_mask_size;
+    if (mask_size > (sizeof(buf) / sizeof(flb_route_mask_element))) {
+        overlimit_routes_mask = flb_malloc(sizeof(flb_route_mask_element) *
+                                           mask_size);
+        if (!overlimit_routes_mask) {
+            flb_errno();
+            return 0;
         }
     }
 
-    return routes_mask;
+    ret = flb_input_chunk_get_overlimit_routes_mask(ic, chunk_size,
+                                                    overlimit_routes_mask);
+    if (ret > 0) {
+        flb_input_chunk_find_space_new_data(ic, overlimit_routes_mask,
+                                            chunk_size);
+    }
+
+    if (overlimit_routes_mask != buf) {
+        flb_free(overlimit_routes_mask);
+    }
+
+    return flb_routes_mask_popcount(ic->routes_mask, mask_size);
 }
 
-/* Find a slot for the incoming data to buffer it in local file system */
-uint64_t flb_input_chunk_place_new_chunk(struct flb_input_chunk *ic, size_t chunk_size)
+/*
+ * Every input instance keeps an index (ins->ht_chunks) of the chunk that is
+ * open to append new data for each Tag, so the ingestion path doesn't need
+ * to scan the list of chunks. The value stored is the chunk reference.
+ */
+static void chunk_index_add(struct flb_input_chunk *ic)
 {
-    uint64_t overlimit_routes_mask;
-    overlimit_routes_mask = flb_input_chunk_get_overlimit_routes_mask(ic, chunk_size);
-    if (overlimit_routes_mask != 0) {
-        flb_input_chunk_find_space_new_data(ic, overlimit_routes_mask, chunk_size);
+    int len;
+
+    if (!ic->tag) {
+        return;
+    }
+
+    /* the hash table keys are strings, skip tags with NULL bytes */
+    len = flb_sds_len(ic->tag);
+    if (len == 0 || memchr(ic->tag, '\0', len)) {
+        return;
     }
 
-    return ic->routes_mask;
+    flb_hash_add(ic->in->ht_chunks, ic->tag, len,
+                 (const char *) &ic, sizeof(ic));
+}
+
+/* Remove the chunk from the index, only if it's the one referenced */
+static void chunk_index_del(struct flb_input_chunk *ic)
+{
+    int ret;
+    size_t size;
+    const char *val;
+    struct flb_input_chunk *cur;
+
+    if (!ic->tag || flb_sds_len(ic->tag) == 0) {
+        return;
+    }
+
+    ret = flb_hash_get(ic->in->ht_chunks, ic->tag, flb_sds_len(ic->tag),
+                       &val, &size);
+    if (ret == -1) {
+        return;
+    }
+
+    memcpy(&cur, val, sizeof(cur));
+    if (cur == ic) {
+        flb_hash_del(ic->in->ht_chunks, ic->tag);
+    }
+}
+
+/* Lookup the chunk open for the given Tag, if it can still receive data */
+static struct flb_input_chunk *chunk_index_get(struct flb_input_instance *in,
+                                               const char *tag, int tag_len)
+{
+    int ret;
+    size_t size;
+    const char *val;
+    struct flb_input_chunk *ic;
+
+    ret = flb_hash_get(in->ht_chunks, tag, tag_len, &val, &size);
+    if (ret == -1) {
+        return NULL;
+    }
+    memcpy(&ic, val, sizeof(ic));
+
+    /*
+     * A chunk being flushed or locked is removed from the index when that
+     * happens, a chunk 'down' stays but data can't be appended until it
+     * comes up again.
+     */
+    if (ic->busy == FLB_TRUE || cio_chunk_is_locked(ic->chunk) ||
+        cio_chunk_is_up(ic->chunk) == CIO_FALSE) {
+        return NULL;
+    }
+
+    return ic;
+}
+
+/* Allocate an input chunk context with room for its routes mask */
+static struct flb_input_chunk *input_chunk_alloc(struct flb_input_instance *in)
+{
+    struct flb_input_chunk *ic;
+
+    ic = flb_malloc(sizeof(struct flb_input_chunk) +
+                    sizeof(flb_route_mask_element) *
+                    in->config->routes_mask_size);
+    if (!ic) {
+        flb_errno();
+        return NULL;
+    }
+    ic->routes_mask = (flb_route_mask_element *) (ic + 1);
+
+    return ic;
 }
 
 /* Create an input chunk using a Chunk I/O */
 struct flb_input_chunk *flb_input_chunk_map(struct flb_input_instance *in,
                                             void *chunk)
 {
-    uint64_t chunk_routes_mask;
+    int routes;
 
 #ifdef FLB_HAVE_METRICS
     int ret;
@@ -317,15 +442,15 @@ struct flb_input_chunk *flb_input_chunk_map(struct flb_input_instance *in,
     struct flb_input_chunk *ic;
 
     /* Create context for the input instance */
-    ic = flb_malloc(sizeof(struct flb_input_chunk));
+    ic = input_chunk_alloc(in);
     if (!ic) {
-        flb_errno();
         return NULL;
     }
 
     ic->busy = FLB_FALSE;
     ic->fs_backlog = FLB_TRUE;
     ic->chunk = chunk;
+    ic->tag = NULL;
     ic->in = in;
     msgpack_packer_init(&ic->mp_pck, ic, flb_input_chunk_write);
     mk_list_add(&ic->_head, &in->chunks);
@@ -344,12 +469,12 @@ struct flb_input_chunk *flb_input_chunk_map(struct flb_input_instance *in,
     }
 #endif
 
-    chunk_routes_mask = flb_router_get_routes_mask_by_tag(in->tag, in->tag_len, in);
-    if (chunk_routes_mask == 0) {
+    routes = flb_router_get_routes_mask_by_tag(in->tag, in->tag_len, in,
+                                               ic->routes_mask);
+    if (routes <= 0) {
         flb_warn("[input chunk] no matching route for backoff log chunk %s",
                  flb_input_chunk_get_name(ic));
     }
-    ic->routes_mask = chunk_routes_mask;
 
     return ic;
 }
@@ -359,8 +484,8 @@ struct flb_input_chunk *flb_input_chunk_create(struct flb_input_instance *in,
 {
     int ret;
     int err;
+    int routes;
     int set_down = FLB_FALSE;
-    uint64_t chunk_routes_mask;
     char name[64];
     struct cio_chunk *chunk;
     struct flb_storage_input *storage;
@@ -409,9 +534,8 @@ struct flb_input_chunk *flb_input_chunk_create(struct flb_input_instance *in,
     }
 
     /* Create context for the input instance */
-    ic = flb_malloc(sizeof(struct flb_input_chunk));
+    ic = input_chunk_alloc(in);
     if (!ic) {
-        flb_errno();
         cio_chunk_close(chunk, CIO_TRUE);
         return NULL;
     }
@@ -421,20 +545,27 @@ struct flb_input_chunk *flb_input_chunk_create(struct flb_input_instance *in,
     ic->in = in;
     ic->stream_off = 0;
     ic->task = NULL;
+    ic->tag = flb_sds_create_len(tag, tag_len);
+    if (!ic->tag) {
+        flb_free(ic);
+        cio_chunk_close(chunk, CIO_TRUE);
+        return NULL;
+    }
 #ifdef FLB_HAVE_METRICS
     ic->total_records = 0;
 #endif
 
     /* Calculate the routes_mask for the input chunk */
-    chunk_routes_mask = flb_router_get_routes_mask_by_tag(tag, tag_len, in);
-    if (chunk_routes_mask == 0) {
+    routes = flb_router_get_routes_mask_by_tag(tag, tag_len, in,
+                                               ic->routes_mask);
+    if (routes <= 0) {
         flb_warn("[input chunk] no matching route for input chunk %s",
                  flb_input_chunk_get_name(ic));
     }
-    ic->routes_mask = chunk_routes_mask;
 
     msgpack_packer_init(&ic->mp_pck, ic, flb_input_chunk_write);
     mk_list_add(&ic->_head, &in->chunks);
+    chunk_index_add(ic);
 
     if (set_down == FLB_TRUE) {
         cio_chunk_down(chunk);
@@ -457,11 +588,16 @@ int flb_input_chunk_destroy(struct flb_input_chunk *ic, int del)
         }
 
         bytes = flb_input_chunk_get_size(ic);
-        if ((ic->routes_mask & o_ins->mask_id) > 0) {
+        if (flb_routes_mask_get_bit(ic->routes_mask, o_ins->mask_id)) {
             o_ins->fs_chunks_size -= bytes;
         }
     }
 
+    chunk_index_del(ic);
+    if (ic->tag) {
+        flb_sds_destroy(ic->tag);
+    }
+
     cio_chunk_close(ic->chunk, del);
     mk_list_del(&ic->_head);
     flb_free(ic);
@@ -475,28 +611,10 @@ static struct flb_input_chunk *input_chunk_get(const char *tag, int tag_len,
                                                size_t chunk_size)
 {
     int new_chunk = FLB_FALSE;
-    struct mk_list *head;
     struct flb_input_chunk *ic = NULL;
 
     /* Try to find a current chunk context to append the data */
-    mk_list_foreach_r(head, &in->chunks) {
-        ic = mk_list_entry(head, struct flb_input_chunk, _head);
-        if (ic->busy == FLB_TRUE || cio_chunk_is_locked(ic->chunk)) {
-            ic = NULL;
-            continue;
-        }
-
-        if (cio_chunk_is_up(ic->chunk) == CIO_FALSE) {
-            ic = NULL;
-            continue;
-        }
-
-        if (cio_meta_cmp(ic->chunk, (char *) tag, tag_len) != 0) {
-            ic = NULL;
-            continue;
-        }
-        break;
-    }
+    ic = chunk_index_get(in, tag, tag_len);
 
     /* No chunk was found, we need to create a new one */
     if (!ic) {
@@ -512,7 +630,8 @@ static struct flb_input_chunk *input_chunk_get(const char *tag, int tag_len,
      * that the chunk will flush to, we need to modify the routes_mask of the oldest chunks
      * (based in creation time) to get enough space for the incoming chunk.
      */
-    if (ic->routes_mask != 0 &&
+    if (!flb_routes_mask_is_empty(ic->routes_mask,
+                                  in->config->routes_mask_size) &&
         flb_input_chunk_place_new_chunk(ic, chunk_size) == 0) {
         /*
          * If the chunk is not newly created, the chunk might already have logs inside.
@@ -595,7 +714,7 @@ size_t flb_input_chunk_set_limits(struct flb_input_instance *in)
         in->config->is_ingestion_active == FLB_TRUE) {
         in->mem_buf_status = FLB_INPUT_RUNNING;
         if (in->p->cb_resume) {
-            in->p->cb_resume(in->context, in->config);
+            flb_input_resume(in);
             flb_info("[input] %s resume (mem buf overlimit)",
                       in->name);
         }
@@ -615,7 +734,7 @@ static inline int flb_input_chunk_protect(struct flb_input_instance *i)
                  i->name);
         if (!flb_input_buf_paused(i)) {
             if (i->p->cb_pause) {
-                i->p->cb_pause(i->context, i->config);
+                flb_input_pause(i);
             }
         }
         i->mem_buf_status = FLB_INPUT_PAUSED;
@@ -697,12 +816,24 @@ int flb_input_chunk_append_raw(struct flb_input_instance *in,
     struct flb_storage_input *si;
 
     /* Check if the input plugin has been paused */
-    if (flb_input_buf_paused(in) == FLB_TRUE) {
+    if (flb_input_buf_paused(in) == FLB_TRUE &&
+        (!in->worker || flb_input_worker_get() == in->worker)) {
         flb_debug("[input chunk] %s is paused, cannot append records",
                   in->name);
         return -1;
     }
 
+    /*
+     * Records appended from an input worker thread are handed to the engine
+     * through the worker ring buffer. The engine appends them later calling
+     * this function again, at that point the records were already accepted
+     * so they are not discarded if the instance got paused in the meantime.
+     */
+    if (in->worker && flb_input_worker_get() == in->worker) {
+        return flb_input_worker_append(in->worker, tag, tag_len,
+                                       buf, buf_size);
+    }
+
     /*
      * Some callers might not set a custom tag, on that case just inherit
      * the fixed instance tag or instance name.
@@ -767,8 +898,19 @@ int flb_input_chunk_append_raw(struct flb_input_instance *in,
     size = cio_chunk_get_content_size(ic->chunk);
 
     /* Lock buffers where size > 2MB */
+    si = (struct flb_storage_input *) in->storage;
     if (size > FLB_INPUT_CHUNK_FS_MAX_SIZE) {
         cio_chunk_lock(ic->chunk);
+        chunk_index_del(ic);
+
+        /*
+         * With storage compression the full chunk is put down right away,
+         * so it's compressed on disk until it gets flushed.
+         */
+        if (si->type == CIO_STORE_FS &&
+            ((struct cio_ctx *) si->cio)->compression != CIO_COMPRESS_NONE) {
+            set_down = FLB_TRUE;
+        }
     }
 
     /* Make sure the data was not filtered out and the buffer size is zero */
@@ -819,7 +961,6 @@ int flb_input_chunk_append_raw(struct flb_input_instance *in,
      * descriptor will be released. At any later time, it must be bring up
      * for I/O operations.
      */
-    si = (struct flb_storage_input *) in->storage;
     if (flb_input_chunk_is_overlimit(in) == FLB_TRUE &&
         si->type == CIO_STORE_FS) {
         if (cio_chunk_is_up(ic->chunk) == CIO_TRUE) {
@@ -880,6 +1021,9 @@ const void *flb_input_chunk_flush(struct flb_input_chunk *ic, size_t *size)
     /* Lock the internal chunk */
     cio_chunk_lock(ic->chunk);
 
+    /* No more data can be appended */
+    chunk_index_del(ic);
+
     return buf;
 }
 
@@ -938,7 +1082,7 @@ void flb_input_chunk_update_output_instances(struct flb_input_chunk *ic,
             continue;
         }
 
-        if ((ic->routes_mask & o_ins->mask_id) > 0) {
+        if (flb_routes_mask_get_bit(ic->routes_mask, o_ins->mask_id)) {
             /*
              * if there is match on any index of 1's in the binary, it indicates
              * that the input chunk will flush to this output instance
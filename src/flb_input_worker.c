@@ -0,0 +1,387 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include <monkey/mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_worker.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_input_chunk.h>
+#include <fluent-bit/flb_input_worker.h>
+
+FLB_TLS_DEFINE(struct flb_in_worker, flb_in_worker_ctx);
+
+void flb_input_worker_prepare()
+{
+    FLB_TLS_INIT(flb_in_worker_ctx);
+}
+
+/* Returns the input worker running in the current thread, if any */
+struct flb_in_worker *flb_input_worker_get()
+{
+    return FLB_TLS_GET(flb_in_worker_ctx);
+}
+
+/*
+ * Copy the records appended by the plugin into the ring buffer. If the ring
+ * is full the worker waits until the engine consumes some records, this is
+ * the back pressure applied to a worker faster than the engine.
+ */
+int flb_input_worker_append(struct flb_in_worker *worker,
+                            const char *tag, size_t tag_len,
+                            const void *buf, size_t buf_size)
+{
+    int n;
+    int notify = FLB_FALSE;
+    size_t pos;
+    uint64_t val = 1;
+    struct flb_in_worker_record *rec;
+
+    /* Record, tag and buffer are stored in the same memory block */
+    rec = flb_malloc(sizeof(struct flb_in_worker_record) + tag_len + buf_size);
+    if (!rec) {
+        flb_errno();
+        return -1;
+    }
+
+    rec->tag = NULL;
+    rec->tag_len = 0;
+    rec->buf = ((char *) rec) + sizeof(struct flb_in_worker_record);
+    if (tag) {
+        rec->tag = rec->buf;
+        rec->tag_len = tag_len;
+        memcpy(rec->tag, tag, tag_len);
+        rec->buf += tag_len;
+    }
+    rec->size = buf_size;
+    memcpy(rec->buf, buf, buf_size);
+
+    pthread_mutex_lock(&worker->lock);
+    while (worker->ring_count == worker->ring_size &&
+           worker->stopping == FLB_FALSE) {
+        pthread_cond_wait(&worker->cond, &worker->lock);
+    }
+
+    if (worker->stopping == FLB_TRUE) {
+        pthread_mutex_unlock(&worker->lock);
+        flb_free(rec);
+        return -1;
+    }
+
+    pos = (worker->ring_head + worker->ring_count) % worker->ring_size;
+    worker->ring[pos] = rec;
+    worker->ring_count++;
+
+    if (worker->notified == FLB_FALSE) {
+        worker->notified = FLB_TRUE;
+        notify = FLB_TRUE;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    /* Wake up the engine only if it's not already draining the ring */
+    if (notify == FLB_TRUE) {
+        n = flb_pipe_w(worker->ch_ring[1], &val, sizeof(val));
+        if (n == -1) {
+            flb_errno();
+        }
+    }
+
+    return 0;
+}
+
+/* Append every record in the ring buffer, it runs in the engine thread */
+static void worker_drain(struct flb_in_worker *worker)
+{
+    struct flb_in_worker_record *rec;
+
+    while (1) {
+        pthread_mutex_lock(&worker->lock);
+        if (worker->ring_count == 0) {
+            worker->notified = FLB_FALSE;
+            pthread_mutex_unlock(&worker->lock);
+            break;
+        }
+
+        rec = worker->ring[worker->ring_head];
+        worker->ring[worker->ring_head] = NULL;
+        worker->ring_head = (worker->ring_head + 1) % worker->ring_size;
+        worker->ring_count--;
+        pthread_cond_signal(&worker->cond);
+        pthread_mutex_unlock(&worker->lock);
+
+        flb_input_chunk_append_raw(worker->ins, rec->tag, rec->tag_len,
+                                   rec->buf, rec->size);
+        flb_free(rec);
+    }
+}
+
+/* Engine event handler: the worker appended records */
+static int cb_worker_ring(void *data)
+{
+    int n;
+    uint64_t val;
+    struct flb_in_worker *worker = data;
+
+    n = flb_pipe_r(worker->ch_ring[0], &val, sizeof(val));
+    if (n <= 0) {
+        flb_errno();
+        return -1;
+    }
+
+    worker_drain(worker);
+    return 0;
+}
+
+/* Run the collector that owns the file descriptor */
+static void worker_collect(struct flb_in_worker *worker, flb_pipefd_t fd)
+{
+    struct mk_list *head;
+    struct flb_input_collector *coll;
+    struct flb_input_instance *ins = worker->ins;
+
+    mk_list_foreach(head, &ins->collectors) {
+        coll = mk_list_entry(head, struct flb_input_collector, _head_ins);
+        if (coll->fd_event == fd) {
+            break;
+        }
+        else if (coll->fd_timer == fd) {
+            flb_utils_timer_consume(fd);
+            break;
+        }
+        coll = NULL;
+    }
+
+    if (!coll || coll->running == FLB_FALSE) {
+        return;
+    }
+
+    coll->cb_collect(ins, worker->config, ins->context);
+}
+
+static void worker_loop(void *data)
+{
+    int n;
+    int running = FLB_TRUE;
+    uint64_t cmd;
+    struct mk_event *event;
+    struct flb_in_worker *worker = data;
+    struct flb_input_instance *ins = worker->ins;
+
+    FLB_TLS_SET(flb_in_worker_ctx, worker);
+
+    flb_debug("[input] worker for %s started", flb_input_name(ins));
+
+    while (running) {
+        mk_event_wait(worker->evl);
+        mk_event_foreach(event, worker->evl) {
+            if (event == &worker->event_cmd) {
+                n = flb_pipe_r(worker->ch_events[0], &cmd, sizeof(cmd));
+                if (n <= 0) {
+                    flb_errno();
+                    continue;
+                }
+
+                if (cmd == FLB_INPUT_WORKER_STOP) {
+                    running = FLB_FALSE;
+                }
+                else if (cmd == FLB_INPUT_WORKER_PAUSE) {
+                    if (ins->p->cb_pause && ins->context) {
+                        ins->p->cb_pause(ins->context, ins->config);
+                    }
+                }
+                else if (cmd == FLB_INPUT_WORKER_RESUME) {
+                    if (ins->p->cb_resume && ins->context) {
+                        ins->p->cb_resume(ins->context, ins->config);
+                    }
+                }
+            }
+            else if (event->type == FLB_ENGINE_EV_CORE) {
+                worker_collect(worker, event->fd);
+            }
+            else if (event->type == FLB_ENGINE_EV_CUSTOM) {
+                event->handler(event);
+            }
+        }
+    }
+
+    flb_debug("[input] worker for %s stopped", flb_input_name(ins));
+}
+
+/* Send a command to the worker thread */
+int flb_input_worker_command(struct flb_in_worker *worker, uint64_t cmd)
+{
+    int n;
+
+    n = flb_pipe_w(worker->ch_events[1], &cmd, sizeof(cmd));
+    if (n == -1) {
+        flb_errno();
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Create the worker context: event loop and channels. It's done before the
+ * plugin initialization so the plugin can register its own events in the
+ * worker event loop (see flb_input_event_loop()).
+ */
+struct flb_in_worker *flb_input_worker_create(struct flb_input_instance *ins,
+                                              struct flb_config *config)
+{
+    int ret;
+    struct mk_event *event;
+    struct flb_in_worker *worker;
+
+    worker = flb_calloc(1, sizeof(struct flb_in_worker));
+    if (!worker) {
+        flb_errno();
+        return NULL;
+    }
+    worker->ins = ins;
+    worker->config = config;
+    worker->ch_ring[0] = -1;
+    worker->ch_ring[1] = -1;
+    worker->ch_events[0] = -1;
+    worker->ch_events[1] = -1;
+    worker->ring_size = FLB_INPUT_WORKER_RING_SIZE;
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->cond, NULL);
+
+    worker->ring = flb_calloc(worker->ring_size,
+                              sizeof(struct flb_in_worker_record *));
+    if (!worker->ring) {
+        flb_errno();
+        flb_input_worker_destroy(worker);
+        return NULL;
+    }
+
+    worker->evl = mk_event_loop_create(256);
+    if (!worker->evl) {
+        flb_input_worker_destroy(worker);
+        return NULL;
+    }
+
+    /* Commands from the engine */
+    MK_EVENT_ZERO(&worker->event_cmd);
+    ret = mk_event_channel_create(worker->evl,
+                                  &worker->ch_events[0],
+                                  &worker->ch_events[1],
+                                  &worker->event_cmd);
+    if (ret != 0) {
+        worker->ch_events[0] = -1;
+        flb_input_worker_destroy(worker);
+        return NULL;
+    }
+
+    /* Records notifications, handled by the engine event loop */
+    ret = flb_pipe_create(worker->ch_ring);
+    if (ret == -1) {
+        flb_errno();
+        worker->ch_ring[0] = -1;
+        flb_input_worker_destroy(worker);
+        return NULL;
+    }
+
+    event = &worker->event;
+    MK_EVENT_NEW(event);
+    event->fd      = worker->ch_ring[0];
+    event->type    = FLB_ENGINE_EV_CUSTOM;
+    event->handler = cb_worker_ring;
+    ret = mk_event_add(config->evl, worker->ch_ring[0],
+                       FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, event);
+    if (ret == -1) {
+        flb_input_worker_destroy(worker);
+        return NULL;
+    }
+
+    return worker;
+}
+
+/* Spawn the worker thread, collectors must be registered already */
+int flb_input_worker_start(struct flb_in_worker *worker)
+{
+    int ret;
+
+    ret = flb_worker_create(worker_loop, worker, &worker->tid, worker->config);
+    if (ret == -1) {
+        flb_error("[input] could not start worker for %s",
+                  flb_input_name(worker->ins));
+        return -1;
+    }
+
+    flb_info("[input] %s running on a worker thread",
+             flb_input_name(worker->ins));
+    return 0;
+}
+
+/*
+ * Stop the worker thread and release the context. Records still in the ring
+ * buffer are appended before returning.
+ */
+void flb_input_worker_destroy(struct flb_in_worker *worker)
+{
+    int ret;
+
+    if (worker->tid) {
+        ret = flb_input_worker_command(worker, FLB_INPUT_WORKER_STOP);
+
+        /* A worker waiting for space in the ring must not block the stop */
+        pthread_mutex_lock(&worker->lock);
+        worker->stopping = FLB_TRUE;
+        pthread_cond_broadcast(&worker->cond);
+        pthread_mutex_unlock(&worker->lock);
+
+        if (ret == 0) {
+            pthread_join(worker->tid, NULL);
+        }
+        worker->tid = 0;
+    }
+
+    if (worker->ring) {
+        worker_drain(worker);
+        flb_free(worker->ring);
+    }
+
+    if (worker->ch_ring[0] > 0) {
+        if (worker->event.status == MK_EVENT_REGISTERED) {
+            mk_event_del(worker->config->evl, &worker->event);
+        }
+        flb_pipe_close(worker->ch_ring[0]);
+        flb_pipe_close(worker->ch_ring[1]);
+    }
+    if (worker->ch_events[0] > 0) {
+        mk_event_del(worker->evl, &worker->event_cmd);
+        flb_pipe_close(worker->ch_events[0]);
+        flb_pipe_close(worker->ch_events[1]);
+    }
+    if (worker->evl) {
+        mk_event_loop_destroy(worker->evl);
+    }
+
+    pthread_cond_destroy(&worker->cond);
+    pthread_mutex_destroy(&worker->lock);
+    flb_free(worker);
+}
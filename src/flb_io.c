@@ -45,11 +45,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <assert.h>
 
 #include <monkey/mk_core.h>
 #include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_io.h>
 #include <fluent-bit/flb_io_tls.h>
@@ -242,11 +244,10 @@ static int net_io_connect_async(struct flb_upstream *u,
     return 0;
 }
 
-FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
-                                  struct flb_thread *th)
+/* Create the socket of a connection, bound to 'net.source_address' if set */
+static int net_io_socket_create(struct flb_upstream_conn *u_conn)
 {
     int ret;
-    int async = FLB_FALSE;
     flb_sockfd_t fd = -1;
     struct flb_upstream *u = u_conn->u;
     struct sockaddr_storage addr;
@@ -333,6 +334,23 @@ FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
     /* Disable Nagle's algorithm */
     flb_net_socket_tcp_nodelay(fd);
 
+    return 0;
+}
+
+FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
+                                  struct flb_thread *th)
+{
+    int ret;
+    int async = FLB_FALSE;
+    flb_sockfd_t fd;
+    struct flb_upstream *u = u_conn->u;
+
+    ret = net_io_socket_create(u_conn);
+    if (ret == -1) {
+        return -1;
+    }
+    fd = u_conn->fd;
+
     /* Check which connection mode must be done */
     if (th) {
         async = flb_upstream_is_async(u);
@@ -371,6 +389,38 @@ FLB_INLINE int flb_io_net_connect(struct flb_upstream_conn *u_conn,
     return 0;
 }
 
+/*
+ * Start a connection without waiting for it, the socket is left in
+ * non-blocking mode: the caller waits for it to be writable and checks the
+ * result with SO_ERROR. Returns -1 if the connection failed already.
+ */
+int flb_io_net_connect_start(struct flb_upstream_conn *u_conn)
+{
+    int ret;
+    int err;
+    struct flb_upstream *u = u_conn->u;
+
+    ret = net_io_socket_create(u_conn);
+    if (ret == -1) {
+        return -1;
+    }
+    flb_net_socket_nonblocking(u_conn->fd);
+
+    ret = flb_net_tcp_fd_connect(u_conn->fd, u->tcp_host, u->tcp_port);
+    if (ret == -1) {
+        err = flb_socket_error(u_conn->fd);
+        if (!FLB_EINPROGRESS(err) && err != 0) {
+            flb_error("[io] connection #%i failed to: %s:%i",
+                      u_conn->fd, u->tcp_host, u->tcp_port);
+            flb_socket_close(u_conn->fd);
+            u_conn->fd = -1;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 static int net_io_write(struct flb_upstream_conn *u_conn,
                         const void *data, size_t len, size_t *out_len)
 {
@@ -413,6 +463,100 @@ static int net_io_write(struct flb_upstream_conn *u_conn,
     return total;
 }
 
+/*
+ * The socket would block: wait in the event loop until it's writable again
+ * and check the connection status. Returns 0 if the write can be retried.
+ */
+static int net_io_write_wait(struct flb_thread *th,
+                             struct flb_upstream_conn *u_conn)
+{
+    int ret;
+    int error = 0;
+    uint32_t mask;
+    socklen_t slen = sizeof(error);
+    char so_error_buf[256];
+    struct flb_upstream *u = u_conn->u;
+
+    u_conn->thread = th;
+    ret = mk_event_add(u->evl,
+                       u_conn->fd,
+                       FLB_ENGINE_EV_THREAD,
+                       MK_EVENT_WRITE, &u_conn->event);
+    if (ret == -1) {
+        /*
+         * If we failed here there no much that we can do, just
+         * let the caller we failed
+         */
+        return -1;
+    }
+
+    /*
+     * Return the control to the parent caller, we need to wait for
+     * the event loop to get back to us.
+     */
+    flb_thread_yield(th, FLB_FALSE);
+
+    /* Save events mask since mk_event_del() will reset it */
+    mask = u_conn->event.mask;
+
+    /* We got a notification, remove the event registered */
+    ret = mk_event_del(u->evl, &u_conn->event);
+    if (ret == -1) {
+        return -1;
+    }
+
+    /* Check the connection status */
+    if ((mask & MK_EVENT_WRITE) == 0) {
+        return -1;
+    }
+
+    ret = getsockopt(u_conn->fd, SOL_SOCKET, SO_ERROR, &error, &slen);
+    if (ret == -1) {
+        flb_error("[io] could not validate socket status");
+        return -1;
+    }
+
+    if (error != 0) {
+        /* Connection is broken, not much to do here */
+        strerror_r(error, so_error_buf, sizeof(so_error_buf) - 1);
+        flb_error("[io fd=%i] error sending data to: %s:%i (%s)",
+                  u_conn->fd,
+                  u->tcp_host, u->tcp_port, so_error_buf);
+
+        return -1;
+    }
+
+    MK_EVENT_NEW(&u_conn->event);
+    return 0;
+}
+
+/* Partial write: yield until the event loop reports the socket writable */
+static int net_io_write_yield(struct flb_thread *th,
+                              struct flb_upstream_conn *u_conn)
+{
+    int ret;
+    struct flb_upstream *u = u_conn->u;
+
+    if (u_conn->event.status == MK_EVENT_NONE) {
+        u_conn->event.mask = MK_EVENT_EMPTY;
+        u_conn->thread = th;
+        ret = mk_event_add(u->evl,
+                           u_conn->fd,
+                           FLB_ENGINE_EV_THREAD,
+                           MK_EVENT_WRITE, &u_conn->event);
+        if (ret == -1) {
+            /*
+             * If we failed here there no much that we can do, just
+             * let the caller we failed
+             */
+            return -1;
+        }
+    }
+    flb_thread_yield(th, MK_FALSE);
+
+    return 0;
+}
+
 /*
  * Perform Async socket write(2) operations. This function depends on a main
  * event-loop and the co-routines interface to yield/resume once sockets are
@@ -426,18 +570,12 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
                                          const void *data, size_t len, size_t *out_len)
 {
     int ret = 0;
-    int error;
-    uint32_t mask;
     ssize_t bytes;
     size_t total = 0;
     size_t to_send;
-    socklen_t slen = sizeof(error);
-    char so_error_buf[256];
     struct flb_upstream *u = u_conn->u;
 
  retry:
-    error = 0;
-
     if (len - total > 524288) {
         to_send = 524288;
     }
@@ -458,96 +596,150 @@ static FLB_INLINE int net_io_write_async(struct flb_thread *th,
 #endif
 
     if (bytes == -1) {
-        if (FLB_WOULDBLOCK()) {
-            u_conn->thread = th;
-            ret = mk_event_add(u->evl,
-                               u_conn->fd,
-                               FLB_ENGINE_EV_THREAD,
-                               MK_EVENT_WRITE, &u_conn->event);
-            if (ret == -1) {
-                /*
-                 * If we failed here there no much that we can do, just
-                 * let the caller we failed
-                 */
-                return -1;
-            }
+        if (FLB_WOULDBLOCK() && net_io_write_wait(th, u_conn) == 0) {
+            goto retry;
+        }
+        return -1;
+    }
 
-            /*
-             * Return the control to the parent caller, we need to wait for
-             * the event loop to get back to us.
-             */
-            flb_thread_yield(th, FLB_FALSE);
+    /* Update counters */
+    total += bytes;
+    if (total < len) {
+        if (net_io_write_yield(th, u_conn) == -1) {
+            return -1;
+        }
+        goto retry;
+    }
 
-            /* Save events mask since mk_event_del() will reset it */
-            mask = u_conn->event.mask;
+    if (u_conn->event.status & MK_EVENT_REGISTERED) {
+        /* We got a notification, remove the event registered */
+        ret = mk_event_del(u->evl, &u_conn->event);
+        assert(ret == 0);
+    }
 
-            /* We got a notification, remove the event registered */
-            ret = mk_event_del(u->evl, &u_conn->event);
-            if (ret == -1) {
-                return -1;
-            }
+    *out_len = total;
+    return bytes;
+}
 
-            /* Check the connection status */
-            if (mask & MK_EVENT_WRITE) {
-                ret = getsockopt(u_conn->fd, SOL_SOCKET, SO_ERROR, &error, &slen);
-                if (ret == -1) {
-                    flb_error("[io] could not validate socket status");
-                    return -1;
-                }
+/* Skip the first 'bytes' of a vector, returns the number of buffers left */
+int flb_io_iov_advance(struct iovec **iov, int iovcnt, size_t bytes)
+{
+    struct iovec *v = *iov;
 
-                if (error != 0) {
-                    /* Connection is broken, not much to do here */
-                    strerror_r(error, so_error_buf, sizeof(so_error_buf) - 1);
-                    flb_error("[io fd=%i] error sending data to: %s:%i (%s)",
-                              u_conn->fd,
-                              u->tcp_host, u->tcp_port, so_error_buf);
+    while (iovcnt > 0 && bytes >= v->iov_len) {
+        bytes -= v->iov_len;
+        v++;
+        iovcnt--;
+    }
 
-                    return -1;
-                }
+    if (iovcnt > 0) {
+        v->iov_base = (char *) v->iov_base + bytes;
+        v->iov_len -= bytes;
+    }
 
-                MK_EVENT_NEW(&u_conn->event);
-                goto retry;
-            }
-            else {
-                return -1;
-            }
+    *iov = v;
+    return iovcnt;
+}
 
+static ssize_t net_io_sendv(int fd, struct iovec *iov, int iovcnt)
+{
+#ifdef FLB_SYSTEM_WINDOWS
+    /* one buffer per call, the callers loop over partial writes */
+    return send(fd, iov->iov_base, iov->iov_len, 0);
+#else
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt > FLB_IO_IOV_MAX ? FLB_IO_IOV_MAX : iovcnt;
+
+    return sendmsg(fd, &msg, 0);
+#endif
+}
+
+static int net_io_writev(struct flb_upstream_conn *u_conn,
+                         struct iovec *iov, int iovcnt, size_t *out_len)
+{
+    int ret;
+    int tries = 0;
+    ssize_t bytes;
+    size_t total = 0;
+
+    if (u_conn->fd <= 0) {
+        struct flb_thread *th;
+        th = (struct flb_thread *) pthread_getspecific(flb_thread_key);
+        ret = flb_io_net_connect(u_conn, th);
+        if (ret == -1) {
+            return -1;
         }
-        else {
+    }
+
+    while (iovcnt > 0) {
+        bytes = net_io_sendv(u_conn->fd, iov, iovcnt);
+        if (bytes == -1) {
+            if (FLB_WOULDBLOCK()) {
+                /* same lazy handling than net_io_write() */
+                sleep(1);
+                tries++;
+
+                if (tries == 30) {
+                    return -1;
+                }
+                continue;
+            }
             return -1;
         }
+        tries = 0;
+        total += bytes;
+        iovcnt = flb_io_iov_advance(&iov, iovcnt, bytes);
+    }
+
+    *out_len = total;
+    return 0;
+}
+
+/* Async version of net_io_writev(), see net_io_write_async() */
+static FLB_INLINE int net_io_writev_async(struct flb_thread *th,
+                                          struct flb_upstream_conn *u_conn,
+                                          struct iovec *iov, int iovcnt,
+                                          size_t *out_len)
+{
+    int ret;
+    ssize_t bytes;
+    size_t total = 0;
+    struct flb_upstream *u = u_conn->u;
+
+ retry:
+    bytes = net_io_sendv(u_conn->fd, iov, iovcnt);
+
+#ifdef FLB_HAVE_TRACE
+    flb_trace("[io thread=%p] [fd %i] writev_async(2)=%d (%lu, %i buffers)",
+              th, u_conn->fd, bytes, total, iovcnt);
+#endif
+
+    if (bytes == -1) {
+        if (FLB_WOULDBLOCK() && net_io_write_wait(th, u_conn) == 0) {
+            goto retry;
+        }
+        return -1;
     }
 
-    /* Update counters */
     total += bytes;
-    if (total < len) {
-        if (u_conn->event.status == MK_EVENT_NONE) {
-            u_conn->event.mask = MK_EVENT_EMPTY;
-            u_conn->thread = th;
-            ret = mk_event_add(u->evl,
-                               u_conn->fd,
-                               FLB_ENGINE_EV_THREAD,
-                               MK_EVENT_WRITE, &u_conn->event);
-            if (ret == -1) {
-                /*
-                 * If we failed here there no much that we can do, just
-                 * let the caller we failed
-                 */
-                return -1;
-            }
+    iovcnt = flb_io_iov_advance(&iov, iovcnt, bytes);
+    if (iovcnt > 0) {
+        if (net_io_write_yield(th, u_conn) == -1) {
+            return -1;
         }
-        flb_thread_yield(th, MK_FALSE);
         goto retry;
     }
 
     if (u_conn->event.status & MK_EVENT_REGISTERED) {
-        /* We got a notification, remove the event registered */
         ret = mk_event_del(u->evl, &u_conn->event);
         assert(ret == 0);
     }
 
     *out_len = total;
-    return bytes;
+    return 0;
 }
 
 static ssize_t net_io_read(struct flb_upstream_conn *u_conn,
@@ -640,6 +832,172 @@ int flb_io_net_write(struct flb_upstream_conn *u_conn, const void *data,
     return ret;
 }
 
+/*
+ * Write a list of buffers with the least number of calls: a single
+ * sendmsg(2) for plain TCP. TLS has no vectored write, buffers that fit
+ * in one record are copied together, larger ones are written in turn.
+ */
+static int net_io_tls_writev(struct flb_upstream_conn *u_conn,
+                             struct iovec *iov, int iovcnt, size_t len,
+                             size_t *out_len)
+{
+    int i;
+    int ret;
+    char *buf;
+    size_t off = 0;
+    size_t bytes;
+
+    if (iovcnt > 1 && len <= FLB_IO_TLS_COALESCE_MAX) {
+        buf = flb_malloc(len);
+        if (!buf) {
+            flb_errno();
+            return -1;
+        }
+        for (i = 0; i < iovcnt; i++) {
+            memcpy(buf + off, iov[i].iov_base, iov[i].iov_len);
+            off += iov[i].iov_len;
+        }
+        ret = flb_io_net_write(u_conn, buf, len, out_len);
+        flb_free(buf);
+        return ret == -1 ? -1 : 0;
+    }
+
+    *out_len = 0;
+    for (i = 0; i < iovcnt; i++) {
+        ret = flb_io_net_write(u_conn, iov[i].iov_base, iov[i].iov_len,
+                               &bytes);
+        if (ret == -1) {
+            return -1;
+        }
+        *out_len += bytes;
+    }
+
+    return 0;
+}
+
+/* Write a vector of buffers to an upstream connection, returns 0 or -1 */
+int flb_io_net_writev(struct flb_upstream_conn *u_conn,
+                      const struct iovec *iov, int iovcnt, size_t *out_len)
+{
+    int i;
+    int ret = -1;
+    size_t len = 0;
+    struct iovec vec_stack[8];
+    struct iovec *vec = vec_stack;
+    struct iovec *pos;
+    struct flb_upstream *u = u_conn->u;
+    struct flb_thread *th = pthread_getspecific(flb_thread_key);
+
+    *out_len = 0;
+
+    /* the vector is consumed while writing, work on a copy */
+    if (iovcnt > sizeof(vec_stack) / sizeof(struct iovec)) {
+        vec = flb_malloc(sizeof(struct iovec) * iovcnt);
+        if (!vec) {
+            flb_errno();
+            return -1;
+        }
+    }
+    for (i = 0; i < iovcnt; i++) {
+        vec[i] = iov[i];
+        len += iov[i].iov_len;
+    }
+
+    /* skip leading empty buffers */
+    pos = vec;
+    iovcnt = flb_io_iov_advance(&pos, iovcnt, 0);
+
+    flb_trace("[io thread=%p] [net_writev] trying %zd bytes, %i buffers",
+              th, len, iovcnt);
+
+    if (iovcnt == 0) {
+        ret = 0;
+    }
+    else if (u->flags & FLB_IO_TCP) {
+        if (u->flags & FLB_IO_ASYNC) {
+            ret = net_io_writev_async(th, u_conn, pos, iovcnt, out_len);
+        }
+        else {
+            ret = net_io_writev(u_conn, pos, iovcnt, out_len);
+        }
+
+        if (ret == -1 && u_conn->fd > 0) {
+            flb_socket_close(u_conn->fd);
+            u_conn->fd = -1;
+            u_conn->event.fd = -1;
+        }
+    }
+    else {
+        ret = net_io_tls_writev(u_conn, pos, iovcnt, len, out_len);
+    }
+
+    if (vec != vec_stack) {
+        flb_free(vec);
+    }
+
+    flb_trace("[io thread=%p] [net_writev] ret=%i total=%lu/%lu",
+              th, ret, *out_len, len);
+    return ret;
+}
+
+/*
+ * Non-blocking write and read for callers running their own wait loop, like
+ * connections shared by pipelined requests. They return the number of bytes
+ * transferred, or 0 if the socket would block, 'mask' is then set to the
+ * event to wait for. Errors and a connection closed by the peer return -1.
+ *
+ * TLS writes one buffer per call.
+ */
+ssize_t flb_io_net_try_writev(struct flb_upstream_conn *u_conn,
+                              const struct iovec *iov, int iovcnt, int *mask)
+{
+    ssize_t ret = -1;
+    struct flb_upstream *u = u_conn->u;
+
+    *mask = 0;
+    if (u->flags & FLB_IO_TCP) {
+        ret = net_io_sendv(u_conn->fd, (struct iovec *) iov, iovcnt);
+        if (ret == -1 && FLB_WOULDBLOCK()) {
+            *mask = MK_EVENT_WRITE;
+            ret = 0;
+        }
+    }
+#ifdef FLB_HAVE_TLS
+    else if (u->flags & FLB_IO_TLS) {
+        ret = flb_io_tls_net_try_write(u_conn, iov->iov_base, iov->iov_len,
+                                       mask);
+    }
+#endif
+
+    return ret;
+}
+
+ssize_t flb_io_net_try_read(struct flb_upstream_conn *u_conn,
+                            void *buf, size_t len, int *mask)
+{
+    ssize_t ret = -1;
+    struct flb_upstream *u = u_conn->u;
+
+    *mask = 0;
+    if (u->flags & FLB_IO_TCP) {
+        ret = recv(u_conn->fd, buf, len, 0);
+        if (ret == -1 && FLB_WOULDBLOCK()) {
+            *mask = MK_EVENT_READ;
+            ret = 0;
+        }
+        else if (ret == 0) {
+            ret = -1;
+        }
+    }
+#ifdef FLB_HAVE_TLS
+    else if (u->flags & FLB_IO_TLS) {
+        ret = flb_io_tls_net_try_read(u_conn, buf, len, mask);
+    }
+#endif
+
+    return ret;
+}
+
 ssize_t flb_io_net_read(struct flb_upstream_conn *u_conn, void *buf, size_t len)
 {
     int ret = -1;
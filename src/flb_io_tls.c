@@ -33,6 +33,7 @@
 #include <fluent-bit/flb_time.h>
 #include <fluent-bit/flb_tls.h>
 #include <fluent-bit/flb_io_tls.h>
+#include <fluent-bit/flb_io_tls_rw.h>
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_config.h>
 #include <fluent-bit/flb_network.h>
@@ -319,15 +320,25 @@ int flb_tls_session_destroy(struct flb_tls_session *session)
     return 0;
 }
 
-/* Perform a TLS handshake */
-int net_io_tls_handshake(void *_u_conn, void *_th)
+/* Forget the TLS session cached for resumption */
+static void tls_resume_reset(struct flb_upstream *u)
+{
+    if (u->tls_resume_set == FLB_TRUE) {
+        mbedtls_ssl_session_free(&u->tls_resume);
+        mbedtls_ssl_session_init(&u->tls_resume);
+        u->tls_resume_set = FLB_FALSE;
+    }
+}
+
+/*
+ * Create the TLS session of a new connection, the last session of the
+ * upstream is offered to the server so the full handshake can be skipped.
+ */
+int flb_io_tls_handshake_start(struct flb_upstream_conn *u_conn)
 {
     int ret;
-    int flag;
     struct flb_tls_session *session;
-    struct flb_upstream_conn *u_conn = _u_conn;
     struct flb_upstream *u = u_conn->u;
-    struct flb_thread *th = _th;
 
     session = flb_tls_session_new(u->tls->context);
     if (!session) {
@@ -348,23 +359,90 @@ int net_io_tls_handshake(void *_u_conn, void *_th)
                         &u_conn->tls_net_context,
                         mbedtls_net_send, mbedtls_net_recv, NULL);
 
- retry_handshake:
-    ret = mbedtls_ssl_handshake(&session->ssl);
-    if (ret != 0) {
-        if (ret != MBEDTLS_ERR_SSL_WANT_READ &&
-            ret !=  MBEDTLS_ERR_SSL_WANT_WRITE) {
+    if (u->net.tls_session_resumption == FLB_TRUE &&
+        u->tls_resume_set == FLB_TRUE) {
+        ret = mbedtls_ssl_set_session(&session->ssl, &u->tls_resume);
+        if (ret != 0) {
             io_tls_error(ret);
-            goto error;
+            tls_resume_reset(u);
         }
+    }
+
+    return 0;
+}
+
+/*
+ * Run the TLS handshake as far as the socket allows it. Returns 0 once it's
+ * done, the event (MK_EVENT_READ or MK_EVENT_WRITE) to wait for before
+ * calling it again, or -1 on error.
+ */
+int flb_io_tls_handshake_step(struct flb_upstream_conn *u_conn)
+{
+    int ret;
+    int state;
+    mbedtls_ssl_context *ssl = &u_conn->tls_session->ssl;
+    struct flb_upstream *u = u_conn->u;
 
-        flag = 0;
-        if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
-            flag = MK_EVENT_WRITE;
+    while (ssl->state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+        state = ssl->state;
+        ret = mbedtls_ssl_handshake_step(ssl);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
+            return MK_EVENT_READ;
         }
-        else if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
-            flag = MK_EVENT_READ;
+        else if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            return MK_EVENT_WRITE;
         }
+        else if (ret != 0) {
+            io_tls_error(ret);
+
+            /* the server might not like the session we offered */
+            tls_resume_reset(u);
+            return -1;
+        }
+
+        /* a resumed session goes from the server hello to the cipher change */
+        if (state == MBEDTLS_SSL_SERVER_HELLO &&
+            ssl->state == MBEDTLS_SSL_SERVER_CHANGE_CIPHER_SPEC) {
+            u->stats.tls_resumed++;
+            flb_debug("[io_tls] connection #%i to %s:%i resumed the TLS "
+                      "session", u_conn->fd, u->tcp_host, u->tcp_port);
+        }
+    }
+
+    if (u->net.tls_session_resumption == FLB_TRUE) {
+        ret = mbedtls_ssl_get_session(ssl, &u->tls_resume);
+        if (ret == 0) {
+            u->tls_resume_set = FLB_TRUE;
+        }
+        else {
+            io_tls_error(ret);
+            tls_resume_reset(u);
+        }
+    }
+
+    return 0;
+}
+
+/* Perform a TLS handshake */
+int net_io_tls_handshake(void *_u_conn, void *_th)
+{
+    int ret;
+    int flag;
+    struct flb_upstream_conn *u_conn = _u_conn;
+    struct flb_upstream *u = u_conn->u;
+    struct flb_thread *th = _th;
+
+    ret = flb_io_tls_handshake_start(u_conn);
+    if (ret == -1) {
+        return -1;
+    }
 
+ retry_handshake:
+    flag = flb_io_tls_handshake_step(u_conn);
+    if (flag == -1) {
+        goto error;
+    }
+    else if (flag != 0) {
         /*
          * If there are no coroutine thread context (th == NULL) it means this
          * TLS handshake is happening from a blocking code. Just sleep a bit
@@ -479,6 +557,62 @@ int flb_io_tls_net_read(struct flb_upstream_conn *u_conn,
     return ret;
 }
 
+/* Non-blocking read, 0 and the event to wait for if it would block */
+ssize_t flb_io_tls_net_try_read(struct flb_upstream_conn *u_conn,
+                                void *buf, size_t len, int *mask)
+{
+    int ret;
+
+    *mask = 0;
+    ret = mbedtls_ssl_read(&u_conn->tls_session->ssl, buf, len);
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
+        *mask = MK_EVENT_READ;
+        return 0;
+    }
+    else if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        *mask = MK_EVENT_WRITE;
+        return 0;
+    }
+    else if (ret < 0) {
+        io_tls_error(ret);
+        return -1;
+    }
+    else if (ret == 0) {
+        flb_debug("[tls] SSL connection closed by peer");
+        return -1;
+    }
+
+    return ret;
+}
+
+/*
+ * Non-blocking write. After a would-block return the caller must retry with
+ * the same data, mbedTLS keeps the record it already encrypted.
+ */
+ssize_t flb_io_tls_net_try_write(struct flb_upstream_conn *u_conn,
+                                 const void *data, size_t len, int *mask)
+{
+    int ret;
+
+    *mask = 0;
+    ret = mbedtls_ssl_write(&u_conn->tls_session->ssl,
+                            (unsigned char *) data, len);
+    if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        *mask = MK_EVENT_WRITE;
+        return 0;
+    }
+    else if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
+        *mask = MK_EVENT_READ;
+        return 0;
+    }
+    else if (ret < 0) {
+        io_tls_error(ret);
+        return -1;
+    }
+
+    return ret;
+}
+
 int flb_io_tls_net_write_async(struct flb_thread *th, struct flb_upstream_conn *u_conn,
                          const void *data, size_t len, size_t *out_len)
 {
@@ -106,6 +106,7 @@ static inline struct flb_filter_instance *filter_instance_get(flb_ctx_t *ctx,
 void flb_init_env()
 {
     flb_thread_prepare();
+    flb_input_prepare();
     flb_output_prepare();
 }
 
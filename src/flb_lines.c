@@ -0,0 +1,118 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_lines.h>
+
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && defined(__AVX2__)
+#include <immintrin.h>
+#define FLB_LINES_AVX2
+#elif defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define FLB_LINES_SSE2
+#endif
+
+/*
+ * Scan 64 bytes per step and turn the comparison into a single 64-bit
+ * mask: with short lines one block yields several offsets at once. When a
+ * block has no line break at all the rest of the gap is skipped with
+ * memchr(), which libc already dispatches to the widest vector unit at
+ * runtime and beats a 16-byte loop on long lines.
+ */
+#define LINES_BLOCK 64
+
+static inline uint64_t block_mask(const char *p)
+{
+#if defined(FLB_LINES_AVX2)
+    __m256i nl = _mm256_set1_epi8('\n');
+    uint64_t lo;
+    uint64_t hi;
+
+    lo = (uint32_t) _mm256_movemask_epi8(
+             _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) p), nl));
+    hi = (uint32_t) _mm256_movemask_epi8(
+             _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (p + 32)),
+                               nl));
+    return lo | (hi << 32);
+#else
+    __m128i nl = _mm_set1_epi8('\n');
+    uint64_t m0;
+    uint64_t m1;
+    uint64_t m2;
+    uint64_t m3;
+
+    m0 = (uint16_t) _mm_movemask_epi8(
+             _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), nl));
+    m1 = (uint16_t) _mm_movemask_epi8(
+             _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + 16)), nl));
+    m2 = (uint16_t) _mm_movemask_epi8(
+             _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + 32)), nl));
+    m3 = (uint16_t) _mm_movemask_epi8(
+             _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (p + 48)), nl));
+    return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+#endif
+}
+
+int flb_lines_scan(const char *buf, size_t len, size_t *lines, int max)
+{
+    int n = 0;
+    size_t i = 0;
+    const char *p;
+#if defined(FLB_LINES_AVX2) || defined(FLB_LINES_SSE2)
+    uint64_t mask;
+
+    while (i + LINES_BLOCK <= len && n < max) {
+        mask = block_mask(buf + i);
+        if (mask == 0) {
+            p = memchr(buf + i + LINES_BLOCK, '\n', len - i - LINES_BLOCK);
+            if (!p) {
+                return n;
+            }
+            i = p - buf;
+            continue;
+        }
+        while (mask && n < max) {
+            lines[n++] = i + __builtin_ctzll(mask);
+            mask &= mask - 1;
+        }
+        i += LINES_BLOCK;
+    }
+#endif
+
+    if (n == max) {
+        return n;
+    }
+
+    /* Remaining bytes (or the whole buffer without SIMD support) */
+    while (i < len && n < max) {
+        p = memchr(buf + i, '\n', len - i);
+        if (!p) {
+            break;
+        }
+        lines[n++] = p - buf;
+        i = (p - buf) + 1;
+    }
+
+    return n;
+}
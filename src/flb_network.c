@@ -50,6 +50,10 @@ void flb_net_setup_init(struct flb_net_setup *net)
     net->keepalive_idle_timeout = 30;
     net->connect_timeout = 10;
     net->source_address = NULL;
+    net->pipeline_depth = 1;
+    net->min_idle_connections = 0;
+    net->max_connections = 0;
+    net->tls_session_resumption = FLB_TRUE;
 }
 
 int flb_net_host_set(const char *plugin_name, struct flb_net_host *host, const char *address)
@@ -36,12 +36,16 @@
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_plugin_proxy.h>
 #include <fluent-bit/flb_http_client_debug.h>
+#include <fluent-bit/flb_routes_mask.h>
+#include <fluent-bit/flb_output_worker.h>
+#include <fluent-bit/flb_upstream_ha.h>
 
 FLB_TLS_DEFINE(struct flb_libco_out_params, flb_libco_params);
 
 void flb_output_prepare()
 {
     FLB_TLS_INIT(flb_libco_params);
+    flb_output_worker_prepare();
 }
 
 /* Validate the the output address protocol */
@@ -187,6 +191,9 @@ void flb_output_exit(struct flb_config *config)
         ins = mk_list_entry(head, struct flb_output_instance, _head);
         p = ins->p;
 
+        /* Workers might be running a flush, stop them first */
+        flb_output_worker_stop(ins);
+
         /* Check a exit callback */
         if (p->cb_exit) {
             if(!p->proxy) {
@@ -241,7 +248,7 @@ struct flb_output_instance *flb_output_new(struct flb_config *config,
         return NULL;
     }
 
-    /* Get the last mask_id reported by an output instance plugin */
+    /* Get the next mask_id after the last output instance plugin */
     if (mk_list_is_empty(&config->outputs) == 0) {
         mask_id = 0;
     }
@@ -249,7 +256,7 @@ struct flb_output_instance *flb_output_new(struct flb_config *config,
         instance = mk_list_entry_last(&config->outputs,
                                       struct flb_output_instance,
                                       _head);
-        mask_id = (instance->mask_id);
+        mask_id = (instance->mask_id + 1);
     }
 
     mk_list_foreach(head, &config->out_plugins) {
@@ -276,18 +283,14 @@ struct flb_output_instance *flb_output_new(struct flb_config *config,
 
     /*
      * Set mask_id: the mask_id is an unique number assigned to this
-     * output instance that is used later to set in an 'unsigned 64
-     * bit number' where a specific task (buffer/records) should be
-     * routed.
+     * output instance, it's the position of the bit used in a routes
+     * mask (see flb_routes_mask.h) to define where a specific task
+     * (buffer/records) should be routed.
      *
      * note: This value is different than instance id.
      */
-    if (mask_id == 0) {
-        instance->mask_id = 1;
-    }
-    else {
-        instance->mask_id = (mask_id * 2);
-    }
+    instance->mask_id = mask_id;
+    config->routes_mask_size = FLB_ROUTES_MASK_ELEMENTS(mask_id + 1);
 
     /* Retrieve an instance id for the output instance */
     instance->id = instance_id(config);
@@ -329,6 +332,9 @@ struct flb_output_instance *flb_output_new(struct flb_config *config,
     instance->match_regex = NULL;
 #endif
     instance->retry_limit = 1;
+    instance->workers     = 0;
+    instance->worker_next = NULL;
+    mk_list_init(&instance->worker_list);
     instance->host.name   = NULL;
     instance->host.address = NULL;
     instance->net_config_map = NULL;
@@ -465,6 +471,15 @@ int flb_output_set_property(struct flb_output_instance *ins,
             ins->retry_limit = 0;
         }
     }
+    else if (prop_key_check("workers", k, len) == 0 && tmp) {
+        ins->workers = atoi(tmp);
+        flb_sds_destroy(tmp);
+        if (ins->workers < 0) {
+            flb_error("[config] invalid number of workers on instance '%s'",
+                      flb_output_name(ins));
+            return -1;
+        }
+    }
     else if (strncasecmp("net.", k, 4) == 0 && tmp) {
         kv = flb_kv_item_create(&ins->net_properties, (char *) k, NULL);
         if (!kv) {
@@ -745,6 +760,19 @@ int flb_output_init_all(struct flb_config *config)
                       p->name);
             return -1;
         }
+
+        /* Start the flush workers */
+        if (ins->workers > 0 && !(p->flags & FLB_OUTPUT_THREAD_SAFE)) {
+            flb_warn("[output] %s does not support workers, flushes run "
+                     "on the engine", flb_output_name(ins));
+            ins->workers = 0;
+        }
+        if (ins->workers > 0) {
+            ret = flb_output_worker_start(ins, config);
+            if (ret == -1) {
+                return -1;
+            }
+        }
     }
 
     return 0;
@@ -765,6 +793,31 @@ int flb_output_check(struct flb_config *config)
     return 0;
 }
 
+#ifdef FLB_HAVE_METRICS
+/* Export the connections pool statistics of the upstream as output metrics */
+static void output_upstream_metrics(struct flb_upstream *u,
+                                    struct flb_output_instance *ins)
+{
+    if (!ins->metrics) {
+        return;
+    }
+
+    if (!flb_metrics_get_id(FLB_METRIC_OUT_UPSTREAM_IDLE, ins->metrics)) {
+        flb_metrics_add(FLB_METRIC_OUT_UPSTREAM_IDLE,
+                        "upstream_idle", ins->metrics);
+        flb_metrics_add(FLB_METRIC_OUT_UPSTREAM_BUSY,
+                        "upstream_busy", ins->metrics);
+        flb_metrics_add(FLB_METRIC_OUT_UPSTREAM_CONNECTS,
+                        "upstream_connects", ins->metrics);
+        flb_metrics_add(FLB_METRIC_OUT_UPSTREAM_TLS_RESUMED,
+                        "upstream_tls_resumed", ins->metrics);
+        flb_metrics_add(FLB_METRIC_OUT_UPSTREAM_WAITS,
+                        "upstream_waits", ins->metrics);
+    }
+    u->metrics = ins->metrics;
+}
+#endif
+
 /*
  * Output plugins might have enabled certain features that have not been passed
  * directly to the upstream context. In order to avoid let plugins validate specific
@@ -801,6 +854,45 @@ int flb_output_upstream_set(struct flb_upstream *u, struct flb_output_instance *
 
     /* Set networking options 'net.*' received through instance properties */
     memcpy(&u->net, &ins->net_setup, sizeof(struct flb_net_setup));
+
+#ifdef FLB_HAVE_METRICS
+    output_upstream_metrics(u, ins);
+#endif
+
+    return 0;
+}
+
+/*
+ * Set the 'net.*' options of the instance on every node of an HA upstream,
+ * TLS is a setting of each node and it's left untouched. The plugin must
+ * not have processed the instance properties with flb_output_config_map_set().
+ */
+int flb_output_upstream_ha_set(void *ha, struct flb_output_instance *ins)
+{
+    int ret;
+    struct mk_list *head;
+    struct flb_upstream_node *node;
+    struct flb_upstream_ha *upstream_ha = ha;
+
+    if (!upstream_ha || !ins->net_config_map) {
+        return -1;
+    }
+
+    ret = flb_config_map_set(&ins->net_properties, ins->net_config_map,
+                             &ins->net_setup);
+    if (ret == -1) {
+        return -1;
+    }
+
+    mk_list_foreach(head, &upstream_ha->nodes) {
+        node = mk_list_entry(head, struct flb_upstream_node, _head);
+        memcpy(&node->u->net, &ins->net_setup, sizeof(struct flb_net_setup));
+
+#ifdef FLB_HAVE_METRICS
+        output_upstream_metrics(node->u, ins);
+#endif
+    }
+
     return 0;
 }
 
@@ -0,0 +1,373 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <monkey/mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_bits.h>
+#include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_thread.h>
+#include <fluent-bit/flb_task.h>
+#include <fluent-bit/flb_worker.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_output_worker.h>
+
+/* Connections timeouts check interval (seconds) */
+#define WORKER_TIMER_INTERVAL  1
+
+FLB_TLS_DEFINE(struct flb_out_worker, flb_out_worker_ctx);
+
+void flb_output_worker_prepare()
+{
+    FLB_TLS_INIT(flb_out_worker_ctx);
+}
+
+/* Returns the output worker running in the current thread, if any */
+struct flb_out_worker *flb_output_worker_get()
+{
+    return FLB_TLS_GET(flb_out_worker_ctx);
+}
+
+/*
+ * Flushes running on an output worker must not use the upstream contexts of
+ * the engine, return the worker copy of the given upstream. It's created on
+ * first use with the same setup but bound to the worker event loop.
+ */
+struct flb_upstream *flb_output_worker_upstream(struct flb_upstream *u)
+{
+    void *tls = NULL;
+    struct mk_list *head;
+    struct flb_upstream *w_u;
+    struct flb_out_worker *worker;
+
+    worker = flb_output_worker_get();
+    if (!worker || u->parent) {
+        return u;
+    }
+
+    mk_list_foreach(head, &worker->upstreams) {
+        w_u = mk_list_entry(head, struct flb_upstream, _head);
+        if (w_u->parent == u) {
+            return w_u;
+        }
+    }
+
+#ifdef FLB_HAVE_TLS
+    tls = u->tls;
+    if (u->tls == &worker->ins->tls && worker->tls.context) {
+        tls = &worker->tls;
+    }
+#endif
+
+    w_u = flb_upstream_clone(u, worker->evl, tls);
+    if (!w_u) {
+        return NULL;
+    }
+    mk_list_add(&w_u->_head, &worker->upstreams);
+
+    return w_u;
+}
+
+/* Resume a flush co-routine, report to the engine if it has finished */
+static void worker_resume(struct flb_out_worker *worker, struct flb_thread *th)
+{
+    int n;
+    uint64_t val;
+    struct flb_output_thread *out_th;
+
+    out_th = (struct flb_output_thread *) FLB_THREAD_DATA(th);
+    flb_thread_resume(th);
+
+    if (out_th->finished == FLB_FALSE) {
+        return;
+    }
+
+    /* From now on the co-routine belongs to the engine */
+    val = FLB_TASK_SET(out_th->ret, out_th->task->id, out_th->task->gen,
+                       out_th->id);
+
+    n = flb_pipe_w(worker->config->ch_manager[1], (void *) &val, sizeof(val));
+    if (n == -1) {
+        flb_errno();
+    }
+}
+
+/*
+ * Resume a flush co-routine from an event handler, on the engine or on the
+ * output worker running in the current thread.
+ */
+void flb_output_worker_resume(struct flb_thread *th)
+{
+    struct flb_out_worker *worker;
+
+    worker = flb_output_worker_get();
+    if (worker) {
+        worker_resume(worker, th);
+    }
+    else {
+        flb_thread_resume(th);
+    }
+}
+
+static void worker_loop(void *data)
+{
+    int n;
+    int running = FLB_TRUE;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct mk_event *event;
+    struct flb_thread *th;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+    struct flb_out_worker *worker = data;
+
+    FLB_TLS_SET(flb_out_worker_ctx, worker);
+
+    flb_debug("[output] worker #%i for %s started",
+              worker->id, flb_output_name(worker->ins));
+
+    while (running) {
+        mk_event_wait(worker->evl);
+        mk_event_foreach(event, worker->evl) {
+            if (event == &worker->event) {
+                /* New flush from the engine, a NULL reference means stop */
+                n = flb_pipe_r(worker->ch_events[0], &th, sizeof(th));
+                if (n <= 0) {
+                    flb_errno();
+                    continue;
+                }
+                if (!th) {
+                    running = FLB_FALSE;
+                    continue;
+                }
+                worker_resume(worker, th);
+            }
+            else if (event == &worker->event_timer) {
+                flb_utils_timer_consume(worker->timer_fd);
+                flb_upstream_conn_timeouts(&worker->upstreams);
+            }
+            else if (event->type == FLB_ENGINE_EV_CUSTOM) {
+                event->handler(event);
+            }
+            else if (event->type == FLB_ENGINE_EV_THREAD) {
+                /* I/O of a flush co-routine is ready */
+                u_conn = (struct flb_upstream_conn *) event;
+                th = u_conn->thread;
+                if (th) {
+                    worker_resume(worker, th);
+                }
+            }
+        }
+
+        flb_upstream_conn_pending_destroy(&worker->upstreams);
+    }
+
+    mk_list_foreach_safe(head, tmp, &worker->upstreams) {
+        u = mk_list_entry(head, struct flb_upstream, _head);
+        flb_upstream_destroy(u);
+    }
+
+    flb_debug("[output] worker #%i for %s stopped",
+              worker->id, flb_output_name(worker->ins));
+}
+
+static void worker_destroy(struct flb_out_worker *worker)
+{
+    if (worker->timer_fd > 0) {
+        mk_event_timeout_destroy(worker->evl, &worker->event_timer);
+    }
+    if (worker->ch_events[0] > 0) {
+        mk_event_del(worker->evl, &worker->event);
+        flb_pipe_close(worker->ch_events[0]);
+        flb_pipe_close(worker->ch_events[1]);
+    }
+    if (worker->evl) {
+        mk_event_loop_destroy(worker->evl);
+    }
+
+#ifdef FLB_HAVE_TLS
+    if (worker->tls.context) {
+        flb_tls_context_destroy(worker->tls.context);
+    }
+#endif
+
+    mk_list_del(&worker->_head);
+    flb_free(worker);
+}
+
+static struct flb_out_worker *worker_create(int id,
+                                            struct flb_output_instance *ins,
+                                            struct flb_config *config)
+{
+    int ret;
+    struct flb_out_worker *worker;
+
+    worker = flb_calloc(1, sizeof(struct flb_out_worker));
+    if (!worker) {
+        flb_errno();
+        return NULL;
+    }
+    worker->id = id;
+    worker->ins = ins;
+    worker->config = config;
+    worker->timer_fd = -1;
+    worker->ch_events[0] = -1;
+    worker->ch_events[1] = -1;
+    mk_list_init(&worker->upstreams);
+    mk_list_add(&worker->_head, &ins->worker_list);
+
+    worker->evl = mk_event_loop_create(256);
+    if (!worker->evl) {
+        worker_destroy(worker);
+        return NULL;
+    }
+
+    MK_EVENT_ZERO(&worker->event);
+    ret = mk_event_channel_create(worker->evl,
+                                  &worker->ch_events[0],
+                                  &worker->ch_events[1],
+                                  &worker->event);
+    if (ret != 0) {
+        worker->ch_events[0] = -1;
+        worker_destroy(worker);
+        return NULL;
+    }
+
+    MK_EVENT_ZERO(&worker->event_timer);
+    worker->timer_fd = mk_event_timeout_create(worker->evl,
+                                               WORKER_TIMER_INTERVAL, 0,
+                                               &worker->event_timer);
+    if (worker->timer_fd == -1) {
+        worker_destroy(worker);
+        return NULL;
+    }
+
+    /* TLS sessions of the worker use their own random generator state */
+#ifdef FLB_HAVE_TLS
+    if (ins->use_tls == FLB_TRUE) {
+        worker->tls.context = flb_tls_context_new(ins->tls_verify,
+                                                  ins->tls_debug,
+                                                  ins->tls_vhost,
+                                                  ins->tls_ca_path,
+                                                  ins->tls_ca_file,
+                                                  ins->tls_crt_file,
+                                                  ins->tls_key_file,
+                                                  ins->tls_key_passwd);
+        if (!worker->tls.context) {
+            worker_destroy(worker);
+            return NULL;
+        }
+    }
+#endif
+
+    ret = flb_worker_create(worker_loop, worker, &worker->tid, config);
+    if (ret == -1) {
+        worker_destroy(worker);
+        return NULL;
+    }
+
+    return worker;
+}
+
+/* Spawn the output workers of the instance */
+int flb_output_worker_start(struct flb_output_instance *ins,
+                            struct flb_config *config)
+{
+    int i;
+    struct flb_out_worker *worker;
+
+    for (i = 0; i < ins->workers; i++) {
+        worker = worker_create(i, ins, config);
+        if (!worker) {
+            flb_error("[output] could not start worker #%i for %s",
+                      i, flb_output_name(ins));
+            flb_output_worker_stop(ins);
+            return -1;
+        }
+    }
+    ins->worker_next = ins->worker_list.next;
+
+    flb_info("[output] %s started %i workers",
+             flb_output_name(ins), ins->workers);
+    return 0;
+}
+
+/* Stop and release the output workers of the instance */
+void flb_output_worker_stop(struct flb_output_instance *ins)
+{
+    int n;
+    void *stop = NULL;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_out_worker *worker;
+
+    mk_list_foreach_safe(head, tmp, &ins->worker_list) {
+        worker = mk_list_entry(head, struct flb_out_worker, _head);
+        if (worker->tid) {
+            n = flb_pipe_w(worker->ch_events[1], &stop, sizeof(stop));
+            if (n == -1) {
+                flb_errno();
+            }
+            else {
+                pthread_join(worker->tid, NULL);
+            }
+        }
+        worker_destroy(worker);
+    }
+    ins->worker_next = NULL;
+}
+
+/*
+ * Hand a flush co-routine to the next worker (round robin). The co-routine
+ * has been created and linked to its task by the engine.
+ */
+int flb_output_worker_flush(struct flb_output_instance *ins,
+                            struct flb_thread *th)
+{
+    int n;
+    struct flb_out_worker *worker;
+    struct flb_output_thread *out_th;
+
+    if (!ins->worker_next) {
+        return -1;
+    }
+
+    worker = mk_list_entry(ins->worker_next, struct flb_out_worker, _head);
+    ins->worker_next = ins->worker_next->next;
+    if (ins->worker_next == &ins->worker_list) {
+        ins->worker_next = ins->worker_list.next;
+    }
+
+    out_th = (struct flb_output_thread *) FLB_THREAD_DATA(th);
+    out_th->worker = worker;
+
+    n = flb_pipe_w(worker->ch_events[1], &th, sizeof(th));
+    if (n == -1) {
+        flb_errno();
+        out_th->worker = NULL;
+        return -1;
+    }
+
+    return 0;
+}
@@ -29,12 +29,18 @@
 #include <fluent-bit/flb_sds.h>
 #include <fluent-bit/flb_time.h>
 #include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_pack_fast.h>
 #include <fluent-bit/flb_unescape.h>
+#include <fluent-bit/flb_utf8.h>
+#include <fluent-bit/flb_dtoa.h>
 
 #include <msgpack.h>
 #include <jsmn/jsmn.h>
 
-#define try_to_write_str  flb_utils_write_str
+#if defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define FLB_PACK_SSE2
+#endif
 
 int flb_json_tokenise(const char *js, size_t len,
                       struct flb_pack_state *state)
@@ -214,7 +220,8 @@ static char *tokens_to_msgpack(struct flb_pack_state *state,
  * the message is complete.
  *
  * This routine do not keep a state in the parser, do not use it for big
- * JSON messages.
+ * JSON messages. Messages are decoded with the structural index decoder,
+ * jsmn is only used for the ones it can't handle.
  */
 int flb_pack_json(const char *js, size_t len, char **buffer, size_t *size,
                   int *root_type)
@@ -226,6 +233,11 @@ int flb_pack_json(const char *js, size_t len, char **buffer, size_t *size,
     char *buf = NULL;
     struct flb_pack_state state;
 
+    ret = flb_pack_json_fast(js, len, buffer, size, root_type, NULL);
+    if (ret == 0) {
+        return 0;
+    }
+
     ret = flb_pack_state_init(&state);
     if (ret != 0) {
         return -1;
@@ -427,21 +439,6 @@ void flb_pack_print(const char *data, size_t bytes)
 }
 
 
-static inline int try_to_write(char *buf, int *off, size_t left,
-                               const char *str, size_t str_len)
-{
-    if (str_len <= 0){
-        str_len = strlen(str);
-    }
-    if (left <= *off+str_len) {
-        return FLB_FALSE;
-    }
-    memcpy(buf+*off, str, str_len);
-    *off += str_len;
-    return FLB_TRUE;
-}
-
-
 /*
  * Check if a key exists in the map using the 'offset' as an index to define
  * which element needs to start looking from
@@ -473,8 +470,300 @@ static inline int key_exists_in_map(msgpack_object key, msgpack_object map, int
     return FLB_FALSE;
 }
 
-static int msgpack2json(char *buf, int *off, size_t left,
-                        const msgpack_object *o)
+/*
+ * JSON output of msgpack2json(): a caller buffer of a fixed size, or a
+ * buffer that grows as needed, an sds string or a raw memory buffer. Room
+ * for a NULL byte is always kept after 'size'.
+ */
+#define JSON_OUT_FIXED   0
+#define JSON_OUT_SDS     1
+#define JSON_OUT_MEM     2
+
+struct json_out {
+    int type;
+    char *buf;
+    size_t len;
+    size_t size;
+};
+
+/* Bytes that can't be copied as they are to a JSON string */
+static const char json_escape[256] = {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+};
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int json_out_grow(struct json_out *o, size_t bytes)
+{
+    size_t size;
+    char *tmp;
+
+    if (o->type == JSON_OUT_FIXED) {
+        return FLB_FALSE;
+    }
+
+    size = o->size * 2;
+    if (size < o->len + bytes) {
+        size = o->len + bytes;
+    }
+
+    if (o->type == JSON_OUT_SDS) {
+        tmp = flb_sds_increase(o->buf, size - o->size);
+        if (!tmp) {
+            return FLB_FALSE;
+        }
+    }
+    else {
+        tmp = flb_realloc(o->buf, size + 1);
+        if (!tmp) {
+            flb_errno();
+            return FLB_FALSE;
+        }
+    }
+
+    o->buf = tmp;
+    o->size = size;
+    return FLB_TRUE;
+}
+
+static inline int json_out_reserve(struct json_out *o, size_t bytes)
+{
+    if (o->len + bytes > o->size) {
+        return json_out_grow(o, bytes);
+    }
+    return FLB_TRUE;
+}
+
+static inline int json_out_write(struct json_out *o,
+                                 const char *str, size_t len)
+{
+    if (!json_out_reserve(o, len)) {
+        return FLB_FALSE;
+    }
+    memcpy(o->buf + o->len, str, len);
+    o->len += len;
+    return FLB_TRUE;
+}
+
+static inline int json_out_char(struct json_out *o, char c)
+{
+    if (!json_out_reserve(o, 1)) {
+        return FLB_FALSE;
+    }
+    o->buf[o->len++] = c;
+    return FLB_TRUE;
+}
+
+/* Number of bytes at the beginning of 'str' that don't need escaping */
+static inline size_t json_str_plain(const char *str, size_t len)
+{
+    size_t i = 0;
+#ifdef FLB_PACK_SSE2
+    int mask;
+    __m128i v;
+    __m128i m;
+
+    /* signed compare: bytes >= 0x80 are lower than a space too */
+    for (; i + 16 <= len; i += 16) {
+        v = _mm_loadu_si128((const __m128i *) (str + i));
+        m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('"')),
+                                      _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))),
+                         _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(' ')),
+                                      _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f))));
+        mask = _mm_movemask_epi8(m);
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    while (i < len && !json_escape[(unsigned char) str[i]]) {
+        i++;
+    }
+    return i;
+}
+
+/* \uXXXX, with more digits if the codepoint needs them */
+static int json_unicode_escape(char *p, uint32_t codepoint)
+{
+    int i;
+    int n = 4;
+
+    while (n < 8 && (codepoint >> (n * 4))) {
+        n++;
+    }
+
+    p[0] = '\\';
+    p[1] = 'u';
+    for (i = 0; i < n; i++) {
+        p[2 + i] = hex_digits[(codepoint >> ((n - 1 - i) * 4)) & 0xf];
+    }
+    return n + 2;
+}
+
+/*
+ * Write a JSON string. The escaping is the one of flb_utils_write_str(),
+ * runs of bytes that don't need it are found 16 bytes at a time and copied
+ * at once.
+ */
+static int json_out_str(struct json_out *o, const char *str, size_t str_len)
+{
+    int b;
+    int len;
+    int hex_bytes;
+    char tmp[16];
+    size_t i = 0;
+    size_t plain;
+    uint32_t c;
+    uint32_t codepoint;
+    uint32_t state;
+
+    /* most strings are copied as they are, a fixed buffer may be too short */
+    if (o->type != JSON_OUT_FIXED && !json_out_reserve(o, str_len + 2)) {
+        return FLB_FALSE;
+    }
+    if (!json_out_char(o, '"')) {
+        return FLB_FALSE;
+    }
+
+    while (i < str_len) {
+        plain = json_str_plain(str + i, str_len - i);
+        if (plain > 0) {
+            if (!json_out_write(o, str + i, plain)) {
+                return FLB_FALSE;
+            }
+            i += plain;
+            if (i == str_len) {
+                break;
+            }
+        }
+
+        c = (unsigned char) str[i];
+        len = 2;
+        tmp[0] = '\\';
+        switch (c) {
+        case '"':
+            tmp[1] = '"';
+            break;
+        case '\\':
+            tmp[1] = '\\';
+            break;
+        case '\n':
+            tmp[1] = 'n';
+            break;
+        case '\r':
+            tmp[1] = 'r';
+            break;
+        case '\t':
+            tmp[1] = 't';
+            break;
+        case '\b':
+            tmp[1] = 'b';
+            break;
+        case '\f':
+            tmp[1] = 'f';
+            break;
+        default:
+            if (c < 0x80) {
+                /* other control characters and DEL */
+                len = json_unicode_escape(tmp, c);
+                break;
+            }
+
+            hex_bytes = flb_utf8_len(str + i);
+            if (i + hex_bytes > str_len) {
+                /* skip truncated UTF-8 */
+                i = str_len;
+                len = 0;
+                break;
+            }
+
+            state = FLB_UTF8_ACCEPT;
+            codepoint = 0;
+            for (b = 0; b < hex_bytes; b++) {
+                if (flb_utf8_decode(&state, &codepoint,
+                                    (unsigned char) str[i + b]) == 0) {
+                    break;
+                }
+            }
+
+            if (state != FLB_UTF8_ACCEPT) {
+                /* Invalid UTF-8 hex, just skip utf-8 bytes */
+                flb_warn("[pack] invalid UTF-8 bytes found, skipping bytes");
+                len = 0;
+            }
+            else {
+                len = json_unicode_escape(tmp, codepoint);
+            }
+            i += hex_bytes - 1;
+        }
+
+        if (len > 0 && !json_out_write(o, tmp, len)) {
+            return FLB_FALSE;
+        }
+        i++;
+    }
+
+    return json_out_char(o, '"');
+}
+
+static inline int json_out_u64(struct json_out *o, uint64_t v, int negative)
+{
+    int len = 0;
+    char tmp[FLB_DTOA_SIZE];
+
+    if (negative) {
+        tmp[len++] = '-';
+    }
+    len += flb_u64toa(v, tmp + len);
+    return json_out_write(o, tmp, len);
+}
+
+/*
+ * Same output than the printf() based encoder: doubles holding an integer
+ * are written with one decimal ('%.1f'), other values use the shortest
+ * digits that round trip with the '%g' layout.
+ */
+static int json_out_double(struct json_out *o, double d)
+{
+    int len = 0;
+    char tmp[FLB_DTOA_SIZE + 4];
+    uint64_t bits;
+
+    if (d >= -9223372036854775808.0 && d < 9223372036854775808.0 &&
+        d == (double) (int64_t) d) {
+        memcpy(&bits, &d, sizeof(bits));
+        if (bits >> 63) {
+            tmp[len++] = '-';
+        }
+        len += flb_u64toa(d < 0 ? -(uint64_t) (int64_t) d : (uint64_t) d,
+                          tmp + len);
+        tmp[len++] = '.';
+        tmp[len++] = '0';
+    }
+    else {
+        len = flb_dtoa(d, 15, tmp);
+    }
+
+    return json_out_write(o, tmp, len);
+}
+
+static int msgpack2json(struct json_out *out, const msgpack_object *o)
 {
     int i;
     int dup;
@@ -484,66 +773,46 @@ static int msgpack2json(char *buf, int *off, size_t left,
 
     switch(o->type) {
     case MSGPACK_OBJECT_NIL:
-        ret = try_to_write(buf, off, left, "null", 4);
+        ret = json_out_write(out, "null", 4);
         break;
 
     case MSGPACK_OBJECT_BOOLEAN:
-        ret = try_to_write(buf, off, left,
-                           (o->via.boolean ? "true":"false"),0);
-
+        if (o->via.boolean) {
+            ret = json_out_write(out, "true", 4);
+        }
+        else {
+            ret = json_out_write(out, "false", 5);
+        }
         break;
 
     case MSGPACK_OBJECT_POSITIVE_INTEGER:
-        {
-            char temp[32] = {0};
-            i = snprintf(temp, sizeof(temp)-1, "%"PRIu64, o->via.u64);
-            ret = try_to_write(buf, off, left, temp, i);
-        }
+        ret = json_out_u64(out, o->via.u64, FLB_FALSE);
         break;
 
     case MSGPACK_OBJECT_NEGATIVE_INTEGER:
-        {
-            char temp[32] = {0};
-            i = snprintf(temp, sizeof(temp)-1, "%"PRId64, o->via.i64);
-            ret = try_to_write(buf, off, left, temp, i);
+        if (o->via.i64 < 0) {
+            ret = json_out_u64(out, -(uint64_t) o->via.i64, FLB_TRUE);
+        }
+        else {
+            ret = json_out_u64(out, o->via.i64, FLB_FALSE);
         }
         break;
+
     case MSGPACK_OBJECT_FLOAT32:
     case MSGPACK_OBJECT_FLOAT64:
-        {
-            char temp[512] = {0};
-            if (o->via.f64 == (double)(long long int)o->via.f64) {
-                i = snprintf(temp, sizeof(temp)-1, "%.1f", o->via.f64);
-            }
-            else {
-                i = snprintf(temp, sizeof(temp)-1, "%.16g", o->via.f64);
-            }
-            ret = try_to_write(buf, off, left, temp, i);
-        }
+        ret = json_out_double(out, o->via.f64);
         break;
 
     case MSGPACK_OBJECT_STR:
-        if (try_to_write(buf, off, left, "\"", 1) &&
-            (o->via.str.size > 0 ?
-             try_to_write_str(buf, off, left, o->via.str.ptr, o->via.str.size)
-             : 1/* nothing to do */) &&
-            try_to_write(buf, off, left, "\"", 1)) {
-            ret = FLB_TRUE;
-        }
+        ret = json_out_str(out, o->via.str.ptr, o->via.str.size);
         break;
 
     case MSGPACK_OBJECT_BIN:
-        if (try_to_write(buf, off, left, "\"", 1) &&
-            (o->via.bin.size > 0 ?
-             try_to_write_str(buf, off, left, o->via.bin.ptr, o->via.bin.size)
-              : 1 /* nothing to do */) &&
-            try_to_write(buf, off, left, "\"", 1)) {
-            ret = FLB_TRUE;
-        }
+        ret = json_out_str(out, o->via.bin.ptr, o->via.bin.size);
         break;
 
     case MSGPACK_OBJECT_EXT:
-        if (!try_to_write(buf, off, left, "\"", 1)) {
+        if (!json_out_char(out, '"')) {
             goto msg2json_end;
         }
         /* ext body. fortmat is similar to printf(1) */
@@ -553,12 +822,12 @@ static int msgpack2json(char *buf, int *off, size_t left,
             loop = o->via.ext.size;
             for(i=0; i<loop; i++) {
                 len = snprintf(temp, sizeof(temp)-1, "\\x%02x", (char)o->via.ext.ptr[i]);
-                if (!try_to_write(buf, off, left, temp, len)) {
+                if (!json_out_write(out, temp, len)) {
                     goto msg2json_end;
                 }
             }
         }
-        if (!try_to_write(buf, off, left, "\"", 1)) {
+        if (!json_out_char(out, '"')) {
             goto msg2json_end;
         }
         ret = FLB_TRUE;
@@ -567,28 +836,28 @@ static int msgpack2json(char *buf, int *off, size_t left,
     case MSGPACK_OBJECT_ARRAY:
         loop = o->via.array.size;
 
-        if (!try_to_write(buf, off, left, "[", 1)) {
+        if (!json_out_char(out, '[')) {
             goto msg2json_end;
         }
         if (loop != 0) {
             msgpack_object* p = o->via.array.ptr;
-            if (!msgpack2json(buf, off, left, p)) {
+            if (!msgpack2json(out, p)) {
                 goto msg2json_end;
             }
             for (i=1; i<loop; i++) {
-                if (!try_to_write(buf, off, left, ",", 1) ||
-                    !msgpack2json(buf, off, left, p+i)) {
+                if (!json_out_char(out, ',') ||
+                    !msgpack2json(out, p+i)) {
                     goto msg2json_end;
                 }
             }
         }
 
-        ret = try_to_write(buf, off, left, "]", 1);
+        ret = json_out_char(out, ']');
         break;
 
     case MSGPACK_OBJECT_MAP:
         loop = o->via.map.size;
-        if (!try_to_write(buf, off, left, "{", 1)) {
+        if (!json_out_char(out, '{')) {
             goto msg2json_end;
         }
         if (loop != 0) {
@@ -607,22 +876,22 @@ static int msgpack2json(char *buf, int *off, size_t left,
                 }
 
                 if (packed > 0) {
-                    if (!try_to_write(buf, off, left, ",", 1)) {
+                    if (!json_out_char(out, ',')) {
                         goto msg2json_end;
                     }
                 }
 
                 if (
-                    !msgpack2json(buf, off, left, &(p+i)->key) ||
-                    !try_to_write(buf, off, left, ":", 1)  ||
-                    !msgpack2json(buf, off, left, &(p+i)->val) ) {
+                    !msgpack2json(out, &(p+i)->key) ||
+                    !json_out_char(out, ':')  ||
+                    !msgpack2json(out, &(p+i)->val) ) {
                     goto msg2json_end;
                 }
                 packed++;
             }
         }
 
-        ret = try_to_write(buf, off, left, "}", 1);
+        ret = json_out_char(out, '}');
         break;
 
     default:
@@ -646,30 +915,38 @@ int flb_msgpack_to_json(char *json_str, size_t json_size,
                         const msgpack_object *obj)
 {
     int ret = -1;
-    int off = 0;
+    struct json_out out;
 
     if (json_str == NULL || obj == NULL) {
         return -1;
     }
 
-    ret = msgpack2json(json_str, &off, json_size - 1, obj);
-    json_str[off] = '\0';
-    return ret ? off: ret;
+    out.type = JSON_OUT_FIXED;
+    out.buf = json_str;
+    out.len = 0;
+    out.size = json_size - 1;
+
+    ret = msgpack2json(&out, obj);
+    json_str[out.len] = '\0';
+    return ret ? out.len: ret;
 }
 
+/*
+ * Convert a msgpack buffer to a JSON sds string. The output buffer grows
+ * while it's written, the conversion is never done twice.
+ */
 flb_sds_t flb_msgpack_raw_to_json_sds(const void *in_buf, size_t in_size)
 {
     int ret;
     size_t off = 0;
-    size_t out_size;
     msgpack_unpacked result;
-    msgpack_object *root;
-    flb_sds_t out_buf;
-    flb_sds_t tmp_buf;
+    struct json_out out;
 
-    out_size = in_size * 1.5;
-    out_buf = flb_sds_create_size(out_size);
-    if (!out_buf) {
+    out.type = JSON_OUT_SDS;
+    out.len = 0;
+    out.size = in_size * 1.5;
+    out.buf = flb_sds_create_size(out.size);
+    if (!out.buf) {
         flb_errno();
         return NULL;
     }
@@ -677,35 +954,21 @@ flb_sds_t flb_msgpack_raw_to_json_sds(const void *in_buf, size_t in_size)
     msgpack_unpacked_init(&result);
     ret = msgpack_unpack_next(&result, in_buf, in_size, &off);
     if (ret != MSGPACK_UNPACK_SUCCESS) {
-        flb_sds_destroy(out_buf);
+        flb_sds_destroy(out.buf);
         return NULL;
     }
 
-    root = &result.data;
-    while (1) {
-        ret = flb_msgpack_to_json(out_buf, out_size, root);
-        if (ret <= 0) {
-            tmp_buf = flb_sds_increase(out_buf, 256);
-            if (tmp_buf) {
-                out_buf = tmp_buf;
-                out_size += 256;
-            }
-            else {
-                flb_errno();
-                flb_sds_destroy(out_buf);
-                msgpack_unpacked_destroy(&result);
-                return NULL;
-            }
-        }
-        else {
-            break;
-        }
+    ret = msgpack2json(&out, &result.data);
+    msgpack_unpacked_destroy(&result);
+    if (!ret) {
+        flb_sds_destroy(out.buf);
+        return NULL;
     }
 
-    msgpack_unpacked_destroy(&result);
-    flb_sds_len_set(out_buf, ret);
+    out.buf[out.len] = '\0';
+    flb_sds_len_set(out.buf, out.len);
 
-    return out_buf;
+    return out.buf;
 }
 
 /*
@@ -748,18 +1011,75 @@ int flb_pack_to_json_date_type(const char *str)
 }
 
 
+/* Pack a record map for JSON conversion, prepending the date if requested */
+static void pack_json_record(msgpack_packer *pck, struct flb_time *tms,
+                             msgpack_object *map, int date_format,
+                             flb_sds_t date_key)
+{
+    int i;
+    int len;
+    int map_size;
+    char time_formatted[32];
+    size_t s;
+    msgpack_object *k;
+    msgpack_object *v;
+    struct tm tm;
+
+    map_size = map->via.map.size;
+
+    if (date_key != NULL) {
+        msgpack_pack_map(pck, map_size + 1);
+    }
+    else {
+        msgpack_pack_map(pck, map_size);
+    }
+
+    if (date_key != NULL) {
+        /* Append date key */
+        msgpack_pack_str(pck, flb_sds_len(date_key));
+        msgpack_pack_str_body(pck, date_key, flb_sds_len(date_key));
+
+        /* Append date value */
+        switch (date_format) {
+        case FLB_PACK_JSON_DATE_DOUBLE:
+            msgpack_pack_double(pck, flb_time_to_double(tms));
+            break;
+        case FLB_PACK_JSON_DATE_ISO8601:
+        /* Format the time, use microsecond precision not nanoseconds */
+            gmtime_r(&tms->tm.tv_sec, &tm);
+            s = strftime(time_formatted, sizeof(time_formatted) - 1,
+                         FLB_PACK_JSON_DATE_ISO8601_FMT, &tm);
+
+            len = snprintf(time_formatted + s,
+                           sizeof(time_formatted) - 1 - s,
+                           ".%06" PRIu64 "Z",
+                           (uint64_t) tms->tm.tv_nsec / 1000);
+            s += len;
+            msgpack_pack_str(pck, s);
+            msgpack_pack_str_body(pck, time_formatted, s);
+            break;
+        case FLB_PACK_JSON_DATE_EPOCH:
+            msgpack_pack_uint64(pck, (long long unsigned)(tms->tm.tv_sec));
+            break;
+        }
+    }
+
+    /* Append remaining keys/values */
+    for (i = 0; i < map_size; i++) {
+        k = &map->via.map.ptr[i].key;
+        v = &map->via.map.ptr[i].val;
+        msgpack_pack_object(pck, *k);
+        msgpack_pack_object(pck, *v);
+    }
+}
+
 flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
                                           int json_format, int date_format,
                                           flb_sds_t date_key)
 {
-    int i;
-    int len;
     int ok = MSGPACK_UNPACK_SUCCESS;
     int records = 0;
-    int map_size;
     size_t off = 0;
-    char time_formatted[32];
-    size_t s;
     flb_sds_t out_tmp;
     flb_sds_t out_js;
     flb_sds_t out_buf = NULL;
@@ -769,9 +1089,6 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
     msgpack_sbuffer tmp_sbuf;
     msgpack_packer tmp_pck;
     msgpack_object *obj;
-    msgpack_object *k;
-    msgpack_object *v;
-    struct tm tm;
     struct flb_time tms;
 
     /* Iterate the original buffer and perform adjustments */
@@ -821,52 +1138,7 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
 
         /* Get the record/map */
         map = root.via.array.ptr[1];
-        map_size = map.via.map.size;
-
-        if (date_key != NULL) {
-            msgpack_pack_map(&tmp_pck, map_size + 1);
-        }
-        else {
-            msgpack_pack_map(&tmp_pck, map_size);
-        }
-
-        if (date_key != NULL) {
-            /* Append date key */
-            msgpack_pack_str(&tmp_pck, flb_sds_len(date_key));
-            msgpack_pack_str_body(&tmp_pck, date_key, flb_sds_len(date_key));
-
-            /* Append date value */
-            switch (date_format) {
-            case FLB_PACK_JSON_DATE_DOUBLE:
-                msgpack_pack_double(&tmp_pck, flb_time_to_double(&tms));
-                break;
-            case FLB_PACK_JSON_DATE_ISO8601:
-            /* Format the time, use microsecond precision not nanoseconds */
-                gmtime_r(&tms.tm.tv_sec, &tm);
-                s = strftime(time_formatted, sizeof(time_formatted) - 1,
-                             FLB_PACK_JSON_DATE_ISO8601_FMT, &tm);
-
-                len = snprintf(time_formatted + s,
-                               sizeof(time_formatted) - 1 - s,
-                               ".%06" PRIu64 "Z",
-                               (uint64_t) tms.tm.tv_nsec / 1000);
-                s += len;
-                msgpack_pack_str(&tmp_pck, s);
-                msgpack_pack_str_body(&tmp_pck, time_formatted, s);
-                break;
-            case FLB_PACK_JSON_DATE_EPOCH:
-                msgpack_pack_uint64(&tmp_pck, (long long unsigned)(tms.tm.tv_sec));
-                break;
-            }
-        }
-
-        /* Append remaining keys/values */
-        for (i = 0; i < map_size; i++) {
-            k = &map.via.map.ptr[i].key;
-            v = &map.via.map.ptr[i].val;
-            msgpack_pack_object(&tmp_pck, *k);
-            msgpack_pack_object(&tmp_pck, *v);
-        }
+        pack_json_record(&tmp_pck, &tms, &map, date_format, date_key);
 
         /*
          * If the format is the original msgpack style, just continue since
@@ -961,6 +1233,83 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
     return out_buf;
 }
 
+/*
+ * Same output than flb_pack_msgpack_to_json_format(), but handed to 'cb'
+ * piece by piece while the records are converted instead of being
+ * accumulated: for JSON format the array delimiters are written apart from
+ * the records. Returns the number of records written or -1 on error,
+ * including when 'cb' fails.
+ */
+int flb_pack_msgpack_to_json_format_cb(const char *data, uint64_t bytes,
+                                       int json_format, int date_format,
+                                       flb_sds_t date_key,
+                                       int (*cb)(void *, const char *, size_t),
+                                       void *cb_data)
+{
+    int ret = 0;
+    int records = 0;
+    size_t off = 0;
+    flb_sds_t out_js;
+    msgpack_unpacked result;
+    msgpack_object root;
+    msgpack_object map;
+    msgpack_sbuffer tmp_sbuf;
+    msgpack_packer tmp_pck;
+    msgpack_object *obj;
+    struct flb_time tms;
+
+    msgpack_sbuffer_init(&tmp_sbuf);
+    msgpack_packer_init(&tmp_pck, &tmp_sbuf, msgpack_sbuffer_write);
+
+    if (json_format == FLB_PACK_JSON_FORMAT_JSON) {
+        ret = cb(cb_data, "[", 1);
+    }
+
+    msgpack_unpacked_init(&result);
+    while (ret == 0 && msgpack_unpack_next(&result, data, bytes, &off) ==
+           MSGPACK_UNPACK_SUCCESS) {
+        root = result.data;
+        if (root.type != MSGPACK_OBJECT_ARRAY || root.via.array.size != 2) {
+            continue;
+        }
+
+        flb_time_pop_from_msgpack(&tms, &result, &obj);
+        map = root.via.array.ptr[1];
+
+        msgpack_sbuffer_clear(&tmp_sbuf);
+        pack_json_record(&tmp_pck, &tms, &map, date_format, date_key);
+
+        out_js = flb_msgpack_raw_to_json_sds(tmp_sbuf.data, tmp_sbuf.size);
+        if (!out_js) {
+            ret = -1;
+            break;
+        }
+
+        if (json_format == FLB_PACK_JSON_FORMAT_JSON && records > 0) {
+            ret = cb(cb_data, ",", 1);
+        }
+        if (ret == 0) {
+            ret = cb(cb_data, out_js, flb_sds_len(out_js));
+        }
+        if (ret == 0 && json_format == FLB_PACK_JSON_FORMAT_LINES) {
+            ret = cb(cb_data, "\n", 1);
+        }
+        flb_sds_destroy(out_js);
+        records++;
+    }
+    msgpack_unpacked_destroy(&result);
+    msgpack_sbuffer_destroy(&tmp_sbuf);
+
+    if (ret == 0 && json_format == FLB_PACK_JSON_FORMAT_JSON) {
+        ret = cb(cb_data, "]", 1);
+    }
+
+    if (ret != 0) {
+        return -1;
+    }
+    return records;
+}
+
 /**
  *  convert msgpack to JSON string.
  *  This API is similar to snprintf.
@@ -971,8 +1320,7 @@ flb_sds_t flb_pack_msgpack_to_json_format(const char *data, uint64_t bytes,
 char *flb_msgpack_to_json_str(size_t size, const msgpack_object *obj)
 {
     int ret;
-    char *buf = NULL;
-    char *tmp;
+    struct json_out out;
 
     if (obj == NULL) {
         return NULL;
@@ -982,33 +1330,23 @@ char *flb_msgpack_to_json_str(size_t size, const msgpack_object *obj)
         size = 128;
     }
 
-    buf = flb_malloc(size);
-    if (!buf) {
+    out.type = JSON_OUT_MEM;
+    out.len = 0;
+    out.size = size;
+    out.buf = flb_malloc(size + 1);
+    if (!out.buf) {
         flb_errno();
         return NULL;
     }
 
-    while (1) {
-        ret = flb_msgpack_to_json(buf, size, obj);
-        if (ret <= 0) {
-            /* buffer is small. retry.*/
-            size += 128;
-            tmp = flb_realloc(buf, size);
-            if (tmp) {
-                buf = tmp;
-            }
-            else {
-                flb_free(buf);
-                flb_errno();
-                return NULL;
-            }
-        }
-        else {
-            break;
-        }
+    ret = msgpack2json(&out, obj);
+    if (!ret) {
+        flb_free(out.buf);
+        return NULL;
     }
+    out.buf[out.len] = '\0';
 
-    return buf;
+    return out.buf;
 }
 
 int flb_pack_time_now(msgpack_packer *pck)
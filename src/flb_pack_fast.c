@@ -0,0 +1,1118 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_pack_fast.h>
+#include <fluent-bit/flb_unescape.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && defined(__AVX2__)
+#include <immintrin.h>
+#define FLB_PACK_FAST_AVX2
+#elif defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#define FLB_PACK_FAST_SSE2
+#endif
+
+/*
+ * The message is decoded in two stages, as simdjson does:
+ *
+ * 1. The input is classified 64 bytes at a time into bitmasks (quotes,
+ *    backslashes, operators and whitespaces). Escaped quotes are removed
+ *    and a prefix XOR of the quotes gives the bytes inside strings, what's
+ *    left are the structural characters: operators, quotes and the first
+ *    byte of every number or literal. Their offsets are stored in an index
+ *    and, since msgpack needs the size of maps and arrays up front, the
+ *    elements of every container are counted at the same time.
+ *
+ * 2. The index is walked once and msgpack is written directly to the output
+ *    buffer, strings are copied (or unescaped) at their final place. The
+ *    encoding is the one msgpack-c uses, the smallest format for a value.
+ *
+ * The decoder accepts standard JSON only. It never produces a different
+ * result than jsmn: anything it's not sure about makes it give up.
+ */
+
+#define BLOCK         64
+#define INDEX_STACK   128
+
+/* scalar classification */
+#define C_QUOTE       1
+#define C_BACKSLASH   2
+#define C_OP          4
+#define C_WS          8
+#define C_NUL        16
+
+struct json_block {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;
+    uint64_t ws;
+    uint64_t nul;
+};
+
+struct json_ctx {
+    const char *js;
+    size_t len;
+
+    /* structural index */
+    int n;
+    int size;
+    uint32_t *idx;
+    uint32_t *counts;
+
+    /* stage 2 */
+    int k;
+    char *out;
+    size_t out_len;
+    size_t out_size;
+    struct flb_pack_json_key *key;
+
+    uint32_t idx_stack[INDEX_STACK];
+    uint32_t counts_stack[INDEX_STACK];
+};
+
+#if defined(FLB_PACK_FAST_AVX2)
+#define EQ(v, c)  _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c))
+#define OR(a, b)  _mm256_or_si256(a, b)
+#define MASK(v)   ((uint64_t) (uint32_t) _mm256_movemask_epi8(v))
+
+static inline void classify(const char *p, struct json_block *b)
+{
+    int i;
+    uint64_t quote = 0;
+    uint64_t backslash = 0;
+    uint64_t op = 0;
+    uint64_t ws = 0;
+    uint64_t nul = 0;
+    __m256i v;
+    __m256i l;
+
+    for (i = 0; i < BLOCK; i += 32) {
+        v = _mm256_loadu_si256((const __m256i *) (p + i));
+        l = OR(v, _mm256_set1_epi8(0x20));
+
+        quote     |= MASK(EQ(v, '"')) << i;
+        backslash |= MASK(EQ(v, '\\')) << i;
+        op        |= MASK(OR(OR(EQ(l, '{'), EQ(l, '}')),
+                             OR(EQ(v, ':'), EQ(v, ',')))) << i;
+        ws        |= MASK(OR(OR(EQ(v, ' '), EQ(v, '\t')),
+                             OR(EQ(v, '\n'), EQ(v, '\r')))) << i;
+        nul       |= MASK(EQ(v, 0)) << i;
+    }
+
+    b->quote = quote;
+    b->backslash = backslash;
+    b->op = op;
+    b->ws = ws;
+    b->nul = nul;
+}
+#elif defined(FLB_PACK_FAST_SSE2)
+#define EQ(v, c)  _mm_cmpeq_epi8(v, _mm_set1_epi8(c))
+#define OR(a, b)  _mm_or_si128(a, b)
+#define MASK(v)   ((uint64_t) (uint16_t) _mm_movemask_epi8(v))
+
+static inline void classify(const char *p, struct json_block *b)
+{
+    int i;
+    uint64_t quote = 0;
+    uint64_t backslash = 0;
+    uint64_t op = 0;
+    uint64_t ws = 0;
+    uint64_t nul = 0;
+    __m128i v;
+    __m128i l;
+
+    for (i = 0; i < BLOCK; i += 16) {
+        v = _mm_loadu_si128((const __m128i *) (p + i));
+        l = OR(v, _mm_set1_epi8(0x20));
+
+        quote     |= MASK(EQ(v, '"')) << i;
+        backslash |= MASK(EQ(v, '\\')) << i;
+        op        |= MASK(OR(OR(EQ(l, '{'), EQ(l, '}')),
+                             OR(EQ(v, ':'), EQ(v, ',')))) << i;
+        ws        |= MASK(OR(OR(EQ(v, ' '), EQ(v, '\t')),
+                             OR(EQ(v, '\n'), EQ(v, '\r')))) << i;
+        nul       |= MASK(EQ(v, 0)) << i;
+    }
+
+    b->quote = quote;
+    b->backslash = backslash;
+    b->op = op;
+    b->ws = ws;
+    b->nul = nul;
+}
+#else
+static const uint8_t json_class[256] = {
+    [0]    = C_NUL,
+    ['"']  = C_QUOTE,
+    ['\\'] = C_BACKSLASH,
+    ['{']  = C_OP, ['}'] = C_OP, ['['] = C_OP, [']'] = C_OP,
+    [':']  = C_OP, [','] = C_OP,
+    [' ']  = C_WS, ['\t'] = C_WS, ['\n'] = C_WS, ['\r'] = C_WS,
+};
+
+static inline void classify(const char *p, struct json_block *b)
+{
+    int i;
+    uint64_t c;
+
+    memset(b, 0, sizeof(struct json_block));
+    for (i = 0; i < BLOCK; i++) {
+        c = json_class[(unsigned char) p[i]];
+        b->quote     |= (uint64_t) ((c & C_QUOTE) != 0) << i;
+        b->backslash |= (uint64_t) ((c & C_BACKSLASH) != 0) << i;
+        b->op        |= (uint64_t) ((c & C_OP) != 0) << i;
+        b->ws        |= (uint64_t) ((c & C_WS) != 0) << i;
+        b->nul       |= (uint64_t) ((c & C_NUL) != 0) << i;
+    }
+}
+#endif
+
+/*
+ * Bytes escaped by a backslash. Runs of backslashes are resolved with a
+ * subtraction: odd runs escape the byte that follows them, even runs don't.
+ * 'next' carries an escape to the first byte of the following block.
+ */
+static inline uint64_t find_escaped(uint64_t backslash, uint64_t *next)
+{
+    const uint64_t odd = 0xaaaaaaaaaaaaaaaaULL;
+    uint64_t potential;
+    uint64_t codes;
+    uint64_t escaped;
+
+    if (!backslash) {
+        escaped = *next;
+        *next = 0;
+        return escaped;
+    }
+
+    potential = backslash & ~*next;
+    codes = (((potential << 1) | odd) - potential) ^ odd;
+    escaped = codes ^ (backslash | *next);
+    *next = (codes & backslash) >> 63;
+
+    return escaped;
+}
+
+/* Bit i is set when an odd number of bits are set up to i */
+static inline uint64_t prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+static int index_grow(struct json_ctx *ctx)
+{
+    int size;
+    uint32_t *idx;
+    uint32_t *counts;
+
+    size = ctx->size * 2;
+    if (ctx->idx == ctx->idx_stack) {
+        idx = flb_malloc(sizeof(uint32_t) * size);
+        counts = flb_malloc(sizeof(uint32_t) * size);
+        if (!idx || !counts) {
+            flb_errno();
+            flb_free(idx);
+            flb_free(counts);
+            return -1;
+        }
+        memcpy(idx, ctx->idx, sizeof(uint32_t) * ctx->n);
+        memcpy(counts, ctx->counts, sizeof(uint32_t) * ctx->n);
+    }
+    else {
+        idx = flb_realloc(ctx->idx, sizeof(uint32_t) * size);
+        if (!idx) {
+            flb_errno();
+            return -1;
+        }
+        ctx->idx = idx;
+        counts = flb_realloc(ctx->counts, sizeof(uint32_t) * size);
+        if (!counts) {
+            flb_errno();
+            return -1;
+        }
+    }
+
+    ctx->idx = idx;
+    ctx->counts = counts;
+    ctx->size = size;
+    return 0;
+}
+
+/* Stage 1: build the structural index and count the containers elements */
+static int index_build(struct json_ctx *ctx)
+{
+    int k;
+    int n = 0;
+    int depth = 0;
+    int first = FLB_FALSE;
+    char c;
+    char pad[BLOCK];
+    size_t i;
+    const char *p;
+    const char *js = ctx->js;
+    uint32_t *idx = ctx->idx;
+    uint32_t *counts = ctx->counts;
+    uint64_t escaped;
+    uint64_t quote;
+    uint64_t in_string;
+    uint64_t outside;
+    uint64_t scalar;
+    uint64_t structurals;
+    uint64_t prev_escaped = 0;
+    uint64_t prev_in_string = 0;
+    uint64_t prev_scalar = 0;
+    struct json_block b;
+    uint32_t stack[FLB_PACK_FAST_DEPTH];
+
+    for (i = 0; i < ctx->len; i += BLOCK) {
+        if (ctx->len - i >= BLOCK) {
+            p = js + i;
+        }
+        else {
+            memset(pad, ' ', BLOCK);
+            memcpy(pad, js + i, ctx->len - i);
+            p = pad;
+        }
+        classify(p, &b);
+
+        /* jsmn stops at the first NUL byte */
+        if (b.nul) {
+            goto error;
+        }
+
+        escaped = find_escaped(b.backslash, &prev_escaped);
+        quote = b.quote & ~escaped;
+        in_string = prefix_xor(quote) ^ prev_in_string;
+        prev_in_string = (uint64_t) ((int64_t) in_string >> 63);
+
+        /* numbers and literals start after an operator or a whitespace */
+        outside = ~(in_string | quote);
+        scalar = outside & ~(b.op | b.ws);
+        structurals = (b.op & outside) | quote |
+                      (scalar & ~((scalar << 1) | prev_scalar));
+        prev_scalar = scalar >> 63;
+
+        if (n + BLOCK > ctx->size) {
+            ctx->n = n;
+            if (index_grow(ctx) == -1) {
+                return -1;
+            }
+            idx = ctx->idx;
+            counts = ctx->counts;
+        }
+
+        /* flatten the bitmask first, without branches */
+        k = n;
+        while (structurals) {
+            idx[n++] = i + __builtin_ctzll(structurals);
+            structurals &= structurals - 1;
+        }
+
+        for (; k < n; k++) {
+            c = js[idx[k]];
+            if (c == '}' || c == ']') {
+                if (depth == 0) {
+                    goto error;
+                }
+                depth--;
+                first = FLB_FALSE;
+            }
+            else if (c == ',') {
+                if (depth > 0) {
+                    counts[stack[depth - 1]]++;
+                }
+                first = FLB_FALSE;
+            }
+            else if (c != ':') {
+                /* first element of the current container */
+                if (first == FLB_TRUE) {
+                    counts[stack[depth - 1]] = 1;
+                    first = FLB_FALSE;
+                }
+                if (c == '{' || c == '[') {
+                    if (depth == FLB_PACK_FAST_DEPTH) {
+                        goto error;
+                    }
+                    stack[depth++] = k;
+                    counts[k] = 0;
+                    first = FLB_TRUE;
+                }
+            }
+        }
+    }
+    ctx->n = n;
+
+    /* unterminated string or container */
+    if (prev_in_string || depth != 0) {
+        return -1;
+    }
+
+    return 0;
+
+ error:
+    ctx->n = n;
+    return -1;
+}
+
+/*
+ * msgpack writer. Every value reserves its maximum size first, the buffer
+ * grows like a msgpack_sbuffer.
+ */
+static int out_grow(struct json_ctx *ctx, size_t bytes)
+{
+    char *tmp;
+    size_t size;
+
+    size = ctx->out_size * 2;
+    while (size < ctx->out_len + bytes) {
+        size *= 2;
+    }
+
+    tmp = flb_realloc(ctx->out, size);
+    if (!tmp) {
+        flb_errno();
+        return -1;
+    }
+    ctx->out = tmp;
+    ctx->out_size = size;
+    return 0;
+}
+
+static inline int out_reserve(struct json_ctx *ctx, size_t bytes)
+{
+    if (ctx->out_len + bytes <= ctx->out_size) {
+        return 0;
+    }
+    return out_grow(ctx, bytes);
+}
+
+static inline void put_be16(char *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void put_be32(char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline void put_be64(char *p, uint64_t v)
+{
+    put_be32(p, v >> 32);
+    put_be32(p + 4, v);
+}
+
+/* map (0x80) or array (0x90) header */
+static inline int pack_container(struct json_ctx *ctx, int fix, uint32_t n)
+{
+    char *p;
+
+    if (out_reserve(ctx, 5) == -1) {
+        return -1;
+    }
+    p = ctx->out + ctx->out_len;
+
+    if (n < 16) {
+        p[0] = fix | n;
+        ctx->out_len += 1;
+    }
+    else if (n < 65536) {
+        p[0] = (fix == 0x80) ? 0xde : 0xdc;
+        put_be16(p + 1, n);
+        ctx->out_len += 3;
+    }
+    else {
+        p[0] = (fix == 0x80) ? 0xdf : 0xdd;
+        put_be32(p + 1, n);
+        ctx->out_len += 5;
+    }
+    return 0;
+}
+
+static inline int str_header_size(size_t len)
+{
+    if (len < 32) {
+        return 1;
+    }
+    else if (len < 256) {
+        return 2;
+    }
+    else if (len < 65536) {
+        return 3;
+    }
+    return 5;
+}
+
+static inline void str_header(char *p, size_t len)
+{
+    if (len < 32) {
+        p[0] = 0xa0 | len;
+    }
+    else if (len < 256) {
+        p[0] = 0xd9;
+        p[1] = len;
+    }
+    else if (len < 65536) {
+        p[0] = 0xda;
+        put_be16(p + 1, len);
+    }
+    else {
+        p[0] = 0xdb;
+        put_be32(p + 1, len);
+    }
+}
+
+static inline int pack_int64(struct json_ctx *ctx, int64_t v)
+{
+    char *p;
+
+    if (out_reserve(ctx, 9) == -1) {
+        return -1;
+    }
+    p = ctx->out + ctx->out_len;
+
+    if (v < -(1LL << 5)) {
+        if (v < -(1LL << 31)) {
+            p[0] = 0xd3;
+            put_be64(p + 1, v);
+            ctx->out_len += 9;
+        }
+        else if (v < -(1LL << 15)) {
+            p[0] = 0xd2;
+            put_be32(p + 1, v);
+            ctx->out_len += 5;
+        }
+        else if (v < -(1LL << 7)) {
+            p[0] = 0xd1;
+            put_be16(p + 1, v);
+            ctx->out_len += 3;
+        }
+        else {
+            p[0] = 0xd0;
+            p[1] = v;
+            ctx->out_len += 2;
+        }
+    }
+    else if (v < (1LL << 7)) {
+        p[0] = v;
+        ctx->out_len += 1;
+    }
+    else if (v < (1LL << 8)) {
+        p[0] = 0xcc;
+        p[1] = v;
+        ctx->out_len += 2;
+    }
+    else if (v < (1LL << 16)) {
+        p[0] = 0xcd;
+        put_be16(p + 1, v);
+        ctx->out_len += 3;
+    }
+    else if (v < (1LL << 32)) {
+        p[0] = 0xce;
+        put_be32(p + 1, v);
+        ctx->out_len += 5;
+    }
+    else {
+        p[0] = 0xcf;
+        put_be64(p + 1, v);
+        ctx->out_len += 9;
+    }
+    return 0;
+}
+
+static inline int pack_double(struct json_ctx *ctx, double d)
+{
+    union {
+        double d;
+        uint64_t u;
+    } v;
+
+    if (out_reserve(ctx, 9) == -1) {
+        return -1;
+    }
+    v.d = d;
+    ctx->out[ctx->out_len] = 0xcb;
+    put_be64(ctx->out + ctx->out_len + 1, v.u);
+    ctx->out_len += 9;
+    return 0;
+}
+
+static inline int pack_byte(struct json_ctx *ctx, unsigned char c)
+{
+    if (out_reserve(ctx, 1) == -1) {
+        return -1;
+    }
+    ctx->out[ctx->out_len++] = c;
+    return 0;
+}
+
+static inline char cur_char(struct json_ctx *ctx)
+{
+    if (ctx->k >= ctx->n) {
+        return '\0';
+    }
+    return ctx->js[ctx->idx[ctx->k]];
+}
+
+/* The same escapes jsmn accepts */
+static int escapes_valid(const char *str, const char *end)
+{
+    int i;
+    char c;
+
+    while ((str = memchr(str, '\\', end - str))) {
+        str++;
+        switch (*str) {
+        case '"': case '/': case '\\': case 'b':
+        case 'f': case 'r': case 'n':  case 't':
+            str++;
+            break;
+        case 'u':
+            str++;
+            for (i = 0; i < 4; i++, str++) {
+                c = *str;
+                if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') ||
+                      (c >= 'a' && c <= 'f'))) {
+                    return FLB_FALSE;
+                }
+            }
+            break;
+        default:
+            return FLB_FALSE;
+        }
+    }
+
+    return FLB_TRUE;
+}
+
+/*
+ * Unescape a string, the bytes between escapes are copied at once. It gives
+ * up on \uXXXX sequences (-1), they are left to flb_unescape_string_utf8().
+ */
+static int unescape(const char *str, int len, char *out)
+{
+    int n;
+    char c;
+    char *o = out;
+    const char *bs;
+    const char *end = str + len;
+
+    while ((bs = memchr(str, '\\', end - str))) {
+        n = bs - str;
+        memcpy(o, str, n);
+        o += n;
+
+        switch (bs[1]) {
+        case '"':
+        case '/':
+        case '\\':
+            c = bs[1];
+            break;
+        case 'b':
+            c = '\b';
+            break;
+        case 'f':
+            c = '\f';
+            break;
+        case 'n':
+            c = '\n';
+            break;
+        case 'r':
+            c = '\r';
+            break;
+        case 't':
+            c = '\t';
+            break;
+        default:
+            return -1;
+        }
+        *o++ = c;
+        str = bs + 2;
+    }
+
+    n = end - str;
+    memcpy(o, str, n);
+    o += n;
+
+    return o - out;
+}
+
+/* Pack the string starting at the current structural, returns its length */
+static int pack_string(struct json_ctx *ctx)
+{
+    int len;
+    int hdr;
+    int out_len;
+    char *body;
+    const char *str;
+
+    str = ctx->js + ctx->idx[ctx->k] + 1;
+    len = ctx->idx[ctx->k + 1] - ctx->idx[ctx->k] - 1;
+    ctx->k += 2;
+
+    if (out_reserve(ctx, 5 + len) == -1) {
+        return -1;
+    }
+
+    /* the body goes after the longest header it can need */
+    hdr = str_header_size(len);
+    body = ctx->out + ctx->out_len + hdr;
+
+    if (!memchr(str, '\\', len)) {
+        memcpy(body, str, len);
+        out_len = len;
+    }
+    else {
+        out_len = unescape(str, len, body);
+        if (out_len == -1) {
+            if (escapes_valid(str, str + len) == FLB_FALSE) {
+                return -1;
+            }
+            out_len = flb_unescape_string_utf8(str, len, body);
+        }
+
+        /* unescaped, the header might be shorter */
+        if (str_header_size(out_len) != hdr) {
+            memmove(body - hdr + str_header_size(out_len), body, out_len);
+            hdr = str_header_size(out_len);
+        }
+    }
+
+    str_header(ctx->out + ctx->out_len, out_len);
+    ctx->out_len += hdr + out_len;
+
+    return out_len;
+}
+
+/* A number or a literal must be followed by one of these, like in jsmn */
+static inline int is_scalar_end(struct json_ctx *ctx, const char *p)
+{
+    if (p >= ctx->js + ctx->len) {
+        return FLB_FALSE;
+    }
+
+    switch (*p) {
+    case ' ': case '\t': case '\n': case '\r':
+    case ',': case ']':  case '}':
+        return FLB_TRUE;
+    }
+    return FLB_FALSE;
+}
+
+static int pack_number(struct json_ctx *ctx, const char *p)
+{
+    int ret;
+    int digits = 0;
+    int is_float = FLB_FALSE;
+    int64_t val = 0;
+    const char *q = p;
+    const char *end = ctx->js + ctx->len;
+
+    if (*q == '-') {
+        q++;
+    }
+    if (q >= end || *q < '0' || *q > '9') {
+        return -1;
+    }
+
+    if (*q == '0') {
+        q++;
+        digits++;
+        if (q < end && *q >= '0' && *q <= '9') {
+            return -1;
+        }
+    }
+    else {
+        while (q < end && *q >= '0' && *q <= '9') {
+            if (digits < 18) {
+                val = (val * 10) + (*q - '0');
+            }
+            q++;
+            digits++;
+        }
+    }
+
+    if (q < end && *q == '.') {
+        is_float = FLB_TRUE;
+        q++;
+        if (q >= end || *q < '0' || *q > '9') {
+            return -1;
+        }
+        while (q < end && *q >= '0' && *q <= '9') {
+            q++;
+        }
+    }
+
+    /* jsmn based packing reads '1e3' as the integer 1, leave it there */
+    if (q < end && (*q == 'e' || *q == 'E')) {
+        if (is_float == FLB_FALSE) {
+            return -1;
+        }
+        q++;
+        if (q < end && (*q == '+' || *q == '-')) {
+            q++;
+        }
+        if (q >= end || *q < '0' || *q > '9') {
+            return -1;
+        }
+        while (q < end && *q >= '0' && *q <= '9') {
+            q++;
+        }
+    }
+
+    if (is_scalar_end(ctx, q) == FLB_FALSE) {
+        return -1;
+    }
+
+    if (is_float == FLB_TRUE) {
+        ret = pack_double(ctx, strtod(p, NULL));
+    }
+    else if (digits > 18) {
+        /* out of the fast path, saturates like atol() */
+        ret = pack_int64(ctx, strtol(p, NULL, 10));
+    }
+    else {
+        ret = pack_int64(ctx, *p == '-' ? -val : val);
+    }
+
+    ctx->k++;
+    return ret;
+}
+
+static inline int literal(struct json_ctx *ctx, const char *p,
+                          const char *str, int len)
+{
+    if (ctx->js + ctx->len - p < len || memcmp(p, str, len) != 0) {
+        return FLB_FALSE;
+    }
+    return is_scalar_end(ctx, p + len);
+}
+
+static int pack_value(struct json_ctx *ctx, int depth);
+
+static int pack_object(struct json_ctx *ctx, int depth)
+{
+    int i;
+    int ret;
+    int len;
+    int match;
+    uint32_t count;
+    size_t kv_off;
+    struct flb_pack_json_key *key = ctx->key;
+
+    count = ctx->counts[ctx->k];
+    if (pack_container(ctx, 0x80, count) == -1) {
+        return -1;
+    }
+    ctx->k++;
+
+    for (i = 0; i < count; i++) {
+        if (cur_char(ctx) != '"') {
+            return -1;
+        }
+
+        kv_off = ctx->out_len;
+        len = pack_string(ctx);
+        if (len == -1) {
+            return -1;
+        }
+
+        /* key lookup, compare the unescaped name */
+        match = FLB_FALSE;
+        if (key && depth == 0 && key->found == FLB_FALSE &&
+            len == key->name_len &&
+            memcmp(ctx->out + ctx->out_len - len, key->name, len) == 0) {
+            match = FLB_TRUE;
+        }
+
+        if (cur_char(ctx) != ':') {
+            return -1;
+        }
+        ctx->k++;
+
+        if (match == FLB_TRUE) {
+            /* the caller knows what to do with a string only */
+            if (cur_char(ctx) != '"') {
+                return -1;
+            }
+            len = pack_string(ctx);
+            if (len == -1) {
+                return -1;
+            }
+            key->found = FLB_TRUE;
+            key->kv_off = kv_off;
+            key->kv_end = ctx->out_len;
+            key->val_off = ctx->out_len - len;
+            key->val_len = len;
+        }
+        else {
+            ret = pack_value(ctx, depth + 1);
+            if (ret == -1) {
+                return -1;
+            }
+        }
+
+        if (cur_char(ctx) != (i + 1 < count ? ',' : '}')) {
+            return -1;
+        }
+        ctx->k++;
+    }
+
+    if (count == 0) {
+        if (cur_char(ctx) != '}') {
+            return -1;
+        }
+        ctx->k++;
+    }
+
+    return 0;
+}
+
+static int pack_array(struct json_ctx *ctx, int depth)
+{
+    int i;
+    uint32_t count;
+
+    count = ctx->counts[ctx->k];
+    if (pack_container(ctx, 0x90, count) == -1) {
+        return -1;
+    }
+    ctx->k++;
+
+    for (i = 0; i < count; i++) {
+        if (pack_value(ctx, depth + 1) == -1) {
+            return -1;
+        }
+        if (cur_char(ctx) != (i + 1 < count ? ',' : ']')) {
+            return -1;
+        }
+        ctx->k++;
+    }
+
+    if (count == 0) {
+        if (cur_char(ctx) != ']') {
+            return -1;
+        }
+        ctx->k++;
+    }
+
+    return 0;
+}
+
+static int pack_value(struct json_ctx *ctx, int depth)
+{
+    int ret;
+    const char *p;
+
+    if (ctx->k >= ctx->n) {
+        return -1;
+    }
+    p = ctx->js + ctx->idx[ctx->k];
+
+    switch (*p) {
+    case '{':
+        return pack_object(ctx, depth);
+    case '[':
+        return pack_array(ctx, depth);
+    case '"':
+        return pack_string(ctx) == -1 ? -1 : 0;
+    case 't':
+        if (literal(ctx, p, "true", 4) == FLB_FALSE) {
+            return -1;
+        }
+        ret = pack_byte(ctx, 0xc3);
+        break;
+    case 'f':
+        if (literal(ctx, p, "false", 5) == FLB_FALSE) {
+            return -1;
+        }
+        ret = pack_byte(ctx, 0xc2);
+        break;
+    case 'n':
+        if (literal(ctx, p, "null", 4) == FLB_FALSE) {
+            return -1;
+        }
+        ret = pack_byte(ctx, 0xc0);
+        break;
+    default:
+        return pack_number(ctx, p);
+    }
+
+    ctx->k++;
+    return ret;
+}
+
+static void ctx_destroy(struct json_ctx *ctx)
+{
+    if (ctx->idx != ctx->idx_stack) {
+        flb_free(ctx->idx);
+        flb_free(ctx->counts);
+    }
+}
+
+int flb_pack_json_fast(const char *js, size_t len,
+                       char **buffer, size_t *size, int *root_type,
+                       struct flb_pack_json_key *key)
+{
+    int ret;
+    int type;
+    struct json_ctx ctx;
+
+    if (len == 0 || len >= UINT32_MAX) {
+        return -1;
+    }
+
+    ctx.js = js;
+    ctx.len = len;
+    ctx.n = 0;
+    ctx.size = INDEX_STACK;
+    ctx.idx = ctx.idx_stack;
+    ctx.counts = ctx.counts_stack;
+    ctx.k = 0;
+    ctx.key = key;
+    if (key) {
+        key->found = FLB_FALSE;
+    }
+
+    ret = index_build(&ctx);
+    if (ret == -1 || ctx.n == 0) {
+        ctx_destroy(&ctx);
+        return -1;
+    }
+
+    switch (js[ctx.idx[0]]) {
+    case '{':
+        type = FLB_PACK_JSON_OBJECT;
+        break;
+    case '[':
+        type = FLB_PACK_JSON_ARRAY;
+        break;
+    case '"':
+        type = FLB_PACK_JSON_STRING;
+        break;
+    default:
+        type = FLB_PACK_JSON_PRIMITIVE;
+    }
+
+    /* msgpack is usually smaller than JSON, numbers aside */
+    ctx.out_len = 0;
+    ctx.out_size = len + 64;
+    ctx.out = flb_malloc(ctx.out_size);
+    if (!ctx.out) {
+        flb_errno();
+        ctx_destroy(&ctx);
+        return -1;
+    }
+
+    /*
+     * Concatenated messages are packed one after the other. jsmn in strict
+     * mode rejects a string out of a container.
+     */
+    while (ctx.k < ctx.n) {
+        ret = -1;
+        if (cur_char(&ctx) != '"') {
+            ret = pack_value(&ctx, 0);
+        }
+        if (ret == -1 || (key && ctx.k < ctx.n)) {
+            flb_free(ctx.out);
+            ctx_destroy(&ctx);
+            return -1;
+        }
+    }
+    ctx_destroy(&ctx);
+
+    *buffer = ctx.out;
+    *size = ctx.out_len;
+    *root_type = type;
+
+    return 0;
+}
+
+void flb_pack_json_key_remove(char *buf, size_t *size,
+                              struct flb_pack_json_key *key)
+{
+    int len;
+    int new_len;
+    uint32_t count;
+    unsigned char *p = (unsigned char *) buf;
+    unsigned char hdr[5];
+
+    /* current header of the root map */
+    if ((p[0] & 0xf0) == 0x80) {
+        count = p[0] & 0x0f;
+        len = 1;
+    }
+    else if (p[0] == 0xde) {
+        count = (p[1] << 8) | p[2];
+        len = 3;
+    }
+    else {
+        count = ((uint32_t) p[1] << 24) | (p[2] << 16) | (p[3] << 8) | p[4];
+        len = 5;
+    }
+
+    count--;
+    if (count < 16) {
+        hdr[0] = 0x80 | count;
+        new_len = 1;
+    }
+    else if (count < 65536) {
+        hdr[0] = 0xde;
+        hdr[1] = count >> 8;
+        hdr[2] = count & 0xff;
+        new_len = 3;
+    }
+    else {
+        hdr[0] = 0xdf;
+        hdr[1] = count >> 24;
+        hdr[2] = (count >> 16) & 0xff;
+        hdr[3] = (count >> 8) & 0xff;
+        hdr[4] = count & 0xff;
+        new_len = 5;
+    }
+
+    /* the header can only get shorter */
+    if (new_len != len) {
+        memmove(buf + new_len, buf + len, key->kv_off - len);
+    }
+    memcpy(buf, hdr, new_len);
+    memmove(buf + key->kv_off - (len - new_len), buf + key->kv_end,
+            *size - key->kv_end);
+
+    *size -= (len - new_len) + (key->kv_end - key->kv_off);
+}
@@ -23,9 +23,90 @@
 
 #include <fluent-bit/flb_parser.h>
 #include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_pack_fast.h>
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_parser_decoder.h>
 
+/* The message must go through the generic path */
+#define JSON_FAST_SKIP   -2
+
+/*
+ * Without decoders the time key is looked up while the message is packed
+ * and removed from the msgpack buffer in place, the map is not unpacked
+ * and packed again.
+ */
+static int json_do_fast(struct flb_parser *parser,
+                        const char *in_buf, size_t in_size,
+                        void **out_buf, size_t *out_size,
+                        struct flb_time *out_time)
+{
+    int ret;
+    int root_type;
+    double tmfrac = 0;
+    char *mp_buf;
+    char *val;
+    char tmp[255];
+    size_t mp_size;
+    size_t len;
+    time_t time_lookup;
+    struct tm tm = {0};
+    struct flb_pack_json_key key;
+    struct flb_pack_json_key *k = NULL;
+
+    if (parser->time_fmt) {
+        key.name = parser->time_key ? parser->time_key : "time";
+        key.name_len = strlen(key.name);
+        k = &key;
+    }
+
+    ret = flb_pack_json_fast(in_buf, in_size, &mp_buf, &mp_size,
+                             &root_type, k);
+    if (ret != 0) {
+        return JSON_FAST_SKIP;
+    }
+
+    /* Make sure object is a map */
+    if (root_type != FLB_PACK_JSON_OBJECT) {
+        flb_free(mp_buf);
+        return -1;
+    }
+
+    *out_buf = mp_buf;
+    *out_size = mp_size;
+
+    /* No time resolution or no time_key field found */
+    if (!k || key.found == FLB_FALSE) {
+        return *out_size;
+    }
+
+    /* Lookup time */
+    val = mp_buf + key.val_off;
+    ret = flb_parser_time_lookup(val, key.val_len, 0, parser, &tm, &tmfrac);
+    if (ret == -1) {
+        len = key.val_len;
+        if (len > sizeof(tmp) - 1) {
+            len = sizeof(tmp) - 1;
+        }
+        memcpy(tmp, val, len);
+        tmp[len] = '\0';
+        flb_warn("[parser:%s] invalid time format %s for '%s'",
+                 parser->name, parser->time_fmt_full, tmp);
+        time_lookup = 0;
+    }
+    else {
+        time_lookup = flb_parser_tm2time(&tm);
+    }
+
+    if (parser->time_keep == FLB_FALSE) {
+        flb_pack_json_key_remove(mp_buf, out_size, &key);
+    }
+
+    out_time->tm.tv_sec  = time_lookup;
+    out_time->tm.tv_nsec = (tmfrac * 1000000000);
+
+    return *out_size;
+}
+
 int flb_parser_json_do(struct flb_parser *parser,
                        const char *in_buf, size_t in_size,
                        void **out_buf, size_t *out_size,
@@ -56,6 +137,14 @@ int flb_parser_json_do(struct flb_parser *parser,
     struct tm tm = {0};
     struct flb_time *t;
 
+    if (!parser->decoders) {
+        ret = json_do_fast(parser, in_buf, in_size,
+                           out_buf, out_size, out_time);
+        if (ret != JSON_FAST_SKIP) {
+            return ret;
+        }
+    }
+
     /* Convert incoming in_buf JSON message to message pack format */
     ret = flb_pack_json(in_buf, in_size, &mp_buf, &mp_size, &root_type);
     if (ret != 0) {
@@ -26,6 +26,8 @@
 #include <fluent-bit/flb_input_chunk.h>
 #include <fluent-bit/flb_output.h>
 #include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_filter.h>
+#include <fluent-bit/flb_hash.h>
 #include <fluent-bit/flb_router.h>
 
 #ifdef FLB_HAVE_REGEX
@@ -164,7 +166,7 @@ int flb_router_io_set(struct flb_config *config)
                       i_ins->name, o_ins->name);
             o_ins->match = flb_sds_create_len("*", 1);
             flb_router_connect(i_ins, o_ins);
-            return 0;
+            goto compile;
         }
     }
 
@@ -210,6 +212,17 @@ int flb_router_io_set(struct flb_config *config)
         }
     }
 
+ compile:
+    /* Compile Match rules for dynamic routing of outputs and filters */
+    if (config->router) {
+        flb_router_destroy(config->router);
+    }
+    config->router = flb_router_create(config);
+    if (!config->router) {
+        flb_error("[router] could not compile routing rules");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -233,57 +246,425 @@ void flb_router_exit(struct flb_config *config)
             flb_free(r);
         }
     }
+
+    if (config->router) {
+        flb_router_destroy(config->router);
+        config->router = NULL;
+    }
+}
+
+static struct flb_router_node *node_create(unsigned char c)
+{
+    struct flb_router_node *node;
+
+    node = flb_calloc(1, sizeof(struct flb_router_node));
+    if (!node) {
+        flb_errno();
+        return NULL;
+    }
+    node->c = c;
+    mk_list_init(&node->rules);
+
+    return node;
+}
+
+static void node_destroy(struct flb_router_node *node)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_router_node *child;
+    struct flb_router_node *next;
+    struct flb_router_rule *rule;
+
+    child = node->child;
+    while (child) {
+        next = child->next;
+        node_destroy(child);
+        child = next;
+    }
+
+    mk_list_foreach_safe(head, tmp, &node->rules) {
+        rule = mk_list_entry(head, struct flb_router_rule, _head);
+        mk_list_del(&rule->_head);
+        flb_free(rule);
+    }
+
+    flb_free(node);
+}
+
+static inline struct flb_router_node *node_child(struct flb_router_node *node,
+                                                 unsigned char c)
+{
+    struct flb_router_node *child;
+
+    for (child = node->child; child; child = child->next) {
+        if (child->c == c) {
+            return child;
+        }
+    }
+
+    return NULL;
+}
+
+static struct flb_router_rule *rule_create(int type, int index, void *ins)
+{
+    struct flb_router_rule *rule;
+
+    rule = flb_calloc(1, sizeof(struct flb_router_rule));
+    if (!rule) {
+        flb_errno();
+        return NULL;
+    }
+    rule->type = type;
+    rule->index = index;
+    rule->ins = ins;
+
+    return rule;
 }
 
 /*
- * Calculate the routes_mask for input chunk with a router_match on tag
+ * Register the rules of an instance: a wildcard 'Match' pattern is placed
+ * in the trie under the node of its literal prefix, while a 'Match_Regex'
+ * pattern goes to the list of regex rules which are always evaluated.
  */
-uint64_t flb_router_get_routes_mask_by_tag(const char *tag, int tag_len,
-                                           struct flb_input_instance *in) {
-    uint64_t routes_mask = 0;
-    struct mk_list *o_head;
-    struct flb_output_instance *o_ins;
-    if (!in) {
+static int router_add_rules(struct flb_router *router, int type, int index,
+                            void *ins, char *match, void *match_regex)
+{
+    int i;
+    struct flb_router_node *node;
+    struct flb_router_node *child;
+    struct flb_router_rule *rule;
+
+    if (match_regex) {
+        rule = rule_create(type, index, ins);
+        if (!rule) {
+            return -1;
+        }
+        rule->match_regex = match_regex;
+        mk_list_add(&rule->_head, &router->regex_rules);
+    }
+
+    if (!match) {
+        return 0;
+    }
+
+    rule = rule_create(type, index, ins);
+    if (!rule) {
         return -1;
     }
+    rule->match = match;
 
-    /* Find all matching routes for the given tag */
-    mk_list_foreach(o_head, &in->config->outputs) {
-        o_ins = mk_list_entry(o_head,
-                              struct flb_output_instance, _head);
+    /* Lookup or create the path for the literal prefix */
+    node = router->root;
+    for (i = 0; match[i] != '\0' && match[i] != '*'; i++) {
+        child = node_child(node, match[i]);
+        if (!child) {
+            child = node_create(match[i]);
+            if (!child) {
+                flb_free(rule);
+                return -1;
+            }
+            child->next = node->child;
+            node->child = child;
+        }
+        node = child;
+    }
+
+    rule->prefix_len = i;
+    rule->literal = (match[i] == '\0');
+    mk_list_add(&rule->_head, &node->rules);
+
+    return 0;
+}
+
+static inline void route_set(struct flb_router *router,
+                             struct flb_router_route *route,
+                             struct flb_router_rule *rule)
+{
+    struct flb_output_instance *o_ins;
+
+    if (rule->type == FLB_ROUTER_OUTPUT) {
+        /*
+         * mask_id of each output instance is an unique number starting from
+         * zero which represents the position of the bit that belongs to the
+         * instance in the routes mask: setting the bits of all the matching
+         * output instances tells us where the chunk will be flushed.
+         *
+         * For example: we have two matching output instances with mask_id 0
+         * and 2, the resulting mask is 00101 and means that the input chunk
+         * will flush to the first and third output instances configured.
+         */
+        o_ins = rule->ins;
+        flb_routes_mask_set_bit(route->routes_mask, o_ins->mask_id);
+    }
+    else {
+        router->matched[rule->index] = FLB_TRUE;
+    }
+}
+
+/*
+ * Resolve the routes for a NULL terminated tag: walk the trie following the
+ * tag characters, every node in the path holds the rules whose literal
+ * prefix matched, so only the remaining wildcard part needs to be checked.
+ */
+static void route_resolve(struct flb_router *router,
+                          const char *tag, int tag_len,
+                          struct flb_router_route *route)
+{
+    int i;
+    int depth = 0;
+    struct mk_list *head;
+    struct flb_router_node *node;
+    struct flb_router_rule *rule;
+    struct flb_filter_instance **filters;
+
+    flb_routes_mask_clear(route->routes_mask, route->routes_mask_size);
+    route->filters_count = 0;
+    if (router->filters_count > 0) {
+        memset(router->matched, '\0', router->filters_count);
+    }
+
+    node = router->root;
+    while (node) {
+        mk_list_foreach(head, &node->rules) {
+            rule = mk_list_entry(head, struct flb_router_rule, _head);
+            if (rule->literal) {
+                if (depth == tag_len) {
+                    route_set(router, route, rule);
+                }
+            }
+            else if (router_match(tag + depth, tag_len - depth,
+                                  rule->match + depth, NULL)) {
+                route_set(router, route, rule);
+            }
+        }
+
+        if (depth == tag_len) {
+            break;
+        }
+        node = node_child(node, tag[depth]);
+        depth++;
+    }
 
-        if (flb_router_match(tag, tag_len, o_ins->match
+    mk_list_foreach(head, &router->regex_rules) {
+        rule = mk_list_entry(head, struct flb_router_rule, _head);
+        if (router_match(tag, tag_len, NULL, rule->match_regex)) {
+            route_set(router, route, rule);
+        }
+    }
+
+    /* Filters must keep the order defined in the configuration */
+    filters = flb_router_route_filters(route);
+    for (i = 0; i < router->filters_count; i++) {
+        if (router->matched[i] == FLB_TRUE) {
+            filters[route->filters_count++] = router->filters[i];
+        }
+    }
+}
+
+/*
+ * Compile the 'Match' and 'Match_Regex' rules of every output and filter
+ * instance into a trie and create the cache of resolved routes by Tag.
+ */
+struct flb_router *flb_router_create(struct flb_config *config)
+{
+    int ret;
+    int index = 0;
+    struct mk_list *head;
+    struct flb_router *router;
+    struct flb_output_instance *o_ins;
+    struct flb_filter_instance *f_ins;
+
+    router = flb_calloc(1, sizeof(struct flb_router));
+    if (!router) {
+        flb_errno();
+        return NULL;
+    }
+    mk_list_init(&router->regex_rules);
+
+    router->root = node_create('\0');
+    if (!router->root) {
+        flb_free(router);
+        return NULL;
+    }
+
+    router->filters_count = mk_list_size(&config->filters);
+    router->filters = flb_calloc(1, sizeof(struct flb_filter_instance *) *
+                                 (router->filters_count + 1));
+    router->matched = flb_calloc(1, router->filters_count + 1);
+    router->route = flb_calloc(1, sizeof(struct flb_router_route) +
+                               sizeof(flb_route_mask_element) *
+                               config->routes_mask_size +
+                               sizeof(struct flb_filter_instance *) *
+                               router->filters_count);
+    if (!router->filters || !router->matched || !router->route) {
+        flb_errno();
+        flb_router_destroy(router);
+        return NULL;
+    }
+    router->route->routes_mask_size = config->routes_mask_size;
+
+    mk_list_foreach(head, &config->outputs) {
+        o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+        ret = router_add_rules(router, FLB_ROUTER_OUTPUT, -1, o_ins,
+                               o_ins->match,
 #ifdef FLB_HAVE_REGEX
-                             , o_ins->match_regex
+                               o_ins->match_regex
 #else
-                             , NULL
+                               NULL
 #endif
-                             )) {
-            /*
-             * mask_id for each output instance is a unique number starting from 1
-             * and multple by 2 each time. (e.g 1, 2 ,4 ,8, 16 ...)
-             * Let's take a look of the binary of the mask_id:
-             *   1:   00000001
-             *   2:   00000010
-             *   4:   00000100
-             *   8:   00001000
-             *   16:  00010000
-             * We can notice that each binary has only one 1's bit and this also
-             * represents the postion of the output instance. Getting the OR of 
-             * mask_id (given that tag is matched) will tell us the output instances 
-             * that the given input chunk will flush to.
-             * 
-             * For example: We have two matching output instances with mask_id 1 and 4
-             * There are two 1's in the binary with index 0 and 2 (starting from right)
-             * and this means that the input chunk will flush to first and third output
-             * instances configured in the Fluent Bit configuraion.
-             * 
-             *    0 |= 1 -> 00000 |= 00001 -> 00001
-             *    00001 |= 4 -> 00001 |= 00100 -> 00101
-             */
-            routes_mask |= o_ins->mask_id;
+                               );
+        if (ret == -1) {
+            flb_router_destroy(router);
+            return NULL;
+        }
+    }
+
+    mk_list_foreach(head, &config->filters) {
+        f_ins = mk_list_entry(head, struct flb_filter_instance, _head);
+        router->filters[index] = f_ins;
+        ret = router_add_rules(router, FLB_ROUTER_FILTER, index, f_ins,
+                               f_ins->match,
+#ifdef FLB_HAVE_REGEX
+                               f_ins->match_regex
+#else
+                               NULL
+#endif
+                               );
+        if (ret == -1) {
+            flb_router_destroy(router);
+            return NULL;
+        }
+        index++;
+    }
+
+    if (config->router_cache_size > 0) {
+        router->cache = flb_hash_create(FLB_HASH_EVICT_OLDER,
+                                        config->router_cache_size,
+                                        config->router_cache_size);
+        if (!router->cache) {
+            flb_router_destroy(router);
+            return NULL;
+        }
+    }
+
+    return router;
+}
+
+void flb_router_destroy(struct flb_router *router)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_router_rule *rule;
+
+    mk_list_foreach_safe(head, tmp, &router->regex_rules) {
+        rule = mk_list_entry(head, struct flb_router_rule, _head);
+        mk_list_del(&rule->_head);
+        flb_free(rule);
+    }
+
+    if (router->root) {
+        node_destroy(router->root);
+    }
+    if (router->cache) {
+        flb_hash_destroy(router->cache);
+    }
+
+    flb_free(router->filters);
+    flb_free(router->matched);
+    flb_free(router->route);
+    flb_free(router);
+}
+
+/*
+ * Get the output instances and filters that matches the given Tag. The
+ * returned route is owned by the router and it's only valid until the next
+ * call to this function.
+ */
+struct flb_router_route *flb_router_route_get(const char *tag, int tag_len,
+                                              struct flb_config *config)
+{
+    int ret;
+    size_t size;
+    char *ntag;
+    char buf[256];
+    struct flb_router *router;
+    struct flb_router_route *route;
+
+    router = config->router;
+    if (!router) {
+        router = flb_router_create(config);
+        if (!router) {
+            return NULL;
         }
+        config->router = router;
+    }
+
+    /* Fast path: routes previously resolved for this Tag */
+    if (router->cache && tag_len > 0) {
+        ret = flb_hash_get(router->cache, tag, tag_len,
+                           (const char **) &route, &size);
+        if (ret >= 0) {
+            return route;
+        }
+    }
+
+    /* The wildcard matcher expects a NULL terminated Tag */
+    if (tag_len < (int) sizeof(buf)) {
+        ntag = buf;
+    }
+    else {
+        ntag = flb_malloc(tag_len + 1);
+        if (!ntag) {
+            flb_errno();
+            return NULL;
+        }
+    }
+    memcpy(ntag, tag, tag_len);
+    ntag[tag_len] = '\0';
+
+    route = router->route;
+    route_resolve(router, ntag, tag_len, route);
+
+    if (ntag != buf) {
+        flb_free(ntag);
+    }
+
+    if (router->cache && tag_len > 0) {
+        size = sizeof(struct flb_router_route) +
+            (sizeof(flb_route_mask_element) * route->routes_mask_size) +
+            (sizeof(struct flb_filter_instance *) * route->filters_count);
+        flb_hash_add(router->cache, tag, tag_len, (const char *) route, size);
     }
 
-    return routes_mask;
+    return route;
+}
+
+/*
+ * Calculate the routes_mask for input chunk using the compiled routes of tag,
+ * 'routes_mask' must have room for config->routes_mask_size elements. Returns
+ * the number of matching output instances or -1 on error.
+ */
+int flb_router_get_routes_mask_by_tag(const char *tag, int tag_len,
+                                      struct flb_input_instance *in,
+                                      flb_route_mask_element *routes_mask)
+{
+    struct flb_router_route *route;
+
+    if (!in) {
+        return -1;
+    }
+
+    flb_routes_mask_clear(routes_mask, in->config->routes_mask_size);
+
+    /* Find all matching routes for the given tag */
+    route = flb_router_route_get(tag, tag_len, in->config);
+    if (!route) {
+        return -1;
+    }
+
+    flb_routes_mask_copy(routes_mask, route->routes_mask,
+                         route->routes_mask_size);
+
+    return flb_routes_mask_popcount(routes_mask, route->routes_mask_size);
 }
@@ -30,6 +30,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#ifdef MK_HAVE_TIMERFD_CREATE
+#include <sys/timerfd.h>
+#endif
 
 static inline double xmin(double a, double b)
 {
@@ -99,123 +102,265 @@ static int random_uniform(int min, int max)
     return ra / copies + min;
 }
 
-/*
- * Schedule a request that will be processed within the next
- * FLB_SCHED_REQUEST_FRAME seconds.
- */
-static int schedule_request_now(int seconds,
-                                struct flb_sched_timer *timer,
-                                struct flb_sched_request *request,
-                                struct flb_config *config)
+/* Monotonic clock in milliseconds, the time unit of the wheel */
+static uint64_t sched_clock()
 {
-    flb_pipefd_t fd;
-    struct mk_event *event;
-    struct flb_sched *sched = config->sched;
+#ifdef _MSC_VER
+    return GetTickCount64();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000) + (ts.tv_nsec / 1000000);
+#endif
+}
 
-    /* Initialize event */
-    event = &timer->event;
-    event->mask   = MK_EVENT_EMPTY;
-    event->status = MK_EVENT_NONE;
+/* Link a timer to the wheel slot of its expiration time */
+static void wheel_add(struct flb_sched *sched, struct flb_sched_timer *timer)
+{
+    int level;
+    int slot;
+    uint64_t delta;
+    uint64_t expire;
 
-    /* Create a timeout into the main event loop */
-    fd = mk_event_timeout_create(config->evl, seconds, 0, event);
-    if (fd == -1) {
-        return -1;
+    /* Already expired, run it on the next tick */
+    expire = timer->expire;
+    if (expire < sched->now) {
+        expire = sched->now;
     }
-    request->fd = fd;
 
-    /*
-     * Note: mk_event_timeout_create() sets a type = MK_EVENT_NOTIFICATION by
-     * default, we need to overwrite this value so we can do a clean check
-     * into the Engine when the event is triggered.
-     */
-    event->type = FLB_ENGINE_EV_SCHED;
-    mk_list_add(&request->_head, &sched->requests);
+    delta = expire - sched->now;
+    for (level = 0; level < FLB_SCHED_WHEEL_LEVELS - 1; level++) {
+        if (delta < (1ULL << (FLB_SCHED_WHEEL_BITS * (level + 1)))) {
+            break;
+        }
+    }
 
-    return 0;
+    /* Beyond the last level: queued again once the slot is reached */
+    if (delta >> (FLB_SCHED_WHEEL_BITS * FLB_SCHED_WHEEL_LEVELS)) {
+        expire = sched->now +
+            (1ULL << (FLB_SCHED_WHEEL_BITS * FLB_SCHED_WHEEL_LEVELS)) - 1;
+    }
+
+    slot = (expire >> (FLB_SCHED_WHEEL_BITS * level)) & FLB_SCHED_WHEEL_MASK;
+    mk_list_add(&timer->_wheel, &sched->wheel[level][slot]);
+    sched->bitmap[level] |= (1ULL << slot);
+
+    timer->level = level;
+    timer->slot = slot;
 }
 
-/*
- * Enqueue a request that will wait until it expected timeout reach the
- * FLB_SCHED_REQUEST_FRAME interval.
- */
-static int schedule_request_wait(struct flb_sched_request *request,
-                                 struct flb_config *config)
+/* Unlink a timer from its slot or from the list of expired timers */
+static void wheel_del(struct flb_sched *sched, struct flb_sched_timer *timer)
 {
-    struct flb_sched *sched = config->sched;
+    struct mk_list *slot;
 
-    mk_list_add(&request->_head, &sched->requests_wait);
-    return 0;
+    if (mk_list_entry_orphan(&timer->_wheel) == -1) {
+        return;
+    }
+    mk_list_del(&timer->_wheel);
+
+    if (timer->level >= 0) {
+        slot = &sched->wheel[timer->level][timer->slot];
+        if (mk_list_is_empty(slot) == 0) {
+            sched->bitmap[timer->level] &= ~(1ULL << timer->slot);
+        }
+        timer->level = -1;
+    }
 }
 
-/*
- * Iterate requests_wait list looking for candidates to be promoted
- * to the 'requests' list.
- */
-static int schedule_request_promote(struct flb_sched *sched)
+/* Move the timers of a slot to 'list' */
+static void wheel_take(struct flb_sched *sched, int level, int slot,
+                       struct mk_list *list)
 {
-    int ret;
-    int next;
-    int passed;
-    time_t now;
     struct mk_list *tmp;
     struct mk_list *head;
-    struct mk_list failed_requests;
-    struct flb_sched_request *request;
+    struct flb_sched_timer *timer;
 
-    now = time(NULL);
-    mk_list_init(&failed_requests);
+    mk_list_foreach_safe(head, tmp, &sched->wheel[level][slot]) {
+        timer = mk_list_entry(head, struct flb_sched_timer, _wheel);
+        mk_list_del(&timer->_wheel);
+        mk_list_add(&timer->_wheel, list);
+        timer->level = -1;
+    }
+    sched->bitmap[level] &= ~(1ULL << slot);
+}
 
-    mk_list_foreach_safe(head, tmp, &sched->requests_wait) {
-        request = mk_list_entry(head, struct flb_sched_request, _head);
+/*
+ * At the start of a round of the first level, the timers of the next slot
+ * of the upper levels are distributed over the lower ones.
+ */
+static void wheel_cascade(struct flb_sched *sched)
+{
+    int level;
+    int slot;
+    struct mk_list tmp;
+    struct mk_list *head;
+    struct mk_list *next;
+    struct flb_sched_timer *timer;
+
+    for (level = 1; level < FLB_SCHED_WHEEL_LEVELS; level++) {
+        slot = (sched->now >> (FLB_SCHED_WHEEL_BITS * level)) &
+            FLB_SCHED_WHEEL_MASK;
 
-        /* First check how many seconds have passed since the request creation */
-        passed = (now - request->created);
-        ret = 0;
+        if (sched->bitmap[level] & (1ULL << slot)) {
+            mk_list_init(&tmp);
+            wheel_take(sched, level, slot, &tmp);
 
-        /* If we passed the original time, schedule now for the next second */
-        if (passed > request->timeout) {
-            mk_list_del(&request->_head);
-            ret = schedule_request_now(1, request->timer, request, sched->config);
-            if (ret != 0) {
-                mk_list_add(&request->_head, &failed_requests);
+            mk_list_foreach_safe(head, next, &tmp) {
+                timer = mk_list_entry(head, struct flb_sched_timer, _wheel);
+                mk_list_del(&timer->_wheel);
+                wheel_add(sched, timer);
             }
         }
-        else if (passed + FLB_SCHED_REQUEST_FRAME >= request->timeout) {
-            /* Check if we should schedule within this frame */
-            mk_list_del(&request->_head);
-            next = labs(passed - request->timeout);
-            ret = schedule_request_now(next, request->timer, request, sched->config);
-            if (ret != 0) {
-                mk_list_add(&request->_head, &failed_requests);
-            }
+
+        if (slot != 0) {
+            break;
+        }
+    }
+}
+
+/* Process the ticks up to 'now', expired timers are moved to 'expired' */
+static void wheel_advance(struct flb_sched *sched, uint64_t now,
+                          struct mk_list *expired)
+{
+    int slot;
+    uint64_t next;
+    uint64_t rest;
+
+    while (sched->now <= now) {
+        slot = sched->now & FLB_SCHED_WHEEL_MASK;
+        if (slot == 0) {
+            wheel_cascade(sched);
+        }
+
+        if (sched->bitmap[0] & (1ULL << slot)) {
+            wheel_take(sched, 0, slot, expired);
+        }
+
+        /* Skip the empty slots of this round */
+        rest = 0;
+        if (slot < FLB_SCHED_WHEEL_MASK) {
+            rest = sched->bitmap[0] >> (slot + 1);
+        }
+
+        if (rest) {
+            next = sched->now + __builtin_ctzll(rest) + 1;
         }
         else {
+            next = (sched->now | FLB_SCHED_WHEEL_MASK) + 1;
+        }
+
+        if (next > now + 1) {
+            next = now + 1;
+        }
+        sched->now = next;
+    }
+}
+
+/*
+ * Earliest tick the wheel has something to do: a timer of the first level
+ * expiring or a slot of the upper levels to be cascaded.
+ */
+static uint64_t wheel_next(struct flb_sched *sched)
+{
+    int cur;
+    int dist;
+    int level;
+    int shift;
+    uint64_t at;
+    uint64_t bits;
+    uint64_t next = UINT64_MAX;
+
+    for (level = 0; level < FLB_SCHED_WHEEL_LEVELS; level++) {
+        bits = sched->bitmap[level];
+        if (!bits) {
             continue;
         }
 
-        /*
-         * If the 'request' could not be scheduled, this could only happen due to memory
-         * exhaustion or running out of file descriptors. There is no much we can do
-         * at this time.
-         */
-        if (ret == -1) {
-            flb_error("[sched] a 'retry request' could not be scheduled. the "
-                      "system might be running out of memory or file "
-                      "descriptors. The scheduler will do a retry later.");
+        /* rotate the slots so the current one is the first bit */
+        shift = FLB_SCHED_WHEEL_BITS * level;
+        cur = (sched->now >> shift) & FLB_SCHED_WHEEL_MASK;
+        if (cur > 0) {
+            bits = (bits >> cur) | (bits << (FLB_SCHED_WHEEL_SLOTS - cur));
+        }
+        dist = __builtin_ctzll(bits);
+
+        if (level == 0) {
+            at = sched->now + dist;
+        }
+        else if (dist == 0 && (sched->now & ((1ULL << shift) - 1)) == 0) {
+            /* the slot is cascaded on the next tick to be processed */
+            at = sched->now;
+        }
+        else if (dist == 0) {
+            /* already cascaded: the slot comes back after a full round */
+            at = ((sched->now >> shift) + FLB_SCHED_WHEEL_SLOTS) << shift;
+        }
+        else {
+            at = ((sched->now >> shift) + dist) << shift;
+        }
+
+        if (at < next) {
+            next = at;
         }
     }
 
-    /* For each failed request, re-add them to the wait list */
-    mk_list_foreach_safe(head, tmp, &failed_requests) {
-        request = mk_list_entry(head, struct flb_sched_request, _head);
-        mk_list_del(&request->_head);
-        mk_list_add(&request->_head, &sched->requests_wait);
+    return next;
+}
+
+/* Arm the wheel timer for the next tick to be processed */
+static int wheel_arm(struct flb_sched *sched)
+{
+#ifdef MK_HAVE_TIMERFD_CREATE
+    int ret;
+    uint64_t ms;
+    uint64_t now;
+    uint64_t next;
+    struct itimerspec its;
+
+    next = wheel_next(sched);
+    if (next == sched->armed) {
+        return 0;
+    }
+
+    /* a zero value disarms the timer */
+    memset(&its, '\0', sizeof(struct itimerspec));
+    if (next != UINT64_MAX) {
+        now = sched_clock();
+        if (next > now) {
+            ms = next - now;
+            its.it_value.tv_sec = ms / 1000;
+            its.it_value.tv_nsec = (ms % 1000) * 1000000;
+        }
+        else {
+            its.it_value.tv_nsec = 1;
+        }
+    }
+
+    ret = timerfd_settime(sched->timer_fd, 0, &its, NULL);
+    if (ret == -1) {
+        flb_errno();
+        return -1;
     }
+    sched->armed = next;
+#endif
 
     return 0;
 }
 
+/* Queue a timer to expire at the given time */
+static void sched_timer_start(struct flb_sched *sched,
+                              struct flb_sched_timer *timer, uint64_t expire)
+{
+    timer->expire = expire;
+    wheel_add(sched, timer);
+
+    if (expire < sched->armed) {
+        wheel_arm(sched);
+    }
+}
+
 static double ipow(double base, int exp)
 {
     double result = 1;
@@ -253,13 +398,19 @@ static int backoff_full_jitter(int base, int cap, int n)
 /* Schedule the 'retry' for a thread buffer flush */
 int flb_sched_request_create(struct flb_config *config, void *data, int tries)
 {
-    int ret;
     int seconds;
+    struct flb_sched *sched = config->sched;
     struct flb_sched_timer *timer;
     struct flb_sched_request *request;
+    struct flb_task_retry *retry = data;
+
+    /* A retry waits for a single request */
+    if (retry->request) {
+        flb_sched_request_destroy(config, retry->request);
+    }
 
     /* Allocate timer context */
-    timer = flb_sched_timer_create(config->sched);
+    timer = flb_sched_timer_create(sched);
     if (!timer) {
         return -1;
     }
@@ -268,40 +419,27 @@ int flb_sched_request_create(struct flb_config *config, void *data, int tries)
     request = flb_malloc(sizeof(struct flb_sched_request));
     if (!request) {
         flb_errno();
+        flb_sched_timer_destroy(timer);
         return -1;
     }
 
     /* Link timer references */
     timer->type = FLB_SCHED_TIMER_REQUEST;
     timer->data = request;
-    timer->event.mask = MK_EVENT_EMPTY;
 
     /* Get suggested wait_time for this request */
     seconds = backoff_full_jitter(FLB_SCHED_BASE, FLB_SCHED_CAP, tries);
     seconds += 1;
 
     /* Populare request */
-    request->fd      = -1;
     request->created = time(NULL);
     request->timeout = seconds;
     request->data    = data;
     request->timer   = timer;
+    mk_list_add(&request->_head, &sched->requests);
+    retry->request = request;
 
-    /* Request to be placed into the sched_requests_wait list */
-    if (seconds > FLB_SCHED_REQUEST_FRAME) {
-        schedule_request_wait(request, config);
-    }
-    else {
-        ret = schedule_request_now(seconds, timer, request, config);
-        if (ret == -1) {
-            flb_error("[sched]  'retry request' could not be created. the "
-                      "system might be running out of memory or file "
-                      "descriptors.");
-            flb_sched_timer_destroy(timer);
-            flb_free(request);
-            return -1;
-        }
-    }
+    sched_timer_start(sched, timer, sched_clock() + (seconds * 1000));
 
     return seconds;
 }
@@ -309,7 +447,7 @@ int flb_sched_request_create(struct flb_config *config, void *data, int tries)
 int flb_sched_request_destroy(struct flb_config *config,
                               struct flb_sched_request *req)
 {
-    struct flb_sched_timer *timer;
+    struct flb_task_retry *retry;
 
     if (!req) {
         return 0;
@@ -317,7 +455,10 @@ int flb_sched_request_destroy(struct flb_config *config,
 
     mk_list_del(&req->_head);
 
-    timer = req->timer;
+    retry = req->data;
+    if (retry->request == req) {
+        retry->request = NULL;
+    }
 
     /*
      * We invalidate the timer since in the same event loop round
@@ -325,12 +466,7 @@ int flb_sched_request_destroy(struct flb_config *config,
      * means the timer will do nothing and will be removed after
      * the event loop round finish.
      */
-    flb_sched_timer_invalidate(timer);
-
-#ifndef FLB_SYSTEM_WINDOWS
-    /* Close pipe after invalidating timer */
-    flb_pipe_close(req->fd);
-#endif
+    flb_sched_timer_invalidate(req->timer);
 
     /* Remove request */
     flb_free(req);
@@ -340,81 +476,86 @@ int flb_sched_request_destroy(struct flb_config *config,
 
 int flb_sched_request_invalidate(struct flb_config *config, void *data)
 {
-    struct mk_list *tmp;
-    struct mk_list *head;
-    struct flb_sched_request *request;
-    struct flb_sched *sched;
-
-    sched = config->sched;
-    mk_list_foreach_safe(head, tmp, &sched->requests) {
-        request = mk_list_entry(head, struct flb_sched_request, _head);
-        if (request->data == data) {
-            flb_sched_request_destroy(config, request);
-            return 0;
-        }
-    }
+    struct flb_task_retry *retry = data;
 
-    /*
-     *  Clean up retry tasks that are scheduled more than 60s.
-     *  Task might be destroyed when there are still retry 
-     *  scheduled but no thread is running for the task.
-     * 
-     *  We need to drop buffered chunks when the filesystem buffer
-     *  limit is reached. We need to make sure that all requests
-     *  should be destroyed to avoid invoke an invlidated request.
-     */
-    mk_list_foreach_safe(head, tmp, &sched->requests_wait) {
-        request = mk_list_entry(head, struct flb_sched_request, _head);
-        if (request->data == data) {
-            flb_sched_request_destroy(config, request);
-            return 0;
-        }
+    if (!retry->request) {
+        return -1;
     }
 
-    return -1;
+    flb_sched_request_destroy(config, retry->request);
+    return 0;
 }
 
-/* Handle a timeout event set by a previous flb_sched_request_create(...) */
-int flb_sched_event_handler(struct flb_config *config, struct mk_event *event)
+/* Run an expired timer */
+static void sched_timer_expire(struct flb_config *config,
+                               struct flb_sched_timer *timer)
 {
-    struct flb_sched *sched;
-    struct flb_sched_timer *timer;
+    uint64_t expire;
+    struct flb_sched *sched = config->sched;
+    struct flb_task_retry *retry;
     struct flb_sched_request *req;
 
-    timer = (struct flb_sched_timer *) event;
-    if (timer->active == FLB_FALSE) {
-        return 0;
-    }
-
     if (timer->type == FLB_SCHED_TIMER_REQUEST) {
-        /* Map request struct */
+        /*
+         * Destroy this scheduled request, it's not longer required. The
+         * retry can be re-scheduled or destroyed by the dispatcher.
+         */
         req = timer->data;
-        consume_byte(req->fd);
+        retry = req->data;
+        flb_sched_request_destroy(config, req);
 
         /* Dispatch 'retry' */
-        flb_engine_dispatch_retry(req->data, config);
-
-        /* Destroy this scheduled request, it's not longer required */
-        flb_sched_request_destroy(config, req);
-    }
-    else if (timer->type == FLB_SCHED_TIMER_FRAME) {
-        sched = timer->data;
-#ifndef __APPLE__
-        consume_byte(sched->frame_fd);
-#endif
-        schedule_request_promote(sched);
+        flb_engine_dispatch_retry(retry, config);
     }
     else if (timer->type == FLB_SCHED_TIMER_CB_ONESHOT) {
-        consume_byte(timer->timer_fd);
-        flb_sched_timer_cb_disable(timer);
         timer->cb(config, timer->data);
         flb_sched_timer_cb_destroy(timer);
     }
     else if (timer->type == FLB_SCHED_TIMER_CB_PERM) {
-        consume_byte(timer->timer_fd);
+        /*
+         * Queue the next expiration before the callback, so it can disable
+         * the timer. Expirations missed are not run twice.
+         */
+        expire = timer->expire + timer->ms;
+        if (expire < sched->now) {
+            expire = sched->now - 1 + timer->ms;
+        }
+        sched_timer_start(sched, timer, expire);
+
         timer->cb(config, timer->data);
     }
+}
 
+/* Handle the expiration of the wheel timer */
+int flb_sched_event_handler(struct flb_config *config, struct mk_event *event)
+{
+#ifdef MK_HAVE_TIMERFD_CREATE
+    uint64_t val;
+#endif
+    struct mk_list expired;
+    struct flb_sched *sched = config->sched;
+    struct flb_sched_timer *timer;
+
+#ifdef MK_HAVE_TIMERFD_CREATE
+    /* arming the timer again resets the expirations, it might be empty */
+    if (read(sched->timer_fd, &val, sizeof(val)) <= 0) {
+        val = 0;
+    }
+#elif !defined(__APPLE__)
+    consume_byte(sched->timer_fd);
+#endif
+
+    mk_list_init(&expired);
+    wheel_advance(sched, sched_clock(), &expired);
+
+    /* Callbacks can cancel or queue timers, take them one at a time */
+    while (mk_list_is_empty(&expired) == -1) {
+        timer = mk_list_entry_first(&expired, struct flb_sched_timer, _wheel);
+        mk_list_del(&timer->_wheel);
+        sched_timer_expire(config, timer);
+    }
+
+    wheel_arm(sched);
     return 0;
 }
 
@@ -429,10 +570,6 @@ int flb_sched_timer_cb_create(struct flb_config *config, int type, int ms,
                               void (*cb)(struct flb_config *, void *),
                               void *data)
 {
-    int fd;
-    time_t sec;
-    long nsec;
-    struct mk_event *event;
     struct flb_sched_timer *timer;
 
     if (type != FLB_SCHED_TIMER_CB_ONESHOT && type != FLB_SCHED_TIMER_CB_PERM) {
@@ -440,6 +577,11 @@ int flb_sched_timer_cb_create(struct flb_config *config, int type, int ms,
         return -1;
     }
 
+    if (ms < 0 || (ms == 0 && type == FLB_SCHED_TIMER_CB_PERM)) {
+        flb_error("[sched] invalid callback timer interval %i ms", ms);
+        return -1;
+    }
+
     timer = flb_sched_timer_create(config->sched);
     if (!timer) {
         return -1;
@@ -448,31 +590,9 @@ int flb_sched_timer_cb_create(struct flb_config *config, int type, int ms,
     timer->type = type;
     timer->data = data;
     timer->cb   = cb;
+    timer->ms   = ms;
 
-    /* Initialize event */
-    event = &timer->event;
-    event->mask   = MK_EVENT_EMPTY;
-    event->status = MK_EVENT_NONE;
-
-    /* Convert from milliseconds to seconds and nanoseconds */
-    sec = (ms / 1000);
-    nsec = ((ms % 1000) * 1000000);
-
-    /* Create the frame timer */
-    fd = mk_event_timeout_create(config->evl, sec, nsec, event);
-    if (fd == -1) {
-        flb_error("[sched] cannot do timeout_create()");
-        flb_sched_timer_destroy(timer);
-        return -1;
-    }
-
-    /*
-     * Note: mk_event_timeout_create() sets a type = MK_EVENT_NOTIFICATION by
-     * default, we need to overwrite this value so we can do a clean check
-     * into the Engine when the event is triggered.
-     */
-    event->type = FLB_ENGINE_EV_SCHED;
-    timer->timer_fd = fd;
+    sched_timer_start(config->sched, timer, sched_clock() + ms);
 
     return 0;
 }
@@ -480,18 +600,12 @@ int flb_sched_timer_cb_create(struct flb_config *config, int type, int ms,
 /* Disable notifications, used before to destroy the context */
 int flb_sched_timer_cb_disable(struct flb_sched_timer *timer)
 {
-    int ret;
-
-    ret = mk_event_closesocket(timer->timer_fd);
-    timer->timer_fd = -1;
-    return ret;
+    wheel_del(timer->config->sched, timer);
+    return 0;
 }
 
 int flb_sched_timer_cb_destroy(struct flb_sched_timer *timer)
 {
-    if (timer->timer_fd > 0) {
-        flb_sched_timer_cb_disable(timer);
-    }
     flb_sched_timer_destroy(timer);
     return 0;
 }
@@ -499,56 +613,66 @@ int flb_sched_timer_cb_destroy(struct flb_sched_timer *timer)
 /* Initialize the Scheduler */
 int flb_sched_init(struct flb_config *config)
 {
+    int i;
+    int j;
     flb_pipefd_t fd;
-    struct mk_event *event;
-    struct flb_sched_timer *timer;
     struct flb_sched *sched;
 
-    sched = flb_malloc(sizeof(struct flb_sched));
+    sched = flb_calloc(1, sizeof(struct flb_sched));
     if (!sched) {
         flb_errno();
         return -1;
     }
-    config->sched = sched;
     sched->config = config;
 
     /* Initialize lists */
     mk_list_init(&sched->requests);
-    mk_list_init(&sched->requests_wait);
     mk_list_init(&sched->timers);
     mk_list_init(&sched->timers_drop);
 
-    /* Create the frame timer who enqueue 'requests' for future time */
-    timer = flb_sched_timer_create(sched);
-    if (!timer) {
+    for (i = 0; i < FLB_SCHED_WHEEL_LEVELS; i++) {
+        for (j = 0; j < FLB_SCHED_WHEEL_SLOTS; j++) {
+            mk_list_init(&sched->wheel[i][j]);
+        }
+    }
+    sched->now = sched_clock();
+    sched->armed = UINT64_MAX;
+
+    /* Create the wheel timer, it's armed once a timer is queued */
+    MK_EVENT_ZERO(&sched->event);
+#ifdef MK_HAVE_TIMERFD_CREATE
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd == -1) {
+        flb_errno();
         flb_free(sched);
         return -1;
     }
 
-    timer->type = FLB_SCHED_TIMER_FRAME;
-    timer->data = sched;
-
-    /* Initialize event */
-    event = &timer->event;
-    event->mask   = MK_EVENT_EMPTY;
-    event->status = MK_EVENT_NONE;
-
-    /* Create the frame timer */
-    fd = mk_event_timeout_create(config->evl, FLB_SCHED_REQUEST_FRAME, 0,
-                                 event);
+    if (mk_event_add(config->evl, fd, FLB_ENGINE_EV_SCHED, MK_EVENT_READ,
+                     &sched->event) == -1) {
+        flb_error("[sched] cannot register the wheel timer");
+        close(fd);
+        flb_free(sched);
+        return -1;
+    }
+#else
+    fd = mk_event_timeout_create(config->evl, 0,
+                                 FLB_SCHED_WHEEL_TICK * 1000000,
+                                 &sched->event);
     if (fd == -1) {
-        flb_sched_timer_destroy(timer);
         flb_free(sched);
         return -1;
     }
-    sched->frame_fd = fd;
 
     /*
      * Note: mk_event_timeout_create() sets a type = MK_EVENT_NOTIFICATION by
      * default, we need to overwrite this value so we can do a clean check
      * into the Engine when the event is triggered.
      */
-    event->type = FLB_ENGINE_EV_SCHED_FRAME;
+    sched->event.type = FLB_ENGINE_EV_SCHED;
+#endif
+    sched->timer_fd = fd;
+    config->sched = sched;
 
     return 0;
 }
@@ -575,13 +699,6 @@ int flb_sched_exit(struct flb_config *config)
         c++; /* evil counter */
     }
 
-    /* Delete requests on wait list */
-    mk_list_foreach_safe(head, tmp, &sched->requests_wait) {
-        request = mk_list_entry(head, struct flb_sched_request, _head);
-        flb_sched_request_destroy(config, request);
-        c++; /* evil counter */
-    }
-
     /* Delete timers */
     mk_list_foreach_safe(head, tmp, &sched->timers) {
         timer = mk_list_entry(head, struct flb_sched_timer, _head);
@@ -596,7 +713,16 @@ int flb_sched_exit(struct flb_config *config)
         c++;
     }
 
+#ifdef MK_HAVE_TIMERFD_CREATE
+    mk_event_del(config->evl, &sched->event);
+    close(sched->timer_fd);
+#else
+    mk_event_timeout_destroy(config->evl, &sched->event);
+    mk_event_closesocket(sched->timer_fd);
+#endif
+
     flb_free(sched);
+    config->sched = NULL;
     return c;
 }
 
@@ -611,9 +737,8 @@ struct flb_sched_timer *flb_sched_timer_create(struct flb_sched *sched)
         flb_errno();
         return NULL;
     }
-    MK_EVENT_ZERO(&timer->event);
 
-    timer->timer_fd = -1;
+    timer->level = -1;
     timer->config = sched->config;
     timer->data = NULL;
 
@@ -629,6 +754,7 @@ void flb_sched_timer_invalidate(struct flb_sched_timer *timer)
     struct flb_sched *sched;
 
     sched  = timer->config->sched;
+    wheel_del(sched, timer);
 
     timer->active = FLB_FALSE;
     mk_list_del(&timer->_head);
@@ -638,10 +764,7 @@ void flb_sched_timer_invalidate(struct flb_sched_timer *timer)
 /* Destroy a timer context */
 int flb_sched_timer_destroy(struct flb_sched_timer *timer)
 {
-    mk_event_timeout_destroy(timer->config->evl, &timer->event);
-    if (timer->timer_fd > 0) {
-        flb_sched_timer_cb_disable(timer);
-    }
+    wheel_del(timer->config->sched, timer);
 
     mk_list_del(&timer->_head);
     flb_free(timer);
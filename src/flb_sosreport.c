@@ -293,7 +293,7 @@ int flb_sosreport(struct flb_config *config)
     mk_list_foreach(head, &config->outputs) {
         ins_out = mk_list_entry(head, struct flb_output_instance, _head);
         printf("[OUTPUT] Instance\n");
-        printf("    Name\t\t%s (%s, mask_id=%" PRIu64 ")\n", ins_out->name, ins_out->p->name,
+        printf("    Name\t\t%s (%s, mask_id=%i)\n", ins_out->name, ins_out->p->name,
                ins_out->mask_id);
         printf("    Match\t\t%s\n", ins_out->match);
 
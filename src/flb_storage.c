@@ -18,6 +18,8 @@
  *  limitations under the License.
  */
 
+#include <inttypes.h>
+
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_input.h>
 #include <fluent-bit/flb_log.h>
@@ -26,6 +28,107 @@
 #include <fluent-bit/flb_utils.h>
 #include <fluent-bit/flb_http_server.h>
 
+#include <chunkio/cio_commit.h>
+
+/* upper bounds of the sync histograms, the last bucket is unbounded */
+static const uint64_t sync_batch_bounds[] = {
+    1, 2, 4, 8, 16, 32, 64, 128, 256
+};
+
+static const uint64_t sync_latency_bounds[] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000
+};
+
+static int histogram_bucket(const uint64_t *bounds, int n, uint64_t val)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (val <= bounds[i]) {
+            return i;
+        }
+    }
+    return n;
+}
+
+/* Chunk I/O callback: invoked after every durable sync */
+static void cb_storage_commit(struct cio_ctx *cio,
+                              struct cio_commit_info *info, void *data)
+{
+    int i;
+    struct flb_storage_metrics *sm = data;
+
+    sm->sync_total++;
+    sm->sync_chunks += info->chunks;
+    sm->sync_bytes += info->bytes;
+
+    i = histogram_bucket(sync_batch_bounds,
+                         FLB_STORAGE_SYNC_BATCH_BUCKETS - 1, info->chunks);
+    sm->sync_batch[i]++;
+
+    i = histogram_bucket(sync_latency_bounds,
+                         FLB_STORAGE_SYNC_LATENCY_BUCKETS - 1, info->latency);
+    sm->sync_latency[i]++;
+}
+
+static void metrics_append_histogram(msgpack_packer *mp_pck, char *name,
+                                     const uint64_t *bounds,
+                                     uint64_t *counts, int n)
+{
+    int i;
+    int len;
+    char buf[32];
+
+    len = strlen(name);
+    msgpack_pack_str(mp_pck, len);
+    msgpack_pack_str_body(mp_pck, name, len);
+    msgpack_pack_map(mp_pck, n);
+
+    for (i = 0; i < n; i++) {
+        if (i < n - 1) {
+            len = snprintf(buf, sizeof(buf) - 1, "%" PRIu64, bounds[i]);
+        }
+        else {
+            len = snprintf(buf, sizeof(buf) - 1, "+Inf");
+        }
+        msgpack_pack_str(mp_pck, len);
+        msgpack_pack_str_body(mp_pck, buf, len);
+        msgpack_pack_uint64(mp_pck, counts[i]);
+    }
+}
+
+static void metrics_append_sync(msgpack_packer *mp_pck,
+                                struct flb_storage_metrics *sm)
+{
+    msgpack_pack_str(mp_pck, 4);
+    msgpack_pack_str_body(mp_pck, "sync", 4);
+    msgpack_pack_map(mp_pck, 5);
+
+    /* sync['total'] */
+    msgpack_pack_str(mp_pck, 5);
+    msgpack_pack_str_body(mp_pck, "total", 5);
+    msgpack_pack_uint64(mp_pck, sm->sync_total);
+
+    /* sync['chunks'] */
+    msgpack_pack_str(mp_pck, 6);
+    msgpack_pack_str_body(mp_pck, "chunks", 6);
+    msgpack_pack_uint64(mp_pck, sm->sync_chunks);
+
+    /* sync['bytes'] */
+    msgpack_pack_str(mp_pck, 5);
+    msgpack_pack_str_body(mp_pck, "bytes", 5);
+    msgpack_pack_uint64(mp_pck, sm->sync_bytes);
+
+    /* sync['batch_size']: chunk syncs covered by every durable sync */
+    metrics_append_histogram(mp_pck, "batch_size", sync_batch_bounds,
+                             sm->sync_batch, FLB_STORAGE_SYNC_BATCH_BUCKETS);
+
+    /* sync['latency_us']: time spent on every durable sync */
+    metrics_append_histogram(mp_pck, "latency_us", sync_latency_bounds,
+                             sm->sync_latency,
+                             FLB_STORAGE_SYNC_LATENCY_BUCKETS);
+}
+
 static void metrics_append_general(msgpack_packer *mp_pck,
                                    struct flb_config *ctx,
                                    struct flb_storage_metrics *sm)
@@ -37,7 +140,7 @@ static void metrics_append_general(msgpack_packer *mp_pck,
 
     msgpack_pack_str(mp_pck, 13);
     msgpack_pack_str_body(mp_pck, "storage_layer", 13);
-    msgpack_pack_map(mp_pck, 1);
+    msgpack_pack_map(mp_pck, 2);
 
     /* Chunks */
     msgpack_pack_str(mp_pck, 6);
@@ -68,6 +171,59 @@ static void metrics_append_general(msgpack_packer *mp_pck,
     msgpack_pack_str(mp_pck, 14);
     msgpack_pack_str_body(mp_pck, "fs_chunks_down", 14);
     msgpack_pack_uint64(mp_pck, storage_st.chunks_fs_down);
+
+    /* Durable syncs */
+    metrics_append_sync(mp_pck, sm);
+}
+
+static void metrics_append_compression(msgpack_packer *mp_pck,
+                                       struct cio_stream *stream)
+{
+    double ratio = 0;
+    struct cio_stream_compress *c = &stream->compress;
+
+    if (c->bytes > 0) {
+        ratio = (double) c->raw_bytes / c->bytes;
+    }
+
+    msgpack_pack_str(mp_pck, 11);
+    msgpack_pack_str_body(mp_pck, "compression", 11);
+    msgpack_pack_map(mp_pck, 7);
+
+    /* compression['chunks'] */
+    msgpack_pack_str(mp_pck, 6);
+    msgpack_pack_str_body(mp_pck, "chunks", 6);
+    msgpack_pack_uint64(mp_pck, c->chunks);
+
+    /* compression['raw_size'] */
+    msgpack_pack_str(mp_pck, 8);
+    msgpack_pack_str_body(mp_pck, "raw_size", 8);
+    msgpack_pack_uint64(mp_pck, c->raw_bytes);
+
+    /* compression['compressed_size'] */
+    msgpack_pack_str(mp_pck, 15);
+    msgpack_pack_str_body(mp_pck, "compressed_size", 15);
+    msgpack_pack_uint64(mp_pck, c->bytes);
+
+    /* compression['ratio'] */
+    msgpack_pack_str(mp_pck, 5);
+    msgpack_pack_str_body(mp_pck, "ratio", 5);
+    msgpack_pack_double(mp_pck, ratio);
+
+    /* compression['cpu_us']: time spent compressing */
+    msgpack_pack_str(mp_pck, 6);
+    msgpack_pack_str_body(mp_pck, "cpu_us", 6);
+    msgpack_pack_uint64(mp_pck, c->cpu_time);
+
+    /* compression['decompressed'] */
+    msgpack_pack_str(mp_pck, 12);
+    msgpack_pack_str_body(mp_pck, "decompressed", 12);
+    msgpack_pack_uint64(mp_pck, c->decompressed);
+
+    /* compression['decompress_cpu_us'] */
+    msgpack_pack_str(mp_pck, 17);
+    msgpack_pack_str_body(mp_pck, "decompress_cpu_us", 17);
+    msgpack_pack_uint64(mp_pck, c->decompress_time);
 }
 
 static void metrics_append_input(msgpack_packer *mp_pck,
@@ -85,7 +241,10 @@ static void metrics_append_input(msgpack_packer *mp_pck,
     int down;
     int busy;
     int busy_size_err;
+    int compression;
     ssize_t busy_size;
+    struct cio_ctx *cio = ctx->cio;
+    struct flb_storage_input *si;
     struct mk_list *head;
     struct mk_list *h_chunks;
     struct flb_input_instance *i;
@@ -105,8 +264,11 @@ static void metrics_append_input(msgpack_packer *mp_pck,
         msgpack_pack_str(mp_pck, len);
         msgpack_pack_str_body(mp_pck, tmp, len);
 
-        /* Map for 'status' and 'chunks' */
-        msgpack_pack_map(mp_pck, 2);
+        /* Map for 'status', 'chunks' and 'compression' if enabled */
+        si = (struct flb_storage_input *) i->storage;
+        compression = (cio->compression != CIO_COMPRESS_NONE &&
+                       si && si->stream->type == CIO_STORE_FS);
+        msgpack_pack_map(mp_pck, compression ? 3 : 2);
 
         /*
          * Status
@@ -229,6 +391,14 @@ static void metrics_append_input(msgpack_packer *mp_pck,
         len = strlen(buf);
         msgpack_pack_str(mp_pck, len);
         msgpack_pack_str_body(mp_pck, buf, len);
+
+        /*
+         * Compression
+         * ===========
+         */
+        if (compression) {
+            metrics_append_compression(mp_pck, si->stream);
+        }
     }
 }
 
@@ -259,24 +429,55 @@ struct flb_storage_metrics *flb_storage_metrics_create(struct flb_config *ctx)
     int ret;
     struct flb_storage_metrics *sm;
 
-    sm = flb_malloc(sizeof(struct flb_storage_metrics));
+    sm = flb_calloc(1, sizeof(struct flb_storage_metrics));
     if (!sm) {
         flb_errno();
         return NULL;
     }
 
     ret = flb_sched_timer_cb_create(ctx, FLB_SCHED_TIMER_CB_PERM, 5000,
-                                    cb_storage_metrics_collect,
-                                    ctx->storage_metrics_ctx);
+                                    cb_storage_metrics_collect, sm);
     if (ret == -1) {
         flb_error("[storage metrics] cannot create timer to collect metrics");
         flb_free(sm);
         return NULL;
     }
 
+    /* account durable syncs */
+    cio_set_commit_callback(ctx->cio, cb_storage_commit, sm);
+
     return sm;
 }
 
+static void cb_storage_commit_flush(struct flb_config *ctx, void *data)
+{
+    cio_commit(ctx->cio);
+}
+
+/*
+ * Group commit: chunk syncs from every input are made durable together
+ * once per commit window, or earlier if storage.commit_bytes is reached.
+ */
+int flb_storage_commit_create(struct flb_config *ctx)
+{
+    int ret;
+    struct cio_ctx *cio = ctx->cio;
+
+    if (!cio || cio_commit_enabled(cio) == CIO_FALSE) {
+        return 0;
+    }
+
+    ret = flb_sched_timer_cb_create(ctx, FLB_SCHED_TIMER_CB_PERM,
+                                    cio->commit_interval,
+                                    cb_storage_commit_flush, NULL);
+    if (ret == -1) {
+        flb_error("[storage] cannot create group commit timer");
+        return -1;
+    }
+
+    return 0;
+}
+
 static int sort_chunk_cmp(const void *a_arg, const void *b_arg)
 {
     char *p;
@@ -338,7 +539,10 @@ static void print_storage_info(struct flb_config *ctx, struct cio_ctx *cio)
         flb_info("[storage] in-memory");
     }
 
-    if (cio->flags & CIO_FULL_SYNC) {
+    if (cio_commit_enabled(cio) == CIO_TRUE) {
+        sync = "group commit";
+    }
+    else if (cio->flags & CIO_FULL_SYNC) {
         sync = "full";
     }
     else {
@@ -346,7 +550,12 @@ static void print_storage_info(struct flb_config *ctx, struct cio_ctx *cio)
     }
 
     if (cio->flags & CIO_CHECKSUM) {
-        checksum = "enabled";
+        if (cio->checksum_type == CIO_CRC32C) {
+            checksum = "enabled (crc32c)";
+        }
+        else {
+            checksum = "enabled (crc32)";
+        }
     }
     else {
         checksum = "disabled";
@@ -355,6 +564,20 @@ static void print_storage_info(struct flb_config *ctx, struct cio_ctx *cio)
     flb_info("[storage] %s synchronization mode, checksum %s, max_chunks_up=%i",
              sync, checksum, ctx->storage_max_chunks_up);
 
+    if (cio_commit_enabled(cio) == CIO_TRUE) {
+        flb_info("[storage] commit_interval=%ims, commit_bytes=%zu",
+                 cio->commit_interval, cio->commit_bytes);
+    }
+
+    if (cio->flags & CIO_SEGMENTS) {
+        flb_info("[storage] segment backend, segment_size=%zu",
+                 cio->segment_size);
+    }
+
+    if (cio->compression == CIO_COMPRESS_LZ4) {
+        flb_info("[storage] locked chunks are compressed (lz4)");
+    }
+
     /* Storage input plugin */
     if (ctx->storage_input_plugin) {
         in = (struct flb_input_instance *) ctx->storage_input_plugin;
@@ -481,6 +704,10 @@ int flb_storage_create(struct flb_config *ctx)
 {
     int ret;
     int flags;
+    int group_commit = FLB_FALSE;
+    int compression = CIO_COMPRESS_NONE;
+    int64_t segment_size = 0;
+    int64_t commit_bytes = 0;
     struct flb_input_instance *in = NULL;
     struct cio_ctx *cio;
 
@@ -495,6 +722,10 @@ int flb_storage_create(struct flb_config *ctx)
         else if (strcasecmp(ctx->storage_sync, "full") == 0) {
             flags |= CIO_FULL_SYNC;
         }
+        else if (strcasecmp(ctx->storage_sync, "group") == 0) {
+            flags |= CIO_FULL_SYNC;
+            group_commit = FLB_TRUE;
+        }
         else {
             flb_error("[storage] invalid synchronization mode");
             return -1;
@@ -506,6 +737,77 @@ int flb_storage_create(struct flb_config *ctx)
         flags |= CIO_CHECKSUM;
     }
 
+    /* filesystem layout: one file per chunk or shared segment files */
+    if (ctx->storage_backend) {
+        if (strcasecmp(ctx->storage_backend, "file") == 0) {
+            /* do nothing, keep the default */
+        }
+        else if (strcasecmp(ctx->storage_backend, "segment") == 0) {
+            flags |= CIO_SEGMENTS;
+        }
+        else {
+            flb_error("[storage] invalid backend '%s'", ctx->storage_backend);
+            return -1;
+        }
+    }
+
+    if (ctx->storage_segment_size) {
+        segment_size = flb_utils_size_to_bytes(ctx->storage_segment_size);
+        if (segment_size <= 0) {
+            flb_error("[storage] invalid segment size '%s'",
+                      ctx->storage_segment_size);
+            return -1;
+        }
+    }
+
+    /* compression of locked chunks, only the file backend supports it */
+    if (ctx->storage_compression) {
+        if (strcasecmp(ctx->storage_compression, "none") == 0) {
+            /* do nothing, keep the default */
+        }
+        else if (strcasecmp(ctx->storage_compression, "lz4") == 0) {
+            compression = CIO_COMPRESS_LZ4;
+        }
+        else {
+            flb_error("[storage] invalid compression '%s'",
+                      ctx->storage_compression);
+            return -1;
+        }
+
+        if (compression != CIO_COMPRESS_NONE && (flags & CIO_SEGMENTS)) {
+            flb_warn("[storage] compression is not supported by the segment "
+                     "backend, chunks are stored uncompressed");
+            compression = CIO_COMPRESS_NONE;
+        }
+    }
+
+    /* group commit window and early size limit */
+    if (group_commit == FLB_TRUE) {
+        if (!ctx->storage_path) {
+            flb_error("[storage] group synchronization mode requires "
+                      "storage.path");
+            return -1;
+        }
+
+        if (ctx->storage_commit_interval < 0) {
+            flb_error("[storage] invalid commit interval %i",
+                      ctx->storage_commit_interval);
+            return -1;
+        }
+        else if (ctx->storage_commit_interval == 0) {
+            ctx->storage_commit_interval = FLB_STORAGE_COMMIT_INTERVAL;
+        }
+
+        if (ctx->storage_commit_bytes) {
+            commit_bytes = flb_utils_size_to_bytes(ctx->storage_commit_bytes);
+            if (commit_bytes <= 0) {
+                flb_error("[storage] invalid commit size '%s'",
+                          ctx->storage_commit_bytes);
+                return -1;
+            }
+        }
+    }
+
     /* Create chunkio context */
     cio = cio_create(ctx->storage_path, log_cb, CIO_LOG_DEBUG, flags);
     if (!cio) {
@@ -519,6 +821,31 @@ int flb_storage_create(struct flb_config *ctx)
         ctx->storage_max_chunks_up = FLB_STORAGE_MAX_CHUNKS_UP;
     }
     cio_set_max_chunks_up(ctx->cio, ctx->storage_max_chunks_up);
+    cio_set_compression(ctx->cio, compression);
+
+    /* list the backlog from the manifest saved at the last shutdown */
+    if (ctx->storage_path) {
+        cio_set_manifest(ctx->cio, CIO_TRUE);
+    }
+
+    if (segment_size > 0 && cio_set_segment_size(cio, segment_size) == -1) {
+        flb_error("[storage] segment size '%s' is too small",
+                  ctx->storage_segment_size);
+        cio_destroy(cio);
+        ctx->cio = NULL;
+        return -1;
+    }
+
+    if (group_commit == FLB_TRUE) {
+        ret = cio_set_group_commit(cio, ctx->storage_commit_interval,
+                                   commit_bytes);
+        if (ret == -1) {
+            flb_error("[storage] cannot enable group commit");
+            cio_destroy(cio);
+            ctx->cio = NULL;
+            return -1;
+        }
+    }
 
     /* Load content from the file system if any */
     ret = cio_load(ctx->cio, NULL);
@@ -578,6 +905,7 @@ void flb_storage_destroy(struct flb_config *ctx)
 
     if (ctx->storage_metrics == FLB_TRUE &&
         ctx->storage_metrics_ctx != NULL) {
+        cio_set_commit_callback(cio, NULL, NULL);
         flb_free(ctx->storage_metrics_ctx);
     }
 
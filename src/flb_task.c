@@ -33,37 +33,108 @@
 #include <fluent-bit/flb_scheduler.h>
 
 /*
- * Every task created must have an unique ID, this function lookup the
- * lowest number available in the tasks_map.
+ * Every task created must have an unique ID, it's the index of a slot of the
+ * tasks_map. Free slots are kept in a list, when it's empty the map doubles
+ * its size up to the 'tasks.max' limit.
  *
  * This 'id' is used by the task interface to communicate with the engine event
  * loop about some action.
  */
+static int map_grow(struct flb_config *config)
+{
+    int i;
+    int max;
+    int size;
+    struct flb_task_map *map;
+
+    max = config->tasks_max;
+    if (max <= 0 || max > FLB_TASK_MAP_MAX) {
+        max = FLB_TASK_MAP_MAX;
+    }
+
+    if (config->tasks_map_size >= max) {
+        return -1;
+    }
+
+    size = config->tasks_map_size * 2;
+    if (size == 0) {
+        size = FLB_TASK_MAP_SIZE;
+    }
+    if (size > max) {
+        size = max;
+    }
+
+    map = flb_realloc(config->tasks_map, sizeof(struct flb_task_map) * size);
+    if (!map) {
+        flb_errno();
+        return -1;
+    }
+
+    /* Link the new slots, lowest ids first */
+    for (i = config->tasks_map_size; i < size; i++) {
+        map[i].task = NULL;
+        map[i].gen = 0;
+        map[i].next_free = (i + 1 < size) ? i + 1 : config->tasks_map_free;
+    }
+    config->tasks_map_free = config->tasks_map_size;
+    config->tasks_map = map;
+    config->tasks_map_size = size;
+
+    return 0;
+}
 
 static inline int map_get_task_id(struct flb_config *config)
 {
-    int i;
-    int map_size = (sizeof(config->tasks_map) / sizeof(struct flb_task_map));
+    int id;
 
-    for (i = 0; i < map_size; i++) {
-        if (config->tasks_map[i].task == NULL) {
-            return i;
-        }
+    if (config->tasks_map_free == -1 && map_grow(config) == -1) {
+        return -1;
     }
 
-    return -1;
+    id = config->tasks_map_free;
+    config->tasks_map_free = config->tasks_map[id].next_free;
+
+    return id;
 }
 
 static inline void map_set_task_id(int id, struct flb_task *task,
                                    struct flb_config *config)
 {
     config->tasks_map[id].task = task;
-
+    task->gen = config->tasks_map[id].gen;
 }
 
 static inline void map_free_task_id(int id, struct flb_config *config)
 {
     config->tasks_map[id].task = NULL;
+    config->tasks_map[id].gen++;
+    config->tasks_map[id].next_free = config->tasks_map_free;
+    config->tasks_map_free = id;
+}
+
+/* Lookup a task by id, NULL if the task of this generation is gone */
+struct flb_task *flb_task_get(struct flb_config *config, int id, int gen)
+{
+    struct flb_task_map *slot;
+
+    if (id < 0 || id >= config->tasks_map_size) {
+        return NULL;
+    }
+
+    slot = &config->tasks_map[id];
+    if (!slot->task || slot->gen != (uint16_t) gen) {
+        return NULL;
+    }
+
+    return slot->task;
+}
+
+void flb_task_map_destroy(struct flb_config *config)
+{
+    flb_free(config->tasks_map);
+    config->tasks_map = NULL;
+    config->tasks_map_size = 0;
+    config->tasks_map_free = -1;
 }
 
 void flb_task_retry_destroy(struct flb_task_retry *retry)
@@ -150,6 +221,7 @@ struct flb_task_retry *flb_task_retry_create(struct flb_task *task,
         retry->attemps = 1;
         retry->o_ins   = o_ins;
         retry->parent  = task;
+        retry->request = NULL;
         mk_list_add(&retry->_head, &task->retries);
 
         flb_debug("[retry] new retry created for task_id=%i attemps=%i",
@@ -347,7 +419,6 @@ struct flb_task *flb_task_create(uint64_t ref_id,
                                  int *err)
 {
     int count = 0;
-    uint64_t routes_mask = 0;
     struct flb_task *task;
     struct flb_task_route *route;
     struct flb_output_instance *o_ins;
@@ -368,6 +439,7 @@ struct flb_task *flb_task_create(uint64_t ref_id,
     task->tag = flb_malloc(tag_len + 1);
     if (!task->tag) {
         flb_errno();
+        map_free_task_id(task->id, config);
         flb_free(task);
         *err = FLB_TRUE;
         return NULL;
@@ -396,7 +468,7 @@ struct flb_task *flb_task_create(uint64_t ref_id,
         o_ins = mk_list_entry(o_head,
                               struct flb_output_instance, _head);
         
-        if ((((struct flb_input_chunk *) ic)->routes_mask & o_ins->mask_id) > 0) {
+        if (flb_routes_mask_get_bit(task_ic->routes_mask, o_ins->mask_id)) {
             route = flb_malloc(sizeof(struct flb_task_route));
             if (!route) {
                 flb_errno();
@@ -406,9 +478,6 @@ struct flb_task *flb_task_create(uint64_t ref_id,
             route->out = o_ins;
             mk_list_add(&route->_head, &task->routes);
             count++;
-
-            /* set the routes as a mask */
-            routes_mask |= o_ins->mask_id;
         }
     }
 
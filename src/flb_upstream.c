@@ -26,8 +26,22 @@
 #include <fluent-bit/flb_upstream.h>
 #include <fluent-bit/flb_io.h>
 #include <fluent-bit/flb_io_tls.h>
+#include <fluent-bit/flb_io_tls_rw.h>
 #include <fluent-bit/flb_tls.h>
+#include <fluent-bit/flb_pipe.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_thread.h>
+#include <fluent-bit/flb_output_worker.h>
+#include <fluent-bit/flb_upstream_pipeline.h>
+
+/* A flush waiting for a connection ('net.max_connections') */
+struct upstream_waiter {
+    struct flb_thread *th;
+    time_t ts;
+    int timed_out;
+    struct mk_list _head;
+};
 
 /* Config map for Upstream networking setup */
 struct flb_config_map upstream_net[] = {
@@ -56,6 +70,34 @@ struct flb_config_map upstream_net[] = {
      "Specify network address to bind for data traffic"
     },
 
+    {
+     FLB_CONFIG_MAP_INT, "net.pipeline_depth", "1",
+     0, FLB_TRUE, offsetof(struct flb_net_setup, pipeline_depth),
+     "Maximum number of HTTP requests in flight on a single keepalive "
+     "connection (HTTP/1.1 pipelining), 1 disables pipelining"
+    },
+
+    {
+     FLB_CONFIG_MAP_INT, "net.min_idle_connections", "0",
+     0, FLB_TRUE, offsetof(struct flb_net_setup, min_idle_connections),
+     "Minimum number of idle keepalive connections, they are opened in the "
+     "background once the first connection has been requested"
+    },
+
+    {
+     FLB_CONFIG_MAP_INT, "net.max_connections", "0",
+     0, FLB_TRUE, offsetof(struct flb_net_setup, max_connections),
+     "Maximum number of connections (per output worker), flushes wait for "
+     "a connection to be released once reached. Zero means no limit"
+    },
+
+    {
+     FLB_CONFIG_MAP_BOOL, "net.tls_session_resumption", "true",
+     0, FLB_TRUE, offsetof(struct flb_net_setup, tls_session_resumption),
+     "Resume the previous TLS session on new connections to skip the full "
+     "handshake"
+    },
+
     /* EOF */
     {0}
 };
@@ -68,6 +110,24 @@ struct mk_list *flb_upstream_get_config_map(struct flb_config *config)
     return config_map;
 }
 
+/* Initialize the connections pool state of a new context */
+static void upstream_pool_init(struct flb_upstream *u)
+{
+    mk_list_init(&u->av_queue);
+    mk_list_init(&u->busy_queue);
+    mk_list_init(&u->destroy_queue);
+    mk_list_init(&u->prewarm_queue);
+    mk_list_init(&u->conn_waiters);
+
+    u->wake_ch[0] = -1;
+    u->wake_ch[1] = -1;
+    pthread_mutex_init(&u->stats_lock, NULL);
+
+#ifdef FLB_HAVE_TLS
+    mbedtls_ssl_session_init(&u->tls_resume);
+#endif
+}
+
 /* Creates a new upstream context */
 struct flb_upstream *flb_upstream_create(struct flb_config *config,
                                          const char *host, int port, int flags,
@@ -96,9 +156,7 @@ struct flb_upstream *flb_upstream_create(struct flb_config *config,
     u->n_connections  = 0;
     u->flags         |= FLB_IO_ASYNC;
 
-    mk_list_init(&u->av_queue);
-    mk_list_init(&u->busy_queue);
-    mk_list_init(&u->destroy_queue);
+    upstream_pool_init(u);
 
 #ifdef FLB_HAVE_TLS
     u->tls      = (struct flb_tls *) tls;
@@ -108,6 +166,46 @@ struct flb_upstream *flb_upstream_create(struct flb_config *config,
     return u;
 }
 
+/*
+ * Create a copy of an upstream context that runs on a different event loop.
+ * The copy is not linked to the configuration list of upstreams, the caller
+ * owns it through the '_head' field.
+ */
+struct flb_upstream *flb_upstream_clone(struct flb_upstream *u,
+                                        struct mk_event_loop *evl,
+                                        void *tls)
+{
+    struct flb_upstream *c;
+
+    c = flb_calloc(1, sizeof(struct flb_upstream));
+    if (!c) {
+        flb_errno();
+        return NULL;
+    }
+
+    c->tcp_host = flb_strdup(u->tcp_host);
+    if (!c->tcp_host) {
+        flb_free(c);
+        return NULL;
+    }
+
+    c->tcp_port      = u->tcp_port;
+    c->flags         = u->flags;
+    c->evl           = evl;
+    c->n_connections = 0;
+    c->parent        = u;
+    c->net           = u->net;
+
+    upstream_pool_init(c);
+    mk_list_init(&c->_head);
+
+#ifdef FLB_HAVE_TLS
+    c->tls = (struct flb_tls *) tls;
+#endif
+
+    return c;
+}
+
 /* Create an upstream context using a valid URL (protocol, host and port) */
 struct flb_upstream *flb_upstream_create_url(struct flb_config *config,
                                              const char *url, int flags,
@@ -176,6 +274,134 @@ struct flb_upstream *flb_upstream_create_url(struct flb_config *config,
     return u;
 }
 
+/* Can a flush get a connection without going over 'net.max_connections' ? */
+static int upstream_slot_available(struct flb_upstream *u)
+{
+    if (u->net.max_connections <= 0 ||
+        u->n_connections < u->net.max_connections) {
+        return FLB_TRUE;
+    }
+
+    if (u->net.keepalive == FLB_TRUE && mk_list_is_empty(&u->av_queue) != 0) {
+        return FLB_TRUE;
+    }
+
+    return FLB_FALSE;
+}
+
+/* Resume the flushes waiting for a connection while there are free slots */
+static void upstream_wake(struct flb_upstream *u)
+{
+    int n;
+    struct upstream_waiter *w;
+
+    /* a resumed flush that can't get a connection waits again at the end */
+    n = mk_list_size(&u->conn_waiters);
+    while (n-- > 0 && mk_list_is_empty(&u->conn_waiters) != 0 &&
+           upstream_slot_available(u) == FLB_TRUE) {
+        w = mk_list_entry_first(&u->conn_waiters, struct upstream_waiter,
+                                _head);
+        mk_list_del(&w->_head);
+        flb_output_worker_resume(w->th);
+    }
+}
+
+static int cb_upstream_wake(void *data)
+{
+    int n;
+    uint64_t val;
+    struct flb_upstream *u;
+
+    u = mk_list_entry(data, struct flb_upstream, wake_event);
+
+    n = flb_pipe_r(u->wake_ch[0], &val, sizeof(val));
+    if (n <= 0) {
+        flb_errno();
+        return -1;
+    }
+    u->wake_signaled = FLB_FALSE;
+
+    upstream_wake(u);
+    return 0;
+}
+
+/*
+ * A connection slot might be free. The caller can be a flush co-routine
+ * that can't resume the others, the event loop does it.
+ */
+static void upstream_signal(struct flb_upstream *u)
+{
+    int n;
+    uint64_t val = 1;
+
+    if (u->wake_signaled == FLB_TRUE ||
+        mk_list_is_empty(&u->conn_waiters) == 0) {
+        return;
+    }
+
+    n = flb_pipe_w(u->wake_ch[1], &val, sizeof(val));
+    if (n == -1) {
+        flb_errno();
+        return;
+    }
+    u->wake_signaled = FLB_TRUE;
+}
+
+/*
+ * Park the flush co-routine until a connection can be taken, returns -1 if
+ * none was released before 'net.connect_timeout'.
+ */
+static int upstream_wait(struct flb_upstream *u, struct flb_thread *th)
+{
+    int ret;
+    struct mk_event *event;
+    struct upstream_waiter w;
+
+    if (u->wake_ch[0] == -1) {
+        ret = flb_pipe_create(u->wake_ch);
+        if (ret == -1) {
+            flb_errno();
+            return -1;
+        }
+
+        event = &u->wake_event;
+        MK_EVENT_NEW(event);
+        event->fd      = u->wake_ch[0];
+        event->type    = FLB_ENGINE_EV_CUSTOM;
+        event->handler = cb_upstream_wake;
+        ret = mk_event_add(u->evl, u->wake_ch[0],
+                           FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, event);
+        if (ret == -1) {
+            flb_pipe_destroy(u->wake_ch);
+            u->wake_ch[0] = -1;
+            u->wake_ch[1] = -1;
+            return -1;
+        }
+    }
+
+    w.th = th;
+    w.ts = time(NULL);
+    w.timed_out = FLB_FALSE;
+    mk_list_add(&w._head, &u->conn_waiters);
+    u->stats.waits++;
+
+    flb_debug("[upstream] waiting for a connection to %s:%i, "
+              "%i connections in use (net.max_connections)",
+              u->tcp_host, u->tcp_port, u->n_connections);
+
+    /* the waker unlinks us before resuming */
+    flb_thread_yield(th, FLB_FALSE);
+
+    if (w.timed_out == FLB_TRUE) {
+        flb_error("[upstream] no connection to %s:%i was released after "
+                  "%i seconds", u->tcp_host, u->tcp_port,
+                  u->net.connect_timeout);
+        return -1;
+    }
+
+    return 0;
+}
+
 static int destroy_conn(struct flb_upstream_conn *u_conn)
 {
     struct flb_upstream *u = u_conn->u;
@@ -183,7 +409,8 @@ static int destroy_conn(struct flb_upstream_conn *u_conn)
     flb_trace("[upstream] destroy connection #%i to %s:%i",
               u_conn->fd, u->tcp_host, u->tcp_port);
 
-    if (u->flags & FLB_IO_ASYNC) {
+    if ((u->flags & FLB_IO_ASYNC) ||
+        u_conn->prewarm != FLB_UPSTREAM_PREWARM_NONE) {
         mk_event_del(u->evl, &u_conn->event);
     }
 
@@ -206,6 +433,9 @@ static int destroy_conn(struct flb_upstream_conn *u_conn)
     /* Add node to destroy queue */
     mk_list_add(&u_conn->_head, &u->destroy_queue);
 
+    /* a flush might be waiting for a free slot */
+    upstream_signal(u);
+
     /*
      * note: the connection context is destroyed by the engine once all events
      * have been processed.
@@ -213,12 +443,12 @@ static int destroy_conn(struct flb_upstream_conn *u_conn)
     return 0;
 }
 
-static struct flb_upstream_conn *create_conn(struct flb_upstream *u)
+/* Allocate a connection context, the caller links it to a queue */
+static struct flb_upstream_conn *conn_new(struct flb_upstream *u,
+                                          struct flb_thread *th)
 {
-    int ret;
     time_t now;
     struct flb_upstream_conn *conn;
-    struct flb_thread *th = pthread_getspecific(flb_thread_key);
 
     now = time(NULL);
 
@@ -256,6 +486,20 @@ static struct flb_upstream_conn *create_conn(struct flb_upstream *u)
 
     MK_EVENT_ZERO(&conn->event);
 
+    return conn;
+}
+
+static struct flb_upstream_conn *create_conn(struct flb_upstream *u)
+{
+    int ret;
+    struct flb_upstream_conn *conn;
+    struct flb_thread *th = pthread_getspecific(flb_thread_key);
+
+    conn = conn_new(u, th);
+    if (!conn) {
+        return NULL;
+    }
+
     /* Link new connection to the busy queue */
     mk_list_add(&conn->_head, &u->busy_queue);
 
@@ -278,6 +522,7 @@ static struct flb_upstream_conn *create_conn(struct flb_upstream *u)
 
     /* Invalidate timeout for connection */
     conn->ts_connect_timeout = -1;
+    u->stats.connects++;
 
     return conn;
 }
@@ -298,12 +543,30 @@ int flb_upstream_destroy(struct flb_upstream *u)
         destroy_conn(u_conn);
     }
 
+    mk_list_foreach_safe(head, tmp, &u->prewarm_queue) {
+        u_conn = mk_list_entry(head, struct flb_upstream_conn, _head);
+        destroy_conn(u_conn);
+    }
+
     mk_list_foreach_safe(head, tmp, &u->destroy_queue) {
         u_conn = mk_list_entry(head, struct flb_upstream_conn, _head);
         mk_list_del(&u_conn->_head);
+        if (u_conn->pipeline) {
+            flb_upstream_pipeline_destroy(u_conn->pipeline);
+        }
         flb_free(u_conn);
     }
 
+    if (u->wake_ch[0] != -1) {
+        mk_event_del(u->evl, &u->wake_event);
+        flb_pipe_destroy(u->wake_ch);
+    }
+    pthread_mutex_destroy(&u->stats_lock);
+
+#ifdef FLB_HAVE_TLS
+    mbedtls_ssl_session_free(&u->tls_resume);
+#endif
+
     flb_free(u->tcp_host);
     mk_list_del(&u->_head);
     flb_free(u);
@@ -323,11 +586,20 @@ int flb_upstream_conn_recycle(struct flb_upstream_conn *conn, int val)
 
 struct flb_upstream_conn *flb_upstream_conn_get(struct flb_upstream *u)
 {
+    int ret;
     int err;
+    socklen_t slen;
     struct mk_list *tmp;
     struct mk_list *head;
+    struct flb_thread *th;
     struct flb_upstream_conn *conn = NULL;
 
+    /* Flushes running on an output worker use the worker copy */
+    u = flb_output_worker_upstream(u);
+    if (!u) {
+        return NULL;
+    }
+
     flb_trace("[upstream] get new connection for %s:%i, net setup:\n"
               "net.connect_timeout        = %i seconds\n"
               "net.source_address         = %s\n"
@@ -339,9 +611,13 @@ struct flb_upstream_conn *flb_upstream_conn_get(struct flb_upstream *u)
               u->net.keepalive ? "enabled": "disabled",
               u->net.keepalive_idle_timeout);
 
+    /* from now on 'net.min_idle_connections' are kept open */
+    u->active = FLB_TRUE;
+
+ retry:
     /* On non Keepalive mode, always create a new TCP connection */
     if (u->net.keepalive == FLB_FALSE) {
-        return create_conn(u);
+        goto create;
     }
 
     /*
@@ -359,7 +635,12 @@ struct flb_upstream_conn *flb_upstream_conn_get(struct flb_upstream *u)
         /* Reset errno */
         conn->net_error = -1;
 
-        err = flb_socket_error(conn->fd);
+        /* errno is stale at this point, get the socket pending error */
+        err = 0;
+        slen = sizeof(err);
+        if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &slen) == -1) {
+            err = flb_socket_error(conn->fd);
+        }
         if (!FLB_EINPROGRESS(err) && err != 0) {
             flb_debug("[upstream] KA connection #%i is in a failed state "
                       "to: %s:%i, cleaning up",
@@ -386,8 +667,62 @@ struct flb_upstream_conn *flb_upstream_conn_get(struct flb_upstream *u)
     }
 
     /* No keepalive connection available, create a new one */
+ create:
+    th = pthread_getspecific(flb_thread_key);
+    if (upstream_slot_available(u) == FLB_FALSE &&
+        th && flb_upstream_is_async(u) == FLB_TRUE) {
+        /* out of a flush co-routine the limit is not enforced */
+        ret = upstream_wait(u, th);
+        if (ret == -1) {
+            return NULL;
+        }
+        goto retry;
+    }
+
+    return create_conn(u);
+}
+
+/*
+ * Get a connection that can be shared with other flushes sending pipelined
+ * requests ('net.pipeline_depth'). Connections already shared are filled up
+ * first so the number of connections stays low. Without pipelining this is
+ * the same as flb_upstream_conn_get().
+ */
+struct flb_upstream_conn *flb_upstream_conn_get_shared(struct flb_upstream *u)
+{
+    int ret;
+    struct mk_list *head;
+    struct flb_upstream_conn *conn;
+
+    u = flb_output_worker_upstream(u);
+    if (!u) {
+        return NULL;
+    }
+
+    if (u->net.pipeline_depth <= 1 || u->net.keepalive == FLB_FALSE ||
+        (u->flags & FLB_IO_ASYNC) == 0) {
+        return flb_upstream_conn_get(u);
+    }
+
+    mk_list_foreach(head, &u->busy_queue) {
+        conn = mk_list_entry(head, struct flb_upstream_conn, _head);
+        if (flb_upstream_pipeline_join(conn) == 0) {
+            flb_trace("[upstream] connection #%i to %s:%i is shared",
+                      conn->fd, u->tcp_host, u->tcp_port);
+            return conn;
+        }
+    }
+
+    conn = flb_upstream_conn_get(u);
     if (!conn) {
-        conn = create_conn(u);
+        return NULL;
+    }
+
+    /* pipelining is an optimization, keep going without it */
+    ret = flb_upstream_pipeline_attach(conn);
+    if (ret == -1) {
+        flb_warn("[upstream] connection #%i to %s:%i cannot be shared",
+                 conn->fd, u->tcp_host, u->tcp_port);
     }
 
     return conn;
@@ -409,13 +744,55 @@ static int cb_upstream_conn_ka_dropped(void *data)
     return destroy_conn(conn);
 }
 
+/*
+ * Move a connection to the 'available' queue, it's monitored while idle in
+ * case the remote endpoint closes it.
+ */
+static int conn_set_available(struct flb_upstream_conn *conn)
+{
+    int ret;
+    struct flb_upstream *u = conn->u;
+
+    mk_list_del(&conn->_head);
+    mk_list_add(&conn->_head, &u->av_queue);
+    conn->ts_available = time(NULL);
+
+    /*
+     * The socket at this point is not longer monitored, so if we want to be
+     * notified if the 'available keepalive connection' gets disconnected by
+     * the remote endpoint we need to add it again.
+     */
+    conn->event.handler = cb_upstream_conn_ka_dropped;
+
+    ret = mk_event_add(u->evl, conn->fd,
+                       FLB_ENGINE_EV_CUSTOM,
+                       MK_EVENT_CLOSE, &conn->event);
+    if (ret == -1) {
+        /* We failed the registration, for safety just destroy the connection */
+        flb_debug("[upstream] KA connection #%i to %s:%i could not be "
+                  "registered, closing.",
+                  conn->fd, u->tcp_host, u->tcp_port);
+        destroy_conn(conn);
+        return -1;
+    }
+
+    /* a flush might be waiting for it */
+    upstream_signal(u);
+
+    flb_debug("[upstream] KA connection #%i to %s:%i is now available",
+              conn->fd, u->tcp_host, u->tcp_port);
+    return 0;
+}
+
 int flb_upstream_conn_release(struct flb_upstream_conn *conn)
 {
     int ret;
-    struct flb_upstream *u;
 
-    /* Upstream context */
-    u = conn->u;
+    /* A shared connection is released by its last user */
+    if (flb_upstream_pipeline_get(conn) &&
+        flb_upstream_pipeline_release(conn) > 0) {
+        return 0;
+    }
 
     /* If this is a valid KA connection just recycle */
     if (conn->u->net.keepalive == FLB_TRUE && conn->recycle == FLB_TRUE && conn->fd > -1) {
@@ -423,30 +800,10 @@ int flb_upstream_conn_release(struct flb_upstream_conn *conn)
          * This connection is still useful, move it to the 'available' queue and
          * initialize variables.
          */
-        mk_list_del(&conn->_head);
-        mk_list_add(&conn->_head, &conn->u->av_queue);
-        conn->ts_available = time(NULL);
-
-        /*
-         * The socket at this point is not longer monitored, so if we want to be
-         * notified if the 'available keepalive connection' gets disconnected by
-         * the remote endpoint we need to add it again.
-         */
-        conn->event.handler = cb_upstream_conn_ka_dropped;
-
-        ret = mk_event_add(u->evl, conn->fd,
-                           FLB_ENGINE_EV_CUSTOM,
-                           MK_EVENT_CLOSE, &conn->event);
+        ret = conn_set_available(conn);
         if (ret == -1) {
-            /* We failed the registration, for safety just destroy the connection */
-            flb_debug("[upstream] KA connection #%i to %s:%i could not be "
-                      "registered, closing.",
-                      conn->fd, conn->u->tcp_host, conn->u->tcp_port);
-            return destroy_conn(conn);
+            return 0;
         }
-
-        flb_debug("[upstream] KA connection #%i to %s:%i is now available",
-                  conn->fd, conn->u->tcp_host, conn->u->tcp_port);
         conn->ka_count++;
         return 0;
     }
@@ -455,19 +812,237 @@ int flb_upstream_conn_release(struct flb_upstream_conn *conn)
     return destroy_conn(conn);
 }
 
-int flb_upstream_conn_timeouts(struct flb_config *ctx)
+/* A background connection failed */
+static void prewarm_failed(struct flb_upstream_conn *conn)
+{
+    struct flb_upstream *u = conn->u;
+
+    flb_debug("[upstream] background connection #%i to %s:%i failed",
+              conn->fd, u->tcp_host, u->tcp_port);
+    destroy_conn(conn);
+}
+
+/*
+ * Background connections are driven by the event loop: the TCP connect and
+ * the TLS handshake go on each time the socket is ready, nothing blocks.
+ */
+static int cb_upstream_conn_prewarm(void *data)
+{
+    int ret;
+    int err = 0;
+    socklen_t len = sizeof(err);
+    struct flb_upstream_conn *conn = data;
+    struct flb_upstream *u = conn->u;
+
+    if (conn->prewarm == FLB_UPSTREAM_PREWARM_CONNECT) {
+        ret = getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (ret == -1 || err != 0 || conn->net_error > 0) {
+            prewarm_failed(conn);
+            return 0;
+        }
+
+#ifdef FLB_HAVE_TLS
+        if (u->flags & FLB_IO_TLS) {
+            ret = flb_io_tls_handshake_start(conn);
+            if (ret == -1) {
+                prewarm_failed(conn);
+                return 0;
+            }
+            conn->prewarm = FLB_UPSTREAM_PREWARM_HANDSHAKE;
+        }
+#endif
+    }
+
+#ifdef FLB_HAVE_TLS
+    if (conn->prewarm == FLB_UPSTREAM_PREWARM_HANDSHAKE) {
+        if (conn->net_error > 0) {
+            prewarm_failed(conn);
+            return 0;
+        }
+
+        ret = flb_io_tls_handshake_step(conn);
+        if (ret == -1) {
+            prewarm_failed(conn);
+            return 0;
+        }
+        else if (ret != 0) {
+            ret = mk_event_add(u->evl, conn->fd, FLB_ENGINE_EV_CUSTOM,
+                               ret, &conn->event);
+            if (ret == -1) {
+                prewarm_failed(conn);
+            }
+            return 0;
+        }
+    }
+#endif
+
+    /* connected: same state than a connection created on demand */
+    mk_event_del(u->evl, &conn->event);
+    flb_net_socket_blocking(conn->fd);
+    conn->prewarm = FLB_UPSTREAM_PREWARM_NONE;
+    conn->ts_connect_timeout = -1;
+    u->stats.connects++;
+
+    flb_debug("[upstream] KA connection #%i to %s:%i opened in the background",
+              conn->fd, u->tcp_host, u->tcp_port);
+    conn_set_available(conn);
+
+    return 0;
+}
+
+/* Open a keepalive connection in the background */
+static int prewarm_conn(struct flb_upstream *u)
+{
+    int ret;
+    struct flb_upstream_conn *conn;
+
+    conn = conn_new(u, NULL);
+    if (!conn) {
+        return -1;
+    }
+    conn->prewarm = FLB_UPSTREAM_PREWARM_CONNECT;
+    mk_list_add(&conn->_head, &u->prewarm_queue);
+    u->n_connections++;
+
+    ret = flb_io_net_connect_start(conn);
+    if (ret == -1) {
+        destroy_conn(conn);
+        return -1;
+    }
+
+    conn->event.handler = cb_upstream_conn_prewarm;
+    ret = mk_event_add(u->evl, conn->fd, FLB_ENGINE_EV_CUSTOM,
+                       MK_EVENT_WRITE, &conn->event);
+    if (ret == -1) {
+        destroy_conn(conn);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Keep 'net.min_idle_connections' available without going over the limit */
+static void upstream_prewarm(struct flb_upstream *u)
+{
+    int ret;
+    int n;
+
+    if (u->active == FLB_FALSE || u->net.keepalive == FLB_FALSE ||
+        u->net.min_idle_connections <= 0) {
+        return;
+    }
+
+    n = u->net.min_idle_connections - mk_list_size(&u->av_queue) -
+        mk_list_size(&u->prewarm_queue);
+    while (n-- > 0) {
+        if (u->net.max_connections > 0 &&
+            u->n_connections >= u->net.max_connections) {
+            break;
+        }
+
+        ret = prewarm_conn(u);
+        if (ret == -1) {
+            break;
+        }
+    }
+}
+
+/*
+ * Report the statistics of the context to the upstream of the engine, the
+ * output worker copies run in other threads.
+ */
+static void upstream_stats_publish(struct flb_upstream *u)
+{
+    struct flb_upstream *dst = u->parent ? u->parent : u;
+    struct flb_upstream_stats *t = &dst->stats_total;
+
+    u->stats.idle = mk_list_size(&u->av_queue);
+    u->stats.busy = mk_list_size(&u->busy_queue);
+
+    /* counters wrap the same way than their deltas */
+    pthread_mutex_lock(&dst->stats_lock);
+    t->idle += u->stats.idle - u->stats_sent.idle;
+    t->busy += u->stats.busy - u->stats_sent.busy;
+    t->connects += u->stats.connects - u->stats_sent.connects;
+    t->tls_resumed += u->stats.tls_resumed - u->stats_sent.tls_resumed;
+    t->waits += u->stats.waits - u->stats_sent.waits;
+    pthread_mutex_unlock(&dst->stats_lock);
+
+    u->stats_sent = u->stats;
+}
+
+void flb_upstream_stats_get(struct flb_upstream *u,
+                            struct flb_upstream_stats *stats)
+{
+    pthread_mutex_lock(&u->stats_lock);
+    *stats = u->stats_total;
+    pthread_mutex_unlock(&u->stats_lock);
+}
+
+#ifdef FLB_HAVE_METRICS
+static void metric_reset(int id, struct flb_metrics *metrics)
+{
+    struct flb_metric *m;
+
+    m = flb_metrics_get_id(id, metrics);
+    if (m) {
+        m->val = 0;
+    }
+}
+
+/* Sum the pool statistics of every upstream of an output into its metrics */
+static void upstream_metrics_update(struct mk_list *list)
+{
+    struct mk_list *head;
+    struct flb_upstream *u;
+    struct flb_upstream_stats stats;
+
+    mk_list_foreach(head, list) {
+        u = mk_list_entry(head, struct flb_upstream, _head);
+        if (!u->metrics) {
+            continue;
+        }
+        metric_reset(FLB_METRIC_OUT_UPSTREAM_IDLE, u->metrics);
+        metric_reset(FLB_METRIC_OUT_UPSTREAM_BUSY, u->metrics);
+        metric_reset(FLB_METRIC_OUT_UPSTREAM_CONNECTS, u->metrics);
+        metric_reset(FLB_METRIC_OUT_UPSTREAM_TLS_RESUMED, u->metrics);
+        metric_reset(FLB_METRIC_OUT_UPSTREAM_WAITS, u->metrics);
+    }
+
+    mk_list_foreach(head, list) {
+        u = mk_list_entry(head, struct flb_upstream, _head);
+        if (!u->metrics) {
+            continue;
+        }
+        flb_upstream_stats_get(u, &stats);
+        flb_metrics_sum(FLB_METRIC_OUT_UPSTREAM_IDLE, stats.idle, u->metrics);
+        flb_metrics_sum(FLB_METRIC_OUT_UPSTREAM_BUSY, stats.busy, u->metrics);
+        flb_metrics_sum(FLB_METRIC_OUT_UPSTREAM_CONNECTS, stats.connects,
+                        u->metrics);
+        flb_metrics_sum(FLB_METRIC_OUT_UPSTREAM_TLS_RESUMED,
+                        stats.tls_resumed, u->metrics);
+        flb_metrics_sum(FLB_METRIC_OUT_UPSTREAM_WAITS, stats.waits,
+                        u->metrics);
+    }
+}
+#endif
+
+int flb_upstream_conn_timeouts(struct mk_list *list)
 {
     time_t now;
     int drop;
+    struct mk_list timed_out;
+    struct mk_list *tmp;
     struct mk_list *head;
     struct mk_list *u_head;
+    struct upstream_waiter *w;
     struct flb_upstream *u;
     struct flb_upstream_conn *u_conn;
 
     now = time(NULL);
 
     /* Iterate all upstream contexts */
-    mk_list_foreach(head, &ctx->upstreams) {
+    mk_list_foreach(head, list) {
         u = mk_list_entry(head, struct flb_upstream, _head);
 
         /* Iterate every busy connection */
@@ -499,6 +1074,17 @@ int flb_upstream_conn_timeouts(struct flb_config *ctx)
             }
         }
 
+        /* Background connections, the event handler cleans them up */
+        mk_list_foreach(u_head, &u->prewarm_queue) {
+            u_conn = mk_list_entry(u_head, struct flb_upstream_conn, _head);
+            if (u->net.connect_timeout > 0 &&
+                u_conn->ts_connect_timeout > 0 &&
+                u_conn->ts_connect_timeout <= now) {
+                shutdown(u_conn->fd, SHUT_RDWR);
+                u_conn->net_error = ETIMEDOUT;
+            }
+        }
+
         /* Check every available Keepalive connection */
         mk_list_foreach(u_head, &u->av_queue) {
             u_conn = mk_list_entry(u_head, struct flb_upstream_conn, _head);
@@ -510,12 +1096,35 @@ int flb_upstream_conn_timeouts(struct flb_config *ctx)
             }
         }
 
+        /* Flushes waiting too long for a connection give up */
+        mk_list_init(&timed_out);
+        mk_list_foreach_safe(u_head, tmp, &u->conn_waiters) {
+            w = mk_list_entry(u_head, struct upstream_waiter, _head);
+            if (u->net.connect_timeout > 0 &&
+                (now - w->ts) >= u->net.connect_timeout) {
+                w->timed_out = FLB_TRUE;
+                mk_list_del(&w->_head);
+                mk_list_add(&w->_head, &timed_out);
+            }
+        }
+        while (mk_list_is_empty(&timed_out) != 0) {
+            w = mk_list_entry_first(&timed_out, struct upstream_waiter, _head);
+            mk_list_del(&w->_head);
+            flb_output_worker_resume(w->th);
+        }
+
+        upstream_prewarm(u);
+        upstream_stats_publish(u);
     }
 
+#ifdef FLB_HAVE_METRICS
+    upstream_metrics_update(list);
+#endif
+
     return 0;
 }
 
-int flb_upstream_conn_pending_destroy(struct flb_config *ctx)
+int flb_upstream_conn_pending_destroy(struct mk_list *list)
 {
     struct mk_list *head;
     struct mk_list *tmp;
@@ -524,13 +1133,16 @@ int flb_upstream_conn_pending_destroy(struct flb_config *ctx)
     struct flb_upstream_conn *u_conn;
 
     /* Iterate all upstream contexts */
-    mk_list_foreach(head, &ctx->upstreams) {
+    mk_list_foreach(head, list) {
         u = mk_list_entry(head, struct flb_upstream, _head);
 
         /* Real destroy of connections context */
         mk_list_foreach_safe(u_head, tmp, &u->destroy_queue) {
             u_conn = mk_list_entry(u_head, struct flb_upstream_conn, _head);
             mk_list_del(&u_conn->_head);
+            if (u_conn->pipeline) {
+                flb_upstream_pipeline_destroy(u_conn->pipeline);
+            }
             flb_free(u_conn);
         }
     }
@@ -24,10 +24,12 @@
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_hash.h>
 #include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_random.h>
 #include <fluent-bit/flb_upstream_ha.h>
 #include <fluent-bit/flb_upstream_node.h>
 
 #include <ctype.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -54,6 +56,16 @@ struct flb_upstream_ha *flb_upstream_ha_create(const char *name)
 
     mk_list_init(&ctx->nodes);
     ctx->last_used_node = NULL;
+    ctx->balance = FLB_UPSTREAM_HA_ROUND_ROBIN;
+    ctx->max_fails = 3;
+    ctx->fail_timeout = 0;
+    pthread_mutex_init(&ctx->lock, NULL);
+
+    if (flb_random_bytes((unsigned char *) &ctx->rand_state,
+                         sizeof(ctx->rand_state)) != 0 ||
+        ctx->rand_state == 0) {
+        ctx->rand_state = (uint64_t) time(NULL) ^ (uintptr_t) ctx;
+    }
 
     return ctx;
 }
@@ -71,6 +83,8 @@ void flb_upstream_ha_destroy(struct flb_upstream_ha *ctx)
         flb_upstream_node_destroy(node);
     }
 
+    flb_free(ctx->ring);
+    pthread_mutex_destroy(&ctx->lock);
     flb_sds_destroy(ctx->name);
     flb_free(ctx);
 }
@@ -79,34 +93,428 @@ void flb_upstream_ha_destroy(struct flb_upstream_ha *ctx)
 void flb_upstream_ha_node_add(struct flb_upstream_ha *ctx,
                               struct flb_upstream_node *node)
 {
+    pthread_mutex_lock(&ctx->lock);
     mk_list_add(&node->_head, &ctx->nodes);
+
+    /* the hashing ring is built again with the new node */
+    flb_free(ctx->ring);
+    ctx->ring = NULL;
+    ctx->ring_size = 0;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+int flb_upstream_ha_balance_type(const char *str)
+{
+    if (strcasecmp(str, "round_robin") == 0) {
+        return FLB_UPSTREAM_HA_ROUND_ROBIN;
+    }
+    else if (strcasecmp(str, "least_outstanding") == 0) {
+        return FLB_UPSTREAM_HA_LEAST_OUTSTANDING;
+    }
+    else if (strcasecmp(str, "ewma") == 0) {
+        return FLB_UPSTREAM_HA_EWMA;
+    }
+    else if (strcasecmp(str, "tag_hash") == 0) {
+        return FLB_UPSTREAM_HA_TAG_HASH;
+    }
+
+    return -1;
+}
+
+/* FNV-1a with a final avalanche, points must spread over the whole ring */
+static uint32_t ha_hash(const char *buf, int len)
+{
+    int i;
+    uint32_t h = 2166136261u;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) buf[i];
+        h *= 16777619u;
+    }
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static uint64_t ha_rand(struct flb_upstream_ha *ctx)
+{
+    uint64_t x = ctx->rand_state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    ctx->rand_state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+ * Ejected nodes are skipped until their timeout expires, unless 'any' is
+ * set: when every node failed, they are still better than no node at all.
+ */
+static int node_available(struct flb_upstream_ha *ctx,
+                          struct flb_upstream_node *node, time_t now, int any)
+{
+    if (node->ejected == FLB_FALSE || any == FLB_TRUE) {
+        return FLB_TRUE;
+    }
+
+    if (now >= node->ejected_until) {
+        node->ejected = FLB_FALSE;
+        node->fails = 0;
+        flb_info("[upstream_ha] node '%s' is back in upstream '%s'",
+                 node->name, ctx->name);
+        return FLB_TRUE;
+    }
+
+    return FLB_FALSE;
+}
+
+/* The node following the last one used, wrapping around the list */
+static struct flb_upstream_node *node_next(struct flb_upstream_ha *ctx,
+                                           struct flb_upstream_node *node)
+{
+    if (!node) {
+        return mk_list_entry_first(&ctx->nodes, struct flb_upstream_node,
+                                   _head);
+    }
+
+    return mk_list_entry_next(&node->_head, struct flb_upstream_node,
+                              _head, &ctx->nodes);
+}
+
+static struct flb_upstream_node *balance_round_robin(struct flb_upstream_ha *ctx,
+                                                     time_t now, int any)
+{
+    int i;
+    int n;
+    struct flb_upstream_node *node;
+
+    n = mk_list_size(&ctx->nodes);
+    node = ctx->last_used_node;
+    for (i = 0; i < n; i++) {
+        node = node_next(ctx, node);
+        if (node_available(ctx, node, now, any) == FLB_TRUE) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+/* Fewest requests in flight, ties are resolved in round robin order */
+static struct flb_upstream_node *balance_least_outstanding(struct flb_upstream_ha *ctx,
+                                                           time_t now, int any)
+{
+    int i;
+    int n;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *best = NULL;
+
+    n = mk_list_size(&ctx->nodes);
+    node = ctx->last_used_node;
+    for (i = 0; i < n; i++) {
+        node = node_next(ctx, node);
+        if (node_available(ctx, node, now, any) == FLB_FALSE) {
+            continue;
+        }
+        if (!best || node->outstanding < best->outstanding) {
+            best = node;
+        }
+    }
+
+    return best;
+}
+
+static double node_cost(struct flb_upstream_node *node)
+{
+    /* nodes without samples yet are tried first */
+    return node->ewma_latency * (node->outstanding + 1);
+}
+
+/*
+ * Power of two choices: out of two random nodes, take the one with the
+ * lower latency average weighted by its requests in flight. It avoids
+ * slow nodes without sending everything to the fastest one.
+ */
+static struct flb_upstream_node *balance_ewma(struct flb_upstream_ha *ctx,
+                                              time_t now, int any)
+{
+    int i = 0;
+    int n = 0;
+    int a;
+    int b;
+    struct mk_list *head;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *node_a = NULL;
+    struct flb_upstream_node *node_b = NULL;
+
+    mk_list_foreach(head, &ctx->nodes) {
+        node = mk_list_entry(head, struct flb_upstream_node, _head);
+        if (node_available(ctx, node, now, any) == FLB_TRUE) {
+            n++;
+        }
+    }
+    if (n == 0) {
+        return NULL;
+    }
+
+    a = ha_rand(ctx) % n;
+    b = a;
+    if (n > 1) {
+        b = (a + 1 + ha_rand(ctx) % (n - 1)) % n;
+    }
+
+    mk_list_foreach(head, &ctx->nodes) {
+        node = mk_list_entry(head, struct flb_upstream_node, _head);
+        if (node_available(ctx, node, now, any) == FLB_FALSE) {
+            continue;
+        }
+        if (i == a) {
+            node_a = node;
+        }
+        if (i == b) {
+            node_b = node;
+        }
+        i++;
+    }
+
+    if (node_cost(node_b) < node_cost(node_a)) {
+        return node_b;
+    }
+    return node_a;
+}
+
+static int ring_point_cmp(const void *a, const void *b)
+{
+    const struct flb_upstream_ha_point *p_a = a;
+    const struct flb_upstream_ha_point *p_b = b;
+
+    if (p_a->hash < p_b->hash) {
+        return -1;
+    }
+    else if (p_a->hash > p_b->hash) {
+        return 1;
+    }
+    return 0;
+}
+
+static int ring_build(struct flb_upstream_ha *ctx)
+{
+    int i;
+    int len;
+    int n = 0;
+    char buf[256];
+    struct mk_list *head;
+    struct flb_upstream_node *node;
+    struct flb_upstream_ha_point *ring;
+
+    ring = flb_malloc(sizeof(struct flb_upstream_ha_point) *
+                      mk_list_size(&ctx->nodes) * FLB_UPSTREAM_HA_RING_POINTS);
+    if (!ring) {
+        flb_errno();
+        return -1;
+    }
+
+    /* points only depend on the node names, not on their order */
+    mk_list_foreach(head, &ctx->nodes) {
+        node = mk_list_entry(head, struct flb_upstream_node, _head);
+        for (i = 0; i < FLB_UPSTREAM_HA_RING_POINTS; i++) {
+            len = snprintf(buf, sizeof(buf), "%s#%i", node->name, i);
+            if (len >= sizeof(buf)) {
+                len = sizeof(buf) - 1;
+            }
+            ring[n].hash = ha_hash(buf, len);
+            ring[n].node = node;
+            n++;
+        }
+    }
+    qsort(ring, n, sizeof(struct flb_upstream_ha_point), ring_point_cmp);
+
+    ctx->ring = ring;
+    ctx->ring_size = n;
+    return 0;
+}
+
+/*
+ * Consistent hashing: a key always goes to the same node while it's
+ * available. When it's not, its keys move to the following nodes on the
+ * ring and only those keys move.
+ */
+static struct flb_upstream_node *balance_tag_hash(struct flb_upstream_ha *ctx,
+                                                  const char *key, int key_len,
+                                                  time_t now, int any)
+{
+    int i;
+    int lo;
+    int hi;
+    int mid;
+    uint32_t h;
+    struct flb_upstream_node *node;
+
+    if (!ctx->ring && ring_build(ctx) == -1) {
+        return balance_round_robin(ctx, now, any);
+    }
+
+    /* first point at or after the key hash */
+    h = ha_hash(key, key_len);
+    lo = 0;
+    hi = ctx->ring_size;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (ctx->ring[mid].hash < h) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+
+    for (i = 0; i < ctx->ring_size; i++) {
+        node = ctx->ring[(lo + i) % ctx->ring_size].node;
+        if (node_available(ctx, node, now, any) == FLB_TRUE) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+static struct flb_upstream_node *node_select(struct flb_upstream_ha *ctx,
+                                             const char *key, int key_len,
+                                             time_t now, int any)
+{
+    switch (ctx->balance) {
+    case FLB_UPSTREAM_HA_LEAST_OUTSTANDING:
+        return balance_least_outstanding(ctx, now, any);
+    case FLB_UPSTREAM_HA_EWMA:
+        return balance_ewma(ctx, now, any);
+    case FLB_UPSTREAM_HA_TAG_HASH:
+        if (key) {
+            return balance_tag_hash(ctx, key, key_len, now, any);
+        }
+        break;
+    }
+
+    return balance_round_robin(ctx, now, any);
 }
 
 /* Return a target node to be used for I/O */
 struct flb_upstream_node *flb_upstream_ha_node_get(struct flb_upstream_ha *ctx)
 {
-    struct flb_upstream_node *cur_node;
+    return flb_upstream_ha_node_get_key(ctx, NULL, 0);
+}
+
+/*
+ * Return a target node for the given key (e.g: a Tag), only used by the
+ * 'tag_hash' strategy.
+ */
+struct flb_upstream_node *flb_upstream_ha_node_get_key(struct flb_upstream_ha *ctx,
+                                                       const char *key,
+                                                       int key_len)
+{
+    time_t now;
     struct flb_upstream_node *node;
 
     if (mk_list_is_empty(&ctx->nodes) == 0) {
         return NULL;
     }
 
-    if (!ctx->last_used_node) {
-        node = mk_list_entry_first(&ctx->nodes, struct flb_upstream_node,
-                                   _head);
-        ctx->last_used_node = node;
-        return node;
-    }
+    now = time(NULL);
 
-    cur_node = (struct flb_upstream_node *) ctx->last_used_node;
-
-    node = mk_list_entry_next(&cur_node->_head, struct flb_upstream_node,
-                              _head, &ctx->nodes);
+    pthread_mutex_lock(&ctx->lock);
+    node = node_select(ctx, key, key_len, now, FLB_FALSE);
+    if (!node) {
+        node = node_select(ctx, key, key_len, now, FLB_TRUE);
+    }
     ctx->last_used_node = node;
+    pthread_mutex_unlock(&ctx->lock);
+
     return node;
 }
 
+/*
+ * A request starts on a node returned by flb_upstream_ha_node_get(). Every
+ * request must be completed with flb_upstream_ha_node_end(), it feeds the
+ * balancing strategies and the passive health checks.
+ */
+void flb_upstream_ha_node_begin(struct flb_upstream_ha *ctx,
+                                struct flb_upstream_node *node,
+                                struct flb_time *start)
+{
+    pthread_mutex_lock(&ctx->lock);
+    node->outstanding++;
+    pthread_mutex_unlock(&ctx->lock);
+
+    flb_time_get(start);
+}
+
+static inline void node_ewma_update(struct flb_upstream_node *node,
+                                    double latency)
+{
+    if (node->ewma_latency == 0) {
+        node->ewma_latency = latency;
+    }
+    else {
+        node->ewma_latency += FLB_UPSTREAM_HA_EWMA_ALPHA *
+                              (latency - node->ewma_latency);
+    }
+}
+
+/* Latency accounted for a failed request, at least the connect timeout */
+static inline double node_fail_latency(struct flb_upstream_node *node,
+                                       double latency)
+{
+    double penalty = FLB_UPSTREAM_HA_FAIL_PENALTY;
+
+    if (node->u && node->u->net.connect_timeout > 0) {
+        penalty = node->u->net.connect_timeout * 1000.0;
+    }
+
+    return latency > penalty ? latency : penalty;
+}
+
+void flb_upstream_ha_node_end(struct flb_upstream_ha *ctx,
+                              struct flb_upstream_node *node,
+                              struct flb_time *start, int success)
+{
+    double latency;
+    struct flb_time now;
+    struct flb_time diff;
+
+    flb_time_get(&now);
+    flb_time_diff(&now, start, &diff);
+    latency = flb_time_to_double(&diff) * 1000.0;
+
+    pthread_mutex_lock(&ctx->lock);
+    node->outstanding--;
+
+    if (success == FLB_TRUE) {
+        node->fails = 0;
+        node_ewma_update(node, latency);
+        pthread_mutex_unlock(&ctx->lock);
+        return;
+    }
+
+    /* failing nodes must not look cheap to the ewma strategy */
+    node_ewma_update(node, node_fail_latency(node, latency));
+    node->fails++;
+    if (ctx->max_fails > 0 && ctx->fail_timeout > 0 &&
+        node->fails >= ctx->max_fails && node->ejected == FLB_FALSE) {
+        node->ejected = FLB_TRUE;
+        node->ejected_until = time(NULL) + ctx->fail_timeout;
+        flb_warn("[upstream_ha] node '%s' ejected from upstream '%s' for "
+                 "%i seconds after %i failed requests",
+                 node->name, ctx->name, ctx->fail_timeout, node->fails);
+    }
+    pthread_mutex_unlock(&ctx->lock);
+}
+
 static struct flb_upstream_node *create_node(int id,
                                              struct mk_rconf_section *s,
                                              struct flb_config *config)
@@ -263,6 +671,39 @@ static struct flb_upstream_node *create_node(int id,
     return node;
 }
 
+static int upstream_ha_set_properties(struct flb_upstream_ha *ups,
+                                      struct mk_rconf_section *s)
+{
+    int ret = 0;
+    char *tmp;
+
+    tmp = mk_rconf_section_get_key(s, "balance", MK_RCONF_STR);
+    if (tmp) {
+        ups->balance = flb_upstream_ha_balance_type(tmp);
+        if (ups->balance == -1) {
+            flb_error("[upstream_ha] invalid balance '%s' on upstream '%s', "
+                      "expected round_robin, least_outstanding, ewma or "
+                      "tag_hash", tmp, ups->name);
+            ret = -1;
+        }
+        flb_free(tmp);
+    }
+
+    tmp = mk_rconf_section_get_key(s, "max_fails", MK_RCONF_STR);
+    if (tmp) {
+        ups->max_fails = atoi(tmp);
+        flb_free(tmp);
+    }
+
+    tmp = mk_rconf_section_get_key(s, "fail_timeout", MK_RCONF_STR);
+    if (tmp) {
+        ups->fail_timeout = atoi(tmp);
+        flb_free(tmp);
+    }
+
+    return ret;
+}
+
 /* Read an upstream file and generate the context */
 struct flb_upstream_ha *flb_upstream_ha_from_file(const char *file,
                                                   struct flb_config *config)
@@ -331,6 +772,15 @@ struct flb_upstream_ha *flb_upstream_ha_from_file(const char *file,
         return NULL;
     }
 
+    /* Balancing strategy and passive health checks */
+    ret = upstream_ha_set_properties(ups, u_section);
+    if (ret == -1) {
+        mk_rconf_free(fconf);
+        flb_upstream_ha_destroy(ups);
+        flb_free(tmp);
+        return NULL;
+    }
+
     /* Register [NODE] sections */
     mk_list_foreach(head, &fconf->sections) {
         n_section = mk_list_entry(head, struct mk_rconf_section, _head);
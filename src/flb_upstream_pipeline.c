@@ -0,0 +1,433 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*  Fluent Bit
+ *  ==========
+ *  Copyright (C) 2019-2020 The Fluent Bit Authors
+ *  Copyright (C) 2015-2018 Treasure Data Inc.
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+
+#include <monkey/mk_core.h>
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_log.h>
+#include <fluent-bit/flb_io.h>
+#include <fluent-bit/flb_pipe.h>
+#include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_thread.h>
+#include <fluent-bit/flb_upstream.h>
+#include <fluent-bit/flb_upstream_pipeline.h>
+#include <fluent-bit/flb_output_worker.h>
+
+/* Resume every parked co-routine, each one checks again what it waits for */
+static void pipeline_wake(struct flb_upstream_pipeline *pl)
+{
+    struct mk_list list;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_upstream_conn *u_conn = pl->u_conn;
+    struct flb_upstream_pipeline_req *req;
+
+    if (pl->want != 0) {
+        mk_event_del(u_conn->u->evl, &u_conn->event);
+        pl->want = 0;
+    }
+
+    mk_list_init(&list);
+    mk_list_foreach_safe(head, tmp, &pl->waiters) {
+        req = mk_list_entry(head, struct flb_upstream_pipeline_req, _head_wait);
+        mk_list_del(&req->_head_wait);
+        mk_list_add(&req->_head_wait, &list);
+    }
+
+    /* the last co-routine might release the connection: don't touch 'pl' */
+    while (mk_list_is_empty(&list) != 0) {
+        req = mk_list_entry_first(&list, struct flb_upstream_pipeline_req,
+                                  _head_wait);
+        mk_list_del(&req->_head_wait);
+        flb_output_worker_resume(req->th);
+    }
+}
+
+/* The socket is ready for one of the parked co-routines */
+static int cb_pipeline_socket(void *data)
+{
+    struct flb_upstream_conn *u_conn = data;
+
+    pipeline_wake(u_conn->pipeline);
+    return 0;
+}
+
+/* The state changed, from a co-routine that can't resume the others */
+static int cb_pipeline_wake(void *data)
+{
+    int n;
+    uint64_t val;
+    struct flb_upstream_pipeline *pl = data;
+
+    n = flb_pipe_r(pl->ch[0], &val, sizeof(val));
+    if (n <= 0) {
+        flb_errno();
+        return -1;
+    }
+    pl->signaled = FLB_FALSE;
+
+    pipeline_wake(pl);
+    return 0;
+}
+
+static void pipeline_signal(struct flb_upstream_pipeline *pl)
+{
+    int n;
+    uint64_t val = 1;
+
+    if (pl->signaled == FLB_TRUE || mk_list_is_empty(&pl->waiters) == 0) {
+        return;
+    }
+
+    n = flb_pipe_w(pl->ch[1], &val, sizeof(val));
+    if (n == -1) {
+        flb_errno();
+        return;
+    }
+    pl->signaled = FLB_TRUE;
+}
+
+/* No more requests on this connection, the pending ones fail */
+static void pipeline_break(struct flb_upstream_pipeline *pl)
+{
+    struct flb_upstream_conn *u_conn = pl->u_conn;
+
+    if (pl->broken == FLB_FALSE) {
+        flb_debug("[upstream] pipelined connection #%i to %s:%i is broken, "
+                  "%i requests pending",
+                  u_conn->fd, u_conn->u->tcp_host, u_conn->u->tcp_port,
+                  mk_list_size(&pl->sent));
+    }
+
+    pl->broken = FLB_TRUE;
+    flb_upstream_conn_recycle(u_conn, FLB_FALSE);
+    pipeline_signal(pl);
+}
+
+/*
+ * Park the co-routine until something changes. If 'mask' is set it also
+ * waits for the socket, the event is shared by every parked co-routine.
+ */
+static void pipeline_park(struct flb_upstream_pipeline *pl,
+                          struct flb_upstream_pipeline_req *req, int mask)
+{
+    int ret;
+    struct flb_upstream_conn *u_conn = pl->u_conn;
+
+    if (mask != 0 && (pl->want & mask) != mask) {
+        u_conn->event.handler = cb_pipeline_socket;
+        ret = mk_event_add(u_conn->u->evl, u_conn->fd,
+                           FLB_ENGINE_EV_CUSTOM, pl->want | mask,
+                           &u_conn->event);
+        if (ret == -1) {
+            pipeline_break(pl);
+            return;
+        }
+        pl->want |= mask;
+    }
+
+    mk_list_add(&req->_head_wait, &pl->waiters);
+    flb_thread_yield(req->th, FLB_FALSE);
+}
+
+/* Start sharing a connection, the caller is the first user */
+int flb_upstream_pipeline_attach(struct flb_upstream_conn *u_conn)
+{
+    int ret;
+    struct mk_event *event;
+    struct flb_upstream *u = u_conn->u;
+    struct flb_upstream_pipeline *pl = u_conn->pipeline;
+
+    if (!pl) {
+        pl = flb_calloc(1, sizeof(struct flb_upstream_pipeline));
+        if (!pl) {
+            flb_errno();
+            return -1;
+        }
+        pl->u_conn = u_conn;
+        mk_list_init(&pl->sent);
+        mk_list_init(&pl->waiters);
+
+        ret = flb_pipe_create(pl->ch);
+        if (ret == -1) {
+            flb_errno();
+            flb_free(pl);
+            return -1;
+        }
+
+        event = &pl->event;
+        MK_EVENT_NEW(event);
+        event->fd      = pl->ch[0];
+        event->type    = FLB_ENGINE_EV_CUSTOM;
+        event->handler = cb_pipeline_wake;
+        ret = mk_event_add(u->evl, pl->ch[0],
+                           FLB_ENGINE_EV_CUSTOM, MK_EVENT_READ, event);
+        if (ret == -1) {
+            flb_pipe_destroy(pl->ch);
+            flb_free(pl);
+            return -1;
+        }
+        u_conn->pipeline = pl;
+    }
+
+    /* a recycled connection is still monitored for disconnections */
+    if (u_conn->event.status & MK_EVENT_REGISTERED) {
+        mk_event_del(u->evl, &u_conn->event);
+    }
+    MK_EVENT_NEW(&u_conn->event);
+
+    /* the socket is shared: nobody must block the event loop on it */
+    flb_net_socket_nonblocking(u_conn->fd);
+
+    pl->users = 1;
+    pl->broken = FLB_FALSE;
+    pl->writer = NULL;
+    pl->want = 0;
+    pl->carry_len = 0;
+
+    return 0;
+}
+
+/* Add a user to a shared connection, -1 if it can't take more requests */
+int flb_upstream_pipeline_join(struct flb_upstream_conn *u_conn)
+{
+    struct flb_upstream_pipeline *pl;
+
+    pl = flb_upstream_pipeline_get(u_conn);
+    if (!pl || pl->broken == FLB_TRUE ||
+        pl->users >= u_conn->u->net.pipeline_depth) {
+        return -1;
+    }
+
+    pl->users++;
+    return 0;
+}
+
+/* Remove a user, returns the number of co-routines still using it */
+int flb_upstream_pipeline_release(struct flb_upstream_conn *u_conn)
+{
+    struct flb_upstream_pipeline *pl = u_conn->pipeline;
+
+    /* e.g: the server announced it closes the connection */
+    if (u_conn->recycle == FLB_FALSE) {
+        pl->broken = FLB_TRUE;
+    }
+
+    pl->users--;
+    if (pl->users > 0) {
+        pipeline_signal(pl);
+        return pl->users;
+    }
+
+    /* data nobody asked for: the connection can't be reused */
+    if (pl->broken == FLB_TRUE || pl->carry_len > 0) {
+        flb_upstream_conn_recycle(u_conn, FLB_FALSE);
+    }
+
+    return 0;
+}
+
+void flb_upstream_pipeline_destroy(struct flb_upstream_pipeline *pl)
+{
+    mk_event_del(pl->u_conn->u->evl, &pl->event);
+    flb_pipe_destroy(pl->ch);
+    flb_free(pl->carry);
+    flb_free(pl);
+}
+
+/*
+ * Write a request once the previous one has been written. A request can be
+ * written in several parts: with 'more' set the connection stays reserved
+ * for it until its last part. Returns 0 on success, on error the connection
+ * is broken and -1 is returned.
+ */
+int flb_upstream_pipeline_writev(struct flb_upstream_conn *u_conn,
+                                 struct flb_upstream_pipeline_req *req,
+                                 const struct iovec *iov, int iovcnt,
+                                 int more, size_t *out_len)
+{
+    int i;
+    int ret = -1;
+    int mask;
+    ssize_t bytes;
+    struct iovec vec_stack[8];
+    struct iovec *vec = vec_stack;
+    struct iovec *pos;
+    struct flb_upstream_pipeline *pl = u_conn->pipeline;
+
+    *out_len = 0;
+
+    if (pl->writer != req) {
+        req->th = pthread_getspecific(flb_thread_key);
+        req->queued = FLB_FALSE;
+
+        while (pl->writer && pl->broken == FLB_FALSE) {
+            pipeline_park(pl, req, 0);
+        }
+        if (pl->broken == FLB_TRUE) {
+            return -1;
+        }
+
+        /* responses come back in the order the requests are written */
+        pl->writer = req;
+        mk_list_add(&req->_head, &pl->sent);
+        req->queued = FLB_TRUE;
+    }
+
+    /* the vector is consumed while writing, work on a copy */
+    if (iovcnt > sizeof(vec_stack) / sizeof(struct iovec)) {
+        vec = flb_malloc(sizeof(struct iovec) * iovcnt);
+        if (!vec) {
+            flb_errno();
+            return -1;
+        }
+    }
+    for (i = 0; i < iovcnt; i++) {
+        vec[i] = iov[i];
+    }
+    pos = vec;
+    iovcnt = flb_io_iov_advance(&pos, iovcnt, 0);
+
+    while (iovcnt > 0) {
+        bytes = flb_io_net_try_writev(u_conn, pos, iovcnt, &mask);
+        if (bytes == -1) {
+            break;
+        }
+        else if (bytes == 0) {
+            pipeline_park(pl, req, mask);
+            if (pl->broken == FLB_TRUE) {
+                break;
+            }
+            continue;
+        }
+
+        *out_len += bytes;
+        iovcnt = flb_io_iov_advance(&pos, iovcnt, bytes);
+    }
+
+    if (iovcnt == 0) {
+        if (more == FLB_FALSE) {
+            pl->writer = NULL;
+            pipeline_signal(pl);
+        }
+        ret = 0;
+    }
+    else {
+        flb_upstream_pipeline_abort(u_conn, req);
+    }
+
+    if (vec != vec_stack) {
+        flb_free(vec);
+    }
+    return ret;
+}
+
+/*
+ * Read the response of a request once the previous ones have been read,
+ * bytes left by them come first. Returns the number of bytes or -1.
+ */
+ssize_t flb_upstream_pipeline_read(struct flb_upstream_conn *u_conn,
+                                   struct flb_upstream_pipeline_req *req,
+                                   void *buf, size_t len)
+{
+    int mask;
+    ssize_t bytes;
+    struct flb_upstream_pipeline *pl = u_conn->pipeline;
+
+    while (pl->broken == FLB_FALSE && pl->sent.next != &req->_head) {
+        pipeline_park(pl, req, 0);
+    }
+
+    while (pl->broken == FLB_FALSE) {
+        if (pl->carry_len > 0) {
+            bytes = pl->carry_len < len ? pl->carry_len : len;
+            memcpy(buf, pl->carry, bytes);
+            memmove(pl->carry, pl->carry + bytes, pl->carry_len - bytes);
+            pl->carry_len -= bytes;
+            return bytes;
+        }
+
+        bytes = flb_io_net_try_read(u_conn, buf, len, &mask);
+        if (bytes == -1) {
+            pipeline_break(pl);
+            break;
+        }
+        else if (bytes > 0) {
+            return bytes;
+        }
+
+        pipeline_park(pl, req, mask);
+    }
+
+    return -1;
+}
+
+/*
+ * The response is complete, 'next' references the bytes read past its end,
+ * they belong to the following responses.
+ */
+void flb_upstream_pipeline_done(struct flb_upstream_conn *u_conn,
+                                struct flb_upstream_pipeline_req *req,
+                                const char *next, size_t len)
+{
+    size_t size;
+    char *tmp;
+    struct flb_upstream_pipeline *pl = u_conn->pipeline;
+
+    if (len > 0) {
+        size = pl->carry_len + len;
+        if (size > pl->carry_size) {
+            tmp = flb_realloc(pl->carry, size);
+            if (!tmp) {
+                flb_errno();
+                flb_upstream_pipeline_abort(u_conn, req);
+                return;
+            }
+            pl->carry = tmp;
+            pl->carry_size = size;
+        }
+
+        /* in front of the bytes not read yet */
+        memmove(pl->carry + len, pl->carry, pl->carry_len);
+        memcpy(pl->carry, next, len);
+        pl->carry_len = size;
+    }
+
+    mk_list_del(&req->_head);
+    req->queued = FLB_FALSE;
+    pipeline_signal(pl);
+}
+
+/* The request failed: the connection can't be trusted anymore */
+void flb_upstream_pipeline_abort(struct flb_upstream_conn *u_conn,
+                                 struct flb_upstream_pipeline_req *req)
+{
+    struct flb_upstream_pipeline *pl = u_conn->pipeline;
+
+    if (pl->writer == req) {
+        pl->writer = NULL;
+    }
+    if (req->queued == FLB_TRUE) {
+        mk_list_del(&req->_head);
+        req->queued = FLB_FALSE;
+    }
+    pipeline_break(pl);
+}
@@ -176,6 +176,43 @@ int is_same_metric(char *s1, char *s2) {
     return 1;
 }
 
+/* Metrics reporting a current value instead of a count */
+static const char *metrics_gauges[] = {
+    "upstream_idle",
+    "upstream_busy",
+    NULL
+};
+
+static int metric_is_gauge(const char *name, size_t len)
+{
+    int i;
+
+    for (i = 0; metrics_gauges[i]; i++) {
+        if (strlen(metrics_gauges[i]) == len &&
+            strncmp(metrics_gauges[i], name, len) == 0) {
+            return FLB_TRUE;
+        }
+    }
+    return FLB_FALSE;
+}
+
+/* TYPE annotation of a formatted metric line */
+static char *metric_type(char *s)
+{
+    int i;
+    size_t len;
+    size_t end = extract_metric_name_end_position(s);
+
+    for (i = 0; metrics_gauges[i]; i++) {
+        len = strlen(metrics_gauges[i]);
+        if (end > len && s[end - len - 1] == '_' &&
+            strncmp(s + end - len, metrics_gauges[i], len) == 0) {
+            return " gauge\n";
+        }
+    }
+    return " counter\n";
+}
+
 /* derive HELP text from metricname */
 /* if help text length > 128, increase init memory for metric_helptxt */
 flb_sds_t metrics_help_txt(char *metric_name, flb_sds_t *metric_helptxt)
@@ -207,6 +244,21 @@ flb_sds_t metrics_help_txt(char *metric_name, flb_sds_t *metric_helptxt)
     else if (strstr(metric_name, "output_proc_bytes")) {
         return flb_sds_cat(*metric_helptxt, " Number of processed output bytes.\n", 35);
     }
+    else if (strstr(metric_name, "output_upstream_idle")) {
+        return flb_sds_cat(*metric_helptxt, " Number of idle upstream connections.\n", 38);
+    }
+    else if (strstr(metric_name, "output_upstream_busy")) {
+        return flb_sds_cat(*metric_helptxt, " Number of upstream connections in use.\n", 40);
+    }
+    else if (strstr(metric_name, "output_upstream_connects")) {
+        return flb_sds_cat(*metric_helptxt, " Number of upstream connections established.\n", 45);
+    }
+    else if (strstr(metric_name, "output_upstream_tls_resumed")) {
+        return flb_sds_cat(*metric_helptxt, " Number of upstream TLS sessions resumed.\n", 42);
+    }
+    else if (strstr(metric_name, "output_upstream_waits")) {
+        return flb_sds_cat(*metric_helptxt, " Number of flushes that waited for a connection.\n", 49);
+    }
     else {
         return (flb_sds_cat(*metric_helptxt, " Fluentbit metrics.\n", 20));
     }
@@ -341,7 +393,12 @@ void cb_metrics_prometheus(mk_request_t *request, void *data)
                 sds_metric = flb_sds_cat(sds_metric, k.via.str.ptr, k.via.str.size);
                 sds_metric = flb_sds_cat(sds_metric, "_", 1);
                 sds_metric = flb_sds_cat(sds_metric, mk.via.str.ptr, mk.via.str.size);
-                sds_metric = flb_sds_cat(sds_metric, "_total{name=\"", 13);
+                if (metric_is_gauge(mk.via.str.ptr, mk.via.str.size)) {
+                    sds_metric = flb_sds_cat(sds_metric, "{name=\"", 7);
+                }
+                else {
+                    sds_metric = flb_sds_cat(sds_metric, "_total{name=\"", 13);
+                }
                 sds_metric = flb_sds_cat(sds_metric, sk.via.str.ptr, sk.via.str.size);
                 sds_metric = flb_sds_cat(sds_metric, "\"} ", 3);
                 sds_metric = flb_sds_cat(sds_metric, tmp, len);
@@ -370,7 +427,8 @@ void cb_metrics_prometheus(mk_request_t *request, void *data)
     null_check(tmp_sds);
     tmp_sds = flb_sds_cat(sds, metrics_arr[0], extract_metric_name_end_position(metrics_arr[0]));
     null_check(tmp_sds);
-    tmp_sds = flb_sds_cat(sds, " counter\n", 9);
+    tmp_sds = flb_sds_cat(sds, metric_type(metrics_arr[0]),
+                          strlen(metric_type(metrics_arr[0])));
     null_check(tmp_sds);
 
     for (i = 0; i < num_metrics; i++) {
@@ -391,7 +449,8 @@ void cb_metrics_prometheus(mk_request_t *request, void *data)
             null_check(tmp_sds);
             tmp_sds = flb_sds_cat(sds, metrics_arr[i+1], extract_metric_name_end_position(metrics_arr[i+1]));
             null_check(tmp_sds);
-            tmp_sds = flb_sds_cat(sds, " counter\n", 9);
+            tmp_sds = flb_sds_cat(sds, metric_type(metrics_arr[i+1]),
+                                  strlen(metric_type(metrics_arr[i+1])));
             null_check(tmp_sds);
         }
     }
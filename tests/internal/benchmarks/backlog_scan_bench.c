@@ -0,0 +1,137 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Startup time with a filesystem backlog: load and sort a synthetic backlog
+ * listing the streams with one thread, with scan workers and from the
+ * manifest saved at shutdown. Directories are in the page cache, a cold
+ * start only widens the gap.
+ * Usage: flb-bench-backlog_scan_bench [chunks] [streams]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <chunkio/chunkio.h>
+#include <chunkio/cio_utils.h>
+
+#define BENCH_PATH   "/tmp/flb-bench-backlog"
+#define ROUNDS       5
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static int chunk_cmp(const void *a_arg, const void *b_arg)
+{
+    struct cio_chunk *a = *(struct cio_chunk **) a_arg;
+    struct cio_chunk *b = *(struct cio_chunk **) b_arg;
+
+    return strcmp(a->name, b->name);
+}
+
+/* Write 'chunks' small chunks spread over 'streams' streams */
+static void backlog_create(int chunks, int streams)
+{
+    int i;
+    int err;
+    char name[64];
+    char record[] = "{\"time\":1600000000,\"log\":\"backlog record\"}";
+    struct cio_ctx *ctx;
+    struct cio_stream **st;
+    struct cio_chunk *chunk;
+
+    cio_utils_recursive_delete(BENCH_PATH);
+    ctx = cio_create(BENCH_PATH, NULL, CIO_LOG_ERROR, CIO_CHECKSUM);
+    st = malloc(sizeof(struct cio_stream *) * streams);
+    if (!ctx || !st) {
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < streams; i++) {
+        snprintf(name, sizeof(name), "tail.%i", i);
+        st[i] = cio_stream_create(ctx, name, CIO_STORE_FS);
+    }
+
+    for (i = 0; i < chunks; i++) {
+        snprintf(name, sizeof(name), "1-%i.%09i.flb", 1600000000 + i, i);
+        chunk = cio_chunk_open(ctx, st[i % streams], name, CIO_OPEN,
+                               sizeof(record), &err);
+        if (!chunk) {
+            exit(EXIT_FAILURE);
+        }
+        cio_chunk_write(chunk, record, sizeof(record) - 1);
+        cio_chunk_down(chunk);
+    }
+
+    cio_destroy(ctx);
+    free(st);
+}
+
+/* Average time in milliseconds to create, load and sort the backlog */
+static double bench_load(int workers, int manifest)
+{
+    int i;
+    int ret;
+    double t0;
+    double total = 0;
+    struct cio_ctx *ctx;
+
+    for (i = 0; i < ROUNDS + 1; i++) {
+        t0 = now();
+        ctx = cio_create(BENCH_PATH, NULL, CIO_LOG_ERROR, CIO_CHECKSUM);
+        if (!ctx) {
+            exit(EXIT_FAILURE);
+        }
+        cio_set_scan_workers(ctx, workers);
+        cio_set_manifest(ctx, manifest);
+
+        ret = cio_load(ctx, NULL);
+        if (ret == -1) {
+            exit(EXIT_FAILURE);
+        }
+        cio_qsort(ctx, chunk_cmp);
+
+        /* the first round only leaves the manifest for the next one */
+        if (i > 0) {
+            total += now() - t0;
+        }
+        cio_destroy(ctx);
+    }
+
+    return total / ROUNDS * 1000;
+}
+
+int main(int argc, char **argv)
+{
+    int chunks = 50000;
+    int streams = 16;
+
+    if (argc > 1) {
+        chunks = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        streams = atoi(argv[2]);
+    }
+    if (chunks <= 0 || streams <= 0) {
+        fprintf(stderr, "usage: %s [chunks] [streams]\n", argv[0]);
+        return 1;
+    }
+
+    printf("backlog of %i chunks in %i streams\n", chunks, streams);
+    backlog_create(chunks, streams);
+
+    printf("1 worker             : %8.2f ms\n", bench_load(1, CIO_FALSE));
+    printf("%i workers            : %8.2f ms\n", CIO_SCAN_WORKERS,
+           bench_load(CIO_SCAN_WORKERS, CIO_FALSE));
+    printf("%i workers + manifest : %8.2f ms\n", CIO_SCAN_WORKERS,
+           bench_load(CIO_SCAN_WORKERS, CIO_TRUE));
+
+    cio_utils_recursive_delete(BENCH_PATH);
+    return 0;
+}
@@ -0,0 +1,115 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Throughput of checksummed chunk writes (storage.checksum on) with the
+ * table driven crc32 and with crc32c. Usage: flb-bench-checksum_bench [MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <chunkio/chunkio.h>
+#include <chunkio/cio_utils.h>
+
+#define BENCH_PATH   "/tmp/flb-bench-checksum"
+#define CHUNK_SIZE   (2 * 1024 * 1024)
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* Append 'write_size' records to chunks of CHUNK_SIZE, as inputs do */
+static double bench_chunks(int type, char *buf, size_t total,
+                           size_t write_size)
+{
+    int err;
+    int n = 0;
+    size_t chunk_bytes = 0;
+    size_t done = 0;
+    char name[32];
+    double t0;
+    double t;
+    struct cio_ctx *ctx;
+    struct cio_stream *stream;
+    struct cio_chunk *chunk = NULL;
+
+    cio_utils_recursive_delete(BENCH_PATH);
+    ctx = cio_create(BENCH_PATH, NULL, CIO_LOG_ERROR, CIO_CHECKSUM);
+    if (!ctx) {
+        exit(EXIT_FAILURE);
+    }
+    cio_set_checksum_type(ctx, type);
+    stream = cio_stream_create(ctx, "bench", CIO_STORE_FS);
+
+    t0 = now();
+    while (done < total) {
+        if (!chunk || chunk_bytes >= CHUNK_SIZE) {
+            if (chunk) {
+                cio_chunk_sync(chunk);
+                cio_chunk_close(chunk, CIO_TRUE);
+            }
+            snprintf(name, sizeof(name), "chunk-%i", n++);
+            chunk = cio_chunk_open(ctx, stream, name, CIO_OPEN,
+                                   CHUNK_SIZE, &err);
+            if (!chunk) {
+                exit(EXIT_FAILURE);
+            }
+            chunk_bytes = 0;
+        }
+        cio_chunk_write(chunk, buf, write_size);
+        chunk_bytes += write_size;
+        done += write_size;
+    }
+    cio_chunk_sync(chunk);
+    cio_chunk_close(chunk, CIO_TRUE);
+    t = now() - t0;
+
+    cio_destroy(ctx);
+    cio_utils_recursive_delete(BENCH_PATH);
+
+    return ((double) total / (1024 * 1024)) / t;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    size_t mb = 256;
+    size_t size = 1024 * 1024;
+    size_t writes[] = {256, 4096, 65536};
+    char *buf;
+    struct cio_ctx *ctx;
+
+    if (argc > 1) {
+        mb = atoi(argv[1]);
+    }
+
+    buf = malloc(size);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+    for (i = 0; i < size; i++) {
+        buf[i] = 'a' + (i % 26);
+    }
+
+    ctx = cio_create(NULL, NULL, CIO_LOG_ERROR, 0);
+    printf("crc32c hardware acceleration: %s\n",
+           ctx->checksum_type == CIO_CRC32C ? "yes" : "no");
+    cio_destroy(ctx);
+
+    for (i = 0; i < sizeof(writes) / sizeof(writes[0]); i++) {
+        printf("writes of %-8zu crc32: %8.1f MB/s  crc32c: %8.1f MB/s\n",
+               writes[i],
+               bench_chunks(CIO_CRC32, buf, mb * 1024 * 1024, writes[i]),
+               bench_chunks(CIO_CRC32C, buf, mb * 1024 * 1024, writes[i]));
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,229 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * A chain of three grep like filters over container logs, each one keeps
+ * the records where a key has an expected value. The msgpack interface
+ * decodes the chunk and packs the kept records again in every stage; the
+ * batch interface decodes once, evaluates every predicate over a column and
+ * packs the result at the end.
+ * Usage: flb-bench-filter_columns_bench [records]
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_filter_batch.h>
+
+#include <msgpack.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct predicate {
+    const char *key;
+    const char *val;
+    int exclude;
+};
+
+static struct predicate chain[] = {
+    {"stream", "stdout", FLB_FALSE},
+    {"level",  "debug",  FLB_TRUE},
+    {"app",    "checkout", FLB_FALSE},
+};
+
+#define CHAIN_SIZE    (sizeof(chain) / sizeof(struct predicate))
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void pack_str(msgpack_packer *pck, const char *str)
+{
+    int len = strlen(str);
+
+    msgpack_pack_str(pck, len);
+    msgpack_pack_str_body(pck, str, len);
+}
+
+static void records_create(msgpack_sbuffer *sbuf, int count)
+{
+    int i;
+    char buf[256];
+    static const char *levels[] = {"info", "debug", "warn", "error"};
+    static const char *apps[] = {"checkout", "cart", "search"};
+    msgpack_packer pck;
+
+    msgpack_sbuffer_init(sbuf);
+    msgpack_packer_init(&pck, sbuf, msgpack_sbuffer_write);
+
+    for (i = 0; i < count; i++) {
+        msgpack_pack_array(&pck, 2);
+        msgpack_pack_uint64(&pck, 1600000000 + i);
+        msgpack_pack_map(&pck, 6);
+        pack_str(&pck, "log");
+        snprintf(buf, sizeof(buf),
+                 "10.0.%i.%i - - [30/Sep/2020:10:00:%02i +0000] \"GET "
+                 "/api/v1/items/%i HTTP/1.1\" 200 %i\n",
+                 i % 256, (i / 256) % 256, i % 60, i * 7919 % 100000,
+                 i % 4096);
+        pack_str(&pck, buf);
+        pack_str(&pck, "stream");
+        pack_str(&pck, i % 10 ? "stdout" : "stderr");
+        pack_str(&pck, "time");
+        snprintf(buf, sizeof(buf), "2020-09-30T10:00:%02i.%09iZ", i % 60, i);
+        pack_str(&pck, buf);
+        pack_str(&pck, "pod");
+        snprintf(buf, sizeof(buf), "checkout-7d9f8b6c5-%05i", i % 100000);
+        pack_str(&pck, buf);
+        pack_str(&pck, "level");
+        pack_str(&pck, levels[i % 4]);
+        pack_str(&pck, "app");
+        pack_str(&pck, apps[i % 3]);
+    }
+}
+
+static int str_equal(msgpack_object *o, const char *str)
+{
+    int len = strlen(str);
+
+    return o && o->type == MSGPACK_OBJECT_STR && o->via.str.size == len &&
+           memcmp(o->via.str.ptr, str, len) == 0;
+}
+
+static int keep(struct predicate *p, msgpack_object *val)
+{
+    return str_equal(val, p->val) != p->exclude;
+}
+
+/* One stage of the msgpack interface: decode, look up the key, pack */
+static void stage_msgpack(struct predicate *p, const char *data, size_t bytes,
+                          msgpack_sbuffer *out)
+{
+    int i;
+    size_t off = 0;
+    msgpack_object map;
+    msgpack_object *val;
+    msgpack_unpacked result;
+    msgpack_packer pck;
+    msgpack_object_kv *kv;
+
+    msgpack_sbuffer_init(out);
+    msgpack_packer_init(&pck, out, msgpack_sbuffer_write);
+
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, data, bytes, &off) ==
+           MSGPACK_UNPACK_SUCCESS) {
+        map = result.data.via.array.ptr[1];
+        val = NULL;
+        for (i = 0; i < map.via.map.size; i++) {
+            kv = &map.via.map.ptr[i];
+            if (str_equal(&kv->key, p->key)) {
+                val = &kv->val;
+                break;
+            }
+        }
+        if (keep(p, val)) {
+            msgpack_pack_object(&pck, result.data);
+        }
+    }
+    msgpack_unpacked_destroy(&result);
+}
+
+static size_t chain_msgpack(msgpack_sbuffer *in)
+{
+    int i;
+    size_t size;
+    msgpack_sbuffer out[2];
+    msgpack_sbuffer *cur = in;
+
+    for (i = 0; i < CHAIN_SIZE; i++) {
+        stage_msgpack(&chain[i], cur->data, cur->size, &out[i % 2]);
+        if (cur != in) {
+            msgpack_sbuffer_destroy(cur);
+        }
+        cur = &out[i % 2];
+    }
+    size = cur->size;
+    msgpack_sbuffer_destroy(cur);
+
+    return size;
+}
+
+static size_t chain_batch(msgpack_sbuffer *in)
+{
+    int i;
+    int k;
+    char *out_buf;
+    size_t out_size;
+    struct flb_batch_column *col;
+    struct flb_filter_batch batch;
+
+    if (flb_filter_batch_init(&batch, in->data, in->size) == -1) {
+        return 0;
+    }
+
+    for (k = 0; k < CHAIN_SIZE; k++) {
+        if (flb_filter_batch_column(&batch, chain[k].key,
+                                    strlen(chain[k].key), &col) == -1) {
+            flb_filter_batch_destroy(&batch);
+            return 0;
+        }
+        for (i = 0; i < batch.count; i++) {
+            if (batch.records[i].flags & FLB_BATCH_RECORD_DROPPED) {
+                continue;
+            }
+            if (!keep(&chain[k], flb_batch_column_value(col, i))) {
+                flb_filter_batch_drop(&batch, i);
+            }
+        }
+    }
+
+    flb_filter_batch_pack(&batch, &out_buf, &out_size);
+    flb_filter_batch_destroy(&batch);
+    flb_free(out_buf);
+
+    return out_size;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    int k;
+    int rounds = 10;
+    int count = 10000;
+    size_t out[2];
+    double t0;
+    double t[2];
+    double mb;
+    msgpack_sbuffer sbuf;
+
+    if (argc > 1) {
+        count = atoi(argv[1]);
+    }
+    if (count <= 0) {
+        fprintf(stderr, "usage: %s [records]\n", argv[0]);
+        return 1;
+    }
+
+    records_create(&sbuf, count);
+    mb = (double) sbuf.size * rounds / (1024 * 1024);
+
+    for (k = 0; k < 2; k++) {
+        t0 = now();
+        for (i = 0; i < rounds; i++) {
+            out[k] = k == 0 ? chain_msgpack(&sbuf) : chain_batch(&sbuf);
+        }
+        t[k] = now() - t0;
+    }
+
+    printf("%i records, %zu bytes, %zu bytes kept\n", count, sbuf.size, out[1]);
+    printf("msgpack per stage: %7.1f MB/s  batch columns: %7.1f MB/s%s\n",
+           mb / t[0], mb / t[1], out[0] != out[1] ? "  (MISMATCH)" : "");
+
+    msgpack_sbuffer_destroy(&sbuf);
+    return 0;
+}
@@ -0,0 +1,239 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Memory and latency of a compressed JSON flush: the payload formatted and
+ * then compressed in one shot, against formatting and compressing it while
+ * it's handed to the sink (what out_http 'stream_compression' does). The
+ * sink only counts bytes, each mode runs in its own process so the peak
+ * resident memory is not shared.
+ * Usage: flb-bench-gzip_stream_bench [MB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_gzip.h>
+#include <fluent-bit/flb_time.h>
+
+struct sink {
+    double t0;
+    double first;
+    size_t bytes;
+};
+
+struct result {
+    double first;
+    double total;
+    size_t bytes;
+    long peak_kb;
+};
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static long proc_status_kb(const char *key)
+{
+    long val = -1;
+    char line[256];
+    FILE *f;
+
+    f = fopen("/proc/self/status", "r");
+    if (!f) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, key, strlen(key)) == 0) {
+            val = atol(line + strlen(key));
+            break;
+        }
+    }
+    fclose(f);
+    return val;
+}
+
+static int sink_write(struct sink *s, size_t len)
+{
+    if (s->bytes == 0) {
+        s->first = now() - s->t0;
+    }
+    s->bytes += len;
+    return 0;
+}
+
+static int cb_gzip_out(void *data, const void *buf, size_t len)
+{
+    return sink_write(data, len);
+}
+
+static int cb_json_out(void *data, const char *buf, size_t len)
+{
+    return flb_gzip_stream_write(data, buf, len);
+}
+
+/* Records of about 250 bytes once in JSON, up to 'size' bytes */
+static void records_create(msgpack_sbuffer *sbuf, size_t size)
+{
+    int i;
+    int len;
+    char msg[200];
+    struct flb_time tm;
+    msgpack_packer pck;
+
+    msgpack_sbuffer_init(sbuf);
+    msgpack_packer_init(&pck, sbuf, msgpack_sbuffer_write);
+
+    for (i = 0; sbuf->size < size * 0.8; i++) {
+        flb_time_set(&tm, 1600000000 + i, i);
+        len = snprintf(msg, sizeof(msg),
+                       "GET /api/v1/items/%i HTTP/1.1 200 %i \"-\" "
+                       "\"Mozilla/5.0 (X11; Linux x86_64)\" rt=%i.%03i "
+                       "upstream=10.0.%i.%i:8080",
+                       i * 7919 % 100000, (i * 31) % 65536, i % 7, i % 1000,
+                       i % 256, (i / 256) % 256);
+
+        msgpack_pack_array(&pck, 2);
+        flb_time_append_to_msgpack(&tm, &pck, 0);
+        msgpack_pack_map(&pck, 2);
+        msgpack_pack_str(&pck, 3);
+        msgpack_pack_str_body(&pck, "log", 3);
+        msgpack_pack_str(&pck, len);
+        msgpack_pack_str_body(&pck, msg, len);
+        msgpack_pack_str(&pck, 6);
+        msgpack_pack_str_body(&pck, "stream", 6);
+        msgpack_pack_str(&pck, 6);
+        msgpack_pack_str_body(&pck, "stdout", 6);
+    }
+}
+
+static void run_oneshot(msgpack_sbuffer *sbuf, struct sink *s)
+{
+    int ret;
+    void *gz_buf;
+    size_t gz_size;
+    flb_sds_t json;
+
+    json = flb_pack_msgpack_to_json_format(sbuf->data, sbuf->size,
+                                           FLB_PACK_JSON_FORMAT_JSON,
+                                           FLB_PACK_JSON_DATE_DOUBLE, NULL);
+    if (!json) {
+        exit(EXIT_FAILURE);
+    }
+
+    ret = flb_gzip_compress(json, flb_sds_len(json), &gz_buf, &gz_size);
+    if (ret == -1) {
+        exit(EXIT_FAILURE);
+    }
+    flb_sds_destroy(json);
+
+    sink_write(s, gz_size);
+    flb_free(gz_buf);
+}
+
+static void run_stream(msgpack_sbuffer *sbuf, struct sink *s)
+{
+    int ret;
+    struct flb_gzip_stream *gz;
+
+    gz = flb_gzip_stream_create(cb_gzip_out, s);
+    if (!gz) {
+        exit(EXIT_FAILURE);
+    }
+
+    ret = flb_pack_msgpack_to_json_format_cb(sbuf->data, sbuf->size,
+                                             FLB_PACK_JSON_FORMAT_JSON,
+                                             FLB_PACK_JSON_DATE_DOUBLE, NULL,
+                                             cb_json_out, gz);
+    if (ret == -1 || flb_gzip_stream_finish(gz) == -1) {
+        exit(EXIT_FAILURE);
+    }
+    flb_gzip_stream_destroy(gz);
+}
+
+/* Run one flush in a child process, report through a pipe */
+static struct result bench(msgpack_sbuffer *sbuf, int stream)
+{
+    int fd[2];
+    long rss;
+    pid_t pid;
+    struct sink s;
+    struct result r;
+
+    if (pipe(fd) == -1) {
+        exit(EXIT_FAILURE);
+    }
+
+    pid = fork();
+    if (pid == 0) {
+        close(fd[0]);
+        rss = proc_status_kb("VmRSS:");
+
+        memset(&s, 0, sizeof(s));
+        s.t0 = now();
+        if (stream) {
+            run_stream(sbuf, &s);
+        }
+        else {
+            run_oneshot(sbuf, &s);
+        }
+        r.total = now() - s.t0;
+        r.first = s.first;
+        r.bytes = s.bytes;
+        r.peak_kb = proc_status_kb("VmHWM:") - rss;
+
+        if (write(fd[1], &r, sizeof(r)) != sizeof(r)) {
+            _exit(EXIT_FAILURE);
+        }
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(fd[1]);
+    if (read(fd[0], &r, sizeof(r)) != sizeof(r)) {
+        exit(EXIT_FAILURE);
+    }
+    close(fd[0]);
+    waitpid(pid, NULL, 0);
+
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    int mb = 5;
+    int i;
+    struct result r;
+    msgpack_sbuffer sbuf;
+    char *names[] = {"format + compress", "stream compression"};
+
+    if (argc > 1) {
+        mb = atoi(argv[1]);
+    }
+    if (mb <= 0) {
+        fprintf(stderr, "usage: %s [MB]\n", argv[0]);
+        return 1;
+    }
+
+    records_create(&sbuf, (size_t) mb * 1024 * 1024);
+    printf("flush of %i MB of msgpack records\n", mb);
+
+    for (i = 0; i < 2; i++) {
+        r = bench(&sbuf, i);
+        printf("%-20s: first byte %8.2f ms, total %8.2f ms, "
+               "%zu bytes out, peak memory +%li KB\n",
+               names[i], r.first * 1000, r.total * 1000, r.bytes, r.peak_kb);
+    }
+
+    msgpack_sbuffer_destroy(&sbuf);
+    return 0;
+}
@@ -0,0 +1,339 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Throughput of the msgpack to JSON conversion done by the HTTP based
+ * outputs, one record at a time: the previous encoder (snprintf() for
+ * numbers, a retry with a bigger buffer when it doesn't fit) against
+ * flb_msgpack_raw_to_json_sds().
+ * Usage: flb-bench-json_encode_bench [records]
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_sds.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_utils.h>
+
+#include <msgpack.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+struct records {
+    int count;
+    size_t bytes;
+    msgpack_sbuffer *data;
+};
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void pack_str(msgpack_packer *pck, const char *str)
+{
+    int len = strlen(str);
+
+    msgpack_pack_str(pck, len);
+    msgpack_pack_str_body(pck, str, len);
+}
+
+/* A container log with its Kubernetes metadata */
+static void kube_record(msgpack_packer *pck, int i)
+{
+    char buf[256];
+
+    msgpack_pack_map(pck, 4);
+    pack_str(pck, "log");
+    snprintf(buf, sizeof(buf),
+             "10.0.%i.%i - - [30/Sep/2020:10:00:%02i +0000] \"GET "
+             "/api/v1/items/%i HTTP/1.1\" %i %i \"-\" \"curl/7.68.0\"\n",
+             i % 256, (i / 256) % 256, i % 60, i * 7919 % 100000,
+             i % 5 ? 200 : 503, i % 4096);
+    pack_str(pck, buf);
+    pack_str(pck, "stream");
+    pack_str(pck, "stdout");
+    pack_str(pck, "time");
+    snprintf(buf, sizeof(buf), "2020-09-30T10:00:%02i.%09iZ", i % 60, i);
+    pack_str(pck, buf);
+
+    pack_str(pck, "kubernetes");
+    msgpack_pack_map(pck, 5);
+    pack_str(pck, "pod_name");
+    snprintf(buf, sizeof(buf), "checkout-7d9f8b6c5-%05i", i % 100000);
+    pack_str(pck, buf);
+    pack_str(pck, "namespace_name");
+    pack_str(pck, "shop");
+    pack_str(pck, "container_name");
+    pack_str(pck, "checkout");
+    pack_str(pck, "labels");
+    msgpack_pack_map(pck, 2);
+    pack_str(pck, "app");
+    pack_str(pck, "checkout");
+    pack_str(pck, "pod-template-hash");
+    pack_str(pck, "7d9f8b6c5");
+    pack_str(pck, "restart_count");
+    msgpack_pack_int(pck, i % 3);
+}
+
+/* Metrics like events, mostly numbers */
+static void metric_record(msgpack_packer *pck, int i)
+{
+    msgpack_pack_map(pck, 8);
+    pack_str(pck, "host");
+    pack_str(pck, "node-17.eu-west-1");
+    pack_str(pck, "cpu_p");
+    msgpack_pack_double(pck, (i % 10000) / 100.0);
+    pack_str(pck, "mem_used");
+    msgpack_pack_uint64(pck, 1073741824ULL + i * 4096ULL);
+    pack_str(pck, "mem_p");
+    msgpack_pack_double(pck, 0.3 + (i % 700) / 1000.0);
+    pack_str(pck, "load");
+    msgpack_pack_array(pck, 3);
+    msgpack_pack_double(pck, 1.0 / (1 + i % 7));
+    msgpack_pack_double(pck, 2.0 / (1 + i % 11));
+    msgpack_pack_double(pck, 3.0 / (1 + i % 13));
+    pack_str(pck, "rx_bytes");
+    msgpack_pack_uint64(pck, (uint64_t) i * 1500);
+    pack_str(pck, "tx_errors");
+    msgpack_pack_int64(pck, -(i % 4));
+    pack_str(pck, "up");
+    msgpack_pack_true(pck);
+}
+
+static void records_create(struct records *r, int count,
+                           void (*record)(msgpack_packer *, int))
+{
+    int i;
+    msgpack_packer pck;
+
+    r->count = count;
+    r->bytes = 0;
+    r->data = malloc(sizeof(msgpack_sbuffer) * count);
+
+    for (i = 0; i < count; i++) {
+        msgpack_sbuffer_init(&r->data[i]);
+        msgpack_packer_init(&pck, &r->data[i], msgpack_sbuffer_write);
+        record(&pck, i);
+        r->bytes += r->data[i].size;
+    }
+}
+
+static void records_destroy(struct records *r)
+{
+    int i;
+
+    for (i = 0; i < r->count; i++) {
+        msgpack_sbuffer_destroy(&r->data[i]);
+    }
+    free(r->data);
+}
+
+/* The previous encoder, kept here as the reference */
+static int prev_write(char *buf, int *off, size_t left,
+                      const char *str, size_t str_len)
+{
+    if (left <= *off + str_len) {
+        return FLB_FALSE;
+    }
+    memcpy(buf + *off, str, str_len);
+    *off += str_len;
+    return FLB_TRUE;
+}
+
+static int prev_key_exists(msgpack_object key, msgpack_object map, int offset)
+{
+    int i;
+    msgpack_object p;
+
+    if (key.type != MSGPACK_OBJECT_STR) {
+        return FLB_FALSE;
+    }
+
+    for (i = offset; i < map.via.map.size; i++) {
+        p = map.via.map.ptr[i].key;
+        if (p.type == MSGPACK_OBJECT_STR &&
+            key.via.str.size == p.via.str.size &&
+            memcmp(key.via.str.ptr, p.via.str.ptr, p.via.str.size) == 0) {
+            return FLB_TRUE;
+        }
+    }
+    return FLB_FALSE;
+}
+
+static int prev_msgpack2json(char *buf, int *off, size_t left,
+                             const msgpack_object *o)
+{
+    int i;
+    int len;
+    int packed = 0;
+    char temp[512];
+    msgpack_object_kv *kv;
+
+    switch (o->type) {
+    case MSGPACK_OBJECT_NIL:
+        return prev_write(buf, off, left, "null", 4);
+    case MSGPACK_OBJECT_BOOLEAN:
+        return o->via.boolean ? prev_write(buf, off, left, "true", 4) :
+                                prev_write(buf, off, left, "false", 5);
+    case MSGPACK_OBJECT_POSITIVE_INTEGER:
+        len = snprintf(temp, sizeof(temp) - 1, "%"PRIu64, o->via.u64);
+        return prev_write(buf, off, left, temp, len);
+    case MSGPACK_OBJECT_NEGATIVE_INTEGER:
+        len = snprintf(temp, sizeof(temp) - 1, "%"PRId64, o->via.i64);
+        return prev_write(buf, off, left, temp, len);
+    case MSGPACK_OBJECT_FLOAT32:
+    case MSGPACK_OBJECT_FLOAT64:
+        if (o->via.f64 == (double) (long long int) o->via.f64) {
+            len = snprintf(temp, sizeof(temp) - 1, "%.1f", o->via.f64);
+        }
+        else {
+            len = snprintf(temp, sizeof(temp) - 1, "%.16g", o->via.f64);
+        }
+        return prev_write(buf, off, left, temp, len);
+    case MSGPACK_OBJECT_STR:
+        return prev_write(buf, off, left, "\"", 1) &&
+               (o->via.str.size == 0 ||
+                flb_utils_write_str(buf, off, left, o->via.str.ptr,
+                                    o->via.str.size)) &&
+               prev_write(buf, off, left, "\"", 1);
+    case MSGPACK_OBJECT_ARRAY:
+        if (!prev_write(buf, off, left, "[", 1)) {
+            return FLB_FALSE;
+        }
+        for (i = 0; i < o->via.array.size; i++) {
+            if ((i > 0 && !prev_write(buf, off, left, ",", 1)) ||
+                !prev_msgpack2json(buf, off, left, o->via.array.ptr + i)) {
+                return FLB_FALSE;
+            }
+        }
+        return prev_write(buf, off, left, "]", 1);
+    case MSGPACK_OBJECT_MAP:
+        if (!prev_write(buf, off, left, "{", 1)) {
+            return FLB_FALSE;
+        }
+        for (i = 0; i < o->via.map.size; i++) {
+            kv = o->via.map.ptr + i;
+            if (prev_key_exists(kv->key, *o, i + 1)) {
+                continue;
+            }
+            if ((packed > 0 && !prev_write(buf, off, left, ",", 1)) ||
+                !prev_msgpack2json(buf, off, left, &kv->key) ||
+                !prev_write(buf, off, left, ":", 1) ||
+                !prev_msgpack2json(buf, off, left, &kv->val)) {
+                return FLB_FALSE;
+            }
+            packed++;
+        }
+        return prev_write(buf, off, left, "}", 1);
+    default:
+        return FLB_FALSE;
+    }
+}
+
+static flb_sds_t prev_raw_to_json_sds(const void *in_buf, size_t in_size)
+{
+    int off;
+    size_t unpack_off = 0;
+    size_t out_size;
+    flb_sds_t out_buf;
+    flb_sds_t tmp;
+    msgpack_unpacked result;
+
+    out_size = in_size * 1.5;
+    out_buf = flb_sds_create_size(out_size);
+
+    msgpack_unpacked_init(&result);
+    msgpack_unpack_next(&result, in_buf, in_size, &unpack_off);
+    while (1) {
+        off = 0;
+        if (prev_msgpack2json(out_buf, &off, out_size - 1, &result.data)) {
+            break;
+        }
+        tmp = flb_sds_increase(out_buf, 256);
+        if (!tmp) {
+            flb_sds_destroy(out_buf);
+            msgpack_unpacked_destroy(&result);
+            return NULL;
+        }
+        out_buf = tmp;
+        out_size += 256;
+    }
+    out_buf[off] = '\0';
+    flb_sds_len_set(out_buf, off);
+    msgpack_unpacked_destroy(&result);
+
+    return out_buf;
+}
+
+static void bench(const char *name, struct records *r)
+{
+    int i;
+    int k;
+    int rounds = 5;
+    int errors = 0;
+    size_t out_bytes = 0;
+    double t0;
+    double t[2];
+    double mb = (double) r->bytes * rounds / (1024 * 1024);
+    flb_sds_t out;
+
+    for (k = 0; k < 2; k++) {
+        t0 = now();
+        for (i = 0; i < r->count * rounds; i++) {
+            msgpack_sbuffer *sbuf = &r->data[i % r->count];
+
+            if (k == 0) {
+                out = prev_raw_to_json_sds(sbuf->data, sbuf->size);
+            }
+            else {
+                out = flb_msgpack_raw_to_json_sds(sbuf->data, sbuf->size);
+            }
+            if (!out) {
+                errors++;
+                continue;
+            }
+            out_bytes += flb_sds_len(out);
+            flb_sds_destroy(out);
+        }
+        t[k] = now() - t0;
+    }
+
+    printf("%-10s previous: %7.1f MB/s  streaming encoder: %7.1f MB/s  "
+           "(%.0f ns per record)%s\n",
+           name, mb / t[0], mb / t[1],
+           t[1] * 1e9 / (r->count * rounds),
+           errors ? "  (ERRORS)" : "");
+}
+
+int main(int argc, char **argv)
+{
+    int count = 100000;
+    struct records kube;
+    struct records metrics;
+
+    if (argc > 1) {
+        count = atoi(argv[1]);
+    }
+    if (count <= 0) {
+        fprintf(stderr, "usage: %s [records]\n", argv[0]);
+        return 1;
+    }
+
+    records_create(&kube, count, kube_record);
+    records_create(&metrics, count, metric_record);
+
+    printf("%i records, average %zu / %zu msgpack bytes\n", count,
+           kube.bytes / count, metrics.bytes / count);
+    bench("kubernetes", &kube);
+    bench("metrics", &metrics);
+
+    records_destroy(&kube);
+    records_destroy(&metrics);
+    return 0;
+}
@@ -0,0 +1,283 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Throughput of the JSON to msgpack conversion of container log lines:
+ * jsmn tokens against the structural index decoder, then the JSON parser
+ * with a time key, the way it used to work (pack, unpack, pack again
+ * without the time key) against flb_parser_json_do().
+ * Usage: flb-bench-json_pack_bench [lines]
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_pack_fast.h>
+#include <fluent-bit/flb_parser.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct lines {
+    int count;
+    size_t bytes;
+    char **data;
+    int *len;
+};
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+/* Docker json-file lines: plain access logs and JSON application logs */
+static int docker_line(char *buf, size_t size, int i)
+{
+    if (i % 2 == 0) {
+        return snprintf(buf, size,
+                        "{\"log\":\"10.0.%i.%i - - [30/Sep/2020:10:00:%02i "
+                        "+0000] \\\"GET /api/v1/items/%i HTTP/1.1\\\" %i %i "
+                        "\\\"-\\\" \\\"curl/7.68.0\\\"\\n\",\"stream\":"
+                        "\"stdout\",\"time\":\"2020-09-30T10:00:%02i."
+                        "%09iZ\"}",
+                        i % 256, (i / 256) % 256, i % 60, i * 7919 % 100000,
+                        i % 5 ? 200 : 503, i % 4096, i % 60, i);
+    }
+    return snprintf(buf, size,
+                    "{\"log\":\"{\\\"level\\\":\\\"info\\\",\\\"msg\\\":"
+                    "\\\"request done\\\",\\\"duration_ms\\\":%i.%i,"
+                    "\\\"user\\\":\\\"id-%i\\\"}\\n\",\"stream\":\"stderr\","
+                    "\"time\":\"2020-09-30T10:00:%02i.%09iZ\"}",
+                    i % 100, i % 10, i, i % 60, i);
+}
+
+/* Events posted to in_http */
+static int http_line(char *buf, size_t size, int i)
+{
+    return snprintf(buf, size,
+                    "{\"service\":\"checkout\",\"host\":\"10.0.1.%i\","
+                    "\"level\":\"%s\",\"latency\":0.%04i,\"status\":%i,"
+                    "\"tags\":[\"web\",\"eu-west-1\"],\"http\":{\"method\":"
+                    "\"POST\",\"path\":\"/cart/%i\",\"bytes\":%i},"
+                    "\"retry\":%s,\"msg\":\"cart updated\"}",
+                    i % 256, i % 3 ? "info" : "warn", i % 10000,
+                    i % 5 ? 200 : 503, i, i % 65536,
+                    i % 2 ? "false" : "true");
+}
+
+static void lines_create(struct lines *l, int count,
+                         int (*line)(char *, size_t, int))
+{
+    int i;
+    char buf[1024];
+
+    l->count = count;
+    l->bytes = 0;
+    l->data = malloc(sizeof(char *) * count);
+    l->len = malloc(sizeof(int) * count);
+
+    for (i = 0; i < count; i++) {
+        l->len[i] = line(buf, sizeof(buf), i);
+        l->data[i] = strdup(buf);
+        l->bytes += l->len[i];
+    }
+}
+
+static void lines_destroy(struct lines *l)
+{
+    int i;
+
+    for (i = 0; i < l->count; i++) {
+        free(l->data[i]);
+    }
+    free(l->data);
+    free(l->len);
+}
+
+static int run_jsmn(const char *js, int len)
+{
+    int ret;
+    int size;
+    char *buf;
+    struct flb_pack_state state;
+
+    flb_pack_state_init(&state);
+    ret = flb_pack_json_state(js, len, &buf, &size, &state);
+    flb_pack_state_reset(&state);
+    if (ret == 0) {
+        flb_free(buf);
+    }
+    return ret;
+}
+
+static int run_fast(const char *js, int len)
+{
+    int ret;
+    int type;
+    char *buf;
+    size_t size;
+
+    ret = flb_pack_json_fast(js, len, &buf, &size, &type, NULL);
+    if (ret == 0) {
+        flb_free(buf);
+    }
+    return ret;
+}
+
+/* What the JSON parser did before: unpack and pack again */
+static int run_parser_unpack(struct flb_parser *parser,
+                             const char *js, int len)
+{
+    int i;
+    int ret;
+    int size;
+    int skip = -1;
+    char *buf;
+    size_t off = 0;
+    double tmfrac;
+    struct tm tm;
+    msgpack_object map;
+    msgpack_object *k;
+    msgpack_object *v = NULL;
+    msgpack_unpacked result;
+    msgpack_sbuffer sbuf;
+    msgpack_packer pck;
+    struct flb_pack_state state;
+
+    flb_pack_state_init(&state);
+    ret = flb_pack_json_state(js, len, &buf, &size, &state);
+    flb_pack_state_reset(&state);
+    if (ret != 0) {
+        return -1;
+    }
+
+    msgpack_unpacked_init(&result);
+    msgpack_unpack_next(&result, buf, size, &off);
+    map = result.data;
+    for (i = 0; i < map.via.map.size; i++) {
+        k = &map.via.map.ptr[i].key;
+        if (k->via.str.size == 4 && memcmp(k->via.str.ptr, "time", 4) == 0) {
+            v = &map.via.map.ptr[i].val;
+            skip = i;
+            break;
+        }
+    }
+
+    if (v) {
+        flb_parser_time_lookup(v->via.str.ptr, v->via.str.size, 0, parser,
+                               &tm, &tmfrac);
+
+        msgpack_sbuffer_init(&sbuf);
+        msgpack_packer_init(&pck, &sbuf, msgpack_sbuffer_write);
+        msgpack_pack_map(&pck, map.via.map.size - 1);
+        for (i = 0; i < map.via.map.size; i++) {
+            if (i != skip) {
+                msgpack_pack_object(&pck, map.via.map.ptr[i].key);
+                msgpack_pack_object(&pck, map.via.map.ptr[i].val);
+            }
+        }
+        msgpack_sbuffer_destroy(&sbuf);
+    }
+
+    msgpack_unpacked_destroy(&result);
+    flb_free(buf);
+    return 0;
+}
+
+static int run_parser(struct flb_parser *parser, const char *js, int len)
+{
+    int ret;
+    void *buf;
+    size_t size;
+    struct flb_time tm;
+
+    ret = flb_parser_do(parser, js, len, &buf, &size, &tm);
+    if (ret == -1) {
+        return -1;
+    }
+    flb_free(buf);
+    return 0;
+}
+
+static void bench(const char *name, struct lines *l, struct flb_parser *p)
+{
+    int i;
+    int r;
+    int errors = 0;
+    int rounds = 5;
+    double t0;
+    double t[4];
+    double mb = (double) l->bytes * rounds / (1024 * 1024);
+
+    for (r = 0; r < 4; r++) {
+        t0 = now();
+        for (i = 0; i < l->count * rounds; i++) {
+            const char *js = l->data[i % l->count];
+            int len = l->len[i % l->count];
+
+            if (r == 0) {
+                errors += run_jsmn(js, len) != 0;
+            }
+            else if (r == 1) {
+                errors += run_fast(js, len) != 0;
+            }
+            else if (r == 2) {
+                errors += run_parser_unpack(p, js, len) != 0;
+            }
+            else {
+                errors += run_parser(p, js, len) != 0;
+            }
+        }
+        t[r] = now() - t0;
+    }
+
+    printf("%-14s jsmn: %7.1f MB/s  structural index: %7.1f MB/s\n"
+           "%-14s parser with unpack: %7.1f MB/s  single pass: %7.1f MB/s"
+           "%s\n",
+           name, mb / t[0], mb / t[1], "", mb / t[2], mb / t[3],
+           errors ? "  (ERRORS)" : "");
+}
+
+int main(int argc, char **argv)
+{
+    int count = 100000;
+    struct lines docker;
+    struct lines http;
+    struct flb_config *config;
+    struct flb_parser *parser;
+
+    if (argc > 1) {
+        count = atoi(argv[1]);
+    }
+    if (count <= 0) {
+        fprintf(stderr, "usage: %s [lines]\n", argv[0]);
+        return 1;
+    }
+
+    config = flb_config_init();
+    parser = flb_parser_create("docker", "json", NULL,
+                               "%Y-%m-%dT%H:%M:%S.%L", "time", NULL,
+                               FLB_FALSE, NULL, 0, NULL, config);
+    if (!parser) {
+        return 1;
+    }
+
+    lines_create(&docker, count, docker_line);
+    lines_create(&http, count, http_line);
+
+    printf("%i lines, average %zu / %zu bytes\n", count,
+           docker.bytes / count, http.bytes / count);
+    bench("docker", &docker, parser);
+    bench("http events", &http, parser);
+
+    lines_destroy(&docker);
+    lines_destroy(&http);
+    flb_parser_destroy(parser);
+    flb_config_exit(config);
+    return 0;
+}
@@ -0,0 +1,124 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Throughput of flb_lines_scan() against a plain memchr() loop, the way
+ * in_tail used to find line breaks. Usage: flb-bench-lines_bench [MB]
+ */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_lines.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BATCH 256
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static void fill(char *buf, size_t size, size_t line_len)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        if ((i + 1) % line_len == 0) {
+            buf[i] = '\n';
+        }
+        else {
+            buf[i] = 'a' + (i % 26);
+        }
+    }
+}
+
+static size_t run_memchr(const char *buf, size_t size)
+{
+    size_t count = 0;
+    const char *p = buf;
+    const char *end = buf + size;
+    const char *nl;
+
+    while (p < end && (nl = memchr(p, '\n', end - p))) {
+        count++;
+        p = nl + 1;
+    }
+    return count;
+}
+
+static size_t run_scan(const char *buf, size_t size)
+{
+    int n;
+    size_t count = 0;
+    size_t off = 0;
+    size_t lines[BATCH];
+
+    while (off < size) {
+        n = flb_lines_scan(buf + off, size - off, lines, BATCH);
+        if (n == 0) {
+            break;
+        }
+        count += n;
+        off += lines[n - 1] + 1;
+    }
+    return count;
+}
+
+static void bench(const char *name, char *buf, size_t size, size_t line_len)
+{
+    int i;
+    int rounds = 10;
+    size_t c1 = 0;
+    size_t c2 = 0;
+    double t0;
+    double t_memchr;
+    double t_scan;
+    double gb = (double) size * rounds / (1024 * 1024 * 1024);
+
+    fill(buf, size, line_len);
+
+    t0 = now();
+    for (i = 0; i < rounds; i++) {
+        c1 += run_memchr(buf, size);
+    }
+    t_memchr = now() - t0;
+
+    t0 = now();
+    for (i = 0; i < rounds; i++) {
+        c2 += run_scan(buf, size);
+    }
+    t_scan = now() - t0;
+
+    printf("%-12s memchr: %6.2f GB/s  flb_lines_scan: %6.2f GB/s%s\n",
+           name, gb / t_memchr, gb / t_scan,
+           c1 == c2 ? "" : "  (MISMATCH)");
+}
+
+int main(int argc, char **argv)
+{
+    size_t mb = 64;
+    size_t size;
+    char *buf;
+
+    if (argc > 1) {
+        mb = atoi(argv[1]);
+    }
+    size = mb * 1024 * 1024;
+
+    buf = malloc(size);
+    if (!buf) {
+        perror("malloc");
+        return 1;
+    }
+
+    bench("short (40B)", buf, size, 40);
+    bench("long (4KB)", buf, size, 4096);
+
+    free(buf);
+    return 0;
+}
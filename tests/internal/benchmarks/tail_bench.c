@@ -0,0 +1,166 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+/*
+ * Catch-up throughput of in_tail for each read backend: a set of files is
+ * written up front and the clock runs until every line has been ingested
+ * by the input instance. Usage: flb-bench-tail_bench [MB] [files]
+ */
+
+#include <fluent-bit.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_metrics.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LINE_SIZE 100
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+static size_t write_files(const char *dir, int files, size_t mb)
+{
+    int i;
+    size_t n;
+    size_t lines;
+    size_t total = 0;
+    char path[1024];
+    char line[LINE_SIZE + 1];
+    FILE *f;
+
+    memset(line, 'x', LINE_SIZE);
+    line[LINE_SIZE - 1] = '\n';
+    line[LINE_SIZE] = '\0';
+
+    lines = (mb * 1024 * 1024) / LINE_SIZE / files;
+    for (i = 0; i < files; i++) {
+        snprintf(path, sizeof(path) - 1, "%s/bench_%i.log", dir, i);
+        f = fopen(path, "w");
+        if (!f) {
+            perror("fopen");
+            exit(1);
+        }
+        for (n = 0; n < lines; n++) {
+            fwrite(line, 1, LINE_SIZE, f);
+        }
+        fclose(f);
+        total += lines;
+    }
+
+    return total;
+}
+
+static void remove_files(const char *dir, int files)
+{
+    int i;
+    char path[1024];
+
+    for (i = 0; i < files; i++) {
+        snprintf(path, sizeof(path) - 1, "%s/bench_%i.log", dir, i);
+        unlink(path);
+    }
+    rmdir(dir);
+}
+
+static size_t ingested_records(flb_ctx_t *ctx)
+{
+#ifdef FLB_HAVE_METRICS
+    struct flb_input_instance *ins;
+    struct flb_metric *m;
+
+    ins = mk_list_entry_first(&ctx->config->inputs,
+                              struct flb_input_instance, _head);
+    m = flb_metrics_get_id(FLB_METRIC_N_RECORDS, ins->metrics);
+    if (m) {
+        return m->val;
+    }
+#endif
+    return 0;
+}
+
+static void bench(const char *backend, const char *pattern,
+                  size_t total_lines, size_t mb)
+{
+    int in_ffd;
+    int out_ffd;
+    double t0;
+    double elapsed;
+    flb_ctx_t *ctx;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "0.2", "Grace", "1", "Log_Level", "error",
+                    NULL);
+
+    in_ffd = flb_input(ctx, (char *) "tail", NULL);
+    flb_input_set(ctx, in_ffd,
+                  "tag", "bench",
+                  "path", pattern,
+                  "read_from_head", "on",
+                  "refresh_interval", "60",
+                  "read_backend", backend,
+                  NULL);
+
+    out_ffd = flb_output(ctx, (char *) "null", NULL);
+    flb_output_set(ctx, out_ffd, "match", "*", NULL);
+
+    t0 = now();
+    if (flb_start(ctx) != 0) {
+        printf("%-9s could not start\n", backend);
+        flb_destroy(ctx);
+        return;
+    }
+
+    while (ingested_records(ctx) < total_lines && now() - t0 < 120) {
+        usleep(1000);
+    }
+    elapsed = now() - t0;
+
+    printf("%-9s %8.2f MB/s  %10.0f lines/s  (%zu/%zu lines)\n",
+           backend, mb / elapsed, ingested_records(ctx) / elapsed,
+           ingested_records(ctx), total_lines);
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}
+
+int main(int argc, char **argv)
+{
+    int files = 64;
+    size_t mb = 256;
+    size_t total;
+    char dir[] = "/tmp/flb-tail-bench-XXXXXX";
+    char pattern[1024];
+
+    if (argc > 1) {
+        mb = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        files = atoi(argv[2]);
+    }
+
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(pattern, sizeof(pattern) - 1, "%s/*.log", dir);
+
+    total = write_files(dir, files, mb);
+    printf("%zu MB in %i files, %zu lines\n", mb, files, total);
+
+    /* The first pass warms up the page cache for every backend */
+    bench("read", pattern, total, mb);
+    bench("read", pattern, total, mb);
+    bench("mmap", pattern, total, mb);
+    bench("io_uring", pattern, total, mb);
+
+    remove_files(dir, files);
+    return 0;
+}
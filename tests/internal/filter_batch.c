@@ -0,0 +1,336 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_mp.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_filter_batch.h>
+#include <msgpack.h>
+
+#include "flb_tests_internal.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define APACHE_10K    FLB_TESTS_DATA_PATH "/data/mp/apache_10k.mp"
+
+/* Pack [ts, {"id": id, "k": "v"}] */
+static void pack_record(msgpack_packer *mp_pck, int id)
+{
+    msgpack_pack_array(mp_pck, 2);
+    msgpack_pack_uint64(mp_pck, 1600000000 + id);
+    msgpack_pack_map(mp_pck, 2);
+    msgpack_pack_str(mp_pck, 2);
+    msgpack_pack_str_body(mp_pck, "id", 2);
+    msgpack_pack_int(mp_pck, id);
+    msgpack_pack_str(mp_pck, 1);
+    msgpack_pack_str_body(mp_pck, "k", 1);
+    msgpack_pack_str(mp_pck, 1);
+    msgpack_pack_str_body(mp_pck, "v", 1);
+}
+
+static void pack_str(msgpack_packer *mp_pck, const char *str)
+{
+    int len = strlen(str);
+
+    msgpack_pack_str(mp_pck, len);
+    msgpack_pack_str_body(mp_pck, str, len);
+}
+
+/* An untouched batch is packed back byte by byte */
+void test_batch_roundtrip()
+{
+    int ret;
+    char *data;
+    char *out_buf;
+    size_t len;
+    size_t out_size;
+    struct stat st;
+    struct flb_filter_batch batch;
+
+    ret = stat(APACHE_10K, &st);
+    if (ret == -1) {
+        exit(1);
+    }
+    len = st.st_size;
+
+    data = mk_file_to_buffer(APACHE_10K);
+    TEST_CHECK(data != NULL);
+
+    ret = flb_filter_batch_init(&batch, data, len);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(batch.count == 10000);
+    TEST_CHECK(batch.alive == 10000);
+    TEST_CHECK(batch.modified == FLB_FALSE);
+    TEST_CHECK(flb_filter_batch_map(&batch, 0) != NULL);
+
+    ret = flb_filter_batch_pack(&batch, &out_buf, &out_size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(out_size == len);
+    TEST_CHECK(memcmp(out_buf, data, len) == 0);
+
+    flb_free(out_buf);
+    flb_filter_batch_destroy(&batch);
+    flb_free(data);
+}
+
+/* Edits are copy-on-write and only applied when packing */
+void test_batch_edit()
+{
+    int i;
+    int ret;
+    int idx;
+    int records = 100;
+    char *out_buf;
+    size_t off = 0;
+    size_t out_size;
+    msgpack_object key;
+    msgpack_object val;
+    msgpack_object *map;
+    msgpack_object root;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+    msgpack_unpacked result;
+    struct flb_filter_batch batch;
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    for (i = 0; i < records; i++) {
+        pack_record(&mp_pck, i);
+    }
+
+    ret = flb_filter_batch_init(&batch, mp_sbuf.data, mp_sbuf.size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(batch.count == records);
+    TEST_CHECK(batch.records[1].ts->via.u64 == 1600000001);
+
+    ret = flb_filter_batch_str(&batch, "new", 3, &key);
+    TEST_CHECK(ret == 0);
+    ret = flb_filter_batch_str(&batch, "value", 5, &val);
+    TEST_CHECK(ret == 0);
+
+    for (i = 0; i < records; i++) {
+        /* drop odd records */
+        if (i % 2) {
+            flb_filter_batch_drop(&batch, i);
+            continue;
+        }
+
+        /* remove 'k' and append enough keys to grow the private map */
+        idx = flb_filter_batch_map_lookup(&batch, i, "k", 1);
+        TEST_CHECK(idx == 1);
+        ret = flb_filter_batch_map_remove(&batch, i, idx);
+        TEST_CHECK(ret == 0);
+
+        if (i == 0) {
+            for (idx = 0; idx < 20; idx++) {
+                ret = flb_filter_batch_map_append(&batch, i, &key, &val);
+                TEST_CHECK(ret == 0);
+            }
+        }
+        else {
+            ret = flb_filter_batch_map_append(&batch, i, &key, &val);
+            TEST_CHECK(ret == 0);
+        }
+    }
+    TEST_CHECK(batch.alive == records / 2);
+    TEST_CHECK(batch.modified == FLB_TRUE);
+
+    ret = flb_filter_batch_pack(&batch, &out_buf, &out_size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(flb_mp_count(out_buf, out_size) == records / 2);
+
+    /* Check the serialized records */
+    i = 0;
+    msgpack_unpacked_init(&result);
+    while (msgpack_unpack_next(&result, out_buf, out_size, &off) ==
+           MSGPACK_UNPACK_SUCCESS) {
+        root = result.data;
+        TEST_CHECK(root.type == MSGPACK_OBJECT_ARRAY);
+        TEST_CHECK(root.via.array.ptr[0].via.u64 == 1600000000 + i);
+
+        map = &root.via.array.ptr[1];
+        TEST_CHECK(map->via.map.size == (i == 0 ? 21 : 2));
+        TEST_CHECK(map->via.map.ptr[0].val.via.i64 == i);
+        TEST_CHECK(map->via.map.ptr[1].key.via.str.size == 3);
+        TEST_CHECK(strncmp(map->via.map.ptr[1].val.via.str.ptr,
+                           "value", 5) == 0);
+        i += 2;
+    }
+    msgpack_unpacked_destroy(&result);
+    TEST_CHECK(i == records);
+    flb_free(out_buf);
+
+    /* The decoded data was not touched */
+    off = 0;
+    msgpack_unpacked_init(&result);
+    ret = msgpack_unpack_next(&result, mp_sbuf.data, mp_sbuf.size, &off);
+    TEST_CHECK(ret == MSGPACK_UNPACK_SUCCESS);
+    TEST_CHECK(result.data.via.array.ptr[1].via.map.size == 2);
+    msgpack_unpacked_destroy(&result);
+
+    /* Dropping everything packs an empty buffer */
+    for (i = 0; i < records; i++) {
+        flb_filter_batch_drop(&batch, i);
+    }
+    TEST_CHECK(batch.alive == 0);
+    ret = flb_filter_batch_pack(&batch, &out_buf, &out_size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(out_buf == NULL && out_size == 0);
+
+    flb_filter_batch_destroy(&batch);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+}
+
+/* Columnar view: timestamps, key columns and edits reflected on them */
+void test_batch_columns()
+{
+    int i;
+    int ret;
+    int records = 30;
+    char key[16];
+    msgpack_object nkey;
+    msgpack_object nval;
+    msgpack_object *val;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+    struct flb_batch_columns *cols;
+    struct flb_batch_column *id;
+    struct flb_batch_column *k;
+    struct flb_batch_column *tri;
+    struct flb_batch_column *col;
+    struct flb_filter_batch batch;
+
+    /* [ts, {"id": i, "k": "v", "tri": "x"}], "tri" every three records */
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    for (i = 0; i < records; i++) {
+        msgpack_pack_array(&mp_pck, 2);
+        msgpack_pack_uint64(&mp_pck, 1600000000 + i);
+        msgpack_pack_map(&mp_pck, (i % 3) ? 2 : 3);
+        pack_str(&mp_pck, "id");
+        msgpack_pack_int(&mp_pck, i);
+        pack_str(&mp_pck, "k");
+        pack_str(&mp_pck, "v");
+        if (i % 3 == 0) {
+            pack_str(&mp_pck, "tri");
+            pack_str(&mp_pck, "x");
+        }
+    }
+    /* duplicated key, the first value wins */
+    msgpack_pack_array(&mp_pck, 2);
+    msgpack_pack_uint64(&mp_pck, 1600000000 + records);
+    msgpack_pack_map(&mp_pck, 2);
+    pack_str(&mp_pck, "k");
+    pack_str(&mp_pck, "first");
+    pack_str(&mp_pck, "k");
+    pack_str(&mp_pck, "second");
+    records++;
+
+    ret = flb_filter_batch_init(&batch, mp_sbuf.data, mp_sbuf.size);
+    TEST_CHECK(ret == 0);
+
+    cols = flb_filter_batch_columns(&batch);
+    TEST_CHECK(cols != NULL);
+    TEST_CHECK(flb_filter_batch_columns(&batch) == cols);
+    TEST_CHECK(cols->complete == FLB_TRUE);
+    TEST_CHECK(cols->keys == 3);
+
+    ret = flb_filter_batch_column(&batch, "id", 2, &id);
+    TEST_CHECK(ret == 0 && id != NULL);
+    ret = flb_filter_batch_column(&batch, "k", 1, &k);
+    TEST_CHECK(ret == 0 && k != NULL);
+    ret = flb_filter_batch_column(&batch, "tri", 3, &tri);
+    TEST_CHECK(ret == 0 && tri != NULL);
+    ret = flb_filter_batch_column(&batch, "none", 4, &col);
+    TEST_CHECK(ret == 0 && col == NULL);
+    TEST_CHECK(flb_batch_column_value(col, 0) == NULL);
+
+    for (i = 0; i < records - 1; i++) {
+        TEST_CHECK(cols->ts[i].tm.tv_sec == 1600000000 + i);
+        val = flb_batch_column_value(id, i);
+        TEST_CHECK(val != NULL && val->via.i64 == i);
+        TEST_CHECK((flb_batch_column_value(tri, i) != NULL) == (i % 3 == 0));
+    }
+    val = flb_batch_column_value(k, records - 1);
+    TEST_CHECK(val != NULL && val->via.str.size == 5 &&
+               strncmp(val->via.str.ptr, "first", 5) == 0);
+
+    /* edits */
+    ret = flb_filter_batch_map_remove(&batch, 2, 1);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(flb_batch_column_value(k, 2) == NULL);
+    val = flb_batch_column_value(id, 2);
+    TEST_CHECK(val != NULL && val->via.i64 == 2);
+
+    flb_filter_batch_str(&batch, "new", 3, &nkey);
+    flb_filter_batch_str(&batch, "value", 5, &nval);
+    ret = flb_filter_batch_map_append(&batch, 4, &nkey, &nval);
+    TEST_CHECK(ret == 0);
+    ret = flb_filter_batch_column(&batch, "new", 3, &col);
+    TEST_CHECK(ret == 0 && col != NULL);
+    for (i = 0; i < records; i++) {
+        TEST_CHECK((flb_batch_column_value(col, i) != NULL) == (i == 4));
+    }
+
+    flb_filter_batch_drop(&batch, 6);
+    TEST_CHECK(flb_batch_column_value(id, 6) == NULL);
+    TEST_CHECK(flb_batch_column_value(tri, 6) == NULL);
+
+    flb_filter_batch_destroy(&batch);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+
+    /* more keys than the dictionary interns while building */
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    for (i = 0; i < 2; i++) {
+        msgpack_pack_array(&mp_pck, 2);
+        msgpack_pack_uint64(&mp_pck, 1600000000);
+        msgpack_pack_map(&mp_pck, FLB_BATCH_COLUMNS_MAX_KEYS * 2);
+        for (ret = 0; ret < FLB_BATCH_COLUMNS_MAX_KEYS * 2; ret++) {
+            snprintf(key, sizeof(key), "k%i", ret);
+            pack_str(&mp_pck, key);
+            msgpack_pack_int(&mp_pck, ret + i);
+        }
+    }
+
+    ret = flb_filter_batch_init(&batch, mp_sbuf.data, mp_sbuf.size);
+    TEST_CHECK(ret == 0);
+    cols = flb_filter_batch_columns(&batch);
+    TEST_CHECK(cols != NULL);
+    TEST_CHECK(cols->complete == FLB_FALSE);
+    TEST_CHECK(cols->keys == FLB_BATCH_COLUMNS_MAX_KEYS);
+
+    snprintf(key, sizeof(key), "k%i", FLB_BATCH_COLUMNS_MAX_KEYS + 10);
+    ret = flb_filter_batch_column(&batch, key, strlen(key), &col);
+    TEST_CHECK(ret == 0 && col != NULL);
+    val = flb_batch_column_value(col, 1);
+    TEST_CHECK(val != NULL && val->via.i64 == FLB_BATCH_COLUMNS_MAX_KEYS + 11);
+    TEST_CHECK(cols->keys == FLB_BATCH_COLUMNS_MAX_KEYS + 1);
+
+    ret = flb_filter_batch_column(&batch, "none", 4, &col);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(flb_batch_column_value(col, 0) == NULL);
+
+    flb_filter_batch_destroy(&batch);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+}
+
+/* Invalid msgpack content is reported */
+void test_batch_invalid()
+{
+    int ret;
+    char buf[] = {0x92, 0x01};
+    struct flb_filter_batch batch;
+
+    ret = flb_filter_batch_init(&batch, buf, sizeof(buf));
+    TEST_CHECK(ret == -1);
+}
+
+TEST_LIST = {
+    {"roundtrip", test_batch_roundtrip},
+    {"edit"     , test_batch_edit},
+    {"columns"  , test_batch_columns},
+    {"invalid"  , test_batch_invalid},
+    { 0 }
+};
@@ -2,6 +2,7 @@
 
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_sds.h>
 #include <fluent-bit/flb_gzip.h>
 
 #include "flb_tests_internal.h"
@@ -40,7 +41,80 @@ void test_compress()
     flb_free(str);
 }
 
+static int cb_stream_out(void *data, const void *buf, size_t len)
+{
+    flb_sds_t *out = data;
+    flb_sds_t tmp;
+
+    tmp = flb_sds_cat(*out, buf, len);
+    if (!tmp) {
+        return -1;
+    }
+    *out = tmp;
+    return 0;
+}
+
+/* Data written in small pieces must decompress like a one-shot payload */
+void test_compress_stream()
+{
+    int i;
+    int ret;
+    size_t off;
+    size_t in_len;
+    size_t len;
+    char *in_data;
+    void *str;
+    flb_sds_t out;
+    struct flb_gzip_stream *gz;
+
+    /* larger than the stream buffer, half of it hard to compress */
+    in_len = FLB_GZIP_STREAM_BUF * 4;
+    in_data = flb_malloc(in_len);
+    TEST_CHECK(in_data != NULL);
+    srand(1);
+    for (i = 0; i < in_len; i++) {
+        if (i < in_len / 2) {
+            in_data[i] = morpheus[i % strlen(morpheus)];
+        }
+        else {
+            in_data[i] = rand() & 0xFF;
+        }
+    }
+
+    out = flb_sds_create_size(1024);
+    TEST_CHECK(out != NULL);
+
+    gz = flb_gzip_stream_create(cb_stream_out, &out);
+    TEST_CHECK(gz != NULL);
+
+    for (off = 0; off < in_len; off += len) {
+        len = (off % 1000) + 1;
+        if (off + len > in_len) {
+            len = in_len - off;
+        }
+        ret = flb_gzip_stream_write(gz, in_data + off, len);
+        TEST_CHECK(ret == 0);
+    }
+    ret = flb_gzip_stream_finish(gz);
+    TEST_CHECK(ret == 0);
+
+    /* nothing can be added once finished */
+    ret = flb_gzip_stream_write(gz, "x", 1);
+    TEST_CHECK(ret == -1);
+    flb_gzip_stream_destroy(gz);
+
+    ret = flb_gzip_uncompress(out, flb_sds_len(out), &str, &len);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(len == in_len);
+    TEST_CHECK(memcmp(in_data, str, in_len) == 0);
+
+    flb_sds_destroy(out);
+    flb_free(in_data);
+    flb_free(str);
+}
+
 TEST_LIST = {
     {"compress", test_compress},
+    {"compress_stream", test_compress_stream},
     { 0 }
 };
@@ -5,6 +5,10 @@
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_socket.h>
 #include <fluent-bit/flb_http_client.h>
+#include <fluent-bit/flb_upstream_pipeline.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "flb_tests_internal.h"
 
@@ -79,7 +83,247 @@ void test_http_buffer_increase()
     flb_config_exit(config);
 }
 
+/* Header, body and body fragments are sent in order with one writev */
+void test_http_body_fragments()
+{
+    int ret;
+    int sv[2];
+    char buf[4096];
+    char *p;
+    ssize_t len;
+    size_t bytes;
+    char *resp = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    struct flb_http_client *c;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+    struct flb_config *config;
+
+    config = flb_config_init();
+    TEST_CHECK(config != NULL);
+
+    u = flb_upstream_create(config, "127.0.0.1", 80, FLB_IO_TCP, NULL);
+    TEST_CHECK(u != NULL);
+    u->flags &= ~FLB_IO_ASYNC;
+
+    /* the peer replies before the request is even sent */
+    ret = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    TEST_CHECK(ret == 0);
+    len = write(sv[1], resp, strlen(resp));
+    TEST_CHECK(len == strlen(resp));
+
+    u_conn = flb_calloc(1, sizeof(struct flb_upstream_conn));
+    TEST_CHECK(u_conn != NULL);
+    u_conn->u = u;
+    u_conn->fd = sv[0];
+
+    c = flb_http_client(u_conn, FLB_HTTP_POST, "/", "[1,", 3,
+                        "127.0.0.1", 80, NULL, 0);
+    TEST_CHECK(c != NULL);
+
+    ret = flb_http_add_body(c, "2,", 2);
+    TEST_CHECK(ret == 0);
+    ret = flb_http_add_body(c, "", 0);
+    TEST_CHECK(ret == 0);
+    ret = flb_http_add_body(c, "3]", 2);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(c->body_iov_count == 2);
+
+    ret = flb_http_do(c, &bytes);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(c->resp.status == 200);
+
+    len = read(sv[1], buf, sizeof(buf) - 1);
+    TEST_CHECK(len == bytes);
+    buf[len > 0 ? len : 0] = '\0';
+
+    TEST_CHECK(strstr(buf, "Content-Length: 7\r\n") != NULL);
+    p = strstr(buf, "\r\n\r\n");
+    TEST_CHECK(p != NULL && strcmp(p + 4, "[1,2,3]") == 0);
+
+    flb_http_client_destroy(c);
+    close(sv[0]);
+    close(sv[1]);
+    flb_free(u_conn);
+    flb_upstream_destroy(u);
+    flb_config_exit(config);
+}
+
+static int cb_body(struct flb_http_client *c, void *data)
+{
+    int ret;
+
+    ret = flb_http_write_body(c, "abc", 3);
+    if (ret == 0) {
+        ret = flb_http_write_body(c, "", 0);
+    }
+    if (ret == 0) {
+        ret = flb_http_write_body(c, data, strlen(data));
+    }
+    return ret;
+}
+
+/* A payload written by a callback goes out with chunked encoding */
+void test_http_body_cb()
+{
+    int ret;
+    int sv[2];
+    char buf[4096];
+    char *p;
+    ssize_t len;
+    size_t bytes;
+    char *resp = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+    struct flb_http_client *c;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+    struct flb_config *config;
+
+    config = flb_config_init();
+    TEST_CHECK(config != NULL);
+
+    u = flb_upstream_create(config, "127.0.0.1", 80, FLB_IO_TCP, NULL);
+    TEST_CHECK(u != NULL);
+    u->flags &= ~FLB_IO_ASYNC;
+
+    ret = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    TEST_CHECK(ret == 0);
+    len = write(sv[1], resp, strlen(resp));
+    TEST_CHECK(len == strlen(resp));
+
+    u_conn = flb_calloc(1, sizeof(struct flb_upstream_conn));
+    TEST_CHECK(u_conn != NULL);
+    u_conn->u = u;
+    u_conn->fd = sv[0];
+
+    /* a body was already set */
+    c = flb_http_client(u_conn, FLB_HTTP_POST, "/", "x", 1,
+                        "127.0.0.1", 80, NULL, 0);
+    TEST_CHECK(c != NULL);
+    ret = flb_http_set_body_cb(c, cb_body, "0123456789abcdef0");
+    TEST_CHECK(ret == -1);
+    flb_http_client_destroy(c);
+
+    c = flb_http_client(u_conn, FLB_HTTP_POST, "/", NULL, 0,
+                        "127.0.0.1", 80, NULL, 0);
+    TEST_CHECK(c != NULL);
+    ret = flb_http_set_body_cb(c, cb_body, "0123456789abcdef0");
+    TEST_CHECK(ret == 0);
+
+    ret = flb_http_do(c, &bytes);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(c->resp.status == 200);
+
+    len = read(sv[1], buf, sizeof(buf) - 1);
+    TEST_CHECK(len == bytes);
+    buf[len > 0 ? len : 0] = '\0';
+
+    TEST_CHECK(strstr(buf, "Content-Length") == NULL);
+    TEST_CHECK(strstr(buf, "Transfer-Encoding: chunked\r\n") != NULL);
+    p = strstr(buf, "\r\n\r\n");
+    TEST_CHECK(p != NULL &&
+               strcmp(p + 4, "3\r\nabc\r\n"
+                             "11\r\n0123456789abcdef0\r\n"
+                             "0\r\n\r\n") == 0);
+
+    flb_http_client_destroy(c);
+    close(sv[0]);
+    close(sv[1]);
+    flb_free(u_conn);
+    flb_upstream_destroy(u);
+    flb_config_exit(config);
+}
+
+/*
+ * Two clients share a pipelined connection: the first one reads both
+ * responses at once and must hand the second one back to the connection.
+ */
+void test_http_pipeline()
+{
+    int ret;
+    int sv[2];
+    char buf[4096];
+    ssize_t len;
+    size_t bytes;
+    char *resp = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"
+                 "HTTP/1.1 201 Created\r\nTransfer-Encoding: chunked\r\n\r\n"
+                 "3\r\nabc\r\n2\r\nde\r\n0\r\n\r\n";
+    struct flb_http_client *c1;
+    struct flb_http_client *c2;
+    struct flb_upstream *u;
+    struct flb_upstream_conn *u_conn;
+    struct flb_config *config;
+
+    config = flb_config_init();
+    TEST_CHECK(config != NULL);
+
+    u = flb_upstream_create(config, "127.0.0.1", 80, FLB_IO_TCP, NULL);
+    TEST_CHECK(u != NULL);
+    u->evl = mk_event_loop_create(8);
+    TEST_CHECK(u->evl != NULL);
+    u->net.pipeline_depth = 2;
+
+    /* both responses are available before the requests are sent */
+    ret = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+    TEST_CHECK(ret == 0);
+    len = write(sv[1], resp, strlen(resp));
+    TEST_CHECK(len == strlen(resp));
+
+    u_conn = flb_calloc(1, sizeof(struct flb_upstream_conn));
+    TEST_CHECK(u_conn != NULL);
+    u_conn->u = u;
+    u_conn->fd = sv[0];
+    u_conn->recycle = FLB_TRUE;
+
+    ret = flb_upstream_pipeline_attach(u_conn);
+    TEST_CHECK(ret == 0);
+    ret = flb_upstream_pipeline_join(u_conn);
+    TEST_CHECK(ret == 0);
+    ret = flb_upstream_pipeline_join(u_conn);
+    TEST_CHECK(ret == -1);
+
+    c1 = flb_http_client(u_conn, FLB_HTTP_POST, "/", "1", 1,
+                         "127.0.0.1", 80, NULL, 0);
+    c2 = flb_http_client(u_conn, FLB_HTTP_POST, "/", "2", 1,
+                         "127.0.0.1", 80, NULL, 0);
+    TEST_CHECK(c1 != NULL && c2 != NULL);
+
+    ret = flb_http_do(c1, &bytes);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(c1->resp.status == 200);
+    TEST_CHECK(c1->resp.payload_size == 2);
+    TEST_CHECK(strcmp(c1->resp.payload, "ok") == 0);
+
+    ret = flb_http_do(c2, &bytes);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(c2->resp.status == 201);
+    TEST_CHECK(c2->resp.payload_size == 5);
+    TEST_CHECK(strncmp(c2->resp.payload, "abcde", 5) == 0);
+
+    /* both requests went out, nothing is left for a third response */
+    len = read(sv[1], buf, sizeof(buf));
+    TEST_CHECK(len > 0);
+    TEST_CHECK(flb_upstream_pipeline_get(u_conn)->carry_len == 0);
+
+    ret = flb_upstream_pipeline_release(u_conn);
+    TEST_CHECK(ret == 1);
+    ret = flb_upstream_pipeline_release(u_conn);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(u_conn->recycle == FLB_TRUE);
+
+    flb_http_client_destroy(c1);
+    flb_http_client_destroy(c2);
+    flb_upstream_pipeline_destroy(u_conn->pipeline);
+    close(sv[0]);
+    close(sv[1]);
+    flb_free(u_conn);
+    mk_event_loop_destroy(u->evl);
+    flb_upstream_destroy(u);
+    flb_config_exit(config);
+}
+
 TEST_LIST = {
     { "http_buffer_increase", test_http_buffer_increase},
+    { "http_body_fragments", test_http_body_fragments},
+    { "http_body_cb", test_http_body_cb},
+    { "http_pipeline", test_http_pipeline},
     { 0 }
 };
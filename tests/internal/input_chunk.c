@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fluent-bit/flb_input_chunk.h>
+#include <fluent-bit/flb_storage.h>
 #include "flb_tests_internal.h"
 
 #include "data/input_chunk/log/test_buffer_drop_chunks.h"
@@ -314,10 +315,99 @@ void flb_test_input_chunk_dropping_chunks()
     flb_destroy(ctx);
 }
 
+/* Chunks open for new data are indexed by Tag */
+void flb_test_input_chunk_tag_index()
+{
+    int i;
+    int j;
+    int ret;
+    int tags = 100;
+    char tag[32];
+    const void *buf;
+    size_t size;
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_config *config;
+    struct flb_input_instance *i_ins;
+    struct flb_output_instance *o_ins;
+    struct flb_input_chunk *ic;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+
+    config = flb_config_init();
+    if (!TEST_CHECK(config != NULL)) {
+        return;
+    }
+
+    i_ins = flb_input_new(config, "dummy", NULL, FLB_TRUE);
+    TEST_CHECK(i_ins != NULL);
+    i_ins->log_level = FLB_LOG_ERROR;
+    ret = flb_input_instance_init(i_ins, config);
+    TEST_CHECK(ret == 0);
+
+    o_ins = flb_output_new(config, "null", NULL);
+    TEST_CHECK(o_ins != NULL);
+    flb_output_set_property(o_ins, "match", "*");
+
+    ret = flb_storage_create(config);
+    TEST_CHECK(ret == 0);
+
+    /* record: [1, {"key": "val"}] */
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&mp_pck, 2);
+    msgpack_pack_uint64(&mp_pck, 1);
+    msgpack_pack_map(&mp_pck, 1);
+    msgpack_pack_str(&mp_pck, 3);
+    msgpack_pack_str_body(&mp_pck, "key", 3);
+    msgpack_pack_str(&mp_pck, 3);
+    msgpack_pack_str_body(&mp_pck, "val", 3);
+
+    /* Interleave tags, every tag must append to the same chunk */
+    for (j = 0; j < 10; j++) {
+        for (i = 0; i < tags; i++) {
+            ret = snprintf(tag, sizeof(tag) - 1, "app.%i", i);
+            ret = flb_input_chunk_append_raw(i_ins, tag, ret,
+                                             mp_sbuf.data, mp_sbuf.size);
+            TEST_CHECK(ret == 0);
+        }
+    }
+    TEST_CHECK(mk_list_size(&i_ins->chunks) == tags);
+
+    /* A chunk being flushed cannot get more data, a new one is created */
+    ic = mk_list_entry_first(&i_ins->chunks, struct flb_input_chunk, _head);
+    buf = flb_input_chunk_flush(ic, &size);
+    TEST_CHECK(buf != NULL && size == mp_sbuf.size * 10);
+
+    ret = flb_input_chunk_append_raw(i_ins, "app.0", 5,
+                                     mp_sbuf.data, mp_sbuf.size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(mk_list_size(&i_ins->chunks) == tags + 1);
+
+    ret = flb_input_chunk_append_raw(i_ins, "app.0", 5,
+                                     mp_sbuf.data, mp_sbuf.size);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(mk_list_size(&i_ins->chunks) == tags + 1);
+
+    /* Destroyed chunks are removed from the index */
+    mk_list_foreach_safe(head, tmp, &i_ins->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        flb_input_chunk_destroy(ic, FLB_TRUE);
+    }
+    TEST_CHECK(i_ins->ht_chunks->total_count == 0);
+
+    msgpack_sbuffer_destroy(&mp_sbuf);
+    flb_storage_destroy(config);
+    flb_input_exit_all(config);
+    flb_output_exit(config);
+    flb_config_exit(config);
+}
+
 /* Test list */
 TEST_LIST = {
     {"input_chunk_exceed_limit",       flb_test_input_chunk_exceed_limit},
     {"input_chunk_buffer_valid",       flb_test_input_chunk_buffer_valid},
     {"input_chunk_dropping_chunks",    flb_test_input_chunk_dropping_chunks},
+    {"input_chunk_tag_index",          flb_test_input_chunk_tag_index},
     {NULL, NULL}
 };
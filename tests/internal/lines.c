@@ -0,0 +1,106 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_lines.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "flb_tests_internal.h"
+
+/* Reference implementation: offsets of every '\n' */
+static int lines_naive(const char *buf, size_t len, size_t *lines, int max)
+{
+    int n = 0;
+    size_t i;
+
+    for (i = 0; i < len && n < max; i++) {
+        if (buf[i] == '\n') {
+            lines[n++] = i;
+        }
+    }
+    return n;
+}
+
+static void check_buffer(const char *buf, size_t len, int max)
+{
+    int i;
+    int n;
+    int n_ref;
+    size_t *lines;
+    size_t *lines_ref;
+
+    lines = flb_malloc(sizeof(size_t) * max);
+    lines_ref = flb_malloc(sizeof(size_t) * max);
+
+    n = flb_lines_scan(buf, len, lines, max);
+    n_ref = lines_naive(buf, len, lines_ref, max);
+    TEST_CHECK(n == n_ref);
+    TEST_MSG("len=%zu max=%i: found %i, expected %i", len, max, n, n_ref);
+
+    for (i = 0; i < n && i < n_ref; i++) {
+        TEST_CHECK(lines[i] == lines_ref[i]);
+    }
+
+    flb_free(lines);
+    flb_free(lines_ref);
+}
+
+void test_lines_basic()
+{
+    int n;
+    size_t lines[8];
+
+    n = flb_lines_scan("", 0, lines, 8);
+    TEST_CHECK(n == 0);
+
+    n = flb_lines_scan("no line break", 13, lines, 8);
+    TEST_CHECK(n == 0);
+
+    n = flb_lines_scan("a\nbb\r\n\nccc", 10, lines, 8);
+    TEST_CHECK(n == 3);
+    TEST_CHECK(lines[0] == 1);
+    TEST_CHECK(lines[1] == 5);
+    TEST_CHECK(lines[2] == 6);
+
+    /* The limit of offsets is respected */
+    n = flb_lines_scan("a\nbb\r\n\nccc", 10, lines, 2);
+    TEST_CHECK(n == 2);
+    TEST_CHECK(lines[1] == 5);
+}
+
+/* Random buffers of every length around the SIMD block sizes */
+void test_lines_random()
+{
+    int i;
+    size_t len;
+    char buf[300];
+
+    srand(1);
+    for (len = 0; len < sizeof(buf); len++) {
+        for (i = 0; i < (int) len; i++) {
+            buf[i] = (rand() % 8 == 0) ? '\n' : 'a' + (rand() % 26);
+        }
+        check_buffer(buf, len, 512);
+        check_buffer(buf, len, 3);
+    }
+}
+
+/* Every byte is a line break */
+void test_lines_dense()
+{
+    char buf[200];
+
+    memset(buf, '\n', sizeof(buf));
+    check_buffer(buf, sizeof(buf), 512);
+    check_buffer(buf, sizeof(buf), 17);
+    check_buffer(buf, sizeof(buf), 32);
+}
+
+TEST_LIST = {
+    { "basic" , test_lines_basic},
+    { "random", test_lines_random},
+    { "dense" , test_lines_dense},
+    { 0 }
+};
@@ -3,6 +3,8 @@
 #include <fluent-bit/flb_info.h>
 #include <fluent-bit/flb_mem.h>
 #include <fluent-bit/flb_pack.h>
+#include <fluent-bit/flb_pack_fast.h>
+#include <fluent-bit/flb_dtoa.h>
 #include <fluent-bit/flb_error.h>
 #include <fluent-bit/flb_str.h>
 #include <monkey/mk_core.h>
@@ -12,6 +14,7 @@
 #include <dirent.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <math.h>
 
 
 #include "flb_tests_internal.h"
@@ -626,6 +629,348 @@ void test_json_pack_bug1278()
     }
 }
 
+static int cb_json_out(void *data, const char *buf, size_t len)
+{
+    flb_sds_t *out = data;
+    flb_sds_t tmp;
+
+    tmp = flb_sds_cat(*out, buf, len);
+    if (!tmp) {
+        return -1;
+    }
+    *out = tmp;
+    return 0;
+}
+
+/* The callback based formatter must produce the same payloads */
+void test_json_format_cb()
+{
+    int i;
+    int ret;
+    int formats[] = {FLB_PACK_JSON_FORMAT_JSON,
+                     FLB_PACK_JSON_FORMAT_STREAM,
+                     FLB_PACK_JSON_FORMAT_LINES};
+    flb_sds_t date_key;
+    flb_sds_t json;
+    flb_sds_t out;
+    struct flb_time tm;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+    for (i = 0; i < 3; i++) {
+        flb_time_set(&tm, 1600000000 + i, 500000000);
+        msgpack_pack_array(&mp_pck, 2);
+        flb_time_append_to_msgpack(&tm, &mp_pck, 0);
+        msgpack_pack_map(&mp_pck, 1);
+        msgpack_pack_str(&mp_pck, 3);
+        msgpack_pack_str_body(&mp_pck, "key", 3);
+        msgpack_pack_int(&mp_pck, i);
+    }
+
+    date_key = flb_sds_create("date");
+    for (i = 0; i < sizeof(formats) / sizeof(int); i++) {
+        json = flb_pack_msgpack_to_json_format(mp_sbuf.data, mp_sbuf.size,
+                                               formats[i],
+                                               FLB_PACK_JSON_DATE_ISO8601,
+                                               date_key);
+        TEST_CHECK(json != NULL);
+
+        out = flb_sds_create_size(64);
+        ret = flb_pack_msgpack_to_json_format_cb(mp_sbuf.data, mp_sbuf.size,
+                                                 formats[i],
+                                                 FLB_PACK_JSON_DATE_ISO8601,
+                                                 date_key, cb_json_out, &out);
+        TEST_CHECK(ret == 3);
+        TEST_CHECK(flb_sds_len(out) == flb_sds_len(json));
+        TEST_CHECK(strcmp(out, json) == 0);
+        TEST_MSG("expected: %s\ngot: %s", json, out);
+
+        flb_sds_destroy(json);
+        flb_sds_destroy(out);
+    }
+
+    flb_sds_destroy(date_key);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+}
+
+/* Pack with jsmn only */
+static int pack_jsmn(const char *js, char **out_buf, int *out_size)
+{
+    int ret;
+    struct flb_pack_state state;
+
+    flb_pack_state_init(&state);
+    ret = flb_pack_json_state(js, strlen(js), out_buf, out_size, &state);
+    flb_pack_state_reset(&state);
+
+    return ret;
+}
+
+/* The structural index decoder must give the same result than jsmn */
+void test_json_pack_fast()
+{
+    int i;
+    int ret;
+    int root_type;
+    int jsmn_size;
+    char *jsmn_buf;
+    char *out_buf;
+    size_t out_size;
+    char long_json[1024];
+    char *valid[] = {
+        "{\"log\":\"GET / HTTP/1.1\\n\",\"stream\":\"stdout\","
+        "\"time\":\"2020-09-30T10:00:00.000000001Z\"}",
+        "{\"a\": [1, -2, 3.5, -0.25e-3, true, false, null, {}, []],"
+        " \"b\" : {\"c\": {\"d\": \"\\\\\\\"\\u00e9\\/\"}}}\n",
+        "[\"\\\\\", 0, 9223372036854775807, 12345678901234567890]",
+        "{\"k\":1}{\"k\":2} [3]",
+        long_json,
+        NULL
+    };
+    char *declined[] = {
+        "\"string\"",                   /* jsmn strict: no root string */
+        "{\"k\": 1e5}",                 /* jsmn packs the integer 1 */
+        "{\"k\": 01}",
+        "{\"k\": tru}",
+        "{\"k\": 1,}",
+        "{\"k\": \"\\x\"}",
+        "{\"k\": [1, 2}",
+        "{\"k\": \"unterminated}",
+        "5",
+        "[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]",
+        NULL
+    };
+
+    /* escaped quotes and backslashes around the 64 bytes boundaries */
+    ret = 0;
+    long_json[ret++] = '[';
+    for (i = 0; i < 40; i++) {
+        ret += sprintf(long_json + ret, "%s\"%.*s\\\"\\\\\"",
+                       i ? "," : "", i % 7, "abcdefg");
+    }
+    long_json[ret++] = ']';
+    long_json[ret] = '\0';
+
+    for (i = 0; valid[i]; i++) {
+        ret = flb_pack_json_fast(valid[i], strlen(valid[i]),
+                                 &out_buf, &out_size, &root_type, NULL);
+        TEST_CHECK(ret == 0);
+        TEST_MSG("message: %s", valid[i]);
+        if (ret != 0) {
+            continue;
+        }
+
+        ret = pack_jsmn(valid[i], &jsmn_buf, &jsmn_size);
+        TEST_CHECK(ret == 0);
+        TEST_CHECK(out_size == jsmn_size);
+        TEST_CHECK(memcmp(out_buf, jsmn_buf, out_size) == 0);
+        TEST_MSG("message: %s", valid[i]);
+
+        flb_free(jsmn_buf);
+        flb_free(out_buf);
+    }
+
+    for (i = 0; declined[i]; i++) {
+        ret = flb_pack_json_fast(declined[i], strlen(declined[i]),
+                                 &out_buf, &out_size, &root_type, NULL);
+        TEST_CHECK(ret == -1);
+        TEST_MSG("message: %s", declined[i]);
+    }
+}
+
+/* Time key lookup while packing */
+void test_json_pack_fast_key()
+{
+    int i;
+    int ret;
+    int root_type;
+    char *out_buf;
+    size_t out_size;
+    size_t off = 0;
+    char *json = "{\"a\":1,\"tim\\u0065\":\"12:00\",\"b\":{\"time\":0},"
+                 "\"time\":\"13:00\"}";
+    msgpack_unpacked result;
+    msgpack_object map;
+    struct flb_pack_json_key key = {"time", 4};
+
+    ret = flb_pack_json_fast(json, strlen(json), &out_buf, &out_size,
+                             &root_type, &key);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(root_type == FLB_PACK_JSON_OBJECT);
+
+    /* the first one on the root map, unescaped */
+    TEST_CHECK(key.found == FLB_TRUE);
+    TEST_CHECK(key.val_len == 5);
+    TEST_CHECK(memcmp(out_buf + key.val_off, "12:00", 5) == 0);
+
+    flb_pack_json_key_remove(out_buf, &out_size, &key);
+
+    msgpack_unpacked_init(&result);
+    ret = msgpack_unpack_next(&result, out_buf, out_size, &off);
+    TEST_CHECK(ret == MSGPACK_UNPACK_SUCCESS);
+    TEST_CHECK(off == out_size);
+    map = result.data;
+    TEST_CHECK(map.type == MSGPACK_OBJECT_MAP && map.via.map.size == 3);
+    for (i = 0; i < map.via.map.size; i++) {
+        TEST_CHECK(map.via.map.ptr[i].key.via.str.size != 4 ||
+                   map.via.map.ptr[i].val.type != MSGPACK_OBJECT_STR ||
+                   memcmp(map.via.map.ptr[i].val.via.str.ptr,
+                          "13:00", 5) == 0);
+    }
+    msgpack_unpacked_destroy(&result);
+    flb_free(out_buf);
+
+    /* not a string or more than one message: up to the caller */
+    json = "{\"time\":1600000000}";
+    ret = flb_pack_json_fast(json, strlen(json), &out_buf, &out_size,
+                             &root_type, &key);
+    TEST_CHECK(ret == -1);
+
+    json = "{\"time\":\"12:00\"}{}";
+    ret = flb_pack_json_fast(json, strlen(json), &out_buf, &out_size,
+                             &root_type, &key);
+    TEST_CHECK(ret == -1);
+}
+
+/* Numbers and strings as written by the JSON encoder */
+void test_json_encode()
+{
+    int i;
+    int ret;
+    flb_sds_t json;
+    msgpack_sbuffer mp_sbuf;
+    msgpack_packer mp_pck;
+    char *expected =
+        "[0,18446744073709551615,-1,-9223372036854775808,"
+        "1.0,-0.0,-2.5,0.1,0.30000000000000004,1.5e-07,0.0001,"
+        "123456789012345.6,1e+20,9007199254740992.0,"
+        "1.100000023841858,"
+        "\"a\\\"b\\\\c\\n\\u007f\\u0001\\u00e9\\u20ac\\u1f600\","
+        "\"0123456789abcdef0123456789abcdef\\tend\"]";
+
+    msgpack_sbuffer_init(&mp_sbuf);
+    msgpack_packer_init(&mp_pck, &mp_sbuf, msgpack_sbuffer_write);
+
+    msgpack_pack_array(&mp_pck, 17);
+    msgpack_pack_uint64(&mp_pck, 0);
+    msgpack_pack_uint64(&mp_pck, UINT64_MAX);
+    msgpack_pack_int64(&mp_pck, -1);
+    msgpack_pack_int64(&mp_pck, INT64_MIN);
+
+    /* doubles holding an integer keep one decimal */
+    msgpack_pack_double(&mp_pck, 1.0);
+    msgpack_pack_double(&mp_pck, -0.0);
+    msgpack_pack_double(&mp_pck, -2.5);
+
+    /* shortest representation that reads back to the same double */
+    msgpack_pack_double(&mp_pck, 0.1);
+    msgpack_pack_double(&mp_pck, 0.1 + 0.2);
+    msgpack_pack_double(&mp_pck, 1.5e-7);
+    msgpack_pack_double(&mp_pck, 0.0001);
+    msgpack_pack_double(&mp_pck, 123456789012345.6);
+    msgpack_pack_double(&mp_pck, 1e20);
+    msgpack_pack_double(&mp_pck, 9007199254740992.0);
+    msgpack_pack_float(&mp_pck, 1.1f);
+
+    msgpack_pack_str(&mp_pck, 17);
+    msgpack_pack_str_body(&mp_pck,
+                          "a\"b\\c\n\x7f\x01\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80",
+                          17);
+    msgpack_pack_str(&mp_pck, 36);
+    msgpack_pack_str_body(&mp_pck,
+                          "0123456789abcdef0123456789abcdef\tend", 36);
+
+    json = flb_msgpack_raw_to_json_sds(mp_sbuf.data, mp_sbuf.size);
+    TEST_CHECK(json != NULL);
+    ret = strcmp(json, expected);
+    TEST_CHECK(ret == 0);
+    TEST_MSG("expected: %s\ngot: %s", expected, json);
+    TEST_CHECK(flb_sds_len(json) == strlen(expected));
+
+    /* a fixed buffer is either large enough or the call fails */
+    for (i = 1; i < strlen(expected) + 3; i++) {
+        char buf[512];
+        msgpack_unpacked result;
+        size_t off = 0;
+
+        msgpack_unpacked_init(&result);
+        msgpack_unpack_next(&result, mp_sbuf.data, mp_sbuf.size, &off);
+        ret = flb_msgpack_to_json(buf, i, &result.data);
+        if (i > strlen(expected)) {
+            TEST_CHECK(ret == strlen(expected));
+            TEST_CHECK(strcmp(buf, expected) == 0);
+        }
+        else {
+            TEST_CHECK(ret <= 0);
+            TEST_CHECK(strlen(buf) < i);
+        }
+        msgpack_unpacked_destroy(&result);
+    }
+
+    flb_sds_destroy(json);
+    msgpack_sbuffer_destroy(&mp_sbuf);
+}
+
+/* Doubles are written with the shortest digits that round trip */
+void test_dtoa()
+{
+    int i;
+    int p;
+    int len;
+    int digits;
+    int exp;
+    char buf[64];
+    char ref[64];
+    double d;
+    double back;
+    uint64_t bits;
+    uint64_t mantissa;
+    uint64_t seed = 88172645463325252ULL;
+
+    for (i = 0; i < 100000; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        bits = seed;
+        if (i % 2) {
+            /* subnormals and small exponents */
+            bits &= 0x801fffffffffffffULL;
+        }
+        memcpy(&d, &bits, sizeof(d));
+        if (isnan(d) || isinf(d)) {
+            continue;
+        }
+
+        len = flb_dtoa(d, 15, buf);
+        buf[len] = '\0';
+        back = strtod(buf, NULL);
+        if (!TEST_CHECK(memcmp(&back, &d, sizeof(d)) == 0)) {
+            TEST_MSG("%a written as %s", d, buf);
+            break;
+        }
+
+        /* no representation with fewer digits reads back to 'd' */
+        flb_dtoa_shortest(d, &mantissa, &exp);
+        digits = flb_u64toa(mantissa, ref);
+        for (p = 1; p < digits; p++) {
+            snprintf(ref, sizeof(ref), "%.*e", p - 1, d);
+            if (!TEST_CHECK(strtod(ref, NULL) != d)) {
+                TEST_MSG("%a written as %s, %s is shorter", d, buf, ref);
+                break;
+            }
+        }
+    }
+
+    len = flb_dtoa(NAN, 15, buf);
+    TEST_CHECK(len == 3 && memcmp(buf, "nan", 3) == 0);
+    len = flb_dtoa(-INFINITY, 15, buf);
+    TEST_CHECK(len == 4 && memcmp(buf, "-inf", 4) == 0);
+    len = flb_dtoa(5e-324, 15, buf);
+    TEST_CHECK(len == 6 && memcmp(buf, "5e-324", 6) == 0);
+}
+
 TEST_LIST = {
     /* JSON maps iteration */
     { "json_pack"          , test_json_pack },
@@ -635,6 +980,11 @@ TEST_LIST = {
     { "json_dup_keys"      , test_json_dup_keys},
     { "json_pack_bug342"   , test_json_pack_bug342},
     { "json_pack_bug1278"  , test_json_pack_bug1278},
+    { "json_format_cb"     , test_json_format_cb},
+    { "json_pack_fast"     , test_json_pack_fast},
+    { "json_pack_fast_key" , test_json_pack_fast_key},
+    { "json_encode"        , test_json_encode},
+    { "dtoa"               , test_dtoa},
 
     /* Mixed bytes, check JSON encoding */
     { "utf8_to_json", test_utf8_to_json},
@@ -1,6 +1,11 @@
 /* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
 
 #include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_input.h>
+#include <fluent-bit/flb_output.h>
+#include <fluent-bit/flb_filter.h>
 #include <fluent-bit/flb_router.h>
 
 #include "flb_tests_internal.h"
@@ -42,7 +47,171 @@ void test_router_wildcard()
     }
 }
 
+/* Match rules for the output and filter instances used by the route tests */
+char *route_matches[] = {
+    "*", "cpu.*", "cpu.rpi", "mem.*", "*.rpi", "*u.r*", "kube.var.log.*",
+    "kube.var.log.containers.app*", "kube.*.log.*", "test", "test*", "te",
+    NULL
+};
+
+char *route_tags[] = {
+    "cpu.rpi", "cpu", "cpu.", "mem.local", "test", "tes", "te", "testing",
+    "kube.var.log.containers.app-abc_default_app-123.log",
+    "kube.var.log.containers.db-xyz_default_db-456.log",
+    "kube.other.log.x", "hoge", NULL
+};
+
+void test_router_route_get()
+{
+    int i;
+    int j;
+    int len;
+    int ret;
+    int count;
+    flb_route_mask_element mask[4];
+    struct mk_list *head;
+    struct flb_config *config;
+    struct flb_output_instance *o_ins;
+    struct flb_filter_instance *f_ins;
+    struct flb_filter_instance *filters[64];
+    struct flb_router_route *route;
+
+    config = flb_config_init();
+    if (!TEST_CHECK(config != NULL)) {
+        return;
+    }
+
+    for (i = 0; route_matches[i]; i++) {
+        o_ins = flb_output_new(config, "null", NULL);
+        TEST_CHECK(o_ins != NULL);
+        flb_output_set_property(o_ins, "match", route_matches[i]);
+
+        f_ins = flb_filter_new(config, "stdout", NULL);
+        TEST_CHECK(f_ins != NULL);
+        flb_filter_set_property(f_ins, "match", route_matches[i]);
+    }
+
+    /* Lookup twice: resolve through the trie, then hit the cache */
+    for (j = 0; j < 2; j++) {
+        for (i = 0; route_tags[i]; i++) {
+            len = strlen(route_tags[i]);
+
+            /* Expected routes using the plain wildcard matcher */
+            flb_routes_mask_clear(mask, config->routes_mask_size);
+            mk_list_foreach(head, &config->outputs) {
+                o_ins = mk_list_entry(head, struct flb_output_instance, _head);
+                ret = flb_router_match(route_tags[i], len, o_ins->match, NULL);
+                if (ret) {
+                    flb_routes_mask_set_bit(mask, o_ins->mask_id);
+                }
+            }
+
+            count = 0;
+            mk_list_foreach(head, &config->filters) {
+                f_ins = mk_list_entry(head, struct flb_filter_instance, _head);
+                ret = flb_router_match(route_tags[i], len, f_ins->match, NULL);
+                if (ret) {
+                    filters[count++] = f_ins;
+                }
+            }
+
+            route = flb_router_route_get(route_tags[i], len, config);
+            if (!TEST_CHECK(route != NULL)) {
+                continue;
+            }
+            TEST_CHECK(memcmp(route->routes_mask, mask,
+                              sizeof(flb_route_mask_element) *
+                              config->routes_mask_size) == 0);
+            TEST_MSG("tag=%s", route_tags[i]);
+            TEST_CHECK(route->filters_count == count);
+            if (route->filters_count == count) {
+                TEST_CHECK(memcmp(flb_router_route_filters(route), filters,
+                                  sizeof(struct flb_filter_instance *) * count)
+                           == 0);
+            }
+        }
+    }
+
+    /* Tags are not required to be NULL terminated */
+    route = flb_router_route_get("cpu.rpi.tail", 7, config);
+    TEST_CHECK(route != NULL && route->filters_count == 5);
+
+    flb_router_destroy(config->router);
+    config->router = NULL;
+
+    flb_filter_exit(config);
+    flb_output_exit(config);
+    flb_config_exit(config);
+}
+
+/* More output instances than bits in a 64-bit integer */
+void test_router_routes_mask()
+{
+    int i;
+    int ret;
+    int outputs = 200;
+    char tmp[32];
+    struct flb_config *config;
+    struct flb_output_instance *o_ins;
+    struct flb_input_instance *i_ins;
+    flb_route_mask_element *mask;
+
+    config = flb_config_init();
+    if (!TEST_CHECK(config != NULL)) {
+        return;
+    }
+
+    i_ins = flb_input_new(config, "dummy", NULL, FLB_FALSE);
+    TEST_CHECK(i_ins != NULL);
+
+    for (i = 0; i < outputs; i++) {
+        o_ins = flb_output_new(config, "null", NULL);
+        TEST_CHECK(o_ins != NULL);
+        TEST_CHECK(o_ins->mask_id == i);
+
+        /* every third instance matches everything */
+        if (i % 3 == 0) {
+            flb_output_set_property(o_ins, "match", "*");
+        }
+        else {
+            snprintf(tmp, sizeof(tmp) - 1, "tag.%i", i);
+            flb_output_set_property(o_ins, "match", tmp);
+        }
+    }
+    TEST_CHECK(config->routes_mask_size == FLB_ROUTES_MASK_ELEMENTS(outputs));
+
+    mask = flb_calloc(config->routes_mask_size,
+                      sizeof(flb_route_mask_element));
+    TEST_CHECK(mask != NULL);
+
+    ret = flb_router_get_routes_mask_by_tag("tag.131", 7, i_ins, mask);
+    TEST_CHECK(ret == ((outputs + 2) / 3) + 1);
+    TEST_CHECK(flb_routes_mask_get_bit(mask, 131) == 1);
+    TEST_CHECK(flb_routes_mask_get_bit(mask, 132) == 1);
+    TEST_CHECK(flb_routes_mask_get_bit(mask, 133) == 0);
+    TEST_CHECK(flb_routes_mask_get_bit(mask, 199) == 0);
+
+    flb_routes_mask_clear_bit(mask, 131);
+    TEST_CHECK(flb_routes_mask_popcount(mask, config->routes_mask_size) ==
+               (outputs + 2) / 3);
+
+    ret = flb_router_get_routes_mask_by_tag("none", 4, i_ins, mask);
+    TEST_CHECK(ret == (outputs + 2) / 3);
+    flb_routes_mask_clear(mask, config->routes_mask_size);
+    TEST_CHECK(flb_routes_mask_is_empty(mask, config->routes_mask_size));
+
+    flb_free(mask);
+    flb_router_destroy(config->router);
+    config->router = NULL;
+
+    flb_input_exit_all(config);
+    flb_output_exit(config);
+    flb_config_exit(config);
+}
+
 TEST_LIST = {
-    { "wildcard", test_router_wildcard},
+    { "wildcard" , test_router_wildcard},
+    { "route_get", test_router_route_get},
+    { "routes_mask", test_router_routes_mask},
     { 0 }
 };
@@ -0,0 +1,246 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_engine.h>
+#include <fluent-bit/flb_scheduler.h>
+#include <fluent-bit/flb_time.h>
+#include <fluent-bit/flb_utils.h>
+
+#include <dirent.h>
+
+#include "flb_tests_internal.h"
+
+#define N_TIMERS 10000
+
+struct sched_test {
+    int fired;
+    int order[8];
+    int perm;
+    struct mk_event timer;
+    struct flb_sched *sched;
+    struct flb_config *config;
+};
+
+struct oneshot {
+    int id;
+    struct sched_test *t;
+};
+
+static int fd_count()
+{
+    int n = 0;
+    DIR *dir;
+
+    dir = opendir("/proc/self/fd");
+    if (!dir) {
+        return -1;
+    }
+    while (readdir(dir)) {
+        n++;
+    }
+    closedir(dir);
+    return n;
+}
+
+static double now_ms()
+{
+    struct flb_time tm;
+
+    flb_time_get(&tm);
+    return flb_time_to_double(&tm) * 1000;
+}
+
+static int sched_test_create(struct sched_test *t)
+{
+    memset(t, 0, sizeof(struct sched_test));
+
+    t->config = flb_config_init();
+    t->config->evl = mk_event_loop_create(16);
+    TEST_CHECK(t->config->evl != NULL);
+
+    /* wake up the loop even if the scheduler has nothing to do */
+    MK_EVENT_ZERO(&t->timer);
+    mk_event_timeout_create(t->config->evl, 0, 20000000, &t->timer);
+
+    if (flb_sched_init(t->config) == -1) {
+        return -1;
+    }
+    t->sched = t->config->sched;
+
+    return 0;
+}
+
+/* Dispatch the scheduler events for 'ms' milliseconds */
+static void sched_run(struct sched_test *t, int ms)
+{
+    double end;
+    struct mk_event *event;
+
+    end = now_ms() + ms;
+    while (now_ms() < end) {
+        mk_event_wait(t->config->evl);
+        mk_event_foreach(event, t->config->evl) {
+            if (event == &t->timer) {
+                flb_utils_timer_consume(event->fd);
+            }
+            else if (event->type & FLB_ENGINE_EV_SCHED) {
+                flb_sched_event_handler(t->config, event);
+            }
+        }
+        flb_sched_timer_cleanup(t->sched);
+    }
+}
+
+static void sched_test_destroy(struct sched_test *t)
+{
+    mk_event_timeout_destroy(t->config->evl, &t->timer);
+    close(t->timer.fd);
+    flb_config_exit(t->config);
+}
+
+static void cb_oneshot(struct flb_config *config, void *data)
+{
+    struct oneshot *o = data;
+
+    if (o->t->fired < 8) {
+        o->t->order[o->t->fired] = o->id;
+    }
+    o->t->fired++;
+}
+
+static void cb_perm(struct flb_config *config, void *data)
+{
+    struct sched_test *t = data;
+
+    t->perm++;
+}
+
+void test_callbacks()
+{
+    int i;
+    int ret;
+    int delays[] = {120, 30, 75, 5};
+    struct oneshot o[4];
+    struct sched_test t;
+
+    ret = sched_test_create(&t);
+    TEST_CHECK(ret == 0);
+
+    for (i = 0; i < 4; i++) {
+        o[i].id = i;
+        o[i].t = &t;
+        ret = flb_sched_timer_cb_create(t.config, FLB_SCHED_TIMER_CB_ONESHOT,
+                                        delays[i], cb_oneshot, &o[i]);
+        TEST_CHECK(ret == 0);
+    }
+
+    ret = flb_sched_timer_cb_create(t.config, FLB_SCHED_TIMER_CB_PERM,
+                                    20, cb_perm, &t);
+    TEST_CHECK(ret == 0);
+
+    /* a permanent timer needs an interval */
+    ret = flb_sched_timer_cb_create(t.config, FLB_SCHED_TIMER_CB_PERM,
+                                    0, cb_perm, &t);
+    TEST_CHECK(ret == -1);
+
+    sched_run(&t, 210);
+
+    /* one-shot timers run once, in order of expiration */
+    TEST_CHECK(t.fired == 4);
+    TEST_CHECK(t.order[0] == 3 && t.order[1] == 1 &&
+               t.order[2] == 2 && t.order[3] == 0);
+    TEST_CHECK(mk_list_size(&t.sched->timers) == 1);
+
+    TEST_CHECK(t.perm >= 8 && t.perm <= 11);
+    TEST_MSG("permanent timer runs: %i", t.perm);
+
+    sched_test_destroy(&t);
+}
+
+void test_many_timers()
+{
+    int i;
+    int fds;
+    int ret;
+    struct oneshot *o;
+    struct sched_test t;
+
+    ret = sched_test_create(&t);
+    TEST_CHECK(ret == 0);
+
+    o = flb_malloc(sizeof(struct oneshot) * N_TIMERS);
+    TEST_CHECK(o != NULL);
+
+    /* timers don't own a file descriptor */
+    fds = fd_count();
+    for (i = 0; i < N_TIMERS; i++) {
+        o[i].id = i;
+        o[i].t = &t;
+        ret = flb_sched_timer_cb_create(t.config, FLB_SCHED_TIMER_CB_ONESHOT,
+                                        (i * 7) % 150, cb_oneshot, &o[i]);
+        TEST_CHECK(ret == 0);
+    }
+    TEST_CHECK(fd_count() == fds);
+
+    sched_run(&t, 200);
+    TEST_CHECK(t.fired == N_TIMERS);
+    TEST_MSG("fired: %i", t.fired);
+    TEST_CHECK(mk_list_size(&t.sched->timers) == 0);
+
+    flb_free(o);
+    sched_test_destroy(&t);
+}
+
+void test_retry_requests()
+{
+    int i;
+    int fds;
+    int ret;
+    struct sched_test t;
+    struct flb_task_retry *retries;
+
+    ret = sched_test_create(&t);
+    TEST_CHECK(ret == 0);
+
+    retries = flb_calloc(N_TIMERS, sizeof(struct flb_task_retry));
+    TEST_CHECK(retries != NULL);
+
+    fds = fd_count();
+    for (i = 0; i < N_TIMERS; i++) {
+        ret = flb_sched_request_create(t.config, &retries[i], 1 + (i % 12));
+        TEST_CHECK(ret > FLB_SCHED_BASE);
+        TEST_CHECK(retries[i].request != NULL);
+    }
+    TEST_CHECK(fd_count() == fds);
+    TEST_CHECK(mk_list_size(&t.sched->requests) == N_TIMERS);
+
+    /* scheduling a retry again replaces the pending request */
+    ret = flb_sched_request_create(t.config, &retries[0], 2);
+    TEST_CHECK(ret > 0);
+    TEST_CHECK(mk_list_size(&t.sched->requests) == N_TIMERS);
+
+    for (i = 0; i < N_TIMERS; i++) {
+        ret = flb_sched_request_invalidate(t.config, &retries[i]);
+        TEST_CHECK(ret == 0);
+        TEST_CHECK(retries[i].request == NULL);
+    }
+    TEST_CHECK(mk_list_size(&t.sched->requests) == 0);
+
+    ret = flb_sched_request_invalidate(t.config, &retries[0]);
+    TEST_CHECK(ret == -1);
+
+    flb_sched_timer_cleanup(t.sched);
+    TEST_CHECK(mk_list_size(&t.sched->timers) == 0);
+
+    flb_free(retries);
+    sched_test_destroy(&t);
+}
+
+TEST_LIST = {
+    { "callbacks",      test_callbacks},
+    { "many_timers",    test_many_timers},
+    { "retry_requests", test_retry_requests},
+    { 0 }
+};
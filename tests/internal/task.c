@@ -0,0 +1,210 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit.h>
+#include <fluent-bit/flb_input_chunk.h>
+#include <fluent-bit/flb_storage.h>
+#include <fluent-bit/flb_task.h>
+#include "flb_tests_internal.h"
+
+#define N_TASKS  300
+
+struct task_test {
+    struct flb_config *config;
+    struct flb_input_instance *i_ins;
+    msgpack_sbuffer mp_sbuf;
+};
+
+static int task_test_create(struct task_test *t, int tasks_max)
+{
+    int ret;
+    msgpack_packer mp_pck;
+    struct flb_output_instance *o_ins;
+
+    memset(t, 0, sizeof(struct task_test));
+
+    t->config = flb_config_init();
+    if (!TEST_CHECK(t->config != NULL)) {
+        return -1;
+    }
+    t->config->tasks_max = tasks_max;
+
+    t->i_ins = flb_input_new(t->config, "dummy", NULL, FLB_TRUE);
+    TEST_CHECK(t->i_ins != NULL);
+    t->i_ins->log_level = FLB_LOG_ERROR;
+    ret = flb_input_instance_init(t->i_ins, t->config);
+    TEST_CHECK(ret == 0);
+
+    o_ins = flb_output_new(t->config, "null", NULL);
+    TEST_CHECK(o_ins != NULL);
+    flb_output_set_property(o_ins, "match", "*");
+
+    ret = flb_storage_create(t->config);
+    TEST_CHECK(ret == 0);
+
+    /* record: [1, {"key": "val"}] */
+    msgpack_sbuffer_init(&t->mp_sbuf);
+    msgpack_packer_init(&mp_pck, &t->mp_sbuf, msgpack_sbuffer_write);
+    msgpack_pack_array(&mp_pck, 2);
+    msgpack_pack_uint64(&mp_pck, 1);
+    msgpack_pack_map(&mp_pck, 1);
+    msgpack_pack_str(&mp_pck, 3);
+    msgpack_pack_str_body(&mp_pck, "key", 3);
+    msgpack_pack_str(&mp_pck, 3);
+    msgpack_pack_str_body(&mp_pck, "val", 3);
+
+    return 0;
+}
+
+/* Create a task for a new chunk, every call uses a different Tag */
+static struct flb_task *task_new(struct task_test *t, int n, int *err)
+{
+    int ret;
+    int len;
+    char tag[32];
+    size_t size;
+    const void *buf;
+    struct flb_input_chunk *ic;
+
+    len = snprintf(tag, sizeof(tag) - 1, "app.%i", n);
+    ret = flb_input_chunk_append_raw(t->i_ins, tag, len,
+                                     t->mp_sbuf.data, t->mp_sbuf.size);
+    TEST_CHECK(ret == 0);
+
+    ic = mk_list_entry_last(&t->i_ins->chunks, struct flb_input_chunk, _head);
+    buf = flb_input_chunk_flush(ic, &size);
+    TEST_CHECK(buf != NULL);
+
+    return flb_task_create(0, buf, size, t->i_ins, ic, tag, len,
+                           t->config, err);
+}
+
+static void task_test_destroy(struct task_test *t)
+{
+    struct mk_list *tmp;
+    struct mk_list *head;
+    struct flb_task *task;
+    struct flb_input_chunk *ic;
+
+    mk_list_foreach_safe(head, tmp, &t->i_ins->tasks) {
+        task = mk_list_entry(head, struct flb_task, _head);
+        flb_task_destroy(task, FLB_TRUE);
+    }
+    mk_list_foreach_safe(head, tmp, &t->i_ins->chunks) {
+        ic = mk_list_entry(head, struct flb_input_chunk, _head);
+        flb_input_chunk_destroy(ic, FLB_TRUE);
+    }
+
+    msgpack_sbuffer_destroy(&t->mp_sbuf);
+    flb_storage_destroy(t->config);
+    flb_input_exit_all(t->config);
+    flb_output_exit(t->config);
+    flb_config_exit(t->config);
+}
+
+/* The map grows beyond its initial size, ids are unique */
+void test_map_grow()
+{
+    int i;
+    int err;
+    struct task_test t;
+    struct flb_task *tasks[N_TASKS];
+
+    if (task_test_create(&t, 0) == -1) {
+        return;
+    }
+
+    for (i = 0; i < N_TASKS; i++) {
+        tasks[i] = task_new(&t, i, &err);
+        if (!TEST_CHECK(tasks[i] != NULL && err == FLB_FALSE)) {
+            break;
+        }
+        TEST_CHECK(tasks[i]->id == i);
+        TEST_MSG("task %i got id %i", i, tasks[i]->id);
+    }
+    TEST_CHECK(t.config->tasks_map_size >= N_TASKS);
+
+    /* tasks moved by the growth are still found */
+    for (i = 0; i < N_TASKS && tasks[i]; i++) {
+        TEST_CHECK(flb_task_get(t.config, i, tasks[i]->gen) == tasks[i]);
+    }
+    TEST_CHECK(flb_task_get(t.config, -1, 0) == NULL);
+    TEST_CHECK(flb_task_get(t.config, t.config->tasks_map_size, 0) == NULL);
+
+    task_test_destroy(&t);
+}
+
+/* A released id is reused with a new generation */
+void test_id_reuse()
+{
+    int i;
+    int id;
+    int err;
+    int gen;
+    struct task_test t;
+    struct flb_task *task;
+    struct flb_task *tasks[16];
+
+    if (task_test_create(&t, 0) == -1) {
+        return;
+    }
+
+    for (i = 0; i < 16; i++) {
+        tasks[i] = task_new(&t, i, &err);
+        TEST_CHECK(tasks[i] != NULL);
+    }
+
+    id = tasks[5]->id;
+    gen = tasks[5]->gen;
+    flb_task_destroy(tasks[5], FLB_TRUE);
+    TEST_CHECK(flb_task_get(t.config, id, gen) == NULL);
+
+    task = task_new(&t, 16, &err);
+    TEST_CHECK(task != NULL);
+    TEST_CHECK(task->id == id);
+    TEST_CHECK(task->gen == (uint16_t) (gen + 1));
+
+    /* the old generation of the id must not resolve to the new task */
+    TEST_CHECK(flb_task_get(t.config, id, gen) == NULL);
+    TEST_CHECK(flb_task_get(t.config, id, task->gen) == task);
+
+    task_test_destroy(&t);
+}
+
+/* No more tasks than 'tasks.max' can exist at the same time */
+void test_tasks_max()
+{
+    int i;
+    int err;
+    struct task_test t;
+    struct flb_task *task;
+
+    if (task_test_create(&t, 10) == -1) {
+        return;
+    }
+
+    for (i = 0; i < 10; i++) {
+        task = task_new(&t, i, &err);
+        TEST_CHECK(task != NULL && err == FLB_FALSE);
+    }
+    TEST_CHECK(t.config->tasks_map_size == 10);
+
+    task = task_new(&t, 10, &err);
+    TEST_CHECK(task == NULL);
+    TEST_CHECK(err == FLB_TRUE);
+
+    /* room again once a task is released */
+    task = mk_list_entry_first(&t.i_ins->tasks, struct flb_task, _head);
+    flb_task_destroy(task, FLB_TRUE);
+
+    task = task_new(&t, 11, &err);
+    TEST_CHECK(task != NULL && err == FLB_FALSE);
+
+    task_test_destroy(&t);
+}
+
+TEST_LIST = {
+    { "map_grow",  test_map_grow},
+    { "id_reuse",  test_id_reuse},
+    { "tasks_max", test_tasks_max},
+    { 0 }
+};
@@ -0,0 +1,286 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_upstream_ha.h>
+
+#include "flb_tests_internal.h"
+
+#define UPSTREAM_FILE    FLB_TESTS_DATA_PATH "/data/upstream_ha/balance.conf"
+#define UPSTREAM_INVALID FLB_TESTS_DATA_PATH \
+    "/data/upstream_ha/invalid_balance.conf"
+
+static struct flb_upstream_ha *ha_create(struct flb_config *config,
+                                         struct flb_upstream_node **nodes)
+{
+    int i = 0;
+    struct mk_list *head;
+    struct flb_upstream_ha *ha;
+
+    ha = flb_upstream_ha_from_file(UPSTREAM_FILE, config);
+    TEST_CHECK(ha != NULL);
+    if (!ha) {
+        return NULL;
+    }
+
+    mk_list_foreach(head, &ha->nodes) {
+        nodes[i++] = mk_list_entry(head, struct flb_upstream_node, _head);
+    }
+    TEST_CHECK(i == 3);
+
+    return ha;
+}
+
+/* Move the start of a request back in time */
+static void start_ago(struct flb_time *start, int ms)
+{
+    flb_time_get(start);
+    start->tm.tv_sec -= ms / 1000;
+    start->tm.tv_nsec -= (ms % 1000) * 1000000;
+    if (start->tm.tv_nsec < 0) {
+        start->tm.tv_sec--;
+        start->tm.tv_nsec += 1000000000;
+    }
+}
+
+void test_from_file()
+{
+    struct flb_config *config;
+    struct flb_upstream_ha *ha;
+    struct flb_upstream_node *nodes[3];
+
+    config = flb_config_init();
+
+    ha = ha_create(config, nodes);
+    TEST_CHECK(ha->balance == FLB_UPSTREAM_HA_LEAST_OUTSTANDING);
+    TEST_CHECK(ha->max_fails == 2);
+    TEST_CHECK(ha->fail_timeout == 30);
+    flb_upstream_ha_destroy(ha);
+
+    ha = flb_upstream_ha_from_file(UPSTREAM_INVALID, config);
+    TEST_CHECK(ha == NULL);
+
+    flb_config_exit(config);
+}
+
+void test_round_robin()
+{
+    int i;
+    struct flb_config *config;
+    struct flb_upstream_ha *ha;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *nodes[3];
+
+    config = flb_config_init();
+    ha = ha_create(config, nodes);
+    ha->balance = FLB_UPSTREAM_HA_ROUND_ROBIN;
+
+    for (i = 0; i < 6; i++) {
+        node = flb_upstream_ha_node_get(ha);
+        TEST_CHECK(node == nodes[i % 3]);
+    }
+
+    /* ejected nodes are skipped */
+    nodes[1]->ejected = FLB_TRUE;
+    nodes[1]->ejected_until = time(NULL) + 60;
+    for (i = 0; i < 4; i++) {
+        node = flb_upstream_ha_node_get(ha);
+        TEST_CHECK(node != nodes[1]);
+    }
+
+    flb_upstream_ha_destroy(ha);
+    flb_config_exit(config);
+}
+
+void test_least_outstanding()
+{
+    struct flb_time start[3];
+    struct flb_config *config;
+    struct flb_upstream_ha *ha;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *nodes[3];
+
+    config = flb_config_init();
+    ha = ha_create(config, nodes);
+
+    /* two requests in flight on the first node, one on the second */
+    flb_upstream_ha_node_begin(ha, nodes[0], &start[0]);
+    flb_upstream_ha_node_begin(ha, nodes[0], &start[1]);
+    flb_upstream_ha_node_begin(ha, nodes[1], &start[2]);
+
+    node = flb_upstream_ha_node_get(ha);
+    TEST_CHECK(node == nodes[2]);
+    flb_upstream_ha_node_begin(ha, node, &start[2]);
+    TEST_CHECK(nodes[2]->outstanding == 1);
+
+    /* second and third are tied, first is still the busiest */
+    node = flb_upstream_ha_node_get(ha);
+    TEST_CHECK(node == nodes[1] || node == nodes[2]);
+
+    flb_upstream_ha_node_end(ha, nodes[0], &start[0], FLB_TRUE);
+    flb_upstream_ha_node_end(ha, nodes[0], &start[1], FLB_TRUE);
+    TEST_CHECK(nodes[0]->outstanding == 0);
+
+    node = flb_upstream_ha_node_get(ha);
+    TEST_CHECK(node == nodes[0]);
+
+    flb_upstream_ha_destroy(ha);
+    flb_config_exit(config);
+}
+
+void test_ewma()
+{
+    int i;
+    int hits[3] = {0};
+    struct flb_time start;
+    struct flb_config *config;
+    struct flb_upstream_ha *ha;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *nodes[3];
+
+    config = flb_config_init();
+    ha = ha_create(config, nodes);
+    ha->balance = FLB_UPSTREAM_HA_EWMA;
+
+    /* the second node answers in ~500ms, the others in ~10ms */
+    for (i = 0; i < 3; i++) {
+        flb_upstream_ha_node_begin(ha, nodes[i], &start);
+        start_ago(&start, i == 1 ? 500 : 10);
+        flb_upstream_ha_node_end(ha, nodes[i], &start, FLB_TRUE);
+    }
+    TEST_CHECK(nodes[1]->ewma_latency > nodes[0]->ewma_latency * 10);
+
+    for (i = 0; i < 300; i++) {
+        node = flb_upstream_ha_node_get(ha);
+        hits[node == nodes[0] ? 0 : node == nodes[1] ? 1 : 2]++;
+    }
+
+    /* with two choices the slowest node is never picked */
+    TEST_CHECK(hits[1] == 0);
+    TEST_CHECK(hits[0] > 50 && hits[2] > 50);
+    TEST_MSG("hits: %i %i %i", hits[0], hits[1], hits[2]);
+
+    /* a node failing fast must not look cheaper than a slow one */
+    flb_upstream_ha_node_begin(ha, nodes[2], &start);
+    flb_upstream_ha_node_end(ha, nodes[2], &start, FLB_FALSE);
+    TEST_CHECK(nodes[2]->ewma_latency > nodes[1]->ewma_latency);
+
+    memset(hits, 0, sizeof(hits));
+    for (i = 0; i < 300; i++) {
+        node = flb_upstream_ha_node_get(ha);
+        hits[node == nodes[0] ? 0 : node == nodes[1] ? 1 : 2]++;
+    }
+    TEST_CHECK(hits[2] == 0);
+    TEST_MSG("hits: %i %i %i", hits[0], hits[1], hits[2]);
+
+    flb_upstream_ha_destroy(ha);
+    flb_config_exit(config);
+}
+
+void test_tag_hash()
+{
+    int i;
+    int len;
+    int moved = 0;
+    char tag[32];
+    struct flb_config *config;
+    struct flb_upstream_ha *ha;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *before[100];
+    struct flb_upstream_node *nodes[3];
+
+    config = flb_config_init();
+    ha = ha_create(config, nodes);
+    ha->balance = FLB_UPSTREAM_HA_TAG_HASH;
+
+    for (i = 0; i < 100; i++) {
+        len = snprintf(tag, sizeof(tag), "kube.app-%i", i);
+        before[i] = flb_upstream_ha_node_get_key(ha, tag, len);
+        TEST_CHECK(before[i] != NULL);
+
+        /* affinity: same tag, same node */
+        node = flb_upstream_ha_node_get_key(ha, tag, len);
+        TEST_CHECK(node == before[i]);
+    }
+
+    /* only the tags of an ejected node move */
+    nodes[0]->ejected = FLB_TRUE;
+    nodes[0]->ejected_until = time(NULL) + 60;
+    for (i = 0; i < 100; i++) {
+        len = snprintf(tag, sizeof(tag), "kube.app-%i", i);
+        node = flb_upstream_ha_node_get_key(ha, tag, len);
+        TEST_CHECK(node != nodes[0]);
+        if (before[i] != nodes[0]) {
+            TEST_CHECK(node == before[i]);
+        }
+        else {
+            moved++;
+        }
+    }
+    TEST_CHECK(moved > 10 && moved < 60);
+    TEST_MSG("moved: %i", moved);
+
+    flb_upstream_ha_destroy(ha);
+    flb_config_exit(config);
+}
+
+void test_passive_health()
+{
+    int i;
+    struct flb_time start;
+    struct flb_config *config;
+    struct flb_upstream_ha *ha;
+    struct flb_upstream_node *node;
+    struct flb_upstream_node *nodes[3];
+
+    config = flb_config_init();
+    ha = ha_create(config, nodes);
+    ha->balance = FLB_UPSTREAM_HA_ROUND_ROBIN;
+
+    /* a success resets the failures count */
+    flb_upstream_ha_node_begin(ha, nodes[0], &start);
+    flb_upstream_ha_node_end(ha, nodes[0], &start, FLB_FALSE);
+    flb_upstream_ha_node_begin(ha, nodes[0], &start);
+    flb_upstream_ha_node_end(ha, nodes[0], &start, FLB_TRUE);
+    TEST_CHECK(nodes[0]->fails == 0 && nodes[0]->ejected == FLB_FALSE);
+
+    /* max_fails consecutive failures eject the node */
+    for (i = 0; i < 2; i++) {
+        flb_upstream_ha_node_begin(ha, nodes[0], &start);
+        flb_upstream_ha_node_end(ha, nodes[0], &start, FLB_FALSE);
+    }
+    TEST_CHECK(nodes[0]->ejected == FLB_TRUE);
+
+    for (i = 0; i < 4; i++) {
+        node = flb_upstream_ha_node_get(ha);
+        TEST_CHECK(node != nodes[0]);
+    }
+
+    /* every node failed: they are still used */
+    nodes[1]->ejected = FLB_TRUE;
+    nodes[1]->ejected_until = time(NULL) + 60;
+    nodes[2]->ejected = FLB_TRUE;
+    nodes[2]->ejected_until = time(NULL) + 60;
+    node = flb_upstream_ha_node_get(ha);
+    TEST_CHECK(node != NULL);
+
+    /* back in the rotation once the timeout expired */
+    nodes[0]->ejected_until = time(NULL) - 1;
+    node = flb_upstream_ha_node_get(ha);
+    TEST_CHECK(node == nodes[0]);
+    TEST_CHECK(nodes[0]->ejected == FLB_FALSE);
+
+    flb_upstream_ha_destroy(ha);
+    flb_config_exit(config);
+}
+
+TEST_LIST = {
+    { "from_file",         test_from_file},
+    { "round_robin",       test_round_robin},
+    { "least_outstanding", test_least_outstanding},
+    { "ewma",              test_ewma},
+    { "tag_hash",          test_tag_hash},
+    { "passive_health",    test_passive_health},
+    { 0 }
+};
@@ -0,0 +1,193 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+
+#include <fluent-bit/flb_info.h>
+#include <fluent-bit/flb_mem.h>
+#include <fluent-bit/flb_config.h>
+#include <fluent-bit/flb_network.h>
+#include <fluent-bit/flb_socket.h>
+#include <fluent-bit/flb_utils.h>
+#include <fluent-bit/flb_upstream.h>
+
+#include "flb_tests_internal.h"
+
+struct pool_test {
+    int port;
+    flb_sockfd_t server;
+    struct mk_event timer;
+    struct flb_config *config;
+    struct flb_upstream *u;
+};
+
+static int pool_test_create(struct pool_test *t)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+
+    memset(t, 0, sizeof(struct pool_test));
+
+    /* listen on any free port, the kernel accepts for us */
+    t->server = flb_net_server("0", "127.0.0.1");
+    TEST_CHECK(t->server != -1);
+    if (t->server == -1) {
+        return -1;
+    }
+    getsockname(t->server, (struct sockaddr *) &addr, &len);
+    t->port = ntohs(addr.sin_port);
+
+    t->config = flb_config_init();
+    t->config->evl = mk_event_loop_create(16);
+    TEST_CHECK(t->config->evl != NULL);
+
+    /* don't wait forever for events that never come */
+    MK_EVENT_ZERO(&t->timer);
+    mk_event_timeout_create(t->config->evl, 1, 0, &t->timer);
+
+    t->u = flb_upstream_create(t->config, "127.0.0.1", t->port,
+                               FLB_IO_TCP, NULL);
+    TEST_CHECK(t->u != NULL);
+    if (!t->u) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void pool_test_destroy(struct pool_test *t)
+{
+    flb_upstream_destroy(t->u);
+    mk_event_timeout_destroy(t->config->evl, &t->timer);
+    flb_socket_close(t->server);
+    flb_config_exit(t->config);
+}
+
+/* Run the event loop until no background connection is pending */
+static void pool_run(struct pool_test *t)
+{
+    int i;
+    struct mk_event *event;
+
+    for (i = 0; i < 10 && mk_list_size(&t->u->prewarm_queue) > 0; i++) {
+        mk_event_wait(t->config->evl);
+        mk_event_foreach(event, t->config->evl) {
+            if (event == &t->timer) {
+                flb_utils_timer_consume(event->fd);
+                continue;
+            }
+            event->handler(event);
+        }
+    }
+    flb_upstream_conn_pending_destroy(&t->config->upstreams);
+}
+
+void test_prewarm()
+{
+    int ret;
+    struct pool_test t;
+    struct flb_upstream_conn *conn;
+    struct flb_upstream_stats stats;
+
+    ret = pool_test_create(&t);
+    if (ret == -1) {
+        return;
+    }
+    t.u->net.min_idle_connections = 2;
+
+    /* nothing is opened until a connection has been requested */
+    flb_upstream_conn_timeouts(&t.config->upstreams);
+    TEST_CHECK(mk_list_size(&t.u->prewarm_queue) == 0);
+
+    conn = flb_upstream_conn_get(t.u);
+    TEST_CHECK(conn != NULL);
+    flb_upstream_conn_release(conn);
+    TEST_CHECK(mk_list_size(&t.u->av_queue) == 1);
+
+    /* one more to reach the minimum */
+    flb_upstream_conn_timeouts(&t.config->upstreams);
+    TEST_CHECK(mk_list_size(&t.u->prewarm_queue) == 1);
+    pool_run(&t);
+    TEST_CHECK(mk_list_size(&t.u->av_queue) == 2);
+    TEST_CHECK(t.u->n_connections == 2);
+
+    /* the statistics are published by the timeouts check */
+    conn = flb_upstream_conn_get(t.u);
+    TEST_CHECK(conn != NULL);
+    flb_upstream_conn_timeouts(&t.config->upstreams);
+    flb_upstream_stats_get(t.u, &stats);
+    TEST_CHECK(stats.busy == 1);
+    TEST_CHECK(stats.connects == 2);
+    TEST_MSG("idle=%zu busy=%zu connects=%zu",
+             stats.idle, stats.busy, stats.connects);
+
+    /* the background connection is ready to be used */
+    TEST_CHECK(mk_list_size(&t.u->prewarm_queue) == 1);
+    pool_run(&t);
+    flb_upstream_conn_release(conn);
+    TEST_CHECK(mk_list_size(&t.u->av_queue) == 3);
+
+    pool_test_destroy(&t);
+}
+
+void test_max_connections()
+{
+    int ret;
+    struct pool_test t;
+    struct flb_upstream_conn *conn;
+
+    ret = pool_test_create(&t);
+    if (ret == -1) {
+        return;
+    }
+    t.u->net.min_idle_connections = 4;
+    t.u->net.max_connections = 2;
+
+    conn = flb_upstream_conn_get(t.u);
+    TEST_CHECK(conn != NULL);
+
+    /* the pool never goes over the limit */
+    flb_upstream_conn_timeouts(&t.config->upstreams);
+    pool_run(&t);
+    TEST_CHECK(t.u->n_connections == 2);
+    TEST_CHECK(mk_list_size(&t.u->av_queue) == 1);
+
+    flb_upstream_conn_release(conn);
+    flb_upstream_conn_timeouts(&t.config->upstreams);
+    TEST_CHECK(mk_list_size(&t.u->prewarm_queue) == 0);
+    TEST_CHECK(mk_list_size(&t.u->av_queue) == 2);
+
+    pool_test_destroy(&t);
+}
+
+void test_prewarm_failure()
+{
+    int ret;
+    struct pool_test t;
+    struct flb_upstream_conn *conn;
+
+    ret = pool_test_create(&t);
+    if (ret == -1) {
+        return;
+    }
+    t.u->net.min_idle_connections = 1;
+
+    conn = flb_upstream_conn_get(t.u);
+    TEST_CHECK(conn != NULL);
+
+    /* nobody listens anymore */
+    flb_socket_close(t.server);
+    t.server = flb_net_server("0", "127.0.0.1");
+    flb_upstream_conn_timeouts(&t.config->upstreams);
+    pool_run(&t);
+    TEST_CHECK(mk_list_size(&t.u->prewarm_queue) == 0);
+    TEST_CHECK(mk_list_size(&t.u->av_queue) == 0);
+    TEST_CHECK(t.u->n_connections == 1);
+
+    flb_upstream_conn_release(conn);
+    pool_test_destroy(&t);
+}
+
+TEST_LIST = {
+    { "prewarm",          test_prewarm},
+    { "max_connections",  test_max_connections},
+    { "prewarm_failure",  test_prewarm_failure},
+    { 0 }
+};
@@ -12,12 +12,14 @@
 void flb_test_null_json_invalid(void);
 void flb_test_null_json_long(void);
 void flb_test_null_json_small(void);
+void flb_test_null_workers(void);
 
 /* Test list */
 TEST_LIST = {
     {"json_invalid",    flb_test_null_json_invalid },
     {"json_long",       flb_test_null_json_long    },
     {"json_small",      flb_test_null_json_small   },
+    {"workers",         flb_test_null_workers      },
     {NULL, NULL}
 };
 
@@ -125,3 +127,39 @@ void flb_test_null_json_small(void)
     flb_stop(ctx);
     flb_destroy(ctx);
 }
+
+/* Flushes run on two output workers */
+void flb_test_null_workers(void)
+{
+    int i;
+    int ret;
+    int bytes;
+    char *p = (char *) JSON_SMALL;
+    flb_ctx_t *ctx;
+    int in_ffd;
+    int out_ffd;
+
+    ctx = flb_create();
+    flb_service_set(ctx, "Flush", "1", "Grace", "1", "Log_Level", "error", NULL);
+
+    in_ffd = flb_input(ctx, (char *) "lib", NULL);
+    TEST_CHECK(in_ffd >= 0);
+    flb_input_set(ctx, in_ffd, "tag", "test", NULL);
+
+    out_ffd = flb_output(ctx, (char *) "null", NULL);
+    TEST_CHECK(out_ffd >= 0);
+    flb_output_set(ctx, out_ffd, "match", "test", "workers", "2", NULL);
+
+    ret = flb_start(ctx);
+    TEST_CHECK(ret == 0);
+
+    for (i = 0; i < 10; i++) {
+        bytes = flb_lib_push(ctx, in_ffd, p, sizeof(JSON_SMALL) - 1);
+        TEST_CHECK(bytes == sizeof(JSON_SMALL) - 1);
+    }
+
+    sleep(2); /* waiting flush */
+
+    flb_stop(ctx);
+    flb_destroy(ctx);
+}